@@ -297,7 +297,8 @@ Requires: libmemcached
 BuildRequires: libmemcached-devel
 
 %description memcached
-Adds support for rlm_memcached as a cache driver.
+Adds support for rlm_memcached as a cache driver, and the experimental
+memcached_async driver.
 %endif
 
 %package json
@@ -742,6 +743,10 @@ touch $RPM_BUILD_ROOT/var/log/radius/{radutmp,radius.log}
 %endif
 %__rm -rf $RPM_BUILD_ROOT/%{_libdir}/freeradius/rlm_test.so
 
+%if %{without rlm_cache_memcached}
+%__rm -f $RPM_BUILD_ROOT/%{_libdir}/freeradius/rlm_cache_memcached_async.so
+%endif
+
 # remove header files, we don't ship a devel package and the
 # headers have multilib conflicts
 %__rm -rf $RPM_BUILD_ROOT/%{_includedir}
@@ -922,6 +927,7 @@ fi
 %{_libdir}/freeradius/rlm_always.so
 %{_libdir}/freeradius/rlm_attr_filter.so
 %{_libdir}/freeradius/rlm_cache.so
+%{_libdir}/freeradius/rlm_cache_htable.so
 %{_libdir}/freeradius/rlm_cache_rbtree.so
 %{_libdir}/freeradius/rlm_chap.so
 %{_libdir}/freeradius/rlm_cipher.so
@@ -1169,6 +1175,7 @@ fi
 %files memcached
 %defattr(-,root,root)
 %{_libdir}/freeradius/rlm_cache_memcached.so
+%{_libdir}/freeradius/rlm_cache_memcached_async.so
 %endif
 
 %files imap
@@ -0,0 +1,41 @@
+#!/bin/bash -e
+
+#
+# ### This is a script to start a memcached server for testing rlm_cache_memcached_async
+#
+
+BASEDIR=$(git rev-parse --show-toplevel)
+BUILDDIR="${BASEDIR}/build/ci/memcached"
+PIDFILE="${BUILDDIR}/memcached.pid"
+
+MEMCACHED_HOST="${MEMCACHED_HOST:-127.0.0.1}"
+MEMCACHED_PORT="${MEMCACHED_PORT:-11211}"
+
+if [ "$(which memcached)" = '' ]; then
+    echo "Can't find memcached (sudo apt-get install memcached, brew install memcached etc...)"
+    exit 1
+fi
+
+mkdir -p "${BUILDDIR}"
+
+# Stop any instance we started previously
+if [ -e "${PIDFILE}" ]; then
+    kill "$(cat "${PIDFILE}")" 2> /dev/null || true
+    rm -f "${PIDFILE}"
+    sleep 1
+fi
+
+# The tests only use TCP
+memcached -d -l "${MEMCACHED_HOST}" -p "${MEMCACHED_PORT}" -U 0 -m 64 -P "${PIDFILE}"
+
+# Wait for it to accept connections
+for i in $(seq 1 20); do
+    if (exec 3<>"/dev/tcp/${MEMCACHED_HOST}/${MEMCACHED_PORT}") 2> /dev/null; then
+        echo "memcached listening on ${MEMCACHED_HOST}:${MEMCACHED_PORT}"
+        exit 0
+    fi
+    sleep 0.5
+done
+
+echo "memcached failed to start"
+exit 1
@@ -810,6 +810,15 @@ int main(int argc, char *argv[])
 		EXIT_WITH_FAILURE;
 	}
 
+	/*
+	 *	Event lists allocated from here on use the
+	 *	configured backend.
+	 */
+	if (fr_event_backend_set(config->event_backend) < 0) {
+		PERROR("Failed setting event backend");
+		EXIT_WITH_FAILURE;
+	}
+
 	/*
 	 *  Initialize the global event loop which handles things like
 	 *  systemd.
@@ -833,12 +842,16 @@ int main(int argc, char *argv[])
 		schedule->max_workers = config->max_workers;
 		schedule->max_networks = config->max_networks;
 		schedule->stats_interval = config->stats_interval;
+		schedule->timer_wheel_resolution = config->timer_wheel_resolution;
 
 		schedule->network.max_outstanding = config->max_requests;
+		schedule->network.dispatch = config->dispatch;
+		schedule->network.dispatch_max_imbalance = config->dispatch_max_imbalance;
 
 #define COPY(_x) schedule->worker._x = config->_x
 		COPY(max_requests);
 		COPY(max_request_time);
+		COPY(talloc_pool_size);
 
 		/*
 		 *	Single server mode: use the global event list.
@@ -1073,6 +1073,7 @@ int fr_radmin_start(main_config_t *config, bool cli)
 #endif
 
 	fr_command_register_hook = fr_radmin_register;
+	fr_command_unregister_hook = fr_radmin_unregister;
 	radmin_main_config = config;
 
 	if (fr_radmin_register(radmin_ctx, NULL, NULL, cmd_table) < 0) {
@@ -1110,6 +1111,7 @@ void fr_radmin_stop(void)
 	}
 
 	TALLOC_FREE(radmin_ctx);
+	radmin_cmd = NULL;
 }
 
 /*
@@ -1120,6 +1122,13 @@ int fr_radmin_register(UNUSED TALLOC_CTX *talloc_ctx, char const *name, void *ct
 	return fr_command_add_multi(radmin_ctx, &radmin_cmd, name, ctx, table);
 }
 
+void fr_radmin_unregister(char const *name, fr_cmd_table_t *table)
+{
+	if (!radmin_ctx) return;
+
+	fr_command_remove_multi(&radmin_cmd, name, table);
+}
+
 /** Run a command from an input string.
  *
  * @param info used to stor
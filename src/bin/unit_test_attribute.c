@@ -203,6 +203,10 @@ typedef struct {
 	char const		*dict_dir;
 	char const		*fuzzer_dir;		//!< Where to write fuzzer files.
 	CONF_SECTION		*features;		//!< Enabled features.
+
+	uint32_t		benchmark;		//!< How many extra times to run each decode-proto
+							///< command, timing them.  0 to not benchmark.
+	bool			benchmark_compile;	//!< Compile dictionaries before benchmarking.
 } command_config_t;
 
 typedef struct {
@@ -267,6 +271,15 @@ static dl_loader_t	*dl_loader = NULL;
 
 static fr_event_list_t	*el = NULL;
 
+/** Totals for decode-proto benchmarking
+ *
+ */
+static struct {
+	uint64_t		packets;		//!< Packets decoded.
+	uint64_t		bytes;			//!< Bytes decoded.
+	fr_time_delta_t		elapsed;		//!< Time spent decoding.
+} decode_benchmark;
+
 size_t process_line(command_result_t *result, command_file_ctx_t *cc, char *data, size_t data_used, char *in, size_t inlen);
 static int process_file(bool *exit_now, TALLOC_CTX *ctx,
 			command_config_t const *config, const char *root_dir, char const *filename, fr_dlist_head_t *lines);
@@ -1616,6 +1629,46 @@ static size_t command_decode_pair(command_result_t *result, command_file_ctx_t *
 	RETURN_OK(slen);
 }
 
+/** Decode a packet repeatedly, adding the time taken to the benchmark totals
+ *
+ */
+static void decode_proto_benchmark(command_file_ctx_t *cc, fr_test_point_proto_decode_t *tp, void *decode_ctx,
+				   uint8_t const *data, size_t data_len)
+{
+	TALLOC_CTX		*ctx;
+	fr_pair_t		*head;
+	fr_time_t		start;
+	uint32_t		i;
+
+	/*
+	 *	Dictionaries may have changed since they were last
+	 *	compiled, in which case their lookup tables were
+	 *	discarded.  This is a no-op for everything else.
+	 */
+	if (cc->config->benchmark_compile) {
+		fr_dict_global_ctx_iter_t	iter;
+		fr_dict_t			*dict;
+
+		for (dict = fr_dict_global_ctx_iter_init(&iter);
+		     dict;
+		     dict = fr_dict_global_ctx_iter_next(&iter)) (void)fr_dict_compile(dict);
+	}
+
+	MEM(ctx = talloc_new(cc->tmp_ctx));
+	MEM(head = fr_pair_afrom_da(ctx, fr_dict_attr_by_name(NULL, fr_dict_root(fr_dict_internal()), "request")));
+
+	start = fr_time();
+	for (i = 0; i < cc->config->benchmark; i++) {
+		(void)tp->func(head, &head->vp_group, data, data_len, decode_ctx);
+		fr_pair_list_free(&head->vp_group);
+	}
+	decode_benchmark.elapsed = fr_time_delta_add(decode_benchmark.elapsed, fr_time_sub(fr_time(), start));
+	decode_benchmark.packets += cc->config->benchmark;
+	decode_benchmark.bytes += (uint64_t)cc->config->benchmark * data_len;
+
+	talloc_free(ctx);
+}
+
 static size_t command_decode_proto(command_result_t *result, command_file_ctx_t *cc,
 				  char *data, size_t data_used, char *in, size_t inlen)
 {
@@ -1691,6 +1744,15 @@ static size_t command_decode_proto(command_result_t *result, command_file_ctx_t
 	fr_strerror_clear();
 	ASAN_UNPOISON_MEMORY_REGION(to_dec_end, COMMAND_OUTPUT_MAX - slen);
 
+	/*
+	 *	Printing the pairs overwrites the packet,
+	 *	so benchmark before we do.
+	 */
+	if (cc->config->benchmark) {
+		decode_proto_benchmark(cc, tp, decode_ctx, to_dec, to_dec_end - to_dec);
+		fr_strerror_clear();
+	}
+
 	/*
 	 *	Output may be an error, and we ignore
 	 *	it if so.
@@ -3500,6 +3562,7 @@ static void usage(char const *name)
 {
 	INFO("usage: %s [options] (-|<filename>[:<lines>] [ <filename>[:<lines>]])", name);
 	INFO("options:");
+	INFO("  -b <iterations>    Benchmark decode-proto, repeating each decode <iterations> times.");
 	INFO("  -d <raddb>         Set user dictionary path (defaults to " RADDBDIR ").");
 	INFO("  -D <dictdir>       Set main dictionary path (defaults to " DICTDIR ").");
 	INFO("  -x                 Debugging mode.");
@@ -3509,6 +3572,7 @@ static void usage(char const *name)
 	INFO("  -M                 Show talloc memory report.");
 	INFO("  -p                 Allow xlat_purify");
 	INFO("  -r <receipt_file>  Create the <receipt_file> as a 'success' exit.");
+	INFO("  -u                 Don't compile dictionaries before benchmarking.");
 	INFO("Where <filename> is a file containing one or more commands and '-' indicates commands should be read from stdin.");
 	INFO("Ranges of <lines> may be specified in the format <start>[-[<end>]][,]");
 }
@@ -3640,7 +3704,8 @@ int main(int argc, char *argv[])
 
 	command_config_t	config = {
 					.raddb_dir = RADDBDIR,
-					.dict_dir = DICTDIR
+					.dict_dir = DICTDIR,
+					.benchmark_compile = true
 				};
 
 	char const		*name;
@@ -3690,7 +3755,11 @@ int main(int argc, char *argv[])
 	default_log.fd = STDOUT_FILENO;
 	default_log.print_level = false;
 
-	while ((c = getopt(argc, argv, "cd:D:F:fxMhpr:")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "b:cd:D:F:fxMhpr:u")) != -1) switch (c) {
+		case 'b':
+			config.benchmark = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+
 		case 'c':
 			do_commands = true;
 			break;
@@ -3728,6 +3797,10 @@ int main(int argc, char *argv[])
 			allow_purify = true;
 			break;
 
+		case 'u':
+			config.benchmark_compile = false;
+			break;
+
 		case 'h':
 		default:
 			do_usage = true;	/* Just set a flag, so we can process extra -x args */
@@ -3908,6 +3981,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (config.benchmark && decode_benchmark.packets) {
+		double secs = fr_time_delta_unwrap(decode_benchmark.elapsed) / (double)NSEC;
+
+		INFO("decode-proto benchmark (%s dictionaries): %" PRIu64 " packets, %" PRIu64 " bytes in %.3fs",
+		     config.benchmark_compile ? "compiled" : "uncompiled",
+		     decode_benchmark.packets, decode_benchmark.bytes, secs);
+		if (secs > 0) INFO("    %.0f packets/s, %.1f MB/s",
+				   decode_benchmark.packets / secs, decode_benchmark.bytes / secs / (1024 * 1024));
+	}
+
 	/*
 	 *	Try really hard to free any allocated
 	 *	memory, so we get clean talloc reports.
@@ -54,7 +54,10 @@ typedef struct {
 	fr_io_decode_t			decode;		//!< Translate raw bytes into fr_pair_ts and metadata.
 	fr_io_encode_t			encode;		//!< Pack fr_pair_ts back into a byte array.
 
-	fr_io_signal_t			flush;		//!< Flush the data when the socket is ready for writing.
+	fr_io_flush_t			flush;		//!< Flush any data which write() queued instead of
+							//!< writing.  Called by the network thread after each
+							//!< batch of writes, and when the socket becomes writable
+							//!< if data is still queued.
 
 	fr_io_signal_t			error;		//!< There was an error on the socket.
 	fr_io_close_t			close;		//!< Close the transport.
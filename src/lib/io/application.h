@@ -56,6 +56,22 @@ typedef int (*fr_app_open_t)(void *instance, fr_schedule_t *sc, CONF_SECTION *cs
  */
 typedef int (*fr_app_priority_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
 
+/** Return a key identifying the client or session which a packet belongs to
+ *
+ * When the network thread uses the "affinity" dispatch policy, packets
+ * with the same key are sent to the same worker, where possible.
+ *
+ * @param[in] instance		of the #fr_app_t.
+ * @param[in] packet_ctx	as returned by the app_io's read() callback.
+ * @param[in] buffer		raw packet
+ * @param[in] buflen		length of the packet
+ * @return
+ *	- 0 if the packet has no affinity.
+ *	- the hash of the key.
+ */
+typedef uint32_t (*fr_app_affinity_get_t)(void const *instance, void const *packet_ctx,
+					  uint8_t const *buffer, size_t buflen);
+
 /** Called by the network thread to pass an event list for the module to use for timer events
  */
 typedef void (*fr_app_event_list_set_t)(fr_listen_t *li, fr_event_list_t *el, void *nr);
@@ -88,6 +104,9 @@ typedef struct {
 							///< to all #fr_app_io_t can be performed by the #fr_app_t.
 
 	fr_app_priority_get_t		priority;	//!< Assign a priority to the packet.
+
+	fr_app_affinity_get_t		affinity;	//!< Get the key used to pick a worker for the packet.
+							///< May be NULL.
 } fr_app_t;
 
 /** Public structure describing an application (protocol) specialisation
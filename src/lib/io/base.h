@@ -315,6 +315,26 @@ typedef int (*fr_io_track_cmp_t)(void const *instance, void *thread_instance, fr
  */
 typedef int (*fr_io_signal_t)(fr_listen_t *li);
 
+/** Statistics returned by a flush function
+ *
+ */
+typedef struct {
+	uint64_t	syscalls_saved;	//!< system calls avoided by queueing, since the last flush.
+	uint64_t	dropped;	//!< queued packets which could not be written, since the last flush.
+} fr_io_flush_stats_t;
+
+/**  Write any data which was queued instead of being written
+ *
+ * @param[in] li		the listener for this socket
+ * @param[out] stats		updated with what has changed since the last flush.
+ * @return
+ *	- 0 on success, all of the queued data has been written.
+ *	- 1 if data is still queued, because the socket would block.
+ *	  The caller should call flush again once the socket is writable.
+ *	- <0 on error
+ */
+typedef int (*fr_io_flush_t)(fr_listen_t *li, fr_io_flush_stats_t *stats);
+
 /**  Handle a close on the socket.
  *
  *  In general, the only thing to do on errors is to close the
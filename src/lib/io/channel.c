@@ -44,11 +44,6 @@ RCSID("$Id$")
 #define MPRINT(...)
 #endif
 
-/*
- *	We disable this until we fix all of the signaling issues...
- */
-#define ENABLE_SKIPS (0)
-
 typedef enum {
 	TO_RESPONDER = 0,
 	TO_REQUESTOR = 1
@@ -118,14 +113,14 @@ typedef struct {
 	fr_channel_recv_callback_t recv;	//!< callback for receiving messages
 	void			*recv_uctx;	//!< context for receiving messages
 
-	bool			must_signal;	//!< we need to signal the other end
-
+	bool			must_signal;	//!< we need to signal the other end, as it may be sleeping.
 
 	uint64_t		sequence;	//!< Sequence number for this channel.
 	uint64_t		ack;		//!< Sequence number of the other end.
 	uint64_t		their_view_of_my_sequence;	//!< Should be clear.
 
-	uint64_t		sequence_at_last_signal;	//!< When we last signaled.
+	uint64_t		ack_at_last_sleep;	//!< The ACK we sent with our last "sleeping" or
+							///< "done" signal.
 
 	fr_atomic_queue_t	*aq;		//!< The queue of messages - visible only to this channel.
 
@@ -240,6 +235,12 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *requestor, fr_con
 	ch->end[TO_RESPONDER].stats.last_sent_signal = now;
 	atomic_store(&ch->end[TO_RESPONDER].active, true);
 
+	/*
+	 *	The responder hasn't seen anything yet, so the first
+	 *	request always signals it.
+	 */
+	ch->end[TO_RESPONDER].must_signal = true;
+
 	ch->end[TO_REQUESTOR].stats.last_write = now;
 	ch->end[TO_REQUESTOR].stats.last_read_other = now;
 	ch->end[TO_REQUESTOR].stats.last_sent_signal = now;
@@ -357,34 +358,18 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	MPRINT("REQUESTOR requests %"PRIu64", num_outstanding %"PRIu64"\n", requestor->stats.packets, requestor->stats.outstanding);
 
-#if ENABLE_SKIPS
 	/*
-	 *	We just sent the first packet.  There can't possibly be a reply, so don't bother looking.
+	 *	We've signalled the responder since it last told us
+	 *	that it was sleeping or done.  So it's either awake,
+	 *	and will pick this packet up when it next reads its
+	 *	queue, or it's about to tell us that it's sleeping.
+	 *	In which case its ACK will be behind our sequence, and
+	 *	fr_channel_service_message() will signal it again.
 	 */
-	if (requestor->stats.outstanding == 1) {
-
-		/*
-		 *	There is at least one old packet which is
-		 *	outstanding, look for a reply.
-		 */
-	} else if (requestor->stats.outstanding > 1) {
-		bool has_reply;
-
-		has_reply = fr_channel_recv_reply(ch);
-
-		if (has_reply) while (fr_channel_recv_reply(ch));
-
-		/*
-		 *	There's no reply yet, so we still have packets outstanding.
-		 *	Or, there is a reply, and there are more packets outstanding.
-		 *	Skip the signal.
-		 */
-		if (!requestor->must_signal && (!has_reply || (has_reply && (requestor->stats.outstanding > 1)))) {
-			MPRINT("REQUESTOR SKIPS signal\n");
-			return 0;
-		}
+	if (!requestor->must_signal) {
+		MPRINT("REQUESTOR SKIPS signal\n");
+		return 0;
 	}
-#endif
 
 	/*
 	 *	Tell the other end that there is new data ready.
@@ -567,6 +552,7 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 	 *	thread.
 	 */
 	if (responder->stats.outstanding == 0) {
+		responder->ack_at_last_sleep = responder->ack;
 		(void) fr_channel_data_ready(ch, when, responder, FR_CHANNEL_SIGNAL_DATA_DONE_RESPONDER);
 		return 0;
 	}
@@ -575,18 +561,6 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 	MPRINT("\twhen - last signal = %"PRIu64" - %"PRIu64" = %"PRIu64"\n", when, responder->stats.last_sent_signal, when - responder->stats.last_sent_signal);
 	MPRINT("\tsequence - ack = %"PRIu64" - %"PRIu64" = %"PRIu64"\n", responder->sequence, responder->their_view_of_my_sequence, responder->sequence - responder->their_view_of_my_sequence);
 
-#ifdef __APPLE__
-	/*
-	 *	If we've sent them a signal since the last ACK, they
-	 *	will receive it, and process the packets.  So we don't
-	 *	need to signal them again.
-	 *
-	 *	But... this doesn't appear to work on the Linux
-	 *	libkqueue implementation.
-	 */
-	if (responder->sequence_at_last_signal > responder->their_view_of_my_sequence) return 0;
-#endif
-
 	/*
 	 *	If we've received a new packet in the last while, OR
 	 *	we've sent a signal in the last while, then we don't
@@ -638,6 +612,12 @@ int fr_channel_null_reply(fr_channel_t *ch)
  * This function should be called from the responders idle loop.
  * i.e. only when it has nothing else to do.
  *
+ * Once the requestor has signalled us, it doesn't signal us again
+ * until we tell it that we're sleeping, or done.  So this function
+ * MUST be called for every channel before the responder blocks.  It
+ * only sends a signal if we've read requests since the last time we
+ * told the requestor that we were sleeping.
+ *
  * @param[in] ch	the channel to signal we're no longer listening on.
  * @return
  *	- <0 on error
@@ -648,15 +628,26 @@ int fr_channel_responder_sleeping(fr_channel_t *ch)
 	fr_channel_end_t *responder;
 	fr_channel_control_t cc;
 
+	if (ch->same_thread) return 0;
+
 	responder = &(ch->end[TO_REQUESTOR]);
 
 	/*
 	 *	We don't have any outstanding requests to process for
 	 *	this channel, don't signal the network thread that
-	 *	we're sleeping.  It already knows.
+	 *	we're sleeping.  It already knows, as we sent "done"
+	 *	with the last reply.
 	 */
 	if (responder->stats.outstanding == 0) return 0;
 
+	/*
+	 *	We haven't read anything since we last said we were
+	 *	sleeping, so the requestor is already going to signal
+	 *	us for the next request.
+	 */
+	if (responder->ack == responder->ack_at_last_sleep) return 0;
+
+	responder->ack_at_last_sleep = responder->ack;
 	responder->stats.signals++;
 
 	cc.signal = FR_CHANNEL_SIGNAL_RESPONDER_SLEEPING;
@@ -685,9 +676,7 @@ int fr_channel_responder_sleeping(fr_channel_t *ch)
 fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size)
 {
 	int rcode;
-#if ENABLE_SKIPS
 	uint64_t ack;
-#endif
 	fr_channel_control_t cc;
 	fr_channel_signal_t cs;
 	fr_channel_event_t ce = FR_CHANNEL_ERROR;
@@ -698,9 +687,7 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 	memcpy(&cc, data, data_size);
 
 	cs = cc.signal;
-#if ENABLE_SKIPS
 	ack = cc.ack;
-#endif
 	*p_channel = ch = cc.ch;
 
 	switch (cs) {
@@ -737,12 +724,11 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 
 	/*
 	 *	Compare their ACK to the last sequence we
-	 *	sent.  If it's different, we signal the responder
-	 *	to wake up.
+	 *	sent.  If it's the same, the responder has seen
+	 *	everything, and we signal it with the next request.
 	 */
 	requestor = &ch->end[TO_RESPONDER];
-#if ENABLE_SKIPS
-	if (!requestor->must_signal && (ack == requestor->sequence)) {
+	if (ack == requestor->sequence) {
 		MPRINT("REQUESTOR SKIPS signal AFTER CE %d num_outstanding %"PRIu64"\n", cs, requestor->stats.outstanding);
 		MPRINT("REQUESTOR has ack %"PRIu64", my seq %"PRIu64" my_view %"PRIu64"\n", ack, requestor->sequence, requestor->their_view_of_my_sequence);
 		return ce;
@@ -750,10 +736,10 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 
 	/*
 	 *	The responder is sleeping or done.  There are more
-	 *	packets available, so we signal it to wake up again.
+	 *	packets available, which we didn't signal, so we
+	 *	signal it to wake up again.
 	 */
-	fr_assert(ack <= requestor->sequence);
-#endif
+	fr_assert(ack < requestor->sequence);
 
 	/*
 	 *	We're signaling it again...
@@ -58,7 +58,6 @@ typedef struct fr_listen fr_listen_t;
 #include <freeradius-devel/util/log.h>
 
 #include <sys/types.h>
-#include <sys/event.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -75,6 +74,19 @@ typedef enum fr_channel_event_t {
 	FR_CHANNEL_EMPTY,
 } fr_channel_event_t;
 
+/** How the network thread chose the worker for a request
+ *
+ */
+typedef enum {
+	FR_CHANNEL_DISPATCH_LEAST_LOADED = 0,		//!< Least loaded worker.
+	FR_CHANNEL_DISPATCH_AFFINITY,			//!< Worker which owns the packet's affinity key.
+	FR_CHANNEL_DISPATCH_AFFINITY_SPILL,		//!< Owner was overloaded, so the next worker
+							///< on the hash ring was used.
+	FR_CHANNEL_DISPATCH_AFFINITY_FALLBACK,		//!< Affinity was configured, but the packet had
+							///< no key, or no worker could take it.
+	FR_CHANNEL_DISPATCH_MAX
+} fr_channel_dispatch_t;
+
 /** Statistics for the channel
  *
  */
@@ -128,6 +140,7 @@ typedef struct {
 	union {
 		struct {
 			fr_time_t		recv_time;	//!< time original request was received (network -> worker)
+			fr_channel_dispatch_t	dispatch;	//!< how the network chose this worker (network -> worker)
 		} request;
 
 		struct {
@@ -33,7 +33,16 @@ RCSID("$Id$")
 
 #include <fcntl.h>
 #include <string.h>
-#include <sys/event.h>
+
+#ifdef HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 
 #define FR_CONTROL_MAX_TYPES	(32)
 
@@ -81,32 +90,79 @@ struct fr_control_s {
 
 	fr_atomic_queue_t	*aq;			//!< destination AQ
 
-	int			pipe[2];       		//!< our pipes
+	int			pipe[2];       		//!< our pipes.  With eventfd, both are the same descriptor.
+
+	atomic_bool		signalled;		//!< a wakeup is pending, and the reader hasn't drained
+							///< the queue yet.  Senders skip the write() when it's set.
 
 	bool			same_thread;		//!< are the two ends in the same thread
 
 	fr_control_ctx_t 	type[FR_CONTROL_MAX_TYPES];	//!< callbacks
 };
 
+/** Wake up the thread reading from the control plane
+ *
+ *  Only the first sender after the reader drains the queue writes to
+ *  the descriptor.  Everyone else sees "signalled", and knows that the
+ *  reader will pick up their message when it drains the queue.
+ *
+ * @param[in] c the control structure
+ */
+static inline void control_signal(fr_control_t *c)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	uint64_t one = 1;
+#endif
+
+	if (atomic_exchange(&c->signalled, true)) return;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	while ((write(c->pipe[1], &one, sizeof(one)) < 0) && (errno == EINTR)) {
+		/* nothing */
+	}
+#else
+	while (write(c->pipe[1], ".", 1) == 0) {
+		/* nothing */
+	}
+#endif
+}
+
 static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
 {
 	fr_control_t *c = talloc_get_type_abort(uctx, fr_control_t);
-	ssize_t i, num;
+	int i;
 	fr_time_t now;
+#ifdef HAVE_SYS_EVENTFD_H
+	uint64_t read_buffer;
+#else
 	char read_buffer[256];
+#endif
 	uint8_t	data[256];
 
-	num = read(fd, read_buffer, sizeof(read_buffer));
-	if (num <= 0) return;
+	/*
+	 *	Empty the descriptor, and then clear the flag.  Any
+	 *	sender which pushes a message after this point will
+	 *	signal us again.  Any sender which pushed a message
+	 *	before this point has its message in the queue.
+	 */
+#ifdef HAVE_SYS_EVENTFD_H
+	(void) read(fd, &read_buffer, sizeof(read_buffer));
+#else
+	while (read(fd, read_buffer, sizeof(read_buffer)) == sizeof(read_buffer)) {
+		/* nothing */
+	}
+#endif
+	atomic_store(&c->signalled, false);
 
 	now = fr_time();
 
-	for (i = 0; i < num; i++) {
+	for (i = 0; i < FR_CONTROL_MAX_MESSAGES; i++) {
 		uint32_t id = 0;
-		size_t message_size;
+		ssize_t message_size;
 
 		message_size = fr_control_message_pop(c->aq, &id, data, sizeof(data));
 		if (!message_size) return;
+		if (message_size < 0) continue;
 
 		if (id >= FR_CONTROL_MAX_TYPES) continue;
 
@@ -114,6 +170,12 @@ static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void
 
 		c->type[id].callback(c->type[id].ctx, data, message_size, now);
 	}
+
+	/*
+	 *	There may be more messages.  Signal ourselves, so that
+	 *	we come back after servicing the other events.
+	 */
+	control_signal(c);
 }
 
 /** Free a control structure
@@ -132,7 +194,7 @@ static int _control_free(fr_control_t *c)
 	(void) fr_event_fd_delete(c->el, c->pipe[0], FR_EVENT_FILTER_IO);
 
 	close(c->pipe[0]);
-	close(c->pipe[1]);
+	if (c->pipe[1] != c->pipe[0]) close(c->pipe[1]);
 
 	return 0;
 }
@@ -158,6 +220,19 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_atomic_
 	c->el = el;
 	c->aq = aq;
 
+#ifdef HAVE_SYS_EVENTFD_H
+	/*
+	 *	An eventfd is a counter, so any number of wakeups need
+	 *	only one read(), and it uses one descriptor instead of two.
+	 */
+	c->pipe[0] = c->pipe[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (c->pipe[0] < 0) {
+		talloc_free(c);
+		fr_strerror_printf("Failed opening eventfd for control socket: %s", fr_syserror(errno));
+		return NULL;
+	}
+	talloc_set_destructor(c, _control_free);
+#else
 	if (pipe((int *) &c->pipe) < 0) {
 		talloc_free(c);
 		fr_strerror_printf("Failed opening pipe for control socket: %s", fr_syserror(errno));
@@ -170,6 +245,7 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_atomic_
 	 */
 	(void) fcntl(c->pipe[0], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
 	(void) fcntl(c->pipe[1], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+#endif
 
 	if (fr_event_fd_insert(c, NULL, el, c->pipe[0], pipe_read, NULL, NULL, c) < 0) {
 		talloc_free(c);
@@ -353,9 +429,7 @@ int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
 
 	if (fr_control_message_push(c, rb, id, data, data_size) < 0) return -1;
 
-	while (write(c->pipe[1], ".", 1) == 0) {
-		/* nothing */
-	}
+	control_signal(c);
 
 	return 0;
 }
@@ -474,7 +548,7 @@ int fr_control_same_thread(fr_control_t *c)
 	c->same_thread = true;
 	(void) fr_event_fd_delete(c->el, c->pipe[0], FR_EVENT_FILTER_IO);
 	close(c->pipe[0]);
-	close(c->pipe[1]);
+	if (c->pipe[1] != c->pipe[0]) close(c->pipe[1]);
 
 	/*
 	 *	Nothing more to do now that everything is gone.
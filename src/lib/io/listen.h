@@ -47,6 +47,13 @@ struct fr_listen {
 							///< Added for rlm_detail which requires inst->parent->sc to be
 							///< populated when event_list_set callback is run which doesn't
 							///< happen if the short cut is taken.
+	bool			read_again;		//!< The app_io has buffered more packets than it returned,
+							///< call read() again without waiting for the FD.
+
+	uint32_t		shard;			//!< Which of the listener's SO_REUSEPORT sockets this is.
+	uint32_t		num_shards;		//!< How many sockets the app_io wants for this listener.
+							///< Set by open().  Each shard is added to a different
+							///< network thread.
 
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
@@ -60,6 +67,7 @@ struct fr_async_s {
 	fr_event_list_t		*el;
 
 	fr_time_tracking_t	tracking;
+	fr_time_t		first_resumed;	//!< When the worker first ran this request.
 	fr_channel_t		*channel;
 
 	fr_dlist_t		entry;		//!< in the list of requests associated with this channel
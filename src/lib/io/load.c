@@ -25,6 +25,9 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/io/load.h>
+#include <freeradius-devel/util/rand.h>
+
+#include <math.h>
 
 /*
  *	We use *inverse* numbers to avoid numerical calculation issues.
@@ -55,6 +58,19 @@ RCSID("$Id$")
 
 #define RTT(_old, _new) fr_time_delta_wrap((fr_time_delta_unwrap(_new) + (fr_time_delta_unwrap(_old) * (IALPHA - 1))) / IALPHA)
 
+/*
+ *	Response times are kept to within 1.6%, and anything slower
+ *	than a minute is counted as a minute.
+ */
+#define LOAD_HISTOGRAM_MAX	((uint64_t) 60 * NSEC)
+#define LOAD_HISTOGRAM_PRECISION (7)
+
+fr_table_num_sorted_t const fr_load_arrival_table[] = {
+	{ L("constant"),	FR_LOAD_ARRIVAL_CONSTANT	},
+	{ L("poisson"),		FR_LOAD_ARRIVAL_POISSON		}
+};
+size_t fr_load_arrival_table_len = NUM_ELEMENTS(fr_load_arrival_table);
+
 typedef enum {
 	FR_LOAD_STATE_INIT = 0,
 	FR_LOAD_STATE_SENDING,
@@ -101,6 +117,13 @@ fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_loa
 	l->callback = callback;
 	l->uctx = uctx;
 
+	l->stats.latency = fr_histogram_alloc(l, LOAD_HISTOGRAM_MAX, LOAD_HISTOGRAM_PRECISION);
+	l->stats.interval = fr_histogram_alloc(l, LOAD_HISTOGRAM_MAX, LOAD_HISTOGRAM_PRECISION);
+	if (!l->stats.latency || !l->stats.interval) {
+		talloc_free(l);
+		return NULL;
+	}
+
 	return l;
 }
 
@@ -126,6 +149,85 @@ static void fr_load_generator_send(fr_load_t *l, fr_time_t now, int count)
 	}
 }
 
+/** Go to the next step of the test
+ *
+ * @return
+ *	- true if there's another step.
+ *	- false if the test is done.
+ */
+static bool load_step_next(fr_load_t *l)
+{
+	l->step_start = l->next;
+	l->step_end = fr_time_add(l->next, l->config->duration);
+	l->step_received = l->stats.received;
+	l->pps += l->config->step;
+	l->stats.pps = l->pps;
+	l->stats.skipped = 0;
+	l->delta = fr_time_delta_div(fr_time_delta_from_sec(l->config->parallel), fr_time_delta_wrap(l->pps));
+
+	/*
+	 *	A step of zero means one run at a fixed rate.
+	 */
+	if (!l->config->step) return false;
+
+	/*
+	 *	Stop at max PPS, if it's set.  Otherwise
+	 *	continue without limit.
+	 */
+	if (l->config->max_pps && (l->pps > l->config->max_pps)) return false;
+
+	return true;
+}
+
+/** How long to wait between one open-loop send and the next
+ *
+ */
+static fr_time_delta_t load_interval(fr_load_t *l)
+{
+	double u;
+
+	if (l->config->arrival == FR_LOAD_ARRIVAL_CONSTANT) return l->delta;
+
+	/*
+	 *	Exponentially distributed, with a mean of 1/pps.  "u"
+	 *	is never 0 or 1, so the gap is never zero or infinite.
+	 */
+	u = ((double) fr_rand() + 1.0) / ((double) UINT32_MAX + 2.0);
+
+	return fr_time_delta_wrap((int64_t) ((-log(u) * NSEC) / l->pps));
+}
+
+/** Send every packet which is due, without waiting for replies
+ *
+ *  Each packet is given the time it should have been sent, and not
+ *  the time it was sent.  So if we're running late, the delay is
+ *  counted in the response time.
+ */
+static void load_timer_open(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_load_t	*l = uctx;
+	uint32_t	count = (l->config->arrival == FR_LOAD_ARRIVAL_CONSTANT) ? l->config->parallel : 1;
+
+	l->stats.backlog = l->stats.sent - l->stats.received;
+	if (l->stats.backlog > l->stats.max_backlog) l->stats.max_backlog = l->stats.backlog;
+
+	l->state = FR_LOAD_STATE_SENDING;
+
+	while (fr_time_lteq(l->next, now)) {
+		if (fr_time_gteq(l->next, l->step_end) && !load_step_next(l)) {
+			l->state = FR_LOAD_STATE_DRAINING;
+			return;
+		}
+
+		fr_load_generator_send(l, l->next, count);
+		l->next = fr_time_add(l->next, load_interval(l));
+	}
+
+	if (fr_event_timer_at(l, el, &l->ev, l->next, load_timer_open, l) < 0) {
+		l->state = FR_LOAD_STATE_DRAINING;
+	}
+}
+
 static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 {
 	fr_load_t *l = uctx;
@@ -142,23 +244,9 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	/*
 	 *	If we're done this step, go to the next one.
 	 */
-	if (fr_time_gteq(l->next, l->step_end)) {
-		l->step_start = l->next;
-		l->step_end = fr_time_add(l->next, l->config->duration);
-		l->step_received = l->stats.received;
-		l->pps += l->config->step;
-		l->stats.pps = l->pps;
-		l->stats.skipped = 0;
-		l->delta = fr_time_delta_div(fr_time_delta_from_sec(l->config->parallel), fr_time_delta_wrap(l->pps));
-
-		/*
-		 *	Stop at max PPS, if it's set.  Otherwise
-		 *	continue without limit.
-		 */
-		if (l->config->max_pps && (l->pps > l->config->max_pps)) {
-			l->state = FR_LOAD_STATE_DRAINING;
-			return;
-		}
+	if (fr_time_gteq(l->next, l->step_end) && !load_step_next(l)) {
+		l->state = FR_LOAD_STATE_DRAINING;
+		return;
 	}
 
 	/*
@@ -238,6 +326,13 @@ int fr_load_generator_start(fr_load_t *l)
 	l->count = l->config->parallel;
 
 	l->delta = fr_time_delta_div(fr_time_delta_from_sec(l->config->parallel), fr_time_delta_wrap(l->pps));
+
+	if (l->config->open_loop) {
+		l->next = l->step_start;
+		load_timer_open(l->el, l->step_start, l);
+		return 0;
+	}
+
 	l->next = fr_time_add(l->step_start, l->delta);
 
 	load_timer(l->el, l->step_start, l);
@@ -278,6 +373,21 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 
 	l->stats.received++;
 
+	/*
+	 *	When we're gated, we're only sending a packet when we
+	 *	get a reply, so a slow reply delays the packets which
+	 *	would have measured it.  Record those, too.
+	 */
+	if (l->state == FR_LOAD_STATE_GATED) {
+		uint64_t interval = fr_time_delta_unwrap(fr_time_delta_from_sec(1)) / l->pps;
+
+		fr_histogram_record_corrected(l->stats.latency, fr_time_delta_unwrap(t), interval);
+		fr_histogram_record_corrected(l->stats.interval, fr_time_delta_unwrap(t), interval);
+	} else {
+		fr_histogram_record(l->stats.latency, fr_time_delta_unwrap(t));
+		fr_histogram_record(l->stats.interval, fr_time_delta_unwrap(t));
+	}
+
 	/*
 	 *	t is in nanoseconds.
 	 */
@@ -335,16 +445,39 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 	return FR_LOAD_DONE;
 }
 
+/** Update the accepted packets/s
+ *
+ */
+static void load_stats_update(fr_load_t *l, fr_time_t now)
+{
+	/*
+	 *	Track packets/s.  Since times are in nanoseconds, we
+	 *	have to scale the counters up by NSEC.  And since NSEC
+	 *	is 1B, the calculations have to be done via 64-bit
+	 *	numbers, and then converted to a final 32-bit counter.
+	 */
+	if (fr_time_gt(now, l->step_start)) {
+		l->stats.pps_accepted =
+			fr_time_delta_unwrap(
+				fr_time_delta_div(fr_time_delta_from_sec(l->stats.received - l->step_received),
+					  	  fr_time_sub(now, l->step_start))
+			);
+	}
+}
+
 /** Print load generator statistics in CVS format.
  *
+ *  The percentiles are for the replies received since the last
+ *  time this function was called.
  */
 size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer, size_t buflen)
 {
 	double now_f, last_send_f;
+	size_t len;
 
 	if (!l->header) {
 		l->header = true;
-		return snprintf(buffer, buflen, "\"time\",\"last_packet\",\"rtt\",\"rttvar\",\"pps\",\"pps_accepted\",\"sent\",\"received\",\"backlog\",\"max_backlog\",\"<usec\",\"us\",\"10us\",\"100us\",\"ms\",\"10ms\",\"100ms\",\"s\",\"blocked\"\n");
+		return snprintf(buffer, buflen, "\"time\",\"last_packet\",\"rtt\",\"rttvar\",\"pps\",\"pps_accepted\",\"sent\",\"received\",\"backlog\",\"max_backlog\",\"<usec\",\"us\",\"10us\",\"100us\",\"ms\",\"10ms\",\"100ms\",\"s\",\"blocked\",\"p50\",\"p90\",\"p99\",\"p99.9\",\"max\"\n");
 	}
 
 
@@ -352,36 +485,78 @@ size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer,
 
 	last_send_f = fr_time_delta_unwrap(fr_time_sub(l->stats.last_send, l->stats.start)) / (double)NSEC;
 
-	/*
-	 *	Track packets/s.  Since times are in nanoseconds, we
-	 *	have to scale the counters up by NSEC.  And since NSEC
-	 *	is 1B, the calculations have to be done via 64-bit
-	 *	numbers, and then converted to a final 32-bit counter.
-	 */
-	if (fr_time_gt(now, l->step_start)) {
-		l->stats.pps_accepted =
-			fr_time_delta_unwrap(
-				fr_time_delta_div(fr_time_delta_from_sec(l->stats.received - l->step_received),
-					  	  fr_time_sub(now, l->step_start))
-			);
+	load_stats_update(l, now);
+
+	len = snprintf(buffer, buflen,
+		       "%f,%f,"
+		       "%" PRIu64 ",%" PRIu64 ","
+		       "%d,%d,"
+		       "%d,%d,"
+		       "%d,%d,"
+		       "%d,%d,%d,%d,%d,%d,%d,%d,"
+		       "%d,"
+		       "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+		       now_f, last_send_f,
+		       fr_time_delta_unwrap(l->stats.rtt), fr_time_delta_unwrap(l->stats.rttvar),
+		       l->stats.pps, l->stats.pps_accepted,
+		       l->stats.sent, l->stats.received,
+		       l->stats.backlog, l->stats.max_backlog,
+		       l->stats.times[0], l->stats.times[1], l->stats.times[2], l->stats.times[3],
+		       l->stats.times[4], l->stats.times[5], l->stats.times[6], l->stats.times[7],
+		       l->stats.blocked,
+		       fr_histogram_value_at_percentile(l->stats.interval, 50),
+		       fr_histogram_value_at_percentile(l->stats.interval, 90),
+		       fr_histogram_value_at_percentile(l->stats.interval, 99),
+		       fr_histogram_value_at_percentile(l->stats.interval, 99.9),
+		       l->stats.interval->count ? l->stats.interval->max : 0);
+
+	fr_histogram_reset(l->stats.interval);
+
+	return len;
+}
+
+/** Print load generator statistics as one JSON object per line
+ *
+ *  "interval" has the response times for the replies received since
+ *  the last time this function was called, and "total" has them for
+ *  the whole test.  All times are in nanoseconds.
+ */
+size_t fr_load_generator_stats_json_sprint(fr_load_t *l, fr_time_t now, char *buffer, size_t buflen)
+{
+	size_t		len;
+	double		now_f;
+	unsigned int	i;
+	fr_histogram_t	*h[2] = { l->stats.interval, l->stats.latency };
+	char		percentiles[2][256];
+
+	now_f = fr_time_delta_unwrap(fr_time_sub(now, l->stats.start)) / (double)NSEC;
+
+	load_stats_update(l, now);
+
+	for (i = 0; i < NUM_ELEMENTS(h); i++) {
+		snprintf(percentiles[i], sizeof(percentiles[i]),
+			 "{\"count\":%" PRIu64 ",\"mean\":%.0f,\"p50\":%" PRIu64 ",\"p90\":%" PRIu64
+			 ",\"p99\":%" PRIu64 ",\"p99.9\":%" PRIu64 ",\"max\":%" PRIu64 "}",
+			 h[i]->count, fr_histogram_mean(h[i]),
+			 fr_histogram_value_at_percentile(h[i], 50),
+			 fr_histogram_value_at_percentile(h[i], 90),
+			 fr_histogram_value_at_percentile(h[i], 99),
+			 fr_histogram_value_at_percentile(h[i], 99.9),
+			 h[i]->count ? h[i]->max : 0);
 	}
 
-	return snprintf(buffer, buflen,
-			"%f,%f,"
-			"%" PRIu64 ",%" PRIu64 ","
-			"%d,%d,"
-			"%d,%d,"
-			"%d,%d,"
-			"%d,%d,%d,%d,%d,%d,%d,%d,"
-			"%d\n",
-			now_f, last_send_f,
-			fr_time_delta_unwrap(l->stats.rtt), fr_time_delta_unwrap(l->stats.rttvar),
-			l->stats.pps, l->stats.pps_accepted,
-			l->stats.sent, l->stats.received,
-			l->stats.backlog, l->stats.max_backlog,
-			l->stats.times[0], l->stats.times[1], l->stats.times[2], l->stats.times[3],
-			l->stats.times[4], l->stats.times[5], l->stats.times[6], l->stats.times[7],
-			l->stats.blocked);
+	len = snprintf(buffer, buflen,
+		       "{\"time\":%f,\"pps\":%d,\"pps_accepted\":%d,"
+		       "\"sent\":%d,\"received\":%d,\"backlog\":%d,\"max_backlog\":%d,\"blocked\":%s,"
+		       "\"interval\":%s,\"total\":%s}\n",
+		       now_f, l->stats.pps, l->stats.pps_accepted,
+		       l->stats.sent, l->stats.received, l->stats.backlog, l->stats.max_backlog,
+		       l->stats.blocked ? "true" : "false",
+		       percentiles[0], percentiles[1]);
+
+	fr_histogram_reset(l->stats.interval);
+
+	return len;
 }
 
 fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l)
@@ -26,8 +26,21 @@
 RCSIDH(load_h, "$Id$")
 
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/histogram.h>
+#include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/talloc.h>
 
+/** How packets are spaced when the load generator is running open-loop
+ *
+ */
+typedef enum {
+	FR_LOAD_ARRIVAL_CONSTANT = 0,	//!< "parallel" packets every "parallel / pps" seconds.
+	FR_LOAD_ARRIVAL_POISSON		//!< one packet at a time, with exponentially distributed gaps.
+} fr_load_arrival_t;
+
+extern fr_table_num_sorted_t const fr_load_arrival_table[];
+extern size_t fr_load_arrival_table_len;
+
 /** Load generation configuration.
  *
  *  The load generator runs a callback periodically in order to
@@ -67,7 +80,23 @@ RCSIDH(load_h, "$Id$")
  *  The generator will try to increase the packet rate after
  *  "duration" seconds, even if the maximum backlog is currently
  *  reached.  This increase has the effect of also increasing the
- *  maximum backlog.
+ *  maximum backlog.  If "step" is zero, the test ends after one
+ *  "duration" at "start_pps".
+ *
+ *  The above is a closed-loop test, as the server can slow down the
+ *  generator.  When "open_loop" is set, there is no backlog limit.
+ *  Each packet has a time when it should be sent, and it is sent at
+ *  that time, however far behind the server is.  If the event loop
+ *  is late, the packets which are due are all sent at once.  The
+ *  packets are either sent at a constant rate, or with a Poisson
+ *  distribution of gaps between them.
+ *
+ *  Response times are measured from the time the packet should have
+ *  been sent, and recorded in histograms.  This avoids "coordinated
+ *  omission", where a stalled server delays the packets which would
+ *  have measured the stall.  In closed-loop mode, packets sent while
+ *  gated are recorded along with the packets which should have been
+ *  sent, but weren't.
  */
 typedef struct {
 	uint32_t       	start_pps;	//!< start PPS
@@ -76,6 +105,8 @@ typedef struct {
 	uint32_t	step;		//!< how much to increase each load test by
 	uint32_t	parallel;	//!< how many packets in parallel to send
 	uint32_t	milliseconds;	//!< how many milliseconds of backlog to top out at
+	bool		open_loop;	//!< send packets on schedule, no matter what the backlog is
+	fr_load_arrival_t arrival;	//!< how packets are spaced in open-loop mode
 } fr_load_config_t;
 
 typedef struct {
@@ -93,6 +124,8 @@ typedef struct {
 	int		max_backlog;	//!< maximum backlog we saw during the test
 	bool		blocked;	//!< whether or not we're blocked
 	int		times[8];	//!< response time in microseconds to tens of seconds
+	fr_histogram_t	*latency;	//!< response times in nanoseconds, for the whole test
+	fr_histogram_t	*interval;	//!< response times in nanoseconds, since the last report
 } fr_load_stats_t;
 
 typedef struct fr_load_s fr_load_t;
@@ -119,4 +152,6 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 
 size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer, size_t buflen);
 
+size_t fr_load_generator_stats_json_sprint(fr_load_t *l, fr_time_t now, char *buffer, size_t buflen);
+
 fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l) CC_HINT(nonnull);
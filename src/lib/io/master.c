@@ -1434,6 +1434,12 @@ do_read:
 		 */
 		packet_len = inst->app_io->read(child, (void **) &local_address, &recv_time,
 					  buffer, buffer_len, leftover);
+
+		/*
+		 *	The child may have read a batch of packets, tell
+		 *	the network side to keep calling us.
+		 */
+		li->read_again = child->read_again;
 		if (packet_len <= 0) {
 			return packet_len;
 		}
@@ -2585,6 +2591,22 @@ reread:
 	return buffer_len;
 }
 
+/** Flush any replies which the child queued.
+ *
+ */
+static int mod_flush(fr_listen_t *li, fr_io_flush_stats_t *stats)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(child, stats);
+}
+
 /** Close the socket.
  *
  */
@@ -2914,25 +2936,23 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Open one shard of a listener, and add it to the scheduler
+ *
+ * @param[in] inst			of the master IO handler.
+ * @param[in] sc			to add the listener to.
+ * @param[in] default_message_size	for the message ring buffer.
+ * @param[in] num_messages		for the message ring buffer.
+ * @param[in] shard			which shard to open.
+ * @return
+ *	- The new listener on success.
+ *	- NULL on error.
+ */
+static fr_listen_t *master_io_listen_shard(fr_io_instance_t *inst, fr_schedule_t *sc,
+					   size_t default_message_size, size_t num_messages, uint32_t shard)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->common.thread_inst_size) {
-		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -2963,6 +2983,13 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	li->default_message_size = default_message_size;
 	li->num_messages = num_messages;
 
+	/*
+	 *	Which shard this is.  open() will tell us how many
+	 *	shards there should be.
+	 */
+	li->shard = shard;
+	li->num_shards = 1;
+
 	/*
 	 *	Per-socket data lives here.
 	 */
@@ -3034,10 +3061,11 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	if (inst->app_io->open(child) < 0) {
 		cf_log_err(inst->app_io_conf, "Failed opening %s interface", inst->app_io->common.name);
 		talloc_free(li);
-		return -1;
+		return NULL;
 	}
 
 	li->fd = child->fd;	/* copy this back up */
+	li->num_shards = child->num_shards;
 
 	if (!child->app_io->get_name) {
 		child->name = child->app_io->common.name;
@@ -3047,9 +3075,10 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  The other shards are
+	 *	deliberately bound to the same address and port.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && (shard == 0)) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -3060,7 +3089,7 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 			ERROR("got socket %d %d\n", child->app_io_addr->inet.src_port, other->app_io_addr->inet.src_port);
 
 			talloc_free(li);
-			return -1;
+			return NULL;
 		}
 
 		(void) listen_record(child);
@@ -3072,9 +3101,43 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	 */
 	if (!fr_schedule_listen_add(sc, li)) {
 		talloc_free(li);
+		return NULL;
+	}
+
+	return li;
+}
+
+int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	fr_listen_t	*li;
+	uint32_t	i;
+
+	/*
+	 *	No IO paths, so we don't initialize them.
+	 */
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->common.thread_inst_size) {
+		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
 		return -1;
 	}
 
+	li = master_io_listen_shard(inst, sc, default_message_size, num_messages, 0);
+	if (!li) return -1;
+
+	/*
+	 *	The app_io asked for more sockets bound to the same
+	 *	address.  Each one gets its own listener, and its own
+	 *	network thread.
+	 */
+	for (i = 1; i < li->num_shards; i++) {
+		if (!master_io_listen_shard(inst, sc, default_message_size, num_messages, i)) return -1;
+	}
+
 	return 0;
 }
 
@@ -3134,6 +3197,7 @@ fr_app_io_t fr_master_app_io = {
 
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.inject			= mod_inject,
 
 	.open			= mod_open,
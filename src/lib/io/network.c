@@ -29,6 +29,7 @@ RCSID("$Id$")
 #define LOG_DST nr->log
 
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/rb.h>
@@ -46,6 +47,16 @@ RCSID("$Id$")
 
 #define MAX_WORKERS 64
 
+#define NETWORK_LATENCY_MAX	((uint64_t) 60 * NSEC)	//!< Longer delays are recorded as this.
+#define NETWORK_LATENCY_PRECISION (7)			//!< Significant bits, i.e. within 1%.
+
+/*
+ *	Each worker is placed at this many points on the hash ring
+ *	used by the "affinity" dispatch policy.  More points give a
+ *	more even split of keys between the workers.
+ */
+#define AFFINITY_POINTS_PER_WORKER (16)
+
 static _Thread_local fr_ring_buffer_t *fr_network_rb;
 
 typedef struct {
@@ -70,6 +81,14 @@ typedef struct {
 	fr_io_stats_t		stats;
 } fr_network_worker_t;
 
+/** A point on the hash ring used by the "affinity" dispatch policy
+ *
+ */
+typedef struct {
+	uint32_t		hash;			//!< position on the ring
+	uint32_t		index;			//!< of the worker in nr->workers
+} fr_network_ring_point_t;
+
 typedef struct {
 	fr_rb_node_t		listen_node;		//!< rbtree node for looking up by listener.
 	fr_rb_node_t		num_node;		//!< rbtree node for looking up by number.
@@ -94,6 +113,13 @@ typedef struct {
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
 	fr_io_stats_t		stats;
+
+	uint64_t		read_batches;		//!< number of read events which returned packets
+	uint64_t		read_batch_packets;	//!< number of packets returned by those read events
+
+	fr_dlist_t		write_entry;		//!< in the list of sockets which have replies to write
+	uint64_t		write_syscalls_saved;	//!< number of system calls saved by coalescing replies
+	uint64_t		write_dropped;		//!< number of coalesced replies which the kernel refused
 } fr_network_socket_t;
 
 /*
@@ -128,8 +154,12 @@ struct fr_network_s {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		write_sockets;		//!< sockets which have replies waiting to be written
 
 	fr_io_stats_t		stats;
+	uint64_t		write_syscalls_saved;	//!< number of system calls saved by coalescing replies
+	uint64_t		write_dropped;		//!< number of coalesced replies which the kernel refused
+	fr_histogram_t		*reply_delay;		//!< from the worker sending a reply, to us writing it.
 
 	fr_rb_tree_t		*sockets;		//!< list of sockets we're managing, ordered by the listener
 	fr_rb_tree_t		*sockets_by_num;       	//!< ordered by number;
@@ -147,6 +177,22 @@ struct fr_network_s {
 
 	fr_network_config_t	config;			//!< configuration
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
+
+	unsigned int		ring_size;		//!< number of points in the ring
+	fr_network_ring_point_t	ring[MAX_WORKERS * AFFINITY_POINTS_PER_WORKER];	//!< consistent hash ring
+							///< of workers, sorted by hash.
+
+	fr_dlist_t		entry;			//!< in the list of all networks.
+};
+
+/*
+ *	All networks, so that their latency histograms can be merged.
+ *	The mutex is never taken when recording latencies.
+ */
+static pthread_mutex_t network_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t network_list = {
+	.entry = FR_DLIST_ENTRY_INITIALISER(network_list.entry),
+	.offset = offsetof(fr_network_t, entry)
 };
 
 static void fr_network_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
@@ -508,6 +554,45 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 	}
 }
 
+static int ring_point_cmp(void const *one, void const *two)
+{
+	fr_network_ring_point_t const *a = one, *b = two;
+
+	return CMP(a->hash, b->hash);
+}
+
+/** Rebuild the hash ring used by the "affinity" dispatch policy
+ *
+ * The points for a worker depend only on the worker, so adding or
+ * removing a worker only moves the keys which that worker owns.
+ *
+ * @param[in] nr	the network
+ */
+static void fr_network_ring_build(fr_network_t *nr)
+{
+	uint32_t i, j;
+
+	nr->ring_size = 0;
+
+	for (i = 0; i < (uint32_t) nr->num_workers; i++) {
+		fr_network_worker_t *w = nr->workers[i];
+		uint32_t hash;
+
+		if (!w) continue;
+
+		hash = fr_hash(&w->worker, sizeof(w->worker));
+
+		for (j = 0; j < AFFINITY_POINTS_PER_WORKER; j++) {
+			nr->ring[nr->ring_size++] = (fr_network_ring_point_t) {
+				.hash = fr_hash_update(&j, sizeof(j), hash),
+				.index = i
+			};
+		}
+	}
+
+	qsort(nr->ring, nr->ring_size, sizeof(nr->ring[0]), ring_point_cmp);
+}
+
 /** Handle a network control message callback for a channel
  *
  * This is called from the event loop when we get a notification
@@ -569,11 +654,14 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 				/*
 				 *	Close the hole...
 				 */
-				memcpy(&nr->workers[i], &nr->workers[i + 1], ((nr->num_workers - i) - 1));
+				memmove(&nr->workers[i], &nr->workers[i + 1],
+					sizeof(nr->workers[0]) * ((nr->num_workers - i) - 1));
+				nr->workers[nr->num_workers - 1] = NULL;
 				break;
 			}
 		}
 		nr->num_workers--;
+		fr_network_ring_build(nr);
 	}
 		break;
 	}
@@ -581,6 +669,83 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 
 #define OUTSTANDING(_x) ((_x)->stats.in - (_x)->stats.out)
 
+/** Pick a worker for a packet using bounded-load consistent hashing
+ *
+ * Each key is owned by the worker at the first point on the ring at
+ * or after the key's hash.  If the owner has more than its fair
+ * share of outstanding packets (the average, plus
+ * dispatch_max_imbalance percent), then we walk around the ring to
+ * the next worker which does not.
+ *
+ * @param[in] nr	the network
+ * @param[in] key	hash of the packet's affinity key.
+ * @param[out] dispatch	how the worker was chosen.
+ * @return
+ *	- the worker.
+ *	- NULL if no worker could take the packet.
+ */
+static fr_network_worker_t *fr_network_affinity_worker(fr_network_t *nr, uint32_t key, fr_channel_dispatch_t *dispatch)
+{
+	unsigned int	lo, hi, i, active = 0, seen = 0;
+	uint64_t	total = 0, limit, visited = 0;
+	fr_network_worker_t *owner;
+
+	if (!nr->ring_size) return NULL;
+
+	for (i = 0; i < (unsigned int) nr->num_workers; i++) {
+		if (!nr->workers[i] || nr->workers[i]->blocked) continue;
+
+		total += OUTSTANDING(nr->workers[i]);
+		active++;
+	}
+	if (!active) return NULL;
+
+	/*
+	 *	Each worker can have at most this many packets
+	 *	outstanding, including the one we're about to send.
+	 */
+	limit = ((total + 1) * (100 + nr->config.dispatch_max_imbalance) + (100 * active) - 1) / (100 * active);
+
+	/*
+	 *	Find the first point which is >= the key, wrapping
+	 *	around to the start of the ring if there isn't one.
+	 */
+	lo = 0;
+	hi = nr->ring_size;
+	while (lo < hi) {
+		unsigned int mid = lo + ((hi - lo) / 2);
+
+		if (nr->ring[mid].hash < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == nr->ring_size) lo = 0;
+
+	owner = nr->workers[nr->ring[lo].index];
+
+	for (i = 0; i < nr->ring_size; i++) {
+		fr_network_ring_point_t	*point = &nr->ring[(lo + i) % nr->ring_size];
+		fr_network_worker_t	*worker = nr->workers[point->index];
+
+		if (visited & ((uint64_t) 1 << point->index)) continue;
+		visited |= ((uint64_t) 1 << point->index);
+
+		if (!worker->blocked) {
+			if ((OUTSTANDING(worker) + 1) <= limit) {
+				*dispatch = (worker == owner) ? FR_CHANNEL_DISPATCH_AFFINITY :
+								FR_CHANNEL_DISPATCH_AFFINITY_SPILL;
+				return worker;
+			}
+		}
+
+		if (++seen == (unsigned int) nr->num_workers) break;
+	}
+
+	return NULL;
+}
+
 /** Send a message on the "best" channel.
  *
  * @param nr the network
@@ -588,10 +753,26 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
  */
 static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 {
-	fr_network_worker_t *worker;
+	fr_network_worker_t	*worker;
+	fr_channel_dispatch_t	dispatch = FR_CHANNEL_DISPATCH_LEAST_LOADED;
+	uint32_t		key = 0;
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
+	/*
+	 *	Ask the application which client / session the packet
+	 *	belongs to, so that we can try to send it to the same
+	 *	worker as the previous packets.
+	 */
+	if (nr->config.dispatch == FR_NETWORK_DISPATCH_AFFINITY) {
+		dispatch = FR_CHANNEL_DISPATCH_AFFINITY_FALLBACK;
+
+		if (cd->listen && cd->listen->app && cd->listen->app->affinity) {
+			key = cd->listen->app->affinity(cd->listen->app_instance, cd->packet_ctx,
+							cd->m.data, cd->m.data_size);
+		}
+	}
+
 retry:
 	if (nr->num_workers == 1) {
 		worker = nr->workers[0];
@@ -603,6 +784,11 @@ retry:
 			return -1;
 		}
 
+	} else if (key && ((worker = fr_network_affinity_worker(nr, key, &dispatch)) != NULL)) {
+		/*
+		 *	Found a worker which isn't overloaded.
+		 */
+
 	} else if (nr->num_blocked == 0) {
 		int64_t cmp;
 		uint32_t one, two;
@@ -703,6 +889,7 @@ retry:
 	 *	happens, we have no idea what to do, and the whole
 	 *	thing falls over.
 	 */
+	cd->request.dispatch = dispatch;
 	if (fr_channel_send_request(worker->channel, cd) < 0) {
 		worker->stats.dropped++;
 		worker->blocked = true;
@@ -849,6 +1036,7 @@ static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s)
 static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int flags, void *ctx)
 {
 	int			num_messages = 0;
+	unsigned int		num_read = 0;
 	fr_network_socket_t	*s = ctx;
 	fr_network_t		*nr = s->nr;
 	ssize_t			data_size;
@@ -859,6 +1047,7 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 
 	DEBUG3("Reading data from FD %u", sockfd);
 
+read_again:
 	if (!s->cd) {
 		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
 		if (!cd) {
@@ -880,7 +1069,7 @@ next_message:
 	 */
 	if (num_messages > 16) {
 		s->cd = cd;
-		return;
+		goto done;
 	}
 
 	cd->priority = PRIORITY_NORMAL;
@@ -898,6 +1087,13 @@ next_message:
 	data_size = s->listen->app_io->read(s->listen, &cd->packet_ctx, &cd->request.recv_time,
 					    cd->m.data, cd->m.rb_size, &s->leftover);
 	if (data_size == 0) {
+		/*
+		 *	The packet was discarded, but the app_io
+		 *	still has more packets from the same batch.
+		 *	Re-use the current buffer for the next one.
+		 */
+		if (s->listen->read_again) goto next_message;
+
 		/*
 		 *	Cache the message for later.  This is
 		 *	important for stream sockets, which can do
@@ -910,7 +1106,7 @@ next_message:
 		 *	blocking issues can happen for stream sockets.
 		 */
 		s->cd = cd;
-		return;
+		goto done;
 	}
 
 	/*
@@ -926,6 +1122,7 @@ next_message:
 	DEBUG3("Read %zd byte(s) from FD %u", data_size, sockfd);
 	nr->stats.in++;
 	s->stats.in++;
+	num_read++;
 
 	/*
 	 *	Initialize the rest of the fields of the channel data.
@@ -1012,6 +1209,21 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	The app_io read a batch of datagrams with one system
+	 *	call, and there are still some left.  They won't
+	 *	trigger another read event, so we have to get them
+	 *	now.  The batch size is bounded by the app_io, so
+	 *	this doesn't starve the other sockets.
+	 */
+	if (s->listen->read_again) goto read_again;
+
+done:
+	if (num_read) {
+		s->read_batches++;
+		s->read_batch_packets += num_read;
+	}
 }
 
 int fr_network_sendto_worker(fr_network_t *nr, fr_listen_t *li, void *packet_ctx, uint8_t const *data, size_t data_len, fr_time_t recv_time)
@@ -1115,6 +1327,32 @@ static fr_event_update_t const resume_write[] = {
 };
 
 
+/** Tell the app_io to write any replies which it has queued
+ *
+ * @param nr	the network
+ * @param s	the socket to flush
+ * @return
+ *	- 0 if all of the queued replies have been written.
+ *	- 1 if replies are still queued, because the socket would block.
+ *	- <0 on error.
+ */
+static inline int fr_network_flush(fr_network_t *nr, fr_network_socket_t *s)
+{
+	fr_io_flush_stats_t	stats = { 0 };
+	int			ret;
+
+	if (!s->listen->app_io->flush) return 0;
+
+	ret = s->listen->app_io->flush(s->listen, &stats);
+
+	s->write_syscalls_saved += stats.syscalls_saved;
+	nr->write_syscalls_saved += stats.syscalls_saved;
+	s->write_dropped += stats.dropped;
+	nr->write_dropped += stats.dropped;
+
+	return ret;
+}
+
 /** Write packets to the network.
  *
  * @param el the event list
@@ -1128,6 +1366,8 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 	fr_listen_t *li = s->listen;
 	fr_network_t *nr = s->nr;
 	fr_channel_data_t *cd;
+	fr_time_t now = fr_time();
+	int rcode;
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
@@ -1144,8 +1384,6 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 	}
 
 	while (cd != NULL) {
-		int rcode;
-
 		fr_assert(li == cd->listen);
 		rcode = li->app_io->write(li, cd->packet_ctx,
 					  cd->reply.request_time,
@@ -1191,6 +1429,7 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 				}
 
 				s->pending = cd;
+				(void) fr_network_flush(nr, s);
 				return;
 			}
 
@@ -1222,6 +1461,15 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 
 		s->written = 0;
 
+		/*
+		 *	The worker set "when" as it sent the reply.
+		 */
+		if (fr_time_gt(now, cd->m.when)) {
+			fr_histogram_record(nr->reply_delay, fr_time_delta_unwrap(fr_time_sub(now, cd->m.when)));
+		} else {
+			fr_histogram_record(nr->reply_delay, 0);
+		}
+
 		/*
 		 *	Reset for the next message.
 		 */
@@ -1235,6 +1483,31 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		cd = fr_heap_pop(&s->waiting);
 	}
 
+	/*
+	 *	The app_io may have queued the packets, so that it can
+	 *	write them all at once.  If the socket would block,
+	 *	then wait until it's writable, and flush again.
+	 */
+	rcode = fr_network_flush(nr, s);
+	if (rcode < 0) {
+		PERROR("Failed writing to socket %s", s->listen->name);
+		fr_network_socket_dead(nr, s);
+		return;
+	}
+
+	if (rcode > 0) {
+		if (!s->blocked) {
+			if (fr_event_filter_update(nr->el, s->listen->fd, FR_EVENT_FILTER_IO, resume_write) < 0) {
+				PERROR("Failed adding write callback to event loop");
+				fr_network_socket_dead(nr, s);
+				return;
+			}
+
+			s->blocked = true;
+		}
+		return;
+	}
+
 	/*
 	 *	We've successfully written all of the packets.  Remove
 	 *	the write callback.
@@ -1254,6 +1527,8 @@ static int _network_socket_free(fr_network_socket_t *s)
 
 	fr_assert(s->outstanding == 0);
 
+	if (fr_dlist_entry_in_list(&s->write_entry)) fr_dlist_remove(&nr->write_sockets, s);
+
 	fr_rb_delete(nr->sockets, s);
 	fr_rb_delete(nr->sockets_by_num, s);
 
@@ -1523,6 +1798,7 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 		if (nr->workers[i]) continue;
 
 		nr->workers[i] = w;
+		fr_network_ring_build(nr);
 		return;
 	}
 
@@ -1593,6 +1869,7 @@ static int fr_network_pre_event(UNUSED fr_time_t now, UNUSED fr_time_delta_t wak
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
 {
 	fr_channel_data_t *cd;
+	fr_network_socket_t *s;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
 	/*
@@ -1601,7 +1878,6 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 	 */
 	while ((cd = fr_heap_pop(&nr->replies)) != NULL) {
 		fr_listen_t *li;
-		fr_network_socket_t *s;
 
 		li = cd->listen;
 
@@ -1647,18 +1923,29 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 			continue;
 		}
 
+		(void) fr_heap_insert(&s->waiting, cd);
+
 		/*
-		 *	No pending message, let's try writing it.
+		 *	No pending message, so we'll write the reply
+		 *	once we've gathered all of the replies for this
+		 *	socket.  That lets the app_io coalesce them.
 		 *
-		 *	If there is a pending message, then we're
-		 *	waiting for IO write to become ready.
+		 *	If there is a pending message, or the app_io
+		 *	still has replies queued, then we're waiting
+		 *	for IO write to become ready, and the write
+		 *	callback will take care of the reply.
 		 */
-		if (!s->pending) {
-			fr_assert(!s->blocked);
-			(void) fr_heap_insert(&s->waiting, cd);
-			fr_network_write(nr->el, s->listen->fd, 0, s);
+		if (!s->pending && !s->blocked && !fr_dlist_entry_in_list(&s->write_entry)) {
+			fr_dlist_insert_tail(&nr->write_sockets, s);
 		}
 	}
+
+	/*
+	 *	Write all of the replies, one socket at a time.
+	 */
+	while ((s = fr_dlist_pop_head(&nr->write_sockets)) != NULL) {
+		fr_network_write(nr->el, s->listen->fd, 0, s);
+	}
 }
 
 /** Stop a network thread in an orderly way
@@ -1851,6 +2138,12 @@ static int _fr_network_free(fr_network_t *nr)
 	if (nr->signal_pipe[0] >= 0) close(nr->signal_pipe[0]);
 	if (nr->signal_pipe[1] >= 0) close(nr->signal_pipe[1]);
 
+	if (fr_dlist_entry_in_list(&nr->entry)) {
+		pthread_mutex_lock(&network_list_mutex);
+		fr_dlist_remove(&network_list, nr);
+		pthread_mutex_unlock(&network_list_mutex);
+	}
+
 	return 0;
 }
 
@@ -1877,10 +2170,18 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		fr_strerror_const("Failed allocating memory");
 		return NULL;
 	}
+	fr_dlist_entry_init(&nr->entry);
 	talloc_set_destructor(nr, _fr_network_free);
 
 	nr->name = talloc_strdup(nr, name);
 
+	nr->reply_delay = fr_histogram_alloc(nr, NETWORK_LATENCY_MAX, NETWORK_LATENCY_PRECISION);
+	if (!nr->reply_delay) {
+		talloc_free(nr);
+		fr_strerror_const("Failed allocating memory");
+		return NULL;
+	}
+
 	nr->thread_id = pthread_self();
 	nr->el = el;
 	nr->log = logger;
@@ -1966,6 +2267,8 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	fr_dlist_talloc_init(&nr->write_sockets, fr_network_socket_t, write_entry);
+
 	if (fr_event_pre_insert(nr->el, fr_network_pre_event, nr) < 0) {
 		fr_strerror_const("Failed adding pre-check to event list");
 		goto fail2;
@@ -1988,9 +2291,44 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	pthread_mutex_lock(&network_list_mutex);
+	fr_dlist_insert_tail(&network_list, nr);
+	pthread_mutex_unlock(&network_list_mutex);
+
 	return nr;
 }
 
+/** Get the reply delay histogram for one, or all networks
+ *
+ * @param[in] ctx	to allocate the histogram in.
+ * @param[out] out	the merged histogram.
+ * @param[in] nr	to get the reply delay for.  If NULL, the
+ *			delays of all networks are merged.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_network_latency(TALLOC_CTX *ctx, fr_histogram_t **out, fr_network_t const *nr)
+{
+	fr_network_t *n;
+
+	*out = fr_histogram_alloc(ctx, NETWORK_LATENCY_MAX, NETWORK_LATENCY_PRECISION);
+	if (!*out) return -1;
+
+	if (nr) {
+		(void) fr_histogram_merge(*out, nr->reply_delay);
+		return 0;
+	}
+
+	pthread_mutex_lock(&network_list_mutex);
+	for (n = fr_dlist_head(&network_list); n; n = fr_dlist_next(&network_list, n)) {
+		(void) fr_histogram_merge(*out, n->reply_delay);
+	}
+	pthread_mutex_unlock(&network_list_mutex);
+
+	return 0;
+}
+
 int fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats)
 {
 	if (num < 0) return -1;
@@ -2021,15 +2359,23 @@ void fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log)
 	}
 }
 
-static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	fr_network_t const *nr = ctx;
 
-	fprintf(fp, "count.in\t%" PRIu64 "\n", nr->stats.in);
-	fprintf(fp, "count.out\t%" PRIu64 "\n", nr->stats.out);
-	fprintf(fp, "count.dup\t%" PRIu64 "\n", nr->stats.dup);
-	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
-	fprintf(fp, "count.sockets\t%u\n", fr_rb_num_elements(nr->sockets));
+	if ((info->argc == 0) || (strcmp(info->argv[0], "count") == 0)) {
+		fprintf(fp, "count.in\t%" PRIu64 "\n", nr->stats.in);
+		fprintf(fp, "count.out\t%" PRIu64 "\n", nr->stats.out);
+		fprintf(fp, "count.dup\t%" PRIu64 "\n", nr->stats.dup);
+		fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
+		fprintf(fp, "count.sockets\t%u\n", fr_rb_num_elements(nr->sockets));
+		fprintf(fp, "count.write_syscalls_saved\t%" PRIu64 "\n", nr->write_syscalls_saved);
+		fprintf(fp, "count.write_dropped\t%" PRIu64 "\n", nr->write_dropped);
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "latency") == 0)) {
+		fr_histogram_fprint(fp, "latency.reply_delay", nr->reply_delay, NSEC);
+	}
 
 	return 0;
 }
@@ -2069,6 +2415,11 @@ static int cmd_stats_socket(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t con
 	fprintf(fp, "count.out\t%" PRIu64 "\n", s->stats.out);
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", s->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", s->stats.dropped);
+	fprintf(fp, "count.read_batches\t%" PRIu64 "\n", s->read_batches);
+	fprintf(fp, "average.read_batch\t%.2f\n",
+		s->read_batches ? ((double) s->read_batch_packets / (double) s->read_batches) : 0.0);
+	fprintf(fp, "count.write_syscalls_saved\t%" PRIu64 "\n", s->write_syscalls_saved);
+	fprintf(fp, "count.write_dropped\t%" PRIu64 "\n", s->write_dropped);
 
 	return 0;
 }
@@ -2086,6 +2437,7 @@ fr_cmd_table_t cmd_network_table[] = {
 		.parent = "stats network",
 		.add_name = true,
 		.name = "self",
+		.syntax = "[(count|latency)]",
 		.func = cmd_stats_self,
 		.help = "Show statistics for a specific network thread.",
 		.read_only = true
@@ -42,8 +42,22 @@ typedef struct fr_network_s fr_network_t;
 extern "C" {
 #endif
 
+/** How the network thread picks a worker for each packet
+ *
+ */
+typedef enum {
+	FR_NETWORK_DISPATCH_LEAST_LOADED = 0,	//!< Least loaded of two randomly chosen workers.
+	FR_NETWORK_DISPATCH_AFFINITY		//!< Consistent hash of the packet's affinity key, with
+						///< bounded load.
+} fr_network_dispatch_t;
+
 typedef struct {
-	uint32_t	max_outstanding;
+	uint32_t		max_outstanding;
+
+	fr_network_dispatch_t	dispatch;		//!< How workers are chosen.
+	uint32_t		dispatch_max_imbalance;	//!< How far (in percent) above the average load a
+							///< worker can be, before affinity packets
+							///< spill over to the next worker.
 } fr_network_config_t;
 
 int		fr_network_listen_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
@@ -82,6 +96,8 @@ int		fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats) CC_HINT(
 
 void		fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log) CC_HINT(nonnull);
 
+int		fr_network_latency(TALLOC_CTX *ctx, fr_histogram_t **out, fr_network_t const *nr) CC_HINT(nonnull(2));
+
 extern fr_cmd_table_t cmd_network_table[];
 
 #ifdef __cplusplus
@@ -28,6 +28,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/autoconf.h>
 
+#include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/rb.h>
@@ -218,6 +219,11 @@ static void *fr_schedule_worker_thread(void *arg)
 		goto fail;
 	}
 
+	if (fr_time_delta_ispos(sc->config->timer_wheel_resolution) &&
+	    (fr_event_list_timer_wheel(sw->el, sc->config->timer_wheel_resolution) < 0)) {
+		PERROR("%s - Failed creating timer wheel", worker_name);
+		goto fail;
+	}
 
 	sw->worker = fr_worker_create(ctx, sw->el, worker_name, sc->log, sc->lvl, &sc->config->worker);
 	if (!sw->worker) {
@@ -364,6 +370,12 @@ static void *fr_schedule_network_thread(void *arg)
 		goto fail;
 	}
 
+	if (fr_time_delta_ispos(sc->config->timer_wheel_resolution) &&
+	    (fr_event_list_timer_wheel(el, sc->config->timer_wheel_resolution) < 0)) {
+		PERROR("%s - Failed creating timer wheel", network_name);
+		goto fail;
+	}
+
 	sn->nr = fr_network_create(ctx, el, network_name, sc->log, sc->lvl, &sc->config->network);
 	if (!sn->nr) {
 		PERROR("%s - Failed creating network", network_name);
@@ -446,6 +458,52 @@ int fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *a
 	return 0;
 }
 
+/** Show the latencies of all workers and networks, merged together
+ *
+ */
+static int cmd_stats_latency(FILE *fp, FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	TALLOC_CTX	*tmp_ctx;
+	fr_histogram_t	*worker[FR_WORKER_LATENCY_MAX];
+	fr_histogram_t	*network;
+	unsigned int	i;
+
+	tmp_ctx = talloc_new(NULL);
+	if (!tmp_ctx) return -1;
+
+	if ((fr_worker_latency(tmp_ctx, worker, NULL) < 0) ||
+	    (fr_network_latency(tmp_ctx, &network, NULL) < 0)) {
+		fprintf(fp_err, "Failed merging latencies\n");
+		talloc_free(tmp_ctx);
+		return -1;
+	}
+
+	for (i = 0; i < FR_WORKER_LATENCY_MAX; i++) {
+		char prefix[32];
+
+		snprintf(prefix, sizeof(prefix), "latency.%s",
+			 fr_table_str_by_value(fr_worker_latency_table, i, "<INVALID>"));
+		fr_histogram_fprint(fp, prefix, worker[i], NSEC);
+	}
+	fr_histogram_fprint(fp, "latency.reply_delay", network, NSEC);
+
+	talloc_free(tmp_ctx);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_schedule_table[] = {
+	{
+		.parent = "stats",
+		.name = "latency",
+		.func = cmd_stats_latency,
+		.help = "Show latencies merged over all worker and network threads.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 /** Create a scheduler and spawn the child threads.
  *
  * @param[in] ctx				talloc context.
@@ -490,6 +548,13 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	 *	If we're single-threaded, create network / worker, and insert them into the event loop.
 	 */
 	if (el) {
+		if (fr_time_delta_ispos(sc->config->timer_wheel_resolution) &&
+		    (fr_event_list_timer_wheel(el, sc->config->timer_wheel_resolution) < 0)) {
+			PERROR("Failed creating timer wheel");
+			talloc_free(sc);
+			return NULL;
+		}
+
 		sc->single_network = fr_network_create(sc, el, "Network", sc->log, sc->lvl, &sc->config->network);
 		if (!sc->single_network) {
 			PERROR("Failed creating network");
@@ -535,6 +600,11 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 			goto st_fail;
 		}
 
+		if (fr_command_register_hook(NULL, NULL, sc, cmd_schedule_table) < 0) {
+			PERROR("Failed adding scheduler commands");
+			goto st_fail;
+		}
+
 		(void) fr_network_worker_add(sc->single_network, sc->single_worker);
 		DEBUG("Scheduler created in single-threaded mode");
 
@@ -737,6 +807,11 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 	}
 
+	if (fr_command_register_hook(NULL, NULL, sc, cmd_schedule_table) < 0) {
+		PERROR("Failed adding scheduler commands");
+		goto st_fail;
+	}
+
 	if (sc) INFO("Scheduler created successfully with %u networks and %u workers",
 		     sc->config->max_networks, (unsigned int)fr_dlist_num_elements(&sc->workers));
 
@@ -884,12 +959,20 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 		nr = sc->single_network;
 	} else {
 		fr_schedule_network_t *sn;
+		unsigned int i;
 
 		/*
+		 *	Each shard of a listener goes to a different
+		 *	network thread.  Everything else goes to the
+		 *	first one.
+		 *
 		 *	@todo - round robin it among the listeners?
 		 *	or maybe add it to the same parent thread?
 		 */
 		sn = fr_dlist_head(&sc->networks);
+		for (i = 0; i < (li->shard % fr_dlist_num_elements(&sc->networks)); i++) {
+			sn = fr_dlist_next(&sc->networks, sn);
+		}
 		nr = sn->nr;
 	}
 
@@ -76,6 +76,9 @@ static void worker_verify(fr_worker_t *worker);
 #define CACHE_LINE_SIZE	64
 static alignas(CACHE_LINE_SIZE) atomic_uint64_t request_number = 0;
 
+#define WORKER_LATENCY_MAX	((uint64_t) 60 * NSEC)	//!< Longer latencies are recorded as this.
+#define WORKER_LATENCY_PRECISION (7)			//!< Significant bits, i.e. within 1%.
+
 static _Thread_local fr_ring_buffer_t *fr_worker_rb;
 
 typedef struct {
@@ -119,10 +122,15 @@ struct fr_worker_s {
 	fr_io_stats_t		stats;		//!< input / output stats
 	fr_time_elapsed_t	cpu_time;	//!< histogram of total CPU time per request
 	fr_time_elapsed_t	wall_clock;	//!< histogram of wall clock time per request
+	fr_histogram_t		*latency[FR_WORKER_LATENCY_MAX];	//!< where requests spend their time.
 
 	uint64_t    		num_naks;	//!< number of messages which were nak'd
 	uint64_t    		num_active;	//!< number of active requests
 
+	uint64_t		dispatch[FR_CHANNEL_DISPATCH_MAX];	//!< how the network threads chose us
+
+	request_arena_stats_t const *arena_stats;	//!< request allocator stats for this thread
+
 	fr_time_delta_t		predicted;	//!< How long we predict a request will take to execute.
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
 
@@ -134,6 +142,27 @@ struct fr_worker_s {
 	fr_event_timer_t const	*ev_cleanup;	//!< timer for max_request_time
 
 	fr_worker_channel_t	*channel;	//!< list of channels
+
+	fr_dlist_t		entry;		//!< in the list of all workers.
+};
+
+fr_table_num_ordered_t const fr_worker_latency_table[] = {
+	{ L("queued"),		FR_WORKER_LATENCY_QUEUED	},
+	{ L("processing"),	FR_WORKER_LATENCY_PROCESSING	},
+	{ L("yielded"),		FR_WORKER_LATENCY_YIELDED	}
+};
+size_t fr_worker_latency_table_len = NUM_ELEMENTS(fr_worker_latency_table);
+
+/*
+ *	All workers, so that their latency histograms can be merged.
+ *	The mutex is only taken when workers are created or freed,
+ *	and when the histograms are read.  Workers never take it when
+ *	recording latencies.
+ */
+static pthread_mutex_t worker_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t worker_list = {
+	.entry = FR_DLIST_ENTRY_INITIALISER(worker_list.entry),
+	.offset = offsetof(fr_worker_t, entry)
 };
 
 typedef struct {
@@ -209,6 +238,7 @@ static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *
 	fr_worker_t *worker = ctx;
 
 	worker->stats.in++;
+	if (cd->request.dispatch < FR_CHANNEL_DISPATCH_MAX) worker->dispatch[cd->request.dispatch]++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
 	cd->channel.ch = ch;
 	worker_request_bootstrap(worker, cd, fr_time());
@@ -715,6 +745,26 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, bool send
 	fr_time_elapsed_update(&worker->cpu_time, now, fr_time_add(now, reply->reply.processing_time));
 	fr_time_elapsed_update(&worker->wall_clock, reply->reply.request_time, now);
 
+	/*
+	 *	Time spent waiting before we first ran the request is
+	 *	queueing.  All other time spent waiting was spent
+	 *	yielded, waiting for modules to resume the request.
+	 */
+	if (fr_time_ispos(request->async->first_resumed)) {
+		fr_time_delta_t queued = fr_time_sub(request->async->first_resumed, request->async->recv_time);
+		fr_time_delta_t yielded = fr_time_delta_sub(request->async->tracking.waiting_total,
+							    fr_time_sub(request->async->first_resumed,
+									request->async->tracking.started));
+
+		if (fr_time_delta_isneg(queued)) queued = fr_time_delta_wrap(0);
+		if (fr_time_delta_isneg(yielded)) yielded = fr_time_delta_wrap(0);
+
+		fr_histogram_record(worker->latency[FR_WORKER_LATENCY_QUEUED], fr_time_delta_unwrap(queued));
+		fr_histogram_record(worker->latency[FR_WORKER_LATENCY_YIELDED], fr_time_delta_unwrap(yielded));
+	}
+	fr_histogram_record(worker->latency[FR_WORKER_LATENCY_PROCESSING],
+			    fr_time_delta_unwrap(reply->reply.processing_time));
+
 	RDEBUG("Finished request");
 
 	/*
@@ -1279,8 +1329,12 @@ static void _worker_request_yield(request_t *request, UNUSED void *uctx)
  */
 static void _worker_request_resume(request_t *request, UNUSED void *uctx)
 {
+	fr_time_t now = fr_time();
+
 	RDEBUG3("Request resuming");
-	fr_time_tracking_resume(&request->async->tracking, fr_time());
+	fr_time_tracking_resume(&request->async->tracking, now);
+
+	if (!fr_time_ispos(request->async->first_resumed)) request->async->first_resumed = now;
 }
 
 /** Check if a request is scheduled
@@ -1338,6 +1392,20 @@ static inline CC_HINT(always_inline) void worker_run_request(fr_worker_t *worker
 	}
 }
 
+/** Remove a worker from the list of all workers
+ *
+ */
+static int _worker_free(fr_worker_t *worker)
+{
+	if (!fr_dlist_entry_in_list(&worker->entry)) return 0;
+
+	pthread_mutex_lock(&worker_list_mutex);
+	fr_dlist_remove(&worker_list, worker);
+	pthread_mutex_unlock(&worker_list_mutex);
+
+	return 0;
+}
+
 /** Create a worker
  *
  * @param[in] ctx the talloc context
@@ -1353,7 +1421,8 @@ static inline CC_HINT(always_inline) void worker_run_request(fr_worker_t *worker
 fr_worker_t *fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *name, fr_log_t const *logger, fr_log_lvl_t lvl,
 			      fr_worker_config_t *config)
 {
-	fr_worker_t *worker;
+	fr_worker_t	*worker;
+	unsigned int	i;
 
 	worker = talloc_zero(ctx, fr_worker_t);
 	if (!worker) {
@@ -1361,6 +1430,8 @@ nomem:
 		fr_strerror_const("Failed allocating memory");
 		return NULL;
 	}
+	fr_dlist_entry_init(&worker->entry);
+	talloc_set_destructor(worker, _worker_free);
 
 	worker->name = talloc_strdup(worker, name); /* thread locality */
 
@@ -1392,6 +1463,14 @@ nomem:
 		goto nomem;
 	}
 
+	for (i = 0; i < FR_WORKER_LATENCY_MAX; i++) {
+		worker->latency[i] = fr_histogram_alloc(worker, WORKER_LATENCY_MAX, WORKER_LATENCY_PRECISION);
+		if (!worker->latency[i]) {
+			talloc_free(worker);
+			goto nomem;
+		}
+	}
+
 	worker->thread_id = pthread_self();
 	worker->el = el;
 	worker->log = logger;
@@ -1452,6 +1531,11 @@ nomem:
 		goto fail;
 	}
 
+	/*
+	 *	Size the per-request arena for this thread.
+	 */
+	worker->arena_stats = request_arena_init(worker->config.talloc_pool_size);
+
 	worker->intp = unlang_interpret_init(worker, el,
 					     &(unlang_request_func_t){
 							.init_internal = _worker_request_internal_init,
@@ -1475,6 +1559,10 @@ nomem:
 	}
 	unlang_interpret_set_thread_default(worker->intp);
 
+	pthread_mutex_lock(&worker_list_mutex);
+	fr_dlist_insert_tail(&worker_list, worker);
+	pthread_mutex_unlock(&worker_list_mutex);
+
 	return worker;
 }
 
@@ -1503,8 +1591,21 @@ void fr_worker(fr_worker_t *worker)
 		 */
 		wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
 		if (wait_for_event) {
+			int i;
+
 			if (worker->exiting && (fr_minmax_heap_num_elements(worker->time_order) == 0)) break;
 
+			/*
+			 *	Tell the network threads that we're
+			 *	going to sleep.  They don't signal us
+			 *	for new requests until we do.
+			 */
+			for (i = 0; i < worker->config.max_channels; i++) {
+				if (!worker->channel[i].ch) continue;
+
+				(void) fr_channel_responder_sleeping(worker->channel[i].ch);
+			}
+
 			DEBUG4("Ready to process requests");
 		}
 
@@ -1588,6 +1689,10 @@ void fr_worker_debug(fr_worker_t *worker, FILE *fp)
 
 	fr_time_tracking_debug(&worker->tracking, fp);
 
+	fprintf(fp, "\trequest arena pool_size = %zu\n", worker->arena_stats->pool_size);
+	fprintf(fp, "\trequest arena alloced = %" PRIu64 " reused = %" PRIu64 " released = %" PRIu64 " freed = %" PRIu64 "\n",
+		worker->arena_stats->alloced, worker->arena_stats->reused,
+		worker->arena_stats->released, worker->arena_stats->freed);
 }
 
 /** Create a channel to the worker
@@ -1692,6 +1797,46 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	return 6;
 }
 
+/** Get the latency histograms for one, or all workers
+ *
+ * The histograms are merged from the ones the workers record to, so
+ * this can be called from any thread.
+ *
+ * @param[in] ctx	to allocate the histograms in.
+ * @param[out] out	one histogram for each #fr_worker_latency_t.
+ * @param[in] worker	to get the latencies for.  If NULL, the
+ *			latencies of all workers are merged.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_worker_latency(TALLOC_CTX *ctx, fr_histogram_t *out[static FR_WORKER_LATENCY_MAX], fr_worker_t const *worker)
+{
+	fr_worker_t	*w;
+	unsigned int	i;
+
+	for (i = 0; i < FR_WORKER_LATENCY_MAX; i++) {
+		out[i] = fr_histogram_alloc(ctx, WORKER_LATENCY_MAX, WORKER_LATENCY_PRECISION);
+		if (!out[i]) {
+			while (i > 0) TALLOC_FREE(out[--i]);
+			return -1;
+		}
+	}
+
+	if (worker) {
+		for (i = 0; i < FR_WORKER_LATENCY_MAX; i++) (void) fr_histogram_merge(out[i], worker->latency[i]);
+		return 0;
+	}
+
+	pthread_mutex_lock(&worker_list_mutex);
+	for (w = fr_dlist_head(&worker_list); w; w = fr_dlist_next(&worker_list, w)) {
+		for (i = 0; i < FR_WORKER_LATENCY_MAX; i++) (void) fr_histogram_merge(out[i], w->latency[i]);
+	}
+	pthread_mutex_unlock(&worker_list_mutex);
+
+	return 0;
+}
+
 static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	fr_worker_t const *worker = ctx;
@@ -1725,6 +1870,38 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fr_time_elapsed_fprint(fp, &worker->wall_clock, "time.requests", 4);
 	}
 
+	if ((info->argc == 0) || (strcmp(info->argv[0], "dispatch") == 0)) {
+		fprintf(fp, "dispatch.least_loaded		%" PRIu64 "\n", worker->dispatch[FR_CHANNEL_DISPATCH_LEAST_LOADED]);
+		fprintf(fp, "dispatch.affinity		%" PRIu64 "\n", worker->dispatch[FR_CHANNEL_DISPATCH_AFFINITY]);
+		fprintf(fp, "dispatch.affinity_spill		%" PRIu64 "\n", worker->dispatch[FR_CHANNEL_DISPATCH_AFFINITY_SPILL]);
+		fprintf(fp, "dispatch.affinity_fallback	%" PRIu64 "\n", worker->dispatch[FR_CHANNEL_DISPATCH_AFFINITY_FALLBACK]);
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "alloc") == 0)) {
+		request_arena_stats_t const *arena = worker->arena_stats;
+
+		fprintf(fp, "alloc.pool_size			%zu\n", arena->pool_size);
+		fprintf(fp, "alloc.alloced			%" PRIu64 "\n", arena->alloced);
+		fprintf(fp, "alloc.reused			%" PRIu64 "\n", arena->reused);
+		fprintf(fp, "alloc.released			%" PRIu64 "\n", arena->released);
+		fprintf(fp, "alloc.freed			%" PRIu64 "\n", arena->freed);
+		fprintf(fp, "alloc.in_use			%u\n", arena->in_use);
+		fprintf(fp, "alloc.in_use_max		%u\n", arena->in_use_max);
+		fprintf(fp, "alloc.free			%u\n", arena->num_free);
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "latency") == 0)) {
+		unsigned int i;
+
+		for (i = 0; i < FR_WORKER_LATENCY_MAX; i++) {
+			char prefix[32];
+
+			snprintf(prefix, sizeof(prefix), "latency.%s",
+				 fr_table_str_by_value(fr_worker_latency_table, i, "<INVALID>"));
+			fr_histogram_fprint(fp, prefix, worker->latency[i], NSEC);
+		}
+	}
+
 	return 0;
 }
 
@@ -1740,7 +1917,7 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.parent = "stats worker",
 		.add_name = true,
 		.name = "self",
-		.syntax = "[(count|cpu)]",
+		.syntax = "[(count|cpu|dispatch|alloc|latency)]",
 		.func = cmd_stats_worker,
 		.help = "Show statistics for a specific worker thread.",
 		.read_only = true
@@ -45,6 +45,7 @@ typedef struct fr_worker_s fr_worker_t;
 #include <freeradius-devel/server/command.h>
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/histogram.h>
 #include <freeradius-devel/util/log.h>
 #include <freeradius-devel/util/talloc.h>
 
@@ -55,6 +56,19 @@ extern "C" {
 #endif
 extern fr_cmd_table_t cmd_worker_table[];
 
+/** Latencies which are recorded for each request a worker processes
+ *
+ */
+typedef enum {
+	FR_WORKER_LATENCY_QUEUED = 0,		//!< From the packet being read, to the worker first running it.
+	FR_WORKER_LATENCY_PROCESSING,		//!< Time the worker spent running the request.
+	FR_WORKER_LATENCY_YIELDED,		//!< Time the request spent yielded, waiting on modules.
+	FR_WORKER_LATENCY_MAX
+} fr_worker_latency_t;
+
+extern fr_table_num_ordered_t const fr_worker_latency_table[];
+extern size_t fr_worker_latency_table_len;
+
 typedef struct {
 	int		max_requests;		//!< max requests this worker will handle
 
@@ -85,6 +99,9 @@ fr_channel_t	*fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 
 int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HINT(nonnull);
 
+int		fr_worker_latency(TALLOC_CTX *ctx, fr_histogram_t *out[static FR_WORKER_LATENCY_MAX],
+				  fr_worker_t const *worker) CC_HINT(nonnull(2));
+
 int		fr_worker_listen_cancel(fr_worker_t *worker, fr_listen_t const *li);
 
 #include <freeradius-devel/server/module.h>
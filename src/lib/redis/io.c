@@ -54,15 +54,65 @@ static void _redis_disconnected(redisAsyncContext const *ac, UNUSED int status)
 	fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
 }
 
+/** Called by hiredis with the response to AUTH or SELECT
+ *
+ * These are sent without a SQN, as they're issued before any
+ * commands from the trunk, and hiredis processes responses
+ * in order.
+ */
+static void _redis_setup_reply(redisAsyncContext *ac, void *vreply, void *privdata)
+{
+	fr_connection_t		*conn = talloc_get_type_abort(ac->data, fr_connection_t);
+	redisReply		*reply = vreply;
+	char const		*cmd = privdata;
+
+	/*
+	 *	Async context is being freed
+	 */
+	if (!reply) return;
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		ERROR("%s failed: %s", cmd, reply->str);
+		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+	}
+}
+
 /** Called by hiredis to indicate the connection is live
  *
  */
-static void _redis_connected(redisAsyncContext const *ac, UNUSED int status)
+static void _redis_connected(redisAsyncContext const *ac, int status)
 {
 	fr_connection_t		*conn = talloc_get_type_abort(ac->data, fr_connection_t);
+	fr_redis_handle_t	*h = conn->h;
+	fr_redis_io_conf_t const *conf = h->conf;
+
+	if (status != REDIS_OK) {
+		ERROR("Failed connecting to %s:%u: %s", conf->hostname, conf->port, ac->errstr);
+		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+		return;
+	}
 
 	DEBUG4("Signalled by hiredis, connection is open");
 
+	/*
+	 *	These are written to the output buffer before any
+	 *	commands from the trunk, so the server will process
+	 *	them first.  We don't need to wait for the responses
+	 *	before marking the connection as connected.
+	 */
+	if (conf->password) {
+		if (conf->username) {
+			redisAsyncCommand(h->ac, _redis_setup_reply, UNCONST(char *, "AUTH"), "AUTH %s %s",
+					  conf->username, conf->password);
+		} else {
+			redisAsyncCommand(h->ac, _redis_setup_reply, UNCONST(char *, "AUTH"),
+					  "AUTH %s", conf->password);
+		}
+	}
+	if (conf->database) {
+		redisAsyncCommand(h->ac, _redis_setup_reply, UNCONST(char *, "SELECT"), "SELECT %u", conf->database);
+	}
+
 	fr_connection_signal_connected(conn);
 }
 
@@ -316,18 +366,19 @@ static fr_connection_state_t _redis_io_connection_init(void **h_out, fr_connecti
 	 */
 	MEM(h = talloc_zero(conn, fr_redis_handle_t));
 	talloc_set_destructor(h, _redis_handle_free);
+	h->conf = conf;
 
 	h->ac = redisAsyncConnect(host, port);
 	if (!h->ac) {
 		ERROR("Failed allocating handle for %s:%u", host, port);
+	error:
+		talloc_free(h);		/* Destructor frees the async context */
 		return FR_CONNECTION_STATE_FAILED;
 	}
 
 	if (h->ac->err) {
 		ERROR("Failed allocating handle for %s:%u: %s", host, port, h->ac->errstr);
-	error:
-		redisAsyncFree(h->ac);
-		return FR_CONNECTION_STATE_FAILED;
+		goto error;
 	}
 
 	/*
@@ -39,10 +39,11 @@ extern "C" {
 #endif
 
 typedef struct {
-	char			*hostname;
+	char const		*hostname;
 	uint16_t		port;
 	uint32_t		database;	//!< number on Redis server.
 
+	char const		*username;	//!< for acls.
 	char const		*password;	//!< to authenticate to Redis.
 	fr_time_delta_t		connection_timeout;
 	fr_time_delta_t		reconnection_delay;
@@ -70,6 +71,8 @@ typedef struct {
 							///< a callback loop.
 	fr_event_timer_t const	*timer;			//!< Connection timer.
 
+	fr_redis_io_conf_t const *conf;			//!< Host and credentials this handle connects with.
+
 
 	redisAsyncContext	*ac;			//!< Async handle for hiredis.
 
@@ -105,13 +108,22 @@ static inline fr_redis_sqn_t fr_redis_connection_sent_request(fr_redis_handle_t
  */
 static inline void fr_redis_connection_ignore_response(fr_redis_handle_t *h, fr_redis_sqn_t sqn)
 {
-	fr_redis_sqn_ignore_t *ignore;
+	fr_redis_sqn_ignore_t *ignore, *prev;
 
-	fr_assert(sqn <= h->rsp_sqn);
+	fr_assert(sqn >= h->rsp_sqn);
 
 	MEM(ignore = talloc_zero(h, fr_redis_sqn_ignore_t));
 	ignore->sqn = sqn;
-	fr_dlist_insert_tail(&h->ignore, ignore);
+
+	/*
+	 *	Command sets may be cancelled in any order,
+	 *	but the list must be kept sorted so the
+	 *	head is always the next response to ignore.
+	 */
+	for (prev = fr_dlist_tail(&h->ignore);
+	     prev && (prev->sqn > sqn);
+	     prev = fr_dlist_prev(&h->ignore, prev));
+	fr_dlist_insert_after(&h->ignore, prev, ignore);
 }
 
 /** Update the response sequence number and check if we should ignore the response
@@ -27,14 +27,16 @@
 
 #include <freeradius-devel/server/connection.h>
 #include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/util/debug.h>
 
 #include "pipeline.h"
 #include "io.h"
 
-
 /** Thread local state for a cluster
  *
- * MOVE ME TO NEW ASYNC CLUSTER CODE
+ * Holds a trunk for every cluster node this thread has sent commands to.
+ * Trunks are created lazily, the first time a key maps to a node, or a
+ * MOVED/ASK redirect points at a node we haven't talked to before.
  */
 struct fr_redis_cluster_thread_s {
 	fr_event_list_t			*el;
@@ -42,13 +44,11 @@ struct fr_redis_cluster_thread_s {
 	char				*log_prefix;	//!< Common log prefix to use for all cluster related
 							///< messages.
 	bool				delay_start;	//!< Prevent connections from spawning immediately.
-};
 
-/** The thread local free list
- *
- * Any entries remaining in the list will be freed when the thread is joined
- */
-static _Thread_local fr_dlist_head_t *command_set_free_list;
+	fr_redis_cluster_t		*cluster;	//!< Shared cluster state.  Used to map keys to nodes.
+	fr_redis_conf_t const		*conf;		//!< Common configuration for connections to cluster nodes.
+	fr_rb_tree_t			*trunks;	//!< Trunks to individual cluster nodes, ordered by address.
+};
 
 typedef enum {
 	FR_REDIS_COMMAND_NORMAL = 0,			//!< A normal, non-transactional command.
@@ -70,7 +70,7 @@ struct fr_redis_command_s {
 
 	fr_redis_command_type_t		type;		//!< Redis command type.
 
-	char const			*str;		//!< The command string.
+	char const			*str;		//!< The command, in RESP (REdis Serialization Protocol) format.
 	size_t				len;		//!< Length of the command string.
 
 	uint64_t			sqn;		//!< The sequence number of the command.  This is only
@@ -85,8 +85,6 @@ struct fr_redis_command_s {
  * Commands MUST map to the same cluster node if using clustering.
  */
 struct fr_redis_command_set_s {
-	fr_dlist_t			entry;
-
 	/** @name Command state lists
 	 * @{
  	 */
@@ -95,7 +93,12 @@ struct fr_redis_command_set_s {
 	fr_dlist_head_t			completed;	//!< Commands complete with replies.
 	/** @} */
 
+	fr_redis_trunk_t		*rtrunk;	//!< Trunk the command set is currently enqueued on.
 	uint8_t				redirected;	//!< How many times this command set was redirected.
+	bool				asking;		//!< Prefix the commands with "ASKING", as we're following
+							///< an ASK redirect.
+	bool				redirecting;	//!< Being removed from one trunk, so it can be enqueued
+							///< on another.  Suppresses the complete and free callbacks.
 
 	/** @name Request state
 	 *
@@ -142,6 +145,10 @@ struct fr_redis_command_set_s {
 };
 
 struct fr_redis_trunk_s {
+	fr_rb_node_t			node;		//!< Entry in the cluster thread's tree of trunks.
+	fr_ipaddr_t			ipaddr;		//!< Address of the node this trunk connects to.
+	uint16_t			port;		//!< Port of the node this trunk connects to.
+
 	fr_redis_io_conf_t const	*io_conf;	//!< Redis I/O configuration.  Specifies how to connect
 							///< to the host this trunk is used to communicate with.
 	fr_trunk_t			*trunk;		//!< Trunk containing all the connections to a specific
@@ -149,43 +156,10 @@ struct fr_redis_trunk_s {
 	fr_redis_cluster_thread_t	*cluster;	//!< Cluster this trunk belongs to.
 };
 
-/** Free any free requests when the thread is joined
- *
- */
-static int _command_set_free_list_free_on_exit(void *arg)
-{
-	fr_dlist_head_t		*list = talloc_get_type_abort(arg, fr_dlist_head_t);
-	fr_redis_command_set_t	*cmds;
-
-	/*
-	 *	See the destructor for why this works
-	 */
-	while ((cmds = fr_dlist_head(list))) if (talloc_free(cmds) < 0) return -1;
-	return talloc_free(list);
-}
-
-/** Free a command set
+/** Sent before commands which are following an ASK redirect
  *
  */
-static int _redis_command_set_free(fr_redis_command_set_t *cmds)
-{
-	if (fr_dlist_num_elements(command_set_free_list) >= 1024) return 0;	/* Keep a buffer of 1024 */
-
-	/*
-	 *	Freed from the free list....
-	 */
-	if (unlikely(fr_dlist_entry_in_list(&cmds->entry))) {
-		fr_dlist_entry_unlink(&cmds->entry);	/* Don't trust the list head to be available */
-		return 0;
-	}
-
-	talloc_free_children(cmds);
-	memset(&cmds, 0, sizeof(cmds));
-
-	fr_dlist_insert_head(command_set_free_list, cmds);
-
-	return -1;	/* Prevent the free */
-}
+static char const asking_cmd[] = "*1\r\n$6\r\nASKING\r\n";
 
 /** Allocate a new command set
  *
@@ -195,13 +169,18 @@ static int _redis_command_set_free(fr_redis_command_set_t *cmds)
  * Control will be returned to the caller via the registered complete
  * and fail functions.
  *
- * @param[in] ctx	to bind the command set's lifetime to.
+ * @note Once the command set has been enqueued, it's owned by the trunk, and
+ *	 will be freed after the complete or fail callback returns.
+ *	 If enqueueing fails, the caller must free the command set.
+ *
+ * @param[in] ctx	to bind the command set's lifetime to.  Should usually
+ *			be NULL, as the command set is freed by the trunk.
  * @param[in] request	to pass to places that need it.
  * @param[in] complete	Function to call when all commands have been processed.
  * @param[in] fail	Function to call if the command set was not executed
  *			or was partially executed.
  * @param[in] rctx	Resume context to pass to complete and fail functions.
- * @return A new or refurbished command set.
+ * @return A new command set.
  */
 fr_redis_command_set_t *fr_redis_command_set_alloc(TALLOC_CTX *ctx,
 						   request_t *request,
@@ -211,37 +190,14 @@ fr_redis_command_set_t *fr_redis_command_set_alloc(TALLOC_CTX *ctx,
 
 {
 	fr_redis_command_set_t	*cmds;
-	fr_dlist_head_t		*free_list;
 
 #define COMMAND_PRE_ALLOC_COUNT	8	//!< How much room we pre-allocate for commands.
 #define COMMAND_PRE_ALLOC_LEN	64	//!< How much we allocate for each command string.
 
-	/*
-	 *	Initialise the free list
-	 */
-	if (unlikely(!command_set_free_list)) {
-		MEM(free_list = talloc(NULL, fr_dlist_head_t));
-		fr_dlist_init(free_list, fr_redis_command_set_t, entry);
-		fr_atexit_thread_local(command_set_free_list, _command_set_free_list_free_on_exit, free_list);
-	} else {
-		free_list = command_set_free_list;
-	}
-
-	/*
-	 *	Pull an element out of the free list
-	 *	or allocate a new one.
-	 */
-	cmds = fr_dlist_head(free_list);
-	if (!cmds) {
-		MEM(cmds = talloc_zero_pooled_object(NULL, fr_redis_command_set_t,
-						     COMMAND_PRE_ALLOC_COUNT,
-						     COMMAND_PRE_ALLOC_COUNT * (sizeof(fr_redis_command_t) +
-						     COMMAND_PRE_ALLOC_LEN)));
-		talloc_set_destructor(cmds, _redis_command_set_free);
-		fr_dlist_entry_init(&cmds->entry);
-	} else {
-		fr_dlist_remove(free_list, cmds);
-	}
+	MEM(cmds = talloc_zero_pooled_object(ctx, fr_redis_command_set_t,
+					     COMMAND_PRE_ALLOC_COUNT * 2,
+					     COMMAND_PRE_ALLOC_COUNT * (sizeof(fr_redis_command_t) +
+					     COMMAND_PRE_ALLOC_LEN)));
 
 	fr_dlist_talloc_init(&cmds->pending, fr_redis_command_t, entry);
 	fr_dlist_talloc_init(&cmds->sent, fr_redis_command_t, entry);
@@ -251,8 +207,6 @@ fr_redis_command_set_t *fr_redis_command_set_alloc(TALLOC_CTX *ctx,
 	cmds->fail = fail;
 	cmds->rctx = rctx;
 
-	if (ctx) talloc_link_ctx(ctx, cmds);
-
 	return cmds;
 }
 
@@ -262,16 +216,73 @@ fr_redis_command_set_t *fr_redis_command_set_alloc(TALLOC_CTX *ctx,
  */
 static int _redis_command_free(fr_redis_command_t *cmd)
 {
-	//if (cmd->result) fr_redis_reply_free(&cmd->result);
+	fr_redis_reply_free(&cmd->result);
 
 	return 0;
 }
 
+/** Return the result of a command
+ *
+ * @param[in] cmd	to retrieve the result for.
+ * @return The result of the command.  Will be freed with the command set.
+ */
 redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd)
 {
 	return cmd->result;
 }
 
+/** Take ownership of the result of a command
+ *
+ * @param[in] cmd	to retrieve the result for.
+ * @return The result of the command.  Must be freed by the caller
+ *	with #fr_redis_reply_free.
+ */
+redisReply *fr_redis_command_steal_result(fr_redis_command_t *cmd)
+{
+	redisReply *reply = cmd->result;
+
+	cmd->result = NULL;
+
+	return reply;
+}
+
+/** Find the name of a RESP formatted command
+ *
+ * @param[out] name		Where to write a pointer to the command name.
+ * @param[out] name_len		Length of the command name.
+ * @param[in] cmd_str		RESP formatted command.
+ * @param[in] cmd_len		Length of the command.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the command is malformed.
+ */
+static int redis_command_name(char const **name, size_t *name_len, char const *cmd_str, size_t cmd_len)
+{
+	char const	*p = cmd_str, *end = cmd_str + cmd_len;
+	char		*q;
+	unsigned long	len;
+
+	/*
+	 *	*<argc>\r\n$<len>\r\n<name>\r\n
+	 */
+	if ((p >= end) || (*p != '*')) return -1;
+	p = memchr(p, '\n', end - p);
+	if (!p || (++p >= end) || (*p != '$')) return -1;
+
+	len = strtoul(p + 1, &q, 10);
+	if ((q + 2 > end) || (q[0] != '\r') || (q[1] != '\n')) return -1;
+	p = q + 2;
+	if ((size_t)(end - p) < len) return -1;
+
+	*name = p;
+	*name_len = len;
+
+	return 0;
+}
+
+#define COMMAND_IS(_name, _name_len, _str) \
+	(((_name_len) == (sizeof(_str) - 1)) && (strncasecmp(_name, _str, sizeof(_str) - 1) == 0))
+
 /** Add a preformatted/expanded command to the command set
  *
  * The command must either be entirely static, or parented by the command set.
@@ -281,7 +292,8 @@ redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd)
  * 	 things, badly.
  *
  * @param[in] cmds	Command set to add command to.
- * @param[in] cmd_str	A fully expanded/formatted command to send to redis.
+ * @param[in] cmd_str	A RESP formatted command to send to redis, such as the
+ *			output of redisFormatCommand.
  *			Must be static, or have the same lifetime as the
  *			command set (allocated with the command set as the parent).
  * @param[in] cmd_len	Length of the command.
@@ -292,9 +304,16 @@ redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd)
 fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
 							     char const *cmd_str, size_t cmd_len)
 {
-	request_t			*request = cmds->request;
+	request_t		*request = cmds->request;
 	fr_redis_command_t	*cmd;
 	fr_redis_command_type_t	type = FR_REDIS_COMMAND_NORMAL;
+	char const		*name;
+	size_t			name_len;
+
+	if (redis_command_name(&name, &name_len, cmd_str, cmd_len) < 0) {
+		ROPTIONAL(RERROR, ERROR, "Malformed command, expected RESP array");
+		return FR_REDIS_PIPELINE_BAD_CMDS;
+	}
 
 	/*
 	 *	Transaction sanity checks.
@@ -306,16 +325,15 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	 *	We try very hard to do this without incurring a performance penalty
 	 *      for non-transactional commands.
 	 */
-	switch (tolower(cmd_str[0])) {
+	switch (tolower(name[0])) {
 	case 'm':
-		if (tolower(cmd_str[1] != 'u')) break;
-		if (strncasecmp(cmd_str, "multi", sizeof("multi") - 1) != 0) break;
+		if (!COMMAND_IS(name, name_len, "multi")) break;
 		/*
 		 *	There should only ever be a difference of
 		 *	1 between txn starts and txn ends.
 		 */
-		if ((cmds->txn_end < cmds->txn_start) && ((cmds->txn_start - cmds->txn_end) > 1)) {
-			ROPTIONAL(ERROR, REDEBUG, "Too many consecutive \"MULTI\" commands");
+		if (cmds->txn_start > cmds->txn_end) {
+			ROPTIONAL(RERROR, ERROR, "Too many consecutive \"MULTI\" commands");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
 		}
 		/*
@@ -323,13 +341,12 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		 *	that's marked as the start of the transaction
 		 *	block.
 		 */
-		type = cmds->txn_watch ? FR_REDIS_COMMAND_TRANSACTION_START : FR_REDIS_COMMAND_NORMAL;
+		type = cmds->txn_watch ? FR_REDIS_COMMAND_NORMAL : FR_REDIS_COMMAND_TRANSACTION_START;
 		cmds->txn_start++;	/* Yes MULTI increments start, not WATCH */
 		break;
 
 	case 'e':
-		if (tolower(cmd_str[1] != 'e')) break;
-		if (strncasecmp(cmd_str, "exec", sizeof("exec") - 1) != 0) break;
+		if (!COMMAND_IS(name, name_len, "exec")) break;
 		goto txn_end;
 
 	/*
@@ -338,29 +355,30 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	 *	executing the commands.
 	 */
 	case 'd':
-		if (tolower(cmd_str[1] != 'i')) break;
-		if (strncasecmp(cmd_str, "discard", sizeof("discard") - 1) != 0) break;
+		if (!COMMAND_IS(name, name_len, "discard")) break;
 	txn_end:
 		if (cmds->txn_start <= cmds->txn_end) {
-			ROPTIONAL(ERROR, REDEBUG, "Transaction not started, missing \"MULTI\" command");
+			ROPTIONAL(RERROR, ERROR, "Transaction not started, missing \"MULTI\" command");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
 		}
 		type = FR_REDIS_COMMAND_TRANSACTION_END;
+		cmds->txn_watch = false;
 		cmds->txn_end++;
 		break;
 
 	case 'w':
-		if (tolower(cmd_str[1] != 'a')) break;
-		if (strncasecmp(cmd_str, "watch", sizeof("watch") - 1) != 0) break;
+		if (!COMMAND_IS(name, name_len, "watch")) break;
 		if (cmds->txn_watch) {
-			ROPTIONAL(ERROR, REDEBUG, "Too many consecutive \"WATCH\" commands");
+			ROPTIONAL(RERROR, ERROR, "Too many consecutive \"WATCH\" commands");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
 		}
 		if (cmds->txn_start > cmds->txn_end) {
-			ROPTIONAL(ERROR, REDEBUG, "\"WATCH\" can only be used before \"MULTI\"");
+			ROPTIONAL(RERROR, ERROR, "\"WATCH\" can only be used before \"MULTI\"");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
 		}
-		FALL_THROUGH;
+		type = FR_REDIS_COMMAND_TRANSACTION_START;
+		cmds->txn_watch = true;
+		break;
 
 	default:
 		break;
@@ -377,6 +395,72 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	return FR_REDIS_PIPELINE_OK;
 }
 
+/** Copy a command formatted by hiredis into the command set, and add it
+ *
+ */
+static fr_redis_pipeline_status_t redis_command_formatted_add(fr_redis_command_set_t *cmds, char *cmd_str, int cmd_len)
+{
+	request_t			*request = cmds->request;
+	char				*our_cmd_str;
+	fr_redis_pipeline_status_t	ret;
+
+	if (cmd_len < 0) {
+		ROPTIONAL(RERROR, ERROR, "Failed formatting command");
+		return FR_REDIS_PIPELINE_BAD_CMDS;
+	}
+
+	MEM(our_cmd_str = talloc_memdup(cmds, cmd_str, (size_t)cmd_len));
+	redisFreeCommand(cmd_str);
+
+	ret = fr_redis_command_preformatted_add(cmds, our_cmd_str, (size_t)cmd_len);
+	if (ret != FR_REDIS_PIPELINE_OK) talloc_free(our_cmd_str);
+
+	return ret;
+}
+
+/** Add a command to the command set, from an array of arguments
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] argc	Number of arguments, including the command name.
+ * @param[in] argv	Arguments.  Do not need to be \0 terminated.
+ * @param[in] argv_len	Length of each argument.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_argv_add(fr_redis_command_set_t *cmds,
+						     int argc, char const **argv, size_t const *argv_len)
+{
+	char	*cmd_str = NULL;
+	int	cmd_len;
+
+	cmd_len = redisFormatCommandArgv(&cmd_str, argc, argv, argv_len);
+
+	return redis_command_formatted_add(cmds, cmd_str, cmd_len);
+}
+
+/** Add a command to the command set, using a hiredis format string
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] fmt	hiredis format string, i.e. "SET %b %s".
+ * @param[in] ...	Arguments for the format string.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_add(fr_redis_command_set_t *cmds, char const *fmt, ...)
+{
+	va_list	ap;
+	char	*cmd_str = NULL;
+	int	cmd_len;
+
+	va_start(ap, fmt);
+	cmd_len = redisvFormatCommand(&cmd_str, fmt, ap);
+	va_end(ap);
+
+	return redis_command_formatted_add(cmds, cmd_str, cmd_len);
+}
+
 /** Enqueue a command set on a specific trunk
  *
  * The command set may be passed around several trunks before it is complete.
@@ -391,11 +475,15 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
  */
 fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds)
 {
+	request_t *request = cmds->request;
+
 	if (cmds->txn_start != cmds->txn_end) {
-		ERROR("Refusing to enqueue - Unbalanced transaction start/stop commands");
+		ROPTIONAL(RERROR, ERROR, "Refusing to enqueue - Unbalanced transaction start/stop commands");
 		return FR_REDIS_PIPELINE_BAD_CMDS;
 	}
 
+	cmds->rtrunk = rtrunk;
+
 	switch (fr_trunk_request_enqueue(&cmds->treq, rtrunk->trunk, cmds->request, cmds, cmds->rctx)) {
 	case FR_TRUNK_ENQUEUE_OK:
 	case FR_TRUNK_ENQUEUE_IN_BACKLOG:
@@ -409,6 +497,157 @@ fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, f
 	}
 }
 
+/** Enqueue a command set on the trunk for the cluster node responsible for a key
+ *
+ * Commands are always sent to the master for the key slot.  If the cluster map
+ * is stale, the MOVED or ASK response will be followed transparently.
+ *
+ * @param[in] rtcluster	Thread specific cluster state.
+ * @param[in] cmds	Command set to enqueue.
+ * @param[in] key	used to select the cluster node.  May be NULL, in which
+ *			case a random node will be selected.
+ * @param[in] key_len	Length of the key.
+ * @return
+ *	- FR_REDIS_PIPELINE_OK if commands were immediately enqueued or placed in the backlog.
+ *	- FR_REDIS_PIPELINE_DST_UNAVAILABLE if the REDIS host is unreachable.
+ *	- FR_REDIS_PIPELINE_FAIL any other general error.
+ */
+fr_redis_pipeline_status_t fr_redis_command_set_enqueue_by_key(fr_redis_cluster_thread_t *rtcluster,
+							       fr_redis_command_set_t *cmds,
+							       uint8_t const *key, size_t key_len)
+{
+	fr_redis_cluster_key_slot_t const	*key_slot;
+	fr_redis_cluster_node_t const		*node;
+	fr_redis_trunk_t			*rtrunk;
+	fr_ipaddr_t				ipaddr;
+	uint16_t				port;
+
+	key_slot = fr_redis_cluster_slot_by_key(rtcluster->cluster, cmds->request, key, key_len);
+	node = fr_redis_cluster_master(rtcluster->cluster, key_slot);
+	if ((fr_redis_cluster_ipaddr(&ipaddr, node) < 0) ||
+	    (fr_redis_cluster_port(&port, node) < 0)) return FR_REDIS_PIPELINE_DST_UNAVAILABLE;
+
+	rtrunk = fr_redis_cluster_trunk_by_addr(rtcluster, &ipaddr, port);
+	if (!rtrunk) return FR_REDIS_PIPELINE_DST_UNAVAILABLE;
+
+	return redis_command_set_enqueue(rtrunk, cmds);
+}
+
+/** Cancel a command set
+ *
+ * Should be called if the request the command set belongs to is cancelled.
+ * Any responses which are received for the command set will be discarded,
+ * and the command set will be freed.
+ *
+ * @param[in] cmds	to cancel.
+ */
+void fr_redis_command_set_signal_cancel(fr_redis_command_set_t *cmds)
+{
+	if (!cmds->treq) return;
+
+	cmds->complete = NULL;
+	cmds->fail = NULL;
+	fr_trunk_request_signal_cancel(cmds->treq);
+}
+
+/** Follow a MOVED or ASK redirect in any of the responses
+ *
+ * The command set is removed from its current trunk, reset, and enqueued
+ * on the trunk for the node we were redirected to.
+ *
+ * @param[in] cmds	with a complete set of responses.
+ * @return
+ *	- true if the command set was redirected (or failed during redirection).
+ *	- false if no redirect was found, or we can't follow it.  The complete
+ *	  callback will receive the redirect as an error reply.
+ */
+static bool redis_command_set_redirect(fr_redis_command_set_t *cmds)
+{
+	fr_redis_cluster_thread_t	*rtcluster = cmds->rtrunk->cluster;
+	request_t			*request = cmds->request;
+	fr_redis_command_t		*cmd;
+	redisReply			*reply = NULL;
+	fr_redis_trunk_t		*rtrunk;
+	fr_ipaddr_t			ipaddr;
+	uint16_t			port;
+	char const			*p;
+	bool				ask = false;
+
+	for (cmd = fr_dlist_head(&cmds->completed);
+	     cmd;
+	     cmd = fr_dlist_next(&cmds->completed, cmd)) {
+		if (!cmd->result || (cmd->result->type != REDIS_REPLY_ERROR) || !cmd->result->str) continue;
+
+		if (strncmp(cmd->result->str, REDIS_ERROR_MOVED_STR " ", sizeof(REDIS_ERROR_MOVED_STR)) == 0) {
+			reply = cmd->result;
+			break;
+		}
+
+		if (strncmp(cmd->result->str, REDIS_ERROR_ASK_STR " ", sizeof(REDIS_ERROR_ASK_STR)) == 0) {
+			reply = cmd->result;
+			ask = true;
+			break;
+		}
+	}
+	if (!reply) return false;
+
+	/*
+	 *	Trunks not associated with a cluster can't follow redirects
+	 */
+	if (!rtcluster->conf) return false;
+
+	if (cmds->redirected >= rtcluster->conf->max_redirects) {
+		ROPTIONAL(RERROR, ERROR, "Too many redirects (%u)", cmds->redirected);
+		return false;
+	}
+
+	/*
+	 *	-MOVED|ASK <slot> <host>:<port>
+	 */
+	p = memchr(reply->str, ' ', reply->len);
+	if (p) p = memchr(p + 1, ' ', reply->len - ((p + 1) - reply->str));
+	if (!p) {
+	bad_redirect:
+		ROPTIONAL(RERROR, ERROR, "Malformed redirect \"%pV\"", fr_box_strvalue_len(reply->str, reply->len));
+		return false;
+	}
+	p++;
+
+	if (fr_inet_pton_port(&ipaddr, &port, p, reply->len - (p - reply->str), AF_UNSPEC, false, true) < 0) {
+		goto bad_redirect;
+	}
+
+	rtrunk = fr_redis_cluster_trunk_by_addr(rtcluster, &ipaddr, port);
+	if (!rtrunk) return false;
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Following %s redirect to %pV:%u",
+		  ask ? REDIS_ERROR_ASK_STR : REDIS_ERROR_MOVED_STR, fr_box_ipaddr(ipaddr), port);
+
+	/*
+	 *	Remove the command set from the current trunk,
+	 *	without notifying the API client.
+	 */
+	cmds->redirecting = true;
+	fr_trunk_request_signal_complete(cmds->treq);
+	cmds->redirecting = false;
+	cmds->treq = NULL;
+
+	while ((cmd = fr_dlist_head(&cmds->completed))) {
+		fr_redis_reply_free(&cmd->result);
+		fr_dlist_remove(&cmds->completed, cmd);
+		fr_dlist_insert_tail(&cmds->pending, cmd);
+	}
+	cmds->asking = ask;
+	cmds->redirected++;
+
+	if (redis_command_set_enqueue(rtrunk, cmds) != FR_REDIS_PIPELINE_OK) {
+		if (cmds->fail) cmds->fail(cmds->request, &cmds->completed, cmds->rctx);
+		talloc_free(cmds);
+	}
+
+	return true;
+}
+
 /** Callback for for receiving Redis replies
  *
  * This is called by hiredis for each response is receives.  privData is set to the
@@ -428,23 +667,27 @@ static void _redis_pipeline_demux(struct redisAsyncContext *ac, void *vreply, vo
 {
 	fr_redis_command_t	*cmd;
 	fr_redis_command_set_t	*cmds;
-	fr_connection_t		*conn = talloc_get_type_abort(ac->ev.data, fr_connection_t);
+	fr_connection_t		*conn = talloc_get_type_abort(ac->data, fr_connection_t);
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
 	redisReply		*reply = vreply;
+
+	/*
+	 *	hiredis calls all the outstanding callbacks
+	 *	with a NULL reply when the async context is
+	 *	freed.  By this point the trunk has already
+	 *	moved or failed the command sets.
+	 */
+	if (!reply) return;
+
 	/*
 	 *	First check if we should ignore the response
 	 */
 	if (!fr_redis_connection_process_response(h)) {
 		DEBUG4("Ignoring response with SQN %"PRIu64, (h->rsp_sqn - 1));	/* Already incremented */
-		fr_redis_reply_free((redisReply **)&reply);
+		fr_redis_reply_free(&reply);
 		return;
 	}
 
-	/*
-	 *	FIXME - Need to check TRYAGAIN, MOVED etc...
-	 *	I guess we might want to wait for the end of
-	 *	the command set to do that.
-	 */
 	cmd = talloc_get_type_abort(privdata, fr_redis_command_t);
 	cmds = cmd->cmds;
 	cmd->result = reply;
@@ -457,8 +700,17 @@ static void _redis_pipeline_demux(struct redisAsyncContext *ac, void *vreply, vo
 	 *	and if it is, tell the trunk the treq
 	 *	is complete.
 	 */
-	if ((fr_dlist_num_elements(&cmds->pending) == 0) &&
-	    (fr_dlist_num_elements(&cmds->sent) == 0)) fr_trunk_request_signal_complete(cmds->treq);
+	if ((fr_dlist_num_elements(&cmds->pending) != 0) ||
+	    (fr_dlist_num_elements(&cmds->sent) != 0)) return;
+
+	/*
+	 *	Redirects are checked once all the responses
+	 *	are in, as the whole command set needs to be
+	 *	resent.
+	 */
+	if (redis_command_set_redirect(cmds)) return;
+
+	fr_trunk_request_signal_complete(cmds->treq);
 }
 
 static fr_connection_t *_redis_pipeline_connection_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
@@ -473,44 +725,71 @@ static fr_connection_t *_redis_pipeline_connection_alloc(fr_trunk_connection_t *
 /** Enqueue one or more command sets onto a redis handle
  *
  * Because the trunk is in always writable mode, _redis_pipeline_mux
- * will be called any time fr_trunk_request_enqueue is called, so there'll only
- * ever be one command to dequeue.
+ * will be called any time fr_trunk_request_enqueue is called.
+ *
+ * Commands are only written to hiredis' output buffer here.  hiredis
+ * registers for write events and flushes the buffer when the socket
+ * becomes writable, so all the commands enqueued during a single pass
+ * of the event loop are written to the socket together.
  *
+ * @param[in] el		Event list.  Unused.
  * @param[in] tconn		Trunk connection holding the commands to enqueue.
  * @param[in] conn		Connection handle containing the fr_redis_handle_t.
  * @param[in] uctx		fr_redis_cluster_t.  Unused.
  */
-static void _redis_pipeline_mux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+static void _redis_pipeline_mux(UNUSED fr_event_list_t *el,
+				fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
 	fr_trunk_request_t	*treq;
-	fr_redis_command_set_t 	*cmds;
-	fr_redis_command_t	*cmd;
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
-	request_t			*request;
 
-	treq = fr_trunk_connection_pop_request(&request, (void *)&cmds, NULL, tconn);
-	while ((cmd = fr_dlist_head(&cmds->pending))) {
+	while (fr_trunk_connection_pop_request(&treq, tconn) == 0) {
+		fr_redis_command_set_t	*cmds;
+		fr_redis_command_t	*cmd;
+		request_t		*request;
+
+		if (!treq) break;
+
+		cmds = talloc_get_type_abort(treq->preq, fr_redis_command_set_t);
+		request = cmds->request;
+
 		/*
-		 *	If this fails it probably means the connection
-		 *	is disconnecting, but if that's happening then
-		 *	we shouldn't be enqueueing new requests?
+		 *	We don't care about the response to ASKING,
+		 *	so we don't register a callback, and it
+		 *	doesn't consume a SQN.
 		 */
-		if (unlikely(redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str) != REDIS_OK)) {
-			ROPTIONAL(ERROR, REDEBUG, "Unexpected error queueing REDIS command");
+		if (cmds->asking &&
+		    (redisAsyncFormattedCommand(h->ac, NULL, NULL, asking_cmd, sizeof(asking_cmd) - 1) != REDIS_OK)) {
+			goto error;
+		}
 
-			while ((cmd = fr_dlist_head(&cmds->sent))) {
-				fr_redis_connection_ignore_response(h, cmd->sqn);
-				fr_dlist_remove(&cmds->sent, cmd);
-				fr_dlist_insert_tail(&cmds->pending, cmd);
+		while ((cmd = fr_dlist_head(&cmds->pending))) {
+			/*
+			 *	If this fails it probably means the connection
+			 *	is disconnecting, but if that's happening then
+			 *	we shouldn't be enqueueing new requests?
+			 */
+			if (unlikely(redisAsyncFormattedCommand(h->ac, _redis_pipeline_demux, cmd,
+								cmd->str, cmd->len) != REDIS_OK)) {
+			error:
+				ROPTIONAL(RERROR, ERROR, "Unexpected error queueing REDIS command");
+
+				while ((cmd = fr_dlist_head(&cmds->sent))) {
+					fr_redis_connection_ignore_response(h, cmd->sqn);
+					fr_dlist_remove(&cmds->sent, cmd);
+					fr_dlist_insert_tail(&cmds->pending, cmd);
+				}
+				fr_trunk_request_signal_fail(treq);
+				goto next;
 			}
-			fr_trunk_request_signal_fail(treq);
-			return;
+			cmd->sqn = fr_redis_connection_sent_request(h);
+			fr_dlist_remove(&cmds->pending, cmd);
+			fr_dlist_insert_tail(&cmds->sent, cmd);
 		}
-		cmd->sqn = fr_redis_connection_sent_request(h);
-		fr_dlist_remove(&cmds->pending, cmd);
-		fr_dlist_insert_tail(&cmds->sent, cmd);
+		fr_trunk_request_signal_sent(treq);
+	next:
+		continue;
 	}
-	fr_trunk_request_signal_sent(treq);
 }
 
 /** Deal with cancellation of sent requests
@@ -519,11 +798,12 @@ static void _redis_pipeline_mux(fr_trunk_connection_t *tconn, fr_connection_t *c
  * on why the commands were cancelled, we either tell the handle to ignore
  * them, or move them back into the pending list.
  */
-static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_trunk_request_t *treq, void *preq,
+static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, void *preq,
 					       fr_trunk_cancel_reason_t reason, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 	fr_redis_handle_t	*h = conn->h;
+	fr_redis_command_t	*cmd;
 
 	/*
 	 *	How we cancel is very different depending
@@ -531,9 +811,9 @@ static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_
 	 */
 	switch (reason) {
 	/*
-	 *	Cancel is only called for requests that
-	 *	have been sent, and only when the connection
-	 *	is about to be closed for some reason.
+	 *	The connection is about to be closed, or the
+	 *	command set is being requeued on another
+	 *	connection.
 	 *
 	 *	We don't need to tell the handle to ignore
 	 *	the responses, we just need to get the
@@ -541,7 +821,21 @@ static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_
 	 *	execution by another handle.
 	 */
 	case FR_TRUNK_CANCEL_REASON_MOVE:
-		fr_dlist_move(&cmds->pending, &cmds->sent);
+	case FR_TRUNK_CANCEL_REASON_REQUEUE:
+		while ((cmd = fr_dlist_head(&cmds->completed))) {
+			fr_redis_reply_free(&cmd->result);
+			fr_dlist_remove(&cmds->completed, cmd);
+			fr_dlist_insert_tail(&cmds->pending, cmd);
+		}
+		while ((cmd = fr_dlist_head(&cmds->sent))) {
+			/*
+			 *	If the connection is still usable
+			 *	responses will still arrive.
+			 */
+			if (reason == FR_TRUNK_CANCEL_REASON_REQUEUE) fr_redis_connection_ignore_response(h, cmd->sqn);
+			fr_dlist_remove(&cmds->sent, cmd);
+			fr_dlist_insert_tail(&cmds->pending, cmd);
+		}
 		return;
 
 	/*
@@ -555,15 +849,12 @@ static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_
 	 *	pending commands.
 	 */
 	case FR_TRUNK_CANCEL_REASON_SIGNAL:
-	{
-		fr_redis_command_t	*cmd;
-
 		for (cmd = fr_dlist_head(&cmds->sent);
 		     cmd;
 		     cmd = fr_dlist_next(&cmds->sent, cmd)) {
 			fr_redis_connection_ignore_response(h, cmd->sqn);
 		}
-	}
+		return;
 
 	case FR_TRUNK_CANCEL_REASON_NONE:
 		fr_assert(0);
@@ -579,6 +870,9 @@ static void _redis_pipeline_command_set_complete(UNUSED request_t *request, void
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
+	if (cmds->redirecting) return;
+
+	cmds->treq = NULL;
 	if (cmds->complete) cmds->complete(cmds->request, &cmds->completed, cmds->rctx);
 }
 
@@ -586,10 +880,11 @@ static void _redis_pipeline_command_set_complete(UNUSED request_t *request, void
  *
  */
 static void _redis_pipeline_command_set_fail(UNUSED request_t *request, void *preq,
-					     UNUSED void *rctx, UNUSED void *uctx)
+					     UNUSED void *rctx, UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
+	cmds->treq = NULL;
 	if (cmds->fail) cmds->fail(cmds->request, &cmds->completed, cmds->rctx);
 }
 
@@ -601,6 +896,11 @@ static void _redis_pipeline_command_set_free(UNUSED request_t *request, void *pr
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
+	/*
+	 *	Being moved to another trunk
+	 */
+	if (cmds->redirecting) return;
+
 	talloc_free(cmds);
 }
 
@@ -627,6 +927,7 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
 
 	MEM(rtrunk = talloc_zero(cluster_thread, fr_redis_trunk_t));
 	rtrunk->io_conf = io_conf;
+	rtrunk->cluster = cluster_thread;
 	rtrunk->trunk = fr_trunk_alloc(rtrunk, cluster_thread->el,
 				       &io_funcs, cluster_thread->tconf, cluster_thread->log_prefix, rtrunk,
 				       cluster_thread->delay_start);
@@ -638,13 +939,86 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
 	return rtrunk;
 }
 
+/** Compare two trunks by the address of the node they connect to
+ *
+ */
+static int8_t _redis_trunk_cmp(void const *one, void const *two)
+{
+	fr_redis_trunk_t const *a = one;
+	fr_redis_trunk_t const *b = two;
+	int8_t ret;
+
+	ret = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+	if (ret != 0) return ret;
+
+	return CMP(a->port, b->port);
+}
+
+/** Find or allocate the trunk for a specific cluster node
+ *
+ * @param[in] rtcluster		Thread specific cluster state.
+ * @param[in] ipaddr		of the cluster node.
+ * @param[in] port		of the cluster node.
+ * @return
+ *	- The trunk for the node.
+ *	- NULL on failure.
+ */
+fr_redis_trunk_t *fr_redis_cluster_trunk_by_addr(fr_redis_cluster_thread_t *rtcluster,
+						 fr_ipaddr_t const *ipaddr, uint16_t port)
+{
+	fr_redis_trunk_t	find, *rtrunk;
+	fr_redis_io_conf_t	*io_conf;
+	char			buffer[FR_IPADDR_STRLEN];
+
+	find.ipaddr = *ipaddr;
+	find.port = port;
+
+	rtrunk = fr_rb_find(rtcluster->trunks, &find);
+	if (rtrunk) return rtrunk;
+
+	if (!rtcluster->conf) return NULL;
+
+	MEM(io_conf = talloc_zero(rtcluster, fr_redis_io_conf_t));
+	MEM(io_conf->hostname = talloc_strdup(io_conf, fr_inet_ntop(buffer, sizeof(buffer), ipaddr)));
+	io_conf->port = port;
+	io_conf->database = rtcluster->conf->database;
+	io_conf->username = rtcluster->conf->username;
+	io_conf->password = rtcluster->conf->password;
+	io_conf->connection_timeout = rtcluster->conf->connection_timeout;
+	io_conf->reconnection_delay = rtcluster->conf->reconnection_delay;
+	io_conf->log_prefix = rtcluster->log_prefix;
+
+	rtrunk = fr_redis_trunk_alloc(rtcluster, io_conf);
+	if (!rtrunk) {
+		talloc_free(io_conf);
+		return NULL;
+	}
+	talloc_steal(rtrunk, io_conf);
+	rtrunk->ipaddr = *ipaddr;
+	rtrunk->port = port;
+
+	fr_rb_insert(rtcluster->trunks, rtrunk);
+
+	return rtrunk;
+}
+
 /** Allocate per-thread, per-cluster instance
  *
  * This structure represents all the connections for a given thread for a given cluster.
  * The structures holds the trunk connections to talk to each cluster member.
  *
+ * @param[in] ctx	to allocate the cluster thread in.
+ * @param[in] el	to run I/O events in.
+ * @param[in] tconf	Trunk configuration for connections to each node.
+ * @param[in] cluster	Shared cluster state.  May be NULL if trunks
+ *			will only be allocated with #fr_redis_trunk_alloc.
+ * @param[in] conf	Common connection configuration.  May be NULL
+ *			if cluster is NULL.
+ * @return A new cluster thread.
  */
-fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_trunk_conf_t const *tconf)
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+							 fr_trunk_conf_t const *tconf,
+							 fr_redis_cluster_t *cluster, fr_redis_conf_t const *conf)
 {
 	fr_redis_cluster_thread_t *cluster_thread;
 	fr_trunk_conf_t *our_tconf;
@@ -655,8 +1029,11 @@ fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_eve
 
 	cluster_thread->el = el;
 	cluster_thread->tconf = our_tconf;
+	cluster_thread->cluster = cluster;
+	cluster_thread->conf = conf;
+	if (conf && conf->log_prefix) MEM(cluster_thread->log_prefix = talloc_strdup(cluster_thread, conf->log_prefix));
+	MEM(cluster_thread->trunks = fr_rb_inline_alloc(cluster_thread, fr_redis_trunk_t, node,
+							 _redis_trunk_cmp, NULL));
 
 	return cluster_thread;
 }
-
-
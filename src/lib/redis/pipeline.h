@@ -32,6 +32,7 @@ RCSIDH(redis_pipeline_h, "$Id$")
 #include <freeradius-devel/server/request.h>
 #include <freeradius-devel/server/trunk.h>
 #include <freeradius-devel/redis/io.h>
+#include <freeradius-devel/redis/cluster.h>
 #include <hiredis/async.h>
 
 #ifdef __cplusplus
@@ -54,6 +55,9 @@ typedef struct fr_redis_trunk_s fr_redis_trunk_t;
 /** Do something meaningful with the replies to the commands previously issued
  *
  * Should mark the request as runnable, if there's a request.
+ *
+ * @note The command set is freed once this callback returns.  Any replies the
+ *	 caller wants to keep must be taken with #fr_redis_command_steal_result.
  */
 typedef void (*fr_redis_command_set_complete_t)(request_t *request, fr_dlist_head_t *completed, void *rctx);
 
@@ -66,12 +70,22 @@ typedef void (*fr_redis_command_set_fail_t)(request_t *request, fr_dlist_head_t
 fr_redis_pipeline_status_t	fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
 							     	  char const *cmd_str, size_t cmd_len);
 
-/*
- *	TEMPORARY
- */
-fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds);
+fr_redis_pipeline_status_t	fr_redis_command_argv_add(fr_redis_command_set_t *cmds,
+							  int argc, char const **argv, size_t const *argv_len);
+
+fr_redis_pipeline_status_t	fr_redis_command_add(fr_redis_command_set_t *cmds, char const *fmt, ...);
+
+fr_redis_pipeline_status_t	redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds);
 
-redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd);
+fr_redis_pipeline_status_t	fr_redis_command_set_enqueue_by_key(fr_redis_cluster_thread_t *rtcluster,
+								    fr_redis_command_set_t *cmds,
+								    uint8_t const *key, size_t key_len);
+
+void				fr_redis_command_set_signal_cancel(fr_redis_command_set_t *cmds);
+
+redisReply			*fr_redis_command_get_result(fr_redis_command_t *cmd);
+
+redisReply			*fr_redis_command_steal_result(fr_redis_command_t *cmd);
 
 fr_redis_command_set_t		*fr_redis_command_set_alloc(TALLOC_CTX *ctx,
 							    request_t *request,
@@ -82,8 +96,12 @@ fr_redis_command_set_t		*fr_redis_command_set_alloc(TALLOC_CTX *ctx,
 fr_redis_trunk_t		*fr_redis_trunk_alloc(fr_redis_cluster_thread_t *rtcluster,
 						      fr_redis_io_conf_t const *conf);
 
+fr_redis_trunk_t		*fr_redis_cluster_trunk_by_addr(fr_redis_cluster_thread_t *rtcluster,
+								fr_ipaddr_t const *ipaddr, uint16_t port);
+
 fr_redis_cluster_thread_t	*fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
-							       fr_trunk_conf_t const *tconf);
+							       fr_trunk_conf_t const *tconf,
+							       fr_redis_cluster_t *cluster, fr_redis_conf_t const *conf);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,8 @@
+TARGET		:= redis_pipeline_test$(E)
+SOURCES		:= test.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS	:= libfreeradius-redis$(L) libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L)
+
+TGT_INSTALLDIR	:=
@@ -1,5 +1,6 @@
 SUBMAKEFILES := \
 	libfreeradius-server.mk \
 	pair_server_tests.mk \
+	state_test.mk \
 	tmpl_dcursor_tests.mk \
 	trunk_tests.mk
@@ -41,6 +41,12 @@ static int fr_command_register(UNUSED TALLOC_CTX *talloc_ctx, UNUSED char const
 
 fr_command_register_hook_t fr_command_register_hook = fr_command_register;
 
+static void fr_command_unregister(UNUSED char const *name, UNUSED fr_cmd_table_t *table)
+{
+}
+
+fr_command_unregister_hook_t fr_command_unregister_hook = fr_command_unregister;
+
 typedef struct fr_cmd_argv_s fr_cmd_argv_t;
 struct fr_cmd_argv_s {
 	char const     		*name;
@@ -837,8 +843,8 @@ int fr_command_add(TALLOC_CTX *talloc_ctx, fr_cmd_t **head, char const *name, vo
 		if (!cmd) {
 			cmd = fr_command_alloc(talloc_ctx, insert, name);
 			cmd->added_name = true;
-			cmd->live = true;
 		}
+		cmd->live = true;	/* may have been removed, and is now being added again */
 
 		start = &(cmd->child);
 		depth++;
@@ -926,9 +932,10 @@ int fr_command_add(TALLOC_CTX *talloc_ctx, fr_cmd_t **head, char const *name, vo
 		/*
 		 *	Can't add new sub-commands to a
 		 *	command which already has a
-		 *	pre-defined syntax.
+		 *	pre-defined syntax.  Commands which
+		 *	were removed can be added again.
 		 */
-		if (!cmd->intermediate) {
+		if (!cmd->intermediate && cmd->live) {
 			fr_strerror_printf("Cannot modify a pre-existing command '%s'", cmd->name);
 			return -1;
 		}
@@ -993,6 +1000,85 @@ int fr_command_add_multi(TALLOC_CTX *talloc_ctx, fr_cmd_t **head, char const *na
 	return 0;
 }
 
+/**  Remove a command from the command tree
+ *
+ *  The command isn't freed, as another thread may be looking at it.
+ *  It's marked as not being live, so it can't be found, run, or tab
+ *  expanded.  Adding the same command again makes it live again.
+ *
+ *  For tables with "add_name", the whole "parent name" subtree is
+ *  removed, e.g. "stats offload foo".
+ *
+ * @param head pointer to the head of the command table.
+ * @param name the additional name the command was added with.
+ * @param table the command was added with.
+ * @return
+ *	- <0 if the command wasn't found.
+ *	- 0 on success.
+ */
+int fr_command_remove(fr_cmd_t **head, char const *name, fr_cmd_table_t const *table)
+{
+	fr_cmd_t	*cmd = NULL, **start = head;
+	char		*parents, *p, *parent;
+	int		ret = 0;
+
+	if (table->parent) {
+		MEM(parents = p = talloc_strdup(NULL, table->parent));
+
+		while ((ret = split(&p, &parent, true)) > 0) {
+			cmd = fr_command_find(start, parent, NULL);
+			if (!cmd) break;
+
+			start = &(cmd->child);
+		}
+		talloc_free(parents);
+
+		if (ret != 0) {
+			fr_strerror_printf("Parent command '%s' not found", table->parent);
+			return -1;
+		}
+	}
+
+	if (table->add_name) {
+		if (!name) {
+			fr_strerror_const("An additional name must be specified");
+			return -1;
+		}
+
+		cmd = fr_command_find(start, name, NULL);
+	} else {
+		cmd = fr_command_find(start, table->name, NULL);
+
+		/*
+		 *	Intermediate commands may be shared with
+		 *	other tables, so they're left alone.
+		 */
+		if (cmd && cmd->intermediate) return 0;
+	}
+
+	if (!cmd) {
+		fr_strerror_printf("Command '%s' not found", table->add_name ? name : table->name);
+		return -1;
+	}
+
+	cmd->live = false;
+
+	return 0;
+}
+
+/**  Remove multiple commands from the global command tree
+ *
+ * @param head pointer to the head of the command table.
+ * @param name the additional name the commands were added with.
+ * @param table array of tables, terminated by "help == NULL"
+ */
+void fr_command_remove_multi(fr_cmd_t **head, char const *name, fr_cmd_table_t const *table)
+{
+	int i;
+
+	for (i = 0; table[i].help != NULL; i++) (void) fr_command_remove(head, name, &table[i]);
+}
+
 /** A stack for walking commands.
  *
  */
@@ -72,9 +72,13 @@ typedef struct {
 typedef int (*fr_cmd_walk_t)(void *ctx, fr_cmd_walk_info_t *);
 typedef int (*fr_command_register_hook_t)(TALLOC_CTX *talloc_ctx, char const *name, void *ctx, fr_cmd_table_t *table);
 extern fr_command_register_hook_t fr_command_register_hook;
+typedef void (*fr_command_unregister_hook_t)(char const *name, fr_cmd_table_t *table);
+extern fr_command_unregister_hook_t fr_command_unregister_hook;
 
 int fr_command_add(TALLOC_CTX *talloc_ctx, fr_cmd_t **head_p, char const *name, void *ctx, fr_cmd_table_t const *table);
 int fr_command_add_multi(TALLOC_CTX *talloc_ctx, fr_cmd_t **heap_p, char const *name, void *ctx, fr_cmd_table_t const *table);
+int fr_command_remove(fr_cmd_t **head_p, char const *name, fr_cmd_table_t const *table);
+void fr_command_remove_multi(fr_cmd_t **head_p, char const *name, fr_cmd_table_t const *table);
 int fr_command_walk(fr_cmd_t *head, void **walk_ctx, void *ctx, fr_cmd_walk_t callback);
 int fr_command_tab_expand(TALLOC_CTX *ctx, fr_cmd_t *head, fr_cmd_info_t *info, int max_expansions, char const **expansions);
 char const *fr_command_help(fr_cmd_t *head, int argc, char *argv[]);
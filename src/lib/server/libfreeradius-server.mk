@@ -23,6 +23,7 @@ SOURCES	:= \
 	map_proc.c \
 	module.c \
 	module_rlm.c \
+	offload.c \
 	packet.c \
 	paircmp.c \
 	pairmove.c \
@@ -42,6 +42,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/conf.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/file.h>
 #include <freeradius-devel/util/hw.h>
 #include <freeradius-devel/util/perm.h>
@@ -168,12 +169,36 @@ static const conf_parser_t resources[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static fr_table_num_sorted_t const dispatch_table[] = {
+	{ L("affinity"),	FR_NETWORK_DISPATCH_AFFINITY		},
+	{ L("least-loaded"),	FR_NETWORK_DISPATCH_LEAST_LOADED	}
+};
+static size_t dispatch_table_len = NUM_ELEMENTS(dispatch_table);
+
 static const conf_parser_t thread_config[] = {
 	{ FR_CONF_OFFSET("num_networks", main_config_t, max_networks), .dflt = STRINGIFY(1),
 	  .func = num_networks_parse },
 	{ FR_CONF_OFFSET("num_workers", main_config_t, max_workers), .dflt = STRINGIFY(0),
 	  .func = num_workers_parse, .dflt_func = num_workers_dflt },
 
+	{ FR_CONF_OFFSET("dispatch", main_config_t, dispatch), .dflt = "least-loaded",
+		.func = cf_table_parse_int,
+			.uctx = &(cf_table_parse_ctx_t){
+				.table = dispatch_table,
+				.len = &dispatch_table_len
+			}
+		},
+	{ FR_CONF_OFFSET("dispatch_max_imbalance", main_config_t, dispatch_max_imbalance), .dflt = "25" },
+
+	{ FR_CONF_OFFSET("event_backend", main_config_t, event_backend), .dflt = "default",
+		.func = cf_table_parse_int,
+			.uctx = &(cf_table_parse_ctx_t){
+				.table = fr_event_backend_table,
+				.len = &fr_event_backend_table_len
+			}
+		},
+	{ FR_CONF_OFFSET("timer_wheel_resolution", main_config_t, timer_wheel_resolution) },
+
 	{ FR_CONF_OFFSET_TYPE_FLAGS("stats_interval", FR_TYPE_TIME_DELTA | CONF_FLAG_HIDDEN, 0, main_config_t, stats_interval), },
 
 #ifdef WITH_TLS
@@ -414,7 +439,8 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >=, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <=, 64);
 
 	memcpy(out, &value, sizeof(value));
 
@@ -149,6 +149,10 @@ struct main_config_s {
 
 	uint32_t	max_networks;			//!< for the scheduler
 	uint32_t	max_workers;			//!< for the scheduler
+	int		dispatch;			//!< how network threads choose workers.
+	uint32_t	dispatch_max_imbalance;		//!< for the "affinity" dispatch policy.
+	int		event_backend;			//!< kqueue or epoll, for event lists.
+	fr_time_delta_t	timer_wheel_resolution;		//!< if set, event lists use a timer wheel.
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
 
 #ifndef NDEBUG
@@ -0,0 +1,741 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Run CPU intensive work in a thread pool, instead of in a worker.
+ * @file src/lib/server/offload.c
+ *
+ * A worker multiplexes many requests on one event loop.  If one of them
+ * spends 100ms hashing a password, every other request on that worker
+ * waits 100ms.  Instead, a module can submit the hashing to an offload
+ * pool, and yield.  When an offload thread has run the job, the worker
+ * is woken up, and the request is marked runnable.
+ *
+ * The queue of jobs waiting for a thread is bounded.  Jobs which wait
+ * longer than the configured timeout are never run, so when the pool
+ * is overloaded, the backlog doesn't grow without limit.
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/server/offload.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+
+#ifdef HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+#endif
+
+#define OFFLOAD_LATENCY_MAX	((uint64_t) 60 * NSEC)	//!< Longer latencies are recorded as this.
+#define OFFLOAD_LATENCY_PRECISION (7)			//!< Significant bits, i.e. within 1%.
+
+#define OFFLOAD_MAX_THREADS	(256)
+
+/** One thread in the pool
+ *
+ */
+typedef struct {
+	fr_offload_t		*pool;			//!< we belong to.
+	pthread_t		pthread_id;		//!< of this thread.
+	fr_histogram_t		*latency[FR_OFFLOAD_LATENCY_MAX];	//!< Only written by this thread, but
+									///< read by radmin, so protected by the
+									///< pool mutex.
+} offload_runner_t;
+
+struct fr_offload_s {
+	char const		*name;			//!< of the pool, for logging and radmin.
+	fr_offload_conf_t	conf;			//!< copied from the caller.
+
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+	pthread_cond_t		cond;			//!< Signalled when a job is queued, or the pool
+							///< is stopping.
+	fr_dlist_head_t		queue;			//!< Jobs waiting for a thread.
+
+	bool			started;		//!< Whether the threads have been created.
+	bool			stopping;		//!< Tell the threads to exit.
+	uint32_t		num_runners;		//!< How many threads were created.
+
+	fr_offload_stats_t	stats;			//!< Counters.
+
+	offload_runner_t	*runner;		//!< Array of conf.num_threads.
+};
+
+/** The half of the pool which is owned by one worker thread
+ *
+ * Jobs come back to the thread which submitted them, via the done list,
+ * and an eventfd (or pipe) in that threads event list.
+ */
+struct fr_offload_thread_s {
+	fr_offload_t		*pool;			//!< we submit jobs to.
+	fr_event_list_t		*el;			//!< to wake up when jobs are done.
+
+	int			fd[2];			//!< read and write ends.  With eventfd, both are
+							///< the same descriptor.
+
+	pthread_mutex_t		mutex;			//!< Protects the done list.
+	fr_dlist_head_t		done;			//!< Jobs which have been run, or which expired.
+
+	uint32_t		outstanding;		//!< Jobs which haven't come back yet.
+};
+
+struct fr_offload_job_s {
+	fr_dlist_t		entry;			//!< In the pool queue, or the done list.
+
+	fr_offload_thread_t	*ot;			//!< which submitted the job.
+	request_t		*request;		//!< to mark runnable.  NULL when the request has
+							///< been cancelled, and the job should just be freed.
+
+	fr_offload_func_t	func;			//!< to run.
+	void			*uctx;			//!< for the function.
+
+	fr_offload_job_state_t	state;			//!< Protected by the pool mutex.
+	bool			returned;		//!< Whether the job came back to the submitting thread.
+
+	fr_time_t		submitted;		//!< When the job was queued.
+	fr_time_t		deadline;		//!< After which the job won't be started.
+};
+
+fr_table_num_sorted_t const fr_offload_latency_table[] = {
+	{ L("queued"),		FR_OFFLOAD_LATENCY_QUEUED	},
+	{ L("running"),		FR_OFFLOAD_LATENCY_RUNNING	}
+};
+size_t fr_offload_latency_table_len = NUM_ELEMENTS(fr_offload_latency_table);
+
+conf_parser_t const fr_offload_config[] = {
+	{ FR_CONF_OFFSET("threads", fr_offload_conf_t, num_threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_queued", fr_offload_conf_t, max_queued), .dflt = "1024" },
+	{ FR_CONF_OFFSET("timeout", fr_offload_conf_t, timeout), .dflt = "1.0" },
+
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_cmd_table_t cmd_offload_table[];
+
+/** Send a job back to the thread which submitted it
+ *
+ * Only the first job added to an empty done list wakes up the thread.
+ * The others are picked up when it empties the list.
+ */
+static void offload_job_return(fr_offload_job_t *job)
+{
+	fr_offload_thread_t	*ot = job->ot;
+	bool			signal;
+#ifdef HAVE_SYS_EVENTFD_H
+	uint64_t		one = 1;
+#endif
+
+	pthread_mutex_lock(&ot->mutex);
+	signal = fr_dlist_empty(&ot->done);
+	fr_dlist_insert_tail(&ot->done, job);
+	pthread_mutex_unlock(&ot->mutex);
+
+	if (!signal) return;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	while ((write(ot->fd[1], &one, sizeof(one)) < 0) && (errno == EINTR)) {
+		/* nothing */
+	}
+#else
+	while ((write(ot->fd[1], ".", 1) < 0) && (errno == EINTR)) {
+		/* nothing */
+	}
+#endif
+}
+
+/** Entry point for offload threads
+ *
+ */
+static void *offload_runner(void *arg)
+{
+	offload_runner_t	*runner = arg;
+	fr_offload_t		*pool = runner->pool;
+	fr_offload_job_t	*job;
+	sigset_t		sigset;
+
+	/*
+	 *	Leave signals to the main thread.
+	 */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (true) {
+		fr_time_t	started, finished;
+
+		while (!pool->stopping && fr_dlist_empty(&pool->queue)) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+		if (pool->stopping) break;
+
+		job = fr_dlist_pop_head(&pool->queue);
+		pool->stats.queued--;
+
+		/*
+		 *	It's waited too long.  Whatever it was for
+		 *	has probably been retransmitted or given up on,
+		 *	so don't make the backlog worse.
+		 */
+		started = fr_time();
+		if (fr_time_gt(started, job->deadline)) {
+			job->state = FR_OFFLOAD_JOB_EXPIRED;
+			pool->stats.expired++;
+			pthread_mutex_unlock(&pool->mutex);
+
+			offload_job_return(job);
+
+			pthread_mutex_lock(&pool->mutex);
+			continue;
+		}
+
+		job->state = FR_OFFLOAD_JOB_RUNNING;
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->func(job->uctx);
+
+		finished = fr_time();
+
+		pthread_mutex_lock(&pool->mutex);
+		fr_histogram_record(runner->latency[FR_OFFLOAD_LATENCY_QUEUED],
+				    fr_time_delta_unwrap(fr_time_sub(started, job->submitted)));
+		fr_histogram_record(runner->latency[FR_OFFLOAD_LATENCY_RUNNING],
+				    fr_time_delta_unwrap(fr_time_sub(finished, started)));
+		job->state = FR_OFFLOAD_JOB_DONE;
+		pool->stats.completed++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		offload_job_return(job);
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Start the threads for a pool
+ *
+ * This is done when the first worker thread attaches to the pool, and not
+ * when the pool is allocated.  Modules are instantiated before the server
+ * forks into the background, and threads don't survive fork().
+ *
+ * Must be called with the pool mutex held.
+ */
+static int offload_start(fr_offload_t *pool)
+{
+	uint32_t	i;
+	int		ret;
+
+	pool->started = true;
+
+	for (i = 0; i < pool->conf.num_threads; i++) {
+		ret = pthread_create(&pool->runner[i].pthread_id, NULL, offload_runner, &pool->runner[i]);
+		if (ret != 0) {
+			fr_strerror_printf("Failed creating offload thread: %s", fr_syserror(ret));
+			break;
+		}
+		pool->num_runners++;
+	}
+
+	if (pool->num_runners == 0) return -1;
+
+	if (pool->num_runners < pool->conf.num_threads) {
+		WARN("offload %s - Only started %u of %u threads", pool->name,
+		     pool->num_runners, pool->conf.num_threads);
+	}
+
+	return 0;
+}
+
+static int _offload_free(fr_offload_t *pool)
+{
+	uint32_t i;
+
+	fr_command_unregister_hook(pool->name, cmd_offload_table);
+
+	pthread_mutex_lock(&pool->mutex);
+	fr_assert(fr_dlist_empty(&pool->queue));
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_runners; i++) pthread_join(pool->runner[i].pthread_id, NULL);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	return 0;
+}
+
+/** Allocate an offload pool
+ *
+ * The threads aren't started until the first call to #fr_offload_thread_alloc.
+ *
+ * @param[in] ctx	to allocate the pool in.  This must not be memory which
+ *			is later made read-only, such as module instance data.
+ * @param[in] conf	for the pool.
+ * @param[in] name	of the pool, used for logging and radmin.
+ * @return
+ *	- The new pool.
+ *	- NULL on error.
+ */
+fr_offload_t *fr_offload_alloc(TALLOC_CTX *ctx, fr_offload_conf_t const *conf, char const *name)
+{
+	fr_offload_t	*pool;
+	uint32_t	i;
+
+	if (conf->num_threads > OFFLOAD_MAX_THREADS) {
+		fr_strerror_printf("Offload threads must be no more than %u", OFFLOAD_MAX_THREADS);
+		return NULL;
+	}
+
+	if (conf->max_queued == 0) {
+		fr_strerror_const("Offload max_queued must be greater than zero");
+		return NULL;
+	}
+
+	if (!fr_time_delta_ispos(conf->timeout)) {
+		fr_strerror_const("Offload timeout must be greater than zero");
+		return NULL;
+	}
+
+	MEM(pool = talloc_zero(ctx, fr_offload_t));
+	pool->name = talloc_strdup(pool, name);
+	pool->conf = *conf;
+	fr_dlist_talloc_init(&pool->queue, fr_offload_job_t, entry);
+
+	MEM(pool->runner = talloc_zero_array(pool, offload_runner_t, conf->num_threads));
+	for (i = 0; i < conf->num_threads; i++) {
+		unsigned int j;
+
+		pool->runner[i].pool = pool;
+		for (j = 0; j < FR_OFFLOAD_LATENCY_MAX; j++) {
+			MEM(pool->runner[i].latency[j] = fr_histogram_alloc(pool->runner, OFFLOAD_LATENCY_MAX,
+									    OFFLOAD_LATENCY_PRECISION));
+		}
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	talloc_set_destructor(pool, _offload_free);
+
+	if (fr_command_register_hook(NULL, pool->name, pool, cmd_offload_table) < 0) {
+		PWARN("offload %s - Failed registering radmin commands", pool->name);
+	}
+
+	return pool;
+}
+
+/** Pick up jobs which have come back to this thread
+ *
+ */
+static void offload_done(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_offload_thread_t	*ot = talloc_get_type_abort(uctx, fr_offload_thread_t);
+	fr_dlist_head_t		done;
+	fr_offload_job_t	*job;
+#ifdef HAVE_SYS_EVENTFD_H
+	uint64_t		read_buffer;
+
+	(void) read(fd, &read_buffer, sizeof(read_buffer));
+#else
+	char			read_buffer[64];
+
+	while (read(fd, read_buffer, sizeof(read_buffer)) == sizeof(read_buffer)) {
+		/* nothing */
+	}
+#endif
+
+	fr_dlist_talloc_init(&done, fr_offload_job_t, entry);
+
+	pthread_mutex_lock(&ot->mutex);
+	fr_dlist_move(&done, &ot->done);
+	pthread_mutex_unlock(&ot->mutex);
+
+	while ((job = fr_dlist_pop_head(&done))) {
+		job->returned = true;
+		fr_assert(ot->outstanding > 0);
+		ot->outstanding--;
+
+		/*
+		 *	The request was cancelled while the job was
+		 *	running.  No one wants the result.
+		 */
+		if (!job->request) {
+			talloc_free(job);
+			continue;
+		}
+
+		unlang_interpret_mark_runnable(job->request);
+	}
+}
+
+static int _offload_thread_free(fr_offload_thread_t *ot)
+{
+	fr_offload_t		*pool = ot->pool;
+	fr_offload_job_t	*job, *next;
+
+	/*
+	 *	Remove our queued jobs, so that we only have to wait
+	 *	for the ones which are running.
+	 */
+	pthread_mutex_lock(&pool->mutex);
+	for (job = fr_dlist_head(&pool->queue); job; job = next) {
+		next = fr_dlist_next(&pool->queue, job);
+		if (job->ot != ot) continue;
+
+		fr_dlist_remove(&pool->queue, job);
+		job->state = FR_OFFLOAD_JOB_CANCELLED;
+		pool->stats.cancelled++;
+		pool->stats.queued--;
+		ot->outstanding--;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	/*
+	 *	The offload threads still have pointers to the
+	 *	running jobs, so we can't free them until they've
+	 *	come back.
+	 */
+	while (ot->outstanding > 0) {
+		struct pollfd pfd = { .fd = ot->fd[0], .events = POLLIN };
+
+		(void) poll(&pfd, 1, 100);
+
+		pthread_mutex_lock(&ot->mutex);
+		while ((job = fr_dlist_pop_head(&ot->done))) ot->outstanding--;
+		pthread_mutex_unlock(&ot->mutex);
+	}
+
+	(void) fr_event_fd_delete(ot->el, ot->fd[0], FR_EVENT_FILTER_IO);
+	close(ot->fd[0]);
+	if (ot->fd[1] != ot->fd[0]) close(ot->fd[1]);
+
+	pthread_mutex_destroy(&ot->mutex);
+
+	return 0;
+}
+
+/** Attach a worker thread to an offload pool
+ *
+ * This should be called from a modules thread_instantiate callback.
+ *
+ * @param[in] ctx	to allocate the handle in.  Jobs are allocated in it too.
+ * @param[in] pool	to submit jobs to.
+ * @param[in] el	of the calling thread.  Jobs which are done wake it up.
+ * @return
+ *	- The new handle.
+ *	- NULL on error.
+ */
+fr_offload_thread_t *fr_offload_thread_alloc(TALLOC_CTX *ctx, fr_offload_t *pool, fr_event_list_t *el)
+{
+	fr_offload_thread_t *ot;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (!pool->started && (offload_start(pool) < 0)) {
+		pthread_mutex_unlock(&pool->mutex);
+		return NULL;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	MEM(ot = talloc_zero(ctx, fr_offload_thread_t));
+	ot->pool = pool;
+	ot->el = el;
+	fr_dlist_talloc_init(&ot->done, fr_offload_job_t, entry);
+
+#ifdef HAVE_SYS_EVENTFD_H
+	ot->fd[0] = ot->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ot->fd[0] < 0) {
+		fr_strerror_printf("Failed opening eventfd for offload pool: %s", fr_syserror(errno));
+		talloc_free(ot);
+		return NULL;
+	}
+#else
+	if (pipe(ot->fd) < 0) {
+		fr_strerror_printf("Failed opening pipe for offload pool: %s", fr_syserror(errno));
+		talloc_free(ot);
+		return NULL;
+	}
+
+	(void) fcntl(ot->fd[0], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+	(void) fcntl(ot->fd[1], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+#endif
+
+	pthread_mutex_init(&ot->mutex, NULL);
+	talloc_set_destructor(ot, _offload_thread_free);
+
+	if (fr_event_fd_insert(ot, NULL, el, ot->fd[0], offload_done, NULL, NULL, ot) < 0) {
+		fr_strerror_const_push("Failed adding offload pool descriptor to event list");
+		talloc_free(ot);
+		return NULL;
+	}
+
+	return ot;
+}
+
+/** Submit a job to an offload pool
+ *
+ * When the job has been run (or has expired), the request is marked
+ * runnable.  The caller should yield after submitting the job, and in
+ * its resume function, check #fr_offload_job_state, read the results
+ * from the uctx, and then free the job with talloc_free().
+ *
+ * If the request is cancelled while it's yielded, the caller's signal
+ * function must call #fr_offload_cancel.
+ *
+ * @param[in] ot	handle for this thread.
+ * @param[in] request	to mark runnable when the job is done.
+ * @param[in] func	to run in an offload thread.
+ * @param[in] uctx	for func.  If the job is queued, uctx is reparented to
+ *			the job, so that it's not freed with the request while
+ *			func is running.
+ * @return
+ *	- The job.
+ *	- NULL if the queue is full.  uctx is left alone, and the caller
+ *	  should fail the request.
+ */
+fr_offload_job_t *fr_offload_submit(fr_offload_thread_t *ot, request_t *request, fr_offload_func_t func, void *uctx)
+{
+	fr_offload_t		*pool = ot->pool;
+	fr_offload_job_t	*job;
+
+	MEM(job = talloc_zero(ot, fr_offload_job_t));
+	job->ot = ot;
+	job->request = request;
+	job->func = func;
+	job->uctx = uctx;
+
+	job->submitted = fr_time();
+	job->deadline = fr_time_add(job->submitted, pool->conf.timeout);
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->stats.queued >= pool->conf.max_queued) {
+		pool->stats.rejected++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		talloc_free(job);
+		fr_strerror_printf("Offload queue is full, with %u jobs", pool->conf.max_queued);
+		return NULL;
+	}
+
+	if (uctx) talloc_steal(job, uctx);
+
+	job->state = FR_OFFLOAD_JOB_QUEUED;
+	fr_dlist_insert_tail(&pool->queue, job);
+	pool->stats.submitted++;
+	pool->stats.queued++;
+	if (pool->stats.queued > pool->stats.queued_max) pool->stats.queued_max = pool->stats.queued;
+
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	ot->outstanding++;
+
+	return job;
+}
+
+/** Cancel a job, because its request is being cancelled
+ *
+ * If the job is still queued, it's removed, and freed.  If it's running,
+ * it's freed when it comes back.  Either way, the caller must not use the
+ * job, or its uctx, after this.
+ *
+ * @param[in] job	to cancel.
+ */
+void fr_offload_cancel(fr_offload_job_t *job)
+{
+	fr_offload_thread_t	*ot = job->ot;
+	fr_offload_t		*pool = ot->pool;
+
+	/*
+	 *	It came back, but the request was cancelled before
+	 *	it was resumed.
+	 */
+	if (job->returned) {
+		talloc_free(job);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	if (job->state == FR_OFFLOAD_JOB_QUEUED) {
+		fr_dlist_remove(&pool->queue, job);
+		job->state = FR_OFFLOAD_JOB_CANCELLED;
+		pool->stats.cancelled++;
+		pool->stats.queued--;
+		pthread_mutex_unlock(&pool->mutex);
+
+		ot->outstanding--;
+		talloc_free(job);
+		return;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	/*
+	 *	An offload thread has it.  We free it in
+	 *	offload_done().
+	 */
+	job->request = NULL;
+}
+
+/** Return how a job ended
+ *
+ * This should only be called once the request has been resumed.
+ *
+ * @param[in] job	to check.
+ * @return the state of the job.
+ */
+fr_offload_job_state_t fr_offload_job_state(fr_offload_job_t const *job)
+{
+	fr_assert(job->returned);
+
+	return job->state;
+}
+
+/** Return the uctx which was passed to #fr_offload_submit
+ *
+ * @param[in] job	to get the uctx from.
+ * @return the uctx.
+ */
+void *fr_offload_job_uctx(fr_offload_job_t const *job)
+{
+	return job->uctx;
+}
+
+/** Get the counters for a pool
+ *
+ * @param[out] stats	where the counters are written.
+ * @param[in] pool	to get the counters for.
+ */
+void fr_offload_stats(fr_offload_stats_t *stats, fr_offload_t *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/** Get the latency histograms for a pool
+ *
+ * The histograms of all of the threads in the pool are merged.
+ *
+ * @param[in] ctx	to allocate the histograms in.
+ * @param[out] out	one histogram for each #fr_offload_latency_t.
+ * @param[in] pool	to get the latencies for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_offload_latency(TALLOC_CTX *ctx, fr_histogram_t *out[static FR_OFFLOAD_LATENCY_MAX], fr_offload_t *pool)
+{
+	uint32_t	i;
+	unsigned int	j;
+
+	for (j = 0; j < FR_OFFLOAD_LATENCY_MAX; j++) {
+		out[j] = fr_histogram_alloc(ctx, OFFLOAD_LATENCY_MAX, OFFLOAD_LATENCY_PRECISION);
+		if (!out[j]) {
+			while (j > 0) TALLOC_FREE(out[--j]);
+			return -1;
+		}
+	}
+
+	/*
+	 *	The offload threads record latencies with the
+	 *	mutex held, so the histograms can't change
+	 *	while they're being merged.
+	 */
+	pthread_mutex_lock(&pool->mutex);
+	for (i = 0; i < pool->conf.num_threads; i++) {
+		for (j = 0; j < FR_OFFLOAD_LATENCY_MAX; j++) (void) fr_histogram_merge(out[j], pool->runner[i].latency[j]);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return 0;
+}
+
+static int cmd_stats_offload(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	fr_offload_t		*pool = ctx;
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "count") == 0)) {
+		fr_offload_stats_t	stats;
+
+		fr_offload_stats(&stats, pool);
+
+		fprintf(fp, "count.threads\t\t\t%u\n", pool->num_runners);
+		fprintf(fp, "count.submitted\t\t\t%" PRIu64 "\n", stats.submitted);
+		fprintf(fp, "count.rejected\t\t\t%" PRIu64 "\n", stats.rejected);
+		fprintf(fp, "count.completed\t\t\t%" PRIu64 "\n", stats.completed);
+		fprintf(fp, "count.expired\t\t\t%" PRIu64 "\n", stats.expired);
+		fprintf(fp, "count.cancelled\t\t\t%" PRIu64 "\n", stats.cancelled);
+		fprintf(fp, "count.queued\t\t\t%u\n", stats.queued);
+		fprintf(fp, "count.queued_max\t\t%u\n", stats.queued_max);
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "latency") == 0)) {
+		TALLOC_CTX	*tmp_ctx;
+		fr_histogram_t	*latency[FR_OFFLOAD_LATENCY_MAX];
+		unsigned int	i;
+
+		MEM(tmp_ctx = talloc_new(NULL));
+		if (fr_offload_latency(tmp_ctx, latency, pool) < 0) {
+			fprintf(fp_err, "Failed merging latencies\n");
+			talloc_free(tmp_ctx);
+			return -1;
+		}
+
+		for (i = 0; i < FR_OFFLOAD_LATENCY_MAX; i++) {
+			char prefix[32];
+
+			snprintf(prefix, sizeof(prefix), "latency.%s",
+				 fr_table_str_by_value(fr_offload_latency_table, i, "<INVALID>"));
+			fr_histogram_fprint(fp, prefix, latency[i], NSEC);
+		}
+		talloc_free(tmp_ctx);
+	}
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_offload_table[] = {
+	{
+		.parent = "stats",
+		.name = "offload",
+		.help = "Statistics for offload pools.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats offload",
+		.add_name = true,
+		.name = "self",
+		.syntax = "[(count|latency)]",
+		.func = cmd_stats_offload,
+		.help = "Show statistics for a specific offload pool.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
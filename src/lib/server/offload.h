@@ -0,0 +1,116 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/offload.h
+ * @brief Run CPU intensive work in a thread pool, instead of in a worker.
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSIDH(offload_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/server/cf_parse.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/histogram.h>
+
+typedef struct fr_offload_s fr_offload_t;
+typedef struct fr_offload_thread_s fr_offload_thread_t;
+typedef struct fr_offload_job_s fr_offload_job_t;
+
+/** Where a job is, or how it ended
+ *
+ */
+typedef enum {
+	FR_OFFLOAD_JOB_QUEUED = 0,			//!< Waiting for an offload thread.
+	FR_OFFLOAD_JOB_RUNNING,				//!< Being run by an offload thread.
+	FR_OFFLOAD_JOB_DONE,				//!< The function was run.
+	FR_OFFLOAD_JOB_EXPIRED,				//!< Nothing picked the job up before its deadline,
+							///< so the function was never run.
+	FR_OFFLOAD_JOB_CANCELLED			//!< Cancelled while it was still queued.
+} fr_offload_job_state_t;
+
+/** Where jobs spend their time
+ *
+ */
+typedef enum {
+	FR_OFFLOAD_LATENCY_QUEUED = 0,			//!< From being submitted, to being started.
+	FR_OFFLOAD_LATENCY_RUNNING,			//!< Running the function.
+	FR_OFFLOAD_LATENCY_MAX
+} fr_offload_latency_t;
+
+typedef struct {
+	uint32_t		num_threads;		//!< Number of offload threads.  0 disables the pool.
+	uint32_t		max_queued;		//!< Maximum number of jobs waiting for a thread.
+	fr_time_delta_t		timeout;		//!< How long a job may wait for a thread.
+} fr_offload_conf_t;
+
+typedef struct {
+	uint64_t		submitted;		//!< Jobs which were queued.
+	uint64_t		rejected;		//!< Jobs which were refused, as the queue was full.
+	uint64_t		completed;		//!< Jobs which were run.
+	uint64_t		expired;		//!< Jobs which weren't started before their deadline.
+	uint64_t		cancelled;		//!< Jobs which were cancelled while queued.
+
+	uint32_t		queued;			//!< Jobs waiting for a thread now.
+	uint32_t		queued_max;		//!< Most jobs which have ever been waiting at once.
+} fr_offload_stats_t;
+
+/** The work to do in an offload thread
+ *
+ * This function MUST NOT access the request, log, or allocate memory
+ * from any talloc context which the submitting thread uses.  It should
+ * only read its inputs from uctx, and write its results back to uctx.
+ *
+ * @param[in] uctx	passed to #fr_offload_submit.
+ */
+typedef void (*fr_offload_func_t)(void *uctx);
+
+extern conf_parser_t const fr_offload_config[];
+
+extern fr_table_num_sorted_t const fr_offload_latency_table[];
+extern size_t fr_offload_latency_table_len;
+
+fr_offload_t		*fr_offload_alloc(TALLOC_CTX *ctx, fr_offload_conf_t const *conf, char const *name)
+			  CC_HINT(nonnull(2,3));
+
+fr_offload_thread_t	*fr_offload_thread_alloc(TALLOC_CTX *ctx, fr_offload_t *pool, fr_event_list_t *el)
+			  CC_HINT(nonnull(2,3));
+
+fr_offload_job_t	*fr_offload_submit(fr_offload_thread_t *ot, request_t *request,
+					   fr_offload_func_t func, void *uctx) CC_HINT(nonnull(1,2,3));
+
+void			fr_offload_cancel(fr_offload_job_t *job) CC_HINT(nonnull);
+
+fr_offload_job_state_t	fr_offload_job_state(fr_offload_job_t const *job) CC_HINT(nonnull);
+
+void			*fr_offload_job_uctx(fr_offload_job_t const *job) CC_HINT(nonnull);
+
+void			fr_offload_stats(fr_offload_stats_t *stats, fr_offload_t *pool) CC_HINT(nonnull);
+
+int			fr_offload_latency(TALLOC_CTX *ctx, fr_histogram_t *out[static FR_OFFLOAD_LATENCY_MAX],
+					   fr_offload_t *pool) CC_HINT(nonnull(2,3));
+
+#ifdef __cplusplus
+}
+#endif
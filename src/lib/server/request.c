@@ -56,11 +56,30 @@ fr_dict_attr_autoload_t request_dict_attr[] = {
 	{ NULL }
 };
 
-/** The thread local free list
+/** Maximum number of reset requests each thread keeps for reuse
  *
- * Any entries remaining in the list will be freed when the thread is joined
  */
-static _Thread_local fr_dlist_head_t *request_free_list; /* macro */
+#define REQUEST_ARENA_MAX_FREE	256
+
+/** Per-thread request arena
+ *
+ * Each request is a talloc pool, so the request's pair lists, packets and
+ * decoded packet data are carved out of a single chunk.  When the request
+ * is done, its children are freed, which empties the pool and resets it
+ * in one step.  The request chunk itself is then parked in the free list
+ * and handed out again, without going back to the system allocator.
+ */
+typedef struct {
+	fr_dlist_head_t		free;		//!< Requests which have been reset, and can be reused.
+	size_t			pool_size;	//!< Additional pool memory allocated with each request.
+	request_arena_stats_t	stats;		//!< Allocator statistics for this thread.
+} request_arena_t;
+
+/** The thread local request arena
+ *
+ * Any entries remaining in the free list will be freed when the thread is joined
+ */
+static _Thread_local request_arena_t *request_arena; /* macro */
 
 #ifndef NDEBUG
 static int _state_ctx_free(fr_pair_t *state)
@@ -358,6 +377,8 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
  */
 static int _request_free(request_t *request)
 {
+	request_arena_t	*arena;
+
 	fr_assert_msg(!fr_heap_entry_inserted(request->time_order_id),
 		      "alloced %s:%i: %s still in the time_order heap ID %i",
 		      request->alloc_file,
@@ -371,32 +392,50 @@ static int _request_free(request_t *request)
 
 	RDEBUG3("Request freed (%p)", request);
 
+	arena = request_arena;
+
 	/*
 	 *	Reinsert into the free list if it's not already
 	 *	in the free list.
 	 *
 	 *	If it *IS* already in the free list, then free it.
+	 *	It stopped counting as in use when it was parked,
+	 *	so only the free list stats change.
 	 */
 	if (unlikely(fr_dlist_entry_in_list(&request->free_entry))) {
 		fr_dlist_entry_unlink(&request->free_entry);	/* Don't trust the list head to be available */
+		if (arena) {
+			fr_assert(arena->stats.num_free > 0);
+			arena->stats.num_free--;
+			arena->stats.freed++;
+		}
 		goto really_free;
 	}
 
+	if (unlikely(!arena)) goto free_children;		/* Freed in a thread that never allocated */
+
+	/*
+	 *	Every other path stops the request counting
+	 *	as in use, whether it's parked or freed.
+	 */
+	fr_assert(arena->stats.in_use > 0);
+	arena->stats.in_use--;
+
 	/*
 	 *	We keep a buffer of <active> + N requests per
 	 *	thread, to avoid spurious allocations.
 	 */
-	if (fr_dlist_num_elements(request_free_list) <= 256) {
-		fr_dlist_head_t		*free_list;
-
+	if (fr_dlist_num_elements(&arena->free) < REQUEST_ARENA_MAX_FREE) {
 		if (request->session_state_ctx) {
 			fr_assert(talloc_parent(request->session_state_ctx) != request);	/* Should never be directly parented */
 			TALLOC_FREE(request->session_state_ctx);				/* Not parented from the request */
 		}
-		free_list = request_free_list;
 
 		/*
-		 *	Reinitialise the request
+		 *	Reinitialise the request.  Once the last
+		 *	child is gone, talloc rewinds the pool,
+		 *	so everything allocated during the life
+		 *	of the request is reclaimed in one go.
 		 */
 		talloc_free_children(request);
 
@@ -415,13 +454,16 @@ static int _request_free(request_t *request)
 		/*
 		 *	Reinsert into the free list
 		 */
-		fr_dlist_insert_head(free_list, request);
-		request_free_list = free_list;
+		fr_dlist_insert_head(&arena->free, request);
+		arena->stats.num_free = fr_dlist_num_elements(&arena->free);
+		arena->stats.released++;
 
 		return -1;	/* Prevent free */
  	}
 
+	arena->stats.freed++;
 
+free_children:
 	/*
 	 *	Ensure anything that might reference the request is
 	 *	freed before it is.
@@ -444,19 +486,54 @@ really_free:
 /** Free any free requests when the thread is joined
  *
  */
-static int _request_free_list_free_on_exit(void *arg)
+static int _request_arena_free_on_exit(void *arg)
 {
-	fr_dlist_head_t *list = talloc_get_type_abort(arg, fr_dlist_head_t);
-	request_t		*request;
+	request_arena_t	*arena = talloc_get_type_abort(arg, request_arena_t);
+	request_t	*request;
 
 	/*
 	 *	See the destructor for why this works
 	 */
-	while ((request = fr_dlist_head(list))) if (talloc_free(request) < 0) return -1;
-	return talloc_free(list);
+	while ((request = fr_dlist_head(&arena->free))) if (talloc_free(request) < 0) return -1;
+	return talloc_free(arena);
+}
+
+/** Return the request arena for this thread, allocating it if needed
+ *
+ */
+static inline CC_HINT(always_inline) request_arena_t *request_arena_get(void)
+{
+	request_arena_t *arena;
+
+	if (likely(request_arena != NULL)) return request_arena;
+
+	MEM(arena = talloc_zero(NULL, request_arena_t));
+	fr_dlist_init(&arena->free, request_t, free_entry);
+	fr_atexit_thread_local(request_arena, _request_arena_free_on_exit, arena);
+
+	return arena;
 }
 
-static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *ctx)
+/** Set the size of the arena allocated with each request in this thread
+ *
+ * Requests already in the free list keep the pool they were allocated with.
+ *
+ * @param[in] pool_size		Additional memory to allocate with each request,
+ *				for pairs, packets and decoded packet data.
+ * @return The allocator statistics for this thread.  The pointer remains valid
+ *	until the thread exits.
+ */
+request_arena_stats_t const *request_arena_init(size_t pool_size)
+{
+	request_arena_t *arena = request_arena_get();
+
+	arena->pool_size = pool_size;
+	arena->stats.pool_size = pool_size;
+
+	return &arena->stats;
+}
+
+static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *ctx, size_t pool_size)
 {
 	request_t *request;
 
@@ -473,11 +550,13 @@ static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *c
 					   1 + 					/* Stack pool */
 					   UNLANG_STACK_MAX + 			/* Stack Frames */
 					   2 + 					/* packets */
-					   10,					/* extra */
+					   10 +					/* extra */
+					   (pool_size / 64),			/* arena, assuming ~64 byte chunks */
 					   (UNLANG_FRAME_PRE_ALLOC * UNLANG_STACK_MAX) +	/* Stack memory */
 					   (sizeof(fr_pair_t) * 5) +		/* pair lists and root*/
 					   (sizeof(fr_packet_t) * 2) +	/* packets */
-					   128					/* extra */
+					   128 +				/* extra */
+					   pool_size				/* arena */
 					   ));
 	fr_assert(ctx != request);
 
@@ -499,38 +578,37 @@ request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx,
 			  request_type_t type, request_init_args_t const *args)
 {
 	request_t		*request;
-	fr_dlist_head_t		*free_list;
+	request_arena_t		*arena;
 
 	if (!args) args = &default_args;
 
 	/*
-	 *	Setup the free list, or return the free
-	 *	list for this thread.
+	 *	Setup the arena, or return the arena
+	 *	for this thread.
 	 */
-	if (unlikely(!request_free_list)) {
-		MEM(free_list = talloc(NULL, fr_dlist_head_t));
-		fr_dlist_init(free_list, request_t, free_entry);
-		fr_atexit_thread_local(request_free_list, _request_free_list_free_on_exit, free_list);
-	} else {
-		free_list = request_free_list;
-	}
+	arena = request_arena_get();
 
-	request = fr_dlist_head(free_list);
+	request = fr_dlist_head(&arena->free);
 	if (!request) {
 		/*
 		 *	Must be allocated with in the NULL ctx
 		 *	as chunk is returned to the free list.
 		 */
-		request = request_alloc_pool(NULL);
+		request = request_alloc_pool(NULL, arena->pool_size);
 		talloc_set_destructor(request, _request_free);
+		arena->stats.alloced++;
 	} else {
 		/*
 		 *	Remove from the free list, as we're
 		 *	about to use it!
 		 */
-		fr_dlist_remove(free_list, request);
+		fr_dlist_remove(&arena->free, request);
+		arena->stats.num_free = fr_dlist_num_elements(&arena->free);
+		arena->stats.reused++;
 	}
 
+	if (++arena->stats.in_use > arena->stats.in_use_max) arena->stats.in_use_max = arena->stats.in_use;
+
 	if (request_init(file, line, request, type, args) < 0) {
 		talloc_free(request);
 		return NULL;
@@ -609,7 +687,7 @@ request_t *_request_local_alloc(char const *file, int line, TALLOC_CTX *ctx,
 
 	if (!args) args = &default_args;
 
-	request = request_alloc_pool(ctx);
+	request = request_alloc_pool(ctx, 0);
 	if (request_init(file, line, request, type, args) < 0) return NULL;
 
 	talloc_set_destructor(request, _request_local_free);
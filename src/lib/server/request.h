@@ -327,6 +327,22 @@ request_t	*_request_alloc(char const *file, int line, TALLOC_CTX *ctx,
 request_t	*_request_local_alloc(char const *file, int line, TALLOC_CTX *ctx,
 				      request_type_t type, request_init_args_t const *args);
 
+/** Per-thread request allocator statistics
+ *
+ */
+typedef struct {
+	uint64_t	alloced;			//!< Requests allocated from the heap.
+	uint64_t	reused;				//!< Requests taken from the free list.
+	uint64_t	released;			//!< Requests reset and returned to the free list.
+	uint64_t	freed;				//!< Requests returned to the heap.
+	uint32_t	in_use;				//!< Requests currently allocated.
+	uint32_t	in_use_max;			//!< Most requests allocated at once.
+	uint32_t	num_free;			//!< Requests in the free list.
+	size_t		pool_size;			//!< Additional pool memory allocated with each request.
+} request_arena_stats_t;
+
+request_arena_stats_t const *request_arena_init(size_t pool_size);
+
 fr_pair_t	*request_state_replace(request_t *request, fr_pair_t *state) CC_HINT(nonnull(1));
 
 int		request_detach(request_t *child);
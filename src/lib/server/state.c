@@ -42,6 +42,12 @@
           \-> reply                 \-> reply                 \-> access-reject/access-accept
  * @endverbatim
  *
+ * When the state store is thread safe, entries are spread over a number of
+ * shards, each with its own mutex, rbtree and expiry list.  The shard is
+ * selected from the (already random) value of the State attribute, so that
+ * workers thawing and freezing unrelated sessions rarely contend for the
+ * same lock.
+ *
  * @copyright 2014 The FreeRADIUS server project
  */
 RCSID("$Id$")
@@ -54,10 +60,23 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Number of shards to use for thread safe state trees
+ *
+ * Must be a power of two.
+ */
+#define STATE_TREE_SHARDS	16
+
 /** Holds a state value, and associated fr_pair_ts and data
  *
  */
@@ -142,19 +161,29 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 } state_child_entry_t;
 
-struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
+/** A subset of the state entries, selected by the value of the State attribute
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
 	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
+} fr_state_shard_t;
+
+struct fr_state_tree_s {
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	uint32_t		used_sessions;			//!< How many sessions are currently in progress.
-	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+	atomic_uint_fast32_t	used_sessions;			//!< How many sessions are currently in progress.
+
+	fr_state_shard_t	*shards;			//!< Array of shards, each with its own tree,
+								///< expiry list and mutex.
+	uint32_t		num_shards;			//!< How many shards there are.  Always a power of two.
 
 	fr_time_delta_t		timeout;			//!< How long to wait before cleaning up state entries.
 
-	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	bool			thread_safe;			//!< Whether we lock the shards whilst modifying them.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 	uint32_t		context_id;			//!< ID binding state values to a context such
@@ -166,7 +195,7 @@ struct fr_state_tree_s {
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -185,22 +214,27 @@ static int8_t state_entry_cmp(void const *one, void const *two)
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*entry;
+	uint32_t		i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -224,12 +258,14 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint8_t server_id, uint32_t context_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	num_shards, i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	state->thread_safe = thread_safe;
 
 	/*
 	 *	Create a break in the contexts.
@@ -240,47 +276,98 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
+	/*
+	 *	There's no contention if only one thread
+	 *	uses the tree, so don't bother sharding.
+	 */
+	num_shards = thread_safe ? STATE_TREE_SHARDS : 1;
+
+	state->shards = talloc_zero_array(state, fr_state_shard_t, num_shards);
+	if (!state->shards) {
 		talloc_free(state);
 		return NULL;
 	}
-
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, free_entry);
+	talloc_set_destructor(state, _state_tree_free);
 
 	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
+	 *	num_shards is only incremented once a shard
+	 *	is fully initialised, so the destructor only
+	 *	cleans up the ones which need cleaning up.
 	 */
-	state->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+	for (i = 0; i < num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(state);
+			return NULL;
+		}
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, free_entry);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
+		if (!shard->tree) {
+			if (thread_safe) pthread_mutex_destroy(&shard->mutex);
+			talloc_free(state);
+			return NULL;
+		}
+
+		state->num_shards++;
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
 	state->context_id = context_id;
-	state->thread_safe = thread_safe;
 
 	return state;
 }
 
+/** Select the shard an entry belongs in
+ *
+ * The state value is mostly random data, so folding it down
+ * gives an even distribution of entries between the shards.
+ *
+ * @param[in] state	tree containing the shards.
+ * @param[in] entry	to find the shard for.  The context_id must
+ *			already have been applied to the state value.
+ * @return the shard the entry should be inserted into, or looked up in.
+ */
+static inline CC_HINT(always_inline)
+fr_state_shard_t *state_entry_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	uint32_t	hash = 0, x;
+	size_t		i;
+
+	if (state->num_shards == 1) return &state->shards[0];
+
+	for (i = 0; i < sizeof(entry->state); i += sizeof(x)) {
+		memcpy(&x, entry->state + i, sizeof(x));
+		hash ^= x;
+	}
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+
+	return &state->shards[hash & (state->num_shards - 1)];
+}
+
 /** Unlink an entry and remove if from the tree
  *
  */
 static inline CC_HINT(always_inline)
-void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
-	fr_rb_delete(state->tree, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
+	fr_rb_delete(shard->tree, entry);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -320,14 +407,88 @@ static int _state_entry_free(fr_state_entry_t *entry)
 
 	DEBUG4("State ID %" PRIu64 " freed", entry->id);
 
-	entry->state_tree->used_sessions--;
+	atomic_fetch_sub_explicit(&entry->state_tree->used_sessions, 1, memory_order_relaxed);
 
 	return 0;
 }
 
+/** Move expired entries from a shard into a list of entries to free
+ *
+ * @note Called with the shard's mutex held.
+ *
+ * @param[in] shard	to expire entries in.
+ * @param[out] to_free	list to add expired entries to.
+ * @param[in] now	the current time.
+ * @return the number of entries expired.
+ */
+static uint64_t state_shard_expire(fr_state_shard_t *shard, fr_dlist_head_t *to_free, fr_time_t now)
+{
+	fr_state_entry_t	*entry, *next;
+	uint64_t		timed_out = 0;
+
+	for (entry = fr_dlist_head(&shard->to_expire);
+	     entry != NULL;
+	     entry = next) {
+ 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
+		next = fr_dlist_next(&shard->to_expire, entry);		/* Advance *before* potential unlinking */
+
+		/*
+		 *	List is ordered by cleanup time, so
+		 *	stop at the first entry that's still
+		 *	valid.
+		 */
+		if (fr_time_gteq(entry->cleanup, now)) break;
+
+		state_entry_unlink(shard, entry);
+		fr_dlist_insert_tail(to_free, entry);
+		timed_out++;
+	}
+
+	shard->timed_out += timed_out;
+
+	return timed_out;
+}
+
+/** Free entries previously removed from their shards
+ *
+ * We do this with no mutex held as freeing may involve significantly more
+ * work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed also,
+ * and it may have complex destructors associated with it.
+ */
+static void state_entries_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t	*entry;
+
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+	}
+}
+
+/** Reserve a session slot
+ *
+ * @return
+ *	- true if a slot was reserved.
+ *	- false if we're at the maximum number of sessions.
+ */
+static inline CC_HINT(always_inline)
+bool state_session_reserve(fr_state_tree_t *state)
+{
+	if (atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed) < state->max_sessions) return true;
+
+	atomic_fetch_sub_explicit(&state->used_sessions, 1, memory_order_relaxed);
+
+	return false;
+}
+
 /** Create a new state entry
  *
- * @note Called with the mutex held.
+ * The entry is not inserted into the state tree.  That's done by
+ * #state_entry_insert once the entry has been populated.
+ *
+ * @note Called with no mutexes held.
  */
 static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
 					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
@@ -336,13 +497,10 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	uint32_t		x;
 	fr_time_t		now = fr_time();
 	fr_pair_t		*vp;
-	fr_state_entry_t	*entry, *next;
+	fr_state_entry_t	*entry;
 
 	uint8_t			old_state[sizeof(old->state)];
 	int			old_tries = 0;
-	uint64_t		timed_out = 0;
-	bool			too_many = false;
-	fr_dlist_head_t		to_free;
 
 	/*
 	 *	Shouldn't be in any lists if it's being reused
@@ -351,77 +509,41 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		  (!fr_dlist_entry_in_list(&old->expire_entry) &&
 		   !fr_rb_node_inline_in_tree(&old->node)));
 
-	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
-
-	/*
-	 *	Clean up expired entries
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
- 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
-
-		if (entry == old) continue;
-
+	if (!old) {
 		/*
-		 *	Too old, we can delete it.
+		 *	Expired entries are normally cleaned up from
+		 *	a shard as new entries are inserted into it.
+		 *	If we're at the limit, go through all the
+		 *	shards before giving up.
 		 */
-		if (fr_time_lt(entry->cleanup, now)) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
+		if (!state_session_reserve(state)) {
+			fr_dlist_head_t		to_free;
+			uint64_t		timed_out = 0;
 
-		break;
-	}
+			fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
 
-	state->timed_out += timed_out;
+			for (i = 0; i < state->num_shards; i++) {
+				fr_state_shard_t *shard = &state->shards[i];
 
-	if (!old) {
-		too_many = (state->used_sessions == (uint32_t) state->max_sessions);
-		if (!too_many) state->used_sessions++;	/* preemptively increment whilst we hold the mutex */
+				PTHREAD_MUTEX_LOCK(&shard->mutex);
+				timed_out += state_shard_expire(shard, &to_free, now);
+				PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+			}
+
+			if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+			state_entries_free(&to_free);
+
+			if (!state_session_reserve(state)) {
+				RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
+				       state->max_sessions);
+				return NULL;
+			}
+		}
 	} else {
 		old_tries = old->tries;
 		memcpy(old_state, old->state, sizeof(old_state));
 	}
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
-
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
-
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
-
-	/*
-	 *	Allocation doesn't need to occur inside the critical region
-	 *	and would add significantly to contention.
-	 */
 	if (!old) {
 		MEM(entry = talloc_zero(NULL, fr_state_entry_t));
 		talloc_set_destructor(entry, _state_entry_free);
@@ -435,13 +557,19 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		talloc_free_children(old);
 		memset(old, 0, sizeof(*old));
 		entry = old;
+
+		/*
+		 *	The entry is still a tracked session,
+		 *	undo the decrement done by the destructor.
+		 */
+		atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed);
 	}
 
 	entry->state_tree = state;
 
 	request_data_list_init(&entry->data);
 
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -531,8 +659,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)),
 	       fr_box_time_delta(fr_time_sub(entry->cleanup, now)));
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -541,28 +667,62 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	*((uint32_t *)(&entry->state_comp.context_id)) ^= state->context_id;
 
-	if (!fr_rb_insert(state->tree, entry)) {
-		RERROR("Failed inserting state entry - Insertion into state tree failed");
-		fr_pair_delete_by_da(reply_list, state->da);
-		talloc_free(entry);
-		return NULL;
-	}
+	return entry;
+}
+
+/** Insert a populated state entry into its shard
+ *
+ * Also cleans up any expired entries in the shard.
+ *
+ * @note Called with no mutexes held.
+ *
+ * @param[in] state	tree to insert the entry into.
+ * @param[in] request	the entry was created for.
+ * @param[in] entry	to insert.
+ * @return
+ *	- 0 on success.
+ *	- -1 if an entry with the same state value already exists.
+ */
+static int state_entry_insert(fr_state_tree_t *state, request_t *request, fr_state_entry_t *entry)
+{
+	fr_state_shard_t	*shard = state_entry_shard(state, entry);
+	fr_dlist_head_t		to_free;
+	uint64_t		timed_out;
+	bool			inserted;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	timed_out = state_shard_expire(shard, &to_free, fr_time());
+
+	inserted = fr_rb_insert(shard->tree, entry);
 
 	/*
 	 *	Link it to the end of the list, which is implicitly
 	 *	ordered by cleanup time.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	if (inserted) fr_dlist_insert_tail(&shard->to_expire, entry);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
-	return entry;
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	state_entries_free(&to_free);
+
+	if (!inserted) {
+		RERROR("Failed inserting state entry - Insertion into state tree failed");
+		return -1;
+	}
+
+	return 0;
 }
 
 /** Find the entry based on the State attribute and remove it from the state tree
  *
+ * @note Called with no mutexes held.
  */
 static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 
 	/*
 	 *	Assume our own State first.
@@ -591,11 +751,15 @@ static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_
 	 */
 	my_entry.state_comp.context_id ^= state->context_id;
 
-	entry = fr_rb_remove(state->tree, &my_entry);
+	shard = state_entry_shard(state, &my_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = fr_rb_remove(shard->tree, &my_entry);
 	if (entry) {
 		(void) talloc_get_type_abort(entry, fr_state_entry_t);
-		fr_dlist_remove(&state->to_expire, entry);
+		fr_dlist_remove(&shard->to_expire, entry);
 	}
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	return entry;
 }
@@ -611,13 +775,8 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
 	vp = fr_pair_find_by_da(&request->request_pairs, NULL, state->da);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		return;
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	if (!entry) return;
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -672,14 +831,11 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return 1;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RDEBUG2("No state entry matching &request.%pP found", vp);
 		return 2;
 	}
-   	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/* Probably impossible in the current code */
 	if (unlikely(entry->thawed != NULL)) {
@@ -761,14 +917,13 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	}
 
 	MEM(state_ctx = request_state_replace(request, NULL));
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 
 	/*
 	 *	Reuses old if possible
 	 */
 	entry = state_entry_create(state, request, &request->reply_pairs, old);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	error:
 		RERROR("Creating state entry failed");
 
 		talloc_free(request_state_replace(request, state_ctx));
@@ -779,10 +934,26 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	fr_assert(entry->ctx == NULL);
 	fr_assert(request->session_state_ctx);
 
+	/*
+	 *	Populate the entry before it's visible
+	 *	to other threads.
+	 */
 	entry->seq_start = request->seq_start;
 	entry->ctx = state_ctx;
 	fr_dlist_move(&entry->data, &data);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+
+	if (state_entry_insert(state, request, entry) < 0) {
+		fr_pair_delete_by_da(&request->reply_pairs, state->da);
+
+		/*
+		 *	Take back the session state so it's
+		 *	not freed along with the entry.
+		 */
+		fr_dlist_move(&data, &entry->data);
+		entry->ctx = NULL;
+		talloc_free(entry);
+		goto error;
+	}
 
 	RDEBUG3("%s - saved", state->da->name);
 	REQUEST_VERIFY(request);
@@ -919,12 +1090,38 @@ void fr_state_discard_child(request_t *parent, void const *unique_ptr, int uniqu
 	talloc_free(child_entry);
 }
 
+/** Hash the parts of a State value which are the same for every round of a session
+ *
+ * Each round of a session gets a new State value, built from the previous
+ * one.  For values we created, the tries and tx fields change on every round,
+ * and the context_id field is alternately xor'd with the tree's context ID.
+ * Only the remaining fields are hashed.
+ *
+ * State values of any other length were set by a module, and are hashed
+ * in full.
+ *
+ * @param[in] value	State value from a packet.
+ * @param[in] len	Length of the State value.
+ * @param[in] hash	to update.
+ * @return the updated hash.
+ */
+uint32_t fr_state_hash(uint8_t const *value, size_t len, uint32_t hash)
+{
+	if (len != sizeof(((fr_state_entry_t *)NULL)->state)) return fr_hash_update(value, len, hash);
+
+	hash = fr_hash_update(value + offsetof(struct state_comp, r_0),
+			      offsetof(struct state_comp, context_id) - offsetof(struct state_comp, r_0), hash);
+
+	return fr_hash_update(value + offsetof(struct state_comp, vx_0),
+			      len - offsetof(struct state_comp, vx_0), hash);
+}
+
 /** Return number of entries created
  *
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -932,7 +1129,18 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	timed_out = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		timed_out += shard->timed_out;
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -940,5 +1148,16 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return fr_rb_num_elements(state->tree);
+	uint64_t	tracked = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		tracked += fr_rb_num_elements(shard->tree);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	return tracked;
 }
@@ -48,6 +48,8 @@ void	fr_state_store_in_parent(request_t *request, void const *unique_ptr, int un
 void	fr_state_restore_to_child(request_t *child, void const *unique_ptr, int unique_int);
 void	fr_state_discard_child(request_t *parent, void const *unique_ptr, int unique_int);
 
+uint32_t fr_state_hash(uint8_t const *value, size_t len, uint32_t hash);
+
 /*
  *	Stats
  */
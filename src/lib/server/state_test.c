@@ -1,28 +1,443 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests and benchmarks for the state store
+ *
+ * @file src/lib/server/state_test.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
 #include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/dict_test.h>
+
+#include "state.c"
+
+#include <pthread.h>
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*test_dict;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("state_test");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+}
+
+static request_t *request_fake_alloc(TALLOC_CTX *ctx)
+{
+	request_t	*request;
 
-fr_time_t	test_time;
+	request = request_local_alloc_external(ctx, NULL);
+	if (!request) return NULL;
 
-/** Allow us to arbitrarily manipulate time
+	/*
+	 *	fr_state_to_request sets the sequence number
+	 */
+	request->async = talloc_zero(request, fr_async_t);
+
+	return request;
+}
+
+/** Add a session-state attribute to a request and freeze it
  *
+ * @return the State value sent in the reply.
  */
-#define fr_time()	test_time
+static fr_pair_t *state_freeze(fr_state_tree_t *state, request_t *request, uint32_t value)
+{
+	fr_pair_t	*vp;
+
+	if (pair_append_session_state(&vp, fr_dict_attr_test_uint32) < 0) return NULL;
+	vp->vp_uint32 = value;
+
+	if (fr_request_to_state(state, request) < 0) return NULL;
 
-#include <state_test.c>
+	return fr_pair_find_by_da(&request->reply_pairs, NULL, fr_dict_attr_test_octets);
+}
 
-/** Test functions that read from dbuffs.
+/** Thaw the session identified by a State value into a new request
  *
  */
-static void state_entry_create(void)
+static request_t *state_thaw(TALLOC_CTX *ctx, fr_state_tree_t *state, fr_pair_t const *state_vp)
+{
+	request_t	*request;
+	fr_pair_t	*vp;
+
+	request = request_fake_alloc(ctx);
+	if (!request) return NULL;
+
+	if (pair_append_request(&vp, fr_dict_attr_test_octets) < 0) {
+	error:
+		talloc_free(request);
+		return NULL;
+	}
+	fr_pair_value_memdup(vp, state_vp->vp_octets, state_vp->vp_length, false);
+
+	if (fr_state_to_request(state, request) != 0) goto error;
+
+	return request;
+}
+
+static void test_state_entry_create(void)
+{
+	fr_state_tree_t	*state;
+	request_t	*request, *thawed;
+	fr_pair_t	*state_vp, *vp;
+
+	state = fr_state_tree_init(autofree, fr_dict_attr_test_octets, false, 10,
+				   fr_time_delta_from_sec(30), 0, 0xdeadbeef);
+	TEST_CHECK(state != NULL);
+
+	request = request_fake_alloc(autofree);
+	TEST_CHECK(request != NULL);
+
+	TEST_CASE("Freeze session-state");
+	state_vp = state_freeze(state, request, 42);
+	TEST_CHECK(state_vp != NULL);
+	TEST_CHECK(state_vp->vp_length == sizeof(((fr_state_entry_t *)NULL)->state));
+	TEST_CHECK(fr_pair_list_empty(&request->session_state_pairs));
+	TEST_CHECK(fr_state_entries_tracked(state) == 1);
+	TEST_CHECK(fr_state_entries_created(state) == 1);
+
+	TEST_CASE("Thaw session-state");
+	thawed = state_thaw(autofree, state, state_vp);
+	TEST_CHECK(thawed != NULL);
+	TEST_CHECK(fr_state_entries_tracked(state) == 0);
+
+	vp = fr_pair_find_by_da(&thawed->session_state_pairs, NULL, fr_dict_attr_test_uint32);
+	TEST_CHECK(vp != NULL);
+	if (vp) TEST_CHECK(vp->vp_uint32 == 42);
+
+	TEST_CASE("Unknown State values don't match");
+	TEST_CHECK(state_thaw(autofree, state, state_vp) == NULL);
+
+	TEST_CASE("Discard session-state");
+	fr_state_discard(state, thawed);
+	TEST_CHECK(fr_pair_list_empty(&thawed->session_state_pairs));
+
+	talloc_free(thawed);
+	talloc_free(request);
+	TEST_CHECK(atomic_load(&state->used_sessions) == 0);
+
+	talloc_free(state);
+}
+
+static void test_state_entry_too_many(void)
 {
+	fr_state_tree_t	*state;
+	request_t	*request[3];
+	size_t		i;
+
+	state = fr_state_tree_init(autofree, fr_dict_attr_test_octets, true, 2,
+				   fr_time_delta_from_sec(30), 0, 0);
+	TEST_CHECK(state != NULL);
+
+	for (i = 0; i < NUM_ELEMENTS(request); i++) {
+		request[i] = request_fake_alloc(autofree);
+		TEST_CHECK(request[i] != NULL);
+	}
+
+	TEST_CASE("Freeze up to max_sessions");
+	TEST_CHECK(state_freeze(state, request[0], 0) != NULL);
+	TEST_CHECK(state_freeze(state, request[1], 1) != NULL);
 
+	TEST_CASE("Freezing more than max_sessions fails");
+	TEST_CHECK(state_freeze(state, request[2], 2) == NULL);
+	TEST_CHECK(fr_state_entries_tracked(state) == 2);
+
+	TEST_CASE("Session-state is returned to the request on failure");
+	TEST_CHECK(fr_pair_find_by_da(&request[2]->session_state_pairs, NULL, fr_dict_attr_test_uint32) != NULL);
+
+	for (i = 0; i < NUM_ELEMENTS(request); i++) talloc_free(request[i]);
+	talloc_free(state);
+}
+
+static void test_state_entry_expire(void)
+{
+	fr_state_tree_t	*state;
+	request_t	*request[2];
+	size_t		i;
+
+	/*
+	 *	Zero timeout means entries are expired as
+	 *	soon as any other entry is created.
+	 */
+	state = fr_state_tree_init(autofree, fr_dict_attr_test_octets, true, 1,
+				   fr_time_delta_wrap(0), 0, 0);
+	TEST_CHECK(state != NULL);
+
+	for (i = 0; i < NUM_ELEMENTS(request); i++) {
+		request[i] = request_fake_alloc(autofree);
+		TEST_CHECK(request[i] != NULL);
+	}
+
+	TEST_CASE("Expired entries in other shards are cleaned up when at max_sessions");
+	TEST_CHECK(state_freeze(state, request[0], 0) != NULL);
+	TEST_CHECK(state_freeze(state, request[1], 1) != NULL);
+	TEST_CHECK(fr_state_entries_tracked(state) == 1);
+	TEST_CHECK(fr_state_entries_timeout(state) == 1);
+
+	for (i = 0; i < NUM_ELEMENTS(request); i++) talloc_free(request[i]);
+	talloc_free(state);
+}
+
+static void test_state_shard_distribution(void)
+{
+	fr_state_tree_t	*state;
+	TALLOC_CTX	*ctx;
+	size_t		i;
+
+	state = fr_state_tree_init(autofree, fr_dict_attr_test_octets, true, 4096,
+				   fr_time_delta_from_sec(30), 0, 0x12345678);
+	TEST_CHECK(state != NULL);
+	TEST_CHECK(state->num_shards == STATE_TREE_SHARDS);
+
+	ctx = talloc_new(autofree);
+
+	for (i = 0; i < 1024; i++) {
+		request_t *request = request_fake_alloc(ctx);
+
+		TEST_CHECK(state_freeze(state, request, i) != NULL);
+	}
+	TEST_CHECK(fr_state_entries_tracked(state) == 1024);
+
+	TEST_CASE("Every shard holds entries");
+	for (i = 0; i < state->num_shards; i++) {
+		TEST_CHECK(fr_rb_num_elements(state->shards[i].tree) > 0);
+		TEST_MSG("shard %zu is empty", i);
+	}
+
+	talloc_free(ctx);
+	talloc_free(state);
+}
+
+/** Run a multi-round session, checking the affinity key of each round
+ *
+ * The first packet of a session has no State, so only the rounds after
+ * it need to hash the same.
+ */
+static void test_state_hash_rounds(void)
+{
+	fr_state_tree_t	*state;
+	request_t	*request, *thawed;
+	fr_pair_t	*state_vp;
+	uint8_t		prev[sizeof(((fr_state_entry_t *)NULL)->state)];
+	uint32_t	seed = 0x5eed, key = 0, hash;	/* seed stands in for the hash of the client's IP */
+	size_t		i;
+
+	state = fr_state_tree_init(autofree, fr_dict_attr_test_octets, false, 10,
+				   fr_time_delta_from_sec(30), 0, 0xdeadbeef);
+	TEST_CHECK(state != NULL);
+
+	request = request_fake_alloc(autofree);
+	TEST_CHECK(request != NULL);
+
+	TEST_CASE("Every round after the first has the same affinity key");
+	for (i = 0; i < 8; i++) {
+		state_vp = state_freeze(state, request, i);
+		TEST_CHECK(state_vp != NULL);
+		if (!state_vp) break;
+		TEST_CHECK(state_vp->vp_length == sizeof(prev));
+
+		hash = fr_state_hash(state_vp->vp_octets, state_vp->vp_length, seed);
+		if (i == 0) {
+			key = hash;
+		} else {
+			TEST_CHECK(memcmp(prev, state_vp->vp_octets, sizeof(prev)) != 0);
+			TEST_MSG("State value didn't change in round %zu", i + 2);
+
+			TEST_CHECK(hash == key);
+			TEST_MSG("Round %zu has key %08x, expected %08x", i + 2, hash, key);
+		}
+		memcpy(prev, state_vp->vp_octets, sizeof(prev));
+
+		thawed = state_thaw(autofree, state, state_vp);
+		TEST_CHECK(thawed != NULL);
+		talloc_free(request);
+		request = thawed;
+		if (!request) break;
+	}
+
+	TEST_CASE("Sessions have different affinity keys");
+	if (request) {
+		request_t *other = request_fake_alloc(autofree);
+
+		state_vp = state_freeze(state, other, 0);
+		TEST_CHECK(state_vp != NULL);
+		if (state_vp) TEST_CHECK(fr_state_hash(state_vp->vp_octets, state_vp->vp_length, seed) != key);
+
+		fr_state_discard(state, request);
+		talloc_free(request);
+		talloc_free(other);
+	}
+
+	talloc_free(state);
+}
+
+#define STATE_BENCH_ROUNDS	20000	//!< Sessions each thread runs.
+#define STATE_BENCH_BACKLOG	10000	//!< Idle sessions in the tree whilst the benchmark runs.
+
+typedef struct {
+	pthread_t		thread;
+	fr_state_tree_t		*state;
+	uint64_t		ops;		//!< Freezes + thaws completed.
+	uint64_t		failed;		//!< Freezes or thaws which failed.
+} state_bench_thread_t;
+
+/** Run multi-round sessions, like a worker processing EAP
+ *
+ * Each session is frozen, thawed, re-frozen (reusing the entry),
+ * thawed again and then discarded.
+ */
+static void *state_bench_thread(void *uctx)
+{
+	state_bench_thread_t	*bt = uctx;
+	TALLOC_CTX		*ctx = talloc_new(NULL);
+	size_t			i;
+
+	for (i = 0; i < STATE_BENCH_ROUNDS; i++) {
+		request_t	*request, *thawed;
+		fr_pair_t	*state_vp;
+
+		request = request_fake_alloc(ctx);
+		state_vp = state_freeze(bt->state, request, i);
+		if (!state_vp) {
+		fail:
+			bt->failed++;
+			talloc_free(request);
+			continue;
+		}
+
+		thawed = state_thaw(ctx, bt->state, state_vp);
+		talloc_free(request);
+		if (!thawed) {
+			bt->failed++;
+			continue;
+		}
+
+		request = thawed;
+		state_vp = state_freeze(bt->state, request, i);
+		if (!state_vp) goto fail;
+
+		thawed = state_thaw(ctx, bt->state, state_vp);
+		talloc_free(request);
+		if (!thawed) {
+			bt->failed++;
+			continue;
+		}
+
+		fr_state_discard(bt->state, thawed);
+		talloc_free(thawed);
+
+		bt->ops += 4;
+	}
+
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+static void test_state_thaw_freeze_perf(void)
+{
+	static uint32_t const	thread_counts[] = { 1, 2, 4, 8, 16 };
+	size_t			i, j;
+
+	for (i = 0; i < NUM_ELEMENTS(thread_counts); i++) {
+		fr_state_tree_t		*state;
+		state_bench_thread_t	*bt;
+		TALLOC_CTX		*backlog_ctx;
+		fr_time_t		start;
+		fr_time_delta_t		elapsed;
+		uint64_t		ops = 0, failed = 0;
+		uint32_t		num = thread_counts[i];
+
+		state = fr_state_tree_init(autofree, fr_dict_attr_test_octets, true,
+					   STATE_BENCH_BACKLOG + (num * 2),
+					   fr_time_delta_from_sec(30), 0, 0);
+		TEST_CHECK(state != NULL);
+
+		/*
+		 *	Sessions which are in progress, but not
+		 *	being worked on.
+		 */
+		backlog_ctx = talloc_new(autofree);
+		for (j = 0; j < STATE_BENCH_BACKLOG; j++) {
+			(void) state_freeze(state, request_fake_alloc(backlog_ctx), j);
+		}
+
+		bt = talloc_zero_array(autofree, state_bench_thread_t, num);
+
+		start = fr_time();
+		for (j = 0; j < num; j++) {
+			bt[j].state = state;
+			TEST_CHECK(pthread_create(&bt[j].thread, NULL, state_bench_thread, &bt[j]) == 0);
+		}
+
+		for (j = 0; j < num; j++) {
+			pthread_join(bt[j].thread, NULL);
+			ops += bt[j].ops;
+			failed += bt[j].failed;
+		}
+		elapsed = fr_time_sub(fr_time(), start);
+
+		TEST_CHECK(failed == 0);
+		TEST_MSG("%"PRIu64" sessions failed", failed);
+		TEST_CHECK(fr_state_entries_tracked(state) == STATE_BENCH_BACKLOG);
+
+		TEST_MSG_ALWAYS("threads=%u, ops=%"PRIu64", per_sec=%0.0lf", num, ops,
+				(double)ops / ((double)fr_time_delta_unwrap(elapsed) / (double)NSEC));
+
+		talloc_free(bt);
+		talloc_free(backlog_ctx);
+		talloc_free(state);
+	}
 }
 
 TEST_LIST = {
 	/*
 	 *	Basic tests
 	 */
-	{ "state_entry_create",				state_entry_create },
-	{ "state_entry_too_many" }
+	{ "state_entry_create",				test_state_entry_create },
+	{ "state_entry_too_many",			test_state_entry_too_many },
+	{ "state_entry_expire",				test_state_entry_expire },
+	{ "state_shard_distribution",			test_state_shard_distribution },
+	{ "state_hash_rounds",				test_state_hash_rounds },
+
+	/*
+	 *	Performance tests
+	 */
+	{ "state_thaw_freeze_perf",			test_state_thaw_freeze_perf },
 
 	{ NULL }
 };
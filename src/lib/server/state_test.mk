@@ -0,0 +1,8 @@
+TARGET		:= state_test$(E)
+SOURCES		:= state_test.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-radius$(L) libfreeradius-server$(L) libfreeradius-unlang$(L)
+
+TGT_INSTALLDIR	:=
@@ -78,9 +78,10 @@ static inline CC_HINT(always_inline) void tmpl_cursor_nested_pop(tmpl_dcursor_ct
 
 /** Initialise the evaluation context for traversing a group attribute
  *
+ * @return the first pair the new evaluation context will look at.
  */
 static inline CC_HINT(always_inline)
-void _tmpl_cursor_pair_init(TALLOC_CTX *list_ctx, fr_pair_list_t *list, tmpl_attr_t const *ar, tmpl_dcursor_ctx_t *cc)
+fr_pair_t *_tmpl_cursor_pair_init(TALLOC_CTX *list_ctx, fr_pair_list_t *list, tmpl_attr_t const *ar, tmpl_dcursor_ctx_t *cc)
 {
 	tmpl_dcursor_nested_t *ns;
 
@@ -97,19 +98,24 @@ void _tmpl_cursor_pair_init(TALLOC_CTX *list_ctx, fr_pair_list_t *list, tmpl_att
 	};
 
 	/*
-	 *	Iterates over attributes of a specific type
+	 *	Iterates over attributes of a specific type, so
+	 *	only pairs of that type need to exist.
 	 */
 	if (ar_is_normal(ar)) {
-		fr_pair_dcursor_iter_init(&ns->cursor, list, _tmpl_cursor_child_next, ns);
+		fr_pair_dcursor_iter_da_init(&ns->cursor, list, ar->ar_da, _tmpl_cursor_child_next, ns);
 	/*
-	 *	Iterates over all attributes at this level
+	 *	Iterates over all attributes at this level.  Use a
+	 *	pair cursor so that removals keep the list's index
+	 *	and any lazy decoder in sync.
 	 */
 	} else if (ar_is_unspecified(ar)) {
-		fr_dcursor_init(&ns->cursor, fr_pair_list_to_dlist(list));
+		fr_pair_dcursor_init(&ns->cursor, list);
 	} else {
 		fr_assert_msg(0, "Invalid attr reference type");
 	}
 	tmpl_cursor_nested_push(cc, ns);
+
+	return fr_dcursor_current(&ns->cursor);
 }
 
 /** Evaluates, then, sometimes, pops evaluation contexts from the tmpl stack
@@ -228,8 +234,7 @@ static void *_tmpl_cursor_next(UNUSED fr_dlist_head_t *list, void *curr, void *u
 				fr_pair_list_t		*list_head;
 
 				list_head = &vp->vp_group;
-				_tmpl_cursor_pair_init(vp, list_head, ar, cc);
-				curr = fr_pair_list_head(list_head);
+				curr = _tmpl_cursor_pair_init(vp, list_head, ar, cc);
 				continue;
 			}
 
@@ -312,6 +317,8 @@ fr_pair_t *tmpl_dcursor_init_relative(int *err, TALLOC_CTX *ctx, tmpl_dcursor_ct
 				      tmpl_dcursor_build_t build, void *uctx)
 {
 	fr_pair_t		*vp = NULL;
+	tmpl_attr_t const	*ar;
+	fr_dict_attr_t const	*da = NULL;
 
 	TMPL_VERIFY(vpt);
 
@@ -333,7 +340,10 @@ fr_pair_t *tmpl_dcursor_init_relative(int *err, TALLOC_CTX *ctx, tmpl_dcursor_ct
 	 */
 	switch (vpt->type) {
 	case TMPL_TYPE_ATTR:
-		_tmpl_cursor_pair_init(list, cc->list, tmpl_attr_list_head(&vpt->data.attribute.ar), cc);
+		ar = tmpl_attr_list_head(&vpt->data.attribute.ar);
+		if (ar_is_normal(ar)) da = ar->ar_da;
+
+		(void) _tmpl_cursor_pair_init(list, cc->list, ar, cc);
 		break;
 
 	default:
@@ -345,7 +355,12 @@ fr_pair_t *tmpl_dcursor_init_relative(int *err, TALLOC_CTX *ctx, tmpl_dcursor_ct
 	 *	Get the first entry from the tmpl
 	 */
 #ifndef TMPL_DCURSOR_MOD
-	vp = fr_pair_dcursor_iter_init(cursor, cc->list, _tmpl_cursor_next, cc);
+	/*
+	 *	Only pairs of the first attribute reference are
+	 *	looked at in this list.  The evaluation contexts
+	 *	create any deferred pairs they need in nested lists.
+	 */
+	vp = fr_pair_dcursor_iter_da_init(cursor, cc->list, da, _tmpl_cursor_next, cc);
 #else
 	vp = fr_dcursor_iter_mod_init(cursor, fr_pair_list_to_dlist(cc->list), _tmpl_cursor_next, NULL, cc, tmpl_dcursor_insert, tmpl_dcursor_remove, cc);
 #endif
@@ -794,6 +794,51 @@ static void test_level_3_build_invalid2(void)
 	test_end;
 }
 
+/*
+ *	Remove every child of an indexed group through the
+ *	cursor for its unspecified reference.
+ */
+static void test_level_2_unspec_remove_indexed(void)
+{
+	common_vars;
+	fr_pair_t	*group_vp, *vp;
+	int		i;
+
+	pair_append_request(&group_vp, fr_dict_attr_test_group);
+	for (i = 0; i < FR_PAIR_LIST_INDEX_THRESHOLD; i++) {
+		fr_pair_append_by_da(group_vp, &vp, &group_vp->vp_group, fr_dict_attr_test_int16);
+	}
+	fr_pair_append_by_da(group_vp, &vp, &group_vp->vp_group, fr_dict_attr_test_int32);
+
+	/*
+	 *	Looking up a pair builds the index
+	 */
+	TEST_CHECK_PAIR(fr_pair_find_by_da(&group_vp->vp_group, NULL, fr_dict_attr_test_int32), vp);
+
+	tmpl_setup_and_cursor_init(test_vp_p(), "&Test-Group-0.[*]");
+	TEST_CHECK_PAIR(test_vp(), fr_pair_list_head(&group_vp->vp_group));
+
+	/*
+	 *	The leaf evaluation context iterates over the
+	 *	group's children, and has already moved past the
+	 *	first one.
+	 */
+	fr_dcursor_head(&vars.cc.leaf.cursor);
+	while (fr_dcursor_current(&vars.cc.leaf.cursor)) talloc_free(fr_dcursor_remove(&vars.cc.leaf.cursor));
+
+	TEST_CHECK(fr_pair_list_num_elements(&group_vp->vp_group) == 0);
+	TEST_CHECK_PAIR(fr_pair_find_by_da(&group_vp->vp_group, NULL, fr_dict_attr_test_int16), NULL);
+	TEST_CHECK_PAIR(fr_pair_find_by_da(&group_vp->vp_group, NULL, fr_dict_attr_test_int32), NULL);
+
+	/*
+	 *	The outer cursor still points at a freed pair,
+	 *	so can't be advanced.
+	 */
+	tmpl_dcursor_clear(&vars.cc);
+	TEST_CHECK_RET(talloc_free(vars.vpt), 0);
+	TEST_CHECK_RET(talloc_free(request), 0);
+}
+
 TEST_LIST = {
 	{ "test_level_1_one",		test_level_1_one },
 	{ "test_level_1_one_second",	test_level_1_one_second },
@@ -821,6 +866,7 @@ TEST_LIST = {
 	{ "test_level_3_two",		test_level_3_two },
 	{ "test_level_3_two_all",	test_level_3_two_all },
 	{ "test_level_3_two_last",	test_level_3_two_last },
+	{ "test_level_2_unspec_remove_indexed",	test_level_2_unspec_remove_indexed },
 
 	{ "test_level_1_build",			test_level_1_build },
 	{ "test_level_2_build_leaf",		test_level_2_build_leaf },
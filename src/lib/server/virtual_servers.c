@@ -867,8 +867,10 @@ int virtual_server_compile_sections(CONF_SECTION *server, virtual_server_compile
 {
 	int i, found;
 	CONF_SECTION *subcs = NULL;
+	unlang_compile_stats_t start, end;
 
 	found = 0;
+	unlang_compile_stats(&start);
 
 	/*
 	 *	The sections are in trees, so this isn't as bad as it
@@ -970,6 +972,12 @@ int virtual_server_compile_sections(CONF_SECTION *server, virtual_server_compile
 		}
 	}
 
+	unlang_compile_stats(&end);
+	if (end.instructions > start.instructions) {
+		DEBUG("Virtual server %s compiled to %u instructions, optimised to %u",
+		      cf_section_name2(server), end.instructions - start.instructions, end.optimised - start.optimised);
+	}
+
 	return found;
 }
 
@@ -36,6 +36,7 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/unlang/subrequest.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/nbo.h>
 
 #include "attrs.h"
 #include "base.h"
@@ -46,6 +47,14 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
 #include <openssl/ssl.h>
 #include <openssl/kdf.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  include <openssl/core_names.h>
+#endif
+
+/** HKDF label used when deriving session ticket keys
+ */
+#define TLS_CACHE_TICKET_KEY_LABEL "freeradius-session-ticket"
 
 /** Retrieve session ID (in binary form) from the session
  *
@@ -492,13 +501,13 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	fr_pair_t		*vp;
 	SSL_SESSION		*sess = tls_session->cache->store.sess;
 	unlang_action_t		ua;
-	fr_time_t		expires = fr_time_from_sec((time_t)(SSL_SESSION_get_time(sess) + SSL_get_timeout(sess)));
-	fr_time_t		now = fr_time();
+	fr_unix_time_t		expires = fr_unix_time_from_sec(SSL_SESSION_get_time(sess) + SSL_get_timeout(sess));
+	fr_unix_time_t		now = fr_time_to_unix_time(fr_time());
 
 	fr_assert(tls_cache->store.sess);
 	fr_assert(tls_cache->store.state == FR_TLS_CACHE_STORE_REQUESTED);
 
-	if (fr_time_lteq(expires, now)) {
+	if (fr_unix_time_lteq(expires, now)) {
 		fr_value_box_t	id;
  		fr_tls_cache_id_to_box_shallow(&id, sess);
 
@@ -533,7 +542,7 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	 *	How long the session has to live
 	 */
 	MEM(pair_update_request(&vp, attr_tls_session_ttl) >= 0);
-	vp->vp_time_delta = fr_time_sub(expires, now);
+	vp->vp_time_delta = fr_unix_time_sub(expires, now);
 
 	/*
 	 *	Serialize the session
@@ -570,6 +579,22 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	}
 	fr_pair_value_memdup_buffer_shallow(vp, data, true);
 
+	/*
+	 *	Keep a copy in memory, so that resumption
+	 *	doesn't need to call the virtual server.
+	 *	The virtual server is still called, so that
+	 *	other servers sharing the external datastore
+	 *	can resume the session too.
+	 */
+	if (conf->cache.mem) {
+		unsigned int	id_len;
+		uint8_t const	*id = SSL_SESSION_get_id(sess, &id_len);
+
+		if (fr_tls_cache_mem_store(conf->cache.mem, id, id_len, data, len, expires) < 0) {
+			RWDEBUG("Session ID %pV - Session too large to store in memory", fr_box_octets(id, id_len));
+		}
+	}
+
 	/*
 	 *	Allocate a child, and set it up to call
 	 *      the TLS virtual server.
@@ -623,6 +648,10 @@ unlang_action_t tls_cache_clear_push(request_t *request, fr_tls_conf_t *conf, fr
 	fr_assert(tls_cache->clear.state == FR_TLS_CACHE_CLEAR_REQUESTED);
 	fr_assert(tls_cache->clear.id);
 
+	if (conf->cache.mem) {
+		fr_tls_cache_mem_clear(conf->cache.mem, tls_cache->clear.id, talloc_array_length(tls_cache->clear.id));
+	}
+
 	MEM(child = unlang_subrequest_alloc(request, dict_tls));
 	request = child;
 
@@ -771,10 +800,12 @@ static SSL_SESSION *tls_cache_load_cb(SSL *ssl,
 				      int key_len, int *copy)
 {
 	fr_tls_session_t	*tls_session;
+	fr_tls_conf_t		*conf;
 	fr_tls_cache_t		*tls_cache;
 	request_t		*request;
 
 	tls_session = fr_tls_session(ssl);
+	conf = fr_tls_session_conf(tls_session->ssl);
 	request = fr_tls_session_request(tls_session->ssl);
 	tls_cache = tls_session->cache;
 
@@ -807,6 +838,30 @@ again:
 	case FR_TLS_CACHE_LOAD_INIT:
 		fr_assert(!tls_cache->load.id);
 
+		/*
+		 *	Try the in-memory store first.  If the
+		 *	session is there, we can skip calling
+		 *	the virtual server entirely.
+		 */
+		if (conf->cache.mem) {
+			SSL_SESSION *sess;
+
+			sess = fr_tls_cache_mem_load(conf->cache.mem, key, key_len);
+			if (sess) {
+				RDEBUG3("Session ID %pV - Found in memory", fr_box_octets(key, key_len));
+
+				/*
+				 *	As with sessions loaded by tls_cache_load_result
+				 */
+				SSL_SESSION_set_ex_data(sess, FR_TLS_EX_INDEX_TLS_SESSION, tls_session);
+
+				tls_cache->load.state = FR_TLS_CACHE_LOAD_RETRIEVED;
+				tls_cache->load.sess = sess;
+				goto again;
+			}
+			RDEBUG3("Session ID %pV - Not found in memory", fr_box_octets(key, key_len));
+		}
+
 		tls_cache->load.state = FR_TLS_CACHE_LOAD_REQUESTED;
 		MEM(tls_cache->load.id = talloc_typed_memdup(tls_cache, (uint8_t const *)key, key_len));
 
@@ -1354,6 +1409,259 @@ static SSL_TICKET_RETURN tls_cache_session_ticket_app_data_get(SSL *ssl, SSL_SES
 	return (status == SSL_TICKET_SUCCESS_RENEW) ? SSL_TICKET_RETURN_USE_RENEW : SSL_TICKET_RETURN_USE;
 }
 
+/** Derive session ticket key material from the configured session_ticket_key
+ *
+ * @param[out] out		Where to write the key material.
+ * @param[in] out_len		How much key material to derive.
+ * @param[in] cache_conf	containing the session_ticket_key.
+ * @param[in] info		HKDF info (label).
+ * @param[in] info_len		Length of the info.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_cache_session_ticket_key_derive(uint8_t *out, size_t out_len, fr_tls_cache_conf_t const *cache_conf,
+					       uint8_t const *info, size_t info_len)
+{
+	EVP_PKEY_CTX *pkey_ctx = NULL;
+
+	if (unlikely((pkey_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL)) == NULL)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed initialising KDF");
+	kdf_error:
+		if (pkey_ctx) EVP_PKEY_CTX_free(pkey_ctx);
+		return -1;
+	}
+	if (unlikely(EVP_PKEY_derive_init(pkey_ctx) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed initialising KDF derivation ctx");
+		goto kdf_error;
+	}
+	if (unlikely(EVP_PKEY_CTX_set_hkdf_md(pkey_ctx, UNCONST(struct evp_md_st *, EVP_sha256())) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting KDF MD");
+		goto kdf_error;
+	}
+	if (unlikely(EVP_PKEY_CTX_set1_hkdf_key(pkey_ctx,
+						UNCONST(unsigned char *, cache_conf->session_ticket_key),
+						talloc_array_length(cache_conf->session_ticket_key)) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting KDF key");
+		goto kdf_error;
+	}
+	if (unlikely(EVP_PKEY_CTX_add1_hkdf_info(pkey_ctx, UNCONST(unsigned char *, info), info_len) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting KDF label");
+		goto kdf_error;
+	}
+	if (EVP_PKEY_derive(pkey_ctx, out, &out_len) != 1) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed deriving session ticket key");
+		goto kdf_error;
+	}
+	EVP_PKEY_CTX_free(pkey_ctx);
+
+	return 0;
+}
+
+/** Set a single, static, set of session ticket keys
+ *
+ * Used when session ticket keys aren't rotated.  The keys stay the
+ * same until the server is restarted.
+ *
+ * @param[in] ctx		to set the keys for.
+ * @param[in] cache_conf	containing the session_ticket_key.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_cache_session_ticket_key_set(SSL_CTX *ctx, fr_tls_cache_conf_t const *cache_conf)
+{
+	size_t	key_len;
+	uint8_t	*key_buff;
+
+	/*
+	 *	If keys is NULL, then OpenSSL returns the expected
+	 *	key length, which may be different across different
+	 *	flavours/versions of OpenSSL.
+	 *
+	 *	We could calculate this in conf.c, but, if in future
+	 *	OpenSSL decides to use different key lengths based
+	 *	on other parameters in the ctx, that'd break.
+	 */
+	key_len = SSL_CTX_set_tlsext_ticket_keys(ctx, NULL, 0);
+
+	/*
+	 *	SSL_CTX_set_tlsext_ticket_keys memcpys its
+	 *	inputs so this is just a temporary buffer.
+	 */
+	MEM(key_buff = talloc_array(NULL, uint8_t, key_len));
+	if (tls_cache_session_ticket_key_derive(key_buff, key_len, cache_conf,
+						(uint8_t const *)TLS_CACHE_TICKET_KEY_LABEL,
+						sizeof(TLS_CACHE_TICKET_KEY_LABEL) - 1) < 0) {
+		talloc_free(key_buff);
+		return -1;
+	}
+
+	/*
+	 *	Ensure the same keys are used across all threads
+	 */
+	if (SSL_CTX_set_tlsext_ticket_keys(ctx,
+					   key_buff, key_len) != 1) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting session ticket keys");
+		talloc_free(key_buff);
+		return -1;
+	}
+
+	DEBUG3("Derived session-ticket-key:");
+	HEXDUMP3(key_buff, key_len, NULL);
+	talloc_free(key_buff);
+
+	return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/** Keys for one session ticket key rotation period
+ *
+ */
+typedef struct {
+	uint8_t		name[8];			//!< Second half of the key name, the first half
+							///< being the rotation period.
+	uint8_t		hmac_key[32];			//!< HMAC-SHA256 key.
+	uint8_t		aes_key[32];			//!< AES-256-CBC key.
+} tls_cache_session_ticket_keys_t;
+
+/** Derive the session ticket keys for a rotation period
+ *
+ * @param[out] keys		Where to write the keys.
+ * @param[in] cache_conf	containing the session_ticket_key.
+ * @param[in] period		Number of rotation intervals since the epoch.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_cache_session_ticket_keys_derive(tls_cache_session_ticket_keys_t *keys,
+						fr_tls_cache_conf_t const *cache_conf, uint64_t period)
+{
+	uint8_t	info[(sizeof(TLS_CACHE_TICKET_KEY_LABEL) - 1) + sizeof(uint64_t)];
+
+	memcpy(info, TLS_CACHE_TICKET_KEY_LABEL, sizeof(TLS_CACHE_TICKET_KEY_LABEL) - 1);
+	fr_nbo_from_uint64(info + (sizeof(TLS_CACHE_TICKET_KEY_LABEL) - 1), period);
+
+	return tls_cache_session_ticket_key_derive((uint8_t *)keys, sizeof(*keys), cache_conf, info, sizeof(info));
+}
+
+/** Encrypt or decrypt session tickets using the keys for a particular point in time
+ *
+ * The key name holds the rotation period the ticket was issued in,
+ * which tells us which keys to decrypt it with.  Tickets issued in
+ * earlier periods are accepted for as long as they could still be
+ * valid, but are replaced with a ticket using the current keys.
+ *
+ * @param[in] cache_conf	containing the session_ticket_key and rotation interval.
+ * @param[in] now		Wallclock time used to pick the current rotation period.
+ * @param[in,out] key_name	Identifies the keys used for the ticket.
+ * @param[in,out] iv		IV for the ticket.
+ * @param[in] cipher_ctx	to initialise for encryption or decryption.
+ * @param[in] mac_ctx		to set the HMAC key for.
+ * @param[in] enc		1 if a ticket is being issued, 0 if one is being decrypted.
+ * @return
+ *	- 2 if the ticket was decrypted, but should be replaced.
+ *	- 1 on success.
+ *	- 0 if the ticket's keys are unknown.
+ *	- -1 on error.
+ */
+static int tls_cache_session_ticket_key_process(fr_tls_cache_conf_t const *cache_conf, fr_unix_time_t now,
+						unsigned char key_name[16], unsigned char iv[EVP_MAX_IV_LENGTH],
+						EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx, int enc)
+{
+	tls_cache_session_ticket_keys_t	keys;
+	uint64_t			interval, current, period, max_age;
+	int				ret = -1;
+	OSSL_PARAM			params[] = {
+						OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+										  keys.hmac_key, sizeof(keys.hmac_key)),
+						OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+										 UNCONST(char *, "SHA256"), 0),
+						OSSL_PARAM_construct_end()
+					};
+
+	interval = fr_time_delta_to_sec(cache_conf->session_ticket_key_rotation);
+	current = fr_unix_time_to_sec(now) / interval;
+
+	if (enc) {
+		if (tls_cache_session_ticket_keys_derive(&keys, cache_conf, current) < 0) goto done;
+
+		fr_nbo_from_uint64(key_name, current);
+		memcpy(key_name + sizeof(uint64_t), keys.name, sizeof(keys.name));
+
+		if ((RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1) ||
+		    (EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, keys.aes_key, iv) != 1) ||
+		    (EVP_MAC_CTX_set_params(mac_ctx, params) != 1)) {
+			fr_tls_strerror_printf(NULL);
+			PERROR("Failed initialising session ticket encryption");
+			goto done;
+		}
+
+		ret = 1;
+		goto done;
+	}
+
+	/*
+	 *	Tickets may be used for "lifetime" after they're
+	 *	issued, so accept tickets from as many periods ago
+	 *	as that could span.  Allow one period ahead, in
+	 *	case another server's clock is slightly fast.
+	 */
+	period = fr_nbo_to_uint64(key_name);
+	max_age = (fr_time_delta_to_sec(cache_conf->lifetime) / interval) + 1;
+	if ((period > (current + 1)) || ((current > period) && ((current - period) > max_age))) {
+		ret = 0;
+		goto done;
+	}
+
+	if (tls_cache_session_ticket_keys_derive(&keys, cache_conf, period) < 0) goto done;
+
+	if (memcmp(key_name + sizeof(uint64_t), keys.name, sizeof(keys.name)) != 0) {
+		ret = 0;
+		goto done;
+	}
+
+	if ((EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, keys.aes_key, iv) != 1) ||
+	    (EVP_MAC_CTX_set_params(mac_ctx, params) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed initialising session ticket decryption");
+		goto done;
+	}
+
+	ret = (period == current) ? 1 : 2;
+
+done:
+	OPENSSL_cleanse(&keys, sizeof(keys));
+
+	return ret;
+}
+
+/** Encrypt or decrypt session tickets with keys which change every session_ticket_key_rotation
+ *
+ * @param[in] ssl		The current OpenSSL session.
+ * @param[in,out] key_name	Identifies the keys used for the ticket.
+ * @param[in,out] iv		IV for the ticket.
+ * @param[in] cipher_ctx	to initialise for encryption or decryption.
+ * @param[in] mac_ctx		to set the HMAC key for.
+ * @param[in] enc		1 if a ticket is being issued, 0 if one is being decrypted.
+ * @return See #tls_cache_session_ticket_key_process.
+ */
+static int tls_cache_session_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char iv[EVP_MAX_IV_LENGTH],
+					   EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx, int enc)
+{
+	return tls_cache_session_ticket_key_process(&fr_tls_session_conf(ssl)->cache,
+						    fr_time_to_unix_time(fr_time()),
+						    key_name, iv, cipher_ctx, mac_ctx, enc);
+}
+#endif
+
 /** Sets callbacks and flags on a SSL_CTX to enable/disable session resumption
  *
  * @param[in] ctx			to modify.
@@ -1403,85 +1711,28 @@ int fr_tls_cache_ctx_init(SSL_CTX *ctx, fr_tls_cache_conf_t const *cache_conf)
 		FALL_THROUGH;
 
 	case FR_TLS_CACHE_STATELESS:
-	{
-		size_t key_len;
-		uint8_t *key_buff;
-		EVP_PKEY_CTX *pkey_ctx = NULL;
-
 		if (!(cache_conf->mode & FR_TLS_CACHE_STATEFUL)) tls_cache_disable_statefull_resumption(ctx);
 
 		/*
-		 *	If keys is NULL, then OpenSSL returns the expected
-		 *	key length, which may be different across different
-		 *	flavours/versions of OpenSSL.
+		 *	Rotated keys are derived from the session_ticket_key
+		 *	and the time, so every SSL_CTX, and every server
+		 *	sharing the session_ticket_key, agrees on the keys
+		 *	without any coordination.
 		 *
-		 *	We could calculate this in conf.c, but, if in future
-		 *	OpenSSL decides to use different key lengths based
-		 *	on other parameters in the ctx, that'd break.
+		 *	conf.c disables rotation for OpenSSL < 3.0.
 		 */
-		key_len = SSL_CTX_set_tlsext_ticket_keys(ctx, NULL, 0);
-
-		if (unlikely((pkey_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL)) == NULL)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed initialising KDF");
-		kdf_error:
-			if (pkey_ctx) EVP_PKEY_CTX_free(pkey_ctx);
-			return -1;
-		}
-		if (unlikely(EVP_PKEY_derive_init(pkey_ctx) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed initialising KDF derivation ctx");
-			goto kdf_error;
-		}
-		if (unlikely(EVP_PKEY_CTX_set_hkdf_md(pkey_ctx, UNCONST(struct evp_md_st *, EVP_sha256())) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting KDF MD");
-			goto kdf_error;
-		}
-		if (unlikely(EVP_PKEY_CTX_set1_hkdf_key(pkey_ctx,
-							UNCONST(unsigned char *, cache_conf->session_ticket_key),
-							talloc_array_length(cache_conf->session_ticket_key)) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting KDF key");
-			goto kdf_error;
-		}
-		if (unlikely(EVP_PKEY_CTX_add1_hkdf_info(pkey_ctx,
-							 UNCONST(unsigned char *, "freeradius-session-ticket"),
-							 sizeof("freeradius-session-ticket") - 1) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting KDF label");
-			goto kdf_error;
-		}
-
-		/*
-		 *	SSL_CTX_set_tlsext_ticket_keys memcpys its
-		 *	inputs so this is just a temporary buffer.
-		 */
-		MEM(key_buff = talloc_array(NULL, uint8_t, key_len));
-		if (EVP_PKEY_derive(pkey_ctx, key_buff, &key_len) != 1) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed deriving session ticket key");
-
-			talloc_free(key_buff);
-			goto kdf_error;
-		}
-		EVP_PKEY_CTX_free(pkey_ctx);
-
-		fr_assert(talloc_array_length(key_buff) == key_len);
-		/*
-		 *	Ensure the same keys are used across all threads
-		 */
-		if (SSL_CTX_set_tlsext_ticket_keys(ctx,
-						   key_buff, key_len) != 1) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting session ticket keys");
+		if (fr_time_delta_ispos(cache_conf->session_ticket_key_rotation)) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			if (unlikely(SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, tls_cache_session_ticket_key_cb) != 1)) {
+				fr_tls_strerror_printf(NULL);
+				PERROR("Failed setting session ticket key callback");
+				return -1;
+			}
+#endif
+		} else if (tls_cache_session_ticket_key_set(ctx, cache_conf) < 0) {
 			return -1;
 		}
 
-		DEBUG3("Derived session-ticket-key:");
-		HEXDUMP3(key_buff, key_len, NULL);
-		talloc_free(key_buff);
-
 		/*
 		 *	These callbacks embed and extract the
 		 *	session-state list from the session-ticket.
@@ -1504,7 +1755,6 @@ int fr_tls_cache_ctx_init(SSL_CTX *ctx, fr_tls_cache_conf_t const *cache_conf)
 #if OPENSSL_VERSION_NUMBER >= 0x10101000L
 		SSL_CTX_set_num_tickets(ctx, 1);
 #endif
-	}
 		break;
 	}
 
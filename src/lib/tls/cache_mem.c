@@ -0,0 +1,291 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/cache_mem.c
+ * @brief In-memory store for stateful session-resumption data, shared by all threads.
+ *
+ * Sessions are spread over a number of shards by the hash of their ID.
+ * Each shard has its own mutex, hash table, and LRU list, so workers
+ * resuming different sessions rarely contend.  Each shard gets an equal
+ * part of the overall byte budget, and evicts its least recently used
+ * sessions when a new one would exceed it.
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls"
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <pthread.h>
+
+#include "cache_mem.h"
+
+/** Serialised session
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the shard's LRU list.
+	fr_unix_time_t		expires;		//!< When the session can no longer be resumed (wallclock).
+	size_t			size;			//!< How much this entry counts against the budget.
+
+	uint8_t const		*id;			//!< Session ID.
+	size_t			id_len;			//!< Length of the session ID.
+
+	uint8_t const		*data;			//!< DER encoded session.
+	size_t			data_len;		//!< Length of the DER encoded session.
+
+	uint8_t			buff[];			//!< Holds the ID, followed by the session.
+} tls_cache_mem_entry_t;
+
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+	fr_hash_table_t		*ht;			//!< Entries by session ID.
+	fr_dlist_head_t		lru;			//!< Most recently used at the head.
+	size_t			size;			//!< Bytes used by the entries.
+	size_t			max_size;		//!< Bytes the entries may use.
+} tls_cache_mem_shard_t;
+
+struct fr_tls_cache_mem_s {
+	uint32_t		num_shards;		//!< How many shards there are.
+	tls_cache_mem_shard_t	**shards;		//!< Array of shards.
+};
+
+static uint32_t tls_cache_mem_entry_hash(void const *data)
+{
+	tls_cache_mem_entry_t const *e = data;
+
+	return fr_hash(e->id, e->id_len);
+}
+
+static int8_t tls_cache_mem_entry_cmp(void const *one, void const *two)
+{
+	tls_cache_mem_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->id_len, b->id_len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->id, b->id, a->id_len);
+	return CMP(ret, 0);
+}
+
+/** Pick the shard for a session ID
+ *
+ * The hash tables use the low bits of the hash, so the shard is
+ * picked with the high bits.  Otherwise every entry in a shard
+ * would land in the same few buckets.
+ */
+static inline CC_HINT(always_inline)
+tls_cache_mem_shard_t *tls_cache_mem_shard(fr_tls_cache_mem_t *mem, uint8_t const *id, size_t id_len)
+{
+	return mem->shards[(fr_hash(id, id_len) >> 16) % mem->num_shards];
+}
+
+/** Unlink an entry from its shard and free it
+ *
+ * The shard must be locked.
+ */
+static void tls_cache_mem_entry_free(tls_cache_mem_shard_t *shard, tls_cache_mem_entry_t *e)
+{
+	fr_hash_table_remove(shard->ht, e);
+	fr_dlist_remove(&shard->lru, e);
+	shard->size -= e->size;
+	talloc_free(e);
+}
+
+static int _tls_cache_mem_shard_free(tls_cache_mem_shard_t *shard)
+{
+	pthread_mutex_destroy(&shard->mutex);
+	return 0;
+}
+
+/** Allocate an in-memory session store
+ *
+ * @param[in] ctx		to allocate the store in.  The store must not
+ *				be allocated in memory which is later made read-only.
+ * @param[in] max_size		Maximum number of bytes of sessions to hold.
+ * @param[in] num_shards	How many shards to split the store into.
+ * @return
+ *	- A new store on success.
+ *	- NULL on failure.
+ */
+fr_tls_cache_mem_t *fr_tls_cache_mem_alloc(TALLOC_CTX *ctx, size_t max_size, uint32_t num_shards)
+{
+	fr_tls_cache_mem_t	*mem;
+	uint32_t		i;
+
+	fr_assert(num_shards > 0);
+
+	MEM(mem = talloc_zero(ctx, fr_tls_cache_mem_t));
+	mem->num_shards = num_shards;
+	MEM(mem->shards = talloc_array(mem, tls_cache_mem_shard_t *, num_shards));
+
+	for (i = 0; i < num_shards; i++) {
+		tls_cache_mem_shard_t	*shard;
+		int			ret;
+
+		MEM(shard = talloc_zero(mem->shards, tls_cache_mem_shard_t));
+		if ((ret = pthread_mutex_init(&shard->mutex, NULL)) != 0) {
+			fr_strerror_printf("Failed initialising mutex: %s", fr_syserror(ret));
+			talloc_free(shard);
+			talloc_free(mem);
+			return NULL;
+		}
+		talloc_set_destructor(shard, _tls_cache_mem_shard_free);
+
+		shard->max_size = max_size / num_shards;
+		fr_dlist_talloc_init(&shard->lru, tls_cache_mem_entry_t, entry);
+		MEM(shard->ht = fr_hash_table_alloc(shard, tls_cache_mem_entry_hash, tls_cache_mem_entry_cmp, NULL));
+
+		mem->shards[i] = shard;
+	}
+
+	return mem;
+}
+
+/** Add a session to the store, replacing any existing session with the same ID
+ *
+ * @param[in] mem		to add the session to.
+ * @param[in] id		Session ID.
+ * @param[in] id_len		Length of the session ID.
+ * @param[in] data		DER encoded session, as produced by i2d_SSL_SESSION.
+ * @param[in] data_len		Length of the encoded session.
+ * @param[in] expires		When the session can no longer be resumed, as wallclock
+ *				time, like the session's own timestamps.
+ * @return
+ *	- 0 if the session was added.
+ *	- -1 if the session was too large to fit in the store.
+ */
+int fr_tls_cache_mem_store(fr_tls_cache_mem_t *mem,
+			   uint8_t const *id, size_t id_len,
+			   uint8_t const *data, size_t data_len, fr_unix_time_t expires)
+{
+	tls_cache_mem_shard_t	*shard = tls_cache_mem_shard(mem, id, id_len);
+	tls_cache_mem_entry_t	find = { .id = id, .id_len = id_len }, *e, *old;
+	size_t			size = sizeof(*e) + id_len + data_len;
+
+	if (size > shard->max_size) return -1;
+
+	pthread_mutex_lock(&shard->mutex);
+
+	old = fr_hash_table_find(shard->ht, &find);
+	if (old) tls_cache_mem_entry_free(shard, old);
+
+	/*
+	 *	Evict the least recently used sessions
+	 *	until the new one fits.
+	 */
+	while ((shard->size + size) > shard->max_size) {
+		e = fr_dlist_tail(&shard->lru);
+		if (!fr_cond_assert(e)) break;
+		tls_cache_mem_entry_free(shard, e);
+	}
+
+	MEM(e = talloc_zero_size(shard, size));
+	talloc_set_type(e, tls_cache_mem_entry_t);
+
+	memcpy(e->buff, id, id_len);
+	memcpy(e->buff + id_len, data, data_len);
+	e->id = e->buff;
+	e->id_len = id_len;
+	e->data = e->buff + id_len;
+	e->data_len = data_len;
+	e->expires = expires;
+	e->size = size;
+
+	if (!fr_hash_table_insert(shard->ht, e)) {
+		talloc_free(e);
+		pthread_mutex_unlock(&shard->mutex);
+		return -1;
+	}
+	fr_dlist_insert_head(&shard->lru, e);
+	shard->size += size;
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	return 0;
+}
+
+/** Retrieve a session from the store
+ *
+ * Expired sessions are removed, and not returned.
+ *
+ * @param[in] mem		to retrieve the session from.
+ * @param[in] id		Session ID.
+ * @param[in] id_len		Length of the session ID.
+ * @return
+ *	- A deserialised session on success.  The caller must free it with SSL_SESSION_free.
+ *	- NULL if no unexpired session was found.
+ */
+SSL_SESSION *fr_tls_cache_mem_load(fr_tls_cache_mem_t *mem, uint8_t const *id, size_t id_len)
+{
+	tls_cache_mem_shard_t	*shard = tls_cache_mem_shard(mem, id, id_len);
+	tls_cache_mem_entry_t	find = { .id = id, .id_len = id_len }, *e;
+	SSL_SESSION		*sess = NULL;
+	uint8_t const		*p;
+
+	pthread_mutex_lock(&shard->mutex);
+
+	e = fr_hash_table_find(shard->ht, &find);
+	if (!e) goto done;
+
+	if (fr_unix_time_lteq(e->expires, fr_time_to_unix_time(fr_time()))) {
+		tls_cache_mem_entry_free(shard, e);
+		goto done;
+	}
+
+	fr_dlist_remove(&shard->lru, e);
+	fr_dlist_insert_head(&shard->lru, e);
+
+	p = e->data;	/* openssl mutates p */
+	sess = d2i_SSL_SESSION(NULL, &p, e->data_len);
+
+done:
+	pthread_mutex_unlock(&shard->mutex);
+
+	return sess;
+}
+
+/** Remove a session from the store
+ *
+ * @param[in] mem		to remove the session from.
+ * @param[in] id		Session ID.
+ * @param[in] id_len		Length of the session ID.
+ */
+void fr_tls_cache_mem_clear(fr_tls_cache_mem_t *mem, uint8_t const *id, size_t id_len)
+{
+	tls_cache_mem_shard_t	*shard = tls_cache_mem_shard(mem, id, id_len);
+	tls_cache_mem_entry_t	find = { .id = id, .id_len = id_len }, *e;
+
+	pthread_mutex_lock(&shard->mutex);
+
+	e = fr_hash_table_find(shard->ht, &find);
+	if (e) tls_cache_mem_entry_free(shard, e);
+
+	pthread_mutex_unlock(&shard->mutex);
+}
+#endif /* WITH_TLS */
@@ -0,0 +1,57 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifdef WITH_TLS
+/**
+ * $Id$
+ *
+ * @file lib/tls/cache_mem.h
+ * @brief In-memory store for stateful session-resumption data, shared by all threads.
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSIDH(cache_mem_h, "$Id$")
+
+#include "openssl_user_macros.h"
+
+#include <openssl/ssl.h>
+
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_tls_cache_mem_s fr_tls_cache_mem_t;
+
+fr_tls_cache_mem_t	*fr_tls_cache_mem_alloc(TALLOC_CTX *ctx, size_t max_size, uint32_t num_shards);
+
+int			fr_tls_cache_mem_store(fr_tls_cache_mem_t *mem,
+					       uint8_t const *id, size_t id_len,
+					       uint8_t const *data, size_t data_len, fr_unix_time_t expires)
+					       CC_HINT(nonnull);
+
+SSL_SESSION		*fr_tls_cache_mem_load(fr_tls_cache_mem_t *mem, uint8_t const *id, size_t id_len)
+					       CC_HINT(nonnull);
+
+void			fr_tls_cache_mem_clear(fr_tls_cache_mem_t *mem, uint8_t const *id, size_t id_len)
+					       CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* WITH_TLS */
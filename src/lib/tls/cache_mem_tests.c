@@ -0,0 +1,412 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the in-memory TLS session store
+ *
+ * @file src/lib/tls/cache_mem_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/nbo.h>
+
+#include "cache_mem.c"
+
+#define SESSION_ID_LEN		32
+
+static TALLOC_CTX		*autofree;
+static SSL_CTX			*ssl_ctx;
+static SSL_CIPHER const		*cipher;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	SSL	*ssl;
+
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("cache_mem_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_time_start() < 0) goto error;
+
+	/*
+	 *	Sessions can't be encoded without a cipher,
+	 *	and ciphers can only be looked up with an SSL.
+	 */
+	ssl_ctx = SSL_CTX_new(TLS_method());
+	if (!ssl_ctx) goto error;
+
+	ssl = SSL_new(ssl_ctx);
+	if (!ssl) goto error;
+
+	cipher = SSL_CIPHER_find(ssl, (uint8_t const[]){ 0x13, 0x01 });	/* TLS_AES_128_GCM_SHA256 */
+	SSL_free(ssl);
+	if (!cipher) goto error;
+}
+
+static void session_id(uint8_t id[SESSION_ID_LEN], uint32_t i)
+{
+	memset(id, 0, SESSION_ID_LEN);
+	fr_nbo_from_uint32(id, i);
+}
+
+/** Produce a DER encoded session, as tls_cache_store_push does
+ */
+static uint8_t *session_encode(TALLOC_CTX *ctx, size_t *len, uint8_t const id[SESSION_ID_LEN])
+{
+	SSL_SESSION	*sess;
+	uint8_t		*data, *p;
+	int		ret;
+
+	sess = SSL_SESSION_new();
+	TEST_ASSERT(sess != NULL);
+
+	TEST_ASSERT(SSL_SESSION_set_protocol_version(sess, TLS1_3_VERSION) == 1);
+	TEST_ASSERT(SSL_SESSION_set_cipher(sess, cipher) == 1);
+	TEST_ASSERT(SSL_SESSION_set1_id(sess, id, SESSION_ID_LEN) == 1);
+
+	ret = i2d_SSL_SESSION(sess, NULL);
+	TEST_ASSERT(ret > 0);
+
+	data = p = talloc_array(ctx, uint8_t, ret);
+	i2d_SSL_SESSION(sess, &p);
+	SSL_SESSION_free(sess);
+
+	*len = ret;
+	return data;
+}
+
+static int session_store(fr_tls_cache_mem_t *mem, uint8_t const id[SESSION_ID_LEN], fr_unix_time_t expires)
+{
+	uint8_t		*data;
+	size_t		len;
+	int		ret;
+
+	data = session_encode(NULL, &len, id);
+	ret = fr_tls_cache_mem_store(mem, id, SESSION_ID_LEN, data, len, expires);
+	talloc_free(data);
+
+	return ret;
+}
+
+/** Check a session can be loaded, and that it's the one we asked for
+ */
+static bool session_found(fr_tls_cache_mem_t *mem, uint8_t const id[SESSION_ID_LEN])
+{
+	SSL_SESSION	*sess;
+	uint8_t const	*found;
+	unsigned int	found_len;
+	bool		ret;
+
+	sess = fr_tls_cache_mem_load(mem, id, SESSION_ID_LEN);
+	if (!sess) return false;
+
+	found = SSL_SESSION_get_id(sess, &found_len);
+	ret = (found_len == SESSION_ID_LEN) && (memcmp(found, id, SESSION_ID_LEN) == 0);
+	SSL_SESSION_free(sess);
+
+	return ret;
+}
+
+static fr_unix_time_t wallclock_in(fr_time_delta_t delta)
+{
+	return fr_unix_time_add(fr_time_to_unix_time(fr_time()), delta);
+}
+
+static size_t cache_mem_used(fr_tls_cache_mem_t *mem)
+{
+	size_t		used = 0;
+	uint32_t	i;
+
+	for (i = 0; i < mem->num_shards; i++) used += mem->shards[i]->size;
+
+	return used;
+}
+
+/** Store, load, replace and clear sessions
+ */
+static void test_cache_mem_insert_lookup(void)
+{
+	fr_tls_cache_mem_t	*mem;
+	uint8_t			id[SESSION_ID_LEN];
+	uint32_t		i, used_shards = 0;
+	size_t			used;
+	fr_unix_time_t		expires = wallclock_in(fr_time_delta_from_sec(3600));
+
+	mem = fr_tls_cache_mem_alloc(autofree, 1024 * 1024, 4);
+	TEST_ASSERT(mem != NULL);
+
+	for (i = 0; i < 100; i++) {
+		session_id(id, i);
+		TEST_CHECK_RET(session_store(mem, id, expires), 0);
+	}
+
+	/*
+	 *	Every session should be retrievable, and spread
+	 *	over more than one shard.
+	 */
+	for (i = 0; i < 100; i++) {
+		session_id(id, i);
+		TEST_CHECK(session_found(mem, id));
+		TEST_MSG("Session %u not found", i);
+	}
+
+	for (i = 0; i < mem->num_shards; i++) if (fr_hash_table_num_elements(mem->shards[i]->ht) > 0) used_shards++;
+	TEST_CHECK(used_shards > 1);
+	TEST_MSG("Expected sessions in more than one shard, got %u", used_shards);
+
+	session_id(id, 100);
+	TEST_CHECK(!session_found(mem, id));
+
+	/*
+	 *	Storing the same ID again replaces the
+	 *	existing session, it doesn't add another.
+	 */
+	used = cache_mem_used(mem);
+	session_id(id, 42);
+	TEST_CHECK_RET(session_store(mem, id, expires), 0);
+	TEST_CHECK_LEN(cache_mem_used(mem), used);
+	TEST_CHECK(session_found(mem, id));
+
+	fr_tls_cache_mem_clear(mem, id, SESSION_ID_LEN);
+	TEST_CHECK(!session_found(mem, id));
+	TEST_CHECK(cache_mem_used(mem) < used);
+
+	/*
+	 *	Clearing an unknown session is a noop
+	 */
+	fr_tls_cache_mem_clear(mem, id, SESSION_ID_LEN);
+
+	session_id(id, 41);
+	TEST_CHECK(session_found(mem, id));
+
+	talloc_free(mem);
+}
+
+/** Sessions expire against wallclock time, like the session's own timestamps
+ */
+static void test_cache_mem_expiry(void)
+{
+	fr_tls_cache_mem_t	*mem;
+	tls_cache_mem_shard_t	*shard;
+	uint8_t			id[SESSION_ID_LEN];
+
+	mem = fr_tls_cache_mem_alloc(autofree, 1024 * 1024, 4);
+	TEST_ASSERT(mem != NULL);
+
+	session_id(id, 1);
+	shard = tls_cache_mem_shard(mem, id, SESSION_ID_LEN);
+
+	TEST_CHECK_RET(session_store(mem, id, wallclock_in(fr_time_delta_from_sec(3600))), 0);
+	TEST_CHECK(session_found(mem, id));
+
+	/*
+	 *	A minute ago, as wallclock time, is still far
+	 *	larger than the server's monotonic time.
+	 *	Comparing against the wrong clock would make
+	 *	this session look valid.
+	 */
+	TEST_CHECK_RET(session_store(mem, id, wallclock_in(fr_time_delta_from_sec(-60))), 0);
+	TEST_CHECK(!session_found(mem, id));
+
+	/*
+	 *	Expired sessions are removed when they're found
+	 */
+	TEST_CHECK_RET(fr_hash_table_num_elements(shard->ht), 0);
+	TEST_CHECK_LEN(shard->size, 0);
+	TEST_CHECK_LEN(fr_dlist_num_elements(&shard->lru), 0);
+
+	/*
+	 *	...and sessions that were valid when they
+	 *	were stored expire as time passes.
+	 */
+	TEST_CHECK_RET(session_store(mem, id, wallclock_in(fr_time_delta_from_sec(1))), 0);
+	TEST_CHECK(session_found(mem, id));
+
+	TEST_CHECK_RET(nanosleep(&(struct timespec){ .tv_sec = 1, .tv_nsec = 100000000 }, NULL), 0);
+	TEST_CHECK(!session_found(mem, id));
+	TEST_CHECK_LEN(shard->size, 0);
+
+	talloc_free(mem);
+}
+
+/** Each shard evicts its own least recently used sessions
+ */
+static void test_cache_mem_shard_eviction(void)
+{
+	fr_tls_cache_mem_t	*mem;
+	tls_cache_mem_shard_t	*shard;
+	uint8_t			ids[6][SESSION_ID_LEN], other[SESSION_ID_LEN], id[SESSION_ID_LEN];
+	uint8_t			*data;
+	size_t			len, entry_size;
+	uint32_t		i, found = 0;
+	bool			have_other = false;
+	fr_unix_time_t		expires = wallclock_in(fr_time_delta_from_sec(3600));
+
+	/*
+	 *	All sessions encode to the same length,
+	 *	so each shard can hold exactly four.
+	 */
+	session_id(id, 0);
+	data = session_encode(NULL, &len, id);
+	talloc_free(data);
+	entry_size = sizeof(tls_cache_mem_entry_t) + SESSION_ID_LEN + len;
+
+	mem = fr_tls_cache_mem_alloc(autofree, entry_size * 4 * 4, 4);
+	TEST_ASSERT(mem != NULL);
+	shard = mem->shards[0];
+
+	/*
+	 *	Find six sessions which land in the first
+	 *	shard, and one which lands in another.
+	 */
+	for (i = 0; (found < NUM_ELEMENTS(ids)) || !have_other; i++) {
+		session_id(id, i);
+		if (tls_cache_mem_shard(mem, id, SESSION_ID_LEN) == shard) {
+			if (found < NUM_ELEMENTS(ids)) memcpy(ids[found++], id, SESSION_ID_LEN);
+		} else if (!have_other) {
+			memcpy(other, id, SESSION_ID_LEN);
+			have_other = true;
+		}
+	}
+
+	TEST_CHECK_RET(session_store(mem, other, expires), 0);
+	for (i = 0; i < 4; i++) TEST_CHECK_RET(session_store(mem, ids[i], expires), 0);
+	TEST_CHECK_LEN(shard->size, shard->max_size);
+
+	/*
+	 *	Using the oldest session makes the second
+	 *	oldest the one to go.
+	 */
+	TEST_CHECK(session_found(mem, ids[0]));
+
+	TEST_CHECK_RET(session_store(mem, ids[4], expires), 0);
+	TEST_CHECK(shard->size <= shard->max_size);
+	TEST_CHECK(!session_found(mem, ids[1]));
+	TEST_MSG("Least recently used session wasn't evicted");
+
+	/*
+	 *	LRU order is now 4, 0, 3, 2.  Using 2 leaves
+	 *	3 as the least recently used.
+	 */
+	TEST_CHECK(session_found(mem, ids[2]));
+
+	TEST_CHECK_RET(session_store(mem, ids[5], expires), 0);
+	TEST_CHECK(!session_found(mem, ids[3]));
+	TEST_CHECK(session_found(mem, ids[0]));
+	TEST_CHECK(session_found(mem, ids[2]));
+	TEST_CHECK(session_found(mem, ids[4]));
+	TEST_CHECK(session_found(mem, ids[5]));
+	TEST_CHECK_RET(fr_hash_table_num_elements(shard->ht), 4);
+
+	/*
+	 *	Other shards have their own budget, and
+	 *	aren't affected.
+	 */
+	TEST_CHECK(session_found(mem, other));
+
+	/*
+	 *	Sessions larger than a shard's budget are refused
+	 *	without evicting anything.
+	 */
+	data = talloc_zero_array(NULL, uint8_t, shard->max_size);
+	TEST_CHECK_RET(fr_tls_cache_mem_store(mem, ids[1], SESSION_ID_LEN, data, shard->max_size, expires), -1);
+	talloc_free(data);
+	TEST_CHECK_RET(fr_hash_table_num_elements(shard->ht), 4);
+
+	talloc_free(mem);
+}
+
+#define THREAD_COUNT		8
+#define THREAD_SESSIONS		256
+
+typedef struct {
+	fr_tls_cache_mem_t	*mem;
+	uint32_t		base;
+	uint32_t		missing;
+} cache_mem_thread_t;
+
+static void *cache_mem_thread(void *arg)
+{
+	cache_mem_thread_t	*t = arg;
+	fr_unix_time_t		expires = wallclock_in(fr_time_delta_from_sec(3600));
+	uint8_t			id[SESSION_ID_LEN];
+	uint32_t		i;
+
+	for (i = 0; i < THREAD_SESSIONS; i++) {
+		session_id(id, t->base + i);
+		if (session_store(t->mem, id, expires) < 0) t->missing++;
+		if (!session_found(t->mem, id)) t->missing++;
+	}
+
+	for (i = 0; i < THREAD_SESSIONS; i += 2) {
+		session_id(id, t->base + i);
+		fr_tls_cache_mem_clear(t->mem, id, SESSION_ID_LEN);
+	}
+
+	return NULL;
+}
+
+/** Workers sharing the store don't lose each other's sessions
+ */
+static void test_cache_mem_threads(void)
+{
+	fr_tls_cache_mem_t	*mem;
+	cache_mem_thread_t	threads[THREAD_COUNT];
+	pthread_t		tids[THREAD_COUNT];
+	uint8_t			id[SESSION_ID_LEN];
+	uint32_t		i, j;
+
+	mem = fr_tls_cache_mem_alloc(autofree, 16 * 1024 * 1024, 8);
+	TEST_ASSERT(mem != NULL);
+
+	for (i = 0; i < THREAD_COUNT; i++) {
+		threads[i] = (cache_mem_thread_t){ .mem = mem, .base = i * THREAD_SESSIONS };
+		TEST_ASSERT(pthread_create(&tids[i], NULL, cache_mem_thread, &threads[i]) == 0);
+	}
+
+	for (i = 0; i < THREAD_COUNT; i++) {
+		pthread_join(tids[i], NULL);
+		TEST_CHECK_RET(threads[i].missing, 0);
+	}
+
+	for (i = 0; i < THREAD_COUNT; i++) {
+		for (j = 0; j < THREAD_SESSIONS; j++) {
+			session_id(id, (i * THREAD_SESSIONS) + j);
+			TEST_CHECK(session_found(mem, id) == ((j % 2) == 1));
+			TEST_MSG("Session %u in wrong state", (i * THREAD_SESSIONS) + j);
+		}
+	}
+
+	talloc_free(mem);
+}
+
+TEST_LIST = {
+	{ "cache_mem_insert_lookup",			test_cache_mem_insert_lookup },
+	{ "cache_mem_expiry",				test_cache_mem_expiry },
+	{ "cache_mem_shard_eviction",			test_cache_mem_shard_eviction },
+	{ "cache_mem_threads",				test_cache_mem_threads },
+
+	{ NULL }
+};
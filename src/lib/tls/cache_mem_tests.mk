@@ -0,0 +1,11 @@
+ifneq ($(OPENSSL_LIBS),)
+TARGET		:= cache_mem_tests$(E)
+endif
+
+SOURCES		:= cache_mem_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(OPENSSL_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(OPENSSL_FLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L)
+
+TGT_INSTALLDIR	:=
@@ -0,0 +1,281 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for session ticket key rotation
+ *
+ * @file src/lib/tls/cache_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "cache.c"
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#define ROTATION		3600
+#define LIFETIME		(2 * ROTATION)
+
+/*
+ *	An arbitrary wallclock time, at the start of a rotation period.
+ */
+#define EPOCH			(1700000000 - (1700000000 % ROTATION))
+
+static TALLOC_CTX		*autofree;
+static EVP_MAC			*hmac;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("cache_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	hmac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+	if (!hmac) goto error;
+}
+
+/** A ticket, sealed the way OpenSSL seals them once the key callback has run
+ */
+typedef struct {
+	unsigned char		key_name[16];
+	unsigned char		iv[EVP_MAX_IV_LENGTH];
+	uint8_t			data[64];
+	int			data_len;
+	uint8_t			mac[EVP_MAX_MD_SIZE];
+	size_t			mac_len;
+} test_ticket_t;
+
+static uint8_t const		ticket_state[] = "resumption secret and session parameters";
+
+static fr_tls_cache_conf_t *cache_conf_alloc(TALLOC_CTX *ctx, char const *key)
+{
+	fr_tls_cache_conf_t *cache_conf;
+
+	MEM(cache_conf = talloc_zero(ctx, fr_tls_cache_conf_t));
+	MEM(cache_conf->session_ticket_key = talloc_memdup(cache_conf, key, strlen(key)));
+	cache_conf->session_ticket_key_rotation = fr_time_delta_from_sec(ROTATION);
+	cache_conf->lifetime = fr_time_delta_from_sec(LIFETIME);
+
+	return cache_conf;
+}
+
+static fr_unix_time_t at(int64_t offset)
+{
+	return fr_unix_time_from_sec(EPOCH + offset);
+}
+
+/** Issue a ticket at a particular time
+ */
+static void ticket_seal(test_ticket_t *ticket, fr_tls_cache_conf_t const *cache_conf, fr_unix_time_t now)
+{
+	EVP_CIPHER_CTX	*cipher_ctx;
+	EVP_MAC_CTX	*mac_ctx;
+	int		len;
+
+	*ticket = (test_ticket_t){};
+
+	MEM(cipher_ctx = EVP_CIPHER_CTX_new());
+	MEM(mac_ctx = EVP_MAC_CTX_new(hmac));
+
+	TEST_CHECK_RET(tls_cache_session_ticket_key_process(cache_conf, now, ticket->key_name, ticket->iv,
+							    cipher_ctx, mac_ctx, 1), 1);
+
+	TEST_CHECK(EVP_EncryptUpdate(cipher_ctx, ticket->data, &len, ticket_state, sizeof(ticket_state)) == 1);
+	ticket->data_len = len;
+	TEST_CHECK(EVP_EncryptFinal_ex(cipher_ctx, ticket->data + ticket->data_len, &len) == 1);
+	ticket->data_len += len;
+
+	TEST_CHECK(EVP_MAC_init(mac_ctx, NULL, 0, NULL) == 1);
+	TEST_CHECK(EVP_MAC_update(mac_ctx, ticket->data, ticket->data_len) == 1);
+	TEST_CHECK(EVP_MAC_final(mac_ctx, ticket->mac, &ticket->mac_len, sizeof(ticket->mac)) == 1);
+
+	EVP_MAC_CTX_free(mac_ctx);
+	EVP_CIPHER_CTX_free(cipher_ctx);
+}
+
+/** Present a ticket at a particular time
+ *
+ * @return the key callback's result.  If the ticket was accepted, its
+ *	MAC and contents are checked too.
+ */
+static int ticket_open(test_ticket_t *ticket, fr_tls_cache_conf_t const *cache_conf, fr_unix_time_t now)
+{
+	EVP_CIPHER_CTX	*cipher_ctx;
+	EVP_MAC_CTX	*mac_ctx;
+	uint8_t		mac[EVP_MAX_MD_SIZE], out[sizeof(ticket->data) + EVP_MAX_BLOCK_LENGTH];
+	size_t		mac_len;
+	int		ret, len, out_len;
+
+	MEM(cipher_ctx = EVP_CIPHER_CTX_new());
+	MEM(mac_ctx = EVP_MAC_CTX_new(hmac));
+
+	ret = tls_cache_session_ticket_key_process(cache_conf, now, ticket->key_name, ticket->iv,
+						   cipher_ctx, mac_ctx, 0);
+	if (ret <= 0) goto done;
+
+	TEST_CHECK(EVP_MAC_init(mac_ctx, NULL, 0, NULL) == 1);
+	TEST_CHECK(EVP_MAC_update(mac_ctx, ticket->data, ticket->data_len) == 1);
+	TEST_CHECK(EVP_MAC_final(mac_ctx, mac, &mac_len, sizeof(mac)) == 1);
+	TEST_CHECK_LEN(mac_len, ticket->mac_len);
+	TEST_CHECK(memcmp(mac, ticket->mac, mac_len) == 0);
+	TEST_MSG("Ticket MAC doesn't match");
+
+	TEST_CHECK(EVP_DecryptUpdate(cipher_ctx, out, &len, ticket->data, ticket->data_len) == 1);
+	out_len = len;
+	TEST_CHECK(EVP_DecryptFinal_ex(cipher_ctx, out + out_len, &len) == 1);
+	out_len += len;
+	TEST_CHECK_LEN(out_len, sizeof(ticket_state));
+	TEST_CHECK(memcmp(out, ticket_state, sizeof(ticket_state)) == 0);
+	TEST_MSG("Ticket contents don't match");
+
+done:
+	EVP_MAC_CTX_free(mac_ctx);
+	EVP_CIPHER_CTX_free(cipher_ctx);
+
+	return ret;
+}
+
+/** Tickets issued in the current period are accepted as they are
+ */
+static void test_ticket_key_current(void)
+{
+	fr_tls_cache_conf_t	*cache_conf = cache_conf_alloc(autofree, "testing123");
+	test_ticket_t		ticket;
+
+	ticket_seal(&ticket, cache_conf, at(0));
+	TEST_CHECK_RET(ticket_open(&ticket, cache_conf, at(0)), 1);
+	TEST_CHECK_RET(ticket_open(&ticket, cache_conf, at(ROTATION - 1)), 1);
+
+	/*
+	 *	The key name carries the period
+	 */
+	TEST_CHECK(fr_nbo_to_uint64(ticket.key_name) == (EPOCH / ROTATION));
+
+	talloc_free(cache_conf);
+}
+
+/** Tickets from the previous key are still accepted, and renewed with the current key
+ */
+static void test_ticket_key_rotation(void)
+{
+	fr_tls_cache_conf_t	*cache_conf = cache_conf_alloc(autofree, "testing123");
+	test_ticket_t		old, renewed;
+
+	ticket_seal(&old, cache_conf, at(ROTATION - 1));
+
+	/*
+	 *	The key has rotated, the ticket decrypts,
+	 *	but should be replaced.
+	 */
+	TEST_CHECK_RET(ticket_open(&old, cache_conf, at(ROTATION)), 2);
+
+	/*
+	 *	The replacement uses the current key...
+	 */
+	ticket_seal(&renewed, cache_conf, at(ROTATION));
+	TEST_CHECK(memcmp(old.key_name, renewed.key_name, sizeof(old.key_name)) != 0);
+	TEST_CHECK(fr_nbo_to_uint64(renewed.key_name) == fr_nbo_to_uint64(old.key_name) + 1);
+	TEST_CHECK_RET(ticket_open(&renewed, cache_conf, at(ROTATION)), 1);
+
+	/*
+	 *	...and the old ticket is still accepted for
+	 *	as long as it could be within its lifetime.
+	 */
+	TEST_CHECK_RET(ticket_open(&old, cache_conf, at(LIFETIME + ROTATION)), 2);
+
+	talloc_free(cache_conf);
+}
+
+/** Tickets from too long ago, or too far in the future, are refused
+ */
+static void test_ticket_key_expired(void)
+{
+	fr_tls_cache_conf_t	*cache_conf = cache_conf_alloc(autofree, "testing123");
+	test_ticket_t		ticket;
+
+	ticket_seal(&ticket, cache_conf, at(0));
+
+	/*
+	 *	lifetime / rotation + 1 periods are allowed
+	 */
+	TEST_CHECK_RET(ticket_open(&ticket, cache_conf, at(LIFETIME + (2 * ROTATION) - 1)), 2);
+	TEST_CHECK_RET(ticket_open(&ticket, cache_conf, at(LIFETIME + (2 * ROTATION))), 0);
+
+	/*
+	 *	One period ahead is allowed for clock skew
+	 *	between servers, any more is not.
+	 */
+	TEST_CHECK_RET(ticket_open(&ticket, cache_conf, at(-1)), 2);
+	TEST_CHECK_RET(ticket_open(&ticket, cache_conf, at(-ROTATION - 1)), 0);
+
+	talloc_free(cache_conf);
+}
+
+/** Tickets must have been issued with the same session_ticket_key
+ */
+static void test_ticket_key_mismatch(void)
+{
+	fr_tls_cache_conf_t	*cache_conf = cache_conf_alloc(autofree, "testing123");
+	fr_tls_cache_conf_t	*other_conf = cache_conf_alloc(autofree, "testing456");
+	test_ticket_t		ticket;
+
+	ticket_seal(&ticket, cache_conf, at(0));
+	TEST_CHECK_RET(ticket_open(&ticket, other_conf, at(0)), 0);
+	TEST_CHECK_RET(ticket_open(&ticket, other_conf, at(ROTATION)), 0);
+
+	/*
+	 *	Servers sharing the key agree on it, without
+	 *	any shared state.
+	 */
+	talloc_free(other_conf);
+	other_conf = cache_conf_alloc(autofree, "testing123");
+	TEST_CHECK_RET(ticket_open(&ticket, other_conf, at(ROTATION)), 2);
+
+	/*
+	 *	Key names that don't match the period are refused
+	 */
+	ticket.key_name[sizeof(uint64_t)] ^= 0xff;
+	TEST_CHECK_RET(ticket_open(&ticket, cache_conf, at(0)), 0);
+
+	talloc_free(other_conf);
+	talloc_free(cache_conf);
+}
+
+TEST_LIST = {
+	{ "ticket_key_current",				test_ticket_key_current },
+	{ "ticket_key_rotation",			test_ticket_key_rotation },
+	{ "ticket_key_expired",				test_ticket_key_expired },
+	{ "ticket_key_mismatch",			test_ticket_key_mismatch },
+
+	{ NULL }
+};
+#else
+static void test_init(void)
+{
+}
+
+TEST_LIST = {
+	{ NULL }
+};
+#endif
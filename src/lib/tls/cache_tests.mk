@@ -0,0 +1,11 @@
+ifneq ($(OPENSSL_LIBS),)
+TARGET		:= cache_tests$(E)
+endif
+
+SOURCES		:= cache_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(OPENSSL_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(OPENSSL_FLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L) libfreeradius-tls$(L)
+
+TGT_INSTALLDIR	:=
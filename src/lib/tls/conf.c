@@ -98,6 +98,10 @@ static conf_parser_t tls_cache_config[] = {
 #endif
 
 	{ FR_CONF_OFFSET("session_ticket_key", fr_tls_cache_conf_t, session_ticket_key) },
+	{ FR_CONF_OFFSET("session_ticket_key_rotation", fr_tls_cache_conf_t, session_ticket_key_rotation), .dflt = "0" },
+
+	{ FR_CONF_OFFSET_TYPE_FLAGS("memory_max_size", FR_TYPE_SIZE, 0, fr_tls_cache_conf_t, memory_max_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("memory_shards", fr_tls_cache_conf_t, memory_shards), .dflt = "16" },
 
 	/*
 	 *	Deprecated
@@ -482,9 +486,7 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 
 	if ((cf_section_parse(conf, conf, cs) < 0) ||
 	    (cf_section_parse_pass2(conf, cs) < 0)) {
-#ifdef __APPLE__
 	error:
-#endif
 		talloc_free(conf);
 		return NULL;
 	}
@@ -496,6 +498,31 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 
 	FR_INTEGER_BOUND_CHECK("padding", conf->padding_block_size, <=, SSL3_RT_MAX_PLAIN_LENGTH);
 
+	if (fr_time_delta_ispos(conf->cache.session_ticket_key_rotation)) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		FR_TIME_DELTA_BOUND_CHECK("cache.session_ticket_key_rotation",
+					  conf->cache.session_ticket_key_rotation, >=, fr_time_delta_from_sec(60));
+#else
+		WARN("Ignoring \"cache.session_ticket_key_rotation\", it requires OpenSSL >= 3.0");
+		conf->cache.session_ticket_key_rotation = fr_time_delta_wrap(0);
+#endif
+	}
+
+	/*
+	 *	The in-memory store is shared by every
+	 *	thread, so it's created here, once.
+	 */
+	if ((conf->cache.mode & FR_TLS_CACHE_STATEFUL) && (conf->cache.memory_max_size > 0)) {
+		FR_INTEGER_BOUND_CHECK("cache.memory_shards", conf->cache.memory_shards, >=, 1);
+		FR_INTEGER_BOUND_CHECK("cache.memory_shards", conf->cache.memory_shards, <=, 256);
+
+		conf->cache.mem = fr_tls_cache_mem_alloc(conf, conf->cache.memory_max_size, conf->cache.memory_shards);
+		if (!conf->cache.mem) {
+			cf_log_perr(cs, "Failed creating in-memory session store");
+			goto error;
+		}
+	}
+
 #ifdef __APPLE__
 	if (conf_cert_admin_password(conf) < 0) goto error;
 #endif
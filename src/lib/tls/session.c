@@ -34,6 +34,7 @@
 #include <freeradius-devel/util/base16.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/pair_legacy.h>
+#include <freeradius-devel/util/syserror.h>
 
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 
@@ -1280,6 +1281,84 @@ static unlang_action_t tls_session_async_handshake_done_round(UNUSED rlm_rcode_t
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
+/** An async engine or provider has finished an operation
+ *
+ * Stop watching its fds, and continue the handshake.
+ */
+static void tls_session_async_fd_ready(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+	request_t		*request = fr_tls_session_request(tls_session->ssl);
+
+	RDEBUG3("OpenSSL async job can continue");
+
+	TALLOC_FREE(tls_session->async_wait);
+	unlang_interpret_mark_runnable(request);
+}
+
+static void tls_session_async_fd_error(UNUSED fr_event_list_t *el, int fd, UNUSED int flags,
+				       int fd_errno, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+	request_t		*request = fr_tls_session_request(tls_session->ssl);
+
+	RERROR("Error on OpenSSL async fd %i: %s", fd, fr_syserror(fd_errno));
+
+	/*
+	 *	Let SSL_read() figure out whether the
+	 *	operation completed.
+	 */
+	TALLOC_FREE(tls_session->async_wait);
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Wait for an async engine or provider to finish an operation
+ *
+ * Engines which support async operation (e.g. for private key operations
+ * offloaded to hardware, or to a thread pool), pause the OpenSSL async job
+ * and give us fds which become readable when the operation has completed.
+ * Rather than spinning on SSL_read(), we add those fds to the request's
+ * event list, and yield.
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	whose async job was paused.
+ * @return
+ *	- 1 if we're waiting on fds, and the caller should yield.
+ *	- 0 if there are no fds to wait on.
+ *	- -1 on error.
+ */
+static int tls_session_async_wait(request_t *request, fr_tls_session_t *tls_session)
+{
+	fr_event_list_t		*el = unlang_interpret_event_list(request);
+	OSSL_ASYNC_FD		*fds;
+	size_t			numfds, i;
+
+	if ((SSL_get_all_async_fds(tls_session->ssl, NULL, &numfds) != 1) || (numfds == 0)) return 0;
+
+	MEM(tls_session->async_wait = talloc_new(tls_session));
+	MEM(fds = talloc_array(tls_session->async_wait, OSSL_ASYNC_FD, numfds));
+
+	if (SSL_get_all_async_fds(tls_session->ssl, fds, &numfds) != 1) {
+		fr_tls_log(request, "Failed retrieving OpenSSL async fds");
+	error:
+		TALLOC_FREE(tls_session->async_wait);
+		return -1;
+	}
+
+	for (i = 0; i < numfds; i++) {
+		if (fr_event_fd_insert(tls_session->async_wait, NULL, el, fds[i],
+				       tls_session_async_fd_ready, NULL, tls_session_async_fd_error,
+				       tls_session) < 0) {
+			RPERROR("Failed watching OpenSSL async fd %i", fds[i]);
+			goto error;
+		}
+	}
+
+	RDEBUG3("Waiting for %zu OpenSSL async fd(s)", numfds);
+
+	return 1;
+}
+
 /** Try very hard to get the SSL * into a consistent state where it's not yielded
  *
  * ...because if it's yielded, we'll probably leak thread contexts and all kinds of memory.
@@ -1299,6 +1378,11 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, UNUSED
 	 *	cache code.
 	 */
 
+	/*
+	 *	Stop waiting for an async engine.
+	 */
+	TALLOC_FREE(tls_session->async_wait);
+
 	/*
 	 *	If SSL_get_error returns SSL_ERROR_WANT_ASYNC
 	 *	it means we're yielded in the middle of a
@@ -1342,6 +1426,12 @@ static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, i
 
 	RDEBUG3("(re-)entered state %s", __FUNCTION__);
 
+	/*
+	 *	Resumed before an async engine signalled us,
+	 *	we'll find out from SSL_read() if it's done.
+	 */
+	TALLOC_FREE(tls_session->async_wait);
+
 	/*
 	 *	Magic/More magic? Although SSL_read is normally
 	 *	used to read application data, it will also
@@ -1470,9 +1560,33 @@ DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
 			IGNORE(unlang_function_clear(request), int);
 			goto error;
 
+		case UNLANG_ACTION_CALCULATE_RESULT:
+			break;
+
 		default:
 			return ua;
 		}
+
+		/*
+		 *	None of our callbacks paused the job, so it
+		 *	was an async engine, usually for a private
+		 *	key operation.  Yield until it's done, and
+		 *	let the worker get on with other requests.
+		 *
+		 *	If the engine doesn't provide fds, we just
+		 *	keep calling SSL_read() until it's done.
+		 */
+		switch (tls_session_async_wait(request, tls_session)) {
+		case 1:
+			return UNLANG_ACTION_YIELD;
+
+		case 0:
+			return UNLANG_ACTION_CALCULATE_RESULT;
+
+		default:
+			IGNORE(unlang_function_clear(request), int);
+			goto error;
+		}
 	}
 
 	case SSL_ERROR_WANT_ASYNC_JOB:
@@ -68,6 +68,12 @@ static _Thread_local unlang_thread_t *unlang_thread_array;
  */
 static fr_rb_tree_t *unlang_instruction_tree = NULL;
 
+/*
+ *	Running totals of instructions compiled, and instructions
+ *	remaining after optimisation.
+ */
+static unlang_compile_stats_t unlang_stats;
+
 /* Here's where we recognize all of our keywords: first the rcodes, then the
  * actions */
 fr_table_num_sorted_t const mod_rcode_table[] = {
@@ -2651,6 +2657,62 @@ static int case_to_key(uint8_t **out, size_t *outlen, void const *data)
 
 static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs);
 
+#define SWITCH_INDEX_MIN_CASES	4	//!< With fewer cases, the htrie is just as fast.
+#define SWITCH_INDEX_DENSITY	4	//!< Maximum number of index entries per case.
+
+/** Build a direct lookup table for switches over dense integer values
+ *
+ * Integer values such as packet codes and enumerated attributes are
+ * usually close together.  When they are, case selection is a bounds
+ * check and an array lookup, instead of hashing the value.
+ *
+ * @param[in] gext	to build the index for.  All cases must have been compiled.
+ * @param[in] type	of the case values.
+ * @return
+ *	- 0 on success, or if the case values aren't suitable for an index.
+ *	- -1 on error.
+ */
+static int switch_index_build(unlang_switch_t *gext, fr_type_t type)
+{
+	unlang_group_t		*g = unlang_switch_to_group(gext);
+	unlang_t		*child;
+	uint64_t		key, min = UINT64_MAX, max = 0;
+	uint64_t		num = 0;
+
+	if (!fr_type_is_integer(type)) return 0;
+
+	for (child = g->children; child; child = child->next) {
+		fr_value_box_t const *box;
+
+		if (child == gext->default_case) continue;
+
+		box = tmpl_value(unlang_group_to_case(unlang_generic_to_group(child))->vpt);
+		if ((box->type != type) || !unlang_switch_index_key(&key, box)) return 0;
+
+		if (key < min) min = key;
+		if (key > max) max = key;
+		num++;
+	}
+
+	if ((num < SWITCH_INDEX_MIN_CASES) || ((max - min) >= (num * SWITCH_INDEX_DENSITY))) return 0;
+
+	gext->index = talloc_zero_array(gext, unlang_t *, (max - min) + 1);
+	if (!gext->index) return -1;
+	gext->index_min = min;
+	gext->index_len = (max - min) + 1;
+	gext->index_type = type;
+
+	for (child = g->children; child; child = child->next) {
+		if (child == gext->default_case) continue;
+
+		(void) unlang_switch_index_key(&key,
+					       tmpl_value(unlang_group_to_case(unlang_generic_to_group(child))->vpt));
+		gext->index[key - min] = child;
+	}
+
+	return 0;
+}
+
 static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs)
 {
 	CONF_ITEM		*ci;
@@ -2767,6 +2829,15 @@ static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		goto error;
 	}
 
+	/*
+	 *	Cases only need exact matches, so fixed size values
+	 *	can go in a hash table, making case selection O(1)
+	 *	instead of O(log n).  Floats stay in a tree, as
+	 *	values which compare equal (0.0 and -0.0) can have
+	 *	different representations.
+	 */
+	if ((htype == FR_HTRIE_RB) && !fr_type_is_float32(type) && !fr_type_is_float64(type)) htype = FR_HTRIE_HASH;
+
 	gext->ht = fr_htrie_alloc(gext, htype,
 				  (fr_hash_t) case_hash,
 				  (fr_cmp_t) case_cmp,
@@ -2857,6 +2928,11 @@ static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		g->num_children++;
 	}
 
+	if (switch_index_build(gext, type) < 0) {
+		cf_log_err(cs, "Failed initializing internal data structures");
+		goto error;
+	}
+
 	compile_action_defaults(c, unlang_ctx);
 
 	return c;
@@ -4748,12 +4824,283 @@ fail:
 	return NULL;
 }
 
+/** Whether an instruction has a list of child instructions
+ *
+ */
+static bool unlang_has_children(unlang_type_t type)
+{
+	switch (type) {
+	case UNLANG_TYPE_CALL:
+	case UNLANG_TYPE_CALLER:
+	case UNLANG_TYPE_CASE:
+	case UNLANG_TYPE_FOREACH:
+	case UNLANG_TYPE_ELSE:
+	case UNLANG_TYPE_ELSIF:
+	case UNLANG_TYPE_GROUP:
+	case UNLANG_TYPE_IF:
+	case UNLANG_TYPE_LOAD_BALANCE:
+	case UNLANG_TYPE_PARALLEL:
+	case UNLANG_TYPE_POLICY:
+	case UNLANG_TYPE_REDUNDANT:
+	case UNLANG_TYPE_REDUNDANT_LOAD_BALANCE:
+	case UNLANG_TYPE_SUBREQUEST:
+	case UNLANG_TYPE_SWITCH:
+	case UNLANG_TYPE_TIMEOUT:
+	case UNLANG_TYPE_LIMIT:
+	case UNLANG_TYPE_TRANSACTION:
+	case UNLANG_TYPE_TRY:
+	case UNLANG_TYPE_CATCH:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Count the instructions in a tree
+ *
+ */
+static unsigned int unlang_instruction_count(unlang_t const *c)
+{
+	unlang_t const	*child;
+	unsigned int	count = 1;
+
+	if (!unlang_has_children(c->type)) return count;
+
+	for (child = unlang_generic_to_group(c)->children; child != NULL; child = child->next) {
+		count += unlang_instruction_count(child);
+	}
+
+	return count;
+}
+
+/** Whether an "if" or "elsif" is always taken
+ *
+ */
+static inline bool unlang_cond_always_true(unlang_t const *c)
+{
+	unlang_cond_t *gext;
+
+	if ((c->type != UNLANG_TYPE_IF) && (c->type != UNLANG_TYPE_ELSIF)) return false;
+
+	gext = unlang_group_to_cond(unlang_generic_to_group(c));
+
+	return gext->is_truthy && gext->value;
+}
+
+/** Whether a tree contains a condition which is evaluated at run time
+ *
+ * Run-time conditions see the rcode of the enclosing frame, so
+ * the frames around them can't be merged without changing what
+ * they see.
+ */
+static bool unlang_has_runtime_cond(unlang_t const *c)
+{
+	unlang_t const *child;
+
+	if (((c->type == UNLANG_TYPE_IF) || (c->type == UNLANG_TYPE_ELSIF)) &&
+	    !unlang_group_to_cond(unlang_generic_to_group(c))->is_truthy) return true;
+
+	if (!unlang_has_children(c->type)) return false;
+
+	for (child = unlang_generic_to_group(c)->children; child != NULL; child = child->next) {
+		if (unlang_has_runtime_cond(child)) return true;
+	}
+
+	return false;
+}
+
+/** Whether the children of an instruction can be run in the frame of its parent
+ *
+ * The instruction has to be a plain group, an "if" or "elsif" which
+ * is always taken, or an "else" which has no "if" in front of it.
+ * It must not declare any local variables, and it must not do
+ * anything with the results of its children other than pass them
+ * up unchanged.
+ *
+ * @param[in] parent	the instruction is in.
+ * @param[in] prev	sibling of the instruction, or NULL if it's the first child.
+ * @param[in] c		the instruction to check.
+ * @return
+ *	- true if the instruction can be replaced by its children.
+ *	- false if it has to be left alone.
+ */
+static bool unlang_can_flatten(unlang_t const *parent, unlang_t const *prev, unlang_t const *c)
+{
+	unlang_group_t	*g;
+	unlang_t const	*child;
+	int		i;
+
+	/*
+	 *	Only parents which run their children in sequence,
+	 *	and don't care which instructions those are.
+	 */
+	switch (parent->type) {
+	case UNLANG_TYPE_CASE:
+	case UNLANG_TYPE_ELSE:
+	case UNLANG_TYPE_ELSIF:
+	case UNLANG_TYPE_FOREACH:
+	case UNLANG_TYPE_GROUP:
+	case UNLANG_TYPE_IF:
+	case UNLANG_TYPE_POLICY:
+		break;
+
+	default:
+		return false;
+	}
+
+	switch (c->type) {
+	case UNLANG_TYPE_GROUP:
+		break;
+
+	case UNLANG_TYPE_ELSIF:
+		if (!unlang_cond_always_true(c)) return false;
+		FALL_THROUGH;
+
+	case UNLANG_TYPE_ELSE:
+		if (prev && ((prev->type == UNLANG_TYPE_IF) || (prev->type == UNLANG_TYPE_ELSIF))) return false;
+		break;
+
+	case UNLANG_TYPE_IF:
+		if (!unlang_cond_always_true(c)) return false;
+		break;
+
+	default:
+		return false;
+	}
+
+	g = unlang_generic_to_group(c);
+	if (!g->children || g->variables) return false;
+
+	if (fr_time_delta_ispos(c->actions.retry.irt) || fr_time_delta_ispos(c->actions.retry.mrd) ||
+	    c->actions.retry.mrc) return false;
+
+	for (i = 0; i < RLM_MODULE_NUMCODES; i++) {
+		if ((c->actions.actions[i] == MOD_ACTION_REJECT) ||
+		    (c->actions.actions[i] == MOD_ACTION_RETRY)) return false;
+	}
+
+	/*
+	 *	An "if" or "elsif" at the end of the group would
+	 *	end up directly in front of a following "else" or
+	 *	"elsif", and would then decide whether that runs.
+	 *	This happens when the "if" the "else" belonged to
+	 *	was always false, and was omitted.
+	 */
+	if (c->next && ((c->next->type == UNLANG_TYPE_ELSE) || (c->next->type == UNLANG_TYPE_ELSIF))) {
+		for (child = g->children; child->next != NULL; child = child->next);
+
+		if ((child->type == UNLANG_TYPE_IF) || (child->type == UNLANG_TYPE_ELSIF)) return false;
+	}
+
+	/*
+	 *	Likewise an "else" or "elsif" at the start of the
+	 *	group would end up directly after a preceding "if"
+	 *	or "elsif", and would then only run when that isn't
+	 *	taken.
+	 */
+	if (prev && ((prev->type == UNLANG_TYPE_IF) || (prev->type == UNLANG_TYPE_ELSIF)) &&
+	    ((g->children->type == UNLANG_TYPE_ELSE) || (g->children->type == UNLANG_TYPE_ELSIF))) return false;
+
+	/*
+	 *	The group has to calculate the same result and
+	 *	priority as its children do, otherwise the parent
+	 *	would see something different.
+	 */
+	for (child = g->children; child != NULL; child = child->next) {
+		if (memcmp(child->actions.actions, c->actions.actions, sizeof(c->actions.actions)) != 0) return false;
+	}
+
+	/*
+	 *	With more than one child, a run-time condition after
+	 *	the first one sees the rcode of the group, which may
+	 *	not be the rcode of the parent.
+	 */
+	if (g->num_children == 1) return true;
+
+	for (child = g->children; child != NULL; child = child->next) {
+		if (unlang_has_runtime_cond(child)) return false;
+	}
+
+	return true;
+}
+
+/** Optimise the children of an instruction
+ *
+ * Compilation has already omitted conditions which are always false,
+ * along with any "elsif" and "else" after a condition which is always
+ * true.  This pass removes the frames which are left over from that:
+ * conditions which are always true, "else" blocks which no longer have
+ * an "if", and groups which do nothing but run their children, are
+ * replaced by their children.  The interpreter then pushes one frame
+ * instead of several.
+ *
+ * @param[in] parent	instruction to optimise.
+ */
+static void unlang_optimise(unlang_t *parent)
+{
+	unlang_group_t	*g;
+	unlang_t	**p, *prev = NULL;
+
+	if (!unlang_has_children(parent->type)) return;
+
+	g = unlang_generic_to_group(parent);
+
+	p = &g->children;
+	while (*p) {
+		unlang_t	*c = *p, *child, *last = NULL;
+		unlang_group_t	*cg;
+
+		unlang_optimise(c);
+
+		if (!unlang_can_flatten(parent, prev, c)) {
+			prev = c;
+			p = &c->next;
+			continue;
+		}
+
+		cg = unlang_generic_to_group(c);
+
+		for (child = cg->children; child != NULL; child = child->next) {
+			child->parent = parent;
+			last = child;
+		}
+
+		/*
+		 *	Splice the children in where the group was, and
+		 *	check them again, as they may now be able to be
+		 *	flattened into this parent, too.
+		 */
+		last->next = c->next;
+		if (g->tail == &c->next) g->tail = &last->next;
+		*p = cg->children;
+		g->num_children += cg->num_children - 1;
+
+		cg->children = NULL;
+		cg->tail = &cg->children;
+		cg->num_children = 0;
+		c->next = NULL;
+
+		if (unlang_ops[c->type].thread_inst_size) fr_rb_delete(unlang_instruction_tree, c);
+	}
+}
+
+/** Return the running totals of instructions compiled
+ *
+ * @param[out] stats	where the totals are written.
+ */
+void unlang_compile_stats(unlang_compile_stats_t *stats)
+{
+	*stats = unlang_stats;
+}
+
 int unlang_compile(CONF_SECTION *cs, unlang_mod_actions_t const * actions, tmpl_rules_t const *rules, void **instruction)
 {
 	unlang_t			*c;
 	tmpl_rules_t			my_rules;
 	char const			*name1, *name2;
 	CONF_DATA const			*cd;
+	unsigned int			before, after;
 	static unlang_ext_t const 	group_ext = {
 						.type = UNLANG_TYPE_GROUP,
 						.len = sizeof(unlang_group_t),
@@ -4795,6 +5142,16 @@ int unlang_compile(CONF_SECTION *cs, unlang_mod_actions_t const * actions, tmpl_
 			    cs, &group_ext);
 	if (!c) return -1;
 
+	before = unlang_instruction_count(c);
+	unlang_optimise(c);
+	after = unlang_instruction_count(c);
+
+	unlang_stats.instructions += before;
+	unlang_stats.optimised += after;
+
+	if (after < before) cf_log_debug(cs, "Optimised %s %s {...} from %u to %u instructions",
+					 name1, name2, before, after);
+
 	if (DEBUG_ENABLED4) unlang_dump(c, 2);
 
 	/*
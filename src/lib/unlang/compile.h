@@ -33,6 +33,11 @@ extern "C" {
 #include <freeradius-devel/util/retry.h>
 #include <freeradius-devel/unlang/mod_action.h>
 
+typedef struct {
+	unsigned int	instructions;			//!< compiled, before optimisation.
+	unsigned int	optimised;			//!< left after optimisation.
+} unlang_compile_stats_t;
+
 void		unlang_compile_init(TALLOC_CTX *ctx);
 
 int 		unlang_compile(CONF_SECTION *cs, unlang_mod_actions_t const *actions, tmpl_rules_t const *rules, void **instruction);
@@ -41,6 +46,8 @@ bool		unlang_compile_is_keyword(const char *name);
 
 bool		unlang_compile_actions(unlang_mod_actions_t *actions, CONF_SECTION *parent, bool module_retry);
 
+void		unlang_compile_stats(unlang_compile_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -95,6 +95,22 @@ static unlang_action_t unlang_switch(rlm_rcode_t *p_result, request_t *request,
 		return UNLANG_ACTION_FAIL;
 	}
 
+	/*
+	 *	Dense integer cases are looked up directly.  The
+	 *	index holds every case, so if there's no entry, the
+	 *	default case is used.
+	 */
+	if (switch_gext->index && (box->type == switch_gext->index_type)) {
+		uint64_t key;
+
+		if (unlang_switch_index_key(&key, box) &&
+		    ((key - switch_gext->index_min) < switch_gext->index_len)) {
+			found = switch_gext->index[key - switch_gext->index_min];
+		}
+		if (!found) found = switch_gext->default_case;
+		goto do_null_case;
+	}
+
 	/*
 	 *	case_gext->vpt.data.literal is an in-line box, so we
 	 *	have to make a shallow copy of its contents.
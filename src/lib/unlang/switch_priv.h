@@ -34,8 +34,86 @@ typedef struct {
 	unlang_t	*default_case;
 	tmpl_t		*vpt;
 	fr_htrie_t	*ht;
+
+	unlang_t	**index;	//!< Cases indexed by key - index_min.  Only built when
+					///< all the case values are integers, and are dense.
+	uint64_t	index_min;	//!< Key of the first entry in the index.
+	uint64_t	index_len;	//!< Number of entries in the index.
+	fr_type_t	index_type;	//!< Type of the case values in the index.
 } unlang_switch_t;
 
+/** Convert an integer value to a key for the case index
+ *
+ * Signed values have their sign bit flipped, so that keys sort
+ * in the same order as the values they were created from.
+ *
+ * @param[out] out	Key for the value.
+ * @param[in] box	to convert.
+ * @return
+ *	- true if the box contains an integer.
+ *	- false for any other type.
+ */
+static inline bool unlang_switch_index_key(uint64_t *out, fr_value_box_t const *box)
+{
+	int64_t	value;
+
+	switch (box->type) {
+	case FR_TYPE_BOOL:
+		*out = box->vb_bool;
+		return true;
+
+	case FR_TYPE_UINT8:
+		*out = box->vb_uint8;
+		return true;
+
+	case FR_TYPE_UINT16:
+		*out = box->vb_uint16;
+		return true;
+
+	case FR_TYPE_UINT32:
+		*out = box->vb_uint32;
+		return true;
+
+	case FR_TYPE_UINT64:
+		*out = box->vb_uint64;
+		return true;
+
+	case FR_TYPE_SIZE:
+		*out = box->vb_size;
+		return true;
+
+	case FR_TYPE_INT8:
+		value = box->vb_int8;
+		break;
+
+	case FR_TYPE_INT16:
+		value = box->vb_int16;
+		break;
+
+	case FR_TYPE_INT32:
+		value = box->vb_int32;
+		break;
+
+	case FR_TYPE_INT64:
+		value = box->vb_int64;
+		break;
+
+	case FR_TYPE_DATE:
+		value = fr_unix_time_unwrap(box->vb_date);
+		break;
+
+	case FR_TYPE_TIME_DELTA:
+		value = fr_time_delta_unwrap(box->vb_time_delta);
+		break;
+
+	default:
+		return false;
+	}
+
+	*out = ((uint64_t)value) ^ ((uint64_t)1 << 63);
+	return true;
+}
+
 /** Cast a group structure to the switch keyword extension
  *
  */
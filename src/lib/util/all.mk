@@ -3,12 +3,16 @@ SUBMAKEFILES := \
 	dbuff_tests.mk \
 	dcursor_tests.mk \
 	dcursor_typed_tests.mk \
+	dict_compile_tests.mk \
 	dlist_tests.mk \
 	edit_tests.mk \
+	event_tests.mk \
 	heap_tests.mk \
+	histogram_tests.mk \
 	hmac_tests.mk \
 	libfreeradius-util.mk \
 	lst_tests.mk \
+	md5_tests.mk \
 	minmax_heap_tests.mk \
 	pair_legacy_tests.mk \
 	pair_list_perf_test.mk \
@@ -19,5 +23,6 @@ SUBMAKEFILES := \
 	size_tests.mk \
 	slab_tests.mk \
 	strerror_tests.mk \
-	time_tests.mk
+	time_tests.mk \
+	timer_wheel_tests.mk
 
@@ -630,7 +630,12 @@ static inline void *fr_dcursor_replace(fr_dcursor_t *cursor, void *r)
 		return NULL;
 	}
 
+	/*
+	 *	Tell the callbacks about both halves
+	 *	of the replacement.
+	 */
 	if (cursor->remove) if (cursor->remove(cursor->dlist, v, cursor->mod_uctx) < 0) return NULL;
+	if (cursor->insert) if (cursor->insert(cursor->dlist, r, cursor->mod_uctx) < 0) return NULL;
 
 	fr_dlist_replace(cursor->dlist, cursor->current, r);
 
@@ -715,6 +715,8 @@ int			fr_dict_global_ctx_dir_set(char const *dict_dir);
 
 void			fr_dict_global_ctx_read_only(void);
 
+int			fr_dict_compile(fr_dict_t const *dict) CC_HINT(nonnull);
+
 void			fr_dict_global_ctx_debug(fr_dict_gctx_t const *gctx);
 
 char const		*fr_dict_global_ctx_dir(void);
@@ -0,0 +1,178 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for compiled dictionary child lookups
+ *
+ * @file src/lib/util/dict_compile_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+static void test_init(void) __attribute__((constructor));
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/dict_ext.h>
+#include <freeradius-devel/util/dict_test.h>
+
+#define MAX_CHECK_ATTR	512		//!< Look up every number up to this, found or not.
+#define NUM_VENDORS	64
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*test_dict;
+
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("dict_compile_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+}
+
+static fr_dict_attr_ext_children_t const *children_ext(fr_dict_attr_t const *da)
+{
+	return fr_dict_attr_ext(da, FR_DICT_ATTR_EXT_CHILDREN);
+}
+
+/** Record what every lookup in a parent returns
+ *
+ */
+static void lookups_record(fr_dict_attr_t const *out[static MAX_CHECK_ATTR], fr_dict_attr_t const *parent)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_CHECK_ATTR; i++) out[i] = fr_dict_attr_child_by_num(parent, i);
+}
+
+/** Check every lookup in a parent returns what it did before
+ *
+ */
+static void lookups_check(fr_dict_attr_t const *expected[static MAX_CHECK_ATTR], fr_dict_attr_t const *parent)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_CHECK_ATTR; i++) {
+		fr_dict_attr_t const *da = fr_dict_attr_child_by_num(parent, i);
+
+		TEST_CHECK(da == expected[i]);
+		TEST_MSG("Lookup of %u in %s returned %s, expected %s", i, parent->name,
+			 da ? da->name : "NULL", expected[i] ? expected[i]->name : "NULL");
+	}
+}
+
+static void test_dense(void)
+{
+	fr_dict_attr_t const	*root_before[MAX_CHECK_ATTR];
+	fr_dict_attr_t const	*tlv_before[MAX_CHECK_ATTR];
+	fr_dict_attr_t const	*root = fr_dict_root(test_dict);
+
+	lookups_record(root_before, root);
+	lookups_record(tlv_before, fr_dict_attr_test_nested_top_tlv);
+
+	TEST_CASE("Compile");
+	TEST_CHECK(fr_dict_compile(test_dict) == 0);
+
+	TEST_CASE("Root and TLV children are indexed directly");
+	TEST_CHECK(children_ext(root)->index != NULL);
+	TEST_CHECK(children_ext(root)->index_mult == 0);
+	TEST_CHECK(children_ext(fr_dict_attr_test_nested_top_tlv)->index != NULL);
+
+	TEST_CASE("Lookups return the same attributes as before");
+	lookups_check(root_before, root);
+	lookups_check(tlv_before, fr_dict_attr_test_nested_top_tlv);
+
+	TEST_CHECK(fr_dict_attr_child_by_num(root, FR_TEST_ATTR_STRING) == fr_dict_attr_test_string);
+	TEST_CHECK(fr_dict_attr_child_by_num(root, UINT32_MAX) == NULL);
+}
+
+static void test_sparse(void)
+{
+	fr_dict_attr_flags_t	flags = {};
+	fr_dict_attr_t const	*vendors[NUM_VENDORS];
+	unsigned int		i;
+
+	TEST_CASE("Add vendors with sparse numbers");
+	for (i = 0; i < NUM_VENDORS; i++) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "Sparse-Vendor-%u", i);
+		TEST_CHECK(fr_dict_attr_add(test_dict, fr_dict_attr_test_vsa, name, 1000 + (i * 7919),
+					    FR_TYPE_VENDOR, &flags) == 0);
+		vendors[i] = fr_dict_attr_by_name(NULL, fr_dict_attr_test_vsa, name);
+		TEST_CHECK(vendors[i] != NULL);
+	}
+
+	TEST_CASE("Compile");
+	TEST_CHECK(fr_dict_compile(test_dict) == 0);
+
+	TEST_CASE("Vendors are in a perfect hash");
+	TEST_CHECK(children_ext(fr_dict_attr_test_vsa)->index != NULL);
+	TEST_CHECK(children_ext(fr_dict_attr_test_vsa)->index_mult != 0);
+
+	TEST_CASE("Every vendor is found");
+	for (i = 0; i < NUM_VENDORS; i++) {
+		TEST_CHECK(fr_dict_vendor_da_by_num(fr_dict_attr_test_vsa, 1000 + (i * 7919)) == vendors[i]);
+		TEST_MSG("Expected %s", vendors[i]->name);
+	}
+	TEST_CHECK(fr_dict_attr_child_by_num(fr_dict_attr_test_vsa, FR_TEST_ATTR_VENDOR) == fr_dict_attr_test_vendor);
+
+	TEST_CASE("Unknown vendors are not found");
+	for (i = 0; i < NUM_VENDORS; i++) {
+		TEST_CHECK(fr_dict_attr_child_by_num(fr_dict_attr_test_vsa, 1001 + (i * 7919)) == NULL);
+	}
+}
+
+static void test_invalidate(void)
+{
+	fr_dict_attr_flags_t	flags = {};
+	fr_dict_attr_t const	*root = fr_dict_root(test_dict);
+	fr_dict_attr_t const	*da;
+
+	TEST_CHECK(fr_dict_compile(test_dict) == 0);
+	TEST_CHECK(children_ext(root)->index != NULL);
+
+	TEST_CASE("Adding a child discards the lookup table");
+	TEST_CHECK(fr_dict_attr_add(test_dict, root, "Compile-Added", 4000, FR_TYPE_UINT32, &flags) == 0);
+	TEST_CHECK(children_ext(root)->index == NULL);
+
+	da = fr_dict_attr_by_name(NULL, root, "Compile-Added");
+	TEST_CHECK(da != NULL);
+	TEST_CHECK(fr_dict_attr_child_by_num(root, 4000) == da);
+
+	TEST_CASE("Recompiling finds the new child");
+	TEST_CHECK(fr_dict_compile(test_dict) == 0);
+	TEST_CHECK(children_ext(root)->index != NULL);
+	TEST_CHECK(fr_dict_attr_child_by_num(root, 4000) == da);
+	TEST_CHECK(fr_dict_attr_child_by_num(root, FR_TEST_ATTR_STRING) == fr_dict_attr_test_string);
+}
+
+TEST_LIST = {
+	{ "dense",		test_dense },
+	{ "sparse",		test_sparse },
+	{ "invalidate",		test_invalidate },
+
+	{ NULL }
+};
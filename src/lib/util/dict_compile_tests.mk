@@ -0,0 +1,8 @@
+TARGET		:= dict_compile_tests$(E)
+SOURCES		:= dict_compile_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L)
+
+TGT_INSTALLDIR	:=
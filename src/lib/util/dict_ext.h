@@ -52,6 +52,14 @@ extern fr_ext_t const fr_dict_enum_ext_def;
 typedef struct {
 	fr_hash_table_t		*child_by_name;			//!< Namespace at this level in the hierarchy.
 	fr_dict_attr_t const	**children;			//!< Children of this attribute.
+
+	fr_dict_attr_t const	**index;			//!< Compiled lookup table, built by fr_dict_compile().
+								///< NULL if the children haven't been compiled, or
+								///< have changed since they were.
+	uint32_t		index_len;			//!< Number of slots in the lookup table.
+	uint32_t		index_mult;			//!< Perfect hash multiplier.  0 if the lookup table
+								///< is indexed directly by attribute number.
+	uint8_t			index_shift;			//!< Perfect hash shift.
 } fr_dict_attr_ext_children_t;
 
 /** Attribute extension - Holds a reference to an attribute in another dictionary
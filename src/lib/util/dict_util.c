@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/conf.h>
 #include <freeradius-devel/util/dict.h>
 #include <freeradius-devel/util/dict_fixup_priv.h>
+#include <freeradius-devel/util/math.h>
 #include <freeradius-devel/util/proto.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/sbuff.h>
@@ -1131,6 +1132,16 @@ int dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t *child)
 	child->next = *this;
 	*this = child;
 
+	/*
+	 *	Any compiled lookup table is now out of date.
+	 */
+	{
+		fr_dict_attr_ext_children_t *ext;
+
+		ext = fr_dict_attr_ext(parent, FR_DICT_ATTR_EXT_CHILDREN);
+		if (ext) TALLOC_FREE(ext->index);
+	}
+
 	return 0;
 }
 
@@ -2872,6 +2883,33 @@ fr_dict_attr_t const *fr_dict_attr_by_name(fr_dict_attr_err_t *err, fr_dict_attr
 	return da;
 }
 
+/** Find a child in a compiled lookup table
+ *
+ * @param[in] ext	Children extension of the parent, with a lookup table.
+ * @param[in] attr	number to look for.
+ * @return
+ *	- The child attribute on success.
+ *	- NULL if the child attribute does not exist.
+ */
+static inline CC_HINT(always_inline) fr_dict_attr_t *dict_attr_child_by_index(fr_dict_attr_ext_children_t const *ext,
+									      unsigned int attr)
+{
+	fr_dict_attr_t const	*da;
+	fr_dict_attr_t		*out;
+
+	if (!ext->index_mult) {
+		if (attr >= ext->index_len) return NULL;
+		da = ext->index[attr];
+	} else {
+		da = ext->index[(uint32_t)(attr * ext->index_mult) >> ext->index_shift];
+		if (!da || (da->attr != attr)) return NULL;
+	}
+
+	memcpy(&out, &da, sizeof(da));
+
+	return out;
+}
+
 /** Internal version of fr_dict_attr_child_by_num
  *
  */
@@ -2880,6 +2918,7 @@ fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned in
 	fr_dict_attr_t const *bin;
 	fr_dict_attr_t const **children;
 	fr_dict_attr_t const *ref;
+	fr_dict_attr_ext_children_t const *ext;
 
 	DA_VERIFY(parent);
 
@@ -2889,6 +2928,9 @@ fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned in
 	ref = fr_dict_attr_ref(parent);
 	if (ref) parent = ref;
 
+	ext = fr_dict_attr_ext(parent, FR_DICT_ATTR_EXT_CHILDREN);
+	if (ext && ext->index) return dict_attr_child_by_index(ext, attr);
+
 	children = dict_attr_children(parent);
 	if (!children) return NULL;
 
@@ -4108,11 +4150,13 @@ void fr_dict_global_ctx_read_only(void)
 	     dict;
 	     dict = fr_hash_table_iter_next(dict_gctx->protocol_by_num, &iter)) {
 	     	dict_hash_tables_finalise(dict);
+		(void)fr_dict_compile(dict);
 		dict->read_only = true;
 	}
 
 	dict = dict_gctx->internal;
 	dict_hash_tables_finalise(dict);
+	(void)fr_dict_compile(dict);
 	dict->read_only = true;
 	dict_gctx->read_only = true;
 }
@@ -4373,6 +4417,164 @@ int fr_dict_walk(fr_dict_attr_t const *da, fr_dict_walk_t callback, void *uctx)
 	return dict_walk(da, callback, uctx);
 }
 
+/** Build a perfect hash of an attribute's children
+ *
+ * Tries a few table sizes and multipliers, until every child lands
+ * in its own slot.
+ *
+ * @param[in] ext	to write the lookup table to.
+ * @param[in] num	How many children there are.
+ * @return
+ *	- 0 on success.
+ *	- 1 if no perfect hash was found.
+ *	- -1 on failure.
+ */
+static int dict_attr_children_hash(fr_dict_attr_ext_children_t *ext, unsigned int num)
+{
+	unsigned int	bits, min_bits, i;
+
+	min_bits = fr_high_bit_pos(num) + 1;		/* At least twice as many slots as children */
+
+	for (bits = min_bits; (bits <= min_bits + 3) && (bits <= 16); bits++) {
+		uint32_t		len = (uint32_t)1 << bits;
+		fr_dict_attr_t const	**index;
+
+		index = talloc_zero_array(ext->children, fr_dict_attr_t const *, len);
+		if (!index) {
+			fr_strerror_const("Out of memory");
+			return -1;
+		}
+
+		for (i = 0; i < 32; i++) {
+			uint32_t	mult = 0x9e3779b1 * ((2 * i) + 1);	/* Always odd */
+			uint8_t		shift = 32 - bits;
+			size_t		j, children_len = talloc_array_length(ext->children);
+			bool		collision = false;
+
+			for (j = 0; (j < children_len) && !collision; j++) {
+				fr_dict_attr_t const *bin;
+
+				for (bin = ext->children[j]; bin; bin = bin->next) {
+					fr_dict_attr_t const **slot = &index[(uint32_t)(bin->attr * mult) >> shift];
+
+					if (!*slot) {
+						*slot = bin;
+						continue;
+					}
+
+					/*
+					 *	Same number, the first one in the bin wins,
+					 *	as it does with the uncompiled lookup.
+					 */
+					if ((*slot)->attr == bin->attr) continue;
+
+					collision = true;
+					break;
+				}
+			}
+
+			if (!collision) {
+				ext->index = index;
+				ext->index_len = len;
+				ext->index_mult = mult;
+				ext->index_shift = shift;
+				return 0;
+			}
+
+			memset(index, 0, sizeof(*index) * len);
+		}
+
+		talloc_free(index);
+	}
+
+	return 1;
+}
+
+/** Build a lookup table for an attribute's children
+ *
+ * Children numbered densely from zero get a table indexed directly by
+ * attribute number.  Sparse children, such as vendors, get a perfect
+ * hash.  Either way a lookup is a single load instead of a walk along
+ * a bin.
+ */
+static int _dict_attr_children_compile(fr_dict_attr_t const *da, UNUSED void *uctx)
+{
+	fr_dict_attr_ext_children_t	*ext;
+	size_t				i, len;
+	unsigned int			num = 0, max = 0;
+
+	ext = fr_dict_attr_ext(da, FR_DICT_ATTR_EXT_CHILDREN);
+	if (!ext || !ext->children || ext->index) return 0;
+
+	len = talloc_array_length(ext->children);
+	for (i = 0; i < len; i++) {
+		fr_dict_attr_t const *bin;
+
+		for (bin = ext->children[i]; bin; bin = bin->next) {
+			num++;
+			if (bin->attr > max) max = bin->attr;
+		}
+	}
+	if (!num) return 0;
+
+	/*
+	 *	Dense enough to index directly.  RADIUS and DHCPv4
+	 *	attributes always are.
+	 */
+	if ((max <= UINT8_MAX) || ((max <= UINT16_MAX) && (max < (num * 4)))) {
+		ext->index = talloc_zero_array(ext->children, fr_dict_attr_t const *, max + 1);
+		if (!ext->index) {
+			fr_strerror_const("Out of memory");
+			return -1;
+		}
+		ext->index_len = max + 1;
+		ext->index_mult = 0;
+		ext->index_shift = 0;
+
+		/*
+		 *	If a number appears more than once, the first
+		 *	in its bin wins, as with the uncompiled lookup.
+		 */
+		for (i = 0; i < len; i++) {
+			fr_dict_attr_t const *bin;
+
+			for (bin = ext->children[i]; bin; bin = bin->next) {
+				if (!ext->index[bin->attr]) ext->index[bin->attr] = bin;
+			}
+		}
+		return 0;
+	}
+
+	/*
+	 *	If there's no perfect hash, lookups
+	 *	walk the bins as before.
+	 */
+	if (dict_attr_children_hash(ext, num) < 0) return -1;
+
+	return 0;
+}
+
+/** Build lookup tables for the children of every attribute in a dictionary
+ *
+ * Lookups by number then take a single load, instead of walking a bin.
+ * The lookup table for an attribute is discarded if children are added
+ * to it afterwards, so this is safe to call on dictionaries which may
+ * still change, but is most useful once they're read only.
+ *
+ * @param[in] dict	to compile.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dict_compile(fr_dict_t const *dict)
+{
+	fr_dict_attr_t const *root = fr_dict_root(dict);
+
+	if (_dict_attr_children_compile(root, NULL) < 0) return -1;
+
+	return fr_dict_walk(root, _dict_attr_children_compile, NULL);
+}
+
 
 void fr_dict_attr_verify(char const *file, int line, fr_dict_attr_t const *da)
 {
@@ -14,7 +14,7 @@
  *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
  */
 
-/**  Wrapper around libkqueue to make managing events easier
+/**  Wrapper around kqueue, or epoll, to make managing events easier
  *
  * Non-thread-safe event handling specific to FreeRADIUS.
  *
@@ -37,6 +37,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/table.h>
+#include <freeradius-devel/util/timer_wheel.h>
 #include <freeradius-devel/util/token.h>
 #include <freeradius-devel/util/atexit.h>
 
@@ -96,6 +97,112 @@ static size_t kevent_filter_table_len = NUM_ELEMENTS(kevent_filter_table);
 static int log_conf_kq;
 #endif
 
+fr_table_num_sorted_t const fr_event_backend_table[] = {
+	{ L("default"),		FR_EVENT_BACKEND_DEFAULT },
+	{ L("epoll"),		FR_EVENT_BACKEND_EPOLL },
+	{ L("kqueue"),		FR_EVENT_BACKEND_KQUEUE }
+};
+size_t fr_event_backend_table_len = NUM_ELEMENTS(fr_event_backend_table);
+
+/** Backend used by new event lists
+ *
+ * Set once at startup, before any threads are created.
+ */
+static fr_event_backend_t event_backend_default = FR_EVENT_BACKEND_DEFAULT;
+
+/** The kernel interface an event list uses to wait for events
+ *
+ * Everything else in the event list is written in terms of kevent()
+ * change and event lists.  With epoll, they're translated by
+ * fr_event_epoll_kevent().
+ */
+typedef struct {
+	fr_event_backend_t	backend;		//!< Which of the below we're using.
+	int			kq;			//!< kqueue instance.
+#ifdef HAVE_SYS_EPOLL_H
+	fr_event_epoll_t	*ep;			//!< epoll instance.
+#endif
+} event_poll_t;
+
+/** Open a kqueue or epoll instance
+ *
+ * @param[out] poll		to initialise.
+ * @param[in] backend		to use.  Must not be FR_EVENT_BACKEND_DEFAULT.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int event_poll_open(event_poll_t *poll, fr_event_backend_t backend)
+{
+	*poll = (event_poll_t){ .backend = backend, .kq = -1 };
+
+	switch (backend) {
+#ifdef HAVE_KQUEUE
+	case FR_EVENT_BACKEND_KQUEUE:
+		poll->kq = kqueue();
+		return (poll->kq < 0) ? -1 : 0;
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+	case FR_EVENT_BACKEND_EPOLL:
+		poll->ep = fr_event_epoll_alloc(NULL);
+		return poll->ep ? 0 : -1;
+#endif
+
+	default:
+		errno = ENOSYS;
+		return -1;
+	}
+}
+
+/** Close a kqueue or epoll instance
+ *
+ */
+static void event_poll_close(event_poll_t *poll)
+{
+	if (poll->kq >= 0) {
+		close(poll->kq);
+		poll->kq = -1;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	TALLOC_FREE(poll->ep);
+#endif
+}
+
+/** Apply changes and wait for events, the same as kevent()
+ *
+ */
+static inline CC_HINT(always_inline)
+int event_poll_kevent(event_poll_t *poll,
+		      struct kevent const *changes, int num_changes,
+		      struct kevent *events, int num_events,
+		      struct timespec const *timeout)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (poll->ep) return fr_event_epoll_kevent(poll->ep, changes, num_changes, events, num_events, timeout);
+#endif
+
+#ifdef HAVE_KQUEUE
+	return kevent(poll->kq, changes, num_changes, events, num_events, timeout);
+#else
+	errno = EBADF;
+	return -1;
+#endif
+}
+
+/** Return the descriptor which is readable when there are events
+ *
+ */
+static inline int event_poll_fd(event_poll_t const *poll)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (poll->ep) return fr_event_epoll_fd(poll->ep);
+#endif
+
+	return poll->kq;
+}
+
 /** A timer event
  *
  */
@@ -111,6 +218,7 @@ struct fr_event_timer {
 							///< event.
 
 	fr_lst_index_t		lst_id;	     	  	//!< Where to store opaque lst data.
+	fr_timer_wheel_entry_t	wheel_entry;		//!< Where to store opaque timer wheel data.
 	fr_dlist_t		entry;			//!< List of deferred timer events.
 
 	fr_event_list_t		*el;			//!< Event list containing this timer.
@@ -410,6 +518,8 @@ typedef struct {
  */
 struct fr_event_list {
 	fr_lst_t		*times;			//!< of timer events to be executed.
+	fr_timer_wheel_t	*wheel;			//!< of timer events to be executed.  Used instead
+							///< of the lst if set.
 	fr_rb_tree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 
 	int			will_exit;		//!< Will exit on next call to fr_event_corral.
@@ -423,7 +533,7 @@ struct fr_event_list {
 
 	int			num_fd_events;		//!< Number of events in this event list.
 
-	int			kq;			//!< instance associated with this event list.
+	event_poll_t		poll;			//!< kqueue or epoll instance associated with this event list.
 
 	fr_dlist_head_t		pre_callbacks;		//!< callbacks when we may be idle...
 	fr_dlist_head_t		post_callbacks;		//!< post-processing callbacks
@@ -573,6 +683,60 @@ static int8_t fr_event_timer_cmp(void const *a, void const *b)
 	return fr_time_cmp(ev_a->when, ev_b->when);
 }
 
+/** Insert a timer event into the timer lst or wheel
+ *
+ */
+static inline CC_HINT(always_inline) int event_timer_insert(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (el->wheel) return fr_timer_wheel_insert(el->wheel, ev);
+
+	return fr_lst_insert(el->times, ev);
+}
+
+/** Remove a timer event from the timer lst or wheel
+ *
+ */
+static inline CC_HINT(always_inline) int event_timer_extract(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (el->wheel) return fr_timer_wheel_extract(el->wheel, ev);
+
+	return fr_lst_extract(el->times, ev);
+}
+
+/** Return the number of timer events in the timer lst or wheel
+ *
+ */
+static inline CC_HINT(always_inline) unsigned int event_timer_num(fr_event_list_t *el)
+{
+	if (el->wheel) return fr_timer_wheel_num_elements(el->wheel);
+
+	return fr_lst_num_elements(el->times);
+}
+
+/** Return the earliest timer event
+ *
+ * @param[in] el	to return the timer event for.
+ * @param[in] now	The current time.  The timer wheel is only advanced up to
+ *			this time, so may not return an event which fires later.
+ * @param[out] next	When the returned event should fire, or if no event was
+ *			returned, a time before which no event will fire.
+ *			fr_time_wrap(0) if there are no timer events.
+ * @return
+ *	- The earliest timer event.
+ *	- NULL if there are no timer events, or none are due before the next tick of the wheel.
+ */
+static inline CC_HINT(always_inline) fr_event_timer_t *event_timer_peek(fr_event_list_t *el, fr_time_t now, fr_time_t *next)
+{
+	fr_event_timer_t *ev;
+
+	if (el->wheel) return fr_timer_wheel_peek(el->wheel, now, next);
+
+	ev = fr_lst_peek(el->times);
+	*next = ev ? ev->when : fr_time_wrap(0);
+
+	return ev;
+}
+
 /** Compare two file descriptor handles
  *
  * @param[in] one the first file descriptor handle.
@@ -607,10 +771,13 @@ uint64_t fr_event_list_num_timers(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_lst_num_elements(el->times);
+	return event_timer_num(el);
 }
 
 /** Return the kq associated with an event list.
+ *
+ * With the epoll backend, this is the epoll descriptor.  Either way,
+ * it's readable when the event list has events to service.
  *
  * @param[in] el to return timer events for.
  * @return kq
@@ -619,7 +786,47 @@ int fr_event_list_kq(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return el->kq;
+	return event_poll_fd(&el->poll);
+}
+
+/** Return the backend an event list uses
+ *
+ * @param[in] el	to check.
+ * @return FR_EVENT_BACKEND_KQUEUE or FR_EVENT_BACKEND_EPOLL.
+ */
+fr_event_backend_t fr_event_list_backend(fr_event_list_t const *el)
+{
+	return el->poll.backend;
+}
+
+/** Set the backend used by event lists allocated after this call
+ *
+ * Should be called once at startup, before any threads are created.
+ *
+ * @param[in] backend	to use.  FR_EVENT_BACKEND_DEFAULT selects kqueue
+ *			if we were built with it, and epoll otherwise.
+ * @return
+ *	- 0 on success.
+ *	- -1 if we weren't built with that backend.
+ */
+int fr_event_backend_set(fr_event_backend_t backend)
+{
+	switch (backend) {
+	case FR_EVENT_BACKEND_DEFAULT:
+#ifdef HAVE_KQUEUE
+	case FR_EVENT_BACKEND_KQUEUE:
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+	case FR_EVENT_BACKEND_EPOLL:
+#endif
+		event_backend_default = backend;
+		return 0;
+
+	default:
+		fr_strerror_printf("Event backend \"%s\" is not available on this platform",
+				   fr_table_str_by_value(fr_event_backend_table, backend, "<INVALID>"));
+		return -1;
+	}
 }
 
 /** Get the current server time according to the event list
@@ -885,7 +1092,7 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 			/*
 			 *	If this fails, assert on debug builds.
 			 */
-			ret = kevent(el->kq, evset, count, NULL, 0, NULL);
+			ret = event_poll_kevent(&el->poll, evset, count, NULL, 0, NULL);
 			if (!fr_cond_assert_msg(ret >= 0,
 						"FD %i was closed without being removed from the KQ: %s",
 						ef->fd, fr_syserror(errno))) {
@@ -1047,7 +1254,7 @@ int _fr_event_filter_update(NDEBUG_LOCATION_ARGS
 		return -1;
 	}
 
-	if (count && unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+	if (count && unlikely(event_poll_kevent(&el->poll, evset, count, NULL, 0, NULL) < 0)) {
 		fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
 		goto error;
 	}
@@ -1154,7 +1361,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 		count = fr_event_build_evset(el, evset, sizeof(evset)/sizeof(*evset),
 					     &ef->active, ef, funcs, &ef->active);
 		if (count < 0) goto free;
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(event_poll_kevent(&el->poll, evset, count, NULL, 0, NULL) < 0))) {
 			fr_strerror_printf("Failed inserting filters for FD %i: %s", fd, fr_syserror(errno));
 			goto free;
 		}
@@ -1186,7 +1393,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 			memcpy(&ef->active, &active, sizeof(ef->active));
 			return -1;
 		}
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(event_poll_kevent(&el->poll, evset, count, NULL, 0, NULL) < 0))) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto error;
 		}
@@ -1394,7 +1601,7 @@ static int _event_timer_free(fr_event_timer_t *ev)
 	if (fr_dlist_entry_in_list(&ev->entry)) {
 		(void) fr_dlist_remove(&el->ev_to_add, ev);
 	} else {
-		int		ret = fr_lst_extract(el->times, ev);
+		int		ret = event_timer_extract(el, ev);
 		char const	*err_file;
 		int		err_line;
 
@@ -1517,7 +1724,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 			char const	*err_file;
 			int		err_line;
 
-			ret = fr_lst_extract(el->times, ev);
+			ret = event_timer_extract(el, ev);
 
 #ifndef NDEBUG
 			err_file = ev->file;
@@ -1555,7 +1762,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 		 *	multiple times.
 		 */
 		if (!fr_dlist_entry_in_list(&ev->entry)) fr_dlist_insert_head(&el->ev_to_add, ev);
-	} else if (unlikely(fr_lst_insert(el->times, ev) < 0)) {
+	} else if (unlikely(event_timer_insert(el, ev) < 0)) {
 		fr_strerror_const_push("Failed inserting event");
 		talloc_set_destructor(ev, NULL);
 		*ev_p = NULL;
@@ -1644,7 +1851,7 @@ static int _event_pid_free(fr_event_pid_t *ev)
 
 	EV_SET(&evset, ev->pid, EVFILT_PROC, EV_DELETE, NOTE_EXIT, 0, ev);
 
-	(void) kevent(ev->el->kq, &evset, 1, NULL, 0, NULL);
+	(void) event_poll_kevent(&ev->el->poll, &evset, 1, NULL, 0, NULL);
 
 	return 0;
 }
@@ -1778,7 +1985,7 @@ int _fr_event_pid_wait(NDEBUG_LOCATION_ARGS
 	 *	waitid to see if there is a pending process and
 	 *	then call the callback as kqueue would have done.
 	 */
-	if (unlikely(kevent(el->kq, &evset, 1, NULL, 0, NULL) < 0)) {
+	if (unlikely(event_poll_kevent(&el->poll, &evset, 1, NULL, 0, NULL) < 0)) {
     		siginfo_t	info;
 		int ret;
 
@@ -2008,10 +2215,10 @@ unsigned int fr_event_list_reap_signal(fr_event_list_t *el, fr_time_delta_t time
 		int		status;
 		struct kevent	evset;
 		int		waiting = 0;
-		int 		kq = kqueue();
+		event_poll_t	poll;
 		fr_time_t	now, start = el->time(), end = fr_time_add(start, timeout);
 
-		if (unlikely(kq < 0)) goto force;
+		if (unlikely(event_poll_open(&poll, el->poll.backend) < 0)) goto force;
 
 		fr_dlist_foreach_safe(&el->pid_to_reap, fr_event_pid_reap_t, i) {
 			if (!i->pid_ev) {
@@ -2038,7 +2245,7 @@ unsigned int fr_event_list_reap_signal(fr_event_list_t *el, fr_time_delta_t time
 			 *	Add the rest to a temporary event loop
 			 */
 			EV_SET(&evset, i->pid_ev->pid, EVFILT_PROC, EV_ADD, NOTE_EXIT, 0, i);
-			if (kevent(kq, &evset, 1, NULL, 0, NULL) < 0) {
+			if (event_poll_kevent(&poll, &evset, 1, NULL, 0, NULL) < 0) {
 				EVENT_DEBUG("%p - %s - Failed adding reaper PID %u to tmp event loop - %p",
 					    el, __FUNCTION__, i->pid_ev->pid, i);
 				event_list_reap_run_callback(i, i->pid_ev->pid, SIGKILL);
@@ -2055,18 +2262,18 @@ unsigned int fr_event_list_reap_signal(fr_event_list_t *el, fr_time_delta_t time
 			struct kevent	kev;
 			int		ret;
 
-			ret = kevent(kq, NULL, 0, &kev, 1, &fr_time_delta_to_timespec(fr_time_sub(end, now)));
+			ret = event_poll_kevent(&poll, NULL, 0, &kev, 1, &fr_time_delta_to_timespec(fr_time_sub(end, now)));
 			switch (ret) {
 			default:
 				EVENT_DEBUG("%p - %s - Reaper tmp loop error %s, forcing process reaping",
 					    el, __FUNCTION__, fr_syserror(errno));
-				close(kq);
+				event_poll_close(&poll);
 				goto force;
 
 			case 0:
 				EVENT_DEBUG("%p - %s - Reaper timeout waiting for process exit, forcing process reaping",
 					    el, __FUNCTION__);
-				close(kq);
+				event_poll_close(&poll);
 				goto force;
 
 			case 1:
@@ -2083,7 +2290,7 @@ unsigned int fr_event_list_reap_signal(fr_event_list_t *el, fr_time_delta_t time
 			waiting--;
 		}
 
-		close(kq);
+		event_poll_close(&poll);
 	}
 
 force:
@@ -2138,7 +2345,7 @@ static int _event_user_delete(fr_event_user_t *ev)
 
 		EV_SET(&evset, (uintptr_t)ev, EVFILT_USER, EV_DELETE, 0, 0, 0);
 
-		if (unlikely(kevent(ev->el->kq, &evset, 1, NULL, 0, NULL) < 0)) {
+		if (unlikely(event_poll_kevent(&ev->el->poll, &evset, 1, NULL, 0, NULL) < 0)) {
 			fr_strerror_printf("Failed removing user event - kevent %s", fr_syserror(evset.flags));
 			return -1;
 		}
@@ -2202,7 +2409,7 @@ int _fr_event_user_insert(NDEBUG_LOCATION_ARGS
 	EV_SET(&evset, (uintptr_t)ev,
 	       EVFILT_USER, EV_ADD | EV_DISPATCH, (trigger * NOTE_TRIGGER), 0, ev);
 
-	if (unlikely(kevent(el->kq, &evset, 1, NULL, 0, NULL) < 0)) {
+	if (unlikely(event_poll_kevent(&el->poll, &evset, 1, NULL, 0, NULL) < 0)) {
 		fr_strerror_printf("Failed adding user event - kevent %s", fr_syserror(evset.flags));
 		talloc_free(ev);
 		return -1;
@@ -2229,7 +2436,7 @@ int fr_event_user_trigger(fr_event_list_t *el, fr_event_user_t *ev)
 
 	EV_SET(&evset, (uintptr_t)ev, EVFILT_USER, EV_ENABLE, NOTE_TRIGGER, 0, NULL);
 
-	if (unlikely(kevent(el->kq, &evset, 1, NULL, 0, NULL) < 0)) {
+	if (unlikely(event_poll_kevent(&el->poll, &evset, 1, NULL, 0, NULL) < 0)) {
 		fr_strerror_printf("Failed triggering user event - kevent %s", fr_syserror(evset.flags));
 		return -1;
 	}
@@ -2358,17 +2565,13 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 	fr_event_timer_cb_t	callback;
 	void			*uctx;
 	fr_event_timer_t	*ev;
+	fr_time_t		next;
 
 	if (unlikely(!el)) return 0;
 
-	if (fr_lst_num_elements(el->times) == 0) {
-		*when = fr_time_wrap(0);
-		return 0;
-	}
-
-	ev = fr_lst_peek(el->times);
+	ev = event_timer_peek(el, *when, &next);
 	if (!ev) {
-		*when = fr_time_wrap(0);
+		*when = next;
 		return 0;
 	}
 
@@ -2412,6 +2615,7 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	int			num_fd_events;
 	bool			timer_event_ready = false;
 	fr_event_timer_t	*ev;
+	fr_time_t		next;
 
 	el->num_fd_events = 0;
 
@@ -2435,13 +2639,13 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	events are in the past.  Or, we wait for a future
 	 *	timer event.
 	 */
-	ev = fr_lst_peek(el->times);
-	if (ev) {
-		if (fr_time_lteq(ev->when, el->now)) {
+	ev = event_timer_peek(el, el->now, &next);
+	if (ev || fr_time_ispos(next)) {
+		if (fr_time_lteq(next, el->now)) {
 			timer_event_ready = true;
 
 		} else if (wait) {
-			when = fr_time_sub(ev->when, el->now);
+			when = fr_time_sub(next, el->now);
 
 		} /* else we're not waiting, leave "when == 0" */
 
@@ -2489,7 +2693,7 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	that occurred since this function was last called
 	 *	or wait for the next timer event.
 	 */
-	num_fd_events = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
+	num_fd_events = event_poll_kevent(&el->poll, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
 
 	/*
 	 *	Interrupt is different from timeout / FD events.
@@ -2684,7 +2888,7 @@ void fr_event_service(fr_event_list_t *el)
 	 *	Run all of the timer events.  Note that these can add
 	 *	new timers!
 	 */
-	if (fr_lst_num_elements(el->times) > 0) {
+	if (event_timer_num(el) > 0) {
 		el->in_handler = true;
 
 		do {
@@ -2710,7 +2914,7 @@ void fr_event_service(fr_event_list_t *el)
 	 */
 	while ((ev = fr_dlist_head(&el->ev_to_add)) != NULL) {
 		(void)fr_dlist_remove(&el->ev_to_add, ev);
-		if (unlikely(fr_lst_insert(el->times, ev) < 0)) {
+		if (unlikely(event_timer_insert(el, ev) < 0)) {
 			talloc_free(ev);
 			fr_assert_msg(0, "failed inserting lst event: %s", fr_strerror());	/* Die in debug builds */
 		}
@@ -2788,13 +2992,19 @@ static int _event_list_free(fr_event_list_t *el)
 {
 	fr_event_timer_t const *ev;
 
-	while ((ev = fr_lst_peek(el->times)) != NULL) fr_event_timer_delete(&ev);
+	if (el->wheel) {
+		fr_timer_wheel_iter_t	iter;
+
+		while ((ev = fr_timer_wheel_iter_init(el->wheel, &iter)) != NULL) fr_event_timer_delete(&ev);
+	} else {
+		while ((ev = fr_lst_peek(el->times)) != NULL) fr_event_timer_delete(&ev);
+	}
 
 	fr_event_list_reap_signal(el, fr_time_delta_wrap(0), SIGKILL);
 
 	talloc_free_children(el);
 
-	if (el->kq >= 0) close(el->kq);
+	event_poll_close(&el->poll);
 
 	return 0;
 }
@@ -2893,6 +3103,7 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 {
 	fr_event_list_t		*el;
 	struct kevent		kev;
+	fr_event_backend_t	backend;
 	int			ret;
 
 	/*
@@ -2910,7 +3121,7 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		return NULL;
 	}
 	el->time = fr_time;
-	el->kq = -1;	/* So destructor can be used before kqueue() provides us with fd */
+	el->poll.kq = -1;	/* So destructor can be used before kqueue() provides us with fd */
 	talloc_set_destructor(el, _event_list_free);
 
 	el->times = fr_lst_talloc_alloc(el, fr_event_timer_cmp, fr_event_timer_t, lst_id, 0);
@@ -2927,9 +3138,18 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		goto error;
 	}
 
-	el->kq = kqueue();
-	if (el->kq < 0) {
-		fr_strerror_printf("Failed allocating kqueue: %s", fr_syserror(errno));
+	backend = event_backend_default;
+	if (backend == FR_EVENT_BACKEND_DEFAULT) {
+#ifdef HAVE_KQUEUE
+		backend = FR_EVENT_BACKEND_KQUEUE;
+#else
+		backend = FR_EVENT_BACKEND_EPOLL;
+#endif
+	}
+
+	if (event_poll_open(&el->poll, backend) < 0) {
+		fr_strerror_printf("Failed allocating %s instance: %s",
+				   fr_table_str_by_value(fr_event_backend_table, backend, "<INVALID>"), fr_syserror(errno));
 		goto error;
 	}
 
@@ -2944,8 +3164,8 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 	 *	Set our "exit" callback as ident 0.
 	 */
 	EV_SET(&kev, 0, EVFILT_USER, EV_ADD | EV_CLEAR, NOTE_FFNOP, 0, NULL);
-	if (kevent(el->kq, &kev, 1, NULL, 0, NULL) < 0) {
-		fr_strerror_printf("Failed adding exit callback to kqueue: %s", fr_syserror(errno));
+	if (event_poll_kevent(&el->poll, &kev, 1, NULL, 0, NULL) < 0) {
+		fr_strerror_printf("Failed adding exit callback: %s", fr_syserror(errno));
 		goto error;
 	}
 
@@ -2956,6 +3176,58 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 	return el;
 }
 
+/** Switch an event list to using a hierarchical timer wheel for timer events
+ *
+ * The default lst costs O(log n) for every insert and delete.  The timer
+ * wheel makes inserting and deleting timer events O(1), at the cost of a
+ * fixed amount of memory per event list.  It's most useful for event lists
+ * with very large numbers of timer events, most of which are deleted before
+ * they fire.
+ *
+ * Any existing timer events are moved into the wheel.
+ *
+ * @param[in] el		to switch.
+ * @param[in] resolution	of the wheel.  Timer events are still run in
+ *				order, and never before they're due.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_event_list_timer_wheel(fr_event_list_t *el, fr_time_delta_t resolution)
+{
+	fr_timer_wheel_t	*wheel;
+	fr_timer_wheel_iter_t	iter;
+	fr_event_timer_t	*ev;
+
+	if (el->wheel) return 0;
+
+	if (unlikely(el->in_handler)) {
+		fr_strerror_const("Can't change the timer backend whilst running timer events");
+		return -1;
+	}
+
+	wheel = fr_timer_wheel_talloc_alloc(el, fr_event_timer_cmp, fr_event_timer_t, when, wheel_entry, resolution);
+	if (unlikely(!wheel)) return -1;
+
+	while ((ev = fr_lst_pop(el->times)) != NULL) {
+		if (unlikely(fr_timer_wheel_insert(wheel, ev) < 0)) {
+			/*
+			 *	Put everything back
+			 */
+			(void) fr_lst_insert(el->times, ev);
+			while ((ev = fr_timer_wheel_iter_init(wheel, &iter)) != NULL) {
+				(void) fr_timer_wheel_extract(wheel, ev);
+				(void) fr_lst_insert(el->times, ev);
+			}
+			talloc_free(wheel);
+			return -1;
+		}
+	}
+	el->wheel = wheel;
+
+	return 0;
+}
+
 /** Override event list time source
  *
  * @param[in] el	to set new time function for.
@@ -2971,7 +3243,7 @@ void fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t fun
  */
 bool fr_event_list_empty(fr_event_list_t *el)
 {
-	return !fr_lst_num_elements(el->times) && !fr_rb_num_elements(el->fds);
+	return !event_timer_num(el) && !fr_rb_num_elements(el->fds);
 }
 
 #ifdef WITH_EVENT_DEBUG
@@ -2993,6 +3265,25 @@ static const char *decade_names[18] = {
 	"1Ms", "10Ms", "100Ms",	/* 1 year is 300Ms */
 };
 
+typedef struct {
+	fr_lst_iter_t		lst;
+	fr_timer_wheel_iter_t	wheel;
+} event_timer_iter_t;
+
+static fr_event_timer_t *event_timer_iter_init(fr_event_list_t *el, event_timer_iter_t *iter)
+{
+	if (el->wheel) return fr_timer_wheel_iter_init(el->wheel, &iter->wheel);
+
+	return fr_lst_iter_init(el->times, &iter->lst);
+}
+
+static fr_event_timer_t *event_timer_iter_next(fr_event_list_t *el, event_timer_iter_t *iter)
+{
+	if (el->wheel) return fr_timer_wheel_iter_next(el->wheel, &iter->wheel);
+
+	return fr_lst_iter_next(el->times, &iter->lst);
+}
+
 typedef struct {
 	fr_rb_node_t	node;
 	char const	*file;
@@ -3016,7 +3307,7 @@ static int8_t event_timer_location_cmp(void const *one, void const *two)
  */
 void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 {
-	fr_lst_iter_t		iter;
+	event_timer_iter_t	iter;
 	fr_event_timer_t const	*ev;
 	size_t			i;
 
@@ -3042,9 +3333,9 @@ void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 	 *	Show which events are due, when they're due,
 	 *	and where they were allocated
 	 */
-	for (ev = fr_lst_iter_init(el->times, &iter);
+	for (ev = event_timer_iter_init(el, &iter);
 	     ev != NULL;
-	     ev = fr_lst_iter_next(el->times, &iter)) {
+	     ev = event_timer_iter_next(el, &iter)) {
 		fr_time_delta_t diff = fr_time_sub(ev->when, now);
 
 		for (i = 0; i < NUM_ELEMENTS(decades); i++) {
@@ -3108,7 +3399,7 @@ void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 #ifndef NDEBUG
 void fr_event_timer_dump(fr_event_list_t *el)
 {
-	fr_lst_iter_t		iter;
+	event_timer_iter_t	iter;
 	fr_event_timer_t 	*ev;
 	fr_time_t		now;
 
@@ -3116,9 +3407,9 @@ void fr_event_timer_dump(fr_event_list_t *el)
 
 	EVENT_DEBUG("Time is now %"PRId64"", fr_time_unwrap(now));
 
-	for (ev = fr_lst_iter_init(el->times, &iter);
+	for (ev = event_timer_iter_init(el, &iter);
 	     ev;
-	     ev = fr_lst_iter_next(el->times, &iter)) {
+	     ev = event_timer_iter_next(el, &iter)) {
 		(void)talloc_get_type_abort(ev, fr_event_timer_t);
 		EVENT_DEBUG("%s[%u]: %p time=%" PRId64 " (%c), callback=%p",
 			    ev->file, ev->line, ev, fr_time_unwrap(ev->when),
@@ -32,9 +32,10 @@ extern "C" {
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/table.h>
+#include <freeradius-devel/util/event_epoll.h>
 
 #include <stdbool.h>
-#include <sys/event.h>
 
 /** An opaque file descriptor handle
  */
@@ -56,6 +57,17 @@ typedef struct fr_event_pid fr_event_pid_t;
  */
 typedef struct fr_event_user_s fr_event_user_t;
 
+/** The kernel interface used to wait for events
+ */
+typedef enum {
+	FR_EVENT_BACKEND_DEFAULT = 0,		//!< kqueue if available, otherwise epoll.
+	FR_EVENT_BACKEND_KQUEUE,		//!< kqueue, or libkqueue.
+	FR_EVENT_BACKEND_EPOLL			//!< Native epoll, Linux only.
+} fr_event_backend_t;
+
+extern fr_table_num_sorted_t const fr_event_backend_table[];
+extern size_t fr_event_backend_table_len;
+
 /** The type of filter to install for an FD
  */
 typedef enum {
@@ -203,6 +215,7 @@ typedef union {
 uint64_t	fr_event_list_num_fds(fr_event_list_t *el);
 uint64_t	fr_event_list_num_timers(fr_event_list_t *el);
 int		fr_event_list_kq(fr_event_list_t *el);
+fr_event_backend_t fr_event_list_backend(fr_event_list_t const *el) CC_HINT(nonnull);
 fr_time_t	fr_event_list_time(fr_event_list_t *el) CC_HINT(nonnull);
 
 int		_fr_event_fd_move(NDEBUG_LOCATION_ARGS
@@ -297,7 +310,11 @@ void		fr_event_loop_exit(fr_event_list_t *el, int code);
 bool		fr_event_loop_exiting(fr_event_list_t *el);
 int		fr_event_loop(fr_event_list_t *el);
 
+int		fr_event_backend_set(fr_event_backend_t backend);
+
 fr_event_list_t	*fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t status, void *status_ctx);
+
+int		fr_event_list_timer_wheel(fr_event_list_t *el, fr_time_delta_t resolution) CC_HINT(nonnull);
 void		fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t func);
 
 bool		fr_event_list_empty(fr_event_list_t *el);
@@ -0,0 +1,986 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Native epoll backend for event lists
+ *
+ * Implements the kevent() filters which event lists use:
+ *
+ * - EVFILT_READ and EVFILT_WRITE are level triggered epoll events.
+ *   Changes are recorded against each file descriptor, and applied
+ *   with one epoll_ctl() call per descriptor, however many filters
+ *   changed.  Regular files can't be added to an epoll set, so they
+ *   are checked on each call instead, as kqueue does.
+ * - EVFILT_USER events are held in a list, and returned without
+ *   waiting when they're triggered.
+ * - EVFILT_PROC NOTE_EXIT uses a pidfd for each process.
+ * - EVFILT_VNODE uses a single inotify instance.
+ *
+ * @file src/lib/util/event_epoll.c
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/event_epoll.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/strerror.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define EPOLL_MAX_EVENTS	256		//!< Most events we read from the kernel at once.
+
+/*
+ *	The epoll data for each descriptor records what it is, so we
+ *	only need to look up the descriptors the caller gave us.
+ */
+typedef enum {
+	EPOLL_TYPE_FD = 0,			//!< A descriptor the caller asked us to watch.
+	EPOLL_TYPE_PROC,			//!< A pidfd, for EVFILT_PROC.
+	EPOLL_TYPE_INOTIFY			//!< Our inotify instance, for EVFILT_VNODE.
+} epoll_type_t;
+
+#define EPOLL_DATA(_type, _fd)		(((uint64_t)(_type) << 32) | (uint32_t)(_fd))
+#define EPOLL_DATA_TYPE(_data)		((epoll_type_t)((_data) >> 32))
+#define EPOLL_DATA_FD(_data)		((int)((_data) & 0xffffffff))
+
+#define EPOLL_READ			0
+#define EPOLL_WRITE			1
+
+/** State for one file descriptor
+ *
+ */
+typedef struct {
+	int			fd;			//!< The descriptor.
+
+	bool			added[2];		//!< EVFILT_READ, EVFILT_WRITE have been added.
+	bool			enabled[2];		//!< and they're enabled.
+	void			*udata[2];		//!< To return with each event.
+
+	uint32_t		registered;		//!< Events which are in the epoll set.
+	bool			regular;		//!< epoll can't watch this descriptor.
+	bool			added_again;		//!< A filter was added, so check the epoll set
+							///< really has the descriptor.
+
+	fr_dlist_t		changed_entry;		//!< In the list of descriptors to update.
+	fr_dlist_t		regular_entry;		//!< In the list of descriptors we check ourselves.
+
+	int			wd;			//!< inotify watch descriptor, or -1.
+	uint32_t		vnode_fflags;		//!< NOTE_* flags the caller wants.
+	uint32_t		vnode_pending;		//!< NOTE_* flags we've seen, but not returned.
+	nlink_t			vnode_nlink;		//!< Link count when we last looked.
+	void			*vnode_udata;		//!< To return with each vnode event.
+	fr_dlist_t		vnode_entry;		//!< In the list of watched vnodes.
+} epoll_fd_t;
+
+/** A process we're waiting to exit
+ *
+ */
+typedef struct {
+	pid_t			pid;			//!< The process.
+	int			pidfd;			//!< Which becomes readable when it exits.
+	void			*udata;			//!< To return with the event.
+	fr_dlist_t		entry;			//!< In the list of processes.
+} epoll_proc_t;
+
+/** A user event
+ *
+ */
+typedef struct {
+	uintptr_t		ident;			//!< Identifier the caller gave us.
+	uint16_t		flags;			//!< EV_CLEAR, EV_DISPATCH, EV_ONESHOT.
+	bool			enabled;		//!< Whether the event can be returned.
+	bool			triggered;		//!< Whether the event has been triggered.
+	void			*udata;			//!< To return with the event.
+	fr_dlist_t		entry;			//!< In the list of user events.
+} epoll_user_t;
+
+struct fr_event_epoll_s {
+	int			epfd;			//!< The epoll instance.
+
+	epoll_fd_t		**fds;			//!< Indexed by descriptor.
+	unsigned int		num_fds;		//!< Size of the fds array.
+
+	fr_dlist_head_t		changed;		//!< Descriptors which need epoll_ctl() calls.
+	fr_dlist_head_t		regular;		//!< Regular files, which we check ourselves.
+
+	int			ifd;			//!< inotify instance, or -1.
+	fr_dlist_head_t		vnodes;			//!< Descriptors with EVFILT_VNODE filters.
+
+	fr_dlist_head_t		procs;			//!< Processes we're waiting for.
+	fr_dlist_head_t		users;			//!< User events.
+	unsigned int		num_triggered;		//!< Number of user events which are triggered.
+
+	struct epoll_event	ready[EPOLL_MAX_EVENTS];	//!< Events returned by the kernel.
+};
+
+static int _event_epoll_free(fr_event_epoll_t *ep)
+{
+	unsigned int i;
+
+	for (i = 0; i < ep->num_fds; i++) {
+		if (ep->fds[i] && (ep->fds[i]->wd >= 0)) (void) inotify_rm_watch(ep->ifd, ep->fds[i]->wd);
+	}
+
+	fr_dlist_foreach(&ep->procs, epoll_proc_t, proc) close(proc->pidfd);
+
+	if (ep->ifd >= 0) close(ep->ifd);
+	if (ep->epfd >= 0) close(ep->epfd);
+
+	return 0;
+}
+
+/** Allocate a new epoll instance
+ *
+ * @param[in] ctx	to allocate it in.
+ * @return
+ *	- A new instance, free it with talloc_free().
+ *	- NULL on error.
+ */
+fr_event_epoll_t *fr_event_epoll_alloc(TALLOC_CTX *ctx)
+{
+	fr_event_epoll_t *ep;
+
+	ep = talloc_zero(ctx, fr_event_epoll_t);
+	if (unlikely(!ep)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	ep->ifd = -1;
+
+	fr_dlist_init(&ep->changed, epoll_fd_t, changed_entry);
+	fr_dlist_init(&ep->regular, epoll_fd_t, regular_entry);
+	fr_dlist_init(&ep->vnodes, epoll_fd_t, vnode_entry);
+	fr_dlist_talloc_init(&ep->procs, epoll_proc_t, entry);
+	fr_dlist_talloc_init(&ep->users, epoll_user_t, entry);
+
+	ep->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (ep->epfd < 0) {
+		talloc_free(ep);
+		return NULL;
+	}
+	talloc_set_destructor(ep, _event_epoll_free);
+
+	return ep;
+}
+
+/** Return the epoll descriptor, which is readable when there are events
+ *
+ */
+int fr_event_epoll_fd(fr_event_epoll_t const *ep)
+{
+	return ep->epfd;
+}
+
+/** Find the state for a descriptor, optionally creating it
+ *
+ */
+static epoll_fd_t *epoll_fd_find(fr_event_epoll_t *ep, uintptr_t ident, bool create)
+{
+	epoll_fd_t	*efd;
+	int		fd;
+
+	if (ident > INT_MAX) {
+		errno = EBADF;
+		return NULL;
+	}
+	fd = (int) ident;
+
+	if (((unsigned int) fd < ep->num_fds) && ep->fds[fd]) return ep->fds[fd];
+
+	if (!create) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	if ((unsigned int) fd >= ep->num_fds) {
+		epoll_fd_t	**fds;
+		unsigned int	num = ep->num_fds ? ep->num_fds : 64;
+
+		while (num <= (unsigned int) fd) num <<= 1;
+
+		fds = talloc_realloc(ep, ep->fds, epoll_fd_t *, num);
+		if (unlikely(!fds)) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		memset(fds + ep->num_fds, 0, sizeof(fds[0]) * (num - ep->num_fds));
+		ep->fds = fds;
+		ep->num_fds = num;
+	}
+
+	efd = talloc_zero(ep->fds, epoll_fd_t);
+	if (unlikely(!efd)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	efd->fd = fd;
+	efd->wd = -1;
+	fr_dlist_entry_init(&efd->changed_entry);
+	fr_dlist_entry_init(&efd->regular_entry);
+	fr_dlist_entry_init(&efd->vnode_entry);
+
+	ep->fds[fd] = efd;
+
+	return efd;
+}
+
+/** Free the state for a descriptor if it has no more filters
+ *
+ */
+static void epoll_fd_release(fr_event_epoll_t *ep, epoll_fd_t *efd)
+{
+	if (efd->added[EPOLL_READ] || efd->added[EPOLL_WRITE] || (efd->wd >= 0)) return;
+	if (fr_dlist_entry_in_list(&efd->changed_entry)) return;
+
+	if (fr_dlist_entry_in_list(&efd->regular_entry)) fr_dlist_remove(&ep->regular, efd);
+
+	ep->fds[efd->fd] = NULL;
+	talloc_free(efd);
+}
+
+/** Record a change to EVFILT_READ or EVFILT_WRITE
+ *
+ * The change is only made in the epoll set when all changes have been recorded.
+ */
+static int epoll_io_change(fr_event_epoll_t *ep, struct kevent const *kev)
+{
+	epoll_fd_t	*efd;
+	int		i = (kev->filter == EVFILT_READ) ? EPOLL_READ : EPOLL_WRITE;
+
+	efd = epoll_fd_find(ep, kev->ident, (kev->flags & EV_ADD) != 0);
+	if (!efd) return -1;
+
+	if (kev->flags & EV_DELETE) {
+		if (!efd->added[i]) {
+			errno = ENOENT;
+			return -1;
+		}
+		efd->added[i] = false;
+		efd->enabled[i] = false;
+		efd->udata[i] = NULL;
+
+	} else {
+		if (kev->flags & EV_ADD) {
+			efd->added[i] = true;
+			efd->enabled[i] = true;
+			efd->udata[i] = kev->udata;
+			efd->added_again = true;
+
+		} else if (!efd->added[i]) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		if (kev->flags & EV_ENABLE) efd->enabled[i] = true;
+		if (kev->flags & EV_DISABLE) efd->enabled[i] = false;
+	}
+
+	if (!fr_dlist_entry_in_list(&efd->changed_entry)) fr_dlist_insert_tail(&ep->changed, efd);
+
+	return 0;
+}
+
+/** Make one epoll_ctl() call for each descriptor which changed
+ *
+ */
+static int epoll_io_apply(fr_event_epoll_t *ep)
+{
+	epoll_fd_t	*efd;
+	int		ret = 0;
+
+	while ((efd = fr_dlist_pop_head(&ep->changed))) {
+		struct epoll_event	event = { .data.u64 = EPOLL_DATA(EPOLL_TYPE_FD, efd->fd) };
+		uint32_t		want = 0;
+		bool			added_again;
+		int			op;
+
+		if (efd->added[EPOLL_READ] && efd->enabled[EPOLL_READ]) want |= EPOLLIN | EPOLLRDHUP;
+		if (efd->added[EPOLL_WRITE] && efd->enabled[EPOLL_WRITE]) want |= EPOLLOUT;
+
+		/*
+		 *	Closing a descriptor removes it from the epoll
+		 *	set, so if a filter is added to a descriptor we
+		 *	already know about, it may be a new descriptor
+		 *	with the same number.
+		 */
+		added_again = efd->added_again;
+		efd->added_again = false;
+
+		if (added_again && efd->regular) {
+			efd->regular = false;
+			if (fr_dlist_entry_in_list(&efd->regular_entry)) fr_dlist_remove(&ep->regular, efd);
+		}
+
+		/*
+		 *	We check regular files ourselves.
+		 */
+		if (efd->regular) {
+			if (!want && fr_dlist_entry_in_list(&efd->regular_entry)) fr_dlist_remove(&ep->regular, efd);
+			if (want && !fr_dlist_entry_in_list(&efd->regular_entry)) fr_dlist_insert_tail(&ep->regular, efd);
+			goto next;
+		}
+
+		if ((want == efd->registered) && (!added_again || !want)) goto next;
+
+		if (!want) {
+			op = EPOLL_CTL_DEL;
+		} else if (!efd->registered) {
+			op = EPOLL_CTL_ADD;
+		} else {
+			op = EPOLL_CTL_MOD;
+		}
+		event.events = want;
+
+		if ((epoll_ctl(ep->epfd, op, efd->fd, &event) < 0) &&
+		    !((op == EPOLL_CTL_MOD) && (errno == ENOENT) && (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, efd->fd, &event) == 0))) {
+			/*
+			 *	Regular files are always readable and
+			 *	writable, so epoll won't take them.
+			 */
+			if ((op == EPOLL_CTL_ADD) && (errno == EPERM)) {
+				efd->regular = true;
+				fr_dlist_insert_tail(&ep->regular, efd);
+				goto next;
+			}
+
+			/*
+			 *	Keep going, so that the other changes are
+			 *	made, but report the error.
+			 */
+			ret = -1;
+			if (op != EPOLL_CTL_DEL) goto next;
+			want = 0;
+		}
+		efd->registered = want;
+
+	next:
+		epoll_fd_release(ep, efd);
+	}
+
+	return ret;
+}
+
+/** Map kevent NOTE_* flags to the inotify events which produce them
+ *
+ */
+static uint32_t epoll_vnode_mask(uint32_t fflags)
+{
+	uint32_t mask = IN_DELETE_SELF;
+
+	if (fflags & (NOTE_DELETE | NOTE_ATTRIB | NOTE_LINK)) mask |= IN_ATTRIB;
+	if (fflags & (NOTE_WRITE | NOTE_EXTEND)) mask |= IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+	if (fflags & NOTE_RENAME) mask |= IN_MOVE_SELF;
+#ifdef NOTE_REVOKE
+	if (fflags & NOTE_REVOKE) mask |= IN_UNMOUNT;
+#endif
+
+	return mask;
+}
+
+/** Add, or delete an EVFILT_VNODE filter
+ *
+ */
+static int epoll_vnode_change(fr_event_epoll_t *ep, struct kevent const *kev)
+{
+	epoll_fd_t	*efd;
+	char		path[64];
+	struct stat	buf;
+
+	efd = epoll_fd_find(ep, kev->ident, (kev->flags & EV_ADD) != 0);
+	if (!efd) return -1;
+
+	if (kev->flags & EV_DELETE) {
+		if (efd->wd < 0) {
+			errno = ENOENT;
+			return -1;
+		}
+		(void) inotify_rm_watch(ep->ifd, efd->wd);
+		efd->wd = -1;
+		efd->vnode_pending = 0;
+		fr_dlist_remove(&ep->vnodes, efd);
+		epoll_fd_release(ep, efd);
+		return 0;
+	}
+
+	if (ep->ifd < 0) {
+		struct epoll_event event = { .events = EPOLLIN, .data.u64 = EPOLL_DATA(EPOLL_TYPE_INOTIFY, 0) };
+
+		ep->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (ep->ifd < 0) goto error;
+
+		if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, ep->ifd, &event) < 0) {
+			close(ep->ifd);
+			ep->ifd = -1;
+			goto error;
+		}
+	}
+
+	if (fstat(efd->fd, &buf) < 0) goto error;
+
+	/*
+	 *	inotify watches paths, not descriptors.  The
+	 *	/proc link resolves to the file the descriptor
+	 *	refers to, so we watch the same inode that kqueue
+	 *	would.
+	 */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", efd->fd);
+	efd->wd = inotify_add_watch(ep->ifd, path, epoll_vnode_mask(kev->fflags));
+	if (efd->wd < 0) goto error;
+
+	efd->vnode_fflags = kev->fflags;
+	efd->vnode_nlink = buf.st_nlink;
+	efd->vnode_udata = kev->udata;
+	if (!fr_dlist_entry_in_list(&efd->vnode_entry)) fr_dlist_insert_tail(&ep->vnodes, efd);
+
+	return 0;
+
+error:
+	epoll_fd_release(ep, efd);
+	return -1;
+}
+
+/** Read the inotify events, and record which NOTE_* flags they map to
+ *
+ */
+static void epoll_vnode_read(fr_event_epoll_t *ep)
+{
+	uint8_t	buffer[4096] CC_HINT(aligned(__alignof__(struct inotify_event)));
+	ssize_t	len;
+
+	while ((len = read(ep->ifd, buffer, sizeof(buffer))) > 0) {
+		uint8_t *p = buffer;
+
+		while (p < (buffer + len)) {
+			struct inotify_event const	*ie = (struct inotify_event const *) p;
+			uint32_t			fflags = 0;
+
+			p += sizeof(*ie) + ie->len;
+
+			fr_dlist_foreach(&ep->vnodes, epoll_fd_t, efd) {
+				struct stat buf;
+
+				if (efd->wd != ie->wd) continue;
+
+				if (ie->mask & IN_MODIFY) fflags |= NOTE_WRITE | NOTE_EXTEND;
+				if (ie->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) fflags |= NOTE_WRITE;
+				if (ie->mask & IN_DELETE_SELF) fflags |= NOTE_DELETE;
+				if (ie->mask & IN_MOVE_SELF) fflags |= NOTE_RENAME;
+#ifdef NOTE_REVOKE
+				if (ie->mask & IN_UNMOUNT) fflags |= NOTE_REVOKE;
+#endif
+
+				/*
+				 *	Unlinking a file we have open only
+				 *	changes its link count.
+				 */
+				if (ie->mask & IN_ATTRIB) {
+					fflags |= NOTE_ATTRIB;
+
+					if ((fstat(efd->fd, &buf) == 0) && (buf.st_nlink != efd->vnode_nlink)) {
+						fflags |= NOTE_LINK;
+						if (buf.st_nlink == 0) fflags |= NOTE_DELETE;
+						efd->vnode_nlink = buf.st_nlink;
+					}
+				}
+
+				efd->vnode_pending |= fflags & efd->vnode_fflags;
+				break;
+			}
+		}
+	}
+}
+
+/** Add, or delete an EVFILT_PROC filter
+ *
+ */
+static int epoll_proc_change(fr_event_epoll_t *ep, struct kevent const *kev)
+{
+	epoll_proc_t		*proc;
+	struct epoll_event	event = { .events = EPOLLIN };
+
+	fr_dlist_foreach(&ep->procs, epoll_proc_t, p) {
+		if (p->pid != (pid_t) kev->ident) continue;
+
+		if (kev->flags & EV_DELETE) {
+			(void) epoll_ctl(ep->epfd, EPOLL_CTL_DEL, p->pidfd, NULL);
+			close(p->pidfd);
+			fr_dlist_remove(&ep->procs, p);
+			talloc_free(p);
+			return 0;
+		}
+
+		p->udata = kev->udata;
+		return 0;
+	}
+
+	if (!(kev->flags & EV_ADD)) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (!(kev->fflags & NOTE_EXIT)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	proc = talloc_zero(ep, epoll_proc_t);
+	if (unlikely(!proc)) {
+		errno = ENOMEM;
+		return -1;
+	}
+	proc->pid = (pid_t) kev->ident;
+	proc->udata = kev->udata;
+
+#ifdef SYS_pidfd_open
+	proc->pidfd = syscall(SYS_pidfd_open, proc->pid, 0);
+#else
+	proc->pidfd = -1;
+	errno = ENOSYS;
+#endif
+	if (proc->pidfd < 0) {
+		talloc_free(proc);
+		return -1;
+	}
+
+	event.data.u64 = EPOLL_DATA(EPOLL_TYPE_PROC, proc->pidfd);
+	if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, proc->pidfd, &event) < 0) {
+		close(proc->pidfd);
+		talloc_free(proc);
+		return -1;
+	}
+	fr_dlist_insert_tail(&ep->procs, proc);
+
+	return 0;
+}
+
+/** Return the exit status of a process which has exited, as kqueue does
+ *
+ * The process is not reaped.
+ */
+static int epoll_proc_status(pid_t pid)
+{
+	siginfo_t info = {};
+
+	if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0) return 0;
+
+	switch (info.si_code) {
+	case CLD_EXITED:
+		return (info.si_status & 0xff) << 8;
+
+	case CLD_KILLED:
+		return info.si_status & 0x7f;
+
+	case CLD_DUMPED:
+		return (info.si_status & 0x7f) | 0x80;
+
+	default:
+		return 0;
+	}
+}
+
+/** Add, change, trigger or delete an EVFILT_USER filter
+ *
+ */
+static int epoll_user_change(fr_event_epoll_t *ep, struct kevent const *kev)
+{
+	epoll_user_t *user = NULL;
+
+	fr_dlist_foreach(&ep->users, epoll_user_t, u) {
+		if (u->ident == kev->ident) {
+			user = u;
+			break;
+		}
+	}
+
+	if (!user) {
+		if (!(kev->flags & EV_ADD)) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		user = talloc_zero(ep, epoll_user_t);
+		if (unlikely(!user)) {
+			errno = ENOMEM;
+			return -1;
+		}
+		user->ident = kev->ident;
+		user->enabled = true;
+		fr_dlist_insert_tail(&ep->users, user);
+	}
+
+	if (kev->flags & EV_DELETE) {
+		if (user->triggered) ep->num_triggered--;
+		fr_dlist_remove(&ep->users, user);
+		talloc_free(user);
+		return 0;
+	}
+
+	if (kev->flags & EV_ADD) {
+		user->flags = kev->flags & (EV_CLEAR | EV_DISPATCH | EV_ONESHOT);
+		user->udata = kev->udata;
+	}
+	if (kev->flags & EV_ENABLE) user->enabled = true;
+	if (kev->flags & EV_DISABLE) user->enabled = false;
+
+	if ((kev->fflags & NOTE_TRIGGER) && !user->triggered) {
+		user->triggered = true;
+		ep->num_triggered++;
+	}
+
+	return 0;
+}
+
+/** Whether a regular file has data to read
+ *
+ * kqueue returns read events for regular files until the offset reaches
+ * the end of the file.
+ */
+static intptr_t epoll_regular_readable(int fd)
+{
+	struct stat	buf;
+	off_t		offset;
+
+	if (fstat(fd, &buf) < 0) return 0;
+
+	offset = lseek(fd, 0, SEEK_CUR);
+	if ((offset < 0) || (offset >= buf.st_size)) return 0;
+
+	return buf.st_size - offset;
+}
+
+/** Whether any events can be returned without waiting
+ *
+ */
+static bool epoll_pending(fr_event_epoll_t *ep)
+{
+	if (ep->num_triggered) return true;
+
+	fr_dlist_foreach(&ep->vnodes, epoll_fd_t, efd) if (efd->vnode_pending) return true;
+
+	fr_dlist_foreach(&ep->regular, epoll_fd_t, efd) {
+		if (efd->added[EPOLL_WRITE] && efd->enabled[EPOLL_WRITE]) return true;
+		if (efd->added[EPOLL_READ] && efd->enabled[EPOLL_READ] && epoll_regular_readable(efd->fd)) return true;
+	}
+
+	return false;
+}
+
+/** Get the errno for a descriptor which reported an error or hang up
+ *
+ */
+static uint32_t epoll_fd_errno(int fd)
+{
+	int		err = 0;
+	socklen_t	len = sizeof(err);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) return 0;
+
+	return err;
+}
+
+/** Translate one epoll event into kevents
+ *
+ * @return the number of kevents written.
+ */
+static int epoll_fd_event(fr_event_epoll_t *ep, struct epoll_event const *event, struct kevent *out, int num_out)
+{
+	epoll_fd_t	*efd;
+	int		fd = EPOLL_DATA_FD(event->data.u64);
+	int		count = 0;
+
+	if (((unsigned int) fd >= ep->num_fds) || !(efd = ep->fds[fd])) return 0;	/* Deleted */
+
+	if ((event->events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+	    efd->added[EPOLL_READ] && efd->enabled[EPOLL_READ] && (count < num_out)) {
+		struct kevent *kev = &out[count++];
+
+		*kev = (struct kevent) {
+			.ident = fd,
+			.filter = EVFILT_READ,
+			.udata = efd->udata[EPOLL_READ]
+		};
+
+		/*
+		 *	The caller uses data to decide whether to
+		 *	read what's left before closing the socket.
+		 */
+		if (event->events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			int available = 0;
+
+			kev->flags |= EV_EOF;
+			if (event->events & EPOLLERR) kev->fflags = epoll_fd_errno(fd);
+			if (ioctl(fd, FIONREAD, &available) == 0) kev->data = available;
+		}
+	}
+
+	if ((event->events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) &&
+	    efd->added[EPOLL_WRITE] && efd->enabled[EPOLL_WRITE] && (count < num_out)) {
+		struct kevent *kev = &out[count++];
+
+		*kev = (struct kevent) {
+			.ident = fd,
+			.filter = EVFILT_WRITE,
+			.udata = efd->udata[EPOLL_WRITE]
+		};
+
+		if (event->events & (EPOLLHUP | EPOLLERR)) {
+			kev->flags |= EV_EOF;
+			kev->fflags = epoll_fd_errno(fd);
+		}
+	}
+
+	return count;
+}
+
+/** Return a process exit as a kevent
+ *
+ * @return the number of kevents written.
+ */
+static int epoll_proc_event(fr_event_epoll_t *ep, struct epoll_event const *event, struct kevent *out)
+{
+	int pidfd = EPOLL_DATA_FD(event->data.u64);
+
+	fr_dlist_foreach(&ep->procs, epoll_proc_t, proc) {
+		if (proc->pidfd != pidfd) continue;
+
+		*out = (struct kevent) {
+			.ident = proc->pid,
+			.filter = EVFILT_PROC,
+			.fflags = NOTE_EXIT,
+			.data = epoll_proc_status(proc->pid),
+			.udata = proc->udata
+		};
+
+		/*
+		 *	Processes only exit once, so NOTE_EXIT is
+		 *	always oneshot.
+		 */
+		(void) epoll_ctl(ep->epfd, EPOLL_CTL_DEL, proc->pidfd, NULL);
+		close(proc->pidfd);
+		fr_dlist_remove(&ep->procs, proc);
+		talloc_free(proc);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/** Return any events we hold, rather than the kernel
+ *
+ * @return the number of kevents written.
+ */
+static int epoll_held_events(fr_event_epoll_t *ep, struct kevent *out, int num_out)
+{
+	int count = 0;
+
+	fr_dlist_foreach(&ep->vnodes, epoll_fd_t, efd) {
+		if (count >= num_out) return count;
+		if (!efd->vnode_pending) continue;
+
+		out[count++] = (struct kevent) {
+			.ident = efd->fd,
+			.filter = EVFILT_VNODE,
+			.flags = EV_CLEAR,
+			.fflags = efd->vnode_pending,
+			.udata = efd->vnode_udata
+		};
+		efd->vnode_pending = 0;
+	}
+
+	fr_dlist_foreach(&ep->regular, epoll_fd_t, efd) {
+		intptr_t available;
+
+		if (count >= num_out) return count;
+
+		if (efd->added[EPOLL_READ] && efd->enabled[EPOLL_READ] &&
+		    ((available = epoll_regular_readable(efd->fd)) > 0)) {
+			out[count++] = (struct kevent) {
+				.ident = efd->fd,
+				.filter = EVFILT_READ,
+				.data = available,
+				.udata = efd->udata[EPOLL_READ]
+			};
+		}
+
+		if (count >= num_out) return count;
+
+		if (efd->added[EPOLL_WRITE] && efd->enabled[EPOLL_WRITE]) {
+			out[count++] = (struct kevent) {
+				.ident = efd->fd,
+				.filter = EVFILT_WRITE,
+				.udata = efd->udata[EPOLL_WRITE]
+			};
+		}
+	}
+
+	if (!ep->num_triggered) return count;
+
+	fr_dlist_foreach_safe(&ep->users, epoll_user_t, user) {
+		if (count >= num_out) return count;
+		if (!user->triggered || !user->enabled) continue;
+
+		out[count++] = (struct kevent) {
+			.ident = user->ident,
+			.filter = EVFILT_USER,
+			.udata = user->udata
+		};
+
+		if (user->flags & EV_ONESHOT) {
+			ep->num_triggered--;
+			fr_dlist_remove(&ep->users, user);
+			talloc_free(user);
+			continue;
+		}
+
+		if (user->flags & (EV_CLEAR | EV_DISPATCH)) {
+			user->triggered = false;
+			ep->num_triggered--;
+		}
+		if (user->flags & EV_DISPATCH) user->enabled = false;
+	}}
+
+	return count;
+}
+
+/** Apply changes, and wait for events, in the same way as kevent()
+ *
+ * @param[in] ep		to use.
+ * @param[in] changes		to apply before waiting.
+ * @param[in] num_changes	in the changes array.
+ * @param[out] events		where to write any events.
+ * @param[in] num_events	maximum number of events to return.  If 0,
+ *				we only apply the changes.
+ * @param[in] timeout		how long to wait for.  NULL means wait forever.
+ * @return
+ *	- The number of events written to events.
+ *	- -1 on error, with errno set.  If a change fails, the others are
+ *	  still applied.
+ */
+int fr_event_epoll_kevent(fr_event_epoll_t *ep,
+			  struct kevent const *changes, int num_changes,
+			  struct kevent *events, int num_events,
+			  struct timespec const *timeout)
+{
+	int	i, ret = 0, num_ready, count;
+	int	saved_errno = 0;
+
+	for (i = 0; i < num_changes; i++) {
+		struct kevent const *kev = &changes[i];
+
+		switch (kev->filter) {
+		case EVFILT_READ:
+		case EVFILT_WRITE:
+			ret = epoll_io_change(ep, kev);
+			break;
+
+		case EVFILT_VNODE:
+			ret = epoll_vnode_change(ep, kev);
+			break;
+
+		case EVFILT_PROC:
+			ret = epoll_proc_change(ep, kev);
+			break;
+
+		case EVFILT_USER:
+			ret = epoll_user_change(ep, kev);
+			break;
+
+		default:
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+
+		if ((ret < 0) && !saved_errno) saved_errno = errno;
+	}
+
+	if ((epoll_io_apply(ep) < 0) && !saved_errno) saved_errno = errno;
+
+	if (saved_errno) {
+		errno = saved_errno;
+		return -1;
+	}
+
+	if (!events || (num_events <= 0)) return 0;
+
+	/*
+	 *	Don't wait if we have events to return already.
+	 */
+	if (epoll_pending(ep)) {
+		num_ready = epoll_wait(ep->epfd, ep->ready, 1, 0);
+
+	} else {
+		int max = (num_events < EPOLL_MAX_EVENTS) ? num_events : EPOLL_MAX_EVENTS;
+
+#ifdef HAVE_EPOLL_PWAIT2
+		num_ready = epoll_pwait2(ep->epfd, ep->ready, max, timeout, NULL);
+#else
+		int ms = -1;
+
+		/*
+		 *	Round up, so timers don't fire early.
+		 */
+		if (timeout) {
+			int64_t when = ((int64_t) timeout->tv_sec * 1000) + ((timeout->tv_nsec + 999999) / 1000000);
+
+			ms = (when > INT_MAX) ? INT_MAX : (int) when;
+		}
+		num_ready = epoll_wait(ep->epfd, ep->ready, max, ms);
+#endif
+	}
+	if (num_ready < 0) return -1;
+
+	count = 0;
+	for (i = 0; (i < num_ready) && (count < num_events); i++) {
+		switch (EPOLL_DATA_TYPE(ep->ready[i].data.u64)) {
+		case EPOLL_TYPE_FD:
+			count += epoll_fd_event(ep, &ep->ready[i], events + count, num_events - count);
+			break;
+
+		case EPOLL_TYPE_PROC:
+			count += epoll_proc_event(ep, &ep->ready[i], events + count);
+			break;
+
+		case EPOLL_TYPE_INOTIFY:
+			epoll_vnode_read(ep);
+			break;
+		}
+	}
+
+	/*
+	 *	Anything we couldn't fit in is level triggered, and
+	 *	will be returned by the next call.
+	 */
+	if (count < num_events) count += epoll_held_events(ep, events + count, num_events - count);
+
+	return count;
+}
+#endif
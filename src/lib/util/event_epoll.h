@@ -0,0 +1,124 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Native epoll backend for event lists
+ *
+ * Event lists are written in terms of kevent() change and event lists.
+ * On Linux, this implements the subset of kevent() which the event
+ * lists use directly on top of epoll, pidfd and inotify.
+ * Changes to the same file descriptor are coalesced into a single
+ * epoll_ctl() call, and there's no locking, as each instance belongs
+ * to a single event list, and so to a single thread.
+ *
+ * If we're building without kqueue, this header also provides the
+ * kevent structure, filters and flags.
+ *
+ * @file src/lib/util/event_epoll.h
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSIDH(event_epoll_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef HAVE_KQUEUE
+#  include <sys/event.h>
+#else
+/** The subset of struct kevent which event lists use
+ *
+ * The layout, filters and flags match those of the BSDs, and of libkqueue.
+ */
+struct kevent {
+	uintptr_t	ident;			//!< Identifier for this event, usually a file descriptor.
+	int16_t		filter;			//!< Filter for this event.
+	uint16_t	flags;			//!< EV_* action and return flags.
+	uint32_t	fflags;			//!< Filter specific flags.
+	intptr_t	data;			//!< Filter specific data.
+	void		*udata;			//!< Opaque user data, returned unchanged.
+};
+
+#define EV_SET(_kevp, _ident, _filter, _flags, _fflags, _data, _udata) do { \
+		struct kevent *_kev = (_kevp); \
+		_kev->ident = (_ident); \
+		_kev->filter = (_filter); \
+		_kev->flags = (_flags); \
+		_kev->fflags = (_fflags); \
+		_kev->data = (_data); \
+		_kev->udata = (void *)(_udata); \
+	} while (0)
+
+#define EVFILT_READ		(-1)
+#define EVFILT_WRITE		(-2)
+#define EVFILT_VNODE		(-4)
+#define EVFILT_PROC		(-5)
+#define EVFILT_SIGNAL		(-6)
+#define EVFILT_TIMER		(-7)
+#define EVFILT_USER		(-11)
+
+#define EV_ADD			0x0001		//!< Add the event.
+#define EV_DELETE		0x0002		//!< Delete the event.
+#define EV_ENABLE		0x0004		//!< Enable the event.
+#define EV_DISABLE		0x0008		//!< Disable the event, but don't delete it.
+#define EV_ONESHOT		0x0010		//!< Delete the event after it's returned.
+#define EV_CLEAR		0x0020		//!< Reset the state after the event is returned.
+#define EV_DISPATCH		0x0080		//!< Disable the event after it's returned.
+#define EV_ERROR		0x4000		//!< Error, data contains the errno.
+#define EV_EOF			0x8000		//!< EOF, fflags contains the errno, if any.
+
+#define NOTE_FFNOP		0x00000000
+#define NOTE_FFAND		0x40000000
+#define NOTE_FFOR		0x80000000
+#define NOTE_FFCOPY		0xc0000000
+#define NOTE_FFCTRLMASK		0xc0000000
+#define NOTE_FFLAGSMASK		0x00ffffff
+#define NOTE_TRIGGER		0x01000000	//!< Trigger a user event.
+
+#define NOTE_DELETE		0x0001		//!< The file was unlinked.
+#define NOTE_WRITE		0x0002		//!< The file, or directory was written to.
+#define NOTE_EXTEND		0x0004		//!< The file was extended.
+#define NOTE_ATTRIB		0x0008		//!< The file's attributes changed.
+#define NOTE_LINK		0x0010		//!< The file's link count changed.
+#define NOTE_RENAME		0x0020		//!< The file was renamed.
+#define NOTE_REVOKE		0x0040		//!< Access to the file was revoked.
+
+#define NOTE_EXIT		0x80000000	//!< The process exited.
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+typedef struct fr_event_epoll_s fr_event_epoll_t;
+
+fr_event_epoll_t	*fr_event_epoll_alloc(TALLOC_CTX *ctx);
+
+int			fr_event_epoll_fd(fr_event_epoll_t const *ep) CC_HINT(nonnull);
+
+int			fr_event_epoll_kevent(fr_event_epoll_t *ep,
+					      struct kevent const *changes, int num_changes,
+					      struct kevent *events, int num_events,
+					      struct timespec const *timeout) CC_HINT(nonnull(1));
+#endif
+
+#ifdef __cplusplus
+}
+#endif
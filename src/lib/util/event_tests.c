@@ -0,0 +1,392 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/time.h>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ *	Each test is run against every backend we were built with.
+ */
+static fr_event_backend_t const backends[] = {
+#ifdef HAVE_KQUEUE
+	FR_EVENT_BACKEND_KQUEUE,
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+	FR_EVENT_BACKEND_EPOLL,
+#endif
+};
+
+#define BACKEND_NAME(_b)	fr_table_str_by_value(fr_event_backend_table, _b, "<INVALID>")
+
+static fr_event_list_t *event_list_alloc(fr_event_backend_t backend)
+{
+	fr_event_list_t *el;
+
+	TEST_CHECK(fr_event_backend_set(backend) == 0);
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+	if (el) TEST_CHECK(fr_event_list_backend(el) == backend);
+
+	return el;
+}
+
+/** Run one iteration of the event loop
+ *
+ */
+static int event_loop_once(fr_event_list_t *el, bool wait)
+{
+	int ret;
+
+	ret = fr_event_corral(el, fr_time(), wait);
+	if (ret > 0) fr_event_service(el);
+
+	return ret;
+}
+
+typedef struct {
+	unsigned int	reads;
+	unsigned int	writes;
+	unsigned int	errors;
+} event_count_t;
+
+static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	event_count_t	*count = uctx;
+	uint8_t		buffer[64];
+
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+	count->reads++;
+}
+
+static void pipe_write(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	event_count_t	*count = uctx;
+
+	count->writes++;
+}
+
+static void pipe_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, UNUSED int fd_errno, void *uctx)
+{
+	event_count_t	*count = uctx;
+
+	count->errors++;
+}
+
+static void timeout_noop(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, UNUSED void *uctx)
+{
+}
+
+static int pipe_open(int fds[2])
+{
+	if (pipe(fds) < 0) return -1;
+
+	(void) fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	(void) fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	return 0;
+}
+
+/** Read readiness, and read filters being suspended and resumed
+ *
+ */
+static void event_test_fd(void)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(backends); i++) {
+		fr_event_list_t		*el;
+		int			fds[2];
+		event_count_t		count = {};
+		static fr_event_update_t const pause_read[] = {
+			FR_EVENT_SUSPEND(fr_event_io_func_t, read),
+			{ 0 }
+		};
+		static fr_event_update_t const resume_read[] = {
+			FR_EVENT_RESUME(fr_event_io_func_t, read),
+			{ 0 }
+		};
+
+		TEST_CASE(BACKEND_NAME(backends[i]));
+
+		el = event_list_alloc(backends[i]);
+		if (!el) continue;
+
+		TEST_CHECK(pipe_open(fds) == 0);
+		TEST_CHECK(fr_event_fd_insert(NULL, NULL, el, fds[0], pipe_read, NULL, NULL, &count) == 0);
+
+		TEST_CHECK(event_loop_once(el, false) == 0);
+		TEST_CHECK(count.reads == 0);
+
+		TEST_CHECK(write(fds[1], "x", 1) == 1);
+		TEST_CHECK(event_loop_once(el, true) == 1);
+		TEST_CHECK(count.reads == 1);
+		TEST_MSG("Expected 1 read, got %u", count.reads);
+
+		/*
+		 *	Data arriving while the filter is suspended
+		 *	is reported when it's resumed.
+		 */
+		TEST_CHECK(fr_event_filter_update(el, fds[0], FR_EVENT_FILTER_IO, pause_read) == 0);
+		TEST_CHECK(write(fds[1], "x", 1) == 1);
+		TEST_CHECK(event_loop_once(el, false) == 0);
+		TEST_CHECK(count.reads == 1);
+
+		TEST_CHECK(fr_event_filter_update(el, fds[0], FR_EVENT_FILTER_IO, resume_read) == 0);
+		TEST_CHECK(event_loop_once(el, true) == 1);
+		TEST_CHECK(count.reads == 2);
+
+		/*
+		 *	An empty pipe is always writable.
+		 */
+		TEST_CHECK(fr_event_fd_insert(NULL, NULL, el, fds[1], NULL, pipe_write, NULL, &count) == 0);
+		TEST_CHECK(event_loop_once(el, true) == 1);
+		TEST_CHECK(count.writes == 1);
+
+		TEST_CHECK(fr_event_fd_delete(el, fds[0], FR_EVENT_FILTER_IO) == 0);
+		TEST_CHECK(fr_event_fd_delete(el, fds[1], FR_EVENT_FILTER_IO) == 0);
+		TEST_CHECK(fr_event_list_num_fds(el) == 0);
+
+		close(fds[0]);
+		close(fds[1]);
+		talloc_free(el);
+	}
+}
+
+/** Closing the other end of a socket calls the error callback
+ *
+ * Pipes are treated as files, so their read callback sees EOF instead.
+ */
+static void event_test_fd_eof(void)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(backends); i++) {
+		fr_event_list_t		*el;
+		int			fds[2];
+		event_count_t		count = {};
+
+		TEST_CASE(BACKEND_NAME(backends[i]));
+
+		el = event_list_alloc(backends[i]);
+		if (!el) continue;
+
+		TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+		TEST_CHECK(fr_event_fd_insert(NULL, NULL, el, fds[0], pipe_read, NULL, pipe_error, &count) == 0);
+
+		close(fds[1]);
+		TEST_CHECK(event_loop_once(el, true) == 1);
+		TEST_CHECK(count.errors == 1);
+		TEST_CHECK(count.reads == 0);
+
+		/*
+		 *	The event list removes the descriptor after
+		 *	calling the error callback.
+		 */
+		TEST_CHECK(fr_event_list_num_fds(el) == 0);
+		close(fds[0]);
+		talloc_free(el);
+	}
+}
+
+static void user_event(UNUSED fr_event_list_t *el, void *uctx)
+{
+	unsigned int	*count = uctx;
+
+	(*count)++;
+}
+
+/** User events are returned once for each trigger
+ *
+ */
+static void event_test_user(void)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(backends); i++) {
+		fr_event_list_t		*el;
+		fr_event_user_t		*ev;
+		unsigned int		count = 0;
+
+		TEST_CASE(BACKEND_NAME(backends[i]));
+
+		el = event_list_alloc(backends[i]);
+		if (!el) continue;
+
+		TEST_CHECK(fr_event_user_insert(el, el, &ev, false, user_event, &count) == 0);
+
+		TEST_CHECK(event_loop_once(el, false) == 0);
+		TEST_CHECK(count == 0);
+
+		TEST_CHECK(fr_event_user_trigger(el, ev) == 0);
+		TEST_CHECK(fr_event_user_trigger(el, ev) == 0);
+		TEST_CHECK(event_loop_once(el, false) == 1);
+		TEST_CHECK(count == 1);
+		TEST_MSG("Expected 1 user event, got %u", count);
+
+		TEST_CHECK(event_loop_once(el, false) == 0);
+		TEST_CHECK(count == 1);
+
+		talloc_free(el);
+	}
+}
+
+static void pid_exited(UNUSED fr_event_list_t *el, UNUSED pid_t pid, int status, void *uctx)
+{
+	int	*out = uctx;
+
+	*out = status;
+}
+
+/** Process exit is reported with the exit status
+ *
+ */
+static void event_test_pid(void)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(backends); i++) {
+		fr_event_list_t		*el;
+		fr_event_pid_t const	*ev = NULL;
+		int			status = -1;
+		pid_t			pid;
+		int			tries;
+
+		TEST_CASE(BACKEND_NAME(backends[i]));
+
+		el = event_list_alloc(backends[i]);
+		if (!el) continue;
+
+		pid = fork();
+		TEST_ASSERT(pid >= 0);
+		if (pid == 0) {
+			usleep(10000);
+			_exit(3);
+		}
+
+		TEST_CHECK(fr_event_pid_wait(el, el, &ev, pid, pid_exited, &status) == 0);
+
+		for (tries = 0; (status < 0) && (tries < 100); tries++) {
+			fr_event_timer_t const *timeout = NULL;
+
+			(void) fr_event_timer_in(el, el, &timeout, fr_time_delta_from_msec(10), timeout_noop, NULL);
+			(void) event_loop_once(el, true);
+			(void) fr_event_timer_delete(&timeout);
+		}
+
+		TEST_CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 3));
+		TEST_MSG("Expected exit status 3, got %d", status);
+
+		talloc_free(el);
+	}
+}
+
+typedef struct {
+	int		fds[2];
+} event_pipe_t;
+
+/** Compare the cost of changing filters, and of finding ready descriptors
+ *
+ * Churn suspends and resumes the read filter on every pipe, which is what
+ * the network side does as its input queues fill and drain.  Harvest makes
+ * every pipe readable, and services the list until all of them are read.
+ */
+static void event_cmp(unsigned int num_pipes, unsigned int rounds)
+{
+	size_t		i;
+	unsigned int	j, k;
+	event_pipe_t	*pipes;
+	static fr_event_update_t const pause_read[] = {
+		FR_EVENT_SUSPEND(fr_event_io_func_t, read),
+		{ 0 }
+	};
+	static fr_event_update_t const resume_read[] = {
+		FR_EVENT_RESUME(fr_event_io_func_t, read),
+		{ 0 }
+	};
+
+	pipes = talloc_array(NULL, event_pipe_t, num_pipes);
+	for (j = 0; j < num_pipes; j++) TEST_ASSERT(pipe_open(pipes[j].fds) == 0);
+
+	for (i = 0; i < NUM_ELEMENTS(backends); i++) {
+		fr_event_list_t		*el;
+		event_count_t		count = {};
+		fr_time_t		start_churn, end_churn, start_harvest, end_harvest;
+
+		el = event_list_alloc(backends[i]);
+		if (!el) continue;
+
+		for (j = 0; j < num_pipes; j++) {
+			TEST_CHECK(fr_event_fd_insert(NULL, NULL, el, pipes[j].fds[0], pipe_read, NULL, NULL, &count) == 0);
+		}
+
+		start_churn = fr_time();
+		for (k = 0; k < rounds; k++) {
+			for (j = 0; j < num_pipes; j++) {
+				(void) fr_event_filter_update(el, pipes[j].fds[0], FR_EVENT_FILTER_IO, pause_read);
+			}
+			for (j = 0; j < num_pipes; j++) {
+				(void) fr_event_filter_update(el, pipes[j].fds[0], FR_EVENT_FILTER_IO, resume_read);
+			}
+			(void) event_loop_once(el, false);
+		}
+		end_churn = fr_time();
+
+		start_harvest = fr_time();
+		for (k = 0; k < rounds; k++) {
+			unsigned int expected = count.reads + num_pipes;
+
+			for (j = 0; j < num_pipes; j++) TEST_CHECK(write(pipes[j].fds[1], "x", 1) == 1);
+			while (count.reads < expected) {
+				if (event_loop_once(el, true) < 0) break;
+			}
+		}
+		end_harvest = fr_time();
+
+		TEST_CHECK(count.reads == (num_pipes * rounds));
+
+		TEST_MSG_ALWAYS("\n%s pipes: %u, rounds: %u\n", BACKEND_NAME(backends[i]), num_pipes, rounds);
+		TEST_MSG_ALWAYS("churn: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_churn, start_churn)) / 1000);
+		TEST_MSG_ALWAYS("harvest: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_harvest, start_harvest)) / 1000);
+
+		talloc_free(el);
+	}
+
+	for (j = 0; j < num_pipes; j++) {
+		close(pipes[j].fds[0]);
+		close(pipes[j].fds[1]);
+	}
+	talloc_free(pipes);
+}
+
+static void event_cmp_10(void)
+{
+	event_cmp(10, 10000);
+}
+
+static void event_cmp_250(void)
+{
+	event_cmp(250, 1000);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "event_test_fd",		event_test_fd },
+	{ "event_test_fd_eof",		event_test_fd_eof },
+	{ "event_test_user",		event_test_user },
+	{ "event_test_pid",		event_test_pid },
+
+	/*
+	 *	Compare backends
+	 */
+	{ "event_cmp_10",		event_cmp_10 },
+	{ "event_cmp_250",		event_cmp_250 },
+
+	{ NULL }
+};
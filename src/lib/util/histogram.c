@@ -0,0 +1,309 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Log-linear histograms for recording latencies
+ *
+ * @file src/lib/util/histogram.c
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/histogram.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/strerror.h>
+
+#include <inttypes.h>
+
+#define HISTOGRAM_PRECISION_MIN	2
+#define HISTOGRAM_PRECISION_MAX	16
+
+/*
+ *	Only one thread records values, so it doesn't need atomic
+ *	increments.  But other threads can read the histogram at any
+ *	time, so each field is loaded and stored atomically.  These
+ *	are plain loads and stores on 64-bit platforms.
+ */
+#define HISTOGRAM_LOAD(_field)		__atomic_load_n(&(_field), __ATOMIC_RELAXED)
+#define HISTOGRAM_STORE(_field, _value)	__atomic_store_n(&(_field), (_value), __ATOMIC_RELAXED)
+
+/** Which bucket a value goes into
+ *
+ * Values below 2^precision each get their own bucket.  Above that,
+ * the value is shifted down until it has "precision" bits left.  The
+ * top bit is then always set, so each shift adds another
+ * 2^(precision - 1) buckets.
+ */
+static inline unsigned int histogram_index(unsigned int precision, uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < ((uint64_t) 1 << precision)) return value;
+
+	shift = fr_high_bit_pos(value) - precision;
+
+	return (shift << (precision - 1)) + (value >> shift);
+}
+
+/** The largest value which goes into a bucket
+ *
+ */
+static inline uint64_t histogram_value(unsigned int precision, unsigned int idx)
+{
+	unsigned int	shift;
+	uint64_t	mantissa;
+
+	if (idx < (1U << precision)) return idx;
+
+	shift = (idx >> (precision - 1)) - 1;
+	mantissa = idx - (shift << (precision - 1));
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+/** Allocate a histogram
+ *
+ * @param[in] ctx		to allocate the histogram in.
+ * @param[in] max_value		largest value which will be recorded.
+ *				Larger values are counted as max_value.
+ * @param[in] precision		number of significant bits to keep for each value.
+ *				7 gives an error of less than 1.6%.
+ * @return
+ *	- A new histogram.
+ *	- NULL on error.
+ */
+fr_histogram_t *fr_histogram_alloc(TALLOC_CTX *ctx, uint64_t max_value, unsigned int precision)
+{
+	fr_histogram_t *h;
+
+	if ((precision < HISTOGRAM_PRECISION_MIN) || (precision > HISTOGRAM_PRECISION_MAX)) {
+		fr_strerror_printf("Histogram precision must be between %u and %u bits",
+				   HISTOGRAM_PRECISION_MIN, HISTOGRAM_PRECISION_MAX);
+		return NULL;
+	}
+
+	if (!max_value) {
+		fr_strerror_const("Histogram maximum value must be greater than zero");
+		return NULL;
+	}
+
+	h = talloc_zero(ctx, fr_histogram_t);
+	if (unlikely(h == NULL)) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	h->max_value = max_value;
+	h->precision = precision;
+	h->num_buckets = histogram_index(precision, max_value) + 1;
+	h->min = UINT64_MAX;
+
+	h->counts = talloc_zero_array(h, uint64_t, h->num_buckets);
+	if (unlikely(h->counts == NULL)) {
+		fr_strerror_const("Out of memory");
+		talloc_free(h);
+		return NULL;
+	}
+
+	return h;
+}
+
+/** Record one value
+ *
+ * @param[in] h		to record the value in.
+ * @param[in] value	to record.
+ */
+void fr_histogram_record(fr_histogram_t *h, uint64_t value)
+{
+	unsigned int idx;
+
+	if (value > h->max_value) value = h->max_value;
+
+	idx = histogram_index(h->precision, value);
+
+	HISTOGRAM_STORE(h->counts[idx], h->counts[idx] + 1);
+	HISTOGRAM_STORE(h->sum, h->sum + value);
+
+	if (value < h->min) HISTOGRAM_STORE(h->min, value);
+	if (value > h->max) HISTOGRAM_STORE(h->max, value);
+
+	HISTOGRAM_STORE(h->count, h->count + 1);
+}
+
+/** Record one value, and correct for coordinated omission
+ *
+ * A sender which waits for each reply before sending the next
+ * request doesn't send anything while the server is stalled.  The
+ * stall then shows up as one slow reply, instead of as all of the
+ * requests which should have been sent during it.
+ *
+ * If the value is larger than the expected interval between
+ * requests, this function records the requests which would have
+ * been sent, each with a latency one interval less than the last.
+ *
+ * @param[in] h		to record the value in.
+ * @param[in] value	to record.
+ * @param[in] interval	expected time between requests.  0 for no correction.
+ */
+void fr_histogram_record_corrected(fr_histogram_t *h, uint64_t value, uint64_t interval)
+{
+	uint64_t missing;
+
+	fr_histogram_record(h, value);
+
+	if (!interval || (value <= interval)) return;
+
+	for (missing = value - interval; missing >= interval; missing -= interval) {
+		fr_histogram_record(h, missing);
+	}
+}
+
+/** Add the values from one histogram to another
+ *
+ * The source histogram can be being recorded to by another thread.
+ * Values recorded during the merge may or may not be included.
+ *
+ * @param[in] dst	to add the values to.
+ * @param[in] src	to take the values from.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the histograms have different precisions.
+ */
+int fr_histogram_merge(fr_histogram_t *dst, fr_histogram_t const *src)
+{
+	unsigned int	i;
+	uint64_t	min, max;
+
+	if (dst->precision != src->precision) {
+		fr_strerror_printf("Can't merge histograms with precision %u and %u",
+				   src->precision, dst->precision);
+		return -1;
+	}
+
+	if (!HISTOGRAM_LOAD(src->count)) return 0;
+
+	/*
+	 *	Values which don't fit go into the last bucket, as if
+	 *	they had been clamped when they were recorded.
+	 */
+	for (i = 0; i < src->num_buckets; i++) {
+		uint64_t count = HISTOGRAM_LOAD(src->counts[i]);
+
+		if (!count) continue;
+
+		dst->count += count;
+		if (i < dst->num_buckets) {
+			dst->counts[i] += count;
+		} else {
+			dst->counts[dst->num_buckets - 1] += count;
+		}
+	}
+
+	dst->sum += HISTOGRAM_LOAD(src->sum);
+
+	min = HISTOGRAM_LOAD(src->min);
+	max = HISTOGRAM_LOAD(src->max);
+	if (max > dst->max_value) max = dst->max_value;
+
+	if (min < dst->min) dst->min = min;
+	if (max > dst->max) dst->max = max;
+
+	return 0;
+}
+
+/** Remove all values from a histogram
+ *
+ * Must only be called by the thread which records values.
+ */
+void fr_histogram_reset(fr_histogram_t *h)
+{
+	unsigned int i;
+
+	for (i = 0; i < h->num_buckets; i++) HISTOGRAM_STORE(h->counts[i], 0);
+
+	HISTOGRAM_STORE(h->count, 0);
+	HISTOGRAM_STORE(h->sum, 0);
+	HISTOGRAM_STORE(h->min, UINT64_MAX);
+	HISTOGRAM_STORE(h->max, 0);
+}
+
+/** Return the value which a percentage of the recorded values are less than or equal to
+ *
+ * @param[in] h			to look at.
+ * @param[in] percentile	0 to 100.
+ * @return
+ *	- The largest value which falls into the same bucket as the value at the percentile.
+ *	- 0 if no values have been recorded.
+ */
+uint64_t fr_histogram_value_at_percentile(fr_histogram_t const *h, double percentile)
+{
+	uint64_t	target, total = 0, max;
+	unsigned int	i;
+
+	if (!HISTOGRAM_LOAD(h->count)) return 0;
+
+	if (percentile <= 0) return HISTOGRAM_LOAD(h->min);
+
+	max = HISTOGRAM_LOAD(h->max);
+	if (percentile >= 100) return max;
+
+	target = (uint64_t) ((percentile / 100.0) * HISTOGRAM_LOAD(h->count) + 0.5);
+	if (!target) target = 1;
+
+	for (i = 0; i < h->num_buckets; i++) {
+		total += HISTOGRAM_LOAD(h->counts[i]);
+		if (total >= target) {
+			uint64_t value = histogram_value(h->precision, i);
+
+			return (value > max) ? max : value;
+		}
+	}
+
+	return max;
+}
+
+/** Return the mean of the recorded values
+ *
+ */
+double fr_histogram_mean(fr_histogram_t const *h)
+{
+	uint64_t count = HISTOGRAM_LOAD(h->count);
+
+	if (!count) return 0;
+
+	return (double) HISTOGRAM_LOAD(h->sum) / count;
+}
+
+/** Print a summary of a histogram, one "name value" pair per line
+ *
+ * @param[in] fp	to print to.
+ * @param[in] prefix	for the name of each value.
+ * @param[in] h		to print.
+ * @param[in] scale	values are divided by this before they are
+ *			printed, e.g. NSEC to print nanoseconds as seconds.
+ */
+void fr_histogram_fprint(FILE *fp, char const *prefix, fr_histogram_t const *h, uint64_t scale)
+{
+	double s = scale ? scale : 1;
+
+	fprintf(fp, "%s.count\t\t%" PRIu64 "\n", prefix, HISTOGRAM_LOAD(h->count));
+	fprintf(fp, "%s.mean\t\t%.9f\n", prefix, fr_histogram_mean(h) / s);
+	fprintf(fp, "%s.p50\t\t%.9f\n", prefix, fr_histogram_value_at_percentile(h, 50) / s);
+	fprintf(fp, "%s.p90\t\t%.9f\n", prefix, fr_histogram_value_at_percentile(h, 90) / s);
+	fprintf(fp, "%s.p99\t\t%.9f\n", prefix, fr_histogram_value_at_percentile(h, 99) / s);
+	fprintf(fp, "%s.p99.9\t%.9f\n", prefix, fr_histogram_value_at_percentile(h, 99.9) / s);
+	fprintf(fp, "%s.max\t\t%.9f\n", prefix, fr_histogram_value_at_percentile(h, 100) / s);
+}
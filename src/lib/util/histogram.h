@@ -0,0 +1,80 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Log-linear histograms for recording latencies
+ *
+ * @file src/lib/util/histogram.h
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSIDH(histogram_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** A histogram with a fixed relative error
+ *
+ * Values are counted in buckets which grow with the magnitude of the
+ * value, in the same way as an HDR histogram.  Each power of two is
+ * split into 2^(precision - 1) buckets, so the error in any value
+ * read back is less than 1 / 2^(precision - 1) of that value.
+ *
+ * Recording a value is a few shifts and an increment, so it's cheap
+ * enough to do for every request.  Only one thread may record values
+ * in a histogram.  Other threads may read or merge it at any time,
+ * without locks.  So each thread should have its own, and they should
+ * be merged when the totals are needed.
+ */
+typedef struct {
+	uint64_t	max_value;		//!< Largest value which can be recorded.  Larger ones are clamped.
+	unsigned int	precision;		//!< Number of bits of each value which are kept.
+	unsigned int	num_buckets;		//!< Number of entries in counts.
+
+	uint64_t	count;			//!< Total number of values recorded.
+	uint64_t	min;			//!< Smallest value recorded.
+	uint64_t	max;			//!< Largest value recorded.
+	uint64_t	sum;			//!< Of all values recorded, for the mean.
+
+	uint64_t	*counts;		//!< Number of values in each bucket.
+} fr_histogram_t;
+
+fr_histogram_t	*fr_histogram_alloc(TALLOC_CTX *ctx, uint64_t max_value, unsigned int precision);
+
+void		fr_histogram_record(fr_histogram_t *h, uint64_t value) CC_HINT(nonnull);
+
+void		fr_histogram_record_corrected(fr_histogram_t *h, uint64_t value, uint64_t interval) CC_HINT(nonnull);
+
+int		fr_histogram_merge(fr_histogram_t *dst, fr_histogram_t const *src) CC_HINT(nonnull);
+
+void		fr_histogram_reset(fr_histogram_t *h) CC_HINT(nonnull);
+
+uint64_t	fr_histogram_value_at_percentile(fr_histogram_t const *h, double percentile) CC_HINT(nonnull);
+
+double		fr_histogram_mean(fr_histogram_t const *h) CC_HINT(nonnull);
+
+void		fr_histogram_fprint(FILE *fp, char const *prefix, fr_histogram_t const *h, uint64_t scale) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,186 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for log-linear histograms
+ *
+ * @file src/lib/util/histogram_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/util/histogram.h>
+#include <freeradius-devel/util/time.h>
+
+#define PRECISION	7
+#define MAX_VALUE	((uint64_t) 60 * NSEC)
+
+/** Whether a value read back is within the error of the value recorded
+ *
+ */
+static bool within_error(uint64_t got, uint64_t expected)
+{
+	uint64_t diff = (got > expected) ? got - expected : expected - got;
+
+	return (diff * (1 << (PRECISION - 1))) <= expected;
+}
+
+static void test_exact_small_values(void)
+{
+	fr_histogram_t	*h;
+	uint64_t	i;
+
+	h = fr_histogram_alloc(NULL, MAX_VALUE, PRECISION);
+	TEST_CHECK(h != NULL);
+
+	for (i = 1; i <= 100; i++) fr_histogram_record(h, i);
+
+	TEST_CHECK(h->count == 100);
+	TEST_CHECK(h->min == 1);
+	TEST_CHECK(h->max == 100);
+	TEST_CHECK(fr_histogram_mean(h) == 50.5);
+
+	TEST_CASE("Values below 2^precision are exact");
+	TEST_CHECK(fr_histogram_value_at_percentile(h, 50) == 50);
+	TEST_MSG("Got %" PRIu64, fr_histogram_value_at_percentile(h, 50));
+	TEST_CHECK(fr_histogram_value_at_percentile(h, 99) == 99);
+	TEST_CHECK(fr_histogram_value_at_percentile(h, 100) == 100);
+	TEST_CHECK(fr_histogram_value_at_percentile(h, 0) == 1);
+
+	talloc_free(h);
+}
+
+static void test_relative_error(void)
+{
+	fr_histogram_t	*h;
+	uint64_t	value;
+
+	h = fr_histogram_alloc(NULL, MAX_VALUE, PRECISION);
+	TEST_CHECK(h != NULL);
+
+	TEST_CASE("Large values are kept to within the precision");
+	for (value = 1; value < MAX_VALUE; value = (value * 3) + 7) {
+		uint64_t got;
+
+		fr_histogram_reset(h);
+		fr_histogram_record(h, value);
+		fr_histogram_record(h, value);
+
+		got = fr_histogram_value_at_percentile(h, 50);
+		TEST_CHECK(within_error(got, value));
+		TEST_MSG("Recorded %" PRIu64 ", got %" PRIu64, value, got);
+	}
+
+	TEST_CASE("Values above the maximum are clamped");
+	fr_histogram_reset(h);
+	fr_histogram_record(h, UINT64_MAX);
+	TEST_CHECK(h->max == MAX_VALUE);
+	TEST_CHECK(fr_histogram_value_at_percentile(h, 50) == MAX_VALUE);
+
+	talloc_free(h);
+}
+
+static void test_percentiles(void)
+{
+	fr_histogram_t	*h;
+	uint64_t	i;
+
+	h = fr_histogram_alloc(NULL, MAX_VALUE, PRECISION);
+	TEST_CHECK(h != NULL);
+
+	/*
+	 *	990 fast replies, and 10 slow ones.
+	 */
+	for (i = 0; i < 990; i++) fr_histogram_record(h, 100 * 1000);
+	for (i = 0; i < 10; i++) fr_histogram_record(h, 50 * 1000 * 1000);
+
+	TEST_CHECK(within_error(fr_histogram_value_at_percentile(h, 50), 100 * 1000));
+	TEST_CHECK(within_error(fr_histogram_value_at_percentile(h, 99), 100 * 1000));
+	TEST_CHECK(within_error(fr_histogram_value_at_percentile(h, 99.9), 50 * 1000 * 1000));
+	TEST_MSG("Got %" PRIu64, fr_histogram_value_at_percentile(h, 99.9));
+
+	talloc_free(h);
+}
+
+static void test_corrected(void)
+{
+	fr_histogram_t	*raw, *corrected;
+	uint64_t	i;
+
+	raw = fr_histogram_alloc(NULL, MAX_VALUE, PRECISION);
+	corrected = fr_histogram_alloc(NULL, MAX_VALUE, PRECISION);
+
+	/*
+	 *	A request every 1ms, with one stall of 100ms.
+	 */
+	for (i = 0; i < 100; i++) {
+		fr_histogram_record(raw, 100 * 1000);
+		fr_histogram_record_corrected(corrected, 100 * 1000, 1000 * 1000);
+	}
+	fr_histogram_record(raw, 100 * 1000 * 1000);
+	fr_histogram_record_corrected(corrected, 100 * 1000 * 1000, 1000 * 1000);
+
+	TEST_CASE("The stall is one value without correction");
+	TEST_CHECK(raw->count == 101);
+	TEST_CHECK(within_error(fr_histogram_value_at_percentile(raw, 90), 100 * 1000));
+
+	TEST_CASE("The stall adds the requests which would have been sent");
+	TEST_CHECK(corrected->count == 200);
+	TEST_MSG("Got %" PRIu64, corrected->count);
+	TEST_CHECK(within_error(fr_histogram_value_at_percentile(corrected, 90), 80 * 1000 * 1000));
+	TEST_MSG("Got %" PRIu64, fr_histogram_value_at_percentile(corrected, 90));
+
+	talloc_free(raw);
+	talloc_free(corrected);
+}
+
+static void test_merge(void)
+{
+	fr_histogram_t	*a, *b, *c;
+	uint64_t	i;
+
+	a = fr_histogram_alloc(NULL, MAX_VALUE, PRECISION);
+	b = fr_histogram_alloc(NULL, MAX_VALUE, PRECISION);
+
+	for (i = 1; i <= 500; i++) fr_histogram_record(a, i * 1000);
+	for (i = 501; i <= 1000; i++) fr_histogram_record(b, i * 1000);
+
+	TEST_CHECK(fr_histogram_merge(a, b) == 0);
+	TEST_CHECK(a->count == 1000);
+	TEST_CHECK(a->min == 1000);
+	TEST_CHECK(a->max == 1000 * 1000);
+	TEST_CHECK(within_error(fr_histogram_value_at_percentile(a, 50), 500 * 1000));
+	TEST_CHECK(within_error(fr_histogram_value_at_percentile(a, 99), 990 * 1000));
+
+	TEST_CASE("Histograms with different precisions can't be merged");
+	c = fr_histogram_alloc(NULL, MAX_VALUE, PRECISION + 1);
+	TEST_CHECK(fr_histogram_merge(a, c) < 0);
+
+	talloc_free(a);
+	talloc_free(b);
+	talloc_free(c);
+}
+
+TEST_LIST = {
+	{ "exact_small_values",	test_exact_small_values },
+	{ "relative_error",	test_relative_error },
+	{ "percentiles",	test_percentiles },
+	{ "corrected",		test_corrected },
+	{ "merge",		test_merge },
+
+	{ NULL }
+};
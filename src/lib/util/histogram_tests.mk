@@ -0,0 +1,8 @@
+TARGET		:= histogram_tests$(E)
+SOURCES		:= histogram_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L)
+
+TGT_INSTALLDIR	:=
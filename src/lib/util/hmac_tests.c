@@ -129,6 +129,41 @@ static void test_hmac_md5(void)
 			      sizeof(digest)), 0);
 }
 
+/** Check batches of HMACs match those calculated one at a time
+ *
+ * Includes keys longer than the block size, which are hashed first.
+ */
+static void test_hmac_md5_multi(void)
+{
+	uint8_t			data[256], key[128];
+	uint8_t			out[100][MD5_DIGEST_LENGTH];
+	fr_hmac_md5_multi_t	msgs[100];
+	size_t			i;
+
+	for (i = 0; i < sizeof(data); i++) data[i] = i * 7;
+	for (i = 0; i < sizeof(key); i++) key[i] = i * 13;
+
+	for (i = 0; i < NUM_ELEMENTS(msgs); i++) {
+		msgs[i] = (fr_hmac_md5_multi_t){
+			.in = data + i,
+			.inlen = (i * 37) % (sizeof(data) - i),
+			.key = key + (i % 16),
+			.key_len = i % (sizeof(key) - 16),
+			.out = out[i]
+		};
+	}
+
+	fr_hmac_md5_multi(msgs, NUM_ELEMENTS(msgs));
+
+	for (i = 0; i < NUM_ELEMENTS(msgs); i++) {
+		uint8_t digest[MD5_DIGEST_LENGTH];
+
+		fr_hmac_md5(digest, msgs[i].in, msgs[i].inlen, msgs[i].key, msgs[i].key_len);
+		TEST_CHECK(memcmp(digest, out[i], sizeof(digest)) == 0);
+		TEST_MSG("HMAC %zu, key length %zu", i, msgs[i].key_len);
+	}
+}
+
 /*
 Test Vectors (Trailing '\0' of a character string not included in test):
 
@@ -210,6 +245,7 @@ TEST_LIST = {
 	 *	Allocation and management
 	 */
 	{ "hmac-md5",			test_hmac_md5	},
+	{ "hmac-md5-multi",		test_hmac_md5_multi	},
 	{ "hmac-sha1",			test_hmac_sha1	},
 
 	{ NULL }
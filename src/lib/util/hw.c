@@ -124,3 +124,32 @@ uint32_t fr_hw_num_cores_active(void)
 	return CORES_DEFAULT;
 }
 #endif
+
+/** Check whether the CPU we're running on supports a feature
+ *
+ * @param[in] feature	to check for.
+ * @return
+ *	- true if the feature is available.
+ *	- false if it's unavailable, or we can't tell.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+bool fr_hw_has_feature(fr_hw_feature_t feature)
+{
+	__builtin_cpu_init();
+
+	switch (feature) {
+	case FR_HW_FEATURE_AVX2:
+		return __builtin_cpu_supports("avx2");
+
+	case FR_HW_FEATURE_AVX512F:
+		return __builtin_cpu_supports("avx512f");
+	}
+
+	return false;
+}
+#else
+bool fr_hw_has_feature(UNUSED fr_hw_feature_t feature)
+{
+	return false;
+}
+#endif
@@ -27,13 +27,24 @@ RCSIDH(hw_h, "$Id$")
 #ifdef __cplusplus
 extern "C" {
 #endif
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+/** CPU features used to select between implementations at runtime
+ *
+ */
+typedef enum {
+	FR_HW_FEATURE_AVX2 = 0,				//!< 256bit integer vectors.
+	FR_HW_FEATURE_AVX512F,				//!< 512bit integer vectors.
+} fr_hw_feature_t;
+
 size_t		fr_hw_cache_line_size(void);
 
 uint32_t	fr_hw_num_cores_active(void);
 
+bool		fr_hw_has_feature(fr_hw_feature_t feature);
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,6 +34,7 @@ SOURCES		:= \
 		   edit.c \
 		   encode.c \
 		   event.c \
+		   event_epoll.c \
 		   ext.c \
 		   fifo.c \
 		   file.c \
@@ -42,6 +43,7 @@ SOURCES		:= \
 		   getaddrinfo.c \
 		   hash.c \
 		   heap.c \
+		   histogram.c \
 		   hmac_md5.c \
 		   hmac_sha1.c \
 		   htrie.c \
@@ -88,6 +90,7 @@ SOURCES		:= \
 		   table.c \
 		   talloc.c \
 		   time.c \
+		   timer_wheel.c \
 		   timeval.c \
 		   token.c \
 		   trie.c \
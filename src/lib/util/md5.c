@@ -9,6 +9,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/hw.h>
 
 /*
  *  FORCE MD5 TO USE OUR MD5 HEADER FILE!
@@ -174,6 +175,77 @@ static const uint8_t PADDING[MD5_BLOCK_LENGTH] = {
 /* This is the central step in the MD5 algorithm. */
 #define MD5STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + data, w = w << s | w >> (32 - s),  w += x)
 
+/* All 64 steps, for any type which supports the operators used above. */
+#define MD5_ROUNDS(_a, _b, _c, _d, _in) do { \
+	MD5STEP(MD5_F1, _a, _b, _c, _d, _in[ 0] + 0xd76aa478,  7); \
+	MD5STEP(MD5_F1, _d, _a, _b, _c, _in[ 1] + 0xe8c7b756, 12); \
+	MD5STEP(MD5_F1, _c, _d, _a, _b, _in[ 2] + 0x242070db, 17); \
+	MD5STEP(MD5_F1, _b, _c, _d, _a, _in[ 3] + 0xc1bdceee, 22); \
+	MD5STEP(MD5_F1, _a, _b, _c, _d, _in[ 4] + 0xf57c0faf,  7); \
+	MD5STEP(MD5_F1, _d, _a, _b, _c, _in[ 5] + 0x4787c62a, 12); \
+	MD5STEP(MD5_F1, _c, _d, _a, _b, _in[ 6] + 0xa8304613, 17); \
+	MD5STEP(MD5_F1, _b, _c, _d, _a, _in[ 7] + 0xfd469501, 22); \
+	MD5STEP(MD5_F1, _a, _b, _c, _d, _in[ 8] + 0x698098d8,  7); \
+	MD5STEP(MD5_F1, _d, _a, _b, _c, _in[ 9] + 0x8b44f7af, 12); \
+	MD5STEP(MD5_F1, _c, _d, _a, _b, _in[10] + 0xffff5bb1, 17); \
+	MD5STEP(MD5_F1, _b, _c, _d, _a, _in[11] + 0x895cd7be, 22); \
+	MD5STEP(MD5_F1, _a, _b, _c, _d, _in[12] + 0x6b901122,  7); \
+	MD5STEP(MD5_F1, _d, _a, _b, _c, _in[13] + 0xfd987193, 12); \
+	MD5STEP(MD5_F1, _c, _d, _a, _b, _in[14] + 0xa679438e, 17); \
+	MD5STEP(MD5_F1, _b, _c, _d, _a, _in[15] + 0x49b40821, 22); \
+	\
+	MD5STEP(MD5_F2, _a, _b, _c, _d, _in[ 1] + 0xf61e2562,  5); \
+	MD5STEP(MD5_F2, _d, _a, _b, _c, _in[ 6] + 0xc040b340,  9); \
+	MD5STEP(MD5_F2, _c, _d, _a, _b, _in[11] + 0x265e5a51, 14); \
+	MD5STEP(MD5_F2, _b, _c, _d, _a, _in[ 0] + 0xe9b6c7aa, 20); \
+	MD5STEP(MD5_F2, _a, _b, _c, _d, _in[ 5] + 0xd62f105d,  5); \
+	MD5STEP(MD5_F2, _d, _a, _b, _c, _in[10] + 0x02441453,  9); \
+	MD5STEP(MD5_F2, _c, _d, _a, _b, _in[15] + 0xd8a1e681, 14); \
+	MD5STEP(MD5_F2, _b, _c, _d, _a, _in[ 4] + 0xe7d3fbc8, 20); \
+	MD5STEP(MD5_F2, _a, _b, _c, _d, _in[ 9] + 0x21e1cde6,  5); \
+	MD5STEP(MD5_F2, _d, _a, _b, _c, _in[14] + 0xc33707d6,  9); \
+	MD5STEP(MD5_F2, _c, _d, _a, _b, _in[ 3] + 0xf4d50d87, 14); \
+	MD5STEP(MD5_F2, _b, _c, _d, _a, _in[ 8] + 0x455a14ed, 20); \
+	MD5STEP(MD5_F2, _a, _b, _c, _d, _in[13] + 0xa9e3e905,  5); \
+	MD5STEP(MD5_F2, _d, _a, _b, _c, _in[ 2] + 0xfcefa3f8,  9); \
+	MD5STEP(MD5_F2, _c, _d, _a, _b, _in[ 7] + 0x676f02d9, 14); \
+	MD5STEP(MD5_F2, _b, _c, _d, _a, _in[12] + 0x8d2a4c8a, 20); \
+	\
+	MD5STEP(MD5_F3, _a, _b, _c, _d, _in[ 5] + 0xfffa3942,  4); \
+	MD5STEP(MD5_F3, _d, _a, _b, _c, _in[ 8] + 0x8771f681, 11); \
+	MD5STEP(MD5_F3, _c, _d, _a, _b, _in[11] + 0x6d9d6122, 16); \
+	MD5STEP(MD5_F3, _b, _c, _d, _a, _in[14] + 0xfde5380c, 23); \
+	MD5STEP(MD5_F3, _a, _b, _c, _d, _in[ 1] + 0xa4beea44,  4); \
+	MD5STEP(MD5_F3, _d, _a, _b, _c, _in[ 4] + 0x4bdecfa9, 11); \
+	MD5STEP(MD5_F3, _c, _d, _a, _b, _in[ 7] + 0xf6bb4b60, 16); \
+	MD5STEP(MD5_F3, _b, _c, _d, _a, _in[10] + 0xbebfbc70, 23); \
+	MD5STEP(MD5_F3, _a, _b, _c, _d, _in[13] + 0x289b7ec6,  4); \
+	MD5STEP(MD5_F3, _d, _a, _b, _c, _in[ 0] + 0xeaa127fa, 11); \
+	MD5STEP(MD5_F3, _c, _d, _a, _b, _in[ 3] + 0xd4ef3085, 16); \
+	MD5STEP(MD5_F3, _b, _c, _d, _a, _in[ 6] + 0x04881d05, 23); \
+	MD5STEP(MD5_F3, _a, _b, _c, _d, _in[ 9] + 0xd9d4d039,  4); \
+	MD5STEP(MD5_F3, _d, _a, _b, _c, _in[12] + 0xe6db99e5, 11); \
+	MD5STEP(MD5_F3, _c, _d, _a, _b, _in[15] + 0x1fa27cf8, 16); \
+	MD5STEP(MD5_F3, _b, _c, _d, _a, _in[2 ] + 0xc4ac5665, 23); \
+	\
+	MD5STEP(MD5_F4, _a, _b, _c, _d, _in[ 0] + 0xf4292244,  6); \
+	MD5STEP(MD5_F4, _d, _a, _b, _c, _in[7 ] + 0x432aff97, 10); \
+	MD5STEP(MD5_F4, _c, _d, _a, _b, _in[14] + 0xab9423a7, 15); \
+	MD5STEP(MD5_F4, _b, _c, _d, _a, _in[5 ] + 0xfc93a039, 21); \
+	MD5STEP(MD5_F4, _a, _b, _c, _d, _in[12] + 0x655b59c3,  6); \
+	MD5STEP(MD5_F4, _d, _a, _b, _c, _in[3 ] + 0x8f0ccc92, 10); \
+	MD5STEP(MD5_F4, _c, _d, _a, _b, _in[10] + 0xffeff47d, 15); \
+	MD5STEP(MD5_F4, _b, _c, _d, _a, _in[1 ] + 0x85845dd1, 21); \
+	MD5STEP(MD5_F4, _a, _b, _c, _d, _in[8 ] + 0x6fa87e4f,  6); \
+	MD5STEP(MD5_F4, _d, _a, _b, _c, _in[15] + 0xfe2ce6e0, 10); \
+	MD5STEP(MD5_F4, _c, _d, _a, _b, _in[6 ] + 0xa3014314, 15); \
+	MD5STEP(MD5_F4, _b, _c, _d, _a, _in[13] + 0x4e0811a1, 21); \
+	MD5STEP(MD5_F4, _a, _b, _c, _d, _in[4 ] + 0xf7537e82,  6); \
+	MD5STEP(MD5_F4, _d, _a, _b, _c, _in[11] + 0xbd3af235, 10); \
+	MD5STEP(MD5_F4, _c, _d, _a, _b, _in[2 ] + 0x2ad7d2bb, 15); \
+	MD5STEP(MD5_F4, _b, _c, _d, _a, _in[9 ] + 0xeb86d391, 21); \
+} while (0)
+
 /** The core of the MD5 algorithm
  *
  * This alters an existing MD5 hash to reflect the addition of 16
@@ -202,73 +274,7 @@ static void fr_md5_local_transform(uint32_t state[static 4], uint8_t const block
 	c = state[2];
 	d = state[3];
 
-	MD5STEP(MD5_F1, a, b, c, d, in[ 0] + 0xd76aa478,  7);
-	MD5STEP(MD5_F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12);
-	MD5STEP(MD5_F1, c, d, a, b, in[ 2] + 0x242070db, 17);
-	MD5STEP(MD5_F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22);
-	MD5STEP(MD5_F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7);
-	MD5STEP(MD5_F1, d, a, b, c, in[ 5] + 0x4787c62a, 12);
-	MD5STEP(MD5_F1, c, d, a, b, in[ 6] + 0xa8304613, 17);
-	MD5STEP(MD5_F1, b, c, d, a, in[ 7] + 0xfd469501, 22);
-	MD5STEP(MD5_F1, a, b, c, d, in[ 8] + 0x698098d8,  7);
-	MD5STEP(MD5_F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12);
-	MD5STEP(MD5_F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
-	MD5STEP(MD5_F1, b, c, d, a, in[11] + 0x895cd7be, 22);
-	MD5STEP(MD5_F1, a, b, c, d, in[12] + 0x6b901122,  7);
-	MD5STEP(MD5_F1, d, a, b, c, in[13] + 0xfd987193, 12);
-	MD5STEP(MD5_F1, c, d, a, b, in[14] + 0xa679438e, 17);
-	MD5STEP(MD5_F1, b, c, d, a, in[15] + 0x49b40821, 22);
-
-	MD5STEP(MD5_F2, a, b, c, d, in[ 1] + 0xf61e2562,  5);
-	MD5STEP(MD5_F2, d, a, b, c, in[ 6] + 0xc040b340,  9);
-	MD5STEP(MD5_F2, c, d, a, b, in[11] + 0x265e5a51, 14);
-	MD5STEP(MD5_F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20);
-	MD5STEP(MD5_F2, a, b, c, d, in[ 5] + 0xd62f105d,  5);
-	MD5STEP(MD5_F2, d, a, b, c, in[10] + 0x02441453,  9);
-	MD5STEP(MD5_F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
-	MD5STEP(MD5_F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20);
-	MD5STEP(MD5_F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5);
-	MD5STEP(MD5_F2, d, a, b, c, in[14] + 0xc33707d6,  9);
-	MD5STEP(MD5_F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14);
-	MD5STEP(MD5_F2, b, c, d, a, in[ 8] + 0x455a14ed, 20);
-	MD5STEP(MD5_F2, a, b, c, d, in[13] + 0xa9e3e905,  5);
-	MD5STEP(MD5_F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9);
-	MD5STEP(MD5_F2, c, d, a, b, in[ 7] + 0x676f02d9, 14);
-	MD5STEP(MD5_F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
-
-	MD5STEP(MD5_F3, a, b, c, d, in[ 5] + 0xfffa3942,  4);
-	MD5STEP(MD5_F3, d, a, b, c, in[ 8] + 0x8771f681, 11);
-	MD5STEP(MD5_F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
-	MD5STEP(MD5_F3, b, c, d, a, in[14] + 0xfde5380c, 23);
-	MD5STEP(MD5_F3, a, b, c, d, in[ 1] + 0xa4beea44,  4);
-	MD5STEP(MD5_F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11);
-	MD5STEP(MD5_F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16);
-	MD5STEP(MD5_F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
-	MD5STEP(MD5_F3, a, b, c, d, in[13] + 0x289b7ec6,  4);
-	MD5STEP(MD5_F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11);
-	MD5STEP(MD5_F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16);
-	MD5STEP(MD5_F3, b, c, d, a, in[ 6] + 0x04881d05, 23);
-	MD5STEP(MD5_F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4);
-	MD5STEP(MD5_F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
-	MD5STEP(MD5_F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
-	MD5STEP(MD5_F3, b, c, d, a, in[2 ] + 0xc4ac5665, 23);
-
-	MD5STEP(MD5_F4, a, b, c, d, in[ 0] + 0xf4292244,  6);
-	MD5STEP(MD5_F4, d, a, b, c, in[7 ] + 0x432aff97, 10);
-	MD5STEP(MD5_F4, c, d, a, b, in[14] + 0xab9423a7, 15);
-	MD5STEP(MD5_F4, b, c, d, a, in[5 ] + 0xfc93a039, 21);
-	MD5STEP(MD5_F4, a, b, c, d, in[12] + 0x655b59c3,  6);
-	MD5STEP(MD5_F4, d, a, b, c, in[3 ] + 0x8f0ccc92, 10);
-	MD5STEP(MD5_F4, c, d, a, b, in[10] + 0xffeff47d, 15);
-	MD5STEP(MD5_F4, b, c, d, a, in[1 ] + 0x85845dd1, 21);
-	MD5STEP(MD5_F4, a, b, c, d, in[8 ] + 0x6fa87e4f,  6);
-	MD5STEP(MD5_F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
-	MD5STEP(MD5_F4, c, d, a, b, in[6 ] + 0xa3014314, 15);
-	MD5STEP(MD5_F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
-	MD5STEP(MD5_F4, a, b, c, d, in[4 ] + 0xf7537e82,  6);
-	MD5STEP(MD5_F4, d, a, b, c, in[11] + 0xbd3af235, 10);
-	MD5STEP(MD5_F4, c, d, a, b, in[2 ] + 0x2ad7d2bb, 15);
-	MD5STEP(MD5_F4, b, c, d, a, in[9 ] + 0xeb86d391, 21);
+	MD5_ROUNDS(a, b, c, d, in);
 
 	state[0] += a;
 	state[1] += b;
@@ -466,6 +472,300 @@ void fr_md5_calc(uint8_t out[static MD5_DIGEST_LENGTH], uint8_t const *in, size_
 	fr_md5_ctx_free_from_list(&ctx);
 }
 
+/*
+ *	Multi-buffer MD5
+ *
+ *	MD5 is a long chain of dependent 32bit operations, so a single
+ *	digest can't use the wider registers on modern CPUs.  We can
+ *	however run the same operation on one block from each of several
+ *	independent messages, with each message in one lane of a vector.
+ *
+ *	The transform is written using the compiler's vector extensions,
+ *	and is built for several vector widths.  The widest the CPU
+ *	supports is selected at runtime.
+ */
+#define MD5_MULTI_LANES_MAX	16
+
+/** Per-lane state used by #fr_md5_calc_multi
+ *
+ */
+typedef struct {
+	fr_md5_multi_t const	*msg;				//!< Being digested, or NULL if the lane is idle.
+	unsigned int		iov_idx;			//!< Current element of msg->iov.
+	size_t			iov_off;			//!< Offset into the current element.
+	uint64_t		len;				//!< Total length of the message.
+	bool			terminated;			//!< Whether the 0x80 terminator has been added.
+	uint8_t			block[MD5_BLOCK_LENGTH];	//!< Next block to transform.
+} md5_multi_lane_t;
+
+/** Transform one block from each lane
+ *
+ * @param[in,out] state		state[n][lane] is word n of the lane's digest state.
+ * @param[in] block		One block per lane.
+ */
+typedef void (*md5_multi_transform_t)(uint32_t state[static 4][MD5_MULTI_LANES_MAX],
+				      uint8_t const *block[static MD5_MULTI_LANES_MAX]);
+
+typedef struct {
+	char const		*name;				//!< Of the implementation.
+	unsigned int		lanes;				//!< How many messages are digested at once.
+	md5_multi_transform_t	transform;			//!< Transform function.
+} md5_multi_impl_t;
+
+static inline CC_HINT(always_inline) uint32_t md5_get_32bit_le(uint8_t const *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** Single lane transform, used when only one message is available
+ *
+ */
+static void md5_multi_transform_x1(uint32_t state[static 4][MD5_MULTI_LANES_MAX],
+				   uint8_t const *block[static MD5_MULTI_LANES_MAX])
+{
+	uint32_t s[4] = { state[0][0], state[1][0], state[2][0], state[3][0] };
+
+	fr_md5_local_transform(s, block[0]);
+
+	state[0][0] = s[0];
+	state[1][0] = s[1];
+	state[2][0] = s[2];
+	state[3][0] = s[3];
+}
+
+#ifdef __GNUC__
+/** Define a transform operating on _lanes blocks at once
+ *
+ * Words are transposed so that each vector holds the same word from
+ * every lane, then the rounds run exactly as they do for the scalar
+ * transform.
+ */
+#  define MD5_MULTI_TRANSFORM(_name, _lanes, ...) \
+static __VA_ARGS__ void _name(uint32_t state[static 4][MD5_MULTI_LANES_MAX], \
+			      uint8_t const *block[static MD5_MULTI_LANES_MAX]) \
+{ \
+	typedef uint32_t md5_vec_t __attribute__((vector_size((_lanes) * sizeof(uint32_t)))); \
+	uint32_t	words[MD5_BLOCK_LENGTH / 4][_lanes]; \
+	md5_vec_t	a, b, c, d, sa, sb, sc, sd, in[MD5_BLOCK_LENGTH / 4]; \
+	unsigned int	i, j; \
+	for (i = 0; i < (MD5_BLOCK_LENGTH / 4); i++) { \
+		for (j = 0; j < (_lanes); j++) words[i][j] = md5_get_32bit_le(block[j] + (i * 4)); \
+	} \
+	memcpy(in, words, sizeof(in)); \
+	memcpy(&sa, state[0], sizeof(sa)); \
+	memcpy(&sb, state[1], sizeof(sb)); \
+	memcpy(&sc, state[2], sizeof(sc)); \
+	memcpy(&sd, state[3], sizeof(sd)); \
+	a = sa; \
+	b = sb; \
+	c = sc; \
+	d = sd; \
+	MD5_ROUNDS(a, b, c, d, in); \
+	a += sa; \
+	b += sb; \
+	c += sc; \
+	d += sd; \
+	memcpy(state[0], &a, sizeof(a)); \
+	memcpy(state[1], &b, sizeof(b)); \
+	memcpy(state[2], &c, sizeof(c)); \
+	memcpy(state[3], &d, sizeof(d)); \
+}
+
+MD5_MULTI_TRANSFORM(md5_multi_transform_x4, 4)
+
+#  if defined(__x86_64__) || defined(__i386__)
+#    define HAVE_MD5_MULTI_X86
+MD5_MULTI_TRANSFORM(md5_multi_transform_avx2, 8, CC_HINT(target("avx2")))
+MD5_MULTI_TRANSFORM(md5_multi_transform_avx512, 16, CC_HINT(target("avx512f")))
+#  endif
+#endif
+
+/** Available implementations, narrowest first
+ *
+ */
+static md5_multi_impl_t const md5_multi_impls[] = {
+	{ .name = "scalar",	.lanes = 1,	.transform = md5_multi_transform_x1 },
+#ifdef __GNUC__
+	{ .name = "x4",		.lanes = 4,	.transform = md5_multi_transform_x4 },
+#endif
+#ifdef HAVE_MD5_MULTI_X86
+	{ .name = "avx2",	.lanes = 8,	.transform = md5_multi_transform_avx2 },
+	{ .name = "avx512",	.lanes = 16,	.transform = md5_multi_transform_avx512 }
+#endif
+};
+
+/** Return whether the CPU can run a given implementation
+ *
+ */
+static bool md5_multi_impl_usable(md5_multi_impl_t const *impl)
+{
+#ifdef HAVE_MD5_MULTI_X86
+	if (impl->transform == md5_multi_transform_avx2) return fr_hw_has_feature(FR_HW_FEATURE_AVX2);
+	if (impl->transform == md5_multi_transform_avx512) return fr_hw_has_feature(FR_HW_FEATURE_AVX512F);
+#endif
+	return true;
+}
+
+/** Pick the widest implementation which has no idle lanes when digesting num messages
+ *
+ * Idle lanes cost as much as busy ones, so with only a couple of
+ * messages the scalar transform is faster.
+ */
+static md5_multi_impl_t const *md5_multi_impl_select(size_t num)
+{
+	md5_multi_impl_t const	*best = &md5_multi_impls[0];
+	size_t			i;
+
+	for (i = 1; i < NUM_ELEMENTS(md5_multi_impls); i++) {
+		if (md5_multi_impls[i].lanes > num) break;
+		if (!md5_multi_impl_usable(&md5_multi_impls[i])) continue;
+
+		best = &md5_multi_impls[i];
+	}
+
+	return best;
+}
+
+/** Return the number of messages #fr_md5_calc_multi will digest at once
+ *
+ * @return the widest vector implementation the CPU supports, in lanes.
+ */
+unsigned int fr_md5_multi_lanes(void)
+{
+	return md5_multi_impl_select(SIZE_MAX)->lanes;
+}
+
+/** Start digesting a new message in a lane
+ *
+ */
+static void md5_multi_lane_load(md5_multi_lane_t *lane, uint32_t state[static 4][MD5_MULTI_LANES_MAX],
+				unsigned int i, fr_md5_multi_t const *msg)
+{
+	unsigned int j;
+
+	lane->msg = msg;
+	lane->iov_idx = 0;
+	lane->iov_off = 0;
+	lane->terminated = false;
+	lane->len = 0;
+	for (j = 0; j < msg->iovcnt; j++) lane->len += msg->iov[j].iov_len;
+
+	state[0][i] = 0x67452301;
+	state[1][i] = 0xefcdab89;
+	state[2][i] = 0x98badcfe;
+	state[3][i] = 0x10325476;
+}
+
+/** Fill the lane's block with the next 64 bytes of its message, adding padding as needed
+ *
+ * @return
+ *	- true if this is the final block of the message.
+ *	- false if there are more blocks to come.
+ */
+static bool md5_multi_lane_fill(md5_multi_lane_t *lane)
+{
+	fr_md5_multi_t const	*msg = lane->msg;
+	size_t			used = 0;
+	uint64_t		bits;
+
+	while ((used < MD5_BLOCK_LENGTH) && (lane->iov_idx < msg->iovcnt)) {
+		struct iovec const	*iov = &msg->iov[lane->iov_idx];
+		size_t			len = iov->iov_len - lane->iov_off;
+
+		if (len > (MD5_BLOCK_LENGTH - used)) len = MD5_BLOCK_LENGTH - used;
+		if (len > 0) memcpy(lane->block + used, (uint8_t const *)iov->iov_base + lane->iov_off, len);
+
+		used += len;
+		lane->iov_off += len;
+		if (lane->iov_off == iov->iov_len) {
+			lane->iov_idx++;
+			lane->iov_off = 0;
+		}
+	}
+	if (used == MD5_BLOCK_LENGTH) return false;
+
+	if (!lane->terminated) {
+		lane->block[used++] = 0x80;
+		lane->terminated = true;
+	}
+
+	/*
+	 *	No room for the length, it goes in the next block.
+	 */
+	if (used > (MD5_BLOCK_LENGTH - 8)) {
+		memset(lane->block + used, 0, MD5_BLOCK_LENGTH - used);
+		return false;
+	}
+	memset(lane->block + used, 0, (MD5_BLOCK_LENGTH - 8) - used);
+
+	bits = lane->len << 3;
+	for (used = 0; used < 8; used++) lane->block[(MD5_BLOCK_LENGTH - 8) + used] = (uint8_t)(bits >> (used * 8));
+
+	return true;
+}
+
+/** Calculate the MD5 digests of multiple independent messages
+ *
+ * Messages are assigned to lanes of the widest vector implementation
+ * the CPU supports.  When a lane's message is complete, the next
+ * message is loaded into it, so messages of different lengths
+ * keep all the lanes busy.
+ *
+ * The output is identical to calling #fr_md5_calc on each message.
+ *
+ * @param[in] msgs	Messages to digest.
+ * @param[in] num	Number of messages.
+ */
+void fr_md5_calc_multi(fr_md5_multi_t const *msgs, size_t num)
+{
+	md5_multi_impl_t const	*impl = md5_multi_impl_select(num);
+	md5_multi_lane_t	lane[MD5_MULTI_LANES_MAX];
+	uint32_t		state[4][MD5_MULTI_LANES_MAX];
+	uint8_t const		*block[MD5_MULTI_LANES_MAX];
+	bool			last[MD5_MULTI_LANES_MAX];
+	unsigned int		i, j, active = 0;
+	size_t			next = 0;
+
+	for (i = 0; i < impl->lanes; i++) {
+		block[i] = lane[i].block;
+
+		if (next < num) {
+			md5_multi_lane_load(&lane[i], state, i, &msgs[next++]);
+			active++;
+			continue;
+		}
+
+		/*
+		 *	Idle lanes are still transformed, their
+		 *	results are ignored.
+		 */
+		lane[i].msg = NULL;
+		memset(lane[i].block, 0, sizeof(lane[i].block));
+	}
+
+	while (active > 0) {
+		for (i = 0; i < impl->lanes; i++) {
+			last[i] = lane[i].msg ? md5_multi_lane_fill(&lane[i]) : false;
+		}
+
+		impl->transform(state, block);
+
+		for (i = 0; i < impl->lanes; i++) {
+			if (!last[i]) continue;
+
+			for (j = 0; j < 4; j++) PUT_32BIT_LE(lane[i].msg->out + (j * 4), state[j][i]);
+
+			if (next < num) {
+				md5_multi_lane_load(&lane[i], state, i, &msgs[next++]);
+				continue;
+			}
+
+			lane[i].msg = NULL;
+			active--;
+		}
+	}
+}
+
 static int _md5_ctx_free_on_exit(void *arg)
 {
 	int i;
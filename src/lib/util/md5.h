@@ -20,6 +20,7 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #ifndef MD5_DIGEST_LENGTH
 #  define MD5_DIGEST_LENGTH 16
@@ -83,6 +84,19 @@ extern		fr_md5_final_t		fr_md5_final;
  */
 void		fr_md5_calc(uint8_t out[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen);
 
+/** A message to digest with #fr_md5_calc_multi
+ *
+ */
+typedef struct {
+	struct iovec const	*iov;		//!< Data to digest, in order.
+	unsigned int		iovcnt;		//!< Number of elements in iov.
+	uint8_t			*out;		//!< Where to write the MD5_DIGEST_LENGTH byte digest.
+} fr_md5_multi_t;
+
+void		fr_md5_calc_multi(fr_md5_multi_t const *msgs, size_t num);
+
+unsigned int	fr_md5_multi_lanes(void);
+
 /** Allocate an MD5 context from a free list
  *
  */
@@ -96,6 +110,20 @@ void		fr_md5_ctx_free_from_list(fr_md5_ctx_t **ctx);
 /* hmac.c */
 int		fr_hmac_md5(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
 			    uint8_t const *key, size_t key_len);
+
+/** A message to authenticate with #fr_hmac_md5_multi
+ *
+ */
+typedef struct {
+	uint8_t const		*in;		//!< Data to authenticate.
+	size_t			inlen;		//!< Length of in.
+	uint8_t const		*key;		//!< HMAC key.
+	size_t			key_len;	//!< Length of key.
+	uint8_t			*out;		//!< Where to write the MD5_DIGEST_LENGTH byte digest.
+} fr_hmac_md5_multi_t;
+
+void		fr_hmac_md5_multi(fr_hmac_md5_multi_t const *msgs, size_t num);
+
 #ifdef __cplusplus
 }
 #endif
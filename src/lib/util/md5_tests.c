@@ -0,0 +1,175 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the multi-buffer MD5 functions
+ *
+ * @file src/lib/util/md5_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/md5.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/time.h>
+
+#define MD5_TEST_MSGS		300		//!< More than any implementation has lanes.
+#define MD5_TEST_DATA		1024
+#define MD5_BENCH_PACKET	120		//!< Typical size of an Access-Request.
+#define MD5_BENCH_BATCH		64
+#define MD5_BENCH_ITERATIONS	20000
+
+static uint8_t	data[MD5_TEST_DATA + MD5_TEST_MSGS];
+
+static void md5_test_data_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(data); i++) data[i] = fr_rand();
+}
+
+/** RFC 1321 test vectors
+ *
+ */
+static void test_md5_multi_vectors(void)
+{
+	static char const	*in[] = {
+					"",
+					"a",
+					"abc",
+					"message digest",
+					"abcdefghijklmnopqrstuvwxyz",
+					"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+					"12345678901234567890123456789012345678901234567890123456789012345678901234567890"
+				};
+	static uint8_t const	expected[][MD5_DIGEST_LENGTH] = {
+					{ 0xd4, 0x1d, 0x8c, 0xd9, 0x8f, 0x00, 0xb2, 0x04,
+					  0xe9, 0x80, 0x09, 0x98, 0xec, 0xf8, 0x42, 0x7e },
+					{ 0x0c, 0xc1, 0x75, 0xb9, 0xc0, 0xf1, 0xb6, 0xa8,
+					  0x31, 0xc3, 0x99, 0xe2, 0x69, 0x77, 0x26, 0x61 },
+					{ 0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0,
+					  0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72 },
+					{ 0xf9, 0x6b, 0x69, 0x7d, 0x7c, 0xb7, 0x93, 0x8d,
+					  0x52, 0x5a, 0x2f, 0x31, 0xaa, 0xf1, 0x61, 0xd0 },
+					{ 0xc3, 0xfc, 0xd3, 0xd7, 0x61, 0x92, 0xe4, 0x00,
+					  0x7d, 0xfb, 0x49, 0x6c, 0xca, 0x67, 0xe1, 0x3b },
+					{ 0xd1, 0x74, 0xab, 0x98, 0xd2, 0x77, 0xd9, 0xf5,
+					  0xa5, 0x61, 0x1c, 0x2c, 0x9f, 0x41, 0x9d, 0x9f },
+					{ 0x57, 0xed, 0xf4, 0xa2, 0x2b, 0xe3, 0xc9, 0x55,
+					  0xac, 0x49, 0xda, 0x2e, 0x21, 0x07, 0xb6, 0x7a }
+				};
+	struct iovec		iov[NUM_ELEMENTS(in)];
+	fr_md5_multi_t		msgs[NUM_ELEMENTS(in)];
+	uint8_t			out[NUM_ELEMENTS(in)][MD5_DIGEST_LENGTH];
+	size_t			i;
+
+	for (i = 0; i < NUM_ELEMENTS(in); i++) {
+		iov[i] = (struct iovec){ .iov_base = UNCONST(char *, in[i]), .iov_len = strlen(in[i]) };
+		msgs[i] = (fr_md5_multi_t){ .iov = &iov[i], .iovcnt = 1, .out = out[i] };
+	}
+
+	fr_md5_calc_multi(msgs, NUM_ELEMENTS(in));
+
+	for (i = 0; i < NUM_ELEMENTS(in); i++) {
+		TEST_CHECK(memcmp(out[i], expected[i], MD5_DIGEST_LENGTH) == 0);
+		TEST_MSG("Digest of \"%s\" is wrong", in[i]);
+	}
+}
+
+/** Check digests of many messages, split over multiple iovecs, match fr_md5_calc
+ *
+ * Batches of every size up to more than the widest implementation are
+ * used, with messages of different lengths, so lanes finish and are
+ * refilled at different times.
+ */
+static void test_md5_multi_calc(void)
+{
+	static struct iovec	iov[MD5_TEST_MSGS][3];
+	static fr_md5_multi_t	msgs[MD5_TEST_MSGS];
+	static uint8_t		out[MD5_TEST_MSGS][MD5_DIGEST_LENGTH];
+	size_t			num, i;
+
+	md5_test_data_init();
+
+	for (num = 0; num <= MD5_TEST_MSGS; num += (num < 40) ? 1 : 37) {
+		for (i = 0; i < num; i++) {
+			size_t len = ((i * 131) + num) % MD5_TEST_DATA;
+			size_t first = len / 3, second = len / 2 - first;
+
+			iov[i][0] = (struct iovec){ .iov_base = data + i, .iov_len = first };
+			iov[i][1] = (struct iovec){ .iov_base = data + i + first, .iov_len = second };
+			iov[i][2] = (struct iovec){ .iov_base = data + i + first + second, .iov_len = len - (first + second) };
+			msgs[i] = (fr_md5_multi_t){ .iov = iov[i], .iovcnt = 3, .out = out[i] };
+		}
+
+		fr_md5_calc_multi(msgs, num);
+
+		for (i = 0; i < num; i++) {
+			uint8_t expected[MD5_DIGEST_LENGTH];
+			size_t	len = iov[i][0].iov_len + iov[i][1].iov_len + iov[i][2].iov_len;
+
+			fr_md5_calc(expected, data + i, len);
+			TEST_CHECK(memcmp(out[i], expected, MD5_DIGEST_LENGTH) == 0);
+			TEST_MSG("Batch of %zu, message %zu, length %zu", num, i, len);
+		}
+	}
+}
+
+/** Compare packets per second digested one at a time, and in batches
+ *
+ */
+static void test_md5_multi_bench(void)
+{
+	static uint8_t	packets[MD5_BENCH_BATCH][MD5_BENCH_PACKET];
+	struct iovec	iov[MD5_BENCH_BATCH];
+	fr_md5_multi_t	msgs[MD5_BENCH_BATCH];
+	uint8_t		out[MD5_BENCH_BATCH][MD5_DIGEST_LENGTH];
+	fr_time_t	start;
+	fr_time_delta_t	single, multi;
+	size_t		i, j;
+
+	for (i = 0; i < MD5_BENCH_BATCH; i++) {
+		for (j = 0; j < MD5_BENCH_PACKET; j++) packets[i][j] = fr_rand();
+		iov[i] = (struct iovec){ .iov_base = packets[i], .iov_len = MD5_BENCH_PACKET };
+		msgs[i] = (fr_md5_multi_t){ .iov = &iov[i], .iovcnt = 1, .out = out[i] };
+	}
+
+	start = fr_time();
+	for (i = 0; i < MD5_BENCH_ITERATIONS; i++) {
+		for (j = 0; j < MD5_BENCH_BATCH; j++) fr_md5_calc(out[j], packets[j], MD5_BENCH_PACKET);
+	}
+	single = fr_time_sub(fr_time(), start);
+
+	start = fr_time();
+	for (i = 0; i < MD5_BENCH_ITERATIONS; i++) fr_md5_calc_multi(msgs, MD5_BENCH_BATCH);
+	multi = fr_time_sub(fr_time(), start);
+
+	TEST_MSG_ALWAYS("\nlanes: %u\n", fr_md5_multi_lanes());
+	TEST_MSG_ALWAYS("single: %.0f packets/s\n",
+			(double)(MD5_BENCH_ITERATIONS * MD5_BENCH_BATCH) /
+			((double)fr_time_delta_unwrap(single) / (double)NSEC));
+	TEST_MSG_ALWAYS("multi: %.0f packets/s\n",
+			(double)(MD5_BENCH_ITERATIONS * MD5_BENCH_BATCH) /
+			((double)fr_time_delta_unwrap(multi) / (double)NSEC));
+}
+
+TEST_LIST = {
+	{ "md5_multi_vectors",		test_md5_multi_vectors },
+	{ "md5_multi_calc",		test_md5_multi_calc },
+	{ "md5_multi_bench",		test_md5_multi_bench },
+
+	{ NULL }
+};
@@ -56,7 +56,83 @@ void fr_pair_list_init(fr_pair_list_t *list)
 #ifdef WITH_VERIFY_PTR
 	list->verified = true;
 #endif
+	list->index = NULL;
+	list->lazy = NULL;
 	list->is_child = false;
+	list->lazy_failed = false;
+}
+
+/** Defer creation of some of the pairs in a list
+ *
+ * Used by protocol decoders to avoid allocating pairs which are
+ * never looked at.  Lookups by #fr_dict_attr_t only create the
+ * pairs matching that attribute.  Anything else which needs the
+ * complete list, such as iterating over it, creates all remaining
+ * pairs first.
+ *
+ * The decoder should insert deferred pairs where they would have
+ * been if they'd been created immediately, so that the order of
+ * the list doesn't depend on which pairs were looked at first.
+ *
+ * @param[in] list	to defer pair creation for.
+ * @param[in] lazy	callback and state to create the pairs.  Must remain
+ *			valid until the callback indicates there are no more
+ *			pairs, or the list is freed.
+ */
+void fr_pair_list_lazy_set(fr_pair_list_t *list, fr_pair_list_lazy_t const *lazy)
+{
+	fr_assert(!list->lazy);
+
+	list->lazy = lazy;
+}
+
+/** Create pairs a protocol decoder deferred
+ *
+ * If the decoder fails, the list is marked as failed, and any remaining
+ * deferred pairs are discarded.  Pairs which were never created can't be
+ * told apart from pairs which were never in the packet, so callers should
+ * check #fr_pair_list_lazy_failed before trusting the contents of the list.
+ *
+ * @param[in] list	to create pairs in.
+ * @param[in] da	to create pairs for.  If NULL, all remaining pairs are created.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, or if creating deferred pairs previously failed.
+ */
+int fr_pair_list_lazy_materialise(fr_pair_list_t const *list, fr_dict_attr_t const *da)
+{
+	fr_pair_list_t			*our_list = UNCONST(fr_pair_list_t *, list);
+	fr_pair_list_lazy_t const	*lazy = list->lazy;
+	int				ret;
+
+	if (!lazy) return list->lazy_failed ? -1 : 0;
+
+	/*
+	 *	The decoder adds pairs using the normal
+	 *	API, which must not recurse back into it.
+	 */
+	our_list->lazy = NULL;
+	ret = lazy->decode(our_list, da, lazy->uctx);
+	if (ret < 0) {
+		our_list->lazy_failed = true;
+		return -1;
+	}
+
+	if (ret > 0) our_list->lazy = lazy;
+
+	return 0;
+}
+
+/** Whether a protocol decoder failed to create the pairs it deferred
+ *
+ * @param[in] list	to check.
+ * @return
+ *	- true if pairs are missing from the list.
+ *	- false if all pairs which have been looked at were created.
+ */
+bool fr_pair_list_lazy_failed(fr_pair_list_t const *list)
+{
+	return list->lazy_failed;
 }
 
 /** Free a fr_pair_t
@@ -325,6 +401,11 @@ int fr_pair_reinit_from_da(fr_pair_list_t *list, fr_pair_t *vp, fr_dict_attr_t c
 		fr_value_box_init(&vp->data, da->type, da, false);
 	}
 
+	/*
+	 *	The pair's entry in the index would be under the wrong da.
+	 */
+	if (fr_pair_order_list_in_a_list(vp)) pair_list_index_invalidate(fr_pair_parent_list(vp));
+
 	to_free = vp->da;
 	vp->da = da;
 
@@ -598,6 +679,8 @@ int fr_pair_raw_afrom_pair(fr_pair_t *vp, uint8_t const *data, size_t data_len)
 	unknown = fr_dict_unknown_afrom_da(vp, vp->da);
 	if (!unknown) return -1;
 
+	if (fr_pair_order_list_in_a_list(vp)) pair_list_index_invalidate(fr_pair_parent_list(vp));
+
 	vp->da = unknown;
 	fr_assert(vp->da->type == FR_TYPE_OCTETS);
 
@@ -674,6 +757,58 @@ unsigned int fr_pair_count_by_da(fr_pair_list_t const *list, fr_dict_attr_t cons
 	return count;
 }
 
+static uint32_t pair_index_hash(void const *data)
+{
+	fr_dict_attr_t const *da = *((fr_dict_attr_t const * const *)data);
+
+	return fr_hash(&da, sizeof(da));
+}
+
+static int8_t pair_index_cmp(void const *one, void const *two)
+{
+	fr_dict_attr_t const *a = *((fr_dict_attr_t const * const *)one);
+	fr_dict_attr_t const *b = *((fr_dict_attr_t const * const *)two);
+
+	return CMP(a, b);
+}
+
+/** Return the index for a list, building it if the list is large enough
+ *
+ * Only the children of pairs are indexed, so the index can be parented
+ * by the pair, and is freed with it.  Lists on the stack, or lists which
+ * aren't children of pairs are always searched linearly.
+ *
+ * The index maps each #fr_dict_attr_t to the first pair in the list with
+ * that da.  It's maintained by the functions which insert and remove pairs,
+ * and discarded on modifications where maintaining it would be expensive.
+ *
+ * @param[in] list	to return the index for.
+ * @return
+ *	- The index.
+ *	- NULL if the list shouldn't be indexed.
+ */
+static inline CC_HINT(always_inline) fr_hash_table_t *pair_list_index(fr_pair_list_t const *list)
+{
+	fr_pair_list_t	*our_list;
+	fr_pair_t	*vp = NULL;
+
+	if (list->index) return list->index;
+
+	if (!list->is_child ||
+	    (fr_pair_order_list_num_elements(&list->order) < FR_PAIR_LIST_INDEX_THRESHOLD)) return NULL;
+
+	our_list = UNCONST(fr_pair_list_t *, list);
+	our_list->index = fr_hash_table_alloc(fr_pair_list_parent(list), pair_index_hash, pair_index_cmp, NULL);
+	if (unlikely(!our_list->index)) return NULL;
+
+	/*
+	 *	Insert fails for all instances after the first.
+	 */
+	while ((vp = fr_pair_order_list_next(&our_list->order, vp))) (void) fr_hash_table_insert(our_list->index, vp);
+
+	return our_list->index;
+}
+
 /** Find the first pair with a matching da
  *
  * @param[in] list	to search in.
@@ -688,12 +823,20 @@ unsigned int fr_pair_count_by_da(fr_pair_list_t const *list, fr_dict_attr_t cons
 fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_pair_t const *prev, fr_dict_attr_t const *da)
 {
 	fr_pair_t *vp = UNCONST(fr_pair_t *, prev);
+	fr_hash_table_t *index;
+
+	/*
+	 *	Only create the deferred pairs we're looking for.
+	 */
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_materialise(list, da);
 
 	if (fr_pair_list_empty(list)) return NULL;
 
 	PAIR_LIST_VERIFY(list);
 
-	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) return vp;
+	if (!prev && (index = pair_list_index(list))) return fr_hash_table_find(index, &da);
+
+	while ((vp = fr_pair_order_list_next(&list->order, vp))) if (da == vp->da) return vp;
 
 	return NULL;
 }
@@ -713,11 +856,13 @@ fr_pair_t *fr_pair_find_last_by_da(fr_pair_list_t const *list, fr_pair_t const *
 {
 	fr_pair_t *vp = UNCONST(fr_pair_t *, prev);
 
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_materialise(list, da);
+
 	if (fr_pair_list_empty(list)) return NULL;
 
 	PAIR_LIST_VERIFY(list);
 
-	while ((vp = fr_pair_list_prev(list, vp))) if (da == vp->da) return vp;
+	while ((vp = fr_pair_order_list_prev(&list->order, vp))) if (da == vp->da) return vp;
 
 	return NULL;
 }
@@ -736,12 +881,26 @@ fr_pair_t *fr_pair_find_last_by_da(fr_pair_list_t const *list, fr_pair_t const *
 fr_pair_t *fr_pair_find_by_da_idx(fr_pair_list_t const *list, fr_dict_attr_t const *da, unsigned int idx)
 {
 	fr_pair_t *vp = NULL;
+	fr_hash_table_t *index;
+
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_materialise(list, da);
 
 	if (fr_pair_list_empty(list)) return NULL;
 
 	PAIR_LIST_VERIFY(list);
 
-	while ((vp = fr_pair_list_next(list, vp))) {
+	/*
+	 *	Start from the first instance, as subsequent
+	 *	instances can only appear after it.
+	 */
+	if ((index = pair_list_index(list))) {
+		vp = fr_hash_table_find(index, &da);
+		if (!vp || (idx == 0)) return vp;
+
+		idx--;
+	}
+
+	while ((vp = fr_pair_order_list_next(&list->order, vp))) {
 		if (da != vp->da) continue;
 
 		if (idx == 0) return vp;
@@ -968,10 +1127,21 @@ fr_pair_t *fr_pair_list_parent(fr_pair_list_t const *list)
 static int _pair_list_dcursor_insert(fr_dlist_head_t *list, void *to_insert, UNUSED void *uctx)
 {
 	fr_pair_t *vp = to_insert;
+	fr_pair_list_t *parent;
 	fr_tlist_head_t *tlist;
 
 	tlist = fr_tlist_head_from_dlist(list);
 
+	/*
+	 *	We don't know where the pair is being inserted,
+	 *	so can only maintain the index if there are no
+	 *	other instances of the da.
+	 */
+	parent = fr_pair_list_from_dlist(list);
+	if (parent->index && (fr_hash_table_find(parent->index, vp) || !fr_hash_table_insert(parent->index, vp))) {
+		pair_list_index_invalidate(parent);
+	}
+
 	/*
 	 *	Mark the pair as inserted into the list.
 	 */
@@ -1009,6 +1179,9 @@ static int _pair_list_dcursor_remove(NDEBUG_UNUSED fr_dlist_head_t *list, void *
 	parent = fr_pair_parent_list(vp);
 #endif
 
+	pair_list_index_remove(parent, vp);
+	pair_list_lazy_remove(parent, vp);
+
 	/*
 	 *	Mark the pair as removed from the list.
 	 */
@@ -1099,6 +1272,34 @@ fr_pair_t *_fr_pair_dcursor_iter_init(fr_dcursor_t *cursor, fr_pair_list_t const
 				      fr_dcursor_iter_t iter, void const *uctx,
 				      bool is_const)
 {
+	pair_list_lazy_materialise(list);
+
+	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
+				iter, NULL, uctx,
+				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
+}
+
+/** Initialises a special dcursor with an iterator which only returns pairs of one attribute
+ *
+ * The same as #_fr_pair_dcursor_iter_init, except that if the list has
+ * deferred pairs, only the ones matching da are created.
+ *
+ * @param[out] cursor	to initialise.
+ * @param[in] list	to iterate over.
+ * @param[in] da	the iterator returns.  If NULL, all deferred pairs are created.
+ * @param[in] iter	Iterator to use when filtering pairs.
+ * @param[in] uctx	To pass to iterator.
+ * @param[in] is_const	whether the fr_pair_list_t is const.
+ * @return
+ *	- NULL if src does not point to any items.
+ *	- The first pair in the list.
+ */
+fr_pair_t *_fr_pair_dcursor_iter_da_init(fr_dcursor_t *cursor, fr_pair_list_t const *list,
+					 fr_dict_attr_t const *da, fr_dcursor_iter_t iter, void const *uctx,
+					 bool is_const)
+{
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_materialise(list, da);
+
 	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
 				iter, NULL, uctx,
 				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
@@ -1120,6 +1321,8 @@ fr_pair_t *_fr_pair_dcursor_iter_init(fr_dcursor_t *cursor, fr_pair_list_t const
 fr_pair_t *_fr_pair_dcursor_init(fr_dcursor_t *cursor, fr_pair_list_t const *list,
 				 bool is_const)
 {
+	pair_list_lazy_materialise(list);
+
 	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
 				NULL, NULL, NULL,
 				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
@@ -1139,6 +1342,8 @@ fr_pair_t *_fr_pair_dcursor_by_da_init(fr_dcursor_t *cursor,
 				        fr_pair_list_t const *list, fr_dict_attr_t const *da,
 				        bool is_const)
 {
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_materialise(list, da);
+
 	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
 				fr_pair_iter_next_by_da, NULL, da,
 				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
@@ -1177,6 +1382,11 @@ fr_pair_t *_fr_pair_dcursor_by_ancestor_init(fr_dcursor_t *cursor,
 					_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
 	}
 
+	/*
+	 *	Only top level leaf pairs are ever deferred, and
+	 *	they can't be descended from a structural da, so
+	 *	there's nothing to create here.
+	 */
 	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
 				fr_pair_iter_next_by_ancestor, NULL, da,
 				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
@@ -1321,6 +1531,7 @@ int fr_pair_prepend(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_pair_order_list_insert_head(&list->order, to_add);
+	pair_list_index_prepend(list, to_add);
 
 	return 0;
 }
@@ -1333,7 +1544,7 @@ int fr_pair_prepend(fr_pair_list_t *list, fr_pair_t *to_add)
  * @param[in] to_add	VP to add to list.
  * @return
  *	- 0 on success.
- *	- -1 on failure (pair already in list).
+ *	- -1 on failure (pair already in list, or deferred pairs couldn't be created).
  *
  * @hidecallergraph
  */
@@ -1351,7 +1562,14 @@ int fr_pair_append(fr_pair_list_t *list, fr_pair_t *to_add)
 		return -1;
 	}
 
+	/*
+	 *	Pairs of the same attribute must stay in order,
+	 *	so create any the decoder is holding back first.
+	 */
+	if (unlikely(list->lazy != NULL) && (fr_pair_list_lazy_materialise(list, to_add->da) < 0)) return -1;
+
 	fr_pair_order_list_insert_tail(&list->order, to_add);
+	pair_list_index_append(list, to_add);
 
 	return 0;
 }
@@ -1385,6 +1603,7 @@ int fr_pair_insert_after(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_add
 	}
 
 	fr_pair_order_list_insert_after(&list->order, pos, to_add);
+	pair_list_index_insert(list, pos, to_add, false);
 
 	return 0;
 }
@@ -1396,7 +1615,7 @@ int fr_pair_insert_after(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_add
  * @param[in] to_add	VP to add to list.
  * @return
  *	- 0 on success.
- *	- -1 on failure (pair already in list).
+ *	- -1 on failure (pair already in list, or deferred pairs couldn't be created).
  */
 int fr_pair_insert_before(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_add)
 {
@@ -1418,7 +1637,11 @@ int fr_pair_insert_before(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_ad
 		return -1;
 	}
 
+	if (!pos && unlikely(list->lazy != NULL) &&
+	    (fr_pair_list_lazy_materialise(list, to_add->da) < 0)) return -1;
+
 	fr_pair_order_list_insert_before(&list->order, pos, to_add);
+	pair_list_index_insert(list, pos, to_add, true);
 
 	return 0;
 }
@@ -2324,6 +2547,7 @@ int fr_pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const
 
 		new_vp = fr_pair_copy(ctx, vp);
 		if (!new_vp) {
+			pair_list_index_invalidate(to);
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
 			return -1;
 		}
@@ -2423,6 +2647,7 @@ int fr_pair_list_copy_by_da(TALLOC_CTX *ctx, fr_pair_list_t *to,
 		cnt++;
 		new_vp = fr_pair_copy(ctx, vp);
 		if (!new_vp) {
+			pair_list_index_invalidate(to);
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
 			return -1;
 		}
@@ -3406,15 +3631,19 @@ void fr_pair_list_verify(char const *file, int line, TALLOC_CTX const *expected,
 	 */
 	if (list->verified) return;
 
-	for (slow = fr_pair_list_head(list), fast = fr_pair_list_head(list);
+	/*
+	 *	Don't create any deferred pairs, we only
+	 *	verify the ones which already exist.
+	 */
+	for (slow = fr_pair_order_list_head(&list->order), fast = fr_pair_order_list_head(&list->order);
 	     slow && fast;
-	     slow = fr_pair_list_next(list, slow), fast = fr_pair_list_next(list, fast)) {
+	     slow = fr_pair_order_list_next(&list->order, slow), fast = fr_pair_order_list_next(&list->order, fast)) {
 		PAIR_VERIFY_WITH_LIST(list, slow);
 
 		/*
 		 *	Advances twice as fast as slow...
 		 */
-		fast = fr_pair_list_next(list, fast);
+		fast = fr_pair_order_list_next(&list->order, fast);
 		fr_fatal_assert_msg(fast != slow,
 				    "CONSISTENCY CHECK FAILED %s[%u]:  Looping list found.  Fast pointer hit "
 				    "slow pointer at \"%s\"",
@@ -3437,13 +3666,27 @@ void fr_pair_list_verify(char const *file, int line, TALLOC_CTX const *expected,
 	/*
 	 *	Check the remaining pairs
 	 */
-	for (; slow; slow = fr_pair_list_next(list, slow)) {
+	for (; slow; slow = fr_pair_order_list_next(&list->order, slow)) {
 		PAIR_VERIFY_WITH_LIST(list, slow);
 
 		parent = talloc_parent(slow);
 		if (expected && (parent != expected)) goto bad_parent;
 	}
 
+	/*
+	 *	Every pair must have an index entry, pointing
+	 *	to a pair with the same da in this list.
+	 */
+	if (list->index) for (slow = fr_pair_order_list_head(&list->order);
+			      slow;
+			      slow = fr_pair_order_list_next(&list->order, slow)) {
+		fr_pair_t *first = fr_hash_table_find(list->index, slow);
+
+		fr_fatal_assert_msg(first && (first->da == slow->da) && (fr_pair_parent_list(first) == list),
+				    "CONSISTENCY CHECK FAILED %s[%u]: Bad index entry for \"%s\"",
+				    file, line, slow->da->name);
+	}
+
 	UNCONST(fr_pair_list_t *, list)->verified = true;
 }
 #endif
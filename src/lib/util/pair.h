@@ -26,6 +26,7 @@ RCSIDH(dpair_h, "$Id$")
 #include <freeradius-devel/build.h>
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/dcursor.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/value.h>
 #include <freeradius-devel/util/tlist.h>
 
@@ -49,15 +50,59 @@ typedef struct value_pair_s fr_pair_t;
 
 FR_TLIST_TYPES(fr_pair_order_list)
 
-typedef struct pair_list_s {
+/** Create pairs which a protocol decoder deferred
+ *
+ * Pairs must be added to the list with the normal pair list API.
+ *
+ * @param[in] list	to add the pairs to.
+ * @param[in] da	to create pairs for.  If NULL, create all remaining pairs.
+ * @param[in] uctx	registered with the list.
+ * @return
+ *	- 1 if the decoder still holds pairs back.
+ *	- 0 if all pairs have been created.
+ *	- <0 on error.
+ */
+typedef int (*fr_pair_list_lazy_func_t)(fr_pair_list_t *list, fr_dict_attr_t const *da, void *uctx);
+
+/** Tell a protocol decoder a pair is being removed from a list it's still creating pairs in
+ *
+ * Lets the decoder drop any references it holds to the pair.
+ *
+ * @param[in] vp	being removed.  Still in the list.
+ * @param[in] prev	the pair before vp.  NULL if vp is the head of the list.
+ * @param[in] uctx	registered with the list.
+ */
+typedef void (*fr_pair_list_lazy_remove_t)(fr_pair_t const *vp, fr_pair_t *prev, void *uctx);
+
+/** Pairs which are still to be decoded from their raw form
+ *
+ */
+typedef struct {
+	fr_pair_list_lazy_func_t	decode;				//!< Called on first access.
+	fr_pair_list_lazy_remove_t	remove;				//!< Called before a pair is removed from the list.
+									///< May be NULL.
+	void				*uctx;				//!< Decoder state, usually
+									///< including the raw data.
+} fr_pair_list_lazy_t;
+
+struct pair_list_s {
         FR_TLIST_HEAD(fr_pair_order_list)	order;			//!< Maintains the relative order of pairs in a list.
 
+	fr_hash_table_t			* _CONST index;			//!< Lazily built index of the first pair with
+									///< each #fr_dict_attr_t.  Only used for the
+									///< children of pairs, once the list grows
+									///< beyond #FR_PAIR_LIST_INDEX_THRESHOLD.
+
+	fr_pair_list_lazy_t const	* _CONST lazy;			//!< Pairs a protocol decoder hasn't
+									///< created yet.  Set by #fr_pair_list_lazy_set.
+
 	bool				 _CONST is_child;		//!< is a child of a VP
+	bool				 _CONST lazy_failed;		//!< A decoder failed to create deferred pairs.
 
 #ifdef WITH_VERIFY_PTR
 	unsigned int		verified : 1;				//!< hack to avoid O(N^3) issues
 #endif
-} fr_pair_list_t;
+};
 
 /** Stores an attribute, a value and various bits of other data
  *
@@ -431,12 +476,25 @@ do { \
 	if (oldvp) fr_pair_delete(_list, oldvp); \
 } while (0)
 
+/** Minimum number of pairs a child list must contain before lookups by da use an index
+ *
+ */
+#ifndef FR_PAIR_LIST_INDEX_THRESHOLD
+#  define FR_PAIR_LIST_INDEX_THRESHOLD	32
+#endif
+
 /* Initialisation */
 /** @hidecallergraph */
 void fr_pair_list_init(fr_pair_list_t *head) CC_HINT(nonnull);
 
 void fr_pair_init_null(fr_pair_t *vp) CC_HINT(nonnull);
 
+void fr_pair_list_lazy_set(fr_pair_list_t *list, fr_pair_list_lazy_t const *lazy) CC_HINT(nonnull);
+
+int fr_pair_list_lazy_materialise(fr_pair_list_t const *list, fr_dict_attr_t const *da) CC_HINT(nonnull(1));
+
+bool fr_pair_list_lazy_failed(fr_pair_list_t const *list) CC_HINT(nonnull);
+
 /* Allocation and management */
 fr_pair_t	*fr_pair_alloc_null(TALLOC_CTX *ctx) CC_HINT(warn_unused_result);
 
@@ -575,6 +633,28 @@ fr_pair_t	*_fr_pair_dcursor_iter_init(fr_dcursor_t *cursor, fr_pair_list_t const
 					    fr_dcursor_iter_t iter, void const *uctx,
 					    bool is_const) CC_HINT(nonnull);
 
+/** Initialises a special dcursor with an iterator which only returns pairs of one attribute
+ *
+ * @param[out] _cursor	to initialise.
+ * @param[in] _list	to iterate over.
+ * @param[in] _da	the iterator returns.  Only deferred pairs of this attribute are created.
+ * @param[in] _iter	Iterator to use when filtering pairs.
+ * @param[in] _uctx	To pass to iterator.
+ * @return
+ *	- NULL if src does not point to any items.
+ *	- The first pair in the list.
+ */
+#define		fr_pair_dcursor_iter_da_init(_cursor, _list, _da, _iter, _uctx) \
+		_fr_pair_dcursor_iter_da_init(_cursor, \
+					      _list, \
+					      _da, \
+					      _iter, \
+					      _uctx, \
+					      IS_CONST(fr_pair_list_t *, _list))
+fr_pair_t	*_fr_pair_dcursor_iter_da_init(fr_dcursor_t *cursor, fr_pair_list_t const *list,
+					       fr_dict_attr_t const *da, fr_dcursor_iter_t iter, void const *uctx,
+					       bool is_const) CC_HINT(nonnull(1,2,4));
+
 /** Initialises a special dcursor with callbacks that will maintain the attr sublists correctly
  *
  * Filters can be applied later with fr_dcursor_filter_set.
@@ -31,6 +31,148 @@ FR_TLIST_FUNCS(fr_pair_order_list, fr_pair_t, order_entry)
 #  define _INLINE CC_HINT(always_inline) static inline
 #endif
 
+/*
+ *	The index is keyed on the da of each pair.  The da is
+ *	the first field in the pair, so a pointer to a da pointer
+ *	can be used as a lookup key.
+ */
+static_assert(offsetof(fr_pair_t, da) == 0, "da must be the first field in fr_pair_t");
+
+/** Discard the index for a list
+ *
+ * Called when a list is modified in a way we can't track cheaply.
+ * The index will be rebuilt on the next lookup.
+ */
+static inline CC_HINT(always_inline) void pair_list_index_invalidate(fr_pair_list_t *list)
+{
+	if (likely(!list->index)) return;
+
+	talloc_free(list->index);
+	list->index = NULL;
+}
+
+/** Record a pair added to the tail of a list
+ *
+ * If there's already an entry for the da, it's earlier in the list
+ * and remains the first instance.
+ */
+static inline CC_HINT(always_inline) void pair_list_index_append(fr_pair_list_t *list, fr_pair_t *vp)
+{
+	if (likely(!list->index)) return;
+
+	if (!fr_hash_table_find(list->index, vp) && !fr_hash_table_insert(list->index, vp)) {
+		pair_list_index_invalidate(list);
+	}
+}
+
+/** Record a pair added to the head of a list
+ *
+ */
+static inline CC_HINT(always_inline) void pair_list_index_prepend(fr_pair_list_t *list, fr_pair_t *vp)
+{
+	if (likely(!list->index)) return;
+
+	if (fr_hash_table_replace(NULL, list->index, vp) < 0) pair_list_index_invalidate(list);
+}
+
+/** Record a pair inserted before or after another pair
+ *
+ * @param[in] list	the pair was inserted into.
+ * @param[in] pos	the pair was inserted next to.
+ * @param[in] vp	that was inserted.
+ * @param[in] before	true if vp was inserted before pos, false if after.
+ */
+static inline CC_HINT(always_inline) void pair_list_index_insert(fr_pair_list_t *list, fr_pair_t const *pos,
+								  fr_pair_t *vp, bool before)
+{
+	fr_pair_t *first;
+
+	if (likely(!list->index)) return;
+
+	first = fr_hash_table_find(list->index, vp);
+	if (!first) {
+		if (!fr_hash_table_insert(list->index, vp)) pair_list_index_invalidate(list);
+		return;
+	}
+
+	/*
+	 *	Inserting after NULL inserts at the head of the
+	 *	list, inserting before NULL inserts at the tail.
+	 */
+	if (!pos) {
+		if (!before) (void) fr_hash_table_replace(NULL, list->index, vp);
+		return;
+	}
+
+	/*
+	 *	Inserting before the current first instance
+	 *	makes vp the new first instance.
+	 */
+	if (before && (pos == first)) {
+		(void) fr_hash_table_replace(NULL, list->index, vp);
+		return;
+	}
+
+	/*
+	 *	Otherwise if pos has the same da, the first instance
+	 *	is before pos, and so must also be before vp.
+	 */
+	if (pos->da == vp->da) return;
+
+	/*
+	 *	Don't know whether vp is before or after the
+	 *	current first instance without walking the list.
+	 */
+	pair_list_index_invalidate(list);
+}
+
+/** Record a pair being removed from a list
+ *
+ * Must be called whilst vp is still linked into the list, as the
+ * next instance of the da becomes the first instance.
+ */
+static inline CC_HINT(always_inline) void pair_list_index_remove(fr_pair_list_t *list, fr_pair_t *vp)
+{
+	fr_pair_t *next = vp;
+
+	if (likely(!list->index)) return;
+
+	if (fr_hash_table_find(list->index, vp) != vp) return;
+
+	while ((next = fr_pair_order_list_next(&list->order, next))) {
+		if (next->da != vp->da) continue;
+
+		(void) fr_hash_table_replace(NULL, list->index, next);
+		return;
+	}
+
+	(void) fr_hash_table_remove(list->index, vp);
+}
+
+/** Create any pairs a protocol decoder deferred
+ *
+ * Called before any operation which needs the complete list.  These
+ * operations can't return an error, so failures are only recorded in
+ * the list, for #fr_pair_list_lazy_failed.
+ */
+static inline CC_HINT(always_inline) void pair_list_lazy_materialise(fr_pair_list_t const *list)
+{
+	if (likely(!list->lazy)) return;
+
+	(void) fr_pair_list_lazy_materialise(list, NULL);
+}
+
+/** Tell the decoder holding back pairs in a list that a pair is being removed
+ *
+ * Must be called whilst vp is still linked into the list.
+ */
+static inline CC_HINT(always_inline) void pair_list_lazy_remove(fr_pair_list_t *list, fr_pair_t *vp)
+{
+	if (likely(!list->lazy) || !list->lazy->remove) return;
+
+	list->lazy->remove(vp, fr_pair_order_list_prev(&list->order, vp), list->lazy->uctx);
+}
+
 /** Get the head of a valuepair list
  *
  * @param[in] list	to return the head of
@@ -42,6 +184,8 @@ FR_TLIST_FUNCS(fr_pair_order_list, fr_pair_t, order_entry)
  */
 _INLINE fr_pair_t *fr_pair_list_head(fr_pair_list_t const *list)
 {
+	pair_list_lazy_materialise(list);
+
 	return fr_pair_order_list_head(&list->order);
 }
 
@@ -55,6 +199,8 @@ _INLINE fr_pair_t *fr_pair_list_head(fr_pair_list_t const *list)
  */
 _INLINE fr_pair_t *fr_pair_list_tail(fr_pair_list_t const *list)
 {
+	pair_list_lazy_materialise(list);
+
 	return fr_pair_order_list_tail(&list->order);
 }
 
@@ -69,6 +215,8 @@ _INLINE fr_pair_t *fr_pair_list_tail(fr_pair_list_t const *list)
  */
 _INLINE fr_pair_t *fr_pair_list_next(fr_pair_list_t const *list, fr_pair_t const *item)
 {
+	pair_list_lazy_materialise(list);
+
 	return fr_pair_order_list_next(&list->order, item);
 }
 
@@ -82,6 +230,8 @@ _INLINE fr_pair_t *fr_pair_list_next(fr_pair_list_t const *list, fr_pair_t const
  */
 _INLINE fr_pair_t *fr_pair_list_prev(fr_pair_list_t const *list, fr_pair_t const *item)
 {
+	pair_list_lazy_materialise(list);
+
 	return fr_pair_order_list_prev(&list->order, item);
 }
 
@@ -103,6 +253,9 @@ _INLINE fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
 	list->verified = false;
 #endif
 
+	pair_list_index_remove(list, vp);
+	pair_list_lazy_remove(list, vp);
+
 	return fr_pair_order_list_remove(&list->order, vp);
 }
 
@@ -112,6 +265,9 @@ _INLINE fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
  */
 _INLINE void fr_pair_list_free(fr_pair_list_t *list)
 {
+	list->lazy = NULL;
+	list->lazy_failed = false;
+	pair_list_index_invalidate(list);
 	fr_pair_order_list_talloc_free(&list->order);
 }
 
@@ -124,6 +280,11 @@ _INLINE void fr_pair_list_free(fr_pair_list_t *list)
  */
 _INLINE bool fr_pair_list_empty(fr_pair_list_t const *list)
 {
+	/*
+	 *	Decoders only defer pairs if there are some.
+	 */
+	if (unlikely(list->lazy != NULL)) return false;
+
 	return fr_pair_order_list_empty(&list->order);
 }
 
@@ -139,6 +300,8 @@ _INLINE bool fr_pair_list_empty(fr_pair_list_t const *list)
  */
 _INLINE void fr_pair_list_sort(fr_pair_list_t *list, fr_cmp_t cmp)
 {
+	pair_list_lazy_materialise(list);
+	pair_list_index_invalidate(list);
 	fr_pair_order_list_sort(&list->order, cmp);
 }
 
@@ -150,6 +313,8 @@ _INLINE void fr_pair_list_sort(fr_pair_list_t *list, fr_cmp_t cmp)
  */
 _INLINE size_t fr_pair_list_num_elements(fr_pair_list_t const *list)
 {
+	pair_list_lazy_materialise(list);
+
 	return fr_pair_order_list_num_elements(&list->order);
 }
 
@@ -161,6 +326,8 @@ _INLINE size_t fr_pair_list_num_elements(fr_pair_list_t const *list)
  */
 _INLINE fr_dlist_head_t *fr_pair_list_to_dlist(fr_pair_list_t const *list)
 {
+	pair_list_lazy_materialise(list);
+
 	return fr_pair_order_list_dlist_head(&list->order);
 }
 
@@ -184,6 +351,15 @@ _INLINE void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
 #ifdef WITH_VERIFY_POINTER
 	dst->verified = false;
 #endif
+	pair_list_lazy_materialise(dst);
+	pair_list_lazy_materialise(src);
+
+	if (dst->index) {
+		fr_pair_t *vp = NULL;
+
+		while ((vp = fr_pair_order_list_next(&src->order, vp))) pair_list_index_append(dst, vp);
+	}
+	pair_list_index_invalidate(src);
 	fr_pair_order_list_move(&dst->order, &src->order);
 }
 
@@ -194,5 +370,8 @@ _INLINE void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
  */
 _INLINE void fr_pair_list_prepend(fr_pair_list_t *dst, fr_pair_list_t *src)
 {
+	pair_list_lazy_materialise(src);
+	pair_list_index_invalidate(dst);
+	pair_list_index_invalidate(src);
 	fr_pair_order_list_move_head(&dst->order, &src->order);
 }
@@ -311,17 +311,43 @@ void pair_list_perf_init(void)
 	fr_time_start();
 }
 
-static void do_test_fr_pair_append(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+/** Allocate a list to run a test on
+ *
+ * Only the children of pairs are indexed, so the indexed tests run on the
+ * children of a group pair, and the others run on a top level list.
+ *
+ * @param[out] parent	to free once the test is done.
+ * @param[in] indexed	Whether lookups should use the list index once the list
+ *			reaches #FR_PAIR_LIST_INDEX_THRESHOLD.
+ */
+static fr_pair_list_t *test_list_alloc(fr_pair_t **parent, bool indexed)
+{
+	fr_pair_list_t *list;
+
+	*parent = fr_pair_afrom_da(autofree, fr_dict_attr_test_group);
+	TEST_ASSERT(*parent != NULL);
+
+	if (indexed) return &(*parent)->vp_group;
+
+	list = talloc(*parent, fr_pair_list_t);
+	TEST_ASSERT(list != NULL);
+	fr_pair_list_init(list);
+
+	return list;
+}
+
+static void do_test_fr_pair_append(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[],
+				bool indexed)
 {
-	fr_pair_list_t  test_vps;
-	unsigned int	i, j;
-	fr_pair_t	*new_vp;
-	fr_time_t	start, end;
-	fr_time_delta_t	used = fr_time_delta_wrap(0);
-	size_t		input_count = talloc_array_length(source_vps);
-	fr_fast_rand_t	rand_ctx;
-
-	fr_pair_list_init(&test_vps);
+	fr_pair_t		*parent;
+	fr_pair_list_t		*test_vps = test_list_alloc(&parent, indexed);
+	unsigned int		i, j;
+	fr_pair_t		*new_vp;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	size_t			input_count = talloc_array_length(source_vps);
+	fr_fast_rand_t		rand_ctx;
+
 	rand_ctx.a = fr_rand();
 	rand_ctx.b = fr_rand();
 
@@ -339,23 +365,34 @@ static void do_test_fr_pair_append(unsigned int len, unsigned int perc, unsigned
 			int idx = fr_fast_rand(&rand_ctx) % input_count;
 			new_vp = fr_pair_copy(autofree, source_vps[idx]);
 			start = fr_time();
-			fr_pair_append(&test_vps, new_vp);
+			fr_pair_append(test_vps, new_vp);
 			end = fr_time();
 			used = fr_time_delta_add(used, fr_time_sub(end, start));
+
+			/*
+			 *  Builds the index once the list is large enough,
+			 *  so subsequent appends include the cost of
+			 *  maintaining it.
+			 */
+			(void) fr_pair_find_by_da(test_vps, NULL, new_vp->da);
 		}
-		TEST_CHECK(fr_pair_list_num_elements(&test_vps) == len);
-		fr_pair_list_free(&test_vps);
+		TEST_CHECK(fr_pair_list_num_elements(test_vps) == len);
+		fr_pair_list_free(test_vps);
 	}
+	talloc_free(parent);
 	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("indexed=%s", indexed ? "yes" : "no");
 	TEST_MSG_ALWAYS("perc_rep=%d", perc);
 	TEST_MSG_ALWAYS("list_length=%d", len);
 	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
 }
 
-static void do_test_fr_pair_find_by_da_idx(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+static void do_test_fr_pair_find_by_da_idx(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[],
+				bool indexed)
 {
-	fr_pair_list_t		test_vps;
+	fr_pair_t		*parent;
+	fr_pair_list_t		*test_vps = test_list_alloc(&parent, indexed);
 	unsigned int		i, j;
 	fr_pair_t		*new_vp;
 	fr_time_t		start, end;
@@ -364,7 +401,6 @@ static void do_test_fr_pair_find_by_da_idx(unsigned int len, unsigned int perc,
 	size_t			input_count = talloc_array_length(source_vps);
 	fr_fast_rand_t		rand_ctx;
 
-	fr_pair_list_init(&test_vps);
 	if (input_count > len) input_count = len;
 	rand_ctx.a = fr_rand();
 	rand_ctx.b = fr_rand();
@@ -375,7 +411,7 @@ static void do_test_fr_pair_find_by_da_idx(unsigned int len, unsigned int perc,
 	for (i = 0; i < len; i++) {
 		int idx = fr_fast_rand(&rand_ctx) % input_count;
 		new_vp = fr_pair_copy(autofree, source_vps[idx]);
-		fr_pair_append(&test_vps, new_vp);
+		fr_pair_append(test_vps, new_vp);
 	}
 
 	/*
@@ -386,22 +422,26 @@ static void do_test_fr_pair_find_by_da_idx(unsigned int len, unsigned int perc,
 			int idx = fr_fast_rand(&rand_ctx) % input_count;
 			da = source_vps[idx]->da;
 			start = fr_time();
-			(void) fr_pair_find_by_da(&test_vps, NULL, da);
+			(void) fr_pair_find_by_da(test_vps, NULL, da);
 			end = fr_time();
 			used = fr_time_delta_add(used, fr_time_sub(end, start));
 		}
 	}
-	fr_pair_list_free(&test_vps);
+	fr_pair_list_free(test_vps);
+	talloc_free(parent);
 	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("indexed=%s", indexed ? "yes" : "no");
 	TEST_MSG_ALWAYS("perc_rep=%d", perc);
 	TEST_MSG_ALWAYS("list_length=%d", len);
 	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
 }
 
-static void do_test_find_nth(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+static void do_test_find_nth(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[],
+				bool indexed)
 {
-	fr_pair_list_t	  	test_vps;
+	fr_pair_t		*parent;
+	fr_pair_list_t		*test_vps = test_list_alloc(&parent, indexed);
 	unsigned int		i, j, nth_item;
 	fr_pair_t		*new_vp;
 	fr_time_t		start, end;
@@ -410,7 +450,6 @@ static void do_test_find_nth(unsigned int len, unsigned int perc, unsigned int r
 	size_t			input_count = talloc_array_length(source_vps);
 	fr_fast_rand_t		rand_ctx;
 
-	fr_pair_list_init(&test_vps);
 	if (input_count > len) input_count = len;
 	rand_ctx.a = fr_rand();
 	rand_ctx.b = fr_rand();
@@ -421,7 +460,7 @@ static void do_test_find_nth(unsigned int len, unsigned int perc, unsigned int r
 	for (i = 0; i < len; i++) {
 		int idx = fr_fast_rand(&rand_ctx) % input_count;
 		new_vp = fr_pair_copy(autofree, source_vps[idx]);
-		fr_pair_append(&test_vps, new_vp);
+		fr_pair_append(test_vps, new_vp);
 	}
 
 	/*
@@ -435,30 +474,89 @@ static void do_test_find_nth(unsigned int len, unsigned int perc, unsigned int r
 
 			da = source_vps[idx]->da;
 			start = fr_time();
-			(void) fr_pair_find_by_da_idx(&test_vps, da, nth_item);
+			(void) fr_pair_find_by_da_idx(test_vps, da, nth_item);
 			end = fr_time();
 			used = fr_time_delta_add(used, fr_time_sub(end, start));
 		}
 	}
-	fr_pair_list_free(&test_vps);
+	fr_pair_list_free(test_vps);
+	talloc_free(parent);
 	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("indexed=%s", indexed ? "yes" : "no");
 	TEST_MSG_ALWAYS("perc_rep=%d", perc);
 	TEST_MSG_ALWAYS("list_length=%d", len);
 	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
 }
 
-static void do_test_fr_pair_list_free(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+static void do_test_fr_pair_delete(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[],
+				   bool indexed)
 {
-	fr_pair_list_t  test_vps;
-	unsigned int	i, j;
-	fr_pair_t	*new_vp;
-	fr_time_t	start, end;
-	fr_time_delta_t	used = fr_time_delta_wrap(0);
-	size_t		input_count = talloc_array_length(source_vps);
-	fr_fast_rand_t	rand_ctx;
-
-	fr_pair_list_init(&test_vps);
+	fr_pair_t		*parent;
+	fr_pair_list_t		*test_vps = test_list_alloc(&parent, indexed);
+	unsigned int		i, j;
+	fr_pair_t		*new_vp, *vp;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	size_t			input_count = talloc_array_length(source_vps);
+	fr_fast_rand_t		rand_ctx;
+
+	if (input_count > len) input_count = len;
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	/*
+	 *  Initialise the test list
+	 */
+	for (i = 0; i < len; i++) {
+		int idx = fr_fast_rand(&rand_ctx) % input_count;
+		new_vp = fr_pair_copy(autofree, source_vps[idx]);
+		fr_pair_append(test_vps, new_vp);
+	}
+
+	/*
+	 *  Delete the first instance of a random DA, then append a
+	 *  replacement to keep the list length (and the ratio of
+	 *  repeats) constant.
+	 */
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < len; j++) {
+			int idx = fr_fast_rand(&rand_ctx) % input_count;
+
+			vp = fr_pair_find_by_da(test_vps, NULL, source_vps[idx]->da);
+			if (!vp) continue;
+
+			start = fr_time();
+			fr_pair_delete(test_vps, vp);
+			end = fr_time();
+			used = fr_time_delta_add(used, fr_time_sub(end, start));
+
+			new_vp = fr_pair_copy(autofree, source_vps[idx]);
+			fr_pair_append(test_vps, new_vp);
+		}
+	}
+	fr_pair_list_free(test_vps);
+	talloc_free(parent);
+	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("indexed=%s", indexed ? "yes" : "no");
+	TEST_MSG_ALWAYS("perc_rep=%d", perc);
+	TEST_MSG_ALWAYS("list_length=%d", len);
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+static void do_test_fr_pair_list_free(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[],
+				bool indexed)
+{
+	fr_pair_t		*parent;
+	fr_pair_list_t		*test_vps = test_list_alloc(&parent, indexed);
+	unsigned int		i, j;
+	fr_pair_t		*new_vp;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	size_t			input_count = talloc_array_length(source_vps);
+	fr_fast_rand_t		rand_ctx;
+
 	if (input_count > len) input_count = len;
 	rand_ctx.a = fr_rand();
 	rand_ctx.b = fr_rand();
@@ -467,15 +565,17 @@ static void do_test_fr_pair_list_free(unsigned int len, unsigned int perc, unsig
 		for (j = 0; j < len; j++) {
 			int idx = fr_fast_rand(&rand_ctx) % input_count;
 			new_vp = fr_pair_copy(autofree, source_vps[idx]);
-			fr_pair_append(&test_vps, new_vp);
+			fr_pair_append(test_vps, new_vp);
 		}
 		start = fr_time();
-		fr_pair_list_free(&test_vps);
+		fr_pair_list_free(test_vps);
 		end = fr_time();
 		used = fr_time_delta_add(used, fr_time_sub(end, start));
 	}
-	fr_pair_list_free(&test_vps);
+	fr_pair_list_free(test_vps);
+	talloc_free(parent);
 	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("indexed=%s", indexed ? "yes" : "no");
 	TEST_MSG_ALWAYS("perc_rep=%d", perc);
 	TEST_MSG_ALWAYS("list_length=%d", len);
 	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
@@ -485,7 +585,11 @@ static void do_test_fr_pair_list_free(unsigned int len, unsigned int perc, unsig
 #define test_func(_func, _count, _perc, _source_vps) \
 static void test_ ## _func ## _ ## _count ## _ ## _perc(void)\
 {\
-	do_test_ ## _func(_count, _perc, 10000, _source_vps);\
+	do_test_ ## _func(_count, _perc, 10000, _source_vps, false);\
+}\
+static void test_ ## _func ## _ ## _count ## _ ## _perc ## _indexed(void)\
+{\
+	do_test_ ## _func(_count, _perc, 10000, _source_vps, true);\
 }
 
 #define test_funcs(_func, _perc) \
@@ -505,14 +609,19 @@ static void test_ ## _func ## _ ## _count ## _ ## _perc(void)\
 all_test_funcs(fr_pair_append)
 all_test_funcs(fr_pair_find_by_da_idx)
 all_test_funcs(find_nth)
+all_test_funcs(fr_pair_delete)
 all_test_funcs(fr_pair_list_free)
 
+#define repetition_test(_func, _count, _perc) \
+	{ #_func "_" #_count "_" #_perc, test_ ## _func ## _ ## _count ## _ ## _perc},\
+	{ #_func "_" #_count "_" #_perc "_indexed", test_ ## _func ## _ ## _count ## _ ## _perc ## _indexed},\
+
 #define repetition_tests(_func, _perc) \
-	{ #_func "_20_" #_perc, test_ ## _func ## _20_ ## _perc},\
-	{ #_func "_40_" #_perc, test_ ## _func ## _40_ ## _perc},\
-	{ #_func "_60_" #_perc, test_ ## _func ## _60_ ## _perc},\
-	{ #_func "_80_" #_perc, test_ ## _func ## _80_ ## _perc},\
-	{ #_func "_100_" #_perc, test_ ## _func ## _100_ ## _perc},\
+	repetition_test(_func, 20, _perc) \
+	repetition_test(_func, 40, _perc) \
+	repetition_test(_func, 60, _perc) \
+	repetition_test(_func, 80, _perc) \
+	repetition_test(_func, 100, _perc)
 
 #define all_repetition_tests(_func) \
 	repetition_tests(_func, 0) \
@@ -525,6 +634,7 @@ TEST_LIST = {
 	all_repetition_tests(fr_pair_append)
 	all_repetition_tests(fr_pair_find_by_da_idx)
 	all_repetition_tests(find_nth)
+	all_repetition_tests(fr_pair_delete)
 	all_repetition_tests(fr_pair_list_free)
 
 	{ NULL }
@@ -45,6 +45,7 @@ static void test_init(void);
 
 #include <freeradius-devel/util/conf.h>
 #include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/radius/radius.h>
 
 #ifdef HAVE_GPERFTOOLS_PROFILER_H
 #  include <gperftools/profiler.h>
@@ -371,6 +372,292 @@ static void test_fr_pair_find_by_da_idx(void)
 	TEST_CHECK(vp && vp->da == fr_dict_attr_test_string);
 }
 
+static void test_fr_pair_find_by_da_indexed(void)
+{
+	fr_pair_t	*parent, *vp, *first, *second, *other;
+	fr_pair_list_t	*list;
+	fr_dcursor_t	cursor;
+	unsigned int	i;
+
+	TEST_CHECK((parent = fr_pair_afrom_da(autofree, fr_dict_attr_test_group)) != NULL);
+	if (!parent) return;
+	list = &parent->vp_group;
+
+	TEST_CASE("Populate a child list beyond the index threshold");
+	for (i = 0; i < FR_PAIR_LIST_INDEX_THRESHOLD; i++) {
+		TEST_CHECK(fr_pair_append_by_da(parent, &vp, list, fr_dict_attr_test_uint32) == 0);
+	}
+	TEST_CHECK(fr_pair_append_by_da(parent, &first, list, fr_dict_attr_test_string) == 0);
+	TEST_CHECK(fr_pair_append_by_da(parent, &second, list, fr_dict_attr_test_string) == 0);
+
+	TEST_CASE("Lookups build the index, and return the first instance");
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == first);
+	TEST_CHECK(list->index != NULL);
+	TEST_CHECK(fr_pair_find_by_da_idx(list, fr_dict_attr_test_string, 1) == second);
+	TEST_CHECK(fr_pair_find_by_da_idx(list, fr_dict_attr_test_string, 2) == NULL);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_octets) == NULL);
+
+	TEST_CASE("Prepending a pair makes it the first instance");
+	TEST_CHECK(fr_pair_prepend_by_da(parent, &other, list, fr_dict_attr_test_string) == 0);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == other);
+
+	TEST_CASE("Removing the first instance makes the next instance the first");
+	fr_pair_delete(list, other);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == first);
+	fr_pair_delete(list, first);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == second);
+
+	TEST_CASE("Inserting before the first instance makes the new pair the first");
+	TEST_CHECK((other = fr_pair_afrom_da(parent, fr_dict_attr_test_string)) != NULL);
+	TEST_CHECK(fr_pair_insert_before(list, second, other) == 0);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == other);
+
+	TEST_CASE("Removing all instances removes the index entry");
+	TEST_CHECK(fr_pair_delete_by_da(list, fr_dict_attr_test_string) == 2);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == NULL);
+
+	TEST_CASE("Appending to an empty index entry");
+	TEST_CHECK(fr_pair_append_by_da(parent, &first, list, fr_dict_attr_test_string) == 0);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == first);
+
+	TEST_CASE("Replacing a pair with a cursor indexes the replacement");
+	TEST_CHECK(fr_pair_dcursor_by_da_init(&cursor, list, fr_dict_attr_test_string) == first);
+	TEST_CHECK((other = fr_pair_afrom_da(parent, fr_dict_attr_test_string)) != NULL);
+	TEST_CHECK(fr_dcursor_replace(&cursor, other) == first);
+	talloc_free(first);
+	TEST_CHECK(list->index != NULL);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == other);
+
+	TEST_CHECK(fr_pair_dcursor_by_da_init(&cursor, list, fr_dict_attr_test_string) == other);
+	TEST_CHECK((vp = fr_pair_afrom_da(parent, fr_dict_attr_test_octets)) != NULL);
+	TEST_CHECK(fr_dcursor_replace(&cursor, vp) == other);
+	talloc_free(other);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == NULL);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_octets) == vp);
+
+	talloc_free(parent);
+}
+
+/** Pretend to be a protocol decoder, which defers creating all of its pairs
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da[4];		//!< In "packet" order.
+	bool			done[4];
+	unsigned int		decoded;
+} test_lazy_t;
+
+static int test_lazy_decode(fr_pair_list_t *list, fr_dict_attr_t const *da, void *uctx)
+{
+	test_lazy_t	*lazy = uctx;
+	unsigned int	i;
+
+	for (i = 0; i < NUM_ELEMENTS(lazy->da); i++) {
+		fr_pair_t *vp;
+
+		if (lazy->done[i] || (da && (lazy->da[i] != da))) continue;
+
+		vp = fr_pair_afrom_da(autofree, lazy->da[i]);
+		if (!vp) return -1;
+		fr_pair_append(list, vp);
+
+		lazy->done[i] = true;
+		lazy->decoded++;
+	}
+
+	return (lazy->decoded < NUM_ELEMENTS(lazy->da));
+}
+
+static void test_fr_pair_list_lazy(void)
+{
+	fr_pair_list_t		list;
+	fr_pair_t		*vp, *first, *appended;
+	test_lazy_t		state = {
+					.da = { fr_dict_attr_test_string, fr_dict_attr_test_uint32,
+						fr_dict_attr_test_string, fr_dict_attr_test_octets }
+				};
+	fr_pair_list_lazy_t	lazy = { .decode = test_lazy_decode, .uctx = &state };
+
+	fr_pair_list_init(&list);
+	fr_pair_list_lazy_set(&list, &lazy);
+
+	TEST_CASE("A list with deferred pairs isn't empty");
+	TEST_CHECK(!fr_pair_list_empty(&list));
+	TEST_CHECK(state.decoded == 0);
+
+	TEST_CASE("Lookups only create pairs of the requested attribute");
+	TEST_CHECK((first = fr_pair_find_by_da(&list, NULL, fr_dict_attr_test_string)) != NULL);
+	TEST_CHECK(state.decoded == 2);
+	TEST_CHECK((vp = fr_pair_find_by_da_idx(&list, fr_dict_attr_test_string, 1)) != NULL);
+	TEST_CHECK(vp != first);
+	TEST_CHECK(state.decoded == 2);
+	TEST_CHECK(list.lazy != NULL);
+
+	TEST_CASE("Appending creates deferred pairs of the same attribute first");
+	TEST_CHECK((appended = fr_pair_afrom_da(autofree, fr_dict_attr_test_uint32)) != NULL);
+	TEST_CHECK(fr_pair_append(&list, appended) == 0);
+	TEST_CHECK(state.decoded == 3);
+	TEST_CHECK(fr_pair_find_by_da_idx(&list, fr_dict_attr_test_uint32, 1) == appended);
+
+	TEST_CASE("Iterating creates all remaining pairs");
+	TEST_CHECK(fr_pair_list_head(&list) == first);
+	TEST_CHECK(state.decoded == 4);
+	TEST_CHECK(list.lazy == NULL);
+	TEST_CHECK(fr_pair_list_num_elements(&list) == 5);
+
+	fr_pair_list_free(&list);
+}
+
+static int test_lazy_decode_fail(UNUSED fr_pair_list_t *list, UNUSED fr_dict_attr_t const *da, UNUSED void *uctx)
+{
+	fr_strerror_const("Malformed attribute");
+	return -1;
+}
+
+static void test_fr_pair_list_lazy_fail(void)
+{
+	fr_pair_list_t		list;
+	fr_pair_t		*vp;
+	fr_pair_list_lazy_t	lazy = { .decode = test_lazy_decode_fail };
+
+	fr_pair_list_init(&list);
+	fr_pair_list_lazy_set(&list, &lazy);
+
+	TEST_CASE("A failed lookup marks the list as failed");
+	TEST_CHECK(!fr_pair_list_lazy_failed(&list));
+	TEST_CHECK(fr_pair_find_by_da(&list, NULL, fr_dict_attr_test_string) == NULL);
+	TEST_CHECK(list.lazy == NULL);
+	TEST_CHECK(fr_pair_list_lazy_failed(&list));
+
+	TEST_CASE("The failure is reported when adding to the list");
+	TEST_CHECK((vp = fr_pair_afrom_da(autofree, fr_dict_attr_test_string)) != NULL);
+	TEST_CHECK(fr_pair_append(&list, vp) < 0);
+	TEST_CHECK(fr_pair_list_empty(&list));
+	talloc_free(vp);
+
+	TEST_CASE("Freeing the list clears the failure");
+	fr_pair_list_free(&list);
+	TEST_CHECK(!fr_pair_list_lazy_failed(&list));
+}
+
+/** A RADIUS packet where only the Vendor-Specific attribute is decoded immediately
+ *
+ */
+static uint8_t const test_lazy_packet[] = {
+	FR_RADIUS_CODE_ACCESS_REQUEST, 0x01, 0x00, 53,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x01, 0x05, 'b', 'o', 'b',				/* User-Name */
+	0x05, 0x06, 0x00, 0x00, 0x00, 0x01,			/* NAS-Port */
+	0x1a, 0x0b, 0x00, 0x00, 0x00, 0x09, 0x01, 0x05,
+	'a', '=', 'b',						/* Vendor-Specific */
+	0x1f, 0x05, 'a', 'b', 'c',				/* Calling-Station-Id */
+	0x05, 0x06, 0x00, 0x00, 0x00, 0x02			/* NAS-Port */
+};
+
+static fr_dict_t const *test_lazy_decode_packet(fr_pair_list_t *list, fr_dict_attr_t const **expected)
+{
+	fr_radius_ctx_t		common = { .secret = "testing123", .secret_length = 10 };
+	uint8_t			*packet = talloc_memdup(autofree, test_lazy_packet, sizeof(test_lazy_packet));
+	fr_radius_decode_ctx_t	decode_ctx = {
+					.common = &common,
+					.tmp_ctx = talloc(autofree, uint8_t),
+					.end = packet + sizeof(test_lazy_packet),
+					.lazy = true
+				};
+	fr_dict_t const		*dict;
+
+	TEST_CASE("Load the RADIUS dictionary");
+	TEST_CHECK(fr_radius_global_init() == 0);
+	TEST_MSG("%s", fr_strerror());
+	TEST_CHECK((dict = fr_dict_by_protocol_name("RADIUS")) != NULL);
+	if (!dict) return NULL;
+
+	expected[0] = fr_dict_attr_by_name(NULL, fr_dict_root(dict), "User-Name");
+	expected[1] = fr_dict_attr_by_name(NULL, fr_dict_root(dict), "NAS-Port");
+	expected[2] = fr_dict_attr_by_name(NULL, fr_dict_root(dict), "Vendor-Specific");
+	expected[3] = fr_dict_attr_by_name(NULL, fr_dict_root(dict), "Calling-Station-Id");
+	expected[4] = expected[1];
+
+	fr_pair_list_init(list);
+
+	TEST_CASE("Only the Vendor-Specific attribute is decoded immediately");
+	TEST_CHECK(fr_radius_decode(autofree, list, packet, sizeof(test_lazy_packet), &decode_ctx) == sizeof(test_lazy_packet));
+	TEST_CHECK(list->lazy != NULL);
+
+	return dict;
+}
+
+static void test_lazy_check_order(fr_pair_list_t *list, fr_dict_attr_t const **expected, unsigned int num)
+{
+	unsigned int	i = 0;
+
+	fr_pair_list_foreach(list, iter) {
+		TEST_CHECK(i < num);
+		if (i >= num) break;
+
+		TEST_CHECK(iter->da == expected[i]);
+		TEST_MSG("Expected %s at position %u, got %s", expected[i]->name, i, iter->da->name);
+		i++;
+	}
+	TEST_CHECK(i == num);
+}
+
+static void test_fr_pair_list_lazy_order(void)
+{
+	fr_dict_attr_t const	*expected[5];
+	fr_pair_list_t		list;
+	fr_pair_t		*vp;
+
+	if (!test_lazy_decode_packet(&list, expected)) return;
+
+	TEST_CASE("Accessing attributes out of order creates them in packet order");
+	TEST_CHECK((vp = fr_pair_find_by_da(&list, NULL, expected[3])) != NULL);
+	TEST_CHECK(vp && (vp->vp_length == 3));
+	TEST_CHECK(fr_pair_find_by_da_idx(&list, expected[1], 1) != NULL);
+	TEST_CHECK(list.lazy != NULL);
+
+	test_lazy_check_order(&list, expected, NUM_ELEMENTS(expected));
+
+	fr_pair_list_free(&list);
+	fr_radius_global_free();
+}
+
+static void test_fr_pair_list_lazy_remove(void)
+{
+	fr_dict_attr_t const	*expected[5];
+	fr_pair_list_t		list;
+	fr_pair_t		*vp;
+
+	if (!test_lazy_decode_packet(&list, expected)) return;
+
+	TEST_CASE("Removing a pair the decoder inserts after");
+	TEST_CHECK((vp = fr_pair_find_by_da(&list, NULL, expected[2])) != NULL);
+	(void) fr_pair_delete(&list, vp);
+	TEST_CHECK(list.lazy != NULL);
+
+	/*
+	 *	Very likely to reuse the memory of the
+	 *	deleted pair, which mustn't be mistaken
+	 *	for it.
+	 */
+	TEST_CASE("Appending a new pair of the same attribute");
+	TEST_CHECK((vp = fr_pair_afrom_da(autofree, expected[2])) != NULL);
+	TEST_CHECK(fr_pair_append(&list, vp) == 0);
+
+	TEST_CASE("Deferred pairs are still created in packet order, before the new pair");
+	TEST_CHECK(fr_pair_find_by_da(&list, NULL, expected[3]) != NULL);
+	TEST_CHECK(fr_pair_find_by_da(&list, NULL, expected[0]) != NULL);
+
+	expected[2] = expected[3];
+	expected[3] = expected[4];
+	expected[4] = vp->da;
+	test_lazy_check_order(&list, expected, NUM_ELEMENTS(expected));
+
+	fr_pair_list_free(&list);
+	fr_radius_global_free();
+}
+
 static void test_fr_pair_find_by_child_num_idx(void)
 {
 	fr_pair_t *vp;
@@ -1430,6 +1717,11 @@ TEST_LIST = {
 	{ "fr_pair_dcursor_value_init",           test_fr_pair_dcursor_value_init },
 	{ "fr_pair_raw_afrom_pair",                test_fr_pair_raw_afrom_pair },
 	{ "fr_pair_find_by_da_idx",                   test_fr_pair_find_by_da_idx },
+	{ "fr_pair_find_by_da_indexed",               test_fr_pair_find_by_da_indexed },
+	{ "fr_pair_list_lazy",                        test_fr_pair_list_lazy },
+	{ "fr_pair_list_lazy_fail",                   test_fr_pair_list_lazy_fail },
+	{ "fr_pair_list_lazy_order",                  test_fr_pair_list_lazy_order },
+	{ "fr_pair_list_lazy_remove",                 test_fr_pair_list_lazy_remove },
 	{ "fr_pair_find_by_child_num_idx",            test_fr_pair_find_by_child_num_idx },
 	{ "fr_pair_find_by_da_nested",            test_fr_pair_find_by_da_nested },
 	{ "fr_pair_append",                       test_fr_pair_append },
@@ -0,0 +1,541 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Hierarchical timer wheel
+ *
+ * @file src/lib/util/timer_wheel.c
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/timer_wheel.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/strerror.h>
+
+/*
+ * Time is divided into ticks of a fixed, power of two, resolution.  Each
+ * level of the wheel has WHEEL_SLOTS slots, with a slot at level N covering
+ * WHEEL_SLOTS^N ticks.  An element is placed in the lowest level at which
+ * its tick and the current tick share the same parent slot, so inserting
+ * and removing an element is a dlist operation, plus setting a bit in the
+ * occupancy map of that level.
+ *
+ * Elements whose tick is at or before the current tick are moved to the
+ * expiry LST, which provides exact ordering for elements due in the same
+ * tick.  Elements further away than the highest level can represent go
+ * into an unordered overflow list.
+ *
+ * The wheel is only advanced to the time passed to fr_timer_wheel_peek().
+ * When the wheel moves into a slot at a higher level, the elements in that
+ * slot are redistributed (cascaded) into the lower levels.  As each element
+ * can only cascade WHEEL_LEVELS times, the amortised cost of insertion and
+ * expiry is constant.
+ */
+#define WHEEL_LEVELS		4
+#define WHEEL_BITS		8
+#define WHEEL_SLOTS		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SLOTS - 1)
+#define WHEEL_OVERFLOW		WHEEL_LEVELS		//!< Level used for elements in the overflow list.
+#define WHEEL_EXPIRY		(WHEEL_LEVELS + 1)	//!< Level used for elements in the expiry LST.
+
+struct fr_timer_wheel_s {
+	char const		*type;				//!< Talloc type of elements.
+	size_t			when_offset;			//!< Offset of the #fr_time_t in the element.
+	size_t			entry_offset;			//!< Offset of the #fr_timer_wheel_entry_t in the element.
+
+	uint8_t			shift;				//!< log2 of the resolution in nanoseconds.
+	uint64_t		cur;				//!< Tick the wheel has been advanced to.
+
+	unsigned int		num_wheel;			//!< Elements in slots or the overflow list.
+
+	fr_lst_t		*expiry;			//!< Elements with a tick <= cur.
+	fr_dlist_head_t		overflow;			//!< Elements beyond the highest level.
+
+	uint64_t		occupied[WHEEL_LEVELS][WHEEL_SLOTS / 64];	//!< Bitmap of non-empty slots.
+	fr_dlist_head_t		slots[WHEEL_LEVELS][WHEEL_SLOTS];	//!< Elements, by level and slot.
+};
+
+static inline CC_HINT(always_inline, nonnull)
+fr_timer_wheel_entry_t *wheel_entry(fr_timer_wheel_t const *tw, void *data)
+{
+	return (fr_timer_wheel_entry_t *)(((uint8_t *)data) + tw->entry_offset);
+}
+
+static inline CC_HINT(always_inline, nonnull)
+fr_time_t wheel_when(fr_timer_wheel_t const *tw, void const *data)
+{
+	return *(fr_time_t const *)(((uint8_t const *)data) + tw->when_offset);
+}
+
+/** Convert a time to a tick
+ *
+ * Times before the epoch are all mapped to tick 0.
+ */
+static inline CC_HINT(always_inline, nonnull)
+uint64_t wheel_tick(fr_timer_wheel_t const *tw, fr_time_t when)
+{
+	int64_t ns = fr_time_unwrap(when);
+
+	if (ns <= 0) return 0;
+
+	return ((uint64_t)ns) >> tw->shift;
+}
+
+static inline CC_HINT(always_inline, nonnull)
+fr_time_t wheel_tick_to_time(fr_timer_wheel_t const *tw, uint64_t tick)
+{
+	return fr_time_wrap((int64_t)(tick << tw->shift));
+}
+
+static inline CC_HINT(always_inline, nonnull)
+void slot_mark(fr_timer_wheel_t *tw, unsigned int level, unsigned int slot)
+{
+	tw->occupied[level][slot >> 6] |= ((uint64_t)1 << (slot & 63));
+}
+
+static inline CC_HINT(always_inline, nonnull)
+void slot_clear(fr_timer_wheel_t *tw, unsigned int level, unsigned int slot)
+{
+	tw->occupied[level][slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+}
+
+/** Find the first occupied slot after the specified slot
+ *
+ * @return
+ *	- The slot number.
+ *	- -1 if there are no occupied slots after the specified slot.
+ */
+static inline CC_HINT(always_inline, nonnull)
+int slot_next(fr_timer_wheel_t const *tw, unsigned int level, unsigned int slot)
+{
+	unsigned int	word;
+	uint64_t	bits;
+
+	if (++slot >= WHEEL_SLOTS) return -1;
+
+	word = slot >> 6;
+	bits = tw->occupied[level][word] & (~(uint64_t)0 << (slot & 63));
+
+	for (;;) {
+		if (bits) return (word << 6) + fr_low_bit_pos(bits) - 1;
+		if (++word >= (WHEEL_SLOTS / 64)) return -1;
+		bits = tw->occupied[level][word];
+	}
+}
+
+/** Place an element into the expiry LST, a slot or the overflow list
+ *
+ */
+static inline CC_HINT(always_inline, nonnull)
+int wheel_place(fr_timer_wheel_t *tw, void *data)
+{
+	fr_timer_wheel_entry_t	*entry = wheel_entry(tw, data);
+	uint64_t		tick = wheel_tick(tw, wheel_when(tw, data));
+	unsigned int		level, slot;
+
+	if (tick <= tw->cur) {
+		if (unlikely(fr_lst_insert(tw->expiry, data) < 0)) return -1;
+		entry->level = WHEEL_EXPIRY;
+		return 0;
+	}
+
+	/*
+	 *	The highest bit which differs between the
+	 *	element's tick and the current tick determines
+	 *	the level.
+	 */
+	level = (fr_high_bit_pos(tick ^ tw->cur) - 1) / WHEEL_BITS;
+	if (level >= WHEEL_LEVELS) {
+		fr_dlist_insert_tail(&tw->overflow, data);
+		entry->level = WHEEL_OVERFLOW;
+		tw->num_wheel++;
+		return 0;
+	}
+
+	slot = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	fr_dlist_insert_tail(&tw->slots[level][slot], data);
+	slot_mark(tw, level, slot);
+	entry->level = level;
+	entry->slot = slot;
+	tw->num_wheel++;
+
+	return 0;
+}
+
+/** Move all elements from a list back into the wheel, relative to the current tick
+ *
+ */
+static inline CC_HINT(always_inline, nonnull)
+void wheel_cascade(fr_timer_wheel_t *tw, fr_dlist_head_t *list)
+{
+	void *data;
+
+	while ((data = fr_dlist_pop_head(list))) {
+		tw->num_wheel--;
+		if (unlikely(wheel_place(tw, data) < 0)) {
+			/*
+			 *	Can only fail if the expiry LST can't
+			 *	be expanded.  Park the element in the
+			 *	overflow list, it'll be retried the next
+			 *	time the wheel advances.
+			 */
+			fr_dlist_insert_tail(&tw->overflow, data);
+			wheel_entry(tw, data)->level = WHEEL_OVERFLOW;
+			tw->num_wheel++;
+		}
+	}
+}
+
+/** Find the first non-empty slot, and the tick at which it starts
+ *
+ * @param[in] tw	to search.
+ * @param[out] level	of the slot.
+ * @param[out] slot	within the level.
+ * @param[out] start	first tick covered by the slot.
+ * @return
+ *	- true if a slot was found.
+ *	- false if the wheel is empty.
+ */
+static bool wheel_next_slot(fr_timer_wheel_t *tw, unsigned int *level, unsigned int *slot, uint64_t *start)
+{
+	unsigned int	i;
+	int		found;
+	void		*data;
+	uint64_t	min;
+
+	if (!tw->num_wheel) return false;
+
+	/*
+	 *	Slots at lower levels always start before
+	 *	slots at higher levels.
+	 */
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		unsigned int shift = WHEEL_BITS * i;
+
+		found = slot_next(tw, i, (tw->cur >> shift) & WHEEL_MASK);
+		if (found < 0) continue;
+
+		*level = i;
+		*slot = found;
+		*start = ((tw->cur >> (shift + WHEEL_BITS)) << (shift + WHEEL_BITS)) | ((uint64_t)found << shift);
+		return true;
+	}
+
+	/*
+	 *	Only elements in the overflow list remain.
+	 *	Find the block containing the earliest one.
+	 */
+	data = fr_dlist_head(&tw->overflow);
+	if (!fr_cond_assert(data)) return false;
+
+	min = wheel_tick(tw, wheel_when(tw, data));
+	while ((data = fr_dlist_next(&tw->overflow, data))) {
+		uint64_t tick = wheel_tick(tw, wheel_when(tw, data));
+
+		if (tick < min) min = tick;
+	}
+
+	*level = WHEEL_OVERFLOW;
+	*slot = 0;
+	*start = (min >> (WHEEL_BITS * WHEEL_LEVELS)) << (WHEEL_BITS * WHEEL_LEVELS);
+	return true;
+}
+
+/** Advance the wheel to the specified tick
+ *
+ * Every element with a tick <= target ends up in the expiry LST.
+ *
+ * @param[in] tw	to advance.
+ * @param[in] target	tick to advance to.
+ * @param[out] next	first tick of the earliest non-empty slot, or UINT64_MAX.
+ */
+static void wheel_advance(fr_timer_wheel_t *tw, uint64_t target, uint64_t *next)
+{
+	unsigned int	level, slot;
+	uint64_t	start;
+
+	while (wheel_next_slot(tw, &level, &slot, &start)) {
+		if (start > target) {
+			*next = start;
+			goto done;
+		}
+
+		/*
+		 *	Jumping to the start of the slot is safe,
+		 *	as all slots before it are empty.
+		 */
+		if (start > tw->cur) tw->cur = start;
+
+		if (level == WHEEL_OVERFLOW) {
+			fr_dlist_head_t	tmp;
+
+			/*
+			 *	Elements may be placed back into the
+			 *	overflow list, so cascade from a copy.
+			 */
+			_fr_dlist_init(&tmp, tw->overflow.offset, tw->overflow.type);
+			fr_dlist_move(&tmp, &tw->overflow);
+			wheel_cascade(tw, &tmp);
+			continue;
+		}
+
+		slot_clear(tw, level, slot);
+		wheel_cascade(tw, &tw->slots[level][slot]);
+	}
+	*next = UINT64_MAX;
+
+done:
+	/*
+	 *	Nothing is due before the first occupied
+	 *	slot, so the wheel can be moved forward to
+	 *	the target.
+	 */
+	if (target > tw->cur) tw->cur = target;
+}
+
+/** Free any elements still in the wheel
+ *
+ */
+static int _timer_wheel_free(fr_timer_wheel_t *tw)
+{
+	unsigned int i, j;
+
+	/*
+	 *	Unlink all the elements so they don't
+	 *	point into freed memory.
+	 */
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS; j++) {
+			while (fr_dlist_pop_head(&tw->slots[i][j]));
+		}
+	}
+	while (fr_dlist_pop_head(&tw->overflow));
+
+	return 0;
+}
+
+/** Allocate a new timer wheel
+ *
+ * @param[in] ctx		Talloc ctx to allocate the wheel in.
+ * @param[in] cmp		Comparator used to order elements which expire in the same tick.
+ * @param[in] type		Talloc type of elements.
+ * @param[in] when_offset	Offset of the #fr_time_t element expiry time.
+ * @param[in] entry_offset	Offset of the #fr_timer_wheel_entry_t in the element.
+ * @param[in] resolution	of the wheel.  Rounded down to a power of two nanoseconds.
+ * @return
+ *	- A new timer wheel.
+ *	- NULL on error.
+ */
+fr_timer_wheel_t *_fr_timer_wheel_alloc(TALLOC_CTX *ctx, fr_lst_cmp_t cmp, char const *type,
+					size_t when_offset, size_t entry_offset, fr_time_delta_t resolution)
+{
+	fr_timer_wheel_t	*tw;
+	unsigned int		i, j;
+	size_t			dlist_offset = entry_offset + offsetof(fr_timer_wheel_entry_t, entry);
+
+	if (unlikely(!fr_time_delta_ispos(resolution))) {
+		fr_strerror_const("Timer wheel resolution must be greater than zero");
+		return NULL;
+	}
+
+	tw = talloc_zero(ctx, fr_timer_wheel_t);
+	if (unlikely(!tw)) return NULL;
+
+	tw->type = type;
+	tw->when_offset = when_offset;
+	tw->entry_offset = entry_offset;
+	tw->shift = fr_high_bit_pos((uint64_t)fr_time_delta_unwrap(resolution)) - 1;
+
+	tw->expiry = _fr_lst_alloc(tw, cmp, type, entry_offset + offsetof(fr_timer_wheel_entry_t, lst_id), 0);
+	if (unlikely(!tw->expiry)) {
+		talloc_free(tw);
+		return NULL;
+	}
+
+	_fr_dlist_init(&tw->overflow, dlist_offset, type);
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS; j++) _fr_dlist_init(&tw->slots[i][j], dlist_offset, type);
+	}
+	talloc_set_destructor(tw, _timer_wheel_free);
+
+	return tw;
+}
+
+/** Insert an element into the timer wheel
+ *
+ * @param[in] tw	to insert the element into.
+ * @param[in] data	to insert.  The expiry time of the element must not be
+ *			changed while it's in the wheel.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_timer_wheel_insert(fr_timer_wheel_t *tw, void *data)
+{
+	if (unlikely(fr_timer_wheel_entry_inserted(wheel_entry(tw, data)))) {
+		fr_strerror_const("Element is already in the timer wheel");
+		return -1;
+	}
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+	if (tw->type) (void)_talloc_get_type_abort(data, tw->type, __location__);
+#endif
+
+	return wheel_place(tw, data);
+}
+
+/** Remove an element from the timer wheel
+ *
+ * @param[in] tw	to remove the element from.
+ * @param[in] data	to remove.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the element was not in the wheel.
+ */
+int fr_timer_wheel_extract(fr_timer_wheel_t *tw, void *data)
+{
+	fr_timer_wheel_entry_t	*entry = wheel_entry(tw, data);
+	fr_dlist_head_t		*list;
+
+	if (fr_lst_entry_inserted(entry->lst_id)) return fr_lst_extract(tw->expiry, data);
+
+	if (unlikely(!fr_dlist_entry_in_list(&entry->entry))) {
+		fr_strerror_const("Tried to extract element not in the timer wheel");
+		return -1;
+	}
+
+	if (entry->level == WHEEL_OVERFLOW) {
+		list = &tw->overflow;
+	} else {
+		list = &tw->slots[entry->level][entry->slot];
+	}
+
+	fr_dlist_remove(list, data);
+	if ((entry->level < WHEEL_LEVELS) && fr_dlist_empty(list)) slot_clear(tw, entry->level, entry->slot);
+	tw->num_wheel--;
+
+	return 0;
+}
+
+/** Advance the wheel, and return the earliest element if it's due
+ *
+ * All elements with an expiry time in the same tick as, or before, now are
+ * ordered exactly, so the element returned is always the one with the
+ * earliest expiry time, though that time may be slightly after now.
+ *
+ * @param[in] tw	to advance.
+ * @param[in] now	the current time.
+ * @param[out] next	Expiry time of the element returned, or if no element
+ *			is due, a time before which no element will expire.
+ *			fr_time_wrap(0) if the wheel is empty.
+ * @return
+ *	- The element with the earliest expiry time.
+ *	- NULL if no elements are due in the current tick.
+ */
+void *fr_timer_wheel_peek(fr_timer_wheel_t *tw, fr_time_t now, fr_time_t *next)
+{
+	uint64_t	next_tick;
+	void		*data;
+
+	wheel_advance(tw, wheel_tick(tw, now), &next_tick);
+
+	data = fr_lst_peek(tw->expiry);
+	if (data) {
+		*next = wheel_when(tw, data);
+		return data;
+	}
+
+	*next = (next_tick == UINT64_MAX) ? fr_time_wrap(0) : wheel_tick_to_time(tw, next_tick);
+	return NULL;
+}
+
+/** Return the number of elements in the timer wheel
+ *
+ */
+unsigned int fr_timer_wheel_num_elements(fr_timer_wheel_t *tw)
+{
+	return fr_lst_num_elements(tw->expiry) + tw->num_wheel;
+}
+
+/** Iterate over the elements in a timer wheel
+ *
+ * @note If the wheel is modified, the iterator should be considered invalidated.
+ *
+ * @param[in] tw	to iterate over.
+ * @param[in] iter	Pointer to an iterator struct, used to maintain
+ *			state between calls.
+ * @return
+ *	- NULL if there are no elements in the wheel.
+ *	- The first element.
+ */
+void *fr_timer_wheel_iter_init(fr_timer_wheel_t *tw, fr_timer_wheel_iter_t *iter)
+{
+	void *data;
+
+	*iter = (fr_timer_wheel_iter_t){ .in_expiry = true };
+
+	data = fr_lst_iter_init(tw->expiry, &iter->lst_iter);
+	if (data) return data;
+
+	iter->in_expiry = false;
+	return fr_timer_wheel_iter_next(tw, iter);
+}
+
+/** Get the next element in a timer wheel
+ *
+ * @param[in] tw	to iterate over.
+ * @param[in] iter	Pointer to an iterator struct, used to maintain
+ *			state between calls.
+ * @return
+ *	- The next element.
+ *	- NULL if there are no more elements.
+ */
+void *fr_timer_wheel_iter_next(fr_timer_wheel_t *tw, fr_timer_wheel_iter_t *iter)
+{
+	fr_dlist_head_t	*list;
+	void		*data;
+
+	if (iter->in_expiry) {
+		data = fr_lst_iter_next(tw->expiry, &iter->lst_iter);
+		if (data) return data;
+
+		iter->in_expiry = false;
+	}
+
+	/*
+	 *	Continue with the current slot, then
+	 *	walk the remaining slots, and finally
+	 *	the overflow list.
+	 */
+	while (iter->slot <= (WHEEL_LEVELS * WHEEL_SLOTS)) {
+		list = (iter->slot == (WHEEL_LEVELS * WHEEL_SLOTS)) ?
+			&tw->overflow :
+			&tw->slots[iter->slot / WHEEL_SLOTS][iter->slot % WHEEL_SLOTS];
+
+		data = iter->next ? iter->next : fr_dlist_head(list);
+		if (data) {
+			iter->next = fr_dlist_next(list, data);
+			if (!iter->next) iter->slot++;
+			return data;
+		}
+
+		iter->next = NULL;
+		iter->slot++;
+	}
+
+	return NULL;
+}
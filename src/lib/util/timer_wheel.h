@@ -0,0 +1,122 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Structures and prototypes for hierarchical timer wheels
+ *
+ * @file src/lib/util/timer_wheel.h
+ *
+ * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
+ */
+RCSIDH(timer_wheel_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/lst.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#include <stdint.h>
+
+typedef struct fr_timer_wheel_s fr_timer_wheel_t;
+
+/** Per-element timer wheel state
+ *
+ * The type passed to fr_timer_wheel_alloc() and fr_timer_wheel_talloc_alloc() in
+ * _type must be the type of a structure with a member of this type.  That member's
+ * name must be passed as the _field argument.
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in a wheel slot.
+	fr_lst_index_t		lst_id;		//!< Position in the expiry LST.
+	uint8_t			level;		//!< Level of the slot the element is in.
+	uint8_t			slot;		//!< Slot within that level.
+} fr_timer_wheel_entry_t;
+
+/** Iterator for timer wheel elements
+ *
+ * Elements are not returned in expiry order.
+ */
+typedef struct {
+	fr_lst_iter_t		lst_iter;	//!< Position in the expiry LST.
+	bool			in_expiry;	//!< Still iterating over the expiry LST.
+	unsigned int		slot;		//!< Current slot, counting across all levels.
+	void			*next;		//!< Next element in the current slot.
+} fr_timer_wheel_iter_t;
+
+/** Creates a timer wheel that can be used with non-talloced elements
+ *
+ * @param[in] _ctx		Talloc ctx to allocate the wheel in.
+ * @param[in] _cmp		Comparator used to order elements which expire in the same tick.
+ * @param[in] _type		Of elements.
+ * @param[in] _when		field containing the #fr_time_t the element expires at.
+ * @param[in] _field		#fr_timer_wheel_entry_t field.
+ * @param[in] _resolution	of the wheel.  Rounded down to a power of two nanoseconds.
+ * @return
+ *	- A pointer to the new timer wheel.
+ *	- NULL on error.
+ */
+#define fr_timer_wheel_alloc(_ctx, _cmp, _type, _when, _field, _resolution) \
+	_fr_timer_wheel_alloc(_ctx, _cmp, NULL, (size_t)offsetof(_type, _when), (size_t)offsetof(_type, _field), _resolution)
+
+/** Creates a timer wheel that verifies elements are of a specific talloc type
+ *
+ * @param[in] _ctx		Talloc ctx to allocate the wheel in.
+ * @param[in] _cmp		Comparator used to order elements which expire in the same tick.
+ * @param[in] _talloc_type	of elements.
+ * @param[in] _when		field containing the #fr_time_t the element expires at.
+ * @param[in] _field		#fr_timer_wheel_entry_t field.
+ * @param[in] _resolution	of the wheel.  Rounded down to a power of two nanoseconds.
+ * @return
+ *	- A pointer to the new timer wheel.
+ *	- NULL on error.
+ */
+#define fr_timer_wheel_talloc_alloc(_ctx, _cmp, _talloc_type, _when, _field, _resolution) \
+	_fr_timer_wheel_alloc(_ctx, _cmp, #_talloc_type, (size_t)offsetof(_talloc_type, _when), \
+			      (size_t)offsetof(_talloc_type, _field), _resolution)
+
+fr_timer_wheel_t	*_fr_timer_wheel_alloc(TALLOC_CTX *ctx, fr_lst_cmp_t cmp, char const *type,
+					       size_t when_offset, size_t entry_offset,
+					       fr_time_delta_t resolution) CC_HINT(nonnull(2));
+
+/** Check if an element is inserted into a timer wheel
+ *
+ * @param[in] entry	#fr_timer_wheel_entry_t *as stored in the element*.
+ */
+static inline bool fr_timer_wheel_entry_inserted(fr_timer_wheel_entry_t const *entry)
+{
+	return fr_lst_entry_inserted(entry->lst_id) || fr_dlist_entry_in_list(&entry->entry);
+}
+
+int		fr_timer_wheel_insert(fr_timer_wheel_t *tw, void *data) CC_HINT(nonnull);
+
+int		fr_timer_wheel_extract(fr_timer_wheel_t *tw, void *data) CC_HINT(nonnull);
+
+void		*fr_timer_wheel_peek(fr_timer_wheel_t *tw, fr_time_t now, fr_time_t *next) CC_HINT(nonnull);
+
+unsigned int	fr_timer_wheel_num_elements(fr_timer_wheel_t *tw) CC_HINT(nonnull);
+
+void		*fr_timer_wheel_iter_init(fr_timer_wheel_t *tw, fr_timer_wheel_iter_t *iter) CC_HINT(nonnull);
+
+void		*fr_timer_wheel_iter_next(fr_timer_wheel_t *tw, fr_timer_wheel_iter_t *iter) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,391 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/time.h>
+#include <freeradius-devel/util/lst.h>
+
+#include "timer_wheel.c"
+
+typedef struct {
+	fr_time_t		when;
+	fr_lst_index_t		lst_id;		/* Only used by the LST comparison */
+	fr_timer_wheel_entry_t	entry;
+	unsigned int		id;
+	bool			inserted;
+} wheel_thing;
+
+static int8_t wheel_cmp(void const *one, void const *two)
+{
+	wheel_thing const	*a = one, *b = two;
+
+	return fr_time_cmp(a->when, b->when);
+}
+
+#define RESOLUTION	fr_time_delta_from_msec(1)
+
+/** Return the inserted element with the earliest expiry time
+ *
+ */
+static wheel_thing *wheel_thing_min(wheel_thing *things, unsigned int count)
+{
+	wheel_thing	*min = NULL;
+	unsigned int	i;
+
+	for (i = 0; i < count; i++) {
+		if (!things[i].inserted) continue;
+		if (!min || fr_time_lt(things[i].when, min->when)) min = &things[i];
+	}
+
+	return min;
+}
+
+static void timer_wheel_test_basic(void)
+{
+	fr_timer_wheel_t	*tw;
+	wheel_thing		things[20];
+	fr_time_t		next;
+	unsigned int		i;
+
+	tw = fr_timer_wheel_alloc(NULL, wheel_cmp, wheel_thing, when, entry, RESOLUTION);
+	TEST_CHECK(tw != NULL);
+
+	memset(things, 0, sizeof(things));
+
+	/*
+	 *	Spread the elements across all levels,
+	 *	including the overflow list.
+	 */
+	for (i = 0; i < NUM_ELEMENTS(things); i++) {
+		things[i].when = fr_time_wrap((int64_t)((NUM_ELEMENTS(things) - i) * fr_time_delta_unwrap(RESOLUTION)) << (i * 2));
+		things[i].id = i;
+		TEST_CHECK(fr_timer_wheel_insert(tw, &things[i]) == 0);
+		TEST_CHECK(fr_timer_wheel_entry_inserted(&things[i].entry));
+		things[i].inserted = true;
+	}
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == NUM_ELEMENTS(things));
+	TEST_CHECK(fr_timer_wheel_insert(tw, &things[0]) < 0);
+
+	for (i = 0; i < NUM_ELEMENTS(things); i++) {
+		wheel_thing *expected = wheel_thing_min(things, NUM_ELEMENTS(things));
+		wheel_thing *thing;
+
+		/*
+		 *	Nothing must be returned before it's due
+		 */
+		thing = fr_timer_wheel_peek(tw, fr_time_sub(expected->when, fr_time_delta_wrap(fr_time_delta_unwrap(RESOLUTION) * 2)), &next);
+		if (thing) TEST_CHECK(thing == expected);
+		TEST_CHECK(fr_time_lteq(next, expected->when));
+
+		thing = fr_timer_wheel_peek(tw, expected->when, &next);
+		TEST_CHECK(thing == expected);
+		TEST_MSG("expected %u got %u", expected->id, thing ? thing->id : UINT_MAX);
+		TEST_CHECK(fr_time_eq(next, expected->when));
+
+		TEST_CHECK(fr_timer_wheel_extract(tw, thing) == 0);
+		TEST_CHECK(!fr_timer_wheel_entry_inserted(&thing->entry));
+		thing->inserted = false;
+	}
+
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == 0);
+	TEST_CHECK(fr_timer_wheel_peek(tw, fr_time_max(), &next) == NULL);
+	TEST_CHECK(fr_time_eq(next, fr_time_wrap(0)));
+
+	talloc_free(tw);
+}
+
+/** Insert, delete and expire elements at random, checking the wheel against a linear search
+ *
+ */
+static void timer_wheel_test_random(void)
+{
+	fr_timer_wheel_t	*tw;
+	wheel_thing		*things;
+	fr_fast_rand_t		rand_ctx;
+	fr_time_t		now = fr_time_wrap(NSEC);
+	unsigned int		count = 1000, inserted = 0, i;
+
+	tw = fr_timer_wheel_alloc(NULL, wheel_cmp, wheel_thing, when, entry, RESOLUTION);
+	TEST_CHECK(tw != NULL);
+
+	things = talloc_zero_array(NULL, wheel_thing, count);
+	for (i = 0; i < count; i++) things[i].id = i;
+
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	for (i = 0; i < 100000; i++) {
+		wheel_thing	*thing = &things[fr_fast_rand(&rand_ctx) % count];
+		uint32_t	op = fr_fast_rand(&rand_ctx) % 10;
+
+		if (op < 6) {
+			int64_t delta;
+
+			if (thing->inserted) {
+				TEST_CHECK(fr_timer_wheel_extract(tw, thing) == 0);
+				inserted--;
+			}
+
+			/*
+			 *	Mixture of sub-tick, sub-second,
+			 *	minutes, and days, and some in the past.
+			 */
+			switch (fr_fast_rand(&rand_ctx) % 5) {
+			case 0:
+				delta = fr_fast_rand(&rand_ctx) % NSEC / 1000;
+				break;
+
+			case 1:
+				delta = fr_fast_rand(&rand_ctx) % NSEC;
+				break;
+
+			case 2:
+				delta = (int64_t)(fr_fast_rand(&rand_ctx) % 300) * NSEC;
+				break;
+
+			case 3:
+				delta = -(int64_t)(fr_fast_rand(&rand_ctx) % (NSEC / 10));
+				break;
+
+			default:
+				delta = (int64_t)(fr_fast_rand(&rand_ctx) % 1000) * 86400 * NSEC;
+				break;
+			}
+
+			thing->when = fr_time_add(now, fr_time_delta_wrap(delta));
+			TEST_CHECK(fr_timer_wheel_insert(tw, thing) == 0);
+			thing->inserted = true;
+			inserted++;
+
+		} else if (op < 8) {
+			if (!thing->inserted) continue;
+
+			TEST_CHECK(fr_timer_wheel_extract(tw, thing) == 0);
+			thing->inserted = false;
+			inserted--;
+
+		} else {
+			now = fr_time_add(now, fr_time_delta_wrap(fr_fast_rand(&rand_ctx) % (NSEC / 10)));
+
+			for (;;) {
+				wheel_thing	*expected = wheel_thing_min(things, count);
+				fr_time_t	next;
+
+				thing = fr_timer_wheel_peek(tw, now, &next);
+				if (!thing) {
+					if (expected) {
+						TEST_CHECK(fr_time_gt(expected->when, now));
+						TEST_CHECK(fr_time_lteq(next, expected->when));
+					}
+					break;
+				}
+
+				TEST_CHECK(expected && fr_time_eq(thing->when, expected->when));
+				if (fr_time_gt(thing->when, now)) break;
+
+				TEST_CHECK(fr_timer_wheel_extract(tw, thing) == 0);
+				thing->inserted = false;
+				inserted--;
+			}
+		}
+
+		TEST_CHECK(fr_timer_wheel_num_elements(tw) == inserted);
+		TEST_MSG("expected %u elements, got %u", inserted, fr_timer_wheel_num_elements(tw));
+	}
+
+	talloc_free(tw);
+	talloc_free(things);
+}
+
+static void timer_wheel_test_iter(void)
+{
+	fr_timer_wheel_t	*tw;
+	fr_timer_wheel_iter_t	iter;
+	wheel_thing		things[100];
+	wheel_thing		*thing;
+	fr_time_t		next;
+	unsigned int		i, found = 0;
+
+	tw = fr_timer_wheel_alloc(NULL, wheel_cmp, wheel_thing, when, entry, RESOLUTION);
+	TEST_CHECK(tw != NULL);
+
+	memset(things, 0, sizeof(things));
+	for (i = 0; i < NUM_ELEMENTS(things); i++) {
+		things[i].when = fr_time_wrap((int64_t)i * i * i * NSEC);
+		TEST_CHECK(fr_timer_wheel_insert(tw, &things[i]) == 0);
+	}
+
+	/*
+	 *	Get some elements into the expiry LST
+	 */
+	(void) fr_timer_wheel_peek(tw, fr_time_wrap((int64_t)1000 * NSEC), &next);
+
+	for (thing = fr_timer_wheel_iter_init(tw, &iter);
+	     thing;
+	     thing = fr_timer_wheel_iter_next(tw, &iter)) {
+		TEST_CHECK(!thing->inserted);
+		thing->inserted = true;
+		found++;
+	}
+	TEST_CHECK(found == NUM_ELEMENTS(things));
+	TEST_MSG("expected %zu elements, found %u", NUM_ELEMENTS(things), found);
+
+	talloc_free(tw);
+}
+
+/** Benchmark timer churn for timer wheels vs LSTs
+ *
+ * Models an event list with a large number of live timers, most of which
+ * are deleted and re-armed before they fire, while time advances and the
+ * earliest timers expire.
+ */
+static void timer_churn_cmp(unsigned int count)
+{
+	wheel_thing	*things;
+	uint32_t	*deltas, *picks;
+	unsigned int	i, ops = count * 10;
+	fr_fast_rand_t	rand_ctx;
+
+	things = talloc_zero_array(NULL, wheel_thing, count);
+	deltas = talloc_array(NULL, uint32_t, ops);
+	picks = talloc_array(NULL, uint32_t, ops);
+
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	/*
+	 *	Timers between 1ms and 30s in the future,
+	 *	like cleanup_delay, max_request_time and
+	 *	retransmission timers.
+	 */
+	for (i = 0; i < ops; i++) {
+		deltas[i] = 1 + (fr_fast_rand(&rand_ctx) % 30000);
+		picks[i] = fr_fast_rand(&rand_ctx) % count;
+	}
+
+	/*
+	 *	LST
+	 */
+	{
+		fr_lst_t	*lst;
+		fr_time_t	now = fr_time_wrap(NSEC), start_insert, end_insert, start_churn, end_churn;
+		unsigned int	expired = 0;
+
+		lst = fr_lst_alloc(NULL, wheel_cmp, wheel_thing, lst_id, 0);
+		TEST_CHECK(lst != NULL);
+
+		start_insert = fr_time();
+		for (i = 0; i < count; i++) {
+			things[i].when = fr_time_add(now, fr_time_delta_from_msec(deltas[i]));
+			fr_lst_insert(lst, &things[i]);
+		}
+		end_insert = fr_time();
+
+		start_churn = fr_time();
+		for (i = 0; i < ops; i++) {
+			wheel_thing *thing = &things[picks[i]];
+
+			if (fr_lst_entry_inserted(thing->lst_id)) fr_lst_extract(lst, thing);
+			thing->when = fr_time_add(now, fr_time_delta_from_msec(deltas[i]));
+			fr_lst_insert(lst, thing);
+
+			if ((i % 100) == 0) {
+				now = fr_time_add(now, fr_time_delta_from_msec(1));
+				while ((thing = fr_lst_peek(lst)) && fr_time_lteq(thing->when, now)) {
+					fr_lst_extract(lst, thing);
+					expired++;
+				}
+			}
+		}
+		end_churn = fr_time();
+
+		TEST_MSG_ALWAYS("\nlst timers: %u\n", count);
+		TEST_MSG_ALWAYS("insert: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_insert, start_insert)) / 1000);
+		TEST_MSG_ALWAYS("churn (%u ops, %u expired): %"PRIu64" μs\n", ops, expired,
+				fr_time_delta_unwrap(fr_time_sub(end_churn, start_churn)) / 1000);
+
+		talloc_free(lst);
+	}
+
+	for (i = 0; i < count; i++) things[i].lst_id = 0;
+
+	/*
+	 *	Timer wheel
+	 */
+	{
+		fr_timer_wheel_t	*tw;
+		fr_time_t		now = fr_time_wrap(NSEC), next, start_insert, end_insert, start_churn, end_churn;
+		unsigned int		expired = 0;
+
+		tw = fr_timer_wheel_alloc(NULL, wheel_cmp, wheel_thing, when, entry, RESOLUTION);
+		TEST_CHECK(tw != NULL);
+
+		start_insert = fr_time();
+		for (i = 0; i < count; i++) {
+			things[i].when = fr_time_add(now, fr_time_delta_from_msec(deltas[i]));
+			fr_timer_wheel_insert(tw, &things[i]);
+		}
+		end_insert = fr_time();
+
+		start_churn = fr_time();
+		for (i = 0; i < ops; i++) {
+			wheel_thing *thing = &things[picks[i]];
+
+			if (fr_timer_wheel_entry_inserted(&thing->entry)) fr_timer_wheel_extract(tw, thing);
+			thing->when = fr_time_add(now, fr_time_delta_from_msec(deltas[i]));
+			fr_timer_wheel_insert(tw, thing);
+
+			if ((i % 100) == 0) {
+				now = fr_time_add(now, fr_time_delta_from_msec(1));
+				while ((thing = fr_timer_wheel_peek(tw, now, &next)) && fr_time_lteq(thing->when, now)) {
+					fr_timer_wheel_extract(tw, thing);
+					expired++;
+				}
+			}
+		}
+		end_churn = fr_time();
+
+		TEST_MSG_ALWAYS("\ntimer wheel timers: %u\n", count);
+		TEST_MSG_ALWAYS("insert: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_insert, start_insert)) / 1000);
+		TEST_MSG_ALWAYS("churn (%u ops, %u expired): %"PRIu64" μs\n", ops, expired,
+				fr_time_delta_unwrap(fr_time_sub(end_churn, start_churn)) / 1000);
+
+		talloc_free(tw);
+	}
+
+	talloc_free(picks);
+	talloc_free(deltas);
+	talloc_free(things);
+}
+
+static void timer_churn_cmp_1000(void)
+{
+	timer_churn_cmp(1000);
+}
+
+static void timer_churn_cmp_100000(void)
+{
+	timer_churn_cmp(100000);
+}
+
+static void timer_churn_cmp_500000(void)
+{
+	timer_churn_cmp(500000);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "timer_wheel_test_basic",	timer_wheel_test_basic },
+	{ "timer_wheel_test_random",	timer_wheel_test_random },
+	{ "timer_wheel_test_iter",	timer_wheel_test_iter },
+
+	/*
+	 *	Compare with LSTs
+	 */
+	{ "timer_churn_cmp_1000",	timer_churn_cmp_1000 },
+	{ "timer_churn_cmp_100000",	timer_churn_cmp_100000 },
+	{ "timer_churn_cmp_500000",	timer_churn_cmp_500000 },
+
+	{ NULL }
+};
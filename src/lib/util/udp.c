@@ -28,6 +28,10 @@ RCSID("$Id$")
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/udp.h>
 
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#  include <linux/filter.h>
+#endif
+
 #define FR_DEBUG_STRERROR_PRINTF if (fr_debug_lvl) fr_strerror_printf
 
 /** Send a packet via a UDP socket.
@@ -208,3 +212,418 @@ done:
 
 	return slen;
 }
+
+/** Read multiple UDP packets with one system call
+ *
+ * Where the platform has no recvmmsg(), it is emulated in userland, and
+ * this function is no worse than calling udp_recv() in a loop.
+ *
+ * @param[in] sockfd		we're reading from.
+ * @param[in] flags		for things.  Connected sockets should use udp_recv().
+ * @param[in,out] msgs		array of datagrams.  The caller sets data and data_size for
+ *				each entry.  On return, data_len, socket and when are
+ *				populated for each datagram which was read.
+ * @param[in] num		number of entries in msgs.  At most #UDP_RECV_MMSG_MAX
+ *				datagrams will be read.
+ * @return
+ *	- > 0 the number of datagrams read.
+ *	- 0 if no datagrams were available.
+ *	- < 0 on failure.
+ */
+int udp_recv_mmsg(int sockfd, int flags, udp_mmsg_t *msgs, unsigned int num)
+{
+	struct mmsghdr		mmsgvec[UDP_RECV_MMSG_MAX];
+	struct iovec		iov[UDP_RECV_MMSG_MAX];
+	struct sockaddr_storage	src[UDP_RECV_MMSG_MAX];
+	struct sockaddr_storage	dst[UDP_RECV_MMSG_MAX];
+	socklen_t		sizeof_dst[UDP_RECV_MMSG_MAX];
+	int			ifindex[UDP_RECV_MMSG_MAX];
+	fr_time_t		when[UDP_RECV_MMSG_MAX];
+	uint8_t			cbuf[UDP_RECV_MMSG_MAX][128];
+	unsigned int		i;
+	int			sock_flags = 0, ret;
+
+	fr_assert((flags & UDP_FLAGS_CONNECTED) == 0);
+
+	if ((flags & UDP_FLAGS_PEEK) != 0) sock_flags |= MSG_PEEK;
+
+	if (num > UDP_RECV_MMSG_MAX) num = UDP_RECV_MMSG_MAX;
+
+	/*
+	 *	The kernel updates msg_namelen and msg_controllen, so
+	 *	the headers have to be set up again for every call.
+	 */
+	memset(mmsgvec, 0, sizeof(mmsgvec[0]) * num);
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = msgs[i].data;
+		iov[i].iov_len = msgs[i].data_size;
+
+		mmsgvec[i].msg_hdr.msg_name = &src[i];
+		mmsgvec[i].msg_hdr.msg_namelen = sizeof(src[i]);
+		mmsgvec[i].msg_hdr.msg_iov = &iov[i];
+		mmsgvec[i].msg_hdr.msg_iovlen = 1;
+		mmsgvec[i].msg_hdr.msg_control = cbuf[i];
+		mmsgvec[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+	}
+
+	ret = recvmmsgfromto(sockfd, mmsgvec, num, sock_flags, ifindex, dst, sizeof_dst, when);
+	if (ret < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return ret;
+	}
+
+	for (i = 0; i < (unsigned int) ret; i++) {
+		udp_mmsg_t *msg = &msgs[i];
+
+		msg->data_len = mmsgvec[i].msg_len;
+		msg->when = when[i];
+		msg->socket = (fr_socket_t){
+			.fd = sockfd,
+			.type = SOCK_DGRAM,
+			.inet = {
+				.ifindex = ifindex[i]
+			}
+		};
+
+		if (fr_ipaddr_from_sockaddr(&msg->socket.inet.src_ipaddr, &msg->socket.inet.src_port,
+					    &src[i], mmsgvec[i].msg_hdr.msg_namelen) < 0) {
+			fr_strerror_const_push("Failed converting src sockaddr to ipaddr");
+			return -1;
+		}
+		if (fr_ipaddr_from_sockaddr(&msg->socket.inet.dst_ipaddr, &msg->socket.inet.dst_port,
+					    &dst[i], sizeof_dst[i]) < 0) {
+			fr_strerror_const_push("Failed converting dst sockaddr to ipaddr");
+			return -1;
+		}
+	}
+
+	return ret;
+}
+
+/** Write multiple UDP packets with one system call
+ *
+ * Where the platform has no sendmmsg(), it is emulated in userland, and
+ * this function is no worse than calling udp_send() in a loop.
+ *
+ * @param[in] sockfd		we're writing to.
+ * @param[in] msgs		array of datagrams.  data, data_len and socket must
+ *				be set for each entry.  The socket src/dst are used
+ *				as-is, i.e. they should already have been swapped.
+ * @param[in] num		number of entries in msgs.  At most #UDP_SEND_MMSG_MAX
+ *				datagrams will be written.
+ *
+ * If the addresses of a datagram can't be converted, only the datagrams
+ * before it are written.  The caller will see a short write, and the bad
+ * datagram will be the first one in the next call, which then fails with
+ * EINVAL.
+ *
+ * @return
+ *	- > 0 the number of datagrams written.
+ *	- < 0 if the first datagram could not be written.  errno is set.
+ */
+int udp_send_mmsg(int sockfd, udp_mmsg_t const *msgs, unsigned int num)
+{
+	struct mmsghdr		mmsgvec[UDP_SEND_MMSG_MAX];
+	struct iovec		iov[UDP_SEND_MMSG_MAX];
+	struct sockaddr_storage	src[UDP_SEND_MMSG_MAX];
+	struct sockaddr_storage	dst[UDP_SEND_MMSG_MAX];
+	uint8_t			cbuf[UDP_SEND_MMSG_MAX][128];
+	unsigned int		i;
+	int			ret;
+
+	if (num > UDP_SEND_MMSG_MAX) num = UDP_SEND_MMSG_MAX;
+
+	for (i = 0; i < num; i++) {
+		udp_mmsg_t const	*msg = &msgs[i];
+		socklen_t		sizeof_src, sizeof_dst;
+
+		if ((fr_ipaddr_to_sockaddr(&dst[i], &sizeof_dst,
+					   &msg->socket.inet.dst_ipaddr, msg->socket.inet.dst_port) < 0) ||
+		    (fr_ipaddr_to_sockaddr(&src[i], &sizeof_src,
+					   &msg->socket.inet.src_ipaddr, msg->socket.inet.src_port) < 0) ||
+		    (sendfromto_msghdr(sockfd, &mmsgvec[i].msg_hdr, cbuf[i], sizeof(cbuf[i]),
+				       msg->socket.inet.ifindex,
+				       (struct sockaddr *)&src[i], sizeof_src,
+				       (struct sockaddr *)&dst[i], sizeof_dst) < 0)) {
+			/*
+			 *	Write the good datagrams before this
+			 *	one.  The caller will retry from here.
+			 */
+			if (i > 0) break;
+
+			fr_strerror_const_push("udp_send_mmsg failed building message header");
+			errno = EINVAL;
+			return -1;
+		}
+
+		iov[i].iov_base = msg->data;
+		iov[i].iov_len = msg->data_len;
+
+		mmsgvec[i].msg_hdr.msg_iov = &iov[i];
+		mmsgvec[i].msg_hdr.msg_iovlen = 1;
+		mmsgvec[i].msg_len = 0;
+	}
+
+	ret = sendmmsg(sockfd, mmsgvec, i, 0);
+	if (ret < 0) fr_strerror_printf("udp_send_mmsg failed: %s", fr_syserror(errno));
+
+	return ret;
+}
+
+/** Allocate a queue for coalescing outgoing datagrams
+ *
+ * @param[in] ctx		to allocate the queue in.
+ * @param[in] sockfd		to write the datagrams to.
+ * @param[in] max		maximum number of datagrams to queue before they
+ *				are written.
+ * @param[in] max_packet_size	of any one datagram.
+ * @return
+ *	- The new queue.
+ *	- NULL on error.
+ */
+udp_mmsg_queue_t *udp_mmsg_queue_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int max, size_t max_packet_size)
+{
+	udp_mmsg_queue_t	*q;
+	uint8_t			*data;
+	unsigned int		i;
+
+	q = talloc_zero(ctx, udp_mmsg_queue_t);
+	if (!q) return NULL;
+
+	q->sockfd = sockfd;
+	q->max = max;
+
+	q->msgs = talloc_zero_array(q, udp_mmsg_t, max);
+	if (!q->msgs) {
+	error:
+		talloc_free(q);
+		return NULL;
+	}
+
+	data = talloc_array(q->msgs, uint8_t, max_packet_size * max);
+	if (!data) goto error;
+
+	for (i = 0; i < max; i++) {
+		q->msgs[i].data = data + (i * max_packet_size);
+		q->msgs[i].data_size = max_packet_size;
+	}
+
+	return q;
+}
+
+/** Queue a datagram for writing
+ *
+ * The datagram is copied, so the caller can free or re-use the buffer
+ * immediately.  If the queue is full, the queued datagrams are written
+ * first.
+ *
+ * Datagrams which are too large for the queue are written immediately
+ * with udp_send(), after any datagrams which are already queued.
+ *
+ * @param[in] q		to add the datagram to.
+ * @param[in] socket	src/dst address of the datagram.  These should already
+ *			have been swapped.
+ * @param[in] data	of the datagram.
+ * @param[in] data_len	of the datagram.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.  errno is EWOULDBLOCK if the datagram could not be
+ *	  queued because earlier datagrams are still waiting for the socket
+ *	  to become writable.
+ */
+int udp_mmsg_queue_add(udp_mmsg_queue_t *q, fr_socket_t const *socket, uint8_t const *data, size_t data_len)
+{
+	udp_mmsg_t	*msg;
+
+	if (q->num == q->max) (void) udp_mmsg_queue_flush(q);
+
+	/*
+	 *	Oversized datagrams are written directly.  Flush the
+	 *	queue first, so that the datagrams are written in order.
+	 */
+	if (data_len > q->msgs[0].data_size) {
+		if (q->num > 0) (void) udp_mmsg_queue_flush(q);
+
+		if (q->num > 0) {
+			errno = EWOULDBLOCK;
+			return -1;
+		}
+
+		if (udp_send(socket, UDP_FLAGS_NONE, UNCONST(uint8_t *, data), data_len) < 0) return -1;
+
+		q->packets++;
+		return 0;
+	}
+
+	/*
+	 *	The kernel didn't take everything last time.  Tell the
+	 *	caller to try again once the socket is writable.
+	 */
+	if (q->num == q->max) {
+		errno = EWOULDBLOCK;
+		return -1;
+	}
+
+	msg = &q->msgs[q->num];
+	memcpy(msg->data, data, data_len);
+	msg->data_len = data_len;
+	msg->socket = *socket;
+
+	q->num++;
+
+	return 0;
+}
+
+/** Write all queued datagrams
+ *
+ * If the socket would block, the datagrams which have not been written
+ * stay queued, and the caller should try again once the socket is
+ * writable.  Datagrams which the kernel refuses for any other reason
+ * are dropped, as the caller has already been told that they were
+ * written.  They are counted in q->dropped.
+ *
+ * @param[in] q		to write.
+ * @return
+ *	- 0 if the queue is now empty.
+ *	- 1 if datagrams are still queued, because the socket would block.
+ */
+int udp_mmsg_queue_flush(udp_mmsg_queue_t *q)
+{
+	unsigned int	done = 0, i;
+
+	while (done < q->num) {
+		int ret;
+
+		ret = udp_send_mmsg(q->sockfd, &q->msgs[done], q->num - done);
+		if (ret < 0) {
+			/*
+			 *	The socket buffer is full.  Nothing
+			 *	else is going to get written.
+			 */
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) break;
+
+			/*
+			 *	Something's wrong with the first
+			 *	datagram.  Skip it, and try the rest.
+			 */
+			q->dropped++;
+			done++;
+			continue;
+		}
+
+		/*
+		 *	Shouldn't happen, but don't spin.
+		 */
+		if (ret == 0) break;
+
+		q->packets += ret;
+		q->syscalls_saved += ret - 1;
+		done += ret;
+	}
+
+	if (done == 0) return (q->num > 0);
+
+	/*
+	 *	Move the datagrams which weren't written to the front
+	 *	of the queue.  The entries are swapped, so that each
+	 *	buffer is still owned by exactly one entry.
+	 */
+	for (i = done; i < q->num; i++) {
+		udp_mmsg_t tmp = q->msgs[i - done];
+
+		q->msgs[i - done] = q->msgs[i];
+		q->msgs[i] = tmp;
+	}
+	q->num -= done;
+
+	return (q->num > 0);
+}
+
+/** Get the queue statistics which have changed since the last call
+ *
+ * @param[in] q			to get the statistics for.
+ * @param[out] syscalls_saved	number of system calls which have been avoided
+ *				by coalescing datagrams.
+ * @param[out] dropped		number of datagrams which the kernel refused.
+ */
+void udp_mmsg_queue_stats(udp_mmsg_queue_t *q, uint64_t *syscalls_saved, uint64_t *dropped)
+{
+	*syscalls_saved = q->syscalls_saved - q->syscalls_reported;
+	q->syscalls_reported = q->syscalls_saved;
+
+	*dropped = q->dropped - q->dropped_reported;
+	q->dropped_reported = q->dropped;
+}
+
+/** Steer packets from a source IP address to the same socket in a SO_REUSEPORT group
+ *
+ * By default, the kernel picks a socket in a SO_REUSEPORT group by
+ * hashing the source IP / port.  Clients which send from many ports
+ * are then spread over all of the sockets.  This function attaches a
+ * classic BPF program to the group, which hashes only the source IP
+ * address.  Every packet from a particular client then arrives on the
+ * same socket.
+ *
+ * The program returns the index of the socket in the group, which is
+ * the order in which the sockets were bound.  If there are fewer
+ * sockets than shards, the kernel falls back to its default hash.
+ *
+ * @param[in] sockfd	any socket in the SO_REUSEPORT group.
+ * @param[in] af	address family of the socket.
+ * @param[in] shards	number of sockets in the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error, or if the platform doesn't support it.
+ */
+int udp_shard_by_src_ipaddr(int sockfd, int af, uint32_t shards)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	struct sock_fprog	fprog;
+	struct sock_filter	code[] = {
+		/*
+		 *	A = the source IP address, or the low 32 bits
+		 *	of it for IPv6.  Offsets are relative to the
+		 *	start of the IP header.
+		 */
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + ((af == AF_INET6) ? 20 : 12)),
+
+		/*
+		 *	A = (A >> 16) ^ A, so that the high bits
+		 *	matter, too.
+		 */
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+
+		/*
+		 *	return A % shards
+		 */
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shards),
+		BPF_STMT(BPF_RET | BPF_A, 0)
+	};
+
+	if (!shards) {
+		fr_strerror_const("Number of shards must be greater than zero");
+		return -1;
+	}
+
+	fprog.len = NUM_ELEMENTS(code);
+	fprog.filter = code;
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport filter: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+#else
+	UNUSED_VAR(sockfd);
+	UNUSED_VAR(af);
+	UNUSED_VAR(shards);
+
+	fr_strerror_const("Steering packets by source IP address is not supported on this platform");
+	return -1;
+#endif
+}
@@ -31,6 +31,7 @@ extern "C" {
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/inet.h>
 #include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/udpfromto.h>
 
@@ -38,6 +39,45 @@ extern "C" {
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+/** Maximum number of datagrams which can be read with one call to udp_recv_mmsg()
+ *
+ */
+#define UDP_RECV_MMSG_MAX	(64)
+
+/** Maximum number of datagrams which can be written with one call to udp_send_mmsg()
+ *
+ */
+#define UDP_SEND_MMSG_MAX	(64)
+
+/** A datagram read by udp_recv_mmsg()
+ *
+ */
+typedef struct {
+	uint8_t			*data;		//!< Buffer to read the datagram into.  Set by the caller.
+	size_t			data_size;	//!< Size of the buffer.  Set by the caller.
+
+	size_t			data_len;	//!< Length of the datagram which was read.
+	fr_socket_t		socket;		//!< src/dst address of the datagram, and the interface
+						///< it was received on.
+	fr_time_t		when;		//!< When the datagram was received.
+} udp_mmsg_t;
+
+/** Datagrams queued for writing with as few system calls as possible
+ *
+ */
+typedef struct {
+	int			sockfd;		//!< we're writing to.
+	udp_mmsg_t		*msgs;		//!< queued datagrams.  Each one has its own buffer.
+	unsigned int		num;		//!< number of datagrams which are queued.
+	unsigned int		max;		//!< maximum number of datagrams which can be queued.
+
+	uint64_t		packets;	//!< number of datagrams which have been written.
+	uint64_t		dropped;	//!< number of datagrams which the kernel refused.
+	uint64_t		syscalls_saved;	//!< number of system calls avoided by coalescing.
+	uint64_t		syscalls_reported; //!< syscalls_saved as of the last call to udp_mmsg_queue_stats().
+	uint64_t		dropped_reported; //!< dropped as of the last call to udp_mmsg_queue_stats().
+} udp_mmsg_queue_t;
+
 int udp_send(fr_socket_t const *socket, int flags, void *data, size_t data_len);
 
 int udp_recv_discard(int sockfd);
@@ -47,6 +87,20 @@ ssize_t udp_recv_peek(int sockfd, void *data, size_t data_len, int flags, fr_ipa
 ssize_t udp_recv(int sockfd, int flags,
 		 fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
 
+int udp_recv_mmsg(int sockfd, int flags, udp_mmsg_t *msgs, unsigned int num);
+
+int udp_send_mmsg(int sockfd, udp_mmsg_t const *msgs, unsigned int num);
+
+udp_mmsg_queue_t *udp_mmsg_queue_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int max, size_t max_packet_size);
+
+int udp_mmsg_queue_add(udp_mmsg_queue_t *q, fr_socket_t const *socket, uint8_t const *data, size_t data_len);
+
+int udp_mmsg_queue_flush(udp_mmsg_queue_t *q);
+
+void udp_mmsg_queue_stats(udp_mmsg_queue_t *q, uint64_t *syscalls_saved, uint64_t *dropped);
+
+int udp_shard_by_src_ipaddr(int sockfd, int af, uint32_t shards);
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,6 +25,7 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/udpfromto.h>
 
 #ifdef HAVE_SYS_UIO_H
@@ -89,6 +90,36 @@ RCSID("$Id$")
 #  endif
 #endif
 
+#ifndef HAVE_RECVMMSG
+/** Emulates the real recvmmsg in userland
+ *
+ * As with the sendmmsg emulation in missing.c, this doesn't save any
+ * system calls, but it means callers can batch reads without ifdefs.
+ *
+ * After the first datagram, the remaining reads are non-blocking, so
+ * we return as soon as the socket has been drained.
+ */
+static int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, UNUSED struct timespec *timeout)
+{
+	unsigned int i;
+
+	for (i = 0; i < vlen; i++) {
+		ssize_t slen;
+
+		slen = recvmsg(sockfd, &msgvec[i].msg_hdr, (i == 0) ? flags : (flags | MSG_DONTWAIT));
+		if (slen < 0) {
+			msgvec[i].msg_len = 0;
+
+			if (i == 0) return -1;
+			return i;
+		}
+		msgvec[i].msg_len = (unsigned int)slen;	/* Number of bytes received */
+	}
+
+	return i;
+}
+#endif
+
 int udpfromto_init(int s, int af)
 {
 	int proto = 0, flag = 0, opt = 1;
@@ -161,6 +192,149 @@ int udpfromto_init(int s, int af)
 	return setsockopt(s, proto, flag, &opt, sizeof(opt));
 }
 
+/** Initialise the destination address from the address the socket is bound to
+ *
+ * recvmsg doesn't provide the destination port, so we take that (and
+ * the address family) from getsockname().  The address may be
+ * INADDR_ANY, in which case a more specific address is filled in
+ * from the control messages returned by recvmsg().
+ *
+ * @param[in] si	The address the socket is bound to.
+ * @param[out] to	Where to write the destination address.
+ * @param[in,out] to_len	Length of the structure pointed to by to.
+ * @return
+ *	- 1 if the platform can't retrieve the destination address, and recvfrom() should be used.
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int recvfromto_dst_init(struct sockaddr_storage const *si, struct sockaddr *to, socklen_t *to_len)
+{
+	if (si->ss_family == AF_INET) {
+#if !defined(IP_PKTINFO) && !defined(IP_RECVDSTADDR)
+		return 1;
+#else
+		struct sockaddr_in *dst = (struct sockaddr_in *) to;
+		struct sockaddr_in const *src = (struct sockaddr_in const *) si;		//-V641
+
+		if (*to_len < sizeof(*dst)) {
+			errno = EINVAL;
+			return -1;
+		}
+		*to_len = sizeof(*dst);
+		*dst = *src;
+		return 0;
+#endif
+	}
+
+#ifdef AF_INET6
+	if (si->ss_family == AF_INET6) {
+#if !defined(IPV6_PKTINFO)
+		return 1;
+#else
+		struct sockaddr_in6 *dst = (struct sockaddr_in6 *) to;
+		struct sockaddr_in6 const *src = (struct sockaddr_in6 const *) si;		//-V641
+
+		if (*to_len < sizeof(*dst)) {
+			errno = EINVAL;
+			return -1;
+		}
+		*to_len = sizeof(*dst);
+		*dst = *src;
+		return 0;
+#endif
+	}
+#endif
+
+	/*
+	 *	Unknown address family.
+	 */
+	errno = EINVAL;
+	return -1;
+}
+
+/** Process the auxiliary data returned by recvmsg()
+ *
+ * @param[in] msgh	As populated by recvmsg().
+ * @param[out] ifindex	The interface which received the datagram (may be NULL).
+ * @param[out] to	Where to write the destination address.
+ * @param[out] to_len	Length of the structure pointed to by to.
+ * @param[out] when	the packet was received (may be NULL).
+ */
+static void recvfromto_cmsg(struct msghdr *msgh, int *ifindex,
+			    struct sockaddr *to, socklen_t *to_len, fr_time_t *when)
+{
+	struct cmsghdr		*cmsg;
+
+	if (ifindex) *ifindex = 0;
+	if (when) *when = fr_time_wrap(0);
+
+/*
+ *	Needed for emscripten, seems to be an issue in CMSG_NXTHDR
+ */
+DIAG_OFF(sign-compare)
+	/* Process auxiliary received data in msgh */
+	for (cmsg = CMSG_FIRSTHDR(msgh);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+DIAG_ON(sign-compare)
+
+#ifdef IP_PKTINFO
+		if ((cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == IP_PKTINFO)) {
+			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
+			*to_len = sizeof(struct sockaddr_in);
+
+			if (ifindex) *ifindex = i->ipi_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef IP_RECVDSTADDR
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = *i;
+
+			*to_len = sizeof(struct sockaddr_in);
+
+			break;
+		}
+#endif
+
+#ifdef IPV6_PKTINFO
+		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
+			*to_len = sizeof(struct sockaddr_in6);
+
+			if (ifindex) *ifindex = i->ipi6_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef SO_TIMESTAMP
+		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
+			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
+		}
+#endif
+
+#ifdef SO_TIMESTAMPNS
+		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMPNS)) {
+			*when = fr_time_from_timespec((struct timespec *)CMSG_DATA(cmsg));
+		}
+#endif
+	}
+
+	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = fr_time();
+}
+
 /** Read a packet from a file descriptor, retrieving additional header information
  *
  * Abstracts away the complexity of using the complexity of using recvmsg().
@@ -195,7 +369,6 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	       fr_time_t *when)
 {
 	struct msghdr		msgh;
-	struct cmsghdr		*cmsg;
 	struct iovec		iov;
 	char			cbuf[256];
 	int			ret;
@@ -214,6 +387,7 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	 *	Catch the case where the caller passes invalid arguments.
 	 */
 	if (!to || !to_len) {
+	do_recvfrom:
 		if (when) *when = fr_time();
 		return recvfrom(fd, buf, len, flags, from, from_len);
 	}
@@ -238,46 +412,9 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	 *	Initialize the 'to' address.  It may be INADDR_ANY here,
 	 *	with a more specific address given by recvmsg(), below.
 	 */
-	if (si.ss_family == AF_INET) {
-#if !defined(IP_PKTINFO) && !defined(IP_RECVDSTADDR)
-		return recvfrom(fd, buf, len, flags, from, from_len);
-#else
-		struct sockaddr_in *dst = (struct sockaddr_in *) to;
-		struct sockaddr_in *src = (struct sockaddr_in *) &si;		//-V641
-
-		if (*to_len < sizeof(*dst)) {
-			errno = EINVAL;
-			return -1;
-		}
-		*to_len = sizeof(*dst);
-		*dst = *src;
-#endif
-	}
-
-#ifdef AF_INET6
-	else if (si.ss_family == AF_INET6) {
-#if !defined(IPV6_PKTINFO)
-		return recvfrom(fd, buf, len, flags, from, from_len);
-#else
-		struct sockaddr_in6 *dst = (struct sockaddr_in6 *) to;
-		struct sockaddr_in6 *src = (struct sockaddr_in6 *) &si;		//-V641
-
-		if (*to_len < sizeof(*dst)) {
-			errno = EINVAL;
-			return -1;
-		}
-		*to_len = sizeof(*dst);
-		*dst = *src;
-#endif
-	}
-#endif
-	/*
-	 *	Unknown address family.
-	 */
-	else {
-		errno = EINVAL;
-		return -1;
-	}
+	ret = recvfromto_dst_init(&si, to, to_len);
+	if (ret < 0) return -1;
+	if (ret > 0) goto do_recvfrom;
 
 	/* Set up iov and msgh structures. */
 	memset(&cbuf, 0, sizeof(cbuf));
@@ -298,86 +435,89 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 
 	if (from_len) *from_len = msgh.msg_namelen;
 
-	if (ifindex) *ifindex = 0;
-	if (when) *when = fr_time_wrap(0);
-
-/*
- *	Needed for emscripten, seems to be an issue in CMSG_NXTHDR
- */
-DIAG_OFF(sign-compare)
-	/* Process auxiliary received data in msgh */
-	for (cmsg = CMSG_FIRSTHDR(&msgh);
-	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
-DIAG_ON(sign-compare)
-
-#ifdef IP_PKTINFO
-		if ((cmsg->cmsg_level == SOL_IP) &&
-		    (cmsg->cmsg_type == IP_PKTINFO)) {
-			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
-
-			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
-			*to_len = sizeof(struct sockaddr_in);
-
-			if (ifindex) *ifindex = i->ipi_ifindex;
-
-			break;
-		}
-#endif
-
-#ifdef IP_RECVDSTADDR
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
-			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+	recvfromto_cmsg(&msgh, ifindex, to, to_len, when);
 
-			((struct sockaddr_in *)to)->sin_addr = *i;
+	return ret;
+}
 
-			*to_len = sizeof(struct sockaddr_in);
+/** Read multiple packets from a file descriptor, retrieving additional header information
+ *
+ * The batched equivalent of recvfromto().  All of the datagrams which are
+ * waiting on the socket (up to vlen) are read with a single call to recvmmsg().
+ *
+ * The caller MUST initialise msg_name, msg_namelen, msg_iov, msg_iovlen,
+ * msg_control and msg_controllen for each entry in msgvec.  The output
+ * arrays MUST have at least vlen entries.
+ *
+ * @param[in] fd	The file descriptor to read from.
+ * @param[in,out] msgvec	The message headers to read datagrams into.
+ * @param[in] vlen	Number of entries in msgvec.
+ * @param[in] flags	passed unmolested to recvmmsg.
+ * @param[out] ifindex	The interface which received each datagram (may be NULL).
+ * @param[out] to	Where to write the destination address of each datagram.
+ * @param[out] to_len	Length of each destination address.
+ * @param[out] when	When each datagram was received (may be NULL).
+ * @return
+ *	- >= 0 the number of datagrams which were read.
+ *	- -1 on failure.
+ */
+int recvmmsgfromto(int fd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+		   int *ifindex,
+		   struct sockaddr_storage *to, socklen_t *to_len,
+		   fr_time_t *when)
+{
+	struct sockaddr_storage	si;
+	socklen_t		si_len = sizeof(si);
+	unsigned int		i;
+	int			ret;
 
-			break;
-		}
+#ifdef STATIC_ANALYZER
+	memset(&si, 0, sizeof(si));
 #endif
 
-#ifdef IPV6_PKTINFO
-		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
-		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
-			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+	if (getsockname(fd, (struct sockaddr *)&si, &si_len) < 0) {
+		return -1;
+	}
 
-			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
-			*to_len = sizeof(struct sockaddr_in6);
+	ret = recvmmsg(fd, msgvec, vlen, flags, NULL);
+	if (ret <= 0) return ret;
 
-			if (ifindex) *ifindex = i->ipi6_ifindex;
+	for (i = 0; i < (unsigned int) ret; i++) {
+		int rcode;
 
-			break;
-		}
-#endif
+		to_len[i] = sizeof(to[i]);
+		rcode = recvfromto_dst_init(&si, (struct sockaddr *) &to[i], &to_len[i]);
+		if (rcode < 0) return -1;
 
-#ifdef SO_TIMESTAMP
-		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
-			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
+		/*
+		 *	No way of getting the destination address.
+		 *	Use the address we're bound to.
+		 */
+		if (rcode > 0) {
+			memcpy(&to[i], &si, si_len);
+			to_len[i] = si_len;
+			if (ifindex) ifindex[i] = 0;
+			if (when) when[i] = fr_time();
+			continue;
 		}
-#endif
 
-#ifdef SO_TIMESTAMPNS
-		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMPNS)) {
-			*when = fr_time_from_timespec((struct timespec *)CMSG_DATA(cmsg));
-		}
-#endif
+		recvfromto_cmsg(&msgvec[i].msg_hdr, ifindex ? &ifindex[i] : NULL,
+				(struct sockaddr *) &to[i], &to_len[i], when ? &when[i] : NULL);
 	}
 
-	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = fr_time();
-
 	return ret;
 }
 
-/** Send packet via a file descriptor, setting the src address and outbound interface
+/** Initialise a msghdr for sending a datagram, setting the src address and outbound interface
  *
- * Abstracts away the complexity of using the complexity of using sendmsg().
+ * If no control messages are needed (there's no src address, or it's a
+ * wildcard address), msg_control is left as NULL, and the caller can
+ * use sendto() instead.
  *
- * @param[in] fd	The file descriptor to write to.
- * @param[in] buf	Where to read datagram data from.
- * @param[in] len	of datagram data.
- * @param[in] flags	passed unmolested to sendmsg.
+ * @param[in] fd	The file descriptor which will be written to.
+ * @param[out] msgh	to initialise.  The caller sets msg_iov and msg_iovlen.
+ * @param[in] cbuf	Buffer for the control messages.
+ * @param[in] cbuf_len	Length of cbuf.
  * @param[in] ifindex	The interface on which to send the datagram.
  *			If automatic interface selection is desired, value should be 0.
  * @param[in] from	The source address.
@@ -388,14 +528,14 @@ DIAG_ON(sign-compare)
  *	- 0 on success.
  *	- -1 on failure.
  */
-int sendfromto(int fd, void *buf, size_t len, int flags,
-	       int ifindex,
-	       struct sockaddr *from, socklen_t from_len,
-	       struct sockaddr *to, socklen_t to_len)
+int sendfromto_msghdr(int fd, struct msghdr *msgh, void *cbuf, size_t cbuf_len,
+		      int ifindex,
+		      struct sockaddr *from, socklen_t from_len,
+		      struct sockaddr *to, socklen_t to_len)
 {
-	struct msghdr	msgh;
-	struct iovec	iov;
-	char		cbuf[256];
+	memset(msgh, 0, sizeof(*msgh));
+	msgh->msg_name = to;
+	msgh->msg_namelen = to_len;
 
 	/*
 	 *	Unknown address family, die.
@@ -434,6 +574,8 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 		break;
 	}
 	}
+#else
+	UNUSED_VAR(fd);
 #endif	/* !__FreeBSD__ */
 
 	/*
@@ -452,7 +594,7 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 
 	/*
 	 *	No "from" or "from" is 0.0.0.0 or ::/0, and there's no
-	 *	interface binding, just use regular sendto.
+	 *	interface binding, so no control messages are needed.
 	 */
 	if (!from || (from_len == 0) ||
 		((ifindex == 0) &&
@@ -460,20 +602,10 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 			(((struct sockaddr_in *) from)->sin_addr.s_addr == INADDR_ANY)) ||
 		(from->sa_family == AF_INET6 &&
 			IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *) from)->sin6_addr))))) {
-		return sendto(fd, buf, len, flags, to, to_len);
+		return 0;
 	}
 
-	/* Set up control buffer iov and msgh structures. */
-	memset(&cbuf, 0, sizeof(cbuf));
-	memset(&msgh, 0, sizeof(msgh));
-	memset(&iov, 0, sizeof(iov));
-	iov.iov_base = buf;
-	iov.iov_len = len;
-
-	msgh.msg_iov = &iov;
-	msgh.msg_iovlen = 1;
-	msgh.msg_name = to;
-	msgh.msg_namelen = to_len;
+	memset(cbuf, 0, cbuf_len);
 
 # if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
 	if (from->sa_family == AF_INET) {
@@ -483,10 +615,12 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 		struct cmsghdr *cmsg;
 		struct in_pktinfo *pkt;
 
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
+		fr_assert(cbuf_len >= CMSG_SPACE(sizeof(*pkt)));
 
-		cmsg = CMSG_FIRSTHDR(&msgh);
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
+
+		cmsg = CMSG_FIRSTHDR(msgh);
 		cmsg->cmsg_level = SOL_IP;
 		cmsg->cmsg_type = IP_PKTINFO;
 		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
@@ -500,10 +634,12 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 		struct cmsghdr *cmsg;
 		struct in_addr *in;
 
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*in));
+		fr_assert(cbuf_len >= CMSG_SPACE(sizeof(*in)));
+
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*in));
 
-		cmsg = CMSG_FIRSTHDR(&msgh);
+		cmsg = CMSG_FIRSTHDR(msgh);
 		cmsg->cmsg_level = IPPROTO_IP;
 		cmsg->cmsg_type = IP_SENDSRCADDR;
 		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
@@ -521,10 +657,12 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 		struct cmsghdr *cmsg;
 		struct in6_pktinfo *pkt;
 
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
+		fr_assert(cbuf_len >= CMSG_SPACE(sizeof(*pkt)));
 
-		cmsg = CMSG_FIRSTHDR(&msgh);
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
+
+		cmsg = CMSG_FIRSTHDR(msgh);
 		cmsg->cmsg_level = IPPROTO_IPV6;
 		cmsg->cmsg_type = IPV6_PKTINFO;
 		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
@@ -536,6 +674,50 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 	}
 #  endif	/* IPV6_PKTINFO */
 
+	return 0;
+}
+
+/** Send packet via a file descriptor, setting the src address and outbound interface
+ *
+ * Abstracts away the complexity of using the complexity of using sendmsg().
+ *
+ * @param[in] fd	The file descriptor to write to.
+ * @param[in] buf	Where to read datagram data from.
+ * @param[in] len	of datagram data.
+ * @param[in] flags	passed unmolested to sendmsg.
+ * @param[in] ifindex	The interface on which to send the datagram.
+ *			If automatic interface selection is desired, value should be 0.
+ * @param[in] from	The source address.
+ * @param[in] from_len	Length of the structure pointed to by from.
+ * @param[in] to	The destination address.
+ * @param[in] to_len	Length of the structure pointed to by to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int sendfromto(int fd, void *buf, size_t len, int flags,
+	       int ifindex,
+	       struct sockaddr *from, socklen_t from_len,
+	       struct sockaddr *to, socklen_t to_len)
+{
+	struct msghdr	msgh;
+	struct iovec	iov;
+	char		cbuf[256];
+
+	if (sendfromto_msghdr(fd, &msgh, cbuf, sizeof(cbuf), ifindex, from, from_len, to, to_len) < 0) return -1;
+
+	/*
+	 *	No control messages, just use regular sendto.
+	 */
+	if (!msgh.msg_control) return sendto(fd, buf, len, flags, to, to_len);
+
+	memset(&iov, 0, sizeof(iov));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	msgh.msg_iov = &iov;
+	msgh.msg_iovlen = 1;
+
 	return sendmsg(fd, &msgh, flags);
 }
 
@@ -45,6 +45,16 @@ int	recvfromto(int s, void *buf, size_t len, int flags,
 		   struct sockaddr *to, socklen_t *tolen,
 		   fr_time_t *when);
 
+int	recvmmsgfromto(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+		       int *ifindex,
+		       struct sockaddr_storage *to, socklen_t *to_len,
+		       fr_time_t *when);
+
+int	sendfromto_msghdr(int s, struct msghdr *msgh, void *cbuf, size_t cbuf_len,
+			  int ifindex,
+			  struct sockaddr *from, socklen_t fromlen,
+			  struct sockaddr *to, socklen_t tolen);
+
 int	sendfromto(int s, void *buf, size_t len, int flags,
 		   int ifindex,
 		   struct sockaddr *from, socklen_t fromlen,
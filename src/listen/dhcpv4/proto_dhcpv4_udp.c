@@ -43,6 +43,8 @@ typedef struct {
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
 	fr_stats_t			stats;			//!< statistics for this socket
+
+	udp_mmsg_queue_t		*send_queue;		//!< replies waiting to be written with sendmmsg()
 }  proto_dhcpv4_udp_thread_t;
 
 typedef struct {
@@ -58,6 +60,8 @@ typedef struct {
 	uint32_t			recv_buff;		//!< How big the kernel's receive buffer should be.
 
 	uint32_t			max_packet_size;	//!< for message ring buffer.
+	uint32_t			max_send_coalesce;	//!< Maximum number of replies to write with one
+								///< sendmmsg() call.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
 	uint16_t			port;			//!< Port to listen on.
@@ -104,6 +108,7 @@ static const conf_parser_t udp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("max_packet_size", proto_dhcpv4_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", proto_dhcpv4_udp_t, max_attributes), .dflt = STRINGIFY(DHCPV4_MAX_ATTRIBUTES) } ,
+	{ FR_CONF_OFFSET("max_send_coalesce", proto_dhcpv4_udp_t, max_send_coalesce), .dflt = "1" } ,
 
 	CONF_PARSER_TERMINATOR
 };
@@ -464,6 +469,16 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 		      fr_box_ipaddr(socket.inet.dst_ipaddr), socket.inet.dst_port);
 	}
 
+	/*
+	 *	Queue the reply, and let mod_flush() write all of the
+	 *	queued replies with one system call.
+	 */
+	if (thread->send_queue && !thread->connection) {
+		if (udp_mmsg_queue_add(thread->send_queue, &socket, buffer, buffer_len) < 0) return -1;
+
+		return buffer_len;
+	}
+
 	/*
 	 *	proto_dhcpv4 takes care of suppressing do-not-respond, etc.
 	 */
@@ -477,6 +492,22 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	return data_size;
 }
 
+/** Write any replies which mod_write() queued
+ *
+ */
+static int mod_flush(fr_listen_t *li, fr_io_flush_stats_t *stats)
+{
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+	int				ret;
+
+	if (!thread->send_queue) return 0;
+
+	ret = udp_mmsg_queue_flush(thread->send_queue);
+	udp_mmsg_queue_stats(thread->send_queue, &stats->syscalls_saved, &stats->dropped);
+
+	return ret;
+}
+
 
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
@@ -562,6 +593,10 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	if (inst->max_send_coalesce > 1) {
+		MEM(thread->send_queue = udp_mmsg_queue_alloc(thread, sockfd, inst->max_send_coalesce, inst->max_packet_size));
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dhcpv4_udp,
@@ -718,6 +753,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, MIN_PACKET_SIZE);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("max_send_coalesce", inst->max_send_coalesce, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_send_coalesce", inst->max_send_coalesce, <=, UDP_SEND_MMSG_MAX);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -832,6 +870,7 @@ fr_app_io_t proto_dhcpv4_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
@@ -43,6 +43,8 @@ typedef struct {
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
 	fr_stats_t			stats;			//!< statistics for this socket
+
+	udp_mmsg_queue_t		*send_queue;		//!< replies waiting to be written with sendmmsg()
 }  proto_dns_udp_thread_t;
 
 typedef struct {
@@ -55,8 +57,14 @@ typedef struct {
 	uint32_t			recv_buff;		//!< How big the kernel's receive buffer should be.
 
 	uint32_t			max_packet_size;	//!< for message ring buffer.
+	uint32_t			max_send_coalesce;	//!< Maximum number of replies to write with one
+								///< sendmmsg() call.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			shards;			//!< Number of SO_REUSEPORT sockets to open, each
+								///< of which is serviced by its own network thread.
+	bool				shard_by_src_ipaddr;	//!< Send all packets from a client to the same shard.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a receive
@@ -93,6 +101,10 @@ static const conf_parser_t udp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("max_packet_size", proto_dns_udp_t, max_packet_size), .dflt = "576" } ,
 	{ FR_CONF_OFFSET("max_attributes", proto_dns_udp_t, max_attributes), .dflt = STRINGIFY(DNS_MAX_ATTRIBUTES) } ,
+	{ FR_CONF_OFFSET("max_send_coalesce", proto_dns_udp_t, max_send_coalesce), .dflt = "1" } ,
+
+	{ FR_CONF_OFFSET("shards", proto_dns_udp_t, shards), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("shard_by_src_ipaddr", proto_dns_udp_t, shard_by_src_ipaddr), .dflt = "no" } ,
 
 	CONF_PARSER_TERMINATOR
 };
@@ -219,6 +231,16 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 		// @todo - figure out where to send the packet
 	}
 
+	/*
+	 *	Queue the reply, and let mod_flush() write all of the
+	 *	queued replies with one system call.
+	 */
+	if (thread->send_queue && !thread->connection) {
+		if (udp_mmsg_queue_add(thread->send_queue, &socket, buffer, buffer_len) < 0) return -1;
+
+		return buffer_len;
+	}
+
 	/*
 	 *	proto_dns takes care of suppressing do-not-respond, etc.
 	 */
@@ -232,6 +254,22 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	return data_size;
 }
 
+/** Write any replies which mod_write() queued
+ *
+ */
+static int mod_flush(fr_listen_t *li, fr_io_flush_stats_t *stats)
+{
+	proto_dns_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dns_udp_thread_t);
+	int			ret;
+
+	if (!thread->send_queue) return 0;
+
+	ret = udp_mmsg_queue_flush(thread->send_queue);
+	udp_mmsg_queue_stats(thread->send_queue, &stats->syscalls_saved, &stats->dropped);
+
+	return ret;
+}
+
 
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
@@ -301,6 +339,29 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	if (inst->max_send_coalesce > 1) {
+		MEM(thread->send_queue = udp_mmsg_queue_alloc(thread, sockfd, inst->max_send_coalesce, inst->max_packet_size));
+	}
+
+	/*
+	 *	Ask the master IO handler to open more sockets on the
+	 *	same address / port.  The kernel then spreads the
+	 *	packets across them.
+	 */
+	li->num_shards = inst->shards;
+
+	/*
+	 *	The filter applies to the whole SO_REUSEPORT group, so
+	 *	it only needs to be attached once.
+	 */
+	if ((inst->shards > 1) && inst->shard_by_src_ipaddr && (li->shard == 0)) {
+		if (udp_shard_by_src_ipaddr(sockfd, ipaddr.af, inst->shards) < 0) {
+			PERROR("Failed setting 'shard_by_src_ipaddr'");
+			close(sockfd);
+			goto error;
+		}
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dns_udp,
@@ -378,6 +439,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 64);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("max_send_coalesce", inst->max_send_coalesce, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_send_coalesce", inst->max_send_coalesce, <=, UDP_SEND_MMSG_MAX);
+
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, <=, 64);
+
 	/*
 	 *	Parse and create the trie for dynamic clients, even if
 	 *	there's no dynamic clients.
@@ -458,6 +525,7 @@ fr_app_io_t proto_dns_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
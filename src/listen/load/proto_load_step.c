@@ -51,21 +51,38 @@ typedef struct {
 	fr_load_config_t		load;			//!< load configuration
 	fr_stats_t			stats;			//!< statistics for this socket
 
+	uint32_t			shard;			//!< which of the listeners this is
+	uint32_t			next_template;		//!< template for the next packet
+
 	int				fd;			//!< for CSV files
 	fr_event_timer_t const		*ev;			//!< for writing statistics
 
 	fr_listen_t			*parent;		//!< master IO handler
 } proto_load_step_thread_t;
 
+/** One packet which the load generator sends
+ *
+ */
+typedef struct {
+	char const			*filename;		//!< which the packet was read from
+	fr_pair_list_t			pair_list;		//!< for input packet
+	int				code;
+} proto_load_step_template_t;
+
+typedef enum {
+	PROTO_LOAD_STEP_REPORT_CSV = 0,
+	PROTO_LOAD_STEP_REPORT_JSON
+} proto_load_step_report_t;
+
 struct proto_load_step_s {
 	proto_load_t			*parent;
 
 	CONF_SECTION			*cs;			//!< our configuration
 
-	char const     			*filename;		//!< where to read input packet from
-	fr_pair_list_t			pair_list;		//!< for input packet
+	char const     			**filename;		//!< where to read input packets from
+	proto_load_step_template_t	*templates;		//!< one for each filename, sent in turn
+	uint32_t			num_templates;
 
-	int				code;
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes
 
 	fr_client_t			*client;		//!< static client
@@ -73,12 +90,23 @@ struct proto_load_step_s {
 	fr_load_config_t		load;			//!< load configuration
 	bool				repeat;			//!, do we repeat the load generation
 	char const     			*csv;			//!< where to write CSV stats
+	proto_load_step_report_t	report;			//!< format of the stats file
+
+	uint32_t			shards;			//!< number of listeners, each on its own network thread
+};
+
+static fr_table_num_sorted_t const report_table[] = {
+	{ L("csv"),	PROTO_LOAD_STEP_REPORT_CSV	},
+	{ L("json"),	PROTO_LOAD_STEP_REPORT_JSON	}
 };
+static size_t report_table_len = NUM_ELEMENTS(report_table);
 
 
 static const conf_parser_t load_listen_config[] = {
-	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_FILE_INPUT | CONF_FLAG_REQUIRED | CONF_FLAG_NOT_EMPTY, proto_load_step_t, filename) },
+	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_FILE_INPUT | CONF_FLAG_REQUIRED | CONF_FLAG_NOT_EMPTY | CONF_FLAG_MULTI, proto_load_step_t, filename) },
 	{ FR_CONF_OFFSET("csv", proto_load_step_t, csv) },
+	{ FR_CONF_OFFSET("report", proto_load_step_t, report), .dflt = "csv",
+	  .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = report_table, .len = &report_table_len } },
 
 	{ FR_CONF_OFFSET("max_attributes", proto_load_step_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
@@ -90,6 +118,11 @@ static const conf_parser_t load_listen_config[] = {
 	{ FR_CONF_OFFSET("parallel", proto_load_step_t, load.parallel) },
 	{ FR_CONF_OFFSET("repeat", proto_load_step_t, repeat) },
 
+	{ FR_CONF_OFFSET("open_loop", proto_load_step_t, load.open_loop) },
+	{ FR_CONF_OFFSET("arrival", proto_load_step_t, load.arrival), .dflt = "constant",
+	  .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = fr_load_arrival_table, .len = &fr_load_arrival_table_len } },
+	{ FR_CONF_OFFSET("shards", proto_load_step_t, shards), .dflt = "1" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -136,12 +169,16 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 
 	*recv_time_p = thread->recv_time;
 
-	if (buffer_len < 1) {
+	if (buffer_len < sizeof(uint32_t)) {
 		DEBUG2("proto_load_step read buffer is too small for input packet");
 		return 0;
 	}
 
-	buffer[0] = 0;
+	/*
+	 *	The "packet" is just which template to send.
+	 */
+	memcpy(buffer, &thread->next_template, sizeof(thread->next_template));
+	if (++thread->next_template == inst->num_templates) thread->next_template = 0;
 
 	/*
 	 *	Print out what we received.
@@ -149,7 +186,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	DEBUG2("proto_load_step - reading packet for %s",
 	       thread->name);
 
-	return 1;
+	return sizeof(uint32_t);
 }
 
 
@@ -199,7 +236,21 @@ static int mod_open(fr_listen_t *li)
 	 *	We never read or write to this file, but we need a
 	 *	readable FD in order to bootstrap the process.
 	 */
-	li->fd = open(inst->filename, O_RDONLY);
+	li->fd = open(inst->filename[0], O_RDONLY);
+
+	/*
+	 *	Ask the master IO handler for more listeners.  Each
+	 *	one runs its own load generator, in its own network
+	 *	thread.
+	 */
+	li->num_shards = inst->shards;
+	thread->shard = li->shard;
+
+	/*
+	 *	Start each shard on a different template, so that the
+	 *	mix of packets is the same across all of them.
+	 */
+	thread->next_template = li->shard % inst->num_templates;
 
 	memset(&ipaddr, 0, sizeof(ipaddr));
 	ipaddr.af = AF_INET;
@@ -207,7 +258,12 @@ static int mod_open(fr_listen_t *li)
 
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
-	thread->name = talloc_typed_asprintf(thread, "load_step from filename %s", inst->filename);
+	if (inst->shards > 1) {
+		thread->name = talloc_typed_asprintf(thread, "load_step from filename %s shard %u",
+						     inst->filename[0], li->shard);
+	} else {
+		thread->name = talloc_typed_asprintf(thread, "load_step from filename %s", inst->filename[0]);
+	}
 	thread->parent = talloc_parent(li);
 
 	return 0;
@@ -233,15 +289,31 @@ static int mod_generate(fr_time_t now, void *uctx)
 }
 
 
+/** Print the statistics in the configured format
+ *
+ */
+static size_t stats_sprint(proto_load_step_thread_t *thread, fr_time_t now, char *buffer, size_t buflen)
+{
+	size_t len;
+
+	if (thread->inst->report == PROTO_LOAD_STEP_REPORT_JSON) {
+		len = fr_load_generator_stats_json_sprint(thread->l, now, buffer, buflen);
+	} else {
+		len = fr_load_generator_stats_sprint(thread->l, now, buffer, buflen);
+	}
+
+	return (len < buflen) ? len : buflen - 1;
+}
+
 static void write_stats(fr_event_list_t *el, fr_time_t now, void *uctx)
 {
 	proto_load_step_thread_t	*thread = uctx;
 	size_t len;
-	char buffer[1024];
+	char buffer[2048];
 
 	(void) fr_event_timer_in(thread, el, &thread->ev, fr_time_delta_from_sec(1), write_stats, thread);
 
-	len = fr_load_generator_stats_sprint(thread->l, now, buffer, sizeof(buffer));
+	len = stats_sprint(thread, now, buffer, sizeof(buffer));
 	if (write(thread->fd, buffer, len) < 0) {
 		DEBUG("Failed writing to %s - %s", thread->inst->csv, fr_syserror(errno));
 	}
@@ -251,11 +323,17 @@ static void write_stats(fr_event_list_t *el, fr_time_t now, void *uctx)
 /** Decode the packet
  *
  */
-static int mod_decode(void const *instance, request_t *request, UNUSED uint8_t *const data, UNUSED size_t data_len)
+static int mod_decode(void const *instance, request_t *request, uint8_t *const data, size_t data_len)
 {
 	proto_load_step_t const	*inst = talloc_get_type_abort_const(instance, proto_load_step_t);
 	fr_io_track_t const	*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
 	fr_io_address_t const  	*address = track->address;
+	proto_load_step_template_t const *template;
+	uint32_t		idx = 0;
+
+	if (data_len >= sizeof(idx)) memcpy(&idx, data, sizeof(idx));
+	if (idx >= inst->num_templates) idx = 0;
+	template = &inst->templates[idx];
 
 	/*
 	 *	Set the request dictionary so that we can do
@@ -267,7 +345,7 @@ static int mod_decode(void const *instance, request_t *request, UNUSED uint8_t *
 	/*
 	 *	Hacks for now until we have a lower-level decode routine.
 	 */
-	if (inst->code) request->packet->code = inst->code;
+	if (template->code) request->packet->code = template->code;
 	request->packet->id = fr_rand() & 0xff;
 	request->reply->id = request->packet->id;
 	memset(request->packet->vector, 0, sizeof(request->packet->vector));
@@ -275,7 +353,7 @@ static int mod_decode(void const *instance, request_t *request, UNUSED uint8_t *
 	request->packet->data = talloc_zero_array(request->packet, uint8_t, 1);
 	request->packet->data_len = 1;
 
-	(void) fr_pair_list_copy(request->request_ctx, &request->request_pairs, &inst->pair_list);
+	(void) fr_pair_list_copy(request->request_ctx, &request->request_pairs, &template->pair_list);
 
 	/*
 	 *	Set the rest of the fields.
@@ -300,8 +378,9 @@ static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
 {
 	proto_load_step_t const       *inst = talloc_get_type_abort_const(li->app_io_instance, proto_load_step_t);
 	proto_load_step_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_step_thread_t);
+	char const			*filename;
 	size_t len;
-	char buffer[256];
+	char buffer[2048];
 
 	thread->el = el;
 	thread->nr = nr;
@@ -315,15 +394,27 @@ static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
 
 	if (!inst->csv) return;
 
-	thread->fd = open(inst->csv, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	/*
+	 *	Each shard writes its own file, so that the network
+	 *	threads don't have to share anything.
+	 */
+	filename = inst->csv;
+	if (inst->shards > 1) filename = talloc_typed_asprintf(thread, "%s.%u", inst->csv, thread->shard);
+
+	thread->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
 	if (thread->fd < 0) {
-		ERROR("Failed opening %s - %s", inst->csv, fr_syserror(errno));
+		ERROR("Failed opening %s - %s", filename, fr_syserror(errno));
 		return;
 	}
 
 	(void) fr_event_timer_in(thread, thread->el, &thread->ev, fr_time_delta_from_sec(1), write_stats, thread);
 
-	len = fr_load_generator_stats_sprint(thread->l, fr_time(), buffer, sizeof(buffer));
+	/*
+	 *	JSON reports are one object per line, with no header.
+	 */
+	if (inst->report != PROTO_LOAD_STEP_REPORT_CSV) return;
+
+	len = stats_sprint(thread, fr_time(), buffer, sizeof(buffer));
 	if (write(thread->fd, buffer, len) < 0) {
 		DEBUG("Failed writing to %s - %s", thread->inst->csv, fr_syserror(errno));
 	}
@@ -341,51 +432,61 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	proto_load_step_t	*inst = talloc_get_type_abort(mctx->mi->data, proto_load_step_t);
 	CONF_SECTION		*conf = mctx->mi->conf;
 	fr_client_t		*client;
-	fr_pair_t		*vp;
 	module_instance_t const	*mi = mctx->mi;
+	uint32_t		i;
+
+	inst->parent = talloc_get_type_abort(mi->parent->data, proto_load_t);
+	inst->cs = conf;
 
-	fr_pair_list_init(&inst->pair_list);
 	inst->client = client = talloc_zero(inst, fr_client_t);
 	if (!inst->client) return 0;
 
 	client->ipaddr.af = AF_INET;
 	client->src_ipaddr = client->ipaddr;
 
-	client->longname = client->shortname = inst->filename;
+	client->longname = client->shortname = inst->filename[0];
 	client->secret = talloc_strdup(client, "testing123");
 	client->nas_type = talloc_strdup(client, "load");
 	client->use_connected = false;
 
-	if (inst->filename) {
-		FILE *fp;
-		bool done = false;
+	/*
+	 *	Each "filename" is a packet template.  The packets are
+	 *	sent in the order the files are listed.
+	 */
+	inst->num_templates = talloc_array_length(inst->filename);
+	MEM(inst->templates = talloc_zero_array(inst, proto_load_step_template_t, inst->num_templates));
+
+	for (i = 0; i < inst->num_templates; i++) {
+		proto_load_step_template_t	*template = &inst->templates[i];
+		FILE				*fp;
+		fr_pair_t			*vp;
+		bool				done = false;
+
+		template->filename = inst->filename[i];
+		fr_pair_list_init(&template->pair_list);
 
-		fp = fopen(inst->filename, "r");
+		fp = fopen(template->filename, "r");
 		if (!fp) {
 			cf_log_err(conf, "Failed opening %s - %s",
-				   inst->filename, fr_syserror(errno));
+				   template->filename, fr_syserror(errno));
 			return -1;
 		}
 
-		if (fr_pair_list_afrom_file(inst, inst->parent->dict, &inst->pair_list, fp, &done) < 0) {
-			cf_log_perr(conf, "Failed reading %s", inst->filename);
+		if (fr_pair_list_afrom_file(inst, inst->parent->dict, &template->pair_list, fp, &done) < 0) {
+			cf_log_perr(conf, "Failed reading %s", template->filename);
 			fclose(fp);
 			return -1;
 		}
 
 		fclose(fp);
-	}
-
-	vp = fr_pair_find_by_da(&inst->pair_list, NULL, inst->parent->attr_packet_type);
-	if (vp) inst->code = vp->vp_uint32;
 
-	inst->parent = talloc_get_type_abort(mi->parent->data, proto_load_t);
-	inst->cs = conf;
+		vp = fr_pair_find_by_da(&template->pair_list, NULL, inst->parent->attr_packet_type);
+		if (vp) template->code = vp->vp_uint32;
+	}
 
 	FR_INTEGER_BOUND_CHECK("start_pps", inst->load.start_pps, >=, 10);
 	FR_INTEGER_BOUND_CHECK("start_pps", inst->load.start_pps, <, 400000);
 
-	FR_INTEGER_BOUND_CHECK("step", inst->load.step, >=, 1);
 	FR_INTEGER_BOUND_CHECK("step", inst->load.step, <, 100000);
 
 	if (inst->load.max_pps > 0) FR_INTEGER_BOUND_CHECK("max_pps", inst->load.max_pps, >, inst->load.start_pps);
@@ -401,6 +502,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, >=, 1);
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, <, 100000);
 
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, <=, 64);
+
 	return 0;
 }
 
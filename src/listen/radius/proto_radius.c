@@ -26,6 +26,7 @@
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/unlang/xlat_func.h>
 #include <freeradius-devel/server/module_rlm.h>
+#include <freeradius-devel/server/state.h>
 #include "proto_radius.h"
 
 extern fr_app_t proto_radius;
@@ -48,6 +49,8 @@ static conf_parser_t const limit_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", proto_radius_t, max_packet_size) } ,
 	{ FR_CONF_OFFSET("num_messages", proto_radius_t, num_messages) } ,
 
+	{ FR_CONF_OFFSET("lazy_decode", proto_radius_t, lazy_decode), .dflt = "no" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -162,13 +165,15 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *
 /** Decode the packet
  *
  */
-static int mod_decode(UNUSED void const *instance, request_t *request, uint8_t *const data, size_t data_len)
+static int mod_decode(void const *instance, request_t *request, uint8_t *const data, size_t data_len)
 {
+	proto_radius_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_t);
 	fr_io_track_t const	*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
 	fr_io_address_t const  	*address = track->address;
 	fr_client_t const	*client;
 	fr_radius_ctx_t		common_ctx;
 	fr_radius_decode_ctx_t	decode_ctx;
+	uint8_t			*packet = data;
 
 	fr_assert(data[0] < FR_RADIUS_CODE_MAX);
 
@@ -193,6 +198,7 @@ static int mod_decode(UNUSED void const *instance, request_t *request, uint8_t *
 		.end = data + data_len,
 		.verify = client->active,
 		.require_message_authenticator = client->message_authenticator,
+		.lazy = inst->lazy_decode,
 	};
 
 	/*
@@ -208,12 +214,21 @@ static int mod_decode(UNUSED void const *instance, request_t *request, uint8_t *
 	request->packet->data = talloc_memdup(request->packet, data, data_len);
 	request->packet->data_len = data_len;
 
+	/*
+	 *	Lazily decoded attributes point into the packet, so
+	 *	decode our copy of it, which lives as long as the request.
+	 */
+	if (inst->lazy_decode) {
+		packet = request->packet->data;
+		decode_ctx.end = packet + data_len;
+	}
+
 	/*
 	 *	!client->active means a fake packet defining a dynamic client - so there will
 	 *	be no secret defined yet - so can't verify.
 	 */
 	if (fr_radius_decode(request->request_ctx, &request->request_pairs,
-			     data, data_len, &decode_ctx) < 0) {
+			     packet, data_len, &decode_ctx) < 0) {
 		talloc_free(decode_ctx.tmp_ctx);
 		RPEDEBUG("Failed reading packet");
 		return -1;
@@ -309,6 +324,18 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 		return 1;
 	}
 
+	/*
+	 *	If lazily decoded attributes couldn't be created,
+	 *	the policies ran without them.  The packet would
+	 *	have been discarded if it had been decoded up front,
+	 *	so don't reply to it.
+	 */
+	if (unlikely(fr_pair_list_lazy_failed(&request->request_pairs))) {
+		REDEBUG("Failed decoding attributes from the packet - not replying");
+		track->do_not_respond = true;
+		return 1;
+	}
+
 	client = address->radclient;
 	fr_assert(client);
 
@@ -420,6 +447,48 @@ static int mod_priority_set(void const *instance, uint8_t const *buffer, UNUSED
 	return inst->priorities[buffer[0]];
 }
 
+/** Send packets from the same client and session to the same worker
+ *
+ * The key is the client's IP address, plus the State attribute when
+ * the packet has one.  Only the parts of State which stay the same
+ * between rounds are hashed, so all rounds of a multi-round
+ * conversation (e.g. EAP) after the first one land on the same worker.
+ */
+static uint32_t mod_affinity_get(UNUSED void const *instance, void const *packet_ctx,
+				 uint8_t const *buffer, size_t buflen)
+{
+	fr_io_track_t const	*track = talloc_get_type(packet_ctx, fr_io_track_t);
+	fr_ipaddr_t const	*ipaddr;
+	uint8_t const		*attr, *end;
+	uint32_t		hash;
+
+	if (!track || !track->address || (buflen < RADIUS_HEADER_LENGTH)) return 0;
+
+	ipaddr = &track->address->socket.inet.src_ipaddr;
+	hash = fr_hash(&ipaddr->addr, (ipaddr->af == AF_INET) ? sizeof(ipaddr->addr.v4) : sizeof(ipaddr->addr.v6));
+
+	/*
+	 *	The packet has already been verified by the app_io,
+	 *	so we just need to walk over the attributes.
+	 */
+	end = buffer + fr_nbo_to_uint16(buffer + 2);
+	if (end > (buffer + buflen)) end = buffer + buflen;
+
+	for (attr = buffer + RADIUS_HEADER_LENGTH;
+	     ((attr + 2) <= end) && (attr[1] >= 2) && ((attr + attr[1]) <= end);
+	     attr += attr[1]) {
+		if (attr[0] != attr_state->attr) continue;
+
+		hash = fr_state_hash(attr + 2, attr[1] - 2, hash);
+		break;
+	}
+
+	/*
+	 *	Zero means "no affinity".
+	 */
+	return hash ? hash : 1;
+}
+
 /** Open listen sockets/connect to external event source
  *
  * @param[in] instance	Ctx data for this application.
@@ -580,5 +649,6 @@ fr_app_t proto_radius = {
 	.open			= mod_open,
 	.decode			= mod_decode,
 	.encode			= mod_encode,
-	.priority		= mod_priority_set
+	.priority		= mod_priority_set,
+	.affinity		= mod_affinity_get
 };
@@ -36,6 +36,7 @@ typedef struct {
 	uint32_t			num_messages;			//!< for message ring buffer.
 
 	bool				tunnel_password_zeros;		//!< check for trailing zeroes in Tunnel-Password.
+	bool				lazy_decode;			//!< Only create pairs when they're accessed.
 
 	uint32_t			priorities[FR_RADIUS_CODE_MAX];	//!< priorities for individual packets
 
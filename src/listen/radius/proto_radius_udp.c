@@ -43,6 +43,11 @@ typedef struct {
 
 	fr_stats_t			stats;			//!< statistics for this socket
 
+	udp_mmsg_t			*recv_mmsg;		//!< datagrams read with one recvmmsg() call
+	unsigned int			recv_mmsg_num;		//!< how many datagrams are in recv_mmsg
+	unsigned int			recv_mmsg_next;		//!< the next datagram to return from recv_mmsg
+
+	udp_mmsg_queue_t		*send_queue;		//!< replies waiting to be written with sendmmsg()
 } proto_radius_udp_thread_t;
 
 typedef struct {
@@ -63,6 +68,15 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			max_recv_coalesce;	//!< Maximum number of packets to read with one
+								///< recvmmsg() call.
+	uint32_t			max_send_coalesce;	//!< Maximum number of replies to write with one
+								///< sendmmsg() call.
+
+	uint32_t			shards;			//!< Number of SO_REUSEPORT sockets to open, each
+								///< of which is serviced by its own network thread.
+	bool				shard_by_src_ipaddr;	//!< Send all packets from a client to the same shard.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
@@ -107,11 +121,56 @@ static const conf_parser_t udp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("max_packet_size", proto_radius_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", proto_radius_udp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
+	{ FR_CONF_OFFSET("max_recv_coalesce", proto_radius_udp_t, max_recv_coalesce), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("max_send_coalesce", proto_radius_udp_t, max_send_coalesce), .dflt = "1" } ,
+
+	{ FR_CONF_OFFSET("shards", proto_radius_udp_t, shards), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("shard_by_src_ipaddr", proto_radius_udp_t, shard_by_src_ipaddr), .dflt = "no" } ,
 
 	CONF_PARSER_TERMINATOR
 };
 
 
+/** Return the next packet from a batch read with recvmmsg()
+ *
+ *  When the batch is empty, all of the packets waiting on the socket
+ *  (up to max_recv_coalesce) are read with one system call.  The
+ *  network side is told to call us again while the batch still
+ *  contains packets, as they won't generate any more read events.
+ */
+static ssize_t mod_read_mmsg(fr_listen_t *li, proto_radius_udp_t const *inst, proto_radius_udp_thread_t *thread,
+			     fr_socket_t *socket_out, uint8_t *buffer, size_t buffer_len, fr_time_t *recv_time_p)
+{
+	udp_mmsg_t	*msg;
+	size_t		len;
+
+	if (thread->recv_mmsg_next == thread->recv_mmsg_num) {
+		int num;
+
+		thread->recv_mmsg_num = thread->recv_mmsg_next = 0;
+
+		num = udp_recv_mmsg(thread->sockfd, UDP_FLAGS_NONE, thread->recv_mmsg, inst->max_recv_coalesce);
+		if (num <= 0) {
+			li->read_again = false;
+			return num;
+		}
+
+		thread->recv_mmsg_num = num;
+	}
+
+	msg = &thread->recv_mmsg[thread->recv_mmsg_next++];
+	li->read_again = (thread->recv_mmsg_next < thread->recv_mmsg_num);
+
+	len = msg->data_len;
+	if (len > buffer_len) len = buffer_len;
+
+	*socket_out = msg->socket;
+	*recv_time_p = msg->when;
+	memcpy(buffer, msg->data, len);
+
+	return len;
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len,
 			size_t *leftover)
 {
@@ -138,7 +197,11 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->recv_mmsg && !thread->connection) {
+		data_size = mod_read_mmsg(li, inst, thread, &address->socket, buffer, buffer_len, recv_time_p);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		PDEBUG2("proto_radius_udp got read error");
 		return data_size;
@@ -245,6 +308,12 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 			memcpy(&packet, &track->reply, sizeof(packet)); /* const issues */
 
+			if (thread->send_queue && !thread->connection) {
+				if (udp_mmsg_queue_add(thread->send_queue, &socket, track->reply, track->reply_len) < 0) return -1;
+
+				return track->reply_len;
+			}
+
 			return udp_send(&socket, flags, packet, track->reply_len);
 		}
 
@@ -256,6 +325,16 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 */
 	fr_assert(buffer_len >= 20);
 
+	/*
+	 *	Queue the reply, and let mod_flush() write all of the
+	 *	queued replies with one system call.
+	 */
+	if (thread->send_queue && !thread->connection) {
+		if (udp_mmsg_queue_add(thread->send_queue, &socket, buffer, buffer_len) < 0) return -1;
+
+		return buffer_len;
+	}
+
 	/*
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
@@ -278,6 +357,22 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	return data_size;
 }
 
+/** Write any replies which mod_write() queued
+ *
+ */
+static int mod_flush(fr_listen_t *li, fr_io_flush_stats_t *stats)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+	int				ret;
+
+	if (!thread->send_queue) return 0;
+
+	ret = udp_mmsg_queue_flush(thread->send_queue);
+	udp_mmsg_queue_stats(thread->send_queue, &stats->syscalls_saved, &stats->dropped);
+
+	return ret;
+}
+
 
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
@@ -361,6 +456,46 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Pre-allocate the buffers for reading multiple packets
+	 *	with one system call.
+	 */
+	if (inst->max_recv_coalesce > 1) {
+		uint8_t		*data;
+		unsigned int	i;
+
+		MEM(thread->recv_mmsg = talloc_zero_array(thread, udp_mmsg_t, inst->max_recv_coalesce));
+		MEM(data = talloc_array(thread->recv_mmsg, uint8_t, inst->max_packet_size * inst->max_recv_coalesce));
+
+		for (i = 0; i < inst->max_recv_coalesce; i++) {
+			thread->recv_mmsg[i].data = data + (i * inst->max_packet_size);
+			thread->recv_mmsg[i].data_size = inst->max_packet_size;
+		}
+	}
+
+	if (inst->max_send_coalesce > 1) {
+		MEM(thread->send_queue = udp_mmsg_queue_alloc(thread, sockfd, inst->max_send_coalesce, inst->max_packet_size));
+	}
+
+	/*
+	 *	Ask the master IO handler to open more sockets on the
+	 *	same address / port.  The kernel then spreads the
+	 *	packets across them.
+	 */
+	li->num_shards = inst->shards;
+
+	/*
+	 *	The filter applies to the whole SO_REUSEPORT group, so
+	 *	it only needs to be attached once.
+	 */
+	if ((inst->shards > 1) && inst->shard_by_src_ipaddr && (li->shard == 0)) {
+		if (udp_shard_by_src_ipaddr(sockfd, ipaddr.af, inst->shards) < 0) {
+			PERROR("Failed setting 'shard_by_src_ipaddr'");
+			close(sockfd);
+			goto error;
+		}
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_radius_udp,
@@ -465,6 +600,15 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("max_recv_coalesce", inst->max_recv_coalesce, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_recv_coalesce", inst->max_recv_coalesce, <=, UDP_RECV_MMSG_MAX);
+
+	FR_INTEGER_BOUND_CHECK("max_send_coalesce", inst->max_send_coalesce, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_send_coalesce", inst->max_send_coalesce, <=, UDP_SEND_MMSG_MAX);
+
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, <=, 64);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -555,6 +699,7 @@ fr_app_io_t proto_radius_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
@@ -0,0 +1,4 @@
+TARGETNAME	:= rlm_cache_htable
+
+TARGET		:= $(TARGETNAME)$(L)
+SOURCES		:= $(TARGETNAME).c
@@ -0,0 +1,608 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_htable.c
+ * @brief Sharded hash table based cache.
+ *
+ * Entries are spread over a power of two number of shards by the top bits
+ * of the hash of their key.  Each shard is an open addressing (linear
+ * probing) table with its own mutex, so workers looking up unrelated keys
+ * rarely contend for the same lock.
+ *
+ * Expired entries are removed lazily, when they're looked up, or when the
+ * CLOCK hand passes over them.  If a memory limit is configured, each shard
+ * gets an equal share of it, and the CLOCK hand evicts entries which have not
+ * been referenced since it last passed over them, until the new entry fits.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/value.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include "../../rlm_cache.h"
+
+/** Number of slots each shard's table starts with
+ *
+ * Must be a power of two.
+ */
+#define HTABLE_INITIAL_SLOTS	64
+
+/** Maximum number of shards
+ */
+#define HTABLE_MAX_SHARDS	256
+
+typedef struct {
+	rlm_cache_entry_t		fields;		//!< Entry data.  Must come first.
+
+	size_t				size;		//!< Memory used by the entry when it was inserted.
+	bool				referenced;	//!< CLOCK reference bit.  Set when the entry is found,
+							///< cleared when the CLOCK hand passes over it.
+} rlm_cache_htable_entry_t;
+
+typedef struct {
+	uint32_t			hash;		//!< Hash of the entry's key, so probing rarely
+							///< needs to touch the entry itself.
+	rlm_cache_htable_entry_t	*entry;		//!< Entry in this slot, or NULL if the slot is empty.
+} rlm_cache_htable_slot_t;
+
+typedef struct {
+	pthread_mutex_t			mutex;		//!< Protects everything below.
+
+	rlm_cache_htable_slot_t		*slots;		//!< Open addressing table.
+	uint32_t			mask;		//!< Number of slots - 1.
+	uint32_t			num;		//!< Number of entries in the table.
+	uint32_t			hand;		//!< CLOCK hand.  Index of the next slot to consider
+							///< for eviction.
+
+	size_t				size;		//!< Memory used by entries in this shard.
+	size_t				max_size;	//!< Share of the memory limit for this shard.  0 if there's no limit.
+} rlm_cache_htable_shard_t;
+
+typedef struct {
+	rlm_cache_htable_shard_t	*shards;	//!< Array of shards.
+	uint32_t			num_shards;	//!< How many shards there are.  Always a power of two.
+	uint8_t				shard_shift;	//!< How far to shift a hash right to get its shard.
+
+	atomic_uint_fast64_t		num_entries;	//!< Entries across all shards, so counting doesn't
+							///< need to lock anything.
+} rlm_cache_htable_mutable_t;
+
+typedef struct {
+	uint32_t			num_shards;	//!< Number of shards to split the table into.
+	size_t				max_size;	//!< Maximum memory all entries may use.
+
+	rlm_cache_htable_mutable_t	*mutable;	//!< Mutable instance data.
+} rlm_cache_htable_t;
+
+/** Per-request handle
+ *
+ * A handle holds the lock of at most one shard at a time.  The lock is taken
+ * by the first operation on a key in that shard, and held until the handle is
+ * released, so entries returned by cache_entry_find() can't be evicted by
+ * other threads whilst rlm_cache is still using them.
+ */
+typedef struct {
+	rlm_cache_htable_shard_t	*locked;	//!< Shard whose mutex we hold, or NULL.
+} rlm_cache_htable_handle_t;
+
+static const conf_parser_t driver_config[] = {
+	{ FR_CONF_OFFSET("shards", rlm_cache_htable_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("max_size", FR_TYPE_SIZE, 0, rlm_cache_htable_t, max_size), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+static inline CC_HINT(always_inline) uint32_t htable_key_hash(fr_value_box_t const *key)
+{
+	return fr_hash(key->vb_strvalue, key->vb_length);
+}
+
+/** Lock the shard a key hash belongs in
+ *
+ * If the handle already holds a different shard's lock, that lock is released first.
+ */
+static inline CC_HINT(always_inline)
+rlm_cache_htable_shard_t *htable_shard_lock(rlm_cache_htable_mutable_t *mutable,
+					   rlm_cache_htable_handle_t *handle, uint32_t hash)
+{
+	rlm_cache_htable_shard_t *shard;
+
+	shard = &mutable->shards[(mutable->num_shards == 1) ? 0 : (hash >> mutable->shard_shift)];
+	if (handle->locked == shard) return shard;
+
+	if (handle->locked) pthread_mutex_unlock(&handle->locked->mutex);
+	pthread_mutex_lock(&shard->mutex);
+	handle->locked = shard;
+
+	return shard;
+}
+
+/** Find the slot an entry with the specified key is in
+ *
+ * @return
+ *	- Index of the slot.
+ *	- -1 if no entry has this key.
+ */
+static int64_t htable_slot_find(rlm_cache_htable_shard_t *shard, uint32_t hash, fr_value_box_t const *key)
+{
+	uint32_t i = hash & shard->mask;
+
+	for (;;) {
+		rlm_cache_htable_slot_t *slot = &shard->slots[i];
+
+		if (!slot->entry) return -1;
+
+		if ((slot->hash == hash) &&
+		    (slot->entry->fields.key.vb_length == key->vb_length) &&
+		    (memcmp(slot->entry->fields.key.vb_strvalue, key->vb_strvalue, key->vb_length) == 0)) return i;
+
+		i = (i + 1) & shard->mask;
+	}
+}
+
+/** Place an entry in the first free slot after its home slot
+ *
+ * @note There must be at least one free slot, and no entry with the same key.
+ */
+static void htable_slot_place(rlm_cache_htable_slot_t *slots, uint32_t mask,
+			      uint32_t hash, rlm_cache_htable_entry_t *entry)
+{
+	uint32_t i = hash & mask;
+
+	while (slots[i].entry) i = (i + 1) & mask;
+
+	slots[i].hash = hash;
+	slots[i].entry = entry;
+}
+
+/** Double the number of slots in a shard
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The shard is left unchanged.
+ */
+static int htable_shard_grow(rlm_cache_htable_shard_t *shard)
+{
+	rlm_cache_htable_slot_t	*slots;
+	uint32_t		mask = (shard->mask << 1) | 1;
+	uint32_t		i;
+
+	slots = talloc_zero_array(talloc_parent(shard->slots), rlm_cache_htable_slot_t, (size_t)mask + 1);
+	if (!slots) return -1;
+
+	for (i = 0; i <= shard->mask; i++) {
+		if (!shard->slots[i].entry) continue;
+
+		htable_slot_place(slots, mask, shard->slots[i].hash, shard->slots[i].entry);
+	}
+
+	talloc_free(shard->slots);
+	shard->slots = slots;
+	shard->mask = mask;
+	shard->hand = 0;
+
+	return 0;
+}
+
+/** Remove the entry in a slot, and free it
+ *
+ * Uses backwards shift deletion, so probe sequences never need tombstones.
+ * Entries shifted back may move behind the CLOCK hand, which at worst means
+ * they get one extra lap before being considered for eviction.
+ */
+static void htable_slot_delete(rlm_cache_htable_mutable_t *mutable, rlm_cache_htable_shard_t *shard, uint32_t i)
+{
+	rlm_cache_htable_slot_t	*slots = shard->slots;
+	uint32_t		j = i;
+
+	shard->size -= slots[i].entry->size;
+	shard->num--;
+	atomic_fetch_sub_explicit(&mutable->num_entries, 1, memory_order_relaxed);
+	talloc_free(slots[i].entry);
+
+	for (;;) {
+		uint32_t home;
+
+		j = (j + 1) & shard->mask;
+		if (!slots[j].entry) break;
+
+		/*
+		 *	Only move the entry back if the hole
+		 *	is (cyclically) between its home slot
+		 *	and the slot it's in now.
+		 */
+		home = slots[j].hash & shard->mask;
+		if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j))) continue;
+
+		slots[i] = slots[j];
+		i = j;
+	}
+
+	slots[i].entry = NULL;
+	slots[i].hash = 0;
+}
+
+/** Run the CLOCK hand until there's enough space for a new entry
+ *
+ * Expired entries are always evicted.  Unexpired entries get a second chance
+ * if they've been referenced since the hand last passed over them.
+ *
+ * @param[in] mutable	instance data.
+ * @param[in] shard	to evict entries from.
+ * @param[in] needed	how much memory the new entry needs.
+ * @param[in] now	the current time, used to determine if entries have expired.
+ */
+static void htable_shard_evict(rlm_cache_htable_mutable_t *mutable, rlm_cache_htable_shard_t *shard,
+			       size_t needed, fr_unix_time_t now)
+{
+	uint64_t i, limit = 2 * ((uint64_t)shard->mask + 1);
+
+	/*
+	 *	Two laps is enough to clear every reference
+	 *	bit, and then evict everything in the shard.
+	 */
+	for (i = 0; (i < limit) && shard->num && ((shard->size + needed) > shard->max_size); i++) {
+		rlm_cache_htable_entry_t *c = shard->slots[shard->hand].entry;
+
+		if (!c) goto next;
+
+		if (c->referenced && !fr_unix_time_lt(c->fields.expires, now)) {
+			c->referenced = false;
+			goto next;
+		}
+
+		/*
+		 *	Don't advance the hand, an entry may
+		 *	have been shifted back into this slot.
+		 */
+		htable_slot_delete(mutable, shard, shard->hand);
+		continue;
+
+	next:
+		shard->hand = (shard->hand + 1) & shard->mask;
+	}
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    request_t *request)
+{
+	rlm_cache_htable_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_htable_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * Expired entries are removed, and reported as a miss.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       request_t *request, void *handle, fr_value_box_t const *key)
+{
+	rlm_cache_htable_t		*driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*c;
+	uint32_t			hash = htable_key_hash(key);
+	int64_t				i;
+
+	shard = htable_shard_lock(driver->mutable, handle, hash);
+
+	i = htable_slot_find(shard, hash, key);
+	if (i < 0) {
+	miss:
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	c = shard->slots[i].entry;
+	if (fr_unix_time_lt(c->fields.expires, fr_time_to_unix_time(request->packet->timestamp))) {
+		htable_slot_delete(driver->mutable, shard, i);
+		goto miss;
+	}
+
+	c->referenced = true;
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 fr_value_box_t const *key)
+{
+	rlm_cache_htable_t		*driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+	rlm_cache_htable_shard_t	*shard;
+	uint32_t			hash = htable_key_hash(key);
+	int64_t				i;
+
+	if (!request) return CACHE_ERROR;
+
+	shard = htable_shard_lock(driver->mutable, handle, hash);
+
+	i = htable_slot_find(shard, hash, key);
+	if (i < 0) return CACHE_MISS;
+
+	htable_slot_delete(driver->mutable, shard, i);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * Any existing entry with the same key is replaced.  If a memory limit is
+ * configured, entries are evicted from the shard until the new one fits.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	rlm_cache_htable_t		*driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+	rlm_cache_htable_mutable_t	*mutable = driver->mutable;
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*entry = UNCONST(rlm_cache_htable_entry_t *, c);
+	uint32_t			hash = htable_key_hash(&c->key);
+	int64_t				i;
+
+	if (!request) return CACHE_ERROR;
+
+	shard = htable_shard_lock(mutable, handle, hash);
+
+	/*
+	 *	Allow overwriting
+	 */
+	i = htable_slot_find(shard, hash, &c->key);
+	if (i >= 0) {
+		if (shard->slots[i].entry == entry) return CACHE_OK;
+		htable_slot_delete(mutable, shard, i);
+	}
+
+	entry->size = talloc_total_size(entry);
+	if (shard->max_size) {
+		if (entry->size > shard->max_size) {
+			RERROR("Entry too large (%zu bytes) to fit in cache shard (%zu bytes)",
+			       entry->size, shard->max_size);
+			return CACHE_ERROR;
+		}
+
+		htable_shard_evict(mutable, shard, entry->size,
+				   fr_time_to_unix_time(request->packet->timestamp));
+	}
+
+	/*
+	 *	Keep the load factor below 3/4
+	 */
+	if ((((uint64_t)shard->num + 1) * 4) > (((uint64_t)shard->mask + 1) * 3)) {
+		if (htable_shard_grow(shard) < 0) {
+			RERROR("Failed growing cache shard");
+			return CACHE_ERROR;
+		}
+	}
+
+	htable_slot_place(shard->slots, shard->mask, hash, entry);
+	shard->size += entry->size;
+	shard->num++;
+	atomic_fetch_add_explicit(&mutable->num_entries, 1, memory_order_relaxed);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * Expiry is checked lazily against the entry's expires time, so there's
+ * nothing else to update.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					  request_t *request, UNUSED void *handle,
+					  UNUSED rlm_cache_entry_t *c)
+{
+	if (!request) return CACHE_ERROR;
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * Doesn't lock any shards, so the count may be slightly stale.
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint64_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  UNUSED request_t *request, UNUSED void *handle)
+{
+	rlm_cache_htable_t *driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+
+	return atomic_load_explicit(&driver->mutable->num_entries, memory_order_relaxed);
+}
+
+/** Allocate a handle
+ *
+ * No locks are taken until the handle is used to operate on a key.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+			 request_t *request)
+{
+	rlm_cache_htable_handle_t *h;
+
+	h = talloc_zero(request, rlm_cache_htable_handle_t);
+	if (!h) {
+		RERROR("Failed allocating cache handle");
+		return -1;
+	}
+	*handle = h;
+
+	return 0;
+}
+
+/** Release a handle, unlocking the shard it holds (if any)
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, request_t *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_htable_handle_t *h = talloc_get_type_abort(handle, rlm_cache_htable_handle_t);
+
+	if (h->locked) {
+		pthread_mutex_unlock(&h->locked->mutex);
+		RDEBUG3("Mutex released");
+	}
+
+	talloc_free(h);
+}
+
+/** Cleanup a cache_htable instance
+ *
+ */
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_cache_htable_t		*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_htable_t);
+	rlm_cache_htable_mutable_t	*mutable = driver->mutable;
+	uint32_t			i, j;
+
+	if (!mutable) return 0;
+
+	for (i = 0; i < mutable->num_shards; i++) {
+		rlm_cache_htable_shard_t *shard = &mutable->shards[i];
+
+		for (j = 0; j <= shard->mask; j++) talloc_free(shard->slots[j].entry);
+
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	TALLOC_FREE(driver->mutable);
+
+	return 0;
+}
+
+/** Create a new cache_htable instance
+ *
+ * @param[in] mctx		Data required for instantiation.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_cache_htable_t		*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_htable_t);
+	rlm_cache_htable_mutable_t	*mutable;
+	uint32_t			num_shards, i;
+	int				ret;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, HTABLE_MAX_SHARDS);
+
+	/*
+	 *	Round up to a power of two, so the shard
+	 *	can be selected with a shift.
+	 */
+	for (num_shards = 1; num_shards < driver->num_shards; num_shards <<= 1);
+
+	if (driver->max_size && (driver->max_size < num_shards)) {
+		cf_log_err(mctx->mi->conf, "max_size (%zu) must be at least the number of shards (%u)",
+			   driver->max_size, num_shards);
+		return -1;
+	}
+
+	MEM(mutable = talloc_zero(NULL, rlm_cache_htable_mutable_t));
+	MEM(mutable->shards = talloc_zero_array(mutable, rlm_cache_htable_shard_t, num_shards));
+	mutable->shard_shift = 32 - fr_high_bit_pos(num_shards) + 1;
+
+	/*
+	 *	num_shards is only incremented once a shard
+	 *	is fully initialised, so mod_detach only
+	 *	cleans up what was actually set up.
+	 */
+	driver->mutable = mutable;
+	for (i = 0; i < num_shards; i++) {
+		rlm_cache_htable_shard_t *shard = &mutable->shards[i];
+
+		shard->slots = talloc_zero_array(mutable->shards, rlm_cache_htable_slot_t, HTABLE_INITIAL_SLOTS);
+		if (!shard->slots) {
+			ERROR("Failed allocating cache shard");
+		error:
+			mod_detach(&(module_detach_ctx_t){ .mi = mctx->mi });
+			return -1;
+		}
+		shard->mask = HTABLE_INITIAL_SLOTS - 1;
+		shard->max_size = driver->max_size / num_shards;
+
+		if ((ret = pthread_mutex_init(&shard->mutex, NULL)) != 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(ret));
+			goto error;
+		}
+
+		mutable->num_shards++;
+	}
+
+	return 0;
+}
+
+extern rlm_cache_driver_t rlm_cache_htable;
+rlm_cache_driver_t rlm_cache_htable = {
+	.common = {
+		.magic		= MODULE_MAGIC_INIT,
+		.name		= "cache_htable",
+		.config		= driver_config,
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach,
+		.inst_size	= sizeof(rlm_cache_htable_t),
+		.inst_type	= "rlm_cache_htable_t",
+	},
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
@@ -0,0 +1,1162 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_memcached_async.c
+ * @brief Asynchronous memcached based cache.
+ *
+ * Speaks the memcached meta text protocol directly over trunk connections,
+ * so lookups from many requests are pipelined on each connection, and
+ * requests yield whilst waiting for replies instead of blocking the worker.
+ *
+ * Lookups are sent as `mg` commands, and complete when their reply arrives.
+ * Stores and deletes are sent as quiet `ms` and `md` commands, which memcached
+ * only replies to on failure, so they complete as soon as they've been written.
+ *
+ * Every command carries an opaque token which memcached echoes back.  Replies
+ * arrive in the order commands were sent, so a lookup's reply is always the
+ * first reply carrying its token, and any reply which doesn't match the oldest
+ * outstanding lookup must be the failure of a store or delete.
+ *
+ * Keys are sent base64 encoded, so they may contain any characters.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/connection.h>
+#include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/base64.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/socket.h>
+
+#include <sys/socket.h>
+
+#include "../../rlm_cache.h"
+#include "../../serialize.h"
+
+/** Longest key memcached accepts, once base64 encoded
+ */
+#define MC_KEY_ENC_MAX		250
+
+/** Longest key we can send
+ */
+#define MC_KEY_MAX		((MC_KEY_ENC_MAX / 4) * 3)
+
+/** Longest command or reply line, excluding entry data
+ */
+#define MC_LINE_MAX		384
+
+typedef enum {
+	MC_OP_GET = 0,					//!< Lookup, we wait for the reply.
+	MC_OP_SET,					//!< Quiet store.
+	MC_OP_DELETE					//!< Quiet delete.
+} mc_op_t;
+
+static fr_table_num_sorted_t const mc_op_table[] = {
+	{ L("delete"),	MC_OP_DELETE	},
+	{ L("get"),	MC_OP_GET	},
+	{ L("set"),	MC_OP_SET	}
+};
+static size_t mc_op_table_len = NUM_ELEMENTS(mc_op_table);
+
+typedef struct {
+	fr_ipaddr_t		server;			//!< memcached server to connect to.
+	uint16_t		port;			//!< Port memcached is listening on.
+	size_t			max_entry_size;		//!< Largest serialized entry we'll store or accept.
+
+	fr_trunk_conf_t		trunk_conf;		//!< Trunk configuration.
+
+	module_instance_t const	*mi;			//!< Our module instance, to find our thread data with.
+} rlm_cache_memcached_async_t;
+
+typedef struct {
+	rlm_cache_memcached_async_t const *inst;	//!< Instance data.
+	fr_event_list_t		*el;			//!< This thread's event list.
+	fr_trunk_t		*trunk;			//!< Connections to memcached.
+
+	uint32_t		opaque;			//!< Opaque token to give the next command.
+} mc_thread_t;
+
+typedef struct {
+	uint8_t			*data;			//!< Start of the buffer.
+	uint8_t			*read;			//!< Where to consume data from.
+	uint8_t			*write;			//!< Where to add data.
+	uint8_t			*end;			//!< End of the buffer.
+} mc_buffer_t;
+
+/** A lookup which has been sent, and is waiting for its reply
+ *
+ * Allocated separately from the request, so that if the request is cancelled
+ * we still know to discard its reply.
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the connection's list of lookups.
+	uint32_t		opaque;			//!< Token the reply will carry.
+	fr_trunk_request_t	*treq;			//!< Request waiting for the reply, or NULL if
+							///< the request went away.
+} mc_inflight_t;
+
+typedef struct {
+	char const		*name;			//!< Describes the connection, for logging.
+	int			fd;			//!< Socket.
+	mc_thread_t		*thread;		//!< Thread the connection belongs to.
+
+	fr_trunk_connection_t	*tconn;			//!< Trunk connection, set when I/O events are registered.
+	fr_trunk_connection_event_t notify_on;		//!< Events the trunk last asked us to watch for.
+
+	fr_dlist_head_t		inflight;		//!< Lookups sent, oldest first.
+
+	size_t			discard;		//!< Entry data still to be skipped in the receive buffer.
+
+	mc_buffer_t		send;			//!< Commands waiting to be written.
+	mc_buffer_t		recv;			//!< Replies waiting to be processed.
+} mc_conn_t;
+
+/** A command to send
+ *
+ */
+typedef struct {
+	mc_op_t			op;			//!< What the command does.
+	uint32_t		opaque;			//!< Token the reply will carry.
+
+	char			*cmd;			//!< Encoded command.
+	size_t			cmd_len;		//!< Length of the encoded command.
+
+	mc_inflight_t		*inflight;		//!< Tracks the reply, once a lookup has been sent.
+} mc_request_t;
+
+/** Per-request handle
+ *
+ * Holds the outstanding lookup, and its result once it arrives.
+ */
+typedef struct {
+	mc_thread_t		*thread;		//!< Thread the handle was acquired in.
+	fr_trunk_request_t	*treq;			//!< Outstanding lookup, or NULL.
+
+	fr_value_box_t		key;			//!< Key that was fetched.
+	bool			fetched;		//!< Whether a lookup has completed.
+	cache_status_t		status;			//!< Result of the lookup.
+	char			*data;			//!< Serialized entry, if one was found.
+	size_t			data_len;		//!< Length of the serialized entry.
+} mc_handle_t;
+
+static const conf_parser_t driver_config[] = {
+	{ FR_CONF_OFFSET_TYPE_FLAGS("server", FR_TYPE_COMBO_IP_ADDR, 0, rlm_cache_memcached_async_t, server), .dflt = "127.0.0.1" },
+	{ FR_CONF_OFFSET("port", rlm_cache_memcached_async_t, port), .dflt = "11211" },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("max_entry_size", FR_TYPE_SIZE, 0, rlm_cache_memcached_async_t, max_entry_size), .dflt = "64k" },
+	{ FR_CONF_OFFSET_SUBSECTION("trunk", 0, rlm_cache_memcached_async_t, trunk_conf, fr_trunk_config) },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Free a connection handle, closing the socket
+ *
+ */
+static int _mc_conn_free(mc_conn_t *h)
+{
+	mc_inflight_t *inflight;
+
+	fr_assert(h->fd >= 0);
+
+	while ((inflight = fr_dlist_pop_head(&h->inflight))) talloc_free(inflight);
+
+	fr_event_fd_delete(h->thread->el, h->fd, FR_EVENT_FILTER_IO);
+
+	if (shutdown(h->fd, SHUT_RDWR) < 0) {
+		DEBUG3("Failed shutting down connection %s: %s", h->name, fr_syserror(errno));
+	}
+
+	if (close(h->fd) < 0) {
+		DEBUG3("Failed closing connection %s: %s", h->name, fr_syserror(errno));
+	}
+
+	h->fd = -1;
+
+	DEBUG("Connection closed - %s", h->name);
+
+	return 0;
+}
+
+/** Open a new connection to memcached
+ *
+ * @param[out] h_out	Where to write the new connection handle.
+ * @param[in] conn	to initialise.
+ * @param[in] uctx	A #mc_thread_t.
+ */
+static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+{
+	mc_thread_t				*thread = talloc_get_type_abort(uctx, mc_thread_t);
+	rlm_cache_memcached_async_t const	*inst = thread->inst;
+	mc_conn_t				*h;
+	size_t					buff_len;
+	int					fd;
+
+	fd = fr_socket_client_tcp(NULL, NULL, &inst->server, inst->port, true);
+	if (fd < 0) {
+		PERROR("Failed opening socket to memcached");
+		return FR_CONNECTION_STATE_FAILED;
+	}
+
+	MEM(h = talloc_zero(conn, mc_conn_t));
+	h->fd = fd;
+	h->thread = thread;
+	fr_dlist_talloc_init(&h->inflight, mc_inflight_t, entry);
+	h->name = talloc_typed_asprintf(h, "proto tcp remote %pV port %u",
+					fr_box_ipaddr(inst->server), inst->port);
+	talloc_set_destructor(h, _mc_conn_free);
+
+	/*
+	 *	Each buffer can hold two of the largest commands
+	 *	(or replies), so we can always make progress.
+	 */
+	buff_len = (MC_LINE_MAX + inst->max_entry_size + 2) * 2;
+
+	MEM(h->send.data = talloc_array(h, uint8_t, buff_len));
+	h->send.read = h->send.write = h->send.data;
+	h->send.end = h->send.data + buff_len;
+
+	MEM(h->recv.data = talloc_array(h, uint8_t, buff_len));
+	h->recv.read = h->recv.write = h->recv.data;
+	h->recv.end = h->recv.data + buff_len;
+
+	/*
+	 *	Signal the connection as open
+	 *	as soon as it becomes writable.
+	 */
+	fr_connection_signal_on_fd(conn, fd);
+
+	*h_out = h;
+
+	return FR_CONNECTION_STATE_CONNECTING;
+}
+
+/** Close a connection
+ *
+ */
+static void conn_close(UNUSED fr_event_list_t *el, void *handle, UNUSED void *uctx)
+{
+	mc_conn_t *h = talloc_get_type_abort(handle, mc_conn_t);
+
+	talloc_free(h);
+}
+
+static fr_connection_t *thread_conn_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+					  fr_connection_conf_t const *conf,
+					  char const *log_prefix, void *uctx)
+{
+	fr_connection_t		*conn;
+	mc_thread_t		*thread = talloc_get_type_abort(uctx, mc_thread_t);
+
+	conn = fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+					.init = conn_init,
+					.close = conn_close,
+				   },
+				   conf,
+				   log_prefix,
+				   thread);
+	if (!conn) {
+		PERROR("Failed allocating state handler for new connection");
+		return NULL;
+	}
+
+	return conn;
+}
+
+/** Connection errored
+ *
+ */
+static void conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	fr_connection_t		*conn = tconn->conn;
+	mc_conn_t		*h = talloc_get_type_abort(conn->h, mc_conn_t);
+
+	ERROR("Connection %s failed: %s", h->name, fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+}
+
+static void conn_writable(fr_event_list_t *el, int fd, int flags, void *uctx);
+
+/** Register for the I/O events we need
+ *
+ * As well as the events the trunk wants, we need to know when we can write
+ * any commands still in the send buffer, and when replies arrive for lookups
+ * whose requests have gone away.
+ */
+static void mc_conn_events(mc_conn_t *h)
+{
+	fr_event_fd_cb_t	read_fn = NULL;
+	fr_event_fd_cb_t	write_fn = NULL;
+
+	if ((h->notify_on & FR_TRUNK_CONN_EVENT_READ) || (fr_dlist_num_elements(&h->inflight) > 0)) {
+		read_fn = fr_trunk_connection_callback_readable;
+	}
+
+	if (h->send.write != h->send.read) {
+		write_fn = conn_writable;
+	} else if (h->notify_on & FR_TRUNK_CONN_EVENT_WRITE) {
+		write_fn = fr_trunk_connection_callback_writable;
+	}
+
+	if (!read_fn && !write_fn) {
+		(void) fr_event_fd_delete(h->thread->el, h->fd, FR_EVENT_FILTER_IO);
+		return;
+	}
+
+	if (fr_event_fd_insert(h, NULL, h->thread->el, h->fd,
+			       read_fn,
+			       write_fn,
+			       conn_error,
+			       h->tconn) < 0) {
+		PERROR("Failed inserting FD event");
+
+		/*
+		 *	May free the connection!
+		 */
+		fr_trunk_connection_signal_reconnect(h->tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+/** Write as much of the send buffer as the socket will take
+ *
+ * @return
+ *	- 0 if the send buffer is now empty.
+ *	- 1 if there's still data to write.
+ *	- -1 if the connection failed.  It will be reconnected.
+ */
+static int mc_flush(mc_conn_t *h)
+{
+	ssize_t sent;
+
+	sent = write(h->fd, h->send.read, h->send.write - h->send.read);
+	if (sent < 0) {
+		switch (errno) {
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+		case EWOULDBLOCK:
+#endif
+		case EAGAIN:
+		case EINTR:
+		case ENOBUFS:
+		case ENOMEM:
+			return 1;
+
+		/*
+		 *	Will requeue any 'sent' lookups, so we
+		 *	don't have to do any cleanup.
+		 */
+		default:
+			ERROR("Failed writing to connection %s: %s", h->name, fr_syserror(errno));
+			fr_trunk_connection_signal_reconnect(h->tconn, FR_CONNECTION_FAILED);
+			return -1;
+		}
+	}
+
+	h->send.read += sent;
+	if (h->send.read < h->send.write) return 1;
+
+	h->send.read = h->send.write = h->send.data;
+
+	return 0;
+}
+
+/** The socket can take the rest of the send buffer
+ *
+ */
+static void conn_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	mc_conn_t		*h = talloc_get_type_abort(tconn->conn->h, mc_conn_t);
+
+	if (mc_flush(h) != 0) return;
+
+	/*
+	 *	Go back to the events the trunk asked for, and
+	 *	let it know it can send more commands.
+	 */
+	mc_conn_events(h);
+	if (h->notify_on & FR_TRUNK_CONN_EVENT_WRITE) fr_trunk_connection_signal_writable(tconn);
+}
+
+static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+			       UNUSED fr_event_list_t *el,
+			       fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	mc_conn_t		*h = talloc_get_type_abort(conn->h, mc_conn_t);
+
+	h->tconn = tconn;
+	h->notify_on = notify_on;
+
+	mc_conn_events(h);
+}
+
+/** Send commands in the order they were enqueued
+ *
+ */
+static int8_t request_prioritise(void const *one, void const *two)
+{
+	mc_request_t const *a = one;
+	mc_request_t const *b = two;
+
+	/*
+	 *	Opaque tokens wrap, so compare the distance between them.
+	 */
+	return CMP((int32_t)(a->opaque - b->opaque), 0);
+}
+
+/** Encode as many commands as will fit into the send buffer, and write them
+ *
+ * Once a command is in the send buffer it will be written before anything
+ * else on the connection, so it counts as sent.  Stores and deletes are
+ * complete at that point, as memcached only replies to them on failure.
+ */
+static void request_mux(UNUSED fr_event_list_t *el,
+			fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	mc_conn_t		*h = talloc_get_type_abort(conn->h, mc_conn_t);
+	size_t			max_cmd_len = MC_LINE_MAX + h->thread->inst->max_entry_size + 2;
+	bool			had_inflight = (fr_dlist_num_elements(&h->inflight) > 0);
+
+	h->tconn = tconn;
+
+	/*
+	 *	Commands from the last mux are still waiting
+	 *	to be written, conn_writable will tell the
+	 *	trunk when there's room for more.
+	 */
+	if (h->send.write != h->send.read) return;
+
+	while ((size_t)(h->send.end - h->send.write) >= max_cmd_len) {
+		fr_trunk_request_t	*treq;
+		mc_request_t		*mreq;
+
+		if (unlikely(fr_trunk_connection_pop_request(&treq, tconn) < 0)) return;
+
+		/*
+		 *	No more commands to send
+		 */
+		if (!treq) break;
+
+		mreq = talloc_get_type_abort(treq->preq, mc_request_t);
+
+		DEBUG3("Sending %s command (opaque %u) over connection %s",
+		       fr_table_str_by_value(mc_op_table, mreq->op, "<INVALID>"), mreq->opaque, h->name);
+
+		memcpy(h->send.write, mreq->cmd, mreq->cmd_len);
+		h->send.write += mreq->cmd_len;
+
+		fr_trunk_request_signal_sent(treq);
+
+		if (mreq->op != MC_OP_GET) {
+			fr_trunk_request_signal_complete(treq);
+			continue;
+		}
+
+		MEM(mreq->inflight = talloc(h, mc_inflight_t));
+		*mreq->inflight = (mc_inflight_t){
+			.opaque = mreq->opaque,
+			.treq = treq
+		};
+		fr_dlist_insert_tail(&h->inflight, mreq->inflight);
+	}
+
+	if (h->send.write == h->send.read) return;
+
+	/*
+	 *	Write all the commands with one system call.
+	 */
+	switch (mc_flush(h)) {
+	case -1:
+		return;
+
+	/*
+	 *	Wait until we can write the rest.
+	 */
+	case 1:
+		mc_conn_events(h);
+		return;
+
+	default:
+		/*
+		 *	If we only sent stores and deletes, the trunk
+		 *	won't ask us to read, but memcached may still
+		 *	reply to earlier lookups whose requests have
+		 *	gone away.
+		 */
+		if (!had_inflight && (fr_dlist_num_elements(&h->inflight) > 0)) mc_conn_events(h);
+		break;
+	}
+}
+
+/** Find a flag in a meta protocol reply
+ *
+ * @param[out] out	Where to write the flag's token.
+ * @param[in] flag	to look for.
+ * @param[in] p		Start of the flags.
+ * @param[in] end	End of the reply line.
+ * @return
+ *	- true if the flag was found.
+ *	- false if it wasn't.
+ */
+static bool mc_reply_flag(uint32_t *out, char flag, char const *p, char const *end)
+{
+	while (p < end) {
+		char const *q;
+
+		while ((p < end) && (*p == ' ')) p++;
+		if (p >= end) break;
+
+		for (q = p; (q < end) && (*q != ' '); q++);
+
+		if ((*p == flag) && (q > (p + 1))) {
+			unsigned long	value;
+			char		*num_end;
+
+			value = strtoul(p + 1, &num_end, 10);
+			if ((num_end != q) || (value > UINT32_MAX)) return false;
+
+			*out = (uint32_t)value;
+			return true;
+		}
+
+		p = q;
+	}
+
+	return false;
+}
+
+/** Read replies, and complete the lookups they're for
+ *
+ */
+static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn,
+			  fr_connection_t *conn, UNUSED void *uctx)
+{
+	mc_conn_t		*h = talloc_get_type_abort(conn->h, mc_conn_t);
+	bool			do_read = true;
+
+	while (true) {
+		ssize_t		slen;
+		size_t		used;
+		char		*line, *line_end, *p;
+		size_t		line_len, data_len = 0, reply_len;
+		uint32_t	opaque;
+		bool		has_opaque, is_value = false;
+		mc_inflight_t	*inflight;
+
+		/*
+		 *	Move what's left to the start of the buffer,
+		 *	so there's always room for a complete reply.
+		 */
+		if (h->recv.read != h->recv.data) {
+			used = h->recv.write - h->recv.read;
+
+			memmove(h->recv.data, h->recv.read, used);
+			h->recv.read = h->recv.data;
+			h->recv.write = h->recv.data + used;
+		}
+
+		if (do_read) {
+			slen = read(h->fd, h->recv.write, h->recv.end - h->recv.write);
+			if (slen == 0) {
+				ERROR("Connection %s closed by memcached", h->name);
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+				return;
+			}
+			if (slen < 0) {
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+
+				ERROR("Failed reading from connection %s: %s", h->name, fr_syserror(errno));
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+				return;
+			}
+
+			h->recv.write += slen;
+			do_read = (h->recv.write == h->recv.end);
+		}
+
+		/*
+		 *	Process every complete reply we have.
+		 */
+		while (true) {
+			used = h->recv.write - h->recv.read;
+
+			/*
+			 *	Skip the data of an entry we couldn't accept.
+			 */
+			if (h->discard) {
+				size_t skip = (h->discard < used) ? h->discard : used;
+
+				h->recv.read += skip;
+				h->discard -= skip;
+				if (h->discard) break;
+				continue;
+			}
+
+			line = (char *)h->recv.read;
+			line_end = memchr(line, '\n', used);
+			if (!line_end) {
+				if (used >= MC_LINE_MAX) {
+					ERROR("Reply from memcached on connection %s is too long", h->name);
+				reconnect:
+					fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+					return;
+				}
+				break;
+			}
+
+			line_len = line_end - line;
+			if ((line_len == 0) || (line[line_len - 1] != '\r')) {
+				ERROR("Malformed reply from memcached on connection %s", h->name);
+				goto reconnect;
+			}
+			line_len--;
+			line_end = line + line_len;
+			reply_len = line_len + 2;
+
+			if ((line_len < 2) || ((line_len > 2) && (line[2] != ' '))) {
+				/*
+				 *	CLIENT_ERROR, SERVER_ERROR and ERROR don't
+				 *	say which command they're for, so we can't
+				 *	tell whether we're still in step with the
+				 *	server.  Start again on a new connection.
+				 */
+				ERROR("memcached returned error on connection %s: %.*s",
+				      h->name, (int)line_len, line);
+				goto reconnect;
+			}
+
+			p = line + 2;
+			if ((line[0] == 'V') && (line[1] == 'A')) {
+				char		*num_end;
+				unsigned long	value;
+
+				value = strtoul(p, &num_end, 10);
+				if ((num_end == p) || ((*num_end != ' ') && (num_end != line_end))) {
+					ERROR("Malformed value reply from memcached on connection %s", h->name);
+					goto reconnect;
+				}
+				data_len = value;
+				p = num_end;
+				is_value = true;
+			}
+			has_opaque = mc_reply_flag(&opaque, 'O', p, line_end);
+
+			/*
+			 *	Wait for all of the entry's data, unless it's
+			 *	too large for us to accept, in which case we
+			 *	discard it as it arrives.
+			 */
+			if (is_value && (data_len <= h->thread->inst->max_entry_size)) {
+				if (used < (reply_len + data_len + 2)) break;
+			}
+
+			/*
+			 *	Is this the reply to the oldest lookup?
+			 */
+			inflight = fr_dlist_head(&h->inflight);
+			if (inflight && (!has_opaque || (inflight->opaque == opaque))) {
+				fr_dlist_remove(&h->inflight, inflight);
+
+				if (inflight->treq) {
+					fr_trunk_request_t	*treq = talloc_get_type_abort(inflight->treq, fr_trunk_request_t);
+					mc_request_t		*mreq = talloc_get_type_abort(treq->preq, mc_request_t);
+					mc_handle_t		*mh = talloc_get_type_abort(treq->rctx, mc_handle_t);
+					request_t		*request = treq->request;
+
+					mreq->inflight = NULL;
+					mh->fetched = true;
+
+					if (is_value && (data_len > h->thread->inst->max_entry_size)) {
+						REDEBUG("Entry is %lu bytes, larger than max_entry_size (%zu bytes)",
+							(unsigned long)data_len, h->thread->inst->max_entry_size);
+						mh->status = CACHE_ERROR;
+
+					} else if (is_value) {
+						RDEBUG2("Retrieved %zu bytes from memcached", data_len);
+						MEM(mh->data = talloc_array(mh, char, data_len + 1));
+						memcpy(mh->data, line + reply_len, data_len);
+						mh->data[data_len] = '\0';
+						mh->data_len = data_len;
+						mh->status = CACHE_OK;
+
+					} else if ((line[0] == 'E') && (line[1] == 'N')) {
+						mh->status = CACHE_MISS;
+
+					} else {
+						REDEBUG("Unexpected reply to lookup: %.*s", (int)line_len, line);
+						mh->status = CACHE_ERROR;
+					}
+
+					fr_trunk_request_signal_complete(treq);
+				}
+				talloc_free(inflight);
+
+			/*
+			 *	Stores and deletes are quiet, so memcached only
+			 *	replies if they failed.
+			 */
+			} else {
+				WARN("memcached failed to store or delete an entry (opaque %u): %.*s",
+				     has_opaque ? opaque : 0, (int)line_len, line);
+			}
+
+			h->recv.read += reply_len;
+			if (is_value) {
+				if (data_len <= h->thread->inst->max_entry_size) {
+					h->recv.read += data_len + 2;
+				} else {
+					h->discard = data_len + 2;
+				}
+			}
+		}
+
+		if (!do_read) return;
+	}
+}
+
+/** Stop tracking a request's reply
+ *
+ * If a lookup has been sent, memcached will still reply to it, so
+ * we leave a tombstone to discard the reply.
+ */
+static void request_conn_release(UNUSED fr_connection_t *conn, void *preq_to_reset, UNUSED void *uctx)
+{
+	mc_request_t	*mreq = talloc_get_type_abort(preq_to_reset, mc_request_t);
+
+	if (mreq->inflight) {
+		mreq->inflight->treq = NULL;
+		mreq->inflight = NULL;
+	}
+}
+
+/** The lookup failed, or a store or delete couldn't be sent
+ *
+ */
+static void request_fail(request_t *request, void *preq, void *rctx,
+			 UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	mc_request_t	*mreq = talloc_get_type_abort(preq, mc_request_t);
+	mc_handle_t	*mh;
+
+	if (mreq->op != MC_OP_GET) {
+		DEBUG("Failed sending %s command to memcached",
+		      fr_table_str_by_value(mc_op_table, mreq->op, "<INVALID>"));
+		return;
+	}
+
+	mh = talloc_get_type_abort(rctx, mc_handle_t);
+	mh->treq = NULL;
+	mh->fetched = true;
+	mh->status = CACHE_ERROR;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** The result of the lookup has been written to the handle
+ *
+ */
+static void request_complete(request_t *request, void *preq, void *rctx, UNUSED void *uctx)
+{
+	mc_request_t	*mreq = talloc_get_type_abort(preq, mc_request_t);
+	mc_handle_t	*mh;
+
+	if (mreq->op != MC_OP_GET) return;
+
+	mh = talloc_get_type_abort(rctx, mc_handle_t);
+	mh->treq = NULL;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+static void request_free(UNUSED request_t *request, void *preq_to_free, UNUSED void *uctx)
+{
+	mc_request_t	*mreq = talloc_get_type_abort(preq_to_free, mc_request_t);
+
+	fr_assert(!mreq->inflight);	/* Dealt with by request_conn_release */
+
+	talloc_free(mreq);
+}
+
+/** Base64 encode a key
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the key is too long.
+ */
+static int mc_key_encode(char out[static MC_KEY_ENC_MAX + 1], request_t *request, fr_value_box_t const *key)
+{
+	ssize_t slen;
+
+	if (key->vb_length > MC_KEY_MAX) {
+		ROPTIONAL(REDEBUG, ERROR, "Key \"%pV\" is too long, must be %u bytes or less", key, MC_KEY_MAX);
+		return -1;
+	}
+
+	slen = fr_base64_encode(&FR_SBUFF_OUT(out, MC_KEY_ENC_MAX + 1),
+				&FR_DBUFF_TMP((uint8_t const *)key->vb_strvalue, key->vb_length), true);
+	if (slen < 0) {
+		ROPTIONAL(RPEDEBUG, PERROR, "Failed encoding key");
+		return -1;
+	}
+	out[slen] = '\0';
+
+	return 0;
+}
+
+/** Allocate and enqueue a command
+ *
+ * @param[in] t		Thread instance.
+ * @param[in] request	to wake when the reply arrives, or NULL for commands we don't wait for.
+ * @param[in] mh	Handle to write the result to, or NULL for commands we don't wait for.
+ * @param[in] op	What the command does.
+ * @param[in] data	to append to the command.  May be NULL.
+ * @param[in] data_len	Length of data.
+ * @param[in] fmt	Command format string, without the opaque token and trailing CRLF.
+ * @return
+ *	- The new trunk request on success.
+ *	- NULL on failure.
+ */
+static fr_trunk_request_t *mc_enqueue(mc_thread_t *t, request_t *request, mc_handle_t *mh, mc_op_t op,
+				      char const *data, size_t data_len, char const *fmt, ...)
+				      CC_HINT(format (printf, 7, 8));
+static fr_trunk_request_t *mc_enqueue(mc_thread_t *t, request_t *request, mc_handle_t *mh, mc_op_t op,
+				      char const *data, size_t data_len, char const *fmt, ...)
+{
+	fr_trunk_request_t	*treq;
+	mc_request_t		*mreq;
+	fr_trunk_enqueue_t	q;
+	va_list			ap;
+	char			line[MC_LINE_MAX];
+	int			line_len;
+
+	treq = fr_trunk_request_alloc(t->trunk, request);
+	if (!treq) return NULL;
+
+	MEM(mreq = talloc_zero(treq, mc_request_t));
+	mreq->op = op;
+	mreq->opaque = t->opaque++;
+
+	va_start(ap, fmt);
+	line_len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	fr_assert((line_len > 0) && ((size_t)line_len < sizeof(line)));
+
+	line_len += snprintf(line + line_len, sizeof(line) - line_len, " O%u%s\r\n",
+			     mreq->opaque, (op == MC_OP_GET) ? "" : " q");
+	fr_assert((size_t)line_len < sizeof(line));
+
+	mreq->cmd_len = line_len + (data ? data_len + 2 : 0);
+	MEM(mreq->cmd = talloc_array(mreq, char, mreq->cmd_len));
+	memcpy(mreq->cmd, line, line_len);
+	if (data) {
+		memcpy(mreq->cmd + line_len, data, data_len);
+		memcpy(mreq->cmd + line_len + data_len, "\r\n", 2);
+	}
+
+	q = fr_trunk_request_enqueue(&treq, t->trunk, request, mreq, mh);
+	if (q < 0) {
+		ROPTIONAL(REDEBUG, ERROR, "Failed enqueueing %s command",
+			  fr_table_str_by_value(mc_op_table, op, "<INVALID>"));
+		fr_trunk_request_free(&treq);
+		return NULL;
+	}
+
+	/*
+	 *	All connections are down.  There's no point
+	 *	in waiting for them, a cache should be fast.
+	 */
+	if (q == FR_TRUNK_ENQUEUE_IN_BACKLOG) {
+		ROPTIONAL(REDEBUG, ERROR, "No connections to memcached available");
+		fr_trunk_request_signal_cancel(treq);
+		return NULL;
+	}
+
+	return treq;
+}
+
+/** Send a lookup for an entry
+ *
+ * @copydetails cache_entry_fetch_t
+ */
+static cache_status_t cache_entry_fetch(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					request_t *request, void *handle, fr_value_box_t const *key)
+{
+	mc_handle_t	*mh = talloc_get_type_abort(handle, mc_handle_t);
+	char		enc_key[MC_KEY_ENC_MAX + 1];
+
+	fr_assert(!mh->treq);
+
+	fr_value_box_clear(&mh->key);
+	TALLOC_FREE(mh->data);
+	mh->data_len = 0;
+	mh->fetched = false;
+
+	if (mc_key_encode(enc_key, request, key) < 0) return CACHE_ERROR;
+
+	if (unlikely(fr_value_box_copy(mh, &mh->key, key) < 0)) {
+		RERROR("Failed copying key");
+		return CACHE_ERROR;
+	}
+
+	mh->treq = mc_enqueue(mh->thread, request, mh, MC_OP_GET, NULL, 0,
+			      "mg %s b v", enc_key);
+	if (!mh->treq) return CACHE_ERROR;
+
+	return CACHE_OK;
+}
+
+/** Return the entry a lookup found
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+				       request_t *request, void *handle, fr_value_box_t const *key)
+{
+	mc_handle_t		*mh = talloc_get_type_abort(handle, mc_handle_t);
+	rlm_cache_entry_t	*c;
+	char			*data;
+	int			ret;
+
+	if (!mh->fetched || (fr_value_box_cmp(&mh->key, key) != 0)) {
+		REDEBUG("Entry for \"%pV\" was not fetched", key);
+		return CACHE_ERROR;
+	}
+
+	if (mh->status != CACHE_OK) return mh->status;
+
+	MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
+
+	/*
+	 *	Deserialising modifies the buffer, and
+	 *	the entry may be looked up more than once.
+	 */
+	MEM(data = talloc_memdup(c, mh->data, mh->data_len + 1));
+	ret = cache_deserialize(c, request->dict, data, mh->data_len);
+	talloc_free(data);
+	if (ret < 0) {
+		RPERROR("Invalid entry");
+	error:
+		talloc_free(c);
+		return CACHE_ERROR;
+	}
+	if (unlikely(fr_value_box_copy(c, &c->key, key) < 0)) {
+		RERROR("Failed copying key");
+		goto error;
+	}
+
+	*out = c;
+
+	return CACHE_OK;
+}
+
+/** Free an entry returned by cache_entry_find
+ *
+ * @copydetails cache_entry_free_t
+ */
+static void cache_entry_free(rlm_cache_entry_t *c)
+{
+	talloc_free(c);
+}
+
+/** Send a quiet store for an entry
+ *
+ * Completes as soon as the command is written.  memcached only replies
+ * if the store fails, and that is logged by the connection.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle, rlm_cache_entry_t const *c)
+{
+	rlm_cache_memcached_async_t const	*inst = talloc_get_type_abort_const(instance, rlm_cache_memcached_async_t);
+	mc_handle_t				*mh = talloc_get_type_abort(handle, mc_handle_t);
+	char					enc_key[MC_KEY_ENC_MAX + 1];
+	TALLOC_CTX				*pool;
+	char					*to_store;
+	size_t					len;
+
+	if (mc_key_encode(enc_key, request, &c->key) < 0) return CACHE_ERROR;
+
+	pool = talloc_pool(NULL, 1024);
+	if (!pool) return CACHE_ERROR;
+
+	if (cache_serialize(pool, &to_store, c) < 0) {
+		talloc_free(pool);
+		return CACHE_ERROR;
+	}
+
+	len = talloc_array_length(to_store) - 1;
+	if (len > inst->max_entry_size) {
+		REDEBUG("Entry is %zu bytes, larger than max_entry_size (%zu bytes)", len, inst->max_entry_size);
+		talloc_free(pool);
+		return CACHE_ERROR;
+	}
+
+	/*
+	 *	TTLs longer than 30 days are treated as
+	 *	absolute unix times, which is what we send.
+	 */
+	if (!mc_enqueue(mh->thread, NULL, NULL, MC_OP_SET, to_store, len,
+			"ms %s %zu b T%" PRIu64, enc_key, len, (uint64_t)fr_unix_time_to_sec(c->expires))) {
+		talloc_free(pool);
+		return CACHE_ERROR;
+	}
+	talloc_free(pool);
+
+	/*
+	 *	Any lookup result we have for this key is stale.
+	 */
+	if (mh->fetched && (fr_value_box_cmp(&mh->key, &c->key) == 0)) mh->fetched = false;
+
+	return CACHE_OK;
+}
+
+/** Send a quiet delete for an entry
+ *
+ * We don't wait for memcached to tell us whether the entry existed.
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					 request_t *request, void *handle, fr_value_box_t const *key)
+{
+	mc_handle_t	*mh = talloc_get_type_abort(handle, mc_handle_t);
+	char		enc_key[MC_KEY_ENC_MAX + 1];
+
+	if (mc_key_encode(enc_key, request, key) < 0) return CACHE_ERROR;
+
+	if (!mc_enqueue(mh->thread, NULL, NULL, MC_OP_DELETE, NULL, 0,
+			"md %s b", enc_key)) return CACHE_ERROR;
+
+	if (mh->fetched && (fr_value_box_cmp(&mh->key, key) == 0)) {
+		mh->status = CACHE_MISS;
+		TALLOC_FREE(mh->data);
+		mh->data_len = 0;
+	}
+
+	return CACHE_OK;
+}
+
+/** Allocate a handle to hold a lookup's result
+ *
+ * @copydetails cache_acquire_t
+ */
+static int mod_handle_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+			      request_t *request)
+{
+	rlm_cache_memcached_async_t const	*inst = talloc_get_type_abort_const(instance, rlm_cache_memcached_async_t);
+	mc_handle_t				*mh;
+
+	MEM(mh = talloc_zero(request, mc_handle_t));
+	mh->thread = talloc_get_type_abort(module_thread(inst->mi)->data, mc_thread_t);
+
+	*handle = mh;
+
+	return 0;
+}
+
+/** Free a handle, cancelling any outstanding lookup
+ *
+ * @copydetails cache_release_t
+ */
+static void mod_handle_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+			       UNUSED request_t *request, rlm_cache_handle_t *handle)
+{
+	mc_handle_t *mh = talloc_get_type_abort(handle, mc_handle_t);
+
+	if (mh->treq) fr_trunk_request_signal_cancel(mh->treq);
+
+	talloc_free(mh);
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_cache_memcached_async_t const	*inst = talloc_get_type_abort_const(mctx->mi->data,
+										    rlm_cache_memcached_async_t);
+	mc_thread_t				*t = talloc_get_type_abort(mctx->thread, mc_thread_t);
+
+	static fr_trunk_io_funcs_t		io_funcs = {
+							.connection_alloc = thread_conn_alloc,
+							.connection_notify = thread_conn_notify,
+							.request_prioritise = request_prioritise,
+							.request_mux = request_mux,
+							.request_demux = request_demux,
+							.request_conn_release = request_conn_release,
+							.request_complete = request_complete,
+							.request_fail = request_fail,
+							.request_free = request_free
+						};
+
+	t->inst = inst;
+	t->el = mctx->el;
+	t->trunk = fr_trunk_alloc(t, mctx->el, &io_funcs, &inst->trunk_conf, mctx->mi->name, t, false);
+	if (!t->trunk) return -1;
+
+	return 0;
+}
+
+/** Check the configuration, and remember our module instance
+ *
+ */
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_cache_memcached_async_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_memcached_async_t);
+	rlm_cache_config_t const	*config = talloc_get_type_abort_const(mctx->mi->parent->data, rlm_cache_config_t);
+
+	if (config->max_entries > 0) {
+		cf_log_err(mctx->mi->conf, "max_entries is not supported by this driver");
+		return -1;
+	}
+
+	FR_SIZE_BOUND_CHECK("max_entry_size", inst->max_entry_size, >=, (size_t)64);
+	FR_SIZE_BOUND_CHECK("max_entry_size", inst->max_entry_size, <=, (size_t)(1024 * 1024));
+
+	inst->mi = mctx->mi;
+
+	return 0;
+}
+
+extern rlm_cache_driver_t rlm_cache_memcached_async;
+rlm_cache_driver_t rlm_cache_memcached_async = {
+	.common = {
+		.magic			= MODULE_MAGIC_INIT,
+		.name			= "cache_memcached_async",
+		.inst_size		= sizeof(rlm_cache_memcached_async_t),
+		.inst_type		= "rlm_cache_memcached_async_t",
+		.config			= driver_config,
+
+		.instantiate		= mod_instantiate,
+
+		.thread_inst_size	= sizeof(mc_thread_t),
+		.thread_inst_type	= "mc_thread_t",
+		.thread_instantiate	= mod_thread_instantiate
+	},
+
+	.fetch		= cache_entry_fetch,
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.free		= cache_entry_free,
+
+	.acquire	= mod_handle_acquire,
+	.release	= mod_handle_release
+};
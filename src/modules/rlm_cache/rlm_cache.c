@@ -33,6 +33,8 @@ RCSID("$Id$")
 #include <freeradius-devel/server/rcode.h>
 #include <freeradius-devel/server/tmpl.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/types.h>
 #include <freeradius-devel/util/value.h>
 #include <freeradius-devel/unlang/xlat_func.h>
@@ -46,6 +48,14 @@ int submodule_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, con
 static int cache_key_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rules, CONF_ITEM *ci, char const *section_name1, char const *section_name2, void const *data, call_env_parser_t const *rule);
 static int cache_update_section_parse(TALLOC_CTX *ctx, call_env_parsed_head_t *out, tmpl_rules_t const *t_rules, CONF_ITEM *ci, char const *section_name1, char const *section_name2, void const *data, call_env_parser_t const *rule);
 
+static const conf_parser_t l1_config[] = {
+	{ FR_CONF_OFFSET("max_entries", rlm_cache_l1_config_t, max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("max_size", FR_TYPE_SIZE, 0, rlm_cache_l1_config_t, max_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("ttl", rlm_cache_l1_config_t, ttl), .dflt = "1s" },
+	{ FR_CONF_OFFSET("negative_ttl", rlm_cache_l1_config_t, negative_ttl), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_TYPE_FLAGS("driver", FR_TYPE_VOID, 0, rlm_cache_t, driver_submodule), .dflt = "rbtree",
 			 .func = submodule_parse },
@@ -55,14 +65,54 @@ static const conf_parser_t module_config[] = {
 	/* Should be a type which matches time_t, @fixme before 2038 */
 	{ FR_CONF_OFFSET("epoch", rlm_cache_config_t, epoch), .dflt = "0" },
 	{ FR_CONF_OFFSET("add_stats", rlm_cache_config_t, stats), .dflt = "no" },
+
+	{ FR_CONF_OFFSET_SUBSECTION("l1", 0, rlm_cache_t, l1, l1_config) },
 	CONF_PARSER_TERMINATOR
 };
 
+/** An entry in a thread's L1 tier
+ *
+ * Holds a private copy of an entry retrieved from the driver, or records
+ * that the driver had no entry for the key.
+ */
+typedef struct {
+	rlm_cache_entry_t	fields;			//!< Copy of the driver's entry.  Must come first.
+
+	fr_unix_time_t		l1_expires;		//!< When the copy must be revalidated with the driver.
+	bool			negative;		//!< The driver had no entry for this key.
+	size_t			size;			//!< Memory used by the copy.
+	fr_dlist_t		entry;			//!< Entry in the LRU list.
+} rlm_cache_l1_entry_t;
+
+/** Per-thread instance data
+ *
+ */
+typedef struct {
+	fr_hash_table_t		*l1;			//!< L1 entries, keyed by cache key.
+	fr_dlist_head_t		lru;			//!< L1 entries, most recently used first.
+	size_t			l1_size;		//!< Memory used by L1 entries.
+
+	uint64_t		l1_hits;		//!< Lookups answered with an entry from the L1 tier.
+	uint64_t		l1_negative_hits;	//!< Lookups answered with "not found" from the L1 tier.
+	uint64_t		l1_misses;		//!< Lookups which had to go to the driver.
+	uint64_t		l1_evictions;		//!< L1 entries evicted to stay within limits.
+	uint64_t		l2_hits;		//!< Driver lookups which found an entry.
+	uint64_t		l2_misses;		//!< Driver lookups which found nothing.
+} rlm_cache_thread_t;
+
 typedef struct {
 	fr_value_box_t		*key;			//!< To lookup the cache entry with.
 	map_list_t		*maps;			//!< Attribute map applied to cache entries.
 } cache_call_env_t;
 
+/** Carries a handle across an asynchronous fetch
+ *
+ */
+typedef struct {
+	rlm_cache_handle_t	*handle;		//!< Handle the entry is being fetched with.
+	cache_call_env_t	*env;			//!< Call env.  Xlats don't get it back when they resume.
+} rlm_cache_fetch_t;
+
 typedef struct {
 	fr_type_t		ktype;		//!< Key type
 
@@ -228,12 +278,227 @@ static rlm_cache_entry_t *cache_alloc(rlm_cache_t const *inst, request_t *reques
  */
 static void cache_free(rlm_cache_t const *inst, rlm_cache_entry_t **c)
 {
-	if (!c || !*c || !inst->driver->free) return;
+	if (!c || !*c) return;
+
+	/*
+	 *	Entries from the L1 tier belong to the thread,
+	 *	not the driver.
+	 */
+	if (talloc_get_type(*c, rlm_cache_l1_entry_t)) {
+		*c = NULL;
+		return;
+	}
+
+	if (!inst->driver->free) return;
 
 	inst->driver->free(*c);
 	*c = NULL;
 }
 
+static uint32_t cache_l1_entry_hash(void const *data)
+{
+	rlm_cache_entry_t const *c = data;
+
+	return fr_hash(c->key.vb_strvalue, c->key.vb_length);
+}
+
+static int8_t cache_l1_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key.vb_strvalue, key.vb_length);
+	return 0;
+}
+
+/** Remove an entry from a thread's L1 tier, and free it
+ *
+ */
+static void cache_l1_entry_free(rlm_cache_thread_t *t, rlm_cache_l1_entry_t *l1)
+{
+	fr_hash_table_remove(t->l1, l1);
+	fr_dlist_remove(&t->lru, l1);
+	t->l1_size -= l1->size;
+	talloc_free(l1);
+}
+
+/** Drop any L1 entry for a key
+ *
+ * Called whenever this thread modifies the key in the driver, so it doesn't
+ * go on serving a stale copy.  Other threads may serve their own copies until
+ * their L1 ttl passes.
+ */
+static void cache_l1_invalidate(rlm_cache_thread_t *t, fr_value_box_t const *key)
+{
+	rlm_cache_l1_entry_t	find = {};
+	rlm_cache_l1_entry_t	*l1;
+
+	if (!t->l1) return;
+
+	fr_value_box_copy_shallow(NULL, &find.fields.key, key);
+
+	l1 = fr_hash_table_find(t->l1, &find);
+	if (l1) cache_l1_entry_free(t, l1);
+}
+
+/** Find a live entry in a thread's L1 tier, discarding it if it's stale
+ *
+ */
+static rlm_cache_l1_entry_t *cache_l1_lookup(rlm_cache_t const *inst, rlm_cache_thread_t *t,
+					     request_t *request, fr_value_box_t const *key)
+{
+	rlm_cache_l1_entry_t	find = {};
+	rlm_cache_l1_entry_t	*l1;
+
+	if (!t->l1) return NULL;
+
+	fr_value_box_copy_shallow(NULL, &find.fields.key, key);
+
+	l1 = fr_hash_table_find(t->l1, &find);
+	if (!l1) return NULL;
+
+	if (fr_unix_time_lt(l1->l1_expires, fr_time_to_unix_time(request->packet->timestamp)) ||
+	    (!l1->negative && fr_unix_time_lt(l1->fields.created, fr_unix_time_from_sec(inst->config.epoch)))) {
+		cache_l1_entry_free(t, l1);
+		return NULL;
+	}
+
+	return l1;
+}
+
+/** Check whether a thread's L1 tier can answer a lookup, without counting it
+ *
+ */
+static inline bool cache_l1_peek(rlm_cache_t const *inst, rlm_cache_thread_t *t,
+				 request_t *request, fr_value_box_t const *key)
+{
+	return cache_l1_lookup(inst, t, request, key) != NULL;
+}
+
+/** Look for an entry in a thread's L1 tier
+ *
+ * @param[out] out	Where to write the entry.  NULL if the L1 tier didn't have
+ *			one, or knows the driver doesn't have one.
+ * @param[in] inst	Module instance.
+ * @param[in] t		Thread instance.
+ * @param[in] request	The current request.
+ * @param[in] key	to look up.
+ * @return
+ *	- 1 if the L1 tier answered.
+ *	- 0 if the driver must be consulted.
+ */
+static int cache_l1_find(rlm_cache_entry_t **out, rlm_cache_t const *inst, rlm_cache_thread_t *t,
+			 request_t *request, fr_value_box_t const *key)
+{
+	rlm_cache_l1_entry_t	*l1;
+
+	*out = NULL;
+
+	if (!t->l1) return 0;
+
+	l1 = cache_l1_lookup(inst, t, request, key);
+	if (!l1) {
+		t->l1_misses++;
+		return 0;
+	}
+
+	fr_dlist_remove(&t->lru, l1);
+	fr_dlist_insert_head(&t->lru, l1);
+
+	if (l1->negative) {
+		RDEBUG2("No cache entry for \"%pV\" (L1)", key);
+		t->l1_negative_hits++;
+		return 1;
+	}
+
+	RDEBUG2("Found entry for \"%pV\" (L1)", key);
+	t->l1_hits++;
+	l1->fields.hits++;
+	*out = &l1->fields;
+
+	return 1;
+}
+
+/** Record the result of a driver lookup in a thread's L1 tier
+ *
+ * The entry is copied, as the driver's entry is only valid until the
+ * handle is released.
+ *
+ * @param[in] inst	Module instance.
+ * @param[in] t		Thread instance.
+ * @param[in] request	The current request.
+ * @param[in] key	that was looked up.
+ * @param[in] c		Entry the driver returned, or NULL if it had none.
+ */
+static void cache_l1_insert(rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
+			    fr_value_box_t const *key, rlm_cache_entry_t const *c)
+{
+	rlm_cache_l1_entry_t	*l1;
+	map_t			*map = NULL;
+	fr_unix_time_t		now = fr_time_to_unix_time(request->packet->timestamp);
+
+	if (!t->l1) return;
+	if (!c && !fr_time_delta_ispos(inst->l1.negative_ttl)) return;
+
+	cache_l1_invalidate(t, key);
+
+	l1 = talloc_zero(t, rlm_cache_l1_entry_t);
+	if (!l1) return;
+	map_list_init(&l1->fields.maps);
+
+	if (unlikely(fr_value_box_copy(l1, &l1->fields.key, key) < 0)) {
+	error:
+		RWDEBUG("Failed copying entry for \"%pV\" into L1 tier", key);
+		talloc_free(l1);
+		return;
+	}
+
+	if (!c) {
+		l1->negative = true;
+		l1->l1_expires = fr_unix_time_add(now, inst->l1.negative_ttl);
+	} else {
+		l1->fields.hits = c->hits;
+		l1->fields.created = c->created;
+		l1->fields.expires = c->expires;
+
+		l1->l1_expires = fr_unix_time_add(now, inst->l1.ttl);
+		if (fr_unix_time_lt(c->expires, l1->l1_expires)) l1->l1_expires = c->expires;
+
+		while ((map = map_list_next(&c->maps, map))) {
+			map_t *c_map;
+
+			MEM(c_map = talloc_zero(l1, map_t));
+			c_map->op = map->op;
+			map_list_init(&c_map->child);
+
+			c_map->lhs = tmpl_copy(c_map, map->lhs);
+			c_map->rhs = tmpl_copy(c_map, map->rhs);
+			if (!c_map->lhs || !c_map->rhs) goto error;
+
+			map_list_insert_tail(&l1->fields.maps, c_map);
+		}
+	}
+
+	l1->size = talloc_total_size(l1);
+	if (inst->l1.max_size && (l1->size > inst->l1.max_size)) {
+		talloc_free(l1);
+		return;
+	}
+
+	/*
+	 *	Evict least recently used entries until
+	 *	the new one fits.
+	 */
+	while ((fr_hash_table_num_elements(t->l1) >= inst->l1.max_entries) ||
+	       (inst->l1.max_size && ((t->l1_size + l1->size) > inst->l1.max_size))) {
+		cache_l1_entry_free(t, fr_dlist_tail(&t->lru));
+		t->l1_evictions++;
+	}
+
+	if (!fr_hash_table_insert(t->l1, l1)) goto error;
+	fr_dlist_insert_head(&t->lru, l1);
+	t->l1_size += l1->size;
+}
+
 /** Merge a cached entry into a #request_t
  *
  * @return
@@ -332,7 +597,7 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 			fr_box_time(request->packet->timestamp));
 
 	expired:
-		inst->driver->expire(&inst->config, inst->driver_submodule->data, request, handle, key);
+		inst->driver->expire(&inst->config, inst->driver_submodule->data, request, *handle, key);
 		cache_free(inst, &c);
 		RETURN_MODULE_NOTFOUND;	/* Couldn't find a non-expired entry */
 	}
@@ -350,6 +615,206 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 	RETURN_MODULE_OK;
 }
 
+/** Find a cached entry, checking this thread's L1 tier before the driver
+ *
+ * Must only be used by callers which don't modify or re-insert the entry,
+ * as entries from the L1 tier are private copies.  The driver handle is only
+ * acquired if the L1 tier can't answer, so it may still be NULL on return.
+ *
+ * @return
+ *	- #RLM_MODULE_OK on cache hit.
+ *	- #RLM_MODULE_FAIL on failure.
+ *	- #RLM_MODULE_NOTFOUND on cache miss.
+ */
+static unlang_action_t cache_find_tiered(rlm_rcode_t *p_result, rlm_cache_entry_t **out,
+					 rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
+					 rlm_cache_handle_t **handle, fr_value_box_t const *key)
+{
+	rlm_rcode_t	rcode;
+
+	if (cache_l1_find(out, inst, t, request, key)) RETURN_MODULE_RCODE(*out ? RLM_MODULE_OK : RLM_MODULE_NOTFOUND);
+
+	if (!*handle && (cache_acquire(handle, inst, request) < 0)) RETURN_MODULE_FAIL;
+
+	cache_find(&rcode, out, inst, request, handle, key);
+	switch (rcode) {
+	case RLM_MODULE_OK:
+		t->l2_hits++;
+		cache_l1_insert(inst, t, request, key, *out);
+		break;
+
+	case RLM_MODULE_NOTFOUND:
+		t->l2_misses++;
+		cache_l1_insert(inst, t, request, key, NULL);
+		break;
+
+	default:
+		break;
+	}
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** Start an asynchronous fetch of the entry for a key
+ *
+ * @param[out] out	Where to write the fetch context, which holds the handle.
+ * @param[in] ctx	to allocate the fetch context in.
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in] env	Call env holding the key.
+ * @return
+ *	- 1 if the request must yield until the fetch completes.
+ *	- 0 if the entry can be found immediately.
+ *	- -1 on failure.
+ */
+static int cache_fetch_start(rlm_cache_fetch_t **out, TALLOC_CTX *ctx, rlm_cache_t const *inst,
+			     request_t *request, cache_call_env_t *env)
+{
+	rlm_cache_fetch_t	*fetch;
+
+	MEM(fetch = talloc_zero(ctx, rlm_cache_fetch_t));
+	fetch->env = env;
+
+	if (cache_acquire(&fetch->handle, inst, request) < 0) {
+	error:
+		talloc_free(fetch);
+		return -1;
+	}
+
+	switch (inst->driver->fetch(&inst->config, inst->driver_submodule->data, request, fetch->handle, env->key)) {
+	case CACHE_OK:
+		*out = fetch;
+		return 1;
+
+	case CACHE_MISS:
+		*out = fetch;
+		return 0;
+
+	default:
+		cache_release(inst, request, &fetch->handle);
+		goto error;
+	}
+}
+
+/** Take the handle an entry was fetched with, and free the fetch context
+ *
+ * @param[in] rctx	Fetch context, or NULL if there wasn't a fetch.
+ * @return The handle, or NULL if there wasn't a fetch.
+ */
+static rlm_cache_handle_t *cache_fetched(void *rctx)
+{
+	rlm_cache_fetch_t	*fetch;
+	rlm_cache_handle_t	*handle;
+
+	if (!rctx) return NULL;
+
+	fetch = talloc_get_type_abort(rctx, rlm_cache_fetch_t);
+	handle = fetch->handle;
+	talloc_free(fetch);
+
+	return handle;
+}
+
+/** Release the handle of a fetch which is still outstanding, cancelling it
+ *
+ */
+static void cache_fetch_signal(module_ctx_t const *mctx, request_t *request, UNUSED fr_signal_t action)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_cache_t);
+	rlm_cache_fetch_t	*fetch = talloc_get_type_abort(mctx->rctx, rlm_cache_fetch_t);
+
+	cache_release(inst, request, &fetch->handle);
+	talloc_free(fetch);
+}
+
+/** Fetch the entry for a key before running a method
+ *
+ * Only used with drivers that provide a #cache_entry_fetch_t callback.  The
+ * method is called again once the entry has been fetched, with mctx->rctx
+ * set, and must pick up the handle with cache_fetched().
+ */
+static unlang_action_t cache_fetch(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+				   module_method_t method)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_cache_t);
+	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
+	rlm_cache_fetch_t	*fetch;
+	module_ctx_t		fetched_mctx;
+
+	switch (cache_fetch_start(&fetch, request, inst, request, env)) {
+	case 1:
+		return unlang_module_yield(request, method, cache_fetch_signal, ~FR_SIGNAL_CANCEL, fetch);
+
+	case 0:
+		break;
+
+	default:
+		RETURN_MODULE_FAIL;
+	}
+
+	fetched_mctx = *mctx;
+	fetched_mctx.rctx = fetch;
+
+	return method(p_result, &fetched_mctx, request);
+}
+
+/** Release the handle of a fetch which is still outstanding, cancelling it
+ *
+ */
+static void cache_xlat_fetch_signal(xlat_ctx_t const *xctx, request_t *request, UNUSED fr_signal_t action)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(xctx->mctx->mi->data, rlm_cache_t);
+	rlm_cache_fetch_t	*fetch = talloc_get_type_abort(xctx->rctx, rlm_cache_fetch_t);
+
+	cache_release(inst, request, &fetch->handle);
+	talloc_free(fetch);
+}
+
+/** Fetch the entry for a key before running an xlat
+ *
+ * @param[out] handle	Where to write the handle the entry was fetched with.
+ *			NULL if no fetch was needed.
+ * @param[out] env	Where to write the call env.
+ * @param[in] xctx	xlat calling ctx.
+ * @param[in] request	The current request.
+ * @param[in] resume	xlat to call again once the entry has been fetched.
+ * @return
+ *	- XLAT_ACTION_YIELD if the xlat must yield.
+ *	- XLAT_ACTION_DONE if the xlat should carry on.
+ *	- XLAT_ACTION_FAIL on failure.
+ */
+static xlat_action_t cache_xlat_fetch(rlm_cache_handle_t **handle, cache_call_env_t **env,
+				      xlat_ctx_t const *xctx, request_t *request, xlat_func_t resume)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(xctx->mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(xctx->mctx->thread, rlm_cache_thread_t);
+	rlm_cache_fetch_t	*fetch;
+
+	if (xctx->rctx) {
+		fetch = talloc_get_type_abort(xctx->rctx, rlm_cache_fetch_t);
+		*env = fetch->env;
+		*handle = cache_fetched(fetch);
+		return XLAT_ACTION_DONE;
+	}
+
+	*env = talloc_get_type_abort(xctx->env_data, cache_call_env_t);
+	*handle = NULL;
+
+	if (!inst->driver->fetch || cache_l1_peek(inst, t, request, (*env)->key)) return XLAT_ACTION_DONE;
+
+	switch (cache_fetch_start(&fetch, request, inst, request, *env)) {
+	case 1:
+		return unlang_xlat_yield(request, resume, cache_xlat_fetch_signal, ~FR_SIGNAL_CANCEL, fetch);
+
+	case 0:
+		*handle = cache_fetched(fetch);
+		return XLAT_ACTION_DONE;
+
+	default:
+		return XLAT_ACTION_FAIL;
+	}
+}
+
 /** Expire a cache entry (removing it from the datastore)
  *
  * @return
@@ -358,10 +823,11 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
  *	- #RLM_MODULE_FAIL on failure.
  */
 static unlang_action_t cache_expire(rlm_rcode_t *p_result,
-				    rlm_cache_t const *inst, request_t *request,
+				    rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
 				    rlm_cache_handle_t **handle, fr_value_box_t const *key)
 {
 	RDEBUG2("Expiring cache entry");
+	cache_l1_invalidate(t, key);
 	for (;;) switch (inst->driver->expire(&inst->config, inst->driver_submodule->data, request, *handle, key)) {
 	case CACHE_RECONNECT:
 		if (cache_reconnect(handle, inst, request) == 0) continue;
@@ -386,7 +852,8 @@ static unlang_action_t cache_expire(rlm_rcode_t *p_result,
  *	- #RLM_MODULE_FAIL on failure.
  */
 static unlang_action_t cache_insert(rlm_rcode_t *p_result,
-				    rlm_cache_t const *inst, request_t *request, rlm_cache_handle_t **handle,
+				    rlm_cache_t const *inst, rlm_cache_thread_t *t,
+				    request_t *request, rlm_cache_handle_t **handle,
 				    fr_value_box_t const *key, map_list_t const *maps, fr_time_delta_t ttl)
 {
 	map_t			const *map = NULL;
@@ -398,8 +865,10 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 
 	TALLOC_CTX		*pool;
 
+	cache_l1_invalidate(t, key);
+
 	if ((inst->config.max_entries > 0) && inst->driver->count &&
-	    (inst->driver->count(&inst->config, inst->driver_submodule->data, request, handle) > inst->config.max_entries)) {
+	    (inst->driver->count(&inst->config, inst->driver_submodule->data, request, *handle) > inst->config.max_entries)) {
 		RWDEBUG("Cache is full: %d entries", inst->config.max_entries);
 		RETURN_MODULE_FAIL;
 	}
@@ -563,9 +1032,11 @@ skip_maps:
  *	- #RLM_MODULE_FAIL on failure.
  */
 static unlang_action_t cache_set_ttl(rlm_rcode_t *p_result,
-				     rlm_cache_t const *inst, request_t *request,
+				     rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
 				     rlm_cache_handle_t **handle, rlm_cache_entry_t *c)
 {
+	cache_l1_invalidate(t, &c->key);
+
 	/*
 	 *	Call the driver's insert method to overwrite the old entry
 	 */
@@ -622,9 +1093,10 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 {
 	rlm_cache_entry_t	*c = NULL;
 	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 
-	rlm_cache_handle_t	*handle;
+	rlm_cache_handle_t	*handle = NULL;
 
 	fr_dcursor_t		cursor;
 	fr_pair_t		*vp;
@@ -641,6 +1113,8 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 		RETURN_MODULE_INVALID;
 	}
 
+	handle = cache_fetched(mctx->rctx);
+
 	/*
 	 *	If Cache-Status-Only == yes, only return whether we found a
 	 *	valid cache entry
@@ -651,13 +1125,12 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 		RDEBUG3("status-only: yes");
 		REXDENT();
 
-		if (cache_acquire(&handle, inst, request) < 0) {
-			RETURN_MODULE_FAIL;
+		if (!mctx->rctx && inst->driver->fetch && !cache_l1_peek(inst, t, request, env->key)) {
+			return cache_fetch(p_result, mctx, request, mod_cache_it);
 		}
 
-		cache_find(&rcode, &c, inst, request, &handle, env->key);
+		cache_find_tiered(&rcode, &c, inst, t, request, &handle, env->key);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
-		fr_assert(!inst->driver->acquire || handle);
 
 		rcode = c ? RLM_MODULE_OK:
 			    RLM_MODULE_NOTFOUND;
@@ -693,16 +1166,32 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	RDEBUG3("expire : %s", expire ? "yes" : "no");
 	RDEBUG3("ttl    : %pV", fr_box_time_delta(ttl));
 	REXDENT();
-	if (cache_acquire(&handle, inst, request) < 0) {
-		RETURN_MODULE_FAIL;
+
+	/*
+	 *	Drivers which can't find entries without blocking fetch
+	 *	them first, unless the L1 tier can answer.
+	 */
+	if (!mctx->rctx && inst->driver->fetch &&
+	    !(merge && !expire && !set_ttl && cache_l1_peek(inst, t, request, env->key))) {
+		return cache_fetch(p_result, mctx, request, mod_cache_it);
 	}
 
 	/*
 	 *	Retrieve the cache entry and merge it with the current request
 	 *	recording whether the entry existed.
+	 *
+	 *	If we're not about to modify the entry, this thread's L1 tier
+	 *	may be able to answer without going to the driver.
 	 */
 	if (merge) {
-		cache_find(&rcode, &c, inst, request, &handle, env->key);
+		if (!expire && !set_ttl) {
+			cache_find_tiered(&rcode, &c, inst, t, request, &handle, env->key);
+		} else {
+			if (!handle && (cache_acquire(&handle, inst, request) < 0)) {
+				RETURN_MODULE_FAIL;
+			}
+			cache_find(&rcode, &c, inst, request, &handle, env->key);
+		}
 		switch (rcode) {
 		case RLM_MODULE_FAIL:
 			goto finish;
@@ -720,7 +1209,16 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 		default:
 			fr_assert(0);
 		}
-		fr_assert(!inst->driver->acquire || handle);
+	}
+
+	/*
+	 *	Anything else we do needs the driver
+	 */
+	if (!handle && (expire || set_ttl || (insert && (exists != 1)))) {
+		if (cache_acquire(&handle, inst, request) < 0) {
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
 	}
 
 	/*
@@ -735,7 +1233,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 			rlm_rcode_t tmp;
 
 			fr_assert(!set_ttl);
-			cache_expire(&tmp, inst, request, &handle, env->key);
+			cache_expire(&tmp, inst, t, request, &handle, env->key);
 			switch (tmp) {
 			case RLM_MODULE_FAIL:
 				rcode = RLM_MODULE_FAIL;
@@ -798,7 +1296,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 
 		c->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
 
-		cache_set_ttl(&tmp, inst, request, &handle, c);
+		cache_set_ttl(&tmp, inst, t, request, &handle, c);
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
 			rcode = RLM_MODULE_FAIL;
@@ -823,7 +1321,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	if (insert && (exists == 0)) {
 		rlm_rcode_t tmp;
 
-		cache_insert(&tmp, inst, request, &handle, env->key, env->maps, ttl);
+		cache_insert(&tmp, inst, t, request, &handle, env->key, env->maps, ttl);
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
 			rcode = RLM_MODULE_FAIL;
@@ -892,8 +1390,9 @@ xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 {
 	rlm_cache_entry_t 		*c = NULL;
 	rlm_cache_t			*inst = talloc_get_type_abort(xctx->mctx->mi->data, rlm_cache_t);
-	cache_call_env_t		*env = talloc_get_type_abort(xctx->env_data, cache_call_env_t);
-	rlm_cache_handle_t		*handle = NULL;
+	rlm_cache_thread_t		*t = talloc_get_type_abort(xctx->mctx->thread, rlm_cache_thread_t);
+	cache_call_env_t		*env;
+	rlm_cache_handle_t		*handle;
 
 	ssize_t				slen;
 
@@ -903,6 +1402,10 @@ xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	tmpl_t				*target = NULL;
 	map_t				*map = NULL;
 	rlm_rcode_t			rcode = RLM_MODULE_NOOP;
+	xlat_action_t			xa;
+
+	xa = cache_xlat_fetch(&handle, &env, xctx, request, cache_xlat);
+	if (xa != XLAT_ACTION_DONE) return xa;
 
 	slen = tmpl_afrom_attr_substr(ctx, NULL, &target,
 				      &FR_SBUFF_IN(attr->vb_strvalue, attr->vb_length),
@@ -916,15 +1419,11 @@ xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 				      });
 	if (slen <= 0) {
 		RPEDEBUG("Invalid key");
+		cache_release(inst, request, &handle);
 		return XLAT_ACTION_FAIL;
 	}
 
-	if (cache_acquire(&handle, inst, request) < 0) {
-		talloc_free(target);
-		return XLAT_ACTION_FAIL;
-	}
-
-	cache_find(&rcode, &c, inst, request, &handle, env->key);
+	cache_find_tiered(&rcode, &c, inst, t, request, &handle, env->key);
 	switch (rcode) {
 	case RLM_MODULE_OK:		/* found */
 		break;
@@ -965,18 +1464,19 @@ static xlat_action_t cache_ttl_get_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 
 	rlm_cache_entry_t	*c = NULL;
 	rlm_cache_t		*inst = talloc_get_type_abort(xctx->mctx->mi->data, rlm_cache_t);
-	cache_call_env_t	*env = talloc_get_type_abort(xctx->env_data, cache_call_env_t);
-	rlm_cache_handle_t	*handle = NULL;
+	rlm_cache_thread_t	*t = talloc_get_type_abort(xctx->mctx->thread, rlm_cache_thread_t);
+	cache_call_env_t	*env;
+	rlm_cache_handle_t	*handle;
 
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 
 	fr_value_box_t		*vb;
+	xlat_action_t		xa;
 
-	if (cache_acquire(&handle, inst, request) < 0) {
-		return XLAT_ACTION_FAIL;
-	}
+	xa = cache_xlat_fetch(&handle, &env, xctx, request, cache_ttl_get_xlat);
+	if (xa != XLAT_ACTION_DONE) return xa;
 
-	cache_find(&rcode, &c, inst, request, &handle, env->key);
+	cache_find_tiered(&rcode, &c, inst, t, request, &handle, env->key);
 	switch (rcode) {
 	case RLM_MODULE_OK:		/* found */
 		break;
@@ -996,6 +1496,49 @@ static xlat_action_t cache_ttl_get_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	return XLAT_ACTION_DONE;
 }
 
+static fr_table_num_sorted_t const cache_stats_table[] = {
+	{ L("l1.evictions"),		offsetof(rlm_cache_thread_t, l1_evictions)	},
+	{ L("l1.hits"),			offsetof(rlm_cache_thread_t, l1_hits)		},
+	{ L("l1.misses"),		offsetof(rlm_cache_thread_t, l1_misses)		},
+	{ L("l1.negative_hits"),	offsetof(rlm_cache_thread_t, l1_negative_hits)	},
+	{ L("l2.hits"),			offsetof(rlm_cache_thread_t, l2_hits)		},
+	{ L("l2.misses"),		offsetof(rlm_cache_thread_t, l2_misses)		}
+};
+static size_t cache_stats_table_len = NUM_ELEMENTS(cache_stats_table);
+
+/** Return one of the calling thread's per-tier counters
+ *
+ * The tiers are "l1" (the per-thread tier) and "l2" (the driver).
+ *
+ * Example:
+@verbatim
+%cache.stats('l1.hits')
+@endverbatim
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t cache_stats_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
+				      xlat_ctx_t const *xctx,
+				      request_t *request, fr_value_box_list_t *in)
+{
+	rlm_cache_thread_t	*t = talloc_get_type_abort(xctx->mctx->thread, rlm_cache_thread_t);
+	fr_value_box_t		*name = fr_value_box_list_head(in);
+	fr_value_box_t		*vb;
+	int			offset;
+
+	offset = fr_table_value_by_str(cache_stats_table, name->vb_strvalue, -1);
+	if (offset < 0) {
+		REDEBUG("Unknown counter \"%pV\"", name);
+		return XLAT_ACTION_FAIL;
+	}
+
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT64, NULL));
+	vb->vb_uint64 = *(uint64_t *)((uint8_t *)t + offset);
+	fr_dcursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
+}
+
 /** Release the allocated resources and cleanup the avps
  */
 static void cache_unref(request_t *request, rlm_cache_t const *inst, rlm_cache_entry_t *entry,
@@ -1045,6 +1588,7 @@ static void cache_unref(request_t *request, rlm_cache_t const *inst, rlm_cache_e
 static unlang_action_t CC_HINT(nonnull) mod_method_status(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 	rlm_cache_entry_t 	*entry = NULL;
@@ -1055,14 +1599,12 @@ static unlang_action_t CC_HINT(nonnull) mod_method_status(rlm_rcode_t *p_result,
 		RETURN_MODULE_FAIL;
 	}
 
-	/* Good to go? */
-	if (cache_acquire(&handle, inst, request) < 0) {
-		RETURN_MODULE_FAIL;
+	if (!mctx->rctx && inst->driver->fetch && !cache_l1_peek(inst, t, request, env->key)) {
+		return cache_fetch(p_result, mctx, request, mod_method_status);
 	}
+	handle = cache_fetched(mctx->rctx);
 
-	fr_assert(!inst->driver->acquire || handle);
-
-	cache_find(&rcode, &entry, inst, request, &handle, env->key);
+	cache_find_tiered(&rcode, &entry, inst, t, request, &handle, env->key);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	rcode = (entry) ? RLM_MODULE_OK : RLM_MODULE_NOTFOUND;
@@ -1083,6 +1625,7 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_load(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 	rlm_cache_entry_t 	*entry = NULL;
@@ -1093,12 +1636,12 @@ static unlang_action_t CC_HINT(nonnull) mod_method_load(rlm_rcode_t *p_result, m
 		RETURN_MODULE_FAIL;
 	}
 
-	/* Good to go? */
-	if (cache_acquire(&handle, inst, request) < 0) {
-		RETURN_MODULE_FAIL;
+	if (!mctx->rctx && inst->driver->fetch && !cache_l1_peek(inst, t, request, env->key)) {
+		return cache_fetch(p_result, mctx, request, mod_method_load);
 	}
+	handle = cache_fetched(mctx->rctx);
 
-	cache_find(&rcode, &entry, inst, request, &handle, env->key);
+	cache_find_tiered(&rcode, &entry, inst, t, request, &handle, env->key);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (!entry) {
@@ -1125,6 +1668,7 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_update(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 	fr_time_delta_t		ttl;
@@ -1138,8 +1682,11 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(rlm_rcode_t *p_result,
 		RETURN_MODULE_FAIL;
 	}
 
+	if (!mctx->rctx && inst->driver->fetch) return cache_fetch(p_result, mctx, request, mod_method_update);
+	handle = cache_fetched(mctx->rctx);
+
 	/* Good to go? */
-	if (cache_acquire(&handle, inst, request) < 0) {
+	if (!handle && (cache_acquire(&handle, inst, request) < 0)) {
 		RETURN_MODULE_FAIL;
 	}
 
@@ -1172,7 +1719,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(rlm_rcode_t *p_result,
 
 		entry->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
 
-		cache_set_ttl(&rcode, inst, request, &handle, entry);
+		cache_set_ttl(&rcode, inst, t, request, &handle, entry);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
 	}
 
@@ -1186,7 +1733,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(rlm_rcode_t *p_result,
 	if (expire) {
 		DEBUG3("Expiring cache entry");
 
-		cache_expire(&rcode, inst, request, &handle, env->key);
+		cache_expire(&rcode, inst, t, request, &handle, env->key);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
 	}
 
@@ -1194,7 +1741,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(rlm_rcode_t *p_result,
 	 *	Inserts are upserts, so we don't care about the
 	 *	entry state.
 	 */
-	cache_insert(&rcode, inst, request, &handle, env->key, env->maps, ttl);
+	cache_insert(&rcode, inst, t, request, &handle, env->key, env->maps, ttl);
 	if (rcode == RLM_MODULE_OK) rcode = RLM_MODULE_UPDATED;
 
 finish:
@@ -1213,6 +1760,7 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_store(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 	fr_time_delta_t		ttl;
@@ -1225,9 +1773,10 @@ static unlang_action_t CC_HINT(nonnull) mod_method_store(rlm_rcode_t *p_result,
 		RETURN_MODULE_FAIL;
 	}
 
-	if (cache_acquire(&handle, inst, request) < 0) {
-		RETURN_MODULE_FAIL;
+	if (!mctx->rctx && inst->driver->fetch && !cache_l1_peek(inst, t, request, env->key)) {
+		return cache_fetch(p_result, mctx, request, mod_method_store);
 	}
+	handle = cache_fetched(mctx->rctx);
 
 	/* Process the TTL */
 	ttl = inst->config.ttl; /* Set the default value from cache { ttl=... } */
@@ -1239,9 +1788,9 @@ static unlang_action_t CC_HINT(nonnull) mod_method_store(rlm_rcode_t *p_result,
 	}
 
 	/*
-	 *	We can only alter the TTL on an entry if it exists.
+	 *	We only insert if there's no existing entry.
 	 */
-	cache_find(&rcode, &entry, inst, request, &handle, env->key);
+	cache_find_tiered(&rcode, &entry, inst, t, request, &handle, env->key);
 	switch (rcode) {
 	default:
 	case RLM_MODULE_OK:
@@ -1255,13 +1804,18 @@ static unlang_action_t CC_HINT(nonnull) mod_method_store(rlm_rcode_t *p_result,
 		break;
 	}
 
+	if (!handle && (cache_acquire(&handle, inst, request) < 0)) {
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
 	/*
 	 *	Inserts are upserts, so we don't care about the
 	 *	entry state, just that we're not meant to be
 	 *	setting the TTL, which precludes performing an
 	 *	insert.
 	 */
-	cache_insert(&rcode, inst, request, &handle, env->key, env->maps, ttl);
+	cache_insert(&rcode, inst, t, request, &handle, env->key, env->maps, ttl);
 
 finish:
 	cache_unref(request, inst, entry, handle);
@@ -1280,6 +1834,7 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_clear(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 	rlm_cache_entry_t 	*entry = NULL;
@@ -1292,8 +1847,11 @@ static unlang_action_t CC_HINT(nonnull) mod_method_clear(rlm_rcode_t *p_result,
 		RETURN_MODULE_FAIL;
 	}
 
+	if (!mctx->rctx && inst->driver->fetch) return cache_fetch(p_result, mctx, request, mod_method_clear);
+	handle = cache_fetched(mctx->rctx);
+
 	/* Good to go? */
-	if (cache_acquire(&handle, inst, request) < 0) {
+	if (!handle && (cache_acquire(&handle, inst, request) < 0)) {
 		RETURN_MODULE_FAIL;
 	}
 
@@ -1306,7 +1864,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_clear(rlm_rcode_t *p_result,
 		goto finish;
 	}
 
-	cache_expire(&rcode, inst, request, &handle, env->key);
+	cache_expire(&rcode, inst, t, request, &handle, env->key);
 
 finish:
 	cache_unref(request, inst, entry, handle);
@@ -1324,6 +1882,7 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_ttl(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 	fr_time_delta_t		ttl;
@@ -1338,8 +1897,11 @@ static unlang_action_t CC_HINT(nonnull) mod_method_ttl(rlm_rcode_t *p_result, mo
 		RETURN_MODULE_FAIL;
 	}
 
+	if (!mctx->rctx && inst->driver->fetch) return cache_fetch(p_result, mctx, request, mod_method_ttl);
+	handle = cache_fetched(mctx->rctx);
+
 	/* Good to go? */
-	if (cache_acquire(&handle, inst, request) < 0) {
+	if (!handle && (cache_acquire(&handle, inst, request) < 0)) {
 		RETURN_MODULE_FAIL;
 	}
 
@@ -1370,7 +1932,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_ttl(rlm_rcode_t *p_result, mo
 
 		entry->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
 
-		cache_set_ttl(&rcode, inst, request, &handle, entry);
+		cache_set_ttl(&rcode, inst, t, request, &handle, entry);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
 
 		rcode = RLM_MODULE_UPDATED;
@@ -1402,6 +1964,26 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	return 0;
 }
 
+/** Allocate this thread's L1 tier
+ *
+ */
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
+
+	if (inst->l1.max_entries == 0) return 0;
+
+	t->l1 = fr_hash_table_alloc(t, cache_l1_entry_hash, cache_l1_entry_cmp, NULL);
+	if (!t->l1) {
+		ERROR("Failed allocating L1 cache tier");
+		return -1;
+	}
+	fr_dlist_talloc_init(&t->lru, rlm_cache_l1_entry_t, entry);
+
+	return 0;
+}
+
 /** Verify that a map in the cache section makes sense
  *
  */
@@ -1463,6 +2045,7 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	fr_assert(inst->driver->find);
 	fr_assert(inst->driver->insert);
 	fr_assert(inst->driver->expire);
+	fr_assert(!inst->driver->fetch || (inst->driver->acquire && inst->driver->release));
 
 	if (!fr_time_delta_ispos(inst->config.ttl)) {
 		cf_log_err(conf, "Must set 'ttl' to non-zero");
@@ -1474,6 +2057,11 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	if ((inst->l1.max_entries > 0) && !fr_time_delta_ispos(inst->l1.ttl)) {
+		cf_log_err(conf, "Must set 'l1.ttl' to non-zero");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -1494,6 +2082,9 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	xlat = xlat_func_register_module(mctx->mi->boot, mctx, "ttl.get", cache_ttl_get_xlat, FR_TYPE_VOID);
 	xlat_func_call_env_set(xlat, &cache_method_env);
 
+	xlat = xlat_func_register_module(mctx->mi->boot, mctx, "stats", cache_stats_xlat, FR_TYPE_UINT64);
+	xlat_func_args_set(xlat, cache_xlat_args);
+
 	return 0;
 }
 
@@ -1514,7 +2105,11 @@ module_rlm_t rlm_cache = {
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
 		.instantiate	= mod_instantiate,
-		.detach		= mod_detach
+		.detach		= mod_detach,
+
+		.thread_inst_size	= sizeof(rlm_cache_thread_t),
+		.thread_inst_type	= "rlm_cache_thread_t",
+		.thread_instantiate	= mod_thread_instantiate
 	},
 	.method_names = (module_method_name_t[]){
 		{ .name1 = "status", .name2 = CF_IDENT_ANY,		.method = mod_method_status,	.method_env = &cache_method_env },
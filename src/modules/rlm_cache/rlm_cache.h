@@ -55,6 +55,18 @@ typedef struct {
 	bool			stats;			//!< Generate statistics.
 } rlm_cache_config_t;
 
+/** Configuration for the per-thread L1 tier
+ *
+ */
+typedef struct {
+	uint32_t		max_entries;		//!< Maximum entries each thread may hold.  0 disables the tier.
+	size_t			max_size;		//!< Maximum memory each thread's entries may use.  0 for no limit.
+	fr_time_delta_t		ttl;			//!< How long an entry may be served from the tier
+							///< before the driver is consulted again.
+	fr_time_delta_t		negative_ttl;		//!< How long to remember that the driver had no entry.
+							///< 0 disables negative caching.
+} rlm_cache_l1_config_t;
+
 /*
  *	Define a structure for our module configuration.
  *
@@ -67,6 +79,8 @@ typedef struct {
 
 	module_instance_t	*driver_submodule;	//!< Driver's instance data.
 	rlm_cache_driver_t const *driver;		//!< Driver's exported interface.
+
+	rlm_cache_l1_config_t	l1;			//!< Per-thread L1 tier configuration.
 } rlm_cache_t;
 
 typedef struct {
@@ -196,6 +210,38 @@ typedef cache_status_t	(*cache_entry_set_ttl_t)(rlm_cache_config_t const *config
 						 request_t *request, void *handle,
 						 rlm_cache_entry_t *c);
 
+/** Start retrieving an entry from the cache asynchronously
+ *
+ * @note This callback is optional.  Drivers which provide it must also provide
+ *	#cache_acquire_t and #cache_release_t, as the result of the fetch is kept
+ *	in the handle.
+ *
+ * If provided, rlm_cache calls it with a freshly acquired handle before any
+ * operation which may need #cache_entry_find_t.  If the driver needs to wait
+ * for I/O it should return #CACHE_OK, and call unlang_interpret_mark_runnable()
+ * once the result has been stored in the handle.  The request yields until then.
+ *
+ * #cache_entry_find_t is then called with the same handle and key, and must
+ * return the fetched result without blocking.
+ *
+ * If the request is cancelled whilst the fetch is outstanding, rlm_cache
+ * releases the handle.  #cache_release_t must cancel the fetch.
+ *
+ * @param[in] config for this instance of the rlm_cache module.
+ * @param[in] instance Driver specific instance data.
+ * @param[in] request The current request.
+ * @param[in] handle the driver gave us when we called #cache_acquire_t.
+ * @param[in] key of the entry to retrieve.
+ * @return
+ *	- #CACHE_ERROR - If the fetch couldn't be started.
+ *	- #CACHE_OK - If the fetch is in progress, and the request should yield.
+ *	- #CACHE_MISS - If there is nothing to wait for, and #cache_entry_find_t
+ *	  may be called immediately.
+ */
+typedef cache_status_t	(*cache_entry_fetch_t)(rlm_cache_config_t const *config, void *instance,
+					       request_t *request, void *handle,
+					       fr_value_box_t const *key);
+
 /** Get the number of entries in the cache
  *
  * @note This callback is optional. Though max_entries will not be enforced if it is not provided.
@@ -260,6 +306,8 @@ struct rlm_cache_driver_s {
 	cache_entry_alloc_t		alloc;			//!< (optional) Allocate a new entry.
 	cache_entry_free_t		free;			//!< (optional) Free memory used by an entry.
 
+	cache_entry_fetch_t		fetch;			//!< (optional) Start retrieving an existing cache
+								///< entry, without blocking.
 	cache_entry_find_t		find;			//!< Retrieve an existing cache entry.
 	cache_entry_insert_t		insert;			//!< Add a new entry.
 	cache_entry_expire_t		expire;			//!< Remove an old entry.
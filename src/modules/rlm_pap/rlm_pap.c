@@ -28,6 +28,7 @@ USES_APPLE_DEPRECATED_API
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module_rlm.h>
+#include <freeradius-devel/server/offload.h>
 #include <freeradius-devel/server/password.h>
 #include <freeradius-devel/tls/base.h>
 #include <freeradius-devel/tls/log.h>
@@ -39,6 +40,7 @@ USES_APPLE_DEPRECATED_API
 #include <freeradius-devel/util/sha1.h>
 
 #include <freeradius-devel/unlang/call_env.h>
+#include <freeradius-devel/unlang/module.h>
 
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.password.h>
 
@@ -73,12 +75,21 @@ static pthread_mutex_t fr_crypt_mutex = PTHREAD_MUTEX_INITIALIZER;
 typedef struct {
 	fr_dict_enum_value_t	*auth_type;
 	bool			normify;
+
+	fr_offload_conf_t	offload_conf;		//!< For hashing crypt and PBKDF2 passwords.
+	fr_offload_t		*offload;		//!< NULL if threads = 0.  Allocated outside of the
+							///< instance data, which is made read-only.
 } rlm_pap_t;
 
-typedef unlang_action_t (*pap_auth_func_t)(rlm_rcode_t *p_result, rlm_pap_t const *inst, request_t *request, fr_pair_t const *, fr_value_box_t const *);
+typedef struct {
+	fr_offload_thread_t	*offload;		//!< NULL if there's no offload pool.
+} rlm_pap_thread_t;
+
+typedef unlang_action_t (*pap_auth_func_t)(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, fr_pair_t const *, fr_value_box_t const *);
 
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("normalise", rlm_pap_t, normify), .dflt = "yes" },
+	{ FR_CONF_OFFSET_SUBSECTION("offload", 0, rlm_pap_t, offload_conf, fr_offload_config) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -178,7 +189,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
  */
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_clear(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       UNUSED module_ctx_t const *mctx, request_t *request,
 						       fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	if ((known_good->vp_length != password->vb_length) ||
@@ -191,49 +202,173 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_clear(rlm_rcode_t *p_result,
 	RETURN_MODULE_OK;
 }
 
+/** Log the result of comparing the passwords
+ *
+ */
+static unlang_action_t CC_HINT(nonnull) pap_auth_result(rlm_rcode_t *p_result, request_t *request, rlm_rcode_t rcode)
+{
+	switch (rcode) {
+	case RLM_MODULE_REJECT:
+		REDEBUG("Password incorrect");
+		break;
+
+	case RLM_MODULE_OK:
+		RDEBUG2("User authenticated successfully");
+		break;
+
+	default:
+		break;
+	}
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** The request was cancelled while hashing was offloaded
+ *
+ */
+static void pap_offload_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	fr_offload_cancel(mctx->rctx);
+}
+
+/** Check how an offloaded hashing job ended
+ *
+ * @param[in] request	The current request.
+ * @param[in] job	which has come back from the offload pool.
+ * @param[in] name	of the password type, for logging.
+ * @return
+ *	- true if the hash was calculated.
+ *	- false if it wasn't.
+ */
+static bool pap_offload_done(request_t *request, fr_offload_job_t *job, char const *name)
+{
+	switch (fr_offload_job_state(job)) {
+	case FR_OFFLOAD_JOB_DONE:
+		return true;
+
+	case FR_OFFLOAD_JOB_EXPIRED:
+		REDEBUG("Offload pool was too busy to calculate %s digest in time", name);
+		return false;
+
+	default:
+		REDEBUG("Offloaded %s digest was not calculated", name);
+		return false;
+	}
+}
+
+/** Submit a hashing job to the offload pool, and yield until it's done
+ *
+ */
+static unlang_action_t pap_offload(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+				   char const *name, fr_offload_func_t func, void *uctx, module_method_t resume)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+	fr_offload_job_t	*job;
+
+	job = fr_offload_submit(t->offload, request, func, uctx);
+	if (!job) {
+		RPERROR("Failed offloading %s digest", name);
+		talloc_free(uctx);
+		RETURN_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, resume, pap_offload_signal, ~FR_SIGNAL_CANCEL, job);
+}
+
 #ifdef HAVE_CRYPT
-static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
-						       fr_pair_t const *known_good, fr_value_box_t const *password)
+typedef struct {
+	char const	*password;			//!< From the request.
+	char const	*known_good;			//!< Password.Crypt.
+	bool		match;				//!< Whether they matched.
+} pap_crypt_job_t;
+
+/** Hash a password with crypt(), possibly in an offload thread
+ *
+ */
+static void pap_crypt_run(void *uctx)
 {
-	char	*crypt_out;
-	int	cmp = 0;
+	pap_crypt_job_t	*cj = uctx;
+	char		*crypt_out;
+	int		cmp = 0;
 
 #ifdef HAVE_CRYPT_R
 	struct crypt_data crypt_data = { .initialized = 0 };
 
-	crypt_out = crypt_r(password->vb_strvalue, known_good->vp_strvalue, &crypt_data);
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	crypt_out = crypt_r(cj->password, cj->known_good, &crypt_data);
+	if (crypt_out) cmp = strcmp(cj->known_good, crypt_out);
 #else
 	/*
 	 *	Ensure we're thread-safe, as crypt() isn't.
 	 */
 	pthread_mutex_lock(&fr_crypt_mutex);
-	crypt_out = crypt(password->vb_strvalue, known_good->vp_strvalue);
+	crypt_out = crypt(cj->password, cj->known_good);
 
 	/*
 	 *	Got something, check it within the lock.  This is
 	 *	faster than copying it to a local buffer, and the
 	 *	time spent within the lock is critical.
 	 */
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	if (crypt_out) cmp = strcmp(cj->known_good, crypt_out);
 	pthread_mutex_unlock(&fr_crypt_mutex);
 #endif
 
-	/*
-	 *	Error.
-	 */
-	if (!crypt_out || (cmp != 0)) {
+	cj->match = (crypt_out && (cmp == 0));
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_crypt_result(rlm_rcode_t *p_result, request_t *request,
+							 pap_crypt_job_t const *cj)
+{
+	if (!cj->match) {
 		REDEBUG("Crypt digest does not match \"known good\" digest");
 		RETURN_MODULE_REJECT;
 	}
 
 	RETURN_MODULE_OK;
 }
+
+static unlang_action_t CC_HINT(nonnull) pap_crypt_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+							 request_t *request)
+{
+	fr_offload_job_t	*job = mctx->rctx;
+	rlm_rcode_t		rcode = RLM_MODULE_FAIL;
+
+	if (pap_offload_done(request, job, "Crypt")) pap_crypt_result(&rcode, request, fr_offload_job_uctx(job));
+	talloc_free(job);
+
+	return pap_auth_result(p_result, request, rcode);
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
+						       module_ctx_t const *mctx, request_t *request,
+						       fr_pair_t const *known_good, fr_value_box_t const *password)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+	pap_crypt_job_t		*cj;
+
+	if (!t->offload) {
+		pap_crypt_job_t inline_cj = {
+			.password = password->vb_strvalue,
+			.known_good = known_good->vp_strvalue
+		};
+
+		pap_crypt_run(&inline_cj);
+		return pap_crypt_result(p_result, request, &inline_cj);
+	}
+
+	/*
+	 *	The request, and the "known good" password may be
+	 *	freed while the job is running, so take copies.
+	 */
+	MEM(cj = talloc_zero(t, pap_crypt_job_t));
+	MEM(cj->password = talloc_strdup(cj, password->vb_strvalue));
+	MEM(cj->known_good = talloc_strdup(cj, known_good->vp_strvalue));
+
+	return pap_offload(p_result, mctx, request, "Crypt", pap_crypt_run, cj, pap_crypt_resume);
+}
 #endif
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_md5(rlm_rcode_t *p_result,
-						     UNUSED rlm_pap_t const *inst, request_t *request,
+						     UNUSED module_ctx_t const *mctx, request_t *request,
 						     fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	uint8_t digest[MD5_DIGEST_LENGTH];
@@ -258,7 +393,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_md5(rlm_rcode_t *p_result,
 
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_smd5(rlm_rcode_t *p_result,
-						      UNUSED rlm_pap_t const *inst, request_t *request,
+						      UNUSED module_ctx_t const *mctx, request_t *request,
 						      fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	fr_md5_ctx_t	*md5_ctx;
@@ -290,7 +425,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_smd5(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_sha1(rlm_rcode_t *p_result,
-						      UNUSED rlm_pap_t const *inst, request_t *request,
+						      UNUSED module_ctx_t const *mctx, request_t *request,
 						      fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	fr_sha1_ctx	sha1_context;
@@ -317,7 +452,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_sha1(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_ssha1(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       UNUSED module_ctx_t const *mctx, request_t *request,
 						       fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	fr_sha1_ctx	sha1_context;
@@ -349,7 +484,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_ssha1(rlm_rcode_t *p_result,
 
 #ifdef HAVE_OPENSSL_EVP_H
 static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md(rlm_rcode_t *p_result,
-						    	UNUSED rlm_pap_t const *inst, request_t *request,
+						    	UNUSED module_ctx_t const *mctx, request_t *request,
 						    	fr_pair_t const *known_good, fr_value_box_t const *password,
 						    	char const *name, EVP_MD const *md)
 {
@@ -377,7 +512,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md_salted(rlm_rcode_t *p_result,
-							       UNUSED rlm_pap_t const *inst, request_t *request,
+							       UNUSED module_ctx_t const *mctx, request_t *request,
 							       fr_pair_t const *known_good, fr_value_box_t const *password,
 							       char const *name, EVP_MD const *md)
 {
@@ -416,10 +551,10 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md_salted(rlm_rcode_t *p_re
  */
 #define PAP_AUTH_EVP_MD(_func, _new_func, _name, _md) \
 static unlang_action_t CC_HINT(nonnull) _new_func(rlm_rcode_t *p_result, \
-					          rlm_pap_t const *inst, request_t *request, \
+					          module_ctx_t const *mctx, request_t *request, \
 						  fr_pair_t const *known_good, fr_value_box_t const *password) \
 { \
-	return _func(p_result, inst, request, known_good, password, _name, _md); \
+	return _func(p_result, mctx, request, known_good, password, _name, _md); \
 }
 
 PAP_AUTH_EVP_MD(pap_auth_evp_md, pap_auth_sha2_224, "SHA2-224", EVP_sha224())
@@ -442,9 +577,72 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_384, "SSHA3-384", EVP_sha
 PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha3_512())
 #  endif
 
+typedef struct {
+	EVP_MD const	*evp_md;			//!< To use with the HMAC.
+	uint32_t	iterations;			//!< How many times to hash.
+
+	uint8_t const	*password;			//!< From the request.
+	size_t		password_len;			//!< Length of the password.
+
+	uint8_t const	*salt;				//!< From the "known good" password.
+	size_t		salt_len;			//!< Length of the salt.
+
+	uint8_t		hash[EVP_MAX_MD_SIZE];		//!< From the "known good" password.
+	uint8_t		digest[EVP_MAX_MD_SIZE];	//!< We calculated.
+	size_t		digest_len;			//!< Length of both the hash and the digest.
+
+	bool		failed;				//!< OpenSSL couldn't calculate the digest.
+} pap_pbkdf2_job_t;
+
+/** Calculate a PBKDF2 digest, possibly in an offload thread
+ *
+ */
+static void pap_pbkdf2_run(void *uctx)
+{
+	pap_pbkdf2_job_t *pj = uctx;
+
+	pj->failed = (PKCS5_PBKDF2_HMAC((char const *)pj->password, (int)pj->password_len,
+					(unsigned char const *)pj->salt, (int)pj->salt_len,
+					(int)pj->iterations,
+					pj->evp_md,
+					(int)pj->digest_len, (unsigned char *)pj->digest) == 0);
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_pbkdf2_result(rlm_rcode_t *p_result, request_t *request,
+							  pap_pbkdf2_job_t const *pj)
+{
+	if (pj->failed) {
+		fr_tls_log(request, "PBKDF2 digest failure");
+		RETURN_MODULE_INVALID;
+	}
+
+	if (fr_digest_cmp(pj->digest, pj->hash, pj->digest_len) != 0) {
+		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
+		REDEBUG3("Salt       : %pH", fr_box_octets(pj->salt, pj->salt_len));
+		REDEBUG3("Calculated : %pH", fr_box_octets(pj->digest, pj->digest_len));
+		REDEBUG3("Expected   : %pH", fr_box_octets(pj->hash, pj->digest_len));
+		RETURN_MODULE_REJECT;
+	}
+
+	RETURN_MODULE_OK;
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_pbkdf2_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+							  request_t *request)
+{
+	fr_offload_job_t	*job = mctx->rctx;
+	rlm_rcode_t		rcode = RLM_MODULE_FAIL;
+
+	if (pap_offload_done(request, job, "PBKDF2")) pap_pbkdf2_result(&rcode, request, fr_offload_job_uctx(job));
+	talloc_free(job);
+
+	return pap_auth_result(p_result, request, rcode);
+}
+
 /** Validates Crypt::PBKDF2 LDAP format strings
  *
  * @param[out] p_result		The result of comparing the pbkdf2 hash with the password.
+ * @param[in] mctx		Module and thread instance data.
  * @param[in] request		The current request.
  * @param[in] str		Raw PBKDF2 string.
  * @param[in] len		Length of string.
@@ -456,15 +654,17 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha
  * @param[in] iter_is_base64	Whether the iterations is are encoded as base64.
  * @param[in] password		to validate.
  * @return
- *	- RLM_MODULE_REJECT
- *	- RLM_MODULE_OK
+ *	- UNLANG_ACTION_YIELD if the digest is being calculated in an offload thread.
+ *	- UNLANG_ACTION_CALCULATE_RESULT, with RLM_MODULE_REJECT, or RLM_MODULE_OK.
  */
 static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t *p_result,
-								     request_t *request, const uint8_t *str, size_t len,
+								     module_ctx_t const *mctx, request_t *request,
+								     const uint8_t *str, size_t len,
 								     fr_table_num_sorted_t const hash_names[], size_t hash_names_len,
 								     char scheme_sep, char iter_sep, char salt_sep,
 								     bool iter_is_base64, fr_value_box_t const *password)
 {
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
 	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
 
 	uint8_t const		*p, *q, *end;
@@ -479,7 +679,7 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 	uint8_t			*salt = NULL;
 	size_t			salt_len;
 	uint8_t			hash[EVP_MAX_MD_SIZE];
-	uint8_t			digest[EVP_MAX_MD_SIZE];
+	pap_pbkdf2_job_t	*pj;
 
 	RDEBUG2("Comparing with \"known-good\" Password.PBKDF2");
 
@@ -657,24 +857,38 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 	/*
 	 *	Hash and compare
 	 */
-	if (PKCS5_PBKDF2_HMAC((char const *)password->vb_octets, (int)password->vb_length,
-			      (unsigned char const *)salt, (int)salt_len,
-			      (int)iterations,
-			      evp_md,
-			      (int)digest_len, (unsigned char *)digest) == 0) {
-		fr_tls_log(request, "PBKDF2 digest failure");
+	if (!t->offload) {
+		pap_pbkdf2_job_t inline_pj = {
+			.evp_md = evp_md,
+			.iterations = iterations,
+			.password = password->vb_octets,
+			.password_len = password->vb_length,
+			.salt = salt,
+			.salt_len = salt_len,
+			.digest_len = digest_len
+		};
+
+		memcpy(inline_pj.hash, hash, digest_len);
+		pap_pbkdf2_run(&inline_pj);
+		pap_pbkdf2_result(&rcode, request, &inline_pj);
 		goto finish;
 	}
 
-	if (fr_digest_cmp(digest, hash, (size_t)digest_len) != 0) {
-		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
-		REDEBUG3("Salt       : %pH", fr_box_octets(salt, salt_len));
-		REDEBUG3("Calculated : %pH", fr_box_octets(digest, digest_len));
-		REDEBUG3("Expected   : %pH", fr_box_octets(hash, slen));
-		rcode = RLM_MODULE_REJECT;
-	} else {
-		rcode = RLM_MODULE_OK;
-	}
+	/*
+	 *	Thousands of iterations can take a while, so
+	 *	don't make the other requests wait.
+	 */
+	MEM(pj = talloc_zero(t, pap_pbkdf2_job_t));
+	pj->evp_md = evp_md;
+	pj->iterations = iterations;
+	MEM(pj->password = talloc_memdup(pj, password->vb_octets, password->vb_length));
+	pj->password_len = password->vb_length;
+	pj->salt = talloc_steal(pj, salt);
+	pj->salt_len = salt_len;
+	memcpy(pj->hash, hash, digest_len);
+	pj->digest_len = digest_len;
+
+	return pap_offload(p_result, mctx, request, "PBKDF2", pap_pbkdf2_run, pj, pap_pbkdf2_resume);
 
 finish:
 	talloc_free(salt);
@@ -683,7 +897,7 @@ finish:
 }
 
 static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_result,
-							       UNUSED rlm_pap_t const *inst,
+							       module_ctx_t const *mctx,
 							       request_t *request,
 							       fr_pair_t const *known_good, fr_value_box_t const *password)
 {
@@ -708,7 +922,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 			q = memchr(p, '}', end - p);
 			p = q + 1;
 		}
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
 					     ':', ':', ':', true, password);
 	}
@@ -720,7 +934,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$PBKDF2$") && (memcmp(p, "$PBKDF2$", sizeof("$PBKDF2$") - 1) == 0)) {
 		p += sizeof("$PBKDF2$") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
 					     ':', ':', '$', false, password);
 	}
@@ -734,7 +948,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$pbkdf2-") && (memcmp(p, "$pbkdf2-", sizeof("$pbkdf2-") - 1) == 0)) {
 		p += sizeof("$pbkdf2-") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 					     pbkdf2_passlib_names, pbkdf2_passlib_names_len,
 					     '$', '$', '$', false, password);
 	}
@@ -746,7 +960,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 #endif
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_nt(rlm_rcode_t *p_result,
-						    UNUSED rlm_pap_t const *inst, request_t *request,
+						    UNUSED module_ctx_t const *mctx, request_t *request,
 						    fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	ssize_t len;
@@ -780,7 +994,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_nt(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_ns_mta_md5(rlm_rcode_t *p_result,
-							    UNUSED rlm_pap_t const *inst, request_t *request,
+							    UNUSED module_ctx_t const *mctx, request_t *request,
 							    fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	uint8_t digest[128];
@@ -845,7 +1059,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_ns_mta_md5(rlm_rcode_t *p_resul
  *
  */
 static unlang_action_t CC_HINT(nonnull) pap_auth_dummy(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, UNUSED request_t *request,
+						       UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
 						       UNUSED fr_pair_t const *known_good, UNUSED fr_value_box_t const *password)
 {
 	RETURN_MODULE_FAIL;
@@ -903,6 +1117,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	fr_pair_t		*known_good;
 	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
 	pap_auth_func_t		auth_func;
+	unlang_action_t		ua;
 	bool			ephemeral;
 	pap_call_env_t		*env_data = talloc_get_type_abort(mctx->env_data, pap_call_env_t);
 
@@ -955,22 +1170,16 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	/*
 	 *	Authenticate, and return.
 	 */
-	auth_func(&rcode, inst, request, known_good, &env_data->password);
+	ua = auth_func(&rcode, mctx, request, known_good, &env_data->password);
 	if (ephemeral) TALLOC_FREE(known_good);
-	switch (rcode) {
-	case RLM_MODULE_REJECT:
-		REDEBUG("Password incorrect");
-		break;
-
-	case RLM_MODULE_OK:
-		RDEBUG2("User authenticated successfully");
-		break;
 
-	default:
-		break;
-	}
+	/*
+	 *	Hashing was offloaded, the resume function
+	 *	logs the result.
+	 */
+	if (ua == UNLANG_ACTION_YIELD) return ua;
 
-	RETURN_MODULE_RCODE(rcode);
+	return pap_auth_result(p_result, request, rcode);
 }
 
 static int mod_instantiate(module_inst_ctx_t const *mctx)
@@ -983,6 +1192,49 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		     mctx->mi->name);
 	}
 
+	if (inst->offload_conf.num_threads > 0) {
+		inst->offload = fr_offload_alloc(NULL, &inst->offload_conf, mctx->mi->name);
+		if (!inst->offload) {
+			PERROR("Failed creating offload pool");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_pap_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_pap_t);
+
+	talloc_free(inst->offload);
+	return 0;
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_pap_t const		*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_pap_t);
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+
+	if (!inst->offload) return 0;
+
+	t->offload = fr_offload_thread_alloc(t, inst->offload, mctx->el);
+	if (!t->offload) {
+		PERROR("Failed attaching to offload pool");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Wait for any jobs this thread has in the offload pool
+ *
+ */
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+
+	TALLOC_FREE(t->offload);
 	return 0;
 }
 
@@ -1057,11 +1309,15 @@ module_rlm_t rlm_pap = {
 	.common = {
 		.magic		= MODULE_MAGIC_INIT,
 		.name		= "pap",
-		.inst_size	= sizeof(rlm_pap_t),
-		.onload		= mod_load,
-		.unload		= mod_unload,
-		.config		= module_config,
-		.instantiate	= mod_instantiate
+		.inst_size		= sizeof(rlm_pap_t),
+		.thread_inst_size	= sizeof(rlm_pap_thread_t),
+		.onload			= mod_load,
+		.unload			= mod_unload,
+		.config			= module_config,
+		.instantiate		= mod_instantiate,
+		.detach			= mod_detach,
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
 	.method_names = (module_method_name_t[]){
 		/*
@@ -90,6 +90,8 @@ typedef struct udp_request_s udp_request_t;
 typedef struct {
 	struct iovec		out;			//!< Describes buffer to send.
 	fr_trunk_request_t	*treq;			//!< Used for signalling.
+	bool			encoded;		//!< Freshly encoded, needs signing and tracking
+							///< before it's sent.
 } udp_coalesced_t;
 
 /** Track the handle, which is tightly correlated with the FD
@@ -103,6 +105,7 @@ typedef struct {
 
 	struct mmsghdr		*mmsgvec;		//!< Vector of inbound/outbound packets.
 	udp_coalesced_t		*coalesced;		//!< Outbound coalesced requests.
+	fr_radius_batch_t	*sign_batch;		//!< Coalesced requests which need signing.
 
 	size_t			send_buff_actual;	//!< What we believe the maximum SO_SNDBUF size to be.
 							///< We don't try and encode more packet data than this
@@ -250,7 +253,7 @@ static rlm_rcode_t radius_code_to_rcode[FR_RADIUS_CODE_MAX] = {
 static void		conn_writable_status_check(UNUSED fr_event_list_t *el, UNUSED int fd,
 						   UNUSED int flags, void *uctx);
 
-static int 		encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id);
+static int 		encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id, bool sign);
 
 static decode_fail_t	decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
 			       udp_handle_t *h, request_t *request, udp_request_t *u,
@@ -640,7 +643,7 @@ static void conn_writable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 	DEBUG("%s - Sending %s ID %d length %ld over connection %s",
 	      h->module_name, fr_radius_packet_name[u->code], u->id, u->packet_len, h->name);
 
-	if (encode(h->inst, h->status_request, u, u->id) < 0) {
+	if (encode(h->inst, h->status_request, u, u->id, true) < 0) {
 	fail:
 		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
 		return;
@@ -733,6 +736,7 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	 */
 	h->mmsgvec = talloc_zero_array(h, struct mmsghdr, h->inst->max_send_coalesce);
 	h->coalesced = talloc_zero_array(h, udp_coalesced_t, h->inst->max_send_coalesce);
+	h->sign_batch = talloc_zero_array(h, fr_radius_batch_t, h->inst->max_send_coalesce);
 	for (i = 0; i < h->inst->max_send_coalesce; i++) {
 		h->mmsgvec[i].msg_hdr.msg_iov = &h->coalesced[i].out;
 		h->mmsgvec[i].msg_hdr.msg_iovlen = 1;
@@ -1193,7 +1197,29 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 	return DECODE_FAIL_NONE;
 }
 
-static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id)
+/** Only certain types of packet, and those with a message_authenticator need signing
+ *
+ * This must agree with encode(), which always adds a Message-Authenticator
+ * to Access-Request and Status-Server packets.
+ */
+static inline bool udp_packet_needs_sign(udp_request_t const *u)
+{
+	if (u->require_ma) return true;
+
+	switch (u->code) {
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id, bool sign)
 {
 	ssize_t			packet_len;
 	uint8_t			*msg = NULL;
@@ -1427,29 +1453,20 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 	}
 
 	/*
-	 *	Only certain types of packet, and those with a
-	 *	message_authenticator need signing.
+	 *	The caller signs the packet, along with any
+	 *	others it's sending at the same time.
 	 */
-	if (message_authenticator) goto sign;
-	switch (u->code) {
-	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
-	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
-	case FR_RADIUS_CODE_COA_REQUEST:
-	sign:
-		/*
-		 *	Now that we're done mangling the packet, sign it.
-		 */
-		if (fr_radius_sign(u->packet, NULL, (uint8_t const *) inst->secret,
-				   talloc_array_length(inst->secret) - 1) < 0) {
-			RERROR("Failed signing packet");
-			goto error;
-		}
-		break;
-
-	default:
-		break;
+	if (!sign || !udp_packet_needs_sign(u)) return 0;
 
+	/*
+	 *	Now that we're done mangling the packet, sign it.
+	 */
+	if (fr_radius_sign(u->packet, NULL, (uint8_t const *) inst->secret,
+			   talloc_array_length(inst->secret) - 1) < 0) {
+		RERROR("Failed signing packet");
+		goto error;
 	}
+
 	return 0;
 }
 
@@ -1707,6 +1724,71 @@ static void status_check_retry(UNUSED fr_event_list_t *el, fr_time_t now, void *
         fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
 }
 
+/** Sign all the freshly encoded packets in the coalesced set at once
+ *
+ * Signing packets together is significantly faster than signing them
+ * one at a time as they're encoded.
+ *
+ * Packets which can't be signed are failed, and removed from the set.
+ *
+ * @param[in] h		Handle the packets are being sent on.
+ * @param[in] queued	Number of packets in h->coalesced.
+ * @return The number of packets left in h->coalesced.
+ */
+static uint16_t coalesced_sign(udp_handle_t *h, uint16_t queued)
+{
+	rlm_radius_udp_t const	*inst = h->inst;
+	uint16_t		i, j, num = 0;
+
+	for (i = 0; i < queued; i++) {
+		udp_request_t	*u;
+
+		if (!h->coalesced[i].encoded) continue;
+
+		u = talloc_get_type_abort(h->coalesced[i].treq->preq, udp_request_t);
+		if (!udp_packet_needs_sign(u)) continue;
+
+		h->sign_batch[num++] = (fr_radius_batch_t){
+			.packet = u->packet,
+			.secret = (uint8_t const *) inst->secret,
+			.secret_len = talloc_array_length(inst->secret) - 1
+		};
+	}
+	if (num > 0) fr_radius_sign_multi(h->sign_batch, num);
+
+	for (i = 0, j = 0, num = 0; i < queued; i++) {
+		fr_trunk_request_t	*treq = h->coalesced[i].treq;
+		udp_request_t		*u = talloc_get_type_abort(treq->preq, udp_request_t);
+		request_t		*request = treq->request;
+
+		if (h->coalesced[i].encoded) {
+			if (udp_packet_needs_sign(u) && (h->sign_batch[num++].rcode < 0)) {
+				RERROR("Failed signing packet");
+				udp_request_reset(u);
+				if (u->ev) (void) fr_event_timer_delete(&u->ev);
+				fr_trunk_request_signal_fail(treq);
+				continue;
+			}
+			RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+
+			/*
+			 *	Remember the authentication vector, which now has the
+			 *	packet signature.
+			 */
+			(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+		}
+
+		/*
+		 *	mmsgvec[j] points to coalesced[j].out, so
+		 *	we only need to move the coalesced entry.
+		 */
+		if (i != j) h->coalesced[j] = h->coalesced[i];
+		j++;
+	}
+
+	return j;
+}
+
 static void request_mux(fr_event_list_t *el,
 			fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
@@ -1774,7 +1856,7 @@ static void request_mux(fr_event_list_t *el,
 			RDEBUG("Sending %s ID %d length %ld over connection %s",
 			       fr_radius_packet_name[u->code], u->id, u->packet_len, h->name);
 
-			if (encode(h->inst, request, u, u->id) < 0) {
+			if (encode(h->inst, request, u, u->id, false) < 0) {
 				/*
 				 *	Need to do this because request_conn_release
 				 *	may not be called.
@@ -1784,16 +1866,11 @@ static void request_mux(fr_event_list_t *el,
 				fr_trunk_request_signal_fail(treq);
 				continue;
 			}
-			RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
-
-			/*
-			 *	Remember the authentication vector, which now has the
-			 *	packet signature.
-			 */
-			(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+			h->coalesced[queued].encoded = true;
 		} else {
 			RDEBUG("Retransmitting %s ID %d length %ld over connection %s",
 			       fr_radius_packet_name[u->code], u->id, u->packet_len, h->name);
+			h->coalesced[queued].encoded = false;
 		}
 
 		log_request_pair_list(L_DBG_LVL_2, request, NULL, &request->request_pairs, NULL);
@@ -1834,6 +1911,9 @@ static void request_mux(fr_event_list_t *el,
 	 */
 	(void)talloc_get_type_abort(h, udp_handle_t);
 
+	queued = coalesced_sign(h, queued);
+	if (queued == 0) return;
+
 	/*
 	 *	Send the coalesced datagrams
 	 */
@@ -1994,7 +2074,7 @@ static void request_mux_replicate(UNUSED fr_event_list_t *el,
 		if (!u->packet) {
 			u->id = h->last_id++;
 
-			if (encode(h->inst, request, u, u->id) < 0) {
+			if (encode(h->inst, request, u, u->id, true) < 0) {
 				fr_trunk_request_signal_fail(treq);
 				continue;
 			}
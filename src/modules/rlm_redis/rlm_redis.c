@@ -33,13 +33,16 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/cf_util.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/server/pool.h>
+#include <freeradius-devel/server/trunk.h>
 
+#include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/unlang/xlat.h>
 #include <freeradius-devel/unlang/xlat_func.h>
 
@@ -82,9 +85,42 @@ typedef struct {
 
 	rlm_redis_lua_t		lua;					//!< Array of functions to register.
 
+	bool			pipeline;				//!< Pipeline commands over per-thread trunk
+									//!< connections, instead of using the pool.
+	fr_trunk_conf_t		trunk_conf;				//!< Trunk configuration for asynchronous
+									//!< commands.
+
 	fr_redis_cluster_t	*cluster;				//!< Redis cluster.
 } rlm_redis_t;
 
+/** rlm_redis thread instance
+ *
+ */
+typedef struct {
+	fr_redis_cluster_thread_t	*cluster;			//!< Trunks to each of the cluster nodes.
+} rlm_redis_thread_t;
+
+/** Resume context for asynchronous redis xlats
+ *
+ */
+typedef struct {
+	fr_redis_command_set_t	*cmds;					//!< Command set in progress.  NULL once
+									//!< the command set completes or fails.
+	redisReply		*reply;					//!< Reply to the last command in the set.
+
+	redis_lua_func_t const	*func;					//!< Lua function being called, if any.
+	bool			script_loaded;				//!< We've already tried to load the script.
+
+	uint8_t const		*key;					//!< Used to select the cluster node.
+	size_t			key_len;				//!< Length of the key.
+
+	char			key_count[sizeof("18446744073709551615")];	//!< Key count argument for lua functions.
+
+	int			argc;					//!< Number of command arguments.
+	char const		*argv[MAX_REDIS_ARGS];			//!< Command arguments.
+	size_t			arg_len[MAX_REDIS_ARGS];		//!< Length of each argument.
+} redis_xlat_rctx_t;
+
 static int lua_func_body_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
 
 static conf_parser_t module_lua_func[] = {
@@ -102,6 +138,8 @@ static conf_parser_t module_lua[] = {
 
 static conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_SUBSECTION("lua", 0, rlm_redis_t, lua, module_lua) },
+	{ FR_CONF_OFFSET("pipeline", rlm_redis_t, pipeline), .dflt = "no" },
+	{ FR_CONF_OFFSET_SUBSECTION("trunk", 0, rlm_redis_t, trunk_conf, fr_trunk_config ) },
 	REDIS_COMMON_CONFIG,
 	CONF_PARSER_TERMINATOR
 };
@@ -247,6 +285,291 @@ parse_reply:
 	return 0;
 }
 
+/** Free any reply we didn't get around to processing
+ *
+ */
+static int _redis_xlat_rctx_free(redis_xlat_rctx_t *rctx)
+{
+	fr_redis_reply_free(&rctx->reply);
+
+	return 0;
+}
+
+/** Take the reply to the last command, and mark the request as runnable
+ *
+ */
+static void redis_xlat_cmds_complete(request_t *request, fr_dlist_head_t *completed, void *uctx)
+{
+	redis_xlat_rctx_t	*rctx = talloc_get_type_abort(uctx, redis_xlat_rctx_t);
+
+	rctx->cmds = NULL;
+	rctx->reply = fr_redis_command_steal_result(fr_dlist_tail(completed));
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Record that the command set failed, and mark the request as runnable
+ *
+ */
+static void redis_xlat_cmds_fail(request_t *request, UNUSED fr_dlist_head_t *completed, void *uctx)
+{
+	redis_xlat_rctx_t	*rctx = talloc_get_type_abort(uctx, redis_xlat_rctx_t);
+
+	rctx->cmds = NULL;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Cancel any outstanding commands if the request is cancelled
+ *
+ */
+static void redis_xlat_signal(xlat_ctx_t const *xctx, request_t *request, UNUSED fr_signal_t action)
+{
+	redis_xlat_rctx_t	*rctx = talloc_get_type_abort(xctx->rctx, redis_xlat_rctx_t);
+
+	if (!rctx->cmds) return;
+
+	RDEBUG2("Cancelling outstanding redis commands");
+
+	fr_redis_command_set_signal_cancel(rctx->cmds);
+	rctx->cmds = NULL;
+}
+
+static xlat_action_t redis_xlat_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
+				       xlat_ctx_t const *xctx,
+				       request_t *request, fr_value_box_list_t *in);
+
+/** Send the command in the rctx to the cluster node responsible for the key
+ *
+ * Commands from many requests are pipelined over the same connections, and
+ * are written out together when the event loop next services the connection.
+ */
+static xlat_action_t redis_xlat_enqueue(request_t *request, rlm_redis_thread_t const *t, redis_xlat_rctx_t *rctx)
+{
+	fr_redis_command_set_t	*cmds;
+
+	MEM(cmds = fr_redis_command_set_alloc(NULL, request, redis_xlat_cmds_complete, redis_xlat_cmds_fail, rctx));
+
+	/*
+	 *	The server processes commands from a connection
+	 *	in order, so we can pipeline loading the script
+	 *	with the call to it.
+	 */
+	if (rctx->script_loaded) {
+		char const	*script_load_argv[] = {
+					"SCRIPT",
+					"LOAD",
+					rctx->func->body
+				};
+
+		size_t		script_load_arg_len[] = {
+					(sizeof("SCRIPT") - 1),
+					(sizeof("LOAD") - 1),
+					(talloc_array_length(rctx->func->body) - 1)
+				};
+
+		if (fr_redis_command_argv_add(cmds, NUM_ELEMENTS(script_load_argv),
+					      script_load_argv, script_load_arg_len) != FR_REDIS_PIPELINE_OK) goto error;
+	}
+
+	if (fr_redis_command_argv_add(cmds, rctx->argc, rctx->argv, rctx->arg_len) != FR_REDIS_PIPELINE_OK) {
+	error:
+		talloc_free(cmds);
+		return XLAT_ACTION_FAIL;
+	}
+
+	rctx->cmds = cmds;
+	if (fr_redis_command_set_enqueue_by_key(t->cluster, cmds, rctx->key, rctx->key_len) != FR_REDIS_PIPELINE_OK) {
+		REDEBUG("Failed enqueueing command");
+		rctx->cmds = NULL;
+		goto error;
+	}
+
+	/*
+	 *	Failed immediately, the command set has already been freed
+	 */
+	if (!rctx->cmds) return XLAT_ACTION_FAIL;
+
+	return unlang_xlat_yield(request, redis_xlat_resume, redis_xlat_signal, ~FR_SIGNAL_CANCEL, rctx);
+}
+
+/** Convert the reply from redis into a value box
+ *
+ */
+static xlat_action_t redis_xlat_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
+				       xlat_ctx_t const *xctx,
+				       request_t *request, UNUSED fr_value_box_list_t *in)
+{
+	redis_xlat_rctx_t		*rctx = talloc_get_type_abort(xctx->rctx, redis_xlat_rctx_t);
+	rlm_redis_thread_t const	*t = talloc_get_type_abort_const(xctx->mctx->thread, rlm_redis_thread_t);
+	fr_value_box_t			*vb_out;
+
+	if (!rctx->reply) {
+		REDEBUG("Failed executing command");
+		return XLAT_ACTION_FAIL;
+	}
+
+	switch (fr_redis_command_status(NULL, rctx->reply)) {
+	case REDIS_RCODE_SUCCESS:
+		break;
+
+	/*
+	 *	Load the script, and try again
+	 */
+	case REDIS_RCODE_NO_SCRIPT:
+		if (rctx->func && !rctx->script_loaded) {
+			RDEBUG3("Loading lua function \"%s\" (0x%s)", rctx->func->name, rctx->func->digest);
+			fr_redis_reply_free(&rctx->reply);
+			rctx->script_loaded = true;
+			return redis_xlat_enqueue(request, t, rctx);
+		}
+		FALL_THROUGH;
+
+	default:
+		RPEDEBUG("Command failed");
+		return XLAT_ACTION_FAIL;
+	}
+
+	MEM(vb_out = fr_value_box_alloc_null(ctx));
+	if (fr_redis_reply_to_value_box(ctx, vb_out, rctx->reply, FR_TYPE_VOID, NULL, false, false) < 0) {
+		RPERROR("Failed processing reply");
+		talloc_free(vb_out);
+		return XLAT_ACTION_FAIL;
+	}
+	fr_dcursor_append(out, vb_out);
+
+	return XLAT_ACTION_DONE;
+}
+
+/** Allocate a resume context for an asynchronous redis xlat
+ *
+ */
+static inline redis_xlat_rctx_t *redis_xlat_rctx_alloc(request_t *request)
+{
+	redis_xlat_rctx_t	*rctx;
+
+	MEM(rctx = talloc_zero(unlang_interpret_frame_talloc_ctx(request), redis_xlat_rctx_t));
+	talloc_set_destructor(rctx, _redis_xlat_rctx_free);
+
+	return rctx;
+}
+
+/** Run the command in the rctx on a pooled connection
+ *
+ * Used when pipelining is disabled, and for read only commands and
+ * functions, which may be sent to replicas.  The worker blocks until
+ * the reply is received.
+ */
+static xlat_action_t redis_xlat_pool(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t *request,
+				     rlm_redis_t const *inst, redis_xlat_rctx_t *rctx, bool read_only)
+{
+	fr_redis_conn_t			*conn;
+	fr_redis_cluster_state_t	state;
+	fr_redis_rcode_t		status;
+
+	redisReply			*reply = NULL;
+	int				s_ret;
+
+	xlat_action_t			action = XLAT_ACTION_DONE;
+	fr_value_box_t			*vb_out;
+
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request,
+						 rctx->key, rctx->key_len, read_only);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
+		bool script_load_done = false;
+
+	again:
+		if (redis_command(&status, &reply, request, conn,
+				  read_only, rctx->argc, rctx->argv, rctx->arg_len) == -2) {
+			state.close_conn = true;
+		}
+
+		if (!rctx->func || (status != REDIS_RCODE_NO_SCRIPT)) continue;
+
+		/*
+		 *	Discard the error we received, and attempt load the function.
+		 */
+		fr_redis_reply_free(&reply);
+
+		RDEBUG3("Loading lua function \"%s\" (0x%s)", rctx->func->name, rctx->func->digest);
+		{
+			char const	*script_load_argv[] = {
+						"SCRIPT",
+						"LOAD",
+						rctx->func->body
+					};
+
+			size_t		script_load_arg_len[] = {
+						(sizeof("SCRIPT") - 1),
+						(sizeof("LOAD") - 1),
+						(talloc_array_length(rctx->func->body) - 1)
+					};
+
+			/*
+			 *	Loading the script failed... fail the call.
+			 */
+			if (script_load_done) {
+			script_load_failed:
+				status = REDIS_RCODE_ERROR;
+				fr_redis_reply_free(&reply);
+				continue;
+			}
+
+			if (redis_command(&status, &reply, request, conn, read_only,
+					  NUM_ELEMENTS(script_load_argv),
+					  script_load_argv, script_load_arg_len) == -2) {
+				state.close_conn = true;
+			}
+
+			if (status == REDIS_RCODE_SUCCESS) {
+				script_load_done = true;
+
+				/*
+				 *	Verify we got a sane response
+				 */
+				if (reply->type != REDIS_REPLY_STRING) {
+					REDEBUG("Unexpected reply type after loading function");
+					fr_redis_reply_print(L_DBG_LVL_OFF, reply, request, 0);
+					goto script_load_failed;
+				}
+
+				if (strcmp(reply->str, rctx->func->digest) != 0) {
+					REDEBUG("Function digest %s, does not match calculated digest %s",
+						reply->str, rctx->func->digest);
+					goto script_load_failed;
+				}
+				fr_redis_reply_free(&reply);
+				goto again;
+			}
+		}
+	}
+
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		action = XLAT_ACTION_FAIL;
+		goto finish;
+	}
+
+	if (!fr_cond_assert(reply)) {
+		action = XLAT_ACTION_FAIL;
+		goto finish;
+	}
+
+	MEM(vb_out = fr_value_box_alloc_null(ctx));
+	if (fr_redis_reply_to_value_box(ctx, vb_out, reply, FR_TYPE_VOID, NULL, false, false) < 0) {
+		RPERROR("Failed processing reply");
+		talloc_free(vb_out);
+		action = XLAT_ACTION_FAIL;
+		goto finish;
+	}
+	fr_dcursor_append(out, vb_out);
+
+finish:
+	fr_redis_reply_free(&reply);
+
+	return action;
+}
+
 static xlat_arg_parser_t const redis_remap_xlat_args[] = {
 	{ .required = true, .concat = true, .type = FR_TYPE_STRING },
 	XLAT_ARG_PARSER_TERMINATOR
@@ -380,52 +703,43 @@ static xlat_action_t redis_lua_func_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 					 xlat_ctx_t const *xctx,
 					 request_t *request, fr_value_box_list_t *in)
 {
-	rlm_redis_t			*inst = talloc_get_type_abort(xctx->mctx->mi->data, rlm_redis_t);
+	rlm_redis_t const		*inst = talloc_get_type_abort_const(xctx->mctx->mi->data, rlm_redis_t);
+	rlm_redis_thread_t const	*t = talloc_get_type_abort_const(xctx->mctx->thread, rlm_redis_thread_t);
 	redis_lua_func_inst_t const	*xlat_inst = talloc_get_type_abort_const(xctx->inst, redis_lua_func_inst_t);
 	redis_lua_func_t		*func = xlat_inst->func;
+	redis_xlat_rctx_t		*rctx;
 
-	fr_redis_conn_t			*conn;
-	fr_redis_cluster_state_t	state;
-	fr_redis_rcode_t		status;
-
-	redisReply			*reply = NULL;
-	int				s_ret;
-
-	char const			*argv[MAX_REDIS_ARGS];
-	size_t				arg_len[MAX_REDIS_ARGS];
-	int				argc;
-	char				key_count[sizeof("184467440737095551615")];
-	uint8_t	const			*key = NULL;
-	size_t				key_len = 0;
-
-	xlat_action_t			action = XLAT_ACTION_DONE;
-	fr_value_box_t			*vb_out;
+	rctx = redis_xlat_rctx_alloc(request);
+	rctx->func = func;
 
 	/*
 	 *	First argument is always the key count
 	 */
-	if (unlikely(fr_value_box_print(&FR_SBUFF_OUT(key_count, sizeof(key_count)), fr_value_box_list_head(in), NULL) < 0)) {
+	if (unlikely(fr_value_box_print(&FR_SBUFF_OUT(rctx->key_count, sizeof(rctx->key_count)),
+					fr_value_box_list_head(in), NULL) < 0)) {
 		RPERROR("Failed converting key count to string");
+	error:
+		talloc_free(rctx);
 		return XLAT_ACTION_FAIL;
 	}
 	fr_value_box_list_talloc_free_head(in);
 
 	/*
-	 *	Try EVALSHA first, and if that fails fall back to SCRIPT LOAD
+	 *	Try EVALSHA first, and if that fails, pipeline
+	 *	SCRIPT LOAD with a second EVALSHA.
 	 */
-	argv[0] = "EVALSHA";
-	arg_len[0] = sizeof("EVALSHA") - 1;
-	argv[1] = func->digest;
-	arg_len[1] = sizeof(func->digest) - 1;
-	argv[2] = key_count;
-	arg_len[2] = strlen(key_count);
-	argc = 3;
+	rctx->argv[0] = "EVALSHA";
+	rctx->arg_len[0] = sizeof("EVALSHA") - 1;
+	rctx->argv[1] = func->digest;
+	rctx->arg_len[1] = sizeof(func->digest) - 1;
+	rctx->argv[2] = rctx->key_count;
+	rctx->arg_len[2] = strlen(rctx->key_count);
+	rctx->argc = 3;
 
 	fr_value_box_list_foreach(in, vb) {
-		if (argc == NUM_ELEMENTS(argv)) {
-			REDEBUG("Too many arguments (%i)", argc);
-			REXDENT();
-			return XLAT_ACTION_FAIL;
+		if (rctx->argc == NUM_ELEMENTS(rctx->argv)) {
+			REDEBUG("Too many arguments (%i)", rctx->argc);
+			goto error;
 		}
 
 		/*
@@ -434,130 +748,46 @@ static xlat_action_t redis_lua_func_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		 *	of subsequent arguments are maintained.
 		 */
 		if (!fr_type_is_string(vb->type)) {
-			argv[argc] = "";
-			arg_len[argc++] = 0;
+			rctx->argv[rctx->argc] = "";
+			rctx->arg_len[rctx->argc++] = 0;
 			continue;
 		}
 
-		argv[argc] = vb->vb_strvalue;
-		arg_len[argc++] = vb->vb_length;
+		rctx->argv[rctx->argc] = vb->vb_strvalue;
+		rctx->arg_len[rctx->argc++] = vb->vb_length;
 	}
 
 	/*
 	 *	For eval commands all keys should hash to the same redis instance
 	 *	so we just use the first key (the arg after the key count).
 	 */
-	if (argc > 3) {
-		key = (uint8_t const *)argv[3];
-	 	key_len = arg_len[3];
+	if (rctx->argc > 3) {
+		rctx->key = (uint8_t const *)rctx->argv[3];
+		rctx->key_len = rctx->arg_len[3];
 	}
 
-	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, func->read_only);
-	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
-	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
-		bool script_load_done = false;
-
-	again:
-	     	RDEBUG3("Calling script 0x%s", func->digest);
-		if (argc > 2) {
-			RDEBUG3("With arguments");
-			RINDENT();
-			for (int i = 2; i < argc; i++) RDEBUG3("[%i] %s", i, argv[i]);
-			REXDENT();
-		}
-		if (redis_command(&status, &reply, request, conn,
-				  func->read_only, argc, argv, arg_len) == -2) {
-			state.close_conn = true;
-		}
-
-		if (status != REDIS_RCODE_NO_SCRIPT) continue;
-
-		/*
-		 *	Discard the error we received, and attempt load the function.
-		 */
-		fr_redis_reply_free(&reply);
-
-		RDEBUG3("Loading lua function \"%s\" (0x%s)", func->name, func->digest);
-		{
-			char const	*script_load_argv[] = {
-						"SCRIPT",
-						"LOAD",
-						func->body
-					};
-
-			size_t		script_load_arg_len[] = {
-						(sizeof("SCRIPT") - 1),
-						(sizeof("LOAD") - 1),
-						(talloc_array_length(func->body) - 1)
-					};
-
-			/*
-			 *	Loading the script failed... fail the call.
-			 */
-			if (script_load_done) {
-			script_load_failed:
-				status = REDIS_RCODE_ERROR;
-				fr_redis_reply_free(&reply);
-				continue;
-			}
-
-			/*
-			 *	Fixme: Really the script load and the eval call should be
-			 *	handled in a single MULTI/EXEC block, but the complexity
-			 *	in handling this properly is great, and most of this
-			 *	synchronous code will need to be rewritten, so for now
-			 *	we just load the script and try again.
-			 */
-			if (redis_command(&status, &reply, request, conn, func->read_only,
-					  NUM_ELEMENTS(script_load_argv),
-					  script_load_argv, script_load_arg_len) == -2) {
-				state.close_conn = true;
-			}
-
-			if (status == REDIS_RCODE_SUCCESS) {
-				script_load_done = true;
-
-				/*
-				 *	Verify we got a sane response
-				 */
-				if (reply->type != REDIS_REPLY_STRING) {
-					REDEBUG("Unexpected reply type after loading function");
-					fr_redis_reply_print(L_DBG_LVL_OFF, reply, request, 0);
-					goto script_load_failed;
-				}
-
-				if (strcmp(reply->str, func->digest) != 0) {
-					REDEBUG("Function digest %s, does not match calculated digest %s", reply->str, func->digest);
-					goto script_load_failed;
-				}
-				fr_redis_reply_free(&reply);
-				goto again;
-			}
-		}
+	RDEBUG3("Calling script 0x%s", func->digest);
+	if (rctx->argc > 2) {
+		RDEBUG3("With arguments");
+		RINDENT();
+		for (int i = 2; i < rctx->argc; i++) RDEBUG3("[%i] %s", i, rctx->argv[i]);
+		REXDENT();
 	}
 
-	if (s_ret != REDIS_RCODE_SUCCESS) {
-		action = XLAT_ACTION_FAIL;
-		goto finish;
-	}
+	/*
+	 *	Read only functions go through the pool, so
+	 *	they can be run on replicas.
+	 */
+	if (!inst->pipeline || func->read_only) {
+		xlat_action_t action;
 
-	if (!fr_cond_assert(reply)) {
-		action = XLAT_ACTION_FAIL;
-		goto finish;
-	}
+		action = redis_xlat_pool(ctx, out, request, inst, rctx, func->read_only);
+		talloc_free(rctx);
 
-	MEM(vb_out = fr_value_box_alloc_null(ctx));
-	if (fr_redis_reply_to_value_box(ctx, vb_out, reply, FR_TYPE_VOID, NULL, false, false) < 0) {
-		RPERROR("Failed processing reply");
-		action = XLAT_ACTION_FAIL;
-		goto finish;
+		return action;
 	}
-	fr_dcursor_append(out, vb_out);
-
-finish:
-	fr_redis_reply_free(&reply);
 
-	return action;
+	return redis_xlat_enqueue(request, t, rctx);
 }
 
 /** Copies the function configuration into xlat function instance data
@@ -591,18 +821,15 @@ static xlat_action_t redis_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 				request_t *request, fr_value_box_list_t *in)
 {
 	rlm_redis_t const	*inst = talloc_get_type_abort_const(xctx->mctx->mi->data, rlm_redis_t);
+	rlm_redis_thread_t const *t = talloc_get_type_abort_const(xctx->mctx->thread, rlm_redis_thread_t);
 	xlat_action_t		action = XLAT_ACTION_DONE;
 	fr_redis_conn_t		*conn;
 
 	bool			read_only = false;
-	uint8_t	const		*key = NULL;
-	size_t			key_len = 0;
-
-	fr_redis_cluster_state_t	state;
-	fr_redis_rcode_t		status;
 
+	fr_redis_rcode_t	status;
 	redisReply		*reply = NULL;
-	int			s_ret;
+	redis_xlat_rctx_t	*rctx;
 
 	fr_value_box_t		*first = fr_value_box_list_head(in);
 	fr_sbuff_t		sbuff = FR_SBUFF_IN(first->vb_strvalue, first->vb_length);
@@ -708,21 +935,30 @@ static xlat_action_t redis_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		}
 	}
 
+	rctx = redis_xlat_rctx_alloc(request);
+
 	RDEBUG2("REDIS command arguments");
 	RINDENT();
 	fr_value_box_list_foreach(in, vb) {
-		if (argc == NUM_ELEMENTS(argv)) {
-			REDEBUG("Too many arguments (%i)", argc);
+		if (rctx->argc == NUM_ELEMENTS(rctx->argv)) {
+			REDEBUG("Too many arguments (%i)", rctx->argc);
 			REXDENT();
-			goto finish;
+			talloc_free(rctx);
+			return XLAT_ACTION_FAIL;
 		}
 
-		argv[argc] = vb->vb_strvalue;
-		arg_len[argc] = vb->vb_length;
-		argc++;
+		rctx->argv[rctx->argc] = vb->vb_strvalue;
+		rctx->arg_len[rctx->argc] = vb->vb_length;
+		rctx->argc++;
 	}
 	REXDENT();
 
+	/*
+	 *	Skip the read only marker
+	 */
+	rctx->argv[0] = fr_sbuff_current(&sbuff);
+	rctx->arg_len[0] = fr_sbuff_remaining(&sbuff);
+
 	/*
 	 *	If we've got multiple arguments, the second one is usually the key.
 	 *	The Redis docs say commands should be analysed first to get key
@@ -730,36 +966,34 @@ static xlat_action_t redis_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	 *	just as expensive as sending them to the wrong server and receiving
 	 *	a redirect.
 	 */
-	if (argc > 1) {
-		key = (uint8_t const *)argv[1];
-	 	key_len = arg_len[1];
+	if (rctx->argc > 1) {
+		rctx->key = (uint8_t const *)rctx->argv[1];
+		rctx->key_len = rctx->arg_len[1];
 	}
 
-	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, read_only);
-	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
-	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
-		RDEBUG2("Executing command: %pV", fr_value_box_list_head(in));
-		if (argc > 1) {
-			RDEBUG2("With arguments");
-			RINDENT();
-			for (int i = 1; i < argc; i++) RDEBUG2("[%i] %s", i, argv[i]);
-			REXDENT();
-		}
-
-		if (redis_command(&status, &reply, request, conn, read_only, argc, argv, arg_len) == -2) {
-			state.close_conn = true;
-		}
-	}
-	if (s_ret != REDIS_RCODE_SUCCESS) {
-		action = XLAT_ACTION_FAIL;
-		goto finish;
+	RDEBUG2("Executing command: %pV", fr_value_box_list_head(in));
+	if (rctx->argc > 1) {
+		RDEBUG2("With arguments");
+		RINDENT();
+		for (int i = 1; i < rctx->argc; i++) RDEBUG2("[%i] %s", i, rctx->argv[i]);
+		REXDENT();
 	}
 
-	if (!fr_cond_assert(reply)) {
-		action = XLAT_ACTION_FAIL;
-		goto finish;
+	/*
+	 *	Normal commands are pipelined over the trunk
+	 *	connections to the master for the key.  Read
+	 *	only commands go through the pool, so they can
+	 *	be run on replicas.
+	 */
+	if (!inst->pipeline || read_only) {
+		action = redis_xlat_pool(ctx, out, request, inst, rctx, read_only);
+		talloc_free(rctx);
+
+		return action;
 	}
 
+	return redis_xlat_enqueue(request, t, rctx);
+
 reply_parse:
 	MEM(vb_out = fr_value_box_alloc_null(ctx));
 	if (fr_redis_reply_to_value_box(ctx, vb_out, reply, FR_TYPE_VOID, NULL, false, false) < 0) {
@@ -775,12 +1009,42 @@ finish:
 	return action;
 }
 
+/** Free the trunks to the cluster nodes
+ *
+ */
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_redis_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_thread_t);
+
+	TALLOC_FREE(t->cluster);
+
+	return 0;
+}
+
+/** Allocate thread specific trunks for pipelining commands, if pipelining is enabled
+ *
+ * Trunks to individual cluster nodes are created the first time a command
+ * is sent to that node.
+ */
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_redis_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_redis_t);
+	rlm_redis_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_thread_t);
+
+	if (!inst->pipeline) return 0;
+
+	t->cluster = fr_redis_cluster_thread_alloc(t, mctx->el, &inst->trunk_conf, inst->cluster, &inst->conf);
+
+	return 0;
+}
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	rlm_redis_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_redis_t);
 	fr_socket_t *nodes;
 	int ret, i;
 
+	inst->conf.log_prefix = mctx->mi->name;
 	inst->cluster = fr_redis_cluster_alloc(inst, mctx->mi->conf, &inst->conf, true, NULL, NULL, NULL);
 	if (!inst->cluster) return -1;
 
@@ -904,6 +1168,11 @@ module_rlm_t rlm_redis = {
 		.config		= module_config,
 		.onload		= mod_load,
 		.bootstrap	= mod_bootstrap,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+
+		.thread_inst_size	= sizeof(rlm_redis_thread_t),
+		.thread_inst_type	= "rlm_redis_thread_t",
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	}
 };
@@ -50,8 +50,10 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
 
 #include <freeradius-devel/unlang/call_env.h>
+#include <freeradius-devel/unlang/interpret.h>
 
 #include "redis_ippool.h"
 
@@ -75,11 +77,25 @@ typedef struct {
 	bool			copy_on_update; //!< Copy the address provided by ip_address to the
 						//!< allocated_address_attr if updates are successful.
 
+	bool			pipeline;	//!< Pipeline allocations and updates over per-thread
+						//!< trunk connections, instead of using the pool.
+	fr_trunk_conf_t		trunk_conf;	//!< Trunk configuration for asynchronous allocations
+						//!< and updates.
+
 	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
 } rlm_redis_ippool_t;
 
+/** rlm_redis_ippool thread instance
+ *
+ */
+typedef struct {
+	fr_redis_cluster_thread_t *cluster;	//!< Trunks to each of the cluster nodes.
+} rlm_redis_ippool_thread_t;
+
 static conf_parser_t redis_config[] = {
 	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET("pipeline", rlm_redis_ippool_t, pipeline), .dflt = "no" },
+	{ FR_CONF_OFFSET_SUBSECTION("trunk", 0, rlm_redis_ippool_t, trunk_conf, fr_trunk_config ) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -552,15 +568,15 @@ static void ippool_action_print(request_t *request, ippool_action_t action,
  * @param[in] wait_timeout	How long to wait for slaves to replicate the data.
  * @param[in] digest		of script.
  * @param[in] script		to upload.
- * @param[in] cmd		EVALSHA command to execute.
- * @param[in] ...		Arguments for the eval command.
+ * @param[in] cmd		RESP formatted EVALSHA command to execute.
+ * @param[in] cmd_len		Length of the EVALSHA command.
  * @return status of the command.
  */
-static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_redis_cluster_t *cluster,
-				      uint8_t const *key, size_t key_len,
-				      uint32_t wait_num, fr_time_delta_t wait_timeout,
-				      char const digest[], char const *script,
-				      char const *cmd, ...)
+static fr_redis_rcode_t ippool_script_formatted(redisReply **out, request_t *request, fr_redis_cluster_t *cluster,
+						uint8_t const *key, size_t key_len,
+						uint32_t wait_num, fr_time_delta_t wait_timeout,
+						char const digest[], char const *script,
+						char const *cmd, size_t cmd_len)
 {
 	fr_redis_conn_t			*conn;
 	redisReply			*replies[5];	/* Must be equal to the maximum number of pipelined commands */
@@ -570,25 +586,17 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	fr_redis_rcode_t		s_ret, status;
 	unsigned int			pipelined = 0;
 
-	va_list				ap;
-
 	*out = NULL;
 
 #ifndef NDEBUG
 	memset(replies, 0, sizeof(replies));
 #endif
 
-	va_start(ap, cmd);
-
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, cluster, request, key, key_len, false);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, cluster, request, status, &replies[0])) {
-	     	va_list	copy;
-
 	     	RDEBUG3("Calling script 0x%s", digest);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendFormattedCommand(conn->handle, cmd, cmd_len);
 		pipelined = 1;
 		if (wait_num) {
 			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, fr_time_delta_to_msec(wait_timeout));
@@ -612,9 +620,7 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	     	RDEBUG3("Loading script 0x%s", digest);
 		redisAppendCommand(conn->handle, "MULTI");
 		redisAppendCommand(conn->handle, "SCRIPT LOAD %s", script);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendFormattedCommand(conn->handle, cmd, cmd_len);
 		redisAppendCommand(conn->handle, "EXEC");
 		pipelined = 4;
 		if (wait_num) {
@@ -686,41 +692,368 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	}
 
 finish:
-	va_end(ap);
 	return s_ret;
 }
 
-/** Allocate a new IP address from a pool
+/** Execute a script against Redis cluster
+ *
+ * Formats the EVALSHA command, and calls #ippool_script_formatted.
+ *
+ * @param[out] out		Where to write Redis reply object resulting from the command.
+ * @param[in] request		The current request.
+ * @param[in] cluster		configuration.
+ * @param[in] key		to use to determine the cluster node.
+ * @param[in] key_len		length of the key.
+ * @param[in] wait_num		If > 0 wait until this many slaves have replicated the data
+ *				from the last command.
+ * @param[in] wait_timeout	How long to wait for slaves to replicate the data.
+ * @param[in] digest		of script.
+ * @param[in] script		to upload.
+ * @param[in] cmd		EVALSHA command to execute.
+ * @param[in] ...		Arguments for the eval command.
+ * @return status of the command.
+ */
+static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_redis_cluster_t *cluster,
+				      uint8_t const *key, size_t key_len,
+				      uint32_t wait_num, fr_time_delta_t wait_timeout,
+				      char const digest[], char const *script,
+				      char const *cmd, ...)
+{
+	char			*formatted = NULL;
+	int			len;
+	fr_redis_rcode_t	status;
+	va_list			ap;
+
+	*out = NULL;
+
+	va_start(ap, cmd);
+	len = redisvFormatCommand(&formatted, cmd, ap);
+	va_end(ap);
+	if (len < 0) {
+		REDEBUG("Failed formatting EVALSHA command");
+		return REDIS_RCODE_ERROR;
+	}
+
+	status = ippool_script_formatted(out, request, cluster, key, key_len, wait_num, wait_timeout,
+					 digest, script, formatted, (size_t)len);
+	redisFreeCommand(formatted);
+
+	return status;
+}
+
+/** Resume context for scripts run over the pipelined trunk connections
  *
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, request_t *request,
-					    redis_ippool_alloc_call_env_t *env, uint32_t lease_time)
+typedef struct {
+	fr_redis_command_set_t	*cmds;		//!< Command set in progress.  NULL once the command
+						//!< set completes or fails.
+
+	char const		*digest;	//!< of the script.
+	char const		*script;	//!< to upload if the server doesn't have it cached.
+	bool			script_loaded;	//!< We've already tried to load the script.
+
+	char			*evalsha;	//!< RESP formatted EVALSHA command.
+	size_t			evalsha_len;	//!< Length of the EVALSHA command.
+
+	uint8_t const		*key;		//!< Used to select the cluster node.
+	size_t			key_len;	//!< Length of the key.
+
+	redisReply		*replies[3];	//!< SCRIPT LOAD, EVALSHA and WAIT replies.
+	size_t			reply_cnt;	//!< How many replies we received.
+	bool			checked;	//!< replies[0] is the EVALSHA reply, and has
+						//!< already been checked by ippool_script_formatted().
+} redis_ippool_rctx_t;
+
+/** Free any replies we didn't get around to processing
+ *
+ */
+static int _redis_ippool_rctx_free(redis_ippool_rctx_t *rctx)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
+	if (rctx->cmds) fr_redis_command_set_signal_cancel(rctx->cmds);
+	fr_redis_pipeline_free(rctx->replies, rctx->reply_cnt);
 
+	return 0;
+}
+
+/** Allocate a resume context for a script call
+ *
+ * @param[in] request		The current request.
+ * @param[in] key		to use to determine the cluster node.
+ * @param[in] key_len		length of the key.
+ * @param[in] digest		of script.
+ * @param[in] script		to upload.
+ * @param[in] cmd		EVALSHA command to execute.
+ * @param[in] ...		Arguments for the eval command.
+ * @return
+ *	- A new resume context.
+ *	- NULL if the command couldn't be formatted.
+ */
+static redis_ippool_rctx_t *ippool_script_rctx_alloc(request_t *request,
+						     uint8_t const *key, size_t key_len,
+						     char const digest[], char const *script,
+						     char const *cmd, ...)
+{
+	redis_ippool_rctx_t	*rctx;
+	char			*evalsha = NULL;
+	int			len;
+	va_list			ap;
+
+	va_start(ap, cmd);
+	len = redisvFormatCommand(&evalsha, cmd, ap);
+	va_end(ap);
+	if (len < 0) {
+		REDEBUG("Failed formatting EVALSHA command");
+		return NULL;
+	}
+
+	MEM(rctx = talloc_zero(unlang_interpret_frame_talloc_ctx(request), redis_ippool_rctx_t));
+	talloc_set_destructor(rctx, _redis_ippool_rctx_free);
+	rctx->key = key;
+	rctx->key_len = key_len;
+	rctx->digest = digest;
+	rctx->script = script;
+	MEM(rctx->evalsha = talloc_memdup(rctx, evalsha, (size_t)len));
+	rctx->evalsha_len = (size_t)len;
+	redisFreeCommand(evalsha);
+
+	return rctx;
+}
+
+/** Take the replies from the completed command set, and mark the request as runnable
+ *
+ */
+static void ippool_script_complete(request_t *request, fr_dlist_head_t *completed, void *uctx)
+{
+	redis_ippool_rctx_t	*rctx = talloc_get_type_abort(uctx, redis_ippool_rctx_t);
+	fr_redis_command_t	*cmd;
+
+	rctx->cmds = NULL;
+
+	for (cmd = fr_dlist_head(completed);
+	     cmd && (rctx->reply_cnt < NUM_ELEMENTS(rctx->replies));
+	     cmd = fr_dlist_next(completed, cmd)) {
+		rctx->replies[rctx->reply_cnt++] = fr_redis_command_steal_result(cmd);
+	}
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Record that the command set failed, and mark the request as runnable
+ *
+ */
+static void ippool_script_fail(request_t *request, UNUSED fr_dlist_head_t *completed, void *uctx)
+{
+	redis_ippool_rctx_t	*rctx = talloc_get_type_abort(uctx, redis_ippool_rctx_t);
+
+	rctx->cmds = NULL;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Cancel any outstanding commands if the request is cancelled
+ *
+ */
+static void ippool_script_signal(module_ctx_t const *mctx, request_t *request, UNUSED fr_signal_t action)
+{
+	redis_ippool_rctx_t	*rctx = talloc_get_type_abort(mctx->rctx, redis_ippool_rctx_t);
+
+	if (!rctx->cmds) return;
+
+	RDEBUG2("Cancelling outstanding redis commands");
+
+	fr_redis_command_set_signal_cancel(rctx->cmds);
+	rctx->cmds = NULL;
+}
+
+/** Run a script call on the cluster node responsible for the key
+ *
+ * If pipelining is enabled, the EVALSHA (and WAIT) are pipelined with
+ * commands from other requests, and the request yields.  If the server
+ * doesn't have the script cached, the call is resent with a SCRIPT LOAD
+ * in front of it.
+ *
+ * Otherwise the script is run on a pooled connection, and resume is
+ * called immediately.
+ *
+ * @param[out] p_result		Result of the module call, if we fail immediately.
+ * @param[in] mctx		Module calling ctx.
+ * @param[in] request		The current request.
+ * @param[in] rctx		Describing the call.
+ * @param[in] resume		Function to call once all replies have been received.
+ */
+static unlang_action_t ippool_script_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+					 redis_ippool_rctx_t *rctx, module_method_t resume)
+{
+	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
+	rlm_redis_ippool_thread_t const	*t = talloc_get_type_abort_const(mctx->thread, rlm_redis_ippool_thread_t);
+	fr_redis_command_set_t		*cmds;
+	char				*evalsha;
+
+	if (!inst->pipeline) {
+		redisReply *reply;
+
+		if (ippool_script_formatted(&reply, request, inst->cluster,
+					    rctx->key, rctx->key_len,
+					    inst->wait_num, inst->wait_timeout,
+					    rctx->digest, rctx->script,
+					    rctx->evalsha, rctx->evalsha_len) != REDIS_RCODE_SUCCESS) RETURN_MODULE_FAIL;
+
+		/*
+		 *	The WAIT reply has already been checked,
+		 *	so hand over just the EVALSHA reply.
+		 */
+		rctx->replies[0] = reply;
+		rctx->reply_cnt = 1;
+		rctx->checked = true;
+
+		return resume(p_result, MODULE_CTX(mctx->mi, mctx->thread, mctx->env_data, rctx), request);
+	}
+
+	MEM(cmds = fr_redis_command_set_alloc(NULL, request, ippool_script_complete, ippool_script_fail, rctx));
+
+	if (rctx->script_loaded) {
+		RDEBUG3("Loading script 0x%s", rctx->digest);
+		if (fr_redis_command_add(cmds, "SCRIPT LOAD %s", rctx->script) != FR_REDIS_PIPELINE_OK) goto error;
+	}
+
+	RDEBUG3("Calling script 0x%s", rctx->digest);
+	MEM(evalsha = talloc_memdup(cmds, rctx->evalsha, rctx->evalsha_len));
+	if (fr_redis_command_preformatted_add(cmds, evalsha, rctx->evalsha_len) != FR_REDIS_PIPELINE_OK) goto error;
+
+	if (inst->wait_num &&
+	    (fr_redis_command_add(cmds, "WAIT %i %i",
+				  inst->wait_num, fr_time_delta_to_msec(inst->wait_timeout)) != FR_REDIS_PIPELINE_OK)) {
+	error:
+		talloc_free(cmds);
+		RETURN_MODULE_FAIL;
+	}
+
+	rctx->cmds = cmds;
+	if (fr_redis_command_set_enqueue_by_key(t->cluster, cmds, rctx->key, rctx->key_len) != FR_REDIS_PIPELINE_OK) {
+		REDEBUG("Failed enqueueing script call");
+		rctx->cmds = NULL;
+		goto error;
+	}
+
+	/*
+	 *	Failed immediately, the command set has already been freed
+	 */
+	if (!rctx->cmds) RETURN_MODULE_FAIL;
+
+	return unlang_module_yield(request, resume, ippool_script_signal, ~FR_SIGNAL_CANCEL, rctx);
+}
+
+/** Check the replies to a script call
+ *
+ * @param[out] out		Where to write the reply to EVALSHA.  Must be freed
+ *				by the caller.
+ * @param[in] request		The current request.
+ * @param[in] inst		Module instance.
+ * @param[in] rctx		Holding the replies.
+ * @return
+ *	- REDIS_RCODE_SUCCESS if the script was executed.
+ *	- REDIS_RCODE_NO_SCRIPT if the script needs to be loaded.  The replies will
+ *	  have been freed, and the caller should call #ippool_script_run again.
+ *	- REDIS_RCODE_ERROR on any other error.
+ */
+static fr_redis_rcode_t ippool_script_result(redisReply **out, request_t *request,
+					     rlm_redis_ippool_t const *inst, redis_ippool_rctx_t *rctx)
+{
+	size_t			idx = rctx->script_loaded ? 1 : 0;
 	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+
+	*out = NULL;
+
+	if (rctx->checked) {
+		*out = rctx->replies[0];
+		rctx->replies[0] = NULL;
+		return REDIS_RCODE_SUCCESS;
+	}
+
+	if (rctx->reply_cnt < (idx + 1 + (inst->wait_num ? 1 : 0))) {
+		REDEBUG("Failed executing script");
+		return REDIS_RCODE_ERROR;
+	}
+
+	if (RDEBUG_ENABLED3) {
+		size_t i;
+
+		for (i = 0; i < rctx->reply_cnt; i++) fr_redis_reply_print(L_DBG_LVL_3, rctx->replies[i], request, i);
+	}
+
+	if (rctx->script_loaded) {
+		if (rctx->replies[0]->type != REDIS_REPLY_STRING) {
+			RERROR("Bad response to SCRIPT LOAD, expected string got %s",
+			       fr_table_str_by_value(redis_reply_types, rctx->replies[0]->type, "<UNKNOWN>"));
+			return REDIS_RCODE_ERROR;
+		}
+		if (strcmp(rctx->replies[0]->str, rctx->digest) != 0) {
+			RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
+				rctx->digest, rctx->replies[0]->str);
+			return REDIS_RCODE_ERROR;
+		}
+	}
+
+	status = fr_redis_command_status(NULL, rctx->replies[idx]);
+	switch (status) {
+	case REDIS_RCODE_SUCCESS:
+		break;
+
+	case REDIS_RCODE_NO_SCRIPT:
+		if (!rctx->script_loaded) {
+			fr_redis_pipeline_free(rctx->replies, rctx->reply_cnt);
+			rctx->reply_cnt = 0;
+			rctx->script_loaded = true;
+			return REDIS_RCODE_NO_SCRIPT;
+		}
+		FALL_THROUGH;
+
+	default:
+		RPEDEBUG("Failed executing script");
+		return REDIS_RCODE_ERROR;
+	}
+
+	if (inst->wait_num && (ippool_wait_check(request, inst->wait_num, rctx->replies[idx + 1]) < 0)) {
+		return REDIS_RCODE_ERROR;
+	}
+
+	*out = rctx->replies[idx];
+	rctx->replies[idx] = NULL;
+
+	return REDIS_RCODE_SUCCESS;
+}
+
+/** Prepare the script call to allocate a new IP address from a pool
+ *
+ */
+static redis_ippool_rctx_t *redis_ippool_allocate_rctx(request_t *request,
+						       redis_ippool_alloc_call_env_t *env, uint32_t lease_time)
+{
+	struct timeval now;
 
 	fr_assert(env->pool_name.vb_length > 0);
 	fr_assert(env->owner.vb_length > 0);
 
 	now = fr_time_to_timeval(fr_time());
 
-	status = ippool_script(&reply, request, inst->cluster,
-			       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-			       inst->wait_num, inst->wait_timeout,
-			       lua_alloc_digest, lua_alloc_cmd,
-	 		       "EVALSHA %s 1 %b %u %u %b %b",
-	 		       lua_alloc_digest,
-			       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-			       (unsigned int)now.tv_sec, lease_time,
-			       (uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length,
-			       (uint8_t const *)env->gateway_id.vb_strvalue, env->gateway_id.vb_length);
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
+	return ippool_script_rctx_alloc(request,
+					(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+					lua_alloc_digest, lua_alloc_cmd,
+					"EVALSHA %s 1 %b %u %u %b %b",
+					lua_alloc_digest,
+					(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+					(unsigned int)now.tv_sec, lease_time,
+					(uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length,
+					(uint8_t const *)env->gateway_id.vb_strvalue, env->gateway_id.vb_length);
+}
+
+/** Process the result of allocating a new IP address from a pool
+ *
+ * @note reply is always freed.
+ */
+static ippool_rcode_t redis_ippool_allocate(request_t *request, redis_ippool_alloc_call_env_t *env, redisReply *reply)
+{
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
 	fr_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
@@ -872,57 +1205,58 @@ finish:
 	return ret;
 }
 
-/** Update an existing IP address in a pool
+/** Prepare the script call to update an existing IP address in a pool
  *
  */
-static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, request_t *request,
-					  redis_ippool_update_call_env_t *env,
-					  fr_ipaddr_t *ip,
-					  fr_value_box_t const *owner,
-					  fr_value_box_t const *gateway_id,
-					  uint32_t expires)
+static redis_ippool_rctx_t *redis_ippool_update_rctx(rlm_redis_ippool_t const *inst, request_t *request,
+						     redis_ippool_update_call_env_t *env,
+						     fr_ipaddr_t *ip,
+						     fr_value_box_t const *owner,
+						     fr_value_box_t const *gateway_id,
+						     uint32_t expires)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+	struct timeval now;
 
 	now = fr_time_to_timeval(fr_time());
 
 	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %u %b %b",
-				       lua_update_digest,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       (unsigned int)now.tv_sec, expires,
-				       htonl(ip->addr.v4.s_addr),
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length,
-				       (uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length);
+		return ippool_script_rctx_alloc(request,
+						(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+						lua_update_digest, lua_update_cmd,
+						"EVALSHA %s 1 %b %u %u %u %b %b",
+						lua_update_digest,
+						(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+						(unsigned int)now.tv_sec, expires,
+						htonl(ip->addr.v4.s_addr),
+						(uint8_t const *)owner->vb_strvalue, owner->vb_length,
+						(uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length);
 	} else {
 		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
 
 		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %s %b %b",
-				       lua_update_digest,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       (unsigned int)now.tv_sec, expires,
-				       ip_buff,
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length,
-				       (uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return ippool_script_rctx_alloc(request,
+						(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+						lua_update_digest, lua_update_cmd,
+						"EVALSHA %s 1 %b %u %u %s %b %b",
+						lua_update_digest,
+						(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+						(unsigned int)now.tv_sec, expires,
+						ip_buff,
+						(uint8_t const *)owner->vb_strvalue, owner->vb_length,
+						(uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length);
 	}
+}
 
+/** Process the result of updating an existing IP address in a pool
+ *
+ * @note reply is always freed.
+ */
+static ippool_rcode_t redis_ippool_update(request_t *request, redis_ippool_update_call_env_t *env,
+					  redisReply *reply, uint32_t expires)
+{
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+
+	fr_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
@@ -1098,10 +1432,43 @@ finish:
 		RETURN_MODULE_NOOP; \
 	}
 
-static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t CC_HINT(nonnull) mod_alloc_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+							  request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
 	redis_ippool_alloc_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_alloc_call_env_t);
+	redis_ippool_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, redis_ippool_rctx_t);
+	redisReply			*reply;
+
+	switch (ippool_script_result(&reply, request, inst, rctx)) {
+	case REDIS_RCODE_SUCCESS:
+		break;
+
+	case REDIS_RCODE_NO_SCRIPT:
+		return ippool_script_run(p_result, mctx, request, rctx, mod_alloc_resume);
+
+	default:
+		RETURN_MODULE_FAIL;
+	}
+
+	switch (redis_ippool_allocate(request, env, reply)) {
+	case IPPOOL_RCODE_SUCCESS:
+		RDEBUG2("IP address lease allocated");
+		RETURN_MODULE_UPDATED;
+
+	case IPPOOL_RCODE_POOL_EMPTY:
+		RWDEBUG("Pool contains no free addresses");
+		RETURN_MODULE_NOTFOUND;
+
+	default:
+		RETURN_MODULE_FAIL;
+	}
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	redis_ippool_alloc_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_alloc_call_env_t);
+	redis_ippool_rctx_t		*rctx;
 	uint32_t			lease_time;
 
 	CHECK_POOL_NAME
@@ -1114,33 +1481,33 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 			env->offer_time.vb_uint32 : env->lease_time.vb_uint32;
 	ippool_action_print(request, POOL_ACTION_ALLOCATE, L_DBG_LVL_2, &env->pool_name, NULL,
 			    &env->owner, &env->gateway_id, lease_time);
-	switch (redis_ippool_allocate(inst, request, env, lease_time)) {
-	case IPPOOL_RCODE_SUCCESS:
-		RDEBUG2("IP address lease allocated");
-		RETURN_MODULE_UPDATED;
 
-	case IPPOOL_RCODE_POOL_EMPTY:
-		RWDEBUG("Pool contains no free addresses");
-		RETURN_MODULE_NOTFOUND;
+	rctx = redis_ippool_allocate_rctx(request, env, lease_time);
+	if (!rctx) RETURN_MODULE_FAIL;
 
-	default:
-		RETURN_MODULE_FAIL;
-	}
+	return ippool_script_run(p_result, mctx, request, rctx, mod_alloc_resume);
 }
 
-static unlang_action_t CC_HINT(nonnull) mod_update(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t CC_HINT(nonnull) mod_update_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+							   request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
 	redis_ippool_update_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_update_call_env_t);
+	redis_ippool_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, redis_ippool_rctx_t);
+	redisReply			*reply;
 
-	CHECK_POOL_NAME
+	switch (ippool_script_result(&reply, request, inst, rctx)) {
+	case REDIS_RCODE_SUCCESS:
+		break;
 
-	ippool_action_print(request, POOL_ACTION_UPDATE, L_DBG_LVL_2, &env->pool_name,
-			    &env->requested_address, &env->owner, &env->gateway_id, env->lease_time.vb_uint32);
-	switch (redis_ippool_update(inst, request, env,
-				    &env->requested_address.datum.ip, &env->owner,
-				    &env->gateway_id,
-				    env->lease_time.vb_uint32)) {
+	case REDIS_RCODE_NO_SCRIPT:
+		return ippool_script_run(p_result, mctx, request, rctx, mod_update_resume);
+
+	default:
+		RETURN_MODULE_FAIL;
+	}
+
+	switch (redis_ippool_update(request, env, reply, env->lease_time.vb_uint32)) {
 	case IPPOOL_RCODE_SUCCESS:
 		RDEBUG2("Requested IP address' \"%pV\" lease updated", &env->requested_address);
 
@@ -1190,6 +1557,26 @@ static unlang_action_t CC_HINT(nonnull) mod_update(rlm_rcode_t *p_result, module
 	}
 }
 
+static unlang_action_t CC_HINT(nonnull) mod_update(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
+	redis_ippool_update_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_update_call_env_t);
+	redis_ippool_rctx_t		*rctx;
+
+	CHECK_POOL_NAME
+
+	ippool_action_print(request, POOL_ACTION_UPDATE, L_DBG_LVL_2, &env->pool_name,
+			    &env->requested_address, &env->owner, &env->gateway_id, env->lease_time.vb_uint32);
+
+	rctx = redis_ippool_update_rctx(inst, request, env,
+					&env->requested_address.datum.ip, &env->owner,
+					&env->gateway_id,
+					env->lease_time.vb_uint32);
+	if (!rctx) RETURN_MODULE_FAIL;
+
+	return ippool_script_run(p_result, mctx, request, rctx, mod_update_resume);
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
@@ -1231,6 +1618,30 @@ static unlang_action_t CC_HINT(nonnull) mod_bulk_release(rlm_rcode_t *p_result,
 	RETURN_MODULE_NOOP;
 }
 
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
+
+	TALLOC_FREE(t->cluster);
+
+	return 0;
+}
+
+/** Allocate thread specific trunks for pipelining allocations and updates, if pipelining is enabled
+ *
+ */
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_redis_ippool_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_redis_ippool_t);
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
+
+	if (!inst->pipeline) return 0;
+
+	t->cluster = fr_redis_cluster_thread_alloc(t, mctx->el, &inst->trunk_conf, inst->cluster, &inst->conf);
+
+	return 0;
+}
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	static bool			done_hash = false;
@@ -1240,6 +1651,8 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 
 	fr_assert(subcs);
 
+	inst->conf.log_prefix = mctx->mi->name;
+
 	inst->cluster = fr_redis_cluster_alloc(inst, subcs, &inst->conf, true, NULL, NULL, NULL);
 	if (!inst->cluster) return -1;
 
@@ -1289,7 +1702,12 @@ module_rlm_t rlm_redis_ippool = {
 		.inst_size	= sizeof(rlm_redis_ippool_t),
 		.config		= module_config,
 		.onload		= mod_load,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+
+		.thread_inst_size	= sizeof(rlm_redis_ippool_thread_t),
+		.thread_inst_type	= "rlm_redis_ippool_thread_t",
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
 	.method_names = (module_method_name_t[]){
 		/*
@@ -43,6 +43,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/unlang/interpret.h>
 
 #include <sys/stat.h>
 
@@ -74,6 +75,25 @@ typedef struct {
 	char		**row;
 } rlm_sql_postgres_conn_t;
 
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+/** A connection used for asynchronous, pipelined queries
+ *
+ */
+typedef struct {
+	PGconn			*db;
+	int			fd;			//!< Socket libpq is using.
+	fr_connection_t		*conn;			//!< Connection state machine this handle belongs to.
+	rlm_sql_postgresql_t const *inst;		//!< Driver instance.
+	rlm_sql_t const		*parent;		//!< rlm_sql instance.
+	fr_dlist_head_t		queries;		//!< Queries sent to the server, in the order their
+							///< results will be returned.
+	bool			head_result;		//!< Results have been received for the query at
+							///< the head of the queries list.
+	bool			flush_pending;		//!< libpq has data it couldn't write to the socket.
+	fr_trunk_connection_event_t notify_on;		//!< Events the trunk wants to be notified about.
+} rlm_sql_postgres_trunk_conn_t;
+#endif
+
 static conf_parser_t driver_config[] = {
 	{ FR_CONF_OFFSET("send_application_name", rlm_sql_postgresql_t, send_application_name), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
@@ -544,6 +564,446 @@ static size_t sql_escape_func(request_t *request, char *out, size_t outlen, char
 	return ret;
 }
 
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+static int _sql_trunk_conn_free(rlm_sql_postgres_trunk_conn_t *c)
+{
+	if (!c->db) return 0;
+
+	PQfinish(c->db);
+	c->db = NULL;
+
+	return 0;
+}
+
+/** Close a trunk connection
+ *
+ * Any queries still in the list are tombstones of cancelled requests,
+ * and are freed along with the handle.
+ */
+static void _sql_trunk_conn_close(fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(h, rlm_sql_postgres_trunk_conn_t);
+	fr_sql_query_t			*query;
+
+	if (c->fd >= 0) {
+		fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+		c->fd = -1;
+	}
+
+	while ((query = fr_dlist_pop_head(&c->queries))) {
+		if (query->status == SQL_QUERY_CANCELLED) talloc_free(query);
+	}
+
+	talloc_free(h);
+}
+
+/** Advance the nonblocking connection process
+ *
+ * libpq tells us whether it wants to read or write next, and we
+ * install the appropriate I/O handler, until the connection is
+ * established or fails.
+ */
+static void _sql_trunk_conn_poll(fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_postgres_trunk_conn_t);
+	fr_event_fd_cb_t		read_fn = NULL, write_fn = NULL;
+	int				new_fd;
+
+	switch (PQconnectPoll(c->db)) {
+	case PGRES_POLLING_OK:
+		if (c->fd >= 0) fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+		c->fd = PQsocket(c->db);
+
+		if (PQenterPipelineMode(c->db) != 1) {
+			ERROR("Failed entering pipeline mode: %s", PQerrorMessage(c->db));
+			goto fail;
+		}
+
+		DEBUG2("Connected to database '%s' on '%s' server version %i, protocol version %i, backend PID %i ",
+		       PQdb(c->db), PQhost(c->db), PQserverVersion(c->db), PQprotocolVersion(c->db),
+		       PQbackendPID(c->db));
+
+		fr_connection_signal_connected(c->conn);
+		return;
+
+	case PGRES_POLLING_READING:
+		read_fn = _sql_trunk_conn_poll;
+		break;
+
+	case PGRES_POLLING_WRITING:
+		write_fn = _sql_trunk_conn_poll;
+		break;
+
+	default:
+		ERROR("Connection failed: %s", PQerrorMessage(c->db));
+	fail:
+		fr_connection_signal_reconnect(c->conn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	/*
+	 *	libpq may move on to another host, and
+	 *	so another socket, when a connection
+	 *	attempt fails.
+	 */
+	new_fd = PQsocket(c->db);
+	if ((c->fd >= 0) && (new_fd != c->fd)) fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+	c->fd = new_fd;
+
+	if (fr_event_fd_insert(c, NULL, el, c->fd, read_fn, write_fn, NULL, c) < 0) {
+		PERROR("Failed inserting FD event");
+		goto fail;
+	}
+}
+
+/** Start a nonblocking connection to the database
+ *
+ */
+static fr_connection_state_t _sql_trunk_conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+{
+	rlm_sql_thread_t		*thread = talloc_get_type_abort(uctx, rlm_sql_thread_t);
+	rlm_sql_postgres_trunk_conn_t	*c;
+
+	MEM(c = talloc_zero(conn, rlm_sql_postgres_trunk_conn_t));
+	*c = (rlm_sql_postgres_trunk_conn_t) {
+		.fd = -1,
+		.conn = conn,
+		.parent = thread->inst,
+		.inst = talloc_get_type_abort(thread->inst->driver_submodule->data, rlm_sql_postgresql_t)
+	};
+	fr_dlist_talloc_init(&c->queries, fr_sql_query_t, entry);
+	talloc_set_destructor(c, _sql_trunk_conn_free);
+
+	DEBUG2("Starting connection using parameters: %s", c->inst->db_string);
+	c->db = PQconnectStart(c->inst->db_string);
+	if (!c->db) {
+		ERROR("Connection failed: Out of memory");
+	error:
+		talloc_free(c);
+		return FR_CONNECTION_STATE_FAILED;
+	}
+	if (PQstatus(c->db) == CONNECTION_BAD) {
+		ERROR("Connection failed: %s", PQerrorMessage(c->db));
+		goto error;
+	}
+	if (PQsetnonblocking(c->db, 1) != 0) {
+		ERROR("Failed setting connection to nonblocking: %s", PQerrorMessage(c->db));
+		goto error;
+	}
+
+	c->fd = PQsocket(c->db);
+	if (fr_event_fd_insert(c, NULL, conn->el, c->fd, NULL, _sql_trunk_conn_poll, NULL, c) < 0) {
+		PERROR("Failed inserting FD event");
+		goto error;
+	}
+
+	*h_out = c;
+
+	return FR_CONNECTION_STATE_CONNECTING;
+}
+
+static fr_connection_t *sql_trunk_connection_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+						   fr_connection_conf_t const *conn_conf,
+						   char const *log_prefix, void *uctx)
+{
+	fr_connection_t	*conn;
+
+	conn = fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+					.init = _sql_trunk_conn_init,
+					.close = _sql_trunk_conn_close
+				   },
+				   conn_conf, log_prefix, uctx);
+	if (!conn) {
+		PERROR("Failed allocating state handler for new PostgreSQL connection");
+		return NULL;
+	}
+
+	return conn;
+}
+
+static void sql_trunk_conn_events_set(rlm_sql_postgres_trunk_conn_t *c, fr_trunk_connection_t *tconn,
+				      fr_event_list_t *el);
+
+static void sql_trunk_conn_error(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	ERROR("Connection failed on fd %d: %s", fd, fr_syserror(fd_errno));
+
+	fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+static void sql_trunk_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_readable(tconn);
+}
+
+/** Write out any data libpq buffered, then let the trunk send more queries
+ *
+ */
+static void sql_trunk_conn_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t		*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(tconn->conn->h, rlm_sql_postgres_trunk_conn_t);
+
+	if (c->flush_pending) {
+		switch (PQflush(c->db)) {
+		case 0:
+			c->flush_pending = false;
+			sql_trunk_conn_events_set(c, tconn, el);
+			break;
+
+		case 1:
+			return;
+
+		default:
+			ERROR("Failed sending queries: %s", PQerrorMessage(c->db));
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
+	}
+
+	if (c->notify_on & FR_TRUNK_CONN_EVENT_WRITE) fr_trunk_connection_signal_writable(tconn);
+}
+
+/** Install I/O handlers for the events the trunk wants, plus writes if libpq has unflushed data
+ *
+ */
+static void sql_trunk_conn_events_set(rlm_sql_postgres_trunk_conn_t *c, fr_trunk_connection_t *tconn,
+				      fr_event_list_t *el)
+{
+	fr_event_fd_cb_t	read_fn = NULL;
+	fr_event_fd_cb_t	write_fn = NULL;
+
+	if (c->notify_on & FR_TRUNK_CONN_EVENT_READ) read_fn = sql_trunk_conn_readable;
+	if ((c->notify_on & FR_TRUNK_CONN_EVENT_WRITE) || c->flush_pending) write_fn = sql_trunk_conn_writable;
+
+	if (!read_fn && !write_fn) {
+		fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+		return;
+	}
+
+	if (fr_event_fd_insert(c, NULL, el, c->fd, read_fn, write_fn, sql_trunk_conn_error, tconn) < 0) {
+		PERROR("Failed inserting FD event");
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+static void sql_trunk_connection_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+					fr_event_list_t *el,
+					fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_postgres_trunk_conn_t);
+
+	c->notify_on = notify_on;
+	sql_trunk_conn_events_set(c, tconn, el);
+}
+
+/** Send pending queries, each followed by a sync point
+ *
+ * A sync point after every query means an error only aborts the
+ * query which caused it, not the rest of the pipeline.
+ */
+static void sql_trunk_request_mux(fr_event_list_t *el, fr_trunk_connection_t *tconn,
+				  fr_connection_t *conn, UNUSED void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_postgres_trunk_conn_t);
+	fr_trunk_request_t		*treq;
+	fr_sql_query_t			*query;
+	request_t			*request;
+
+	while (fr_trunk_connection_pop_request(&treq, tconn) == 0) {
+		if (!treq) break;
+
+		query = talloc_get_type_abort(treq->preq, fr_sql_query_t);
+		request = query->request;
+
+		if (!PQsendQueryParams(c->db, query->query_str, 0, NULL, NULL, NULL, NULL, 0) ||
+		    !PQpipelineSync(c->db)) {
+			ROPTIONAL(RERROR, ERROR, "Failed to send query: %s", PQerrorMessage(c->db));
+			fr_trunk_request_signal_fail(treq);
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
+
+		query->status = SQL_QUERY_SUBMITTED;
+		fr_dlist_insert_tail(&c->queries, query);
+		fr_trunk_request_signal_sent(treq);
+	}
+
+	switch (PQflush(c->db)) {
+	case 0:
+		break;
+
+	case 1:
+		if (!c->flush_pending) {
+			c->flush_pending = true;
+			sql_trunk_conn_events_set(c, tconn, el);
+		}
+		break;
+
+	default:
+		ERROR("Failed sending queries: %s", PQerrorMessage(c->db));
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		break;
+	}
+}
+
+/** Record the result of the query at the head of the pipeline
+ *
+ */
+static void sql_trunk_query_result(rlm_sql_postgres_trunk_conn_t *c, fr_sql_query_t *query, PGresult *result)
+{
+	request_t	*request = query->request;
+	rlm_sql_t const	*inst = c->parent;
+	ExecStatusType	status = PQresultStatus(result);
+
+	switch (status) {
+	case PGRES_COMMAND_OK:
+		query->affected_rows = affected_rows(result);
+		break;
+
+#ifdef HAVE_PGRES_SINGLE_TUPLE
+	case PGRES_SINGLE_TUPLE:
+#endif
+	case PGRES_TUPLES_OK:
+		query->affected_rows = PQntuples(result);
+		break;
+
+	default:
+		break;
+	}
+
+	query->rcode = sql_classify_error(UNCONST(rlm_sql_postgresql_t *, c->inst), status, result);
+	if ((query->rcode != RLM_SQL_OK) && request) {
+		char const *msg = PQresultErrorMessage(result);
+
+		if (msg && *msg) {
+			if (query->rcode == RLM_SQL_ALT_QUERY) {
+				RDEBUG2("%s", msg);
+			} else {
+				RERROR("%s", msg);
+			}
+		}
+	}
+
+	DEBUG3("Query on %s returned: %s", inst->name,
+	       fr_table_str_by_value(sql_rcode_description_table, query->rcode, "<INVALID>"));
+}
+
+/** Read results from the pipeline, and resume the requests they belong to
+ *
+ */
+static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn,
+				    fr_connection_t *conn, UNUSED void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_postgres_trunk_conn_t);
+	fr_sql_query_t			*query;
+	PGresult			*result;
+
+	if (!PQconsumeInput(c->db)) {
+		ERROR("Failed reading input: %s", PQerrorMessage(c->db));
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	while (!PQisBusy(c->db)) {
+		fr_trunk_request_t	*treq;
+
+		query = fr_dlist_head(&c->queries);
+		result = PQgetResult(c->db);
+		if (result) {
+			/*
+			 *	Sync points delimit queries, they don't
+			 *	carry results of their own.
+			 */
+			if (PQresultStatus(result) == PGRES_PIPELINE_SYNC) {
+				PQclear(result);
+				continue;
+			}
+
+			/*
+			 *	Only the first result of a query is
+			 *	recorded.  Results for cancelled queries
+			 *	are discarded.
+			 */
+			if (query && !c->head_result) {
+				if (query->status != SQL_QUERY_CANCELLED) sql_trunk_query_result(c, query, result);
+				c->head_result = true;
+			}
+			PQclear(result);
+			continue;
+		}
+
+		/*
+		 *	NULL without any results means the
+		 *	pipeline is idle.
+		 */
+		if (!query || !c->head_result) break;
+
+		/*
+		 *	NULL after results marks the end of
+		 *	the query at the head of the pipeline.
+		 */
+		fr_dlist_remove(&c->queries, query);
+		c->head_result = false;
+
+		if (query->status == SQL_QUERY_CANCELLED) {
+			talloc_free(query);
+			continue;
+		}
+
+		query->status = SQL_QUERY_RETURNED;
+		treq = query->treq;
+		query->treq = NULL;
+
+		if (query->request) unlang_interpret_mark_runnable(query->request);
+		fr_trunk_request_signal_complete(treq);
+	}
+}
+
+/** Remove a query from a connection
+ *
+ * Queries which were cancelled by their request can't be removed
+ * from the pipeline, so they're kept as tombstones until their
+ * results arrive and are discarded.
+ */
+static void sql_trunk_request_cancel(fr_connection_t *conn, void *preq, fr_trunk_cancel_reason_t reason,
+				     UNUSED void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_postgres_trunk_conn_t);
+	fr_sql_query_t			*query = talloc_get_type_abort(preq, fr_sql_query_t);
+
+	switch (reason) {
+	case FR_TRUNK_CANCEL_REASON_SIGNAL:
+		query->status = SQL_QUERY_CANCELLED;
+		query->request = NULL;
+		query->treq = NULL;
+		talloc_steal(c, query);
+		break;
+
+	/*
+	 *	Connection is going away, the query will be
+	 *	sent again on another connection.
+	 */
+	case FR_TRUNK_CANCEL_REASON_MOVE:
+	case FR_TRUNK_CANCEL_REASON_REQUEUE:
+		if (fr_dlist_head(&c->queries) == query) c->head_result = false;
+		fr_dlist_remove(&c->queries, query);
+		query->status = SQL_QUERY_PREPARED;
+		query->rcode = RLM_SQL_ERROR;
+		query->affected_rows = -1;
+		break;
+
+	case FR_TRUNK_CANCEL_REASON_NONE:
+		break;
+	}
+}
+#endif
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	rlm_sql_t const		*parent = talloc_get_type_abort(mctx->mi->parent->data, rlm_sql_t);
@@ -688,5 +1148,16 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
 	.sql_affected_rows		= sql_affected_rows,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	.uses_trunks			= true,
+	.trunk_io_funcs = {
+		.connection_alloc	= sql_trunk_connection_alloc,
+		.connection_notify	= sql_trunk_connection_notify,
+		.request_mux		= sql_trunk_request_mux,
+		.request_demux		= sql_trunk_request_demux,
+		.request_cancel		= sql_trunk_request_cancel,
+		.request_fail		= sql_request_fail
+	}
+#endif
 };
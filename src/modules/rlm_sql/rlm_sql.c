@@ -72,6 +72,11 @@ static const conf_parser_t module_config[] = {
 	 */
 	{ FR_CONF_OFFSET("query_timeout", rlm_sql_config_t, query_timeout) },
 
+	/*
+	 *	Only used by drivers which support asynchronous queries.
+	 */
+	{ FR_CONF_OFFSET_SUBSECTION("trunk", 0, rlm_sql_t, trunk_conf, fr_trunk_config) },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -213,9 +218,12 @@ typedef struct {
 	rlm_sql_t const			*inst;		//!< Module instance.
 	request_t			*request;	//!< Request being processed.
 	rlm_sql_handle_t		*handle;	//!< Database connection handle.
+	fr_trunk_t			*trunk;		//!< Trunk to run queries on, if the driver is asynchronous.
 	sql_redundant_call_env_t	*call_env;	//!< Call environment data.
 	size_t				query_no;	//!< Current query number.
 	fr_value_box_list_t		query;		//!< Where expanded query tmpl will be written.
+	fr_value_box_t			*query_vb;	//!< Expanded query currently being run on the trunk.
+	fr_sql_query_t			*query_ctx;	//!< Query currently being run on the trunk.
 } sql_redundant_ctx_t;
 
 typedef struct {
@@ -1497,26 +1505,23 @@ static int sql_redundant_ctx_free(sql_redundant_ctx_t *to_free)
  * @param uctx		Current redundant sql context.
  * @return one of the RLM_MODULE_* values.
  */
-static unlang_action_t mod_sql_redundant_resume(rlm_rcode_t *p_result, UNUSED int *priority, request_t *request, void *uctx)
+static unlang_action_t mod_sql_redundant_resume(rlm_rcode_t *p_result, UNUSED int *priority, request_t *request, void *uctx);
+
+/** Check the result of a query in a redundant list, and move on to the next query if required
+ *
+ * @param p_result	Result of current module call.
+ * @param request	Current request.
+ * @param redundant_ctx	Current redundant sql context.
+ * @param sql_ret	Result of the query.
+ * @param numaffected	Number of rows the query updated.
+ * @return one of the RLM_MODULE_* values.
+ */
+static unlang_action_t sql_redundant_next(rlm_rcode_t *p_result, request_t *request,
+					  sql_redundant_ctx_t *redundant_ctx, sql_rcode_t sql_ret, int numaffected)
 {
-	sql_redundant_ctx_t		*redundant_ctx = talloc_get_type_abort(uctx, sql_redundant_ctx_t);
 	sql_redundant_call_env_t	*call_env = redundant_ctx->call_env;
-	rlm_sql_t const			*inst = redundant_ctx->inst;
-	fr_value_box_t			*query;
-	int				sql_ret;
-	int				numaffected = 0;
 	tmpl_t				*next_query;
 
-	query = fr_value_box_list_pop_head(&redundant_ctx->query);
-	if (!query) RETURN_MODULE_FAIL;
-
-	if ((call_env->filename.type == FR_TYPE_STRING) && (call_env->filename.vb_length > 0)) {
-		rlm_sql_query_log(inst, call_env->filename.vb_strvalue, query->vb_strvalue);
-	}
-
-	sql_ret = rlm_sql_query(inst, request, &redundant_ctx->handle, query->vb_strvalue);
-	talloc_free(query);
-
 	RDEBUG2("SQL query returned: %s", fr_table_str_by_value(sql_rcode_description_table, sql_ret, "<INVALID>"));
 
 	switch (sql_ret) {
@@ -1524,6 +1529,7 @@ static unlang_action_t mod_sql_redundant_resume(rlm_rcode_t *p_result, UNUSED in
 	 *	Query was a success! Now we just need to check if it did anything.
 	 */
 	case RLM_SQL_OK:
+	case RLM_SQL_NO_MORE_ROWS:
 		break;
 
 	/*
@@ -1551,14 +1557,11 @@ static unlang_action_t mod_sql_redundant_resume(rlm_rcode_t *p_result, UNUSED in
 	case RLM_SQL_ALT_QUERY:
 		goto next;
 	}
-	fr_assert(redundant_ctx->handle);
 
 	/*
 	 *	We need to have updated something for the query to have been
 	 *	counted as successful.
 	 */
-	numaffected = (inst->driver->sql_affected_rows)(redundant_ctx->handle, &inst->config);
-	(inst->driver->sql_finish_query)(redundant_ctx->handle, &inst->config);
 	RDEBUG2("%i record(s) updated", numaffected);
 
 	if (numaffected > 0) RETURN_MODULE_OK;	/* A query succeeded, were done! */
@@ -1577,6 +1580,81 @@ next:
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+/** Resume function called after an asynchronous query in a redundant list of queries has returned
+ *
+ * @param p_result	Result of current module call.
+ * @param priority	Unused.
+ * @param request	Current request.
+ * @param uctx		Current redundant sql context.
+ * @return one of the RLM_MODULE_* values.
+ */
+static unlang_action_t mod_sql_redundant_query_resume(rlm_rcode_t *p_result, UNUSED int *priority,
+						      request_t *request, void *uctx)
+{
+	sql_redundant_ctx_t		*redundant_ctx = talloc_get_type_abort(uctx, sql_redundant_ctx_t);
+	fr_sql_query_t			*query_ctx = redundant_ctx->query_ctx;
+	sql_rcode_t			sql_ret = query_ctx->rcode;
+	int				numaffected = query_ctx->affected_rows;
+
+	TALLOC_FREE(redundant_ctx->query_ctx);
+	TALLOC_FREE(redundant_ctx->query_vb);
+
+	return sql_redundant_next(p_result, request, redundant_ctx, sql_ret, numaffected);
+}
+
+/** Resume function called after expansion of next query in a redundant list of queries
+ *
+ * @param p_result	Result of current module call.
+ * @param priority	Unused.
+ * @param request	Current request.
+ * @param uctx		Current redundant sql context.
+ * @return one of the RLM_MODULE_* values.
+ */
+static unlang_action_t mod_sql_redundant_resume(rlm_rcode_t *p_result, UNUSED int *priority, request_t *request, void *uctx)
+{
+	sql_redundant_ctx_t		*redundant_ctx = talloc_get_type_abort(uctx, sql_redundant_ctx_t);
+	sql_redundant_call_env_t	*call_env = redundant_ctx->call_env;
+	rlm_sql_t const			*inst = redundant_ctx->inst;
+	fr_value_box_t			*query;
+	sql_rcode_t			sql_ret;
+	int				numaffected = 0;
+
+	query = fr_value_box_list_pop_head(&redundant_ctx->query);
+	if (!query) RETURN_MODULE_FAIL;
+
+	if ((call_env->filename.type == FR_TYPE_STRING) && (call_env->filename.vb_length > 0)) {
+		rlm_sql_query_log(inst, call_env->filename.vb_strvalue, query->vb_strvalue);
+	}
+
+	/*
+	 *	Asynchronous drivers run the query on a trunk
+	 *	connection and yield until it returns.
+	 */
+	if (redundant_ctx->trunk) {
+		redundant_ctx->query_vb = query;
+		redundant_ctx->query_ctx = fr_sql_query_alloc(redundant_ctx, inst, request, query->vb_strvalue);
+
+		if (unlang_function_repeat_set(request, mod_sql_redundant_query_resume) < 0) RETURN_MODULE_FAIL;
+		if (rlm_sql_trunk_query(redundant_ctx->query_ctx, redundant_ctx->trunk) == UNLANG_ACTION_FAIL) {
+			RETURN_MODULE_FAIL;
+		}
+
+		return UNLANG_ACTION_PUSHED_CHILD;
+	}
+
+	sql_ret = rlm_sql_query(inst, request, &redundant_ctx->handle, query->vb_strvalue);
+	talloc_free(query);
+
+	if (sql_ret == RLM_SQL_OK) {
+		fr_assert(redundant_ctx->handle);
+
+		numaffected = (inst->driver->sql_affected_rows)(redundant_ctx->handle, &inst->config);
+		(inst->driver->sql_finish_query)(redundant_ctx->handle, &inst->config);
+	}
+
+	return sql_redundant_next(p_result, request, redundant_ctx, sql_ret, numaffected);
+}
+
 /**  Generic module call for failing between a bunch of queries.
  *
  * Used for `accounting` and `send` module calls
@@ -1585,6 +1663,7 @@ next:
 static unlang_action_t CC_HINT(nonnull) mod_sql_redundant(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_sql_t const			*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_sql_t);
+	rlm_sql_thread_t		*thread = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
 	sql_redundant_call_env_t	*call_env = talloc_get_type_abort(mctx->env_data, sql_redundant_call_env_t);
 	sql_redundant_ctx_t		*redundant_ctx;
 
@@ -1601,14 +1680,22 @@ static unlang_action_t CC_HINT(nonnull) mod_sql_redundant(rlm_rcode_t *p_result,
 		.inst = inst,
 		.request = request,
 		.call_env = call_env,
+		.trunk = thread->trunk,
 		.query_no = 0
 	};
 	talloc_set_destructor(redundant_ctx, sql_redundant_ctx_free);
 
-	redundant_ctx->handle = fr_pool_connection_get(inst->pool, request);
-	if (!redundant_ctx->handle) RETURN_MODULE_FAIL;
+	/*
+	 *	Queries run on the trunk don't need a pooled handle
+	 *	reserved for the duration of the call.  Escaping
+	 *	borrows a handle from the pool as required.
+	 */
+	if (!redundant_ctx->trunk) {
+		redundant_ctx->handle = fr_pool_connection_get(inst->pool, request);
+		if (!redundant_ctx->handle) RETURN_MODULE_FAIL;
 
-	request_data_add(request, (void *)sql_escape_uctx_alloc, 0, redundant_ctx->handle, false, false, false);
+		request_data_add(request, (void *)sql_escape_uctx_alloc, 0, redundant_ctx->handle, false, false, false);
+	}
 
 	sql_set_user(inst, request, &call_env->user);
 
@@ -1783,6 +1870,43 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	return 0;
 }
 
+/** Free the trunk used for asynchronous queries
+ *
+ */
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
+
+	TALLOC_FREE(t->trunk);
+
+	return 0;
+}
+
+/** Initialise thread specific data structure
+ *
+ * If the driver supports asynchronous queries, allocate a trunk
+ * for this thread.  Otherwise queries are run on the connection pool.
+ */
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
+
+	t->el = mctx->el;
+	t->inst = inst;
+
+	if (!inst->driver->uses_trunks) return 0;
+
+	t->trunk = fr_trunk_alloc(t, mctx->el, &inst->driver->trunk_io_funcs,
+				  &inst->trunk_conf, inst->name, t, false);
+	if (!t->trunk) {
+		ERROR("Failed creating trunk for asynchronous queries");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	rlm_sql_boot_t const	*boot = talloc_get_type_abort(mctx->mi->boot, rlm_sql_boot_t);
@@ -1992,7 +2116,11 @@ module_rlm_t rlm_sql = {
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
 		.instantiate	= mod_instantiate,
-		.detach		= mod_detach
+		.detach		= mod_detach,
+		.thread_inst_size	= sizeof(rlm_sql_thread_t),
+		.thread_inst_type	= "rlm_sql_thread_t",
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
 	.method_names = (module_method_name_t[]){
 		/*
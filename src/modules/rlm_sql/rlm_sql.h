@@ -31,6 +31,8 @@ RCSIDH(rlm_sql_h, "$Id$")
 #include <freeradius-devel/server/pool.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/exfile.h>
+#include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/unlang/action.h>
 
 #define FR_ITEM_CHECK 0
 #define FR_ITEM_REPLY 1
@@ -54,6 +56,17 @@ typedef enum {
 	FALL_THROUGH_DEFAULT,
 } sql_fall_through_t;
 
+/** Status of an asynchronous query
+ *
+ */
+typedef enum {
+	SQL_QUERY_FAILED = -1,		//!< Failed to submit the query, or the connection failed.
+	SQL_QUERY_PREPARED = 0,		//!< Ready to submit.
+	SQL_QUERY_SUBMITTED,		//!< Submitted for execution, waiting on results.
+	SQL_QUERY_RETURNED,		//!< Results have been received.
+	SQL_QUERY_CANCELLED		//!< Request was cancelled, results will be discarded.
+} fr_sql_query_status_t;
+
 typedef char **rlm_sql_row_t;
 
 typedef struct {
@@ -105,6 +118,34 @@ typedef struct {
 								//!< when log strings need to be copied.
 } rlm_sql_handle_t;
 
+/** An asynchronous query, run on a trunk connection
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;				//!< Module instance for this query.
+	request_t		*request;			//!< Request this query relates to.
+	fr_trunk_t		*trunk;				//!< Trunk this query was submitted to.
+	fr_trunk_request_t	*treq;				//!< Trunk request for this query.
+	char const		*query_str;			//!< Query string to run.
+	fr_sql_query_status_t	status;				//!< Status of the query.
+	sql_rcode_t		rcode;				//!< Result code from the driver.
+	int			affected_rows;			//!< Number of rows the query affected.
+	unsigned int		retries;			//!< How many times the query has been re-enqueued
+								///< after its connection failed.
+	fr_dlist_t		entry;				//!< Entry in the connection's list of queries
+								///< waiting on results.
+} fr_sql_query_t;
+
+/** Per-thread instance data
+ *
+ */
+typedef struct {
+	fr_event_list_t		*el;				//!< Thread's event list.
+	rlm_sql_t const		*inst;				//!< Module instance.
+	fr_trunk_t		*trunk;				//!< Trunk for asynchronous queries.  NULL if the
+								///< driver doesn't support them.
+} rlm_sql_thread_t;
+
 extern fr_table_num_sorted_t const sql_rcode_description_table[];
 extern size_t sql_rcode_description_table_len;
 extern fr_table_num_sorted_t const sql_rcode_table[];
@@ -170,11 +211,16 @@ typedef struct {
 	sql_rcode_t	(*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t const *config);
 
 	xlat_escape_legacy_t	sql_escape_func;
+
+	bool			uses_trunks;		//!< Driver can run queries asynchronously on trunk connections.
+	fr_trunk_io_funcs_t	trunk_io_funcs;		//!< Trunk callbacks.  The uctx passed to them is
+							///< the #rlm_sql_thread_t.  preqs are #fr_sql_query_t.
 } rlm_sql_driver_t;
 
 struct sql_inst {
 	rlm_sql_config_t	config; /* HACK */
 	fr_pool_t		*pool;
+	fr_trunk_conf_t		trunk_conf;		//!< Configuration for trunks used by asynchronous drivers.
 
 	fr_dict_attr_t const	*sql_user;		//!< Cached pointer to SQL-User-Name
 							//!< dictionary attribute.
@@ -200,6 +246,10 @@ sql_rcode_t	rlm_sql_select_query(rlm_sql_t const *inst, request_t *request, rlm_
 sql_rcode_t	rlm_sql_query(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
 sql_rcode_t    	rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle);
 void		rlm_sql_print_error(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t *handle, bool force_debug);
+fr_sql_query_t	*fr_sql_query_alloc(TALLOC_CTX *ctx, rlm_sql_t const *inst, request_t *request, char const *query_str);
+unlang_action_t	rlm_sql_trunk_query(fr_sql_query_t *query, fr_trunk_t *trunk) CC_HINT(nonnull);
+void		sql_request_fail(request_t *request, void *preq, void *rctx,
+				 fr_trunk_request_state_t state, void *uctx);
 
 /*
  *	sql_state.c
@@ -30,6 +30,8 @@ RCSID("$Id$")
 
 #include	<freeradius-devel/server/base.h>
 #include	<freeradius-devel/util/debug.h>
+#include	<freeradius-devel/unlang/function.h>
+#include	<freeradius-devel/unlang/interpret.h>
 
 #include	<sys/file.h>
 #include	<sys/stat.h>
@@ -475,6 +477,209 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, request_t *request, rlm_sql_han
 	return RLM_SQL_ERROR;
 }
 
+/** Allocate an asynchronous query
+ *
+ * @param[in] ctx		to allocate the query in.
+ * @param[in] inst		#rlm_sql_t instance data.
+ * @param[in] request		this query relates to.
+ * @param[in] query_str		to execute.  Must remain valid until the query has returned.
+ * @return A new query in the #SQL_QUERY_PREPARED state.
+ */
+fr_sql_query_t *fr_sql_query_alloc(TALLOC_CTX *ctx, rlm_sql_t const *inst, request_t *request, char const *query_str)
+{
+	fr_sql_query_t	*query;
+
+	MEM(query = talloc_zero(ctx, fr_sql_query_t));
+	*query = (fr_sql_query_t) {
+		.inst = inst,
+		.request = request,
+		.query_str = query_str,
+		.status = SQL_QUERY_PREPARED,
+		.rcode = RLM_SQL_ERROR,
+		.affected_rows = -1
+	};
+	fr_dlist_entry_init(&query->entry);
+
+	return query;
+}
+
+/** Enqueue an asynchronous query on its trunk
+ *
+ * @param[in] query		to enqueue.  query->trunk must be set.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int sql_trunk_query_enqueue(fr_sql_query_t *query)
+{
+	request_t	*request = query->request;
+
+	query->status = SQL_QUERY_PREPARED;
+	query->rcode = RLM_SQL_ERROR;
+	query->affected_rows = -1;
+
+	switch (fr_trunk_request_enqueue(&query->treq, query->trunk, request, query, NULL)) {
+	case FR_TRUNK_ENQUEUE_OK:
+	case FR_TRUNK_ENQUEUE_IN_BACKLOG:
+		break;
+
+	default:
+		RERROR("Failed enqueueing query");
+		return -1;
+	}
+
+	RDEBUG2("Executing query: %s", query->query_str);
+
+	return 0;
+}
+
+/** Map the result of an asynchronous query to a module rcode
+ *
+ * Error handling mirrors #rlm_sql_query, so callers see the same
+ * #sql_rcode_t values whichever path the query was run on.
+ *
+ * If the connection the query was sent on failed, the query is
+ * enqueued again, so it can run on another connection.  As with
+ * the pool, where each existing connection is tried, then a new
+ * one, the query is retried at most once more than the maximum
+ * number of connections in the trunk.
+ */
+static unlang_action_t sql_trunk_query_results(rlm_rcode_t *p_result, UNUSED int *priority,
+					       request_t *request, void *uctx)
+{
+	fr_sql_query_t		*query = talloc_get_type_abort(uctx, fr_sql_query_t);
+	rlm_sql_t const		*inst = query->inst;
+
+	switch (query->status) {
+	case SQL_QUERY_PREPARED:
+	case SQL_QUERY_SUBMITTED:
+		/* The query hasn't returned yet */
+		return UNLANG_ACTION_YIELD;
+
+	default:
+		break;
+	}
+
+	switch (query->rcode) {
+	case RLM_SQL_OK:
+	case RLM_SQL_NO_MORE_ROWS:
+		RETURN_MODULE_OK;
+
+	case RLM_SQL_ERROR:
+		/*
+		 *	If the driver can't distinguish between constraints
+		 *	violations and other errors, let the caller try
+		 *	the alternate query.
+		 */
+		if (!(inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY)) {
+			query->rcode = RLM_SQL_ALT_QUERY;
+			RETURN_MODULE_OK;
+		}
+		RETURN_MODULE_FAIL;
+
+	case RLM_SQL_ALT_QUERY:
+		RETURN_MODULE_OK;
+
+	case RLM_SQL_QUERY_INVALID:
+		RETURN_MODULE_INVALID;
+
+	case RLM_SQL_RECONNECT:
+		if (query->retries >= (unsigned int)inst->trunk_conf.max + 1) {
+			RERROR("Hit reconnection limit");
+			RETURN_MODULE_FAIL;
+		}
+		query->retries++;
+
+		RWARN("Connection failed, retrying query (%u/%u)", query->retries, inst->trunk_conf.max + 1);
+		if (sql_trunk_query_enqueue(query) < 0) RETURN_MODULE_FAIL;
+
+		return UNLANG_ACTION_YIELD;
+
+	default:
+		RERROR("Query failed: %s", fr_table_str_by_value(sql_rcode_description_table, query->rcode, "<INVALID>"));
+		RETURN_MODULE_FAIL;
+	}
+}
+
+/** Signal an SQL query running on a trunk connection to cancel
+ *
+ */
+static void sql_trunk_query_cancel(UNUSED request_t *request, UNUSED fr_signal_t action, void *uctx)
+{
+	fr_sql_query_t	*query = talloc_get_type_abort(uctx, fr_sql_query_t);
+
+	/*
+	 *	Query may have completed, but the request
+	 *	not yet have been resumed.
+	 */
+	if (!query->treq) return;
+
+	/*
+	 *	The query needs to be parented by the treq so that it still
+	 *	exists when the driver's cancel callback is run.
+	 */
+	talloc_steal(query->treq, query);
+
+	fr_trunk_request_signal_cancel(query->treq);
+
+	/*
+	 *	Once we've called cancel, the treq is no
+	 *	longer ours to manipulate, it belongs to
+	 *	the trunk code.
+	 */
+	query->treq = NULL;
+}
+
+/** Run an asynchronous SQL query on a trunk connection
+ *
+ * The request yields until the driver signals that the query has
+ * returned, at which point query->rcode holds the driver's result.
+ *
+ * @param[in] query		to run, allocated with #fr_sql_query_alloc.
+ * @param[in] trunk		to submit the query to.
+ * @return
+ *	- UNLANG_ACTION_FAIL on error.
+ *	- UNLANG_ACTION_PUSHED_CHILD on success.
+ */
+unlang_action_t rlm_sql_trunk_query(fr_sql_query_t *query, fr_trunk_t *trunk)
+{
+	request_t	*request = query->request;
+
+	/* There's no query to run, return an error */
+	if (query->query_str[0] == '\0') {
+		REDEBUG("Zero length query");
+		return UNLANG_ACTION_FAIL;
+	}
+
+	query->trunk = trunk;
+	if (sql_trunk_query_enqueue(query) < 0) return UNLANG_ACTION_FAIL;
+
+	return unlang_function_push(request, NULL, sql_trunk_query_results,
+				    sql_trunk_query_cancel, ~FR_SIGNAL_CANCEL, UNLANG_SUB_FRAME, query);
+}
+
+/** Trunk callback for requests which failed, or were moved off a failed connection
+ *
+ * Drivers should use this as their request_fail callback.
+ */
+void sql_request_fail(request_t *request, void *preq, UNUSED void *rctx,
+		      UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	fr_sql_query_t		*query = talloc_get_type_abort(preq, fr_sql_query_t);
+
+	/*
+	 *	Failed trunk requests get freed - so remove association in query.
+	 */
+	query->treq = NULL;
+	query->status = SQL_QUERY_FAILED;
+	query->rcode = RLM_SQL_RECONNECT;
+
+	/*
+	 *	Ensure request is runnable.
+	 */
+	if (request) unlang_interpret_mark_runnable(request);
+}
+
 /** Call the driver's sql_select_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_select_query)(handle, &inst->config);``
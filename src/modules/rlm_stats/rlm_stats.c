@@ -26,6 +26,8 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/network.h>
+#include <freeradius-devel/io/worker.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/radius/radius.h>
@@ -101,12 +103,30 @@ fr_dict_autoload_t rlm_stats_dict[] = {
 static fr_dict_attr_t const *attr_freeradius_stats4_ipv4_address;
 static fr_dict_attr_t const *attr_freeradius_stats4_ipv6_address;
 static fr_dict_attr_t const *attr_freeradius_stats4_type;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_type;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_count;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_mean;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_p50;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_p90;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_p99;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_p999;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_max;
 
 extern fr_dict_attr_autoload_t rlm_stats_dict_attr[];
 fr_dict_attr_autoload_t rlm_stats_dict_attr[] = {
 	{ .out = &attr_freeradius_stats4_ipv4_address, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-IPv4-Address", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_radius },
 	{ .out = &attr_freeradius_stats4_ipv6_address, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-IPv6-Address", .type = FR_TYPE_IPV6_ADDR, .dict = &dict_radius },
 	{ .out = &attr_freeradius_stats4_type, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency", .type = FR_TYPE_TLV, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_type, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency.Stats4-Latency-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_count, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency.Stats4-Latency-Count", .type = FR_TYPE_UINT64, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_mean, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency.Stats4-Latency-Mean", .type = FR_TYPE_UINT64, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_p50, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency.Stats4-Latency-P50", .type = FR_TYPE_UINT64, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_p90, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency.Stats4-Latency-P90", .type = FR_TYPE_UINT64, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_p99, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency.Stats4-Latency-P99", .type = FR_TYPE_UINT64, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_p999, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency.Stats4-Latency-P999", .type = FR_TYPE_UINT64, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_max, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency.Stats4-Latency-Max", .type = FR_TYPE_UINT64, .dict = &dict_radius },
 	{ NULL }
 };
 
@@ -163,6 +183,61 @@ static void coalesce(uint64_t final_stats[FR_RADIUS_CODE_MAX], rlm_stats_thread_
 }
 
 
+/** Add one latency histogram to the reply, as a Stats4-Latency TLV
+ *
+ */
+static void latency_add(request_t *request, uint32_t type, fr_histogram_t const *h)
+{
+	fr_pair_t	*vp, *child;
+
+#define LATENCY_ADD(_attr, _value) do { \
+		MEM(fr_pair_append_by_da(vp, &child, &vp->vp_group, attr_freeradius_stats4_latency_##_attr) >= 0); \
+		child->vp_uint64 = (_value) / 1000; \
+	} while (0)
+
+	MEM(pair_append_reply(&vp, attr_freeradius_stats4_latency) >= 0);
+
+	MEM(fr_pair_append_by_da(vp, &child, &vp->vp_group, attr_freeradius_stats4_latency_type) >= 0);
+	child->vp_uint32 = type;
+
+	MEM(fr_pair_append_by_da(vp, &child, &vp->vp_group, attr_freeradius_stats4_latency_count) >= 0);
+	child->vp_uint64 = h->count;
+
+	LATENCY_ADD(mean, (uint64_t) fr_histogram_mean(h));
+	LATENCY_ADD(p50, fr_histogram_value_at_percentile(h, 50));
+	LATENCY_ADD(p90, fr_histogram_value_at_percentile(h, 90));
+	LATENCY_ADD(p99, fr_histogram_value_at_percentile(h, 99));
+	LATENCY_ADD(p999, fr_histogram_value_at_percentile(h, 99.9));
+	LATENCY_ADD(max, fr_histogram_value_at_percentile(h, 100));
+}
+
+/** Add the latencies of all workers and networks to the reply
+ *
+ */
+static int latency_add_all(request_t *request)
+{
+	TALLOC_CTX	*tmp_ctx;
+	fr_histogram_t	*worker[FR_WORKER_LATENCY_MAX];
+	fr_histogram_t	*network;
+
+	MEM(tmp_ctx = talloc_new(NULL));
+
+	if ((fr_worker_latency(tmp_ctx, worker, NULL) < 0) ||
+	    (fr_network_latency(tmp_ctx, &network, NULL) < 0)) {
+		talloc_free(tmp_ctx);
+		return -1;
+	}
+
+	latency_add(request, FR_STATS4_LATENCY_TYPE_VALUE_QUEUED, worker[FR_WORKER_LATENCY_QUEUED]);
+	latency_add(request, FR_STATS4_LATENCY_TYPE_VALUE_PROCESSING, worker[FR_WORKER_LATENCY_PROCESSING]);
+	latency_add(request, FR_STATS4_LATENCY_TYPE_VALUE_YIELDED, worker[FR_WORKER_LATENCY_YIELDED]);
+	latency_add(request, FR_STATS4_LATENCY_TYPE_VALUE_REPLY_DELAY, network);
+
+	talloc_free(tmp_ctx);
+
+	return 0;
+}
+
 /*
  *	Do the statistics
  */
@@ -315,6 +390,13 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		coalesce(local_stats, t, offsetof(rlm_stats_thread_t, dst), &mydata);
 		break;
 
+	case FR_STATS4_TYPE_VALUE_LATENCY:
+		if (latency_add_all(request) < 0) {
+			REDEBUG("Failed merging latencies");
+			RETURN_MODULE_FAIL;
+		}
+		RETURN_MODULE_OK;
+
 	default:
 		REDEBUG("Invalid value '%d' for FreeRADIUS-Stats4-type", stats_type);
 		RETURN_MODULE_FAIL;
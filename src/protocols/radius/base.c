@@ -285,25 +285,29 @@ invalid:
 	return packet_len;
 }
 
-/** Sign a previously encoded packet
+/** Check a packet can be signed, and initialise its authenticator fields
  *
- * Calculates the request/response authenticator for packets which need it, and fills
- * in the message-authenticator value if the attribute is present in the encoded packet.
+ * Fills in the Request / Response Authenticator field with the value
+ * which is hashed to produce the authenticator, and zeroes the
+ * Message-Authenticator if the attribute is present.
  *
+ * @param[out] ma		Where to write a pointer to the Message-Authenticator
+ *				value, or NULL if the packet doesn't contain one.
  * @param[in,out] packet	(request or response).
  * @param[in] vector		original packet vector to use
- * @param[in] secret		to sign the packet with.
  * @param[in] secret_len	The length of the secret.
  * @return
  *	- <0 on error
- *	- 0 on success
+ *	- 0 if the packet has a random Request Authenticator.
+ *	- 1 if the authenticator must be set to MD5(packet + secret).
  */
-int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
-		   uint8_t const *secret, size_t secret_len)
+static int radius_sign_prepare(uint8_t **ma, uint8_t *packet, uint8_t const *vector, size_t secret_len)
 {
 	uint8_t		*msg, *end;
 	size_t		packet_len = fr_nbo_to_uint16(packet + 2);
 
+	*ma = NULL;
+
 	/*
 	 *	No real limit on secret length, this is just
 	 *	to catch uninitialised fields.
@@ -346,46 +350,20 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 			return -1;
 		}
 
-		switch (packet[0]) {
-		case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
-		case FR_RADIUS_CODE_DISCONNECT_REQUEST:
-		case FR_RADIUS_CODE_COA_REQUEST:
-			memset(packet + 4, 0, RADIUS_AUTH_VECTOR_LENGTH);
-			break;
-
-		case FR_RADIUS_CODE_ACCESS_ACCEPT:
-		case FR_RADIUS_CODE_ACCESS_REJECT:
-		case FR_RADIUS_CODE_ACCESS_CHALLENGE:
-		case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
-		case FR_RADIUS_CODE_DISCONNECT_ACK:
-		case FR_RADIUS_CODE_DISCONNECT_NAK:
-		case FR_RADIUS_CODE_COA_ACK:
-		case FR_RADIUS_CODE_COA_NAK:
-			if (!vector) goto need_original;
-			memcpy(packet + 4, vector, RADIUS_AUTH_VECTOR_LENGTH);
-			break;
-
-		case FR_RADIUS_CODE_ACCESS_REQUEST:
-		case FR_RADIUS_CODE_STATUS_SERVER:
-			/* packet + 4 MUST be the Request Authenticator filled with random data */
-			break;
-
-		default:
-			goto bad_packet;
-		}
-
 		/*
-		 *	Force Message-Authenticator to be zero,
-		 *	calculate the HMAC, and put it into the
-		 *	Message-Authenticator attribute.
+		 *	We don't know how to calculate
+		 *	Message-Authenticator for these.
 		 */
-		memset(msg + 2, 0, RADIUS_AUTH_VECTOR_LENGTH);
-		fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		if (packet[0] == FR_RADIUS_CODE_PROTOCOL_ERROR) goto bad_packet;
+
+		*ma = msg + 2;
 		break;
 	}
 
 	/*
-	 *	Initialize the request authenticator.
+	 *	Initialize the request authenticator.  The
+	 *	Message-Authenticator is calculated with this value
+	 *	in place.
 	 */
 	switch (packet[0]) {
 	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
@@ -404,7 +382,6 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 	case FR_RADIUS_CODE_COA_NAK:
 	case FR_RADIUS_CODE_PROTOCOL_ERROR:
 		if (!vector) {
-		need_original:
 			fr_strerror_const("Cannot sign response packet without a request packet");
 			return -1;
 		}
@@ -413,19 +390,63 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 
 		/*
 		 *	The Request Authenticator is random numbers.
-		 *	We don't need to sign anything else, so
-		 *	return.
+		 *	We don't need to sign anything else.
+		 *
+		 *	packet + 4 MUST be the Request Authenticator
+		 *	filled with random data.
 		 */
 	case FR_RADIUS_CODE_ACCESS_REQUEST:
 	case FR_RADIUS_CODE_STATUS_SERVER:
+		if (*ma) memset(*ma, 0, RADIUS_AUTH_VECTOR_LENGTH);
 		return 0;
 
 	default:
 	bad_packet:
+		*ma = NULL;
 		fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
 		return -1;
 	}
 
+	/*
+	 *	Force Message-Authenticator to be zero before
+	 *	calculating the HMAC.
+	 */
+	if (*ma) memset(*ma, 0, RADIUS_AUTH_VECTOR_LENGTH);
+
+	return 1;
+}
+
+/** Sign a previously encoded packet
+ *
+ * Calculates the request/response authenticator for packets which need it, and fills
+ * in the message-authenticator value if the attribute is present in the encoded packet.
+ *
+ * @param[in,out] packet	(request or response).
+ * @param[in] vector		original packet vector to use
+ * @param[in] secret		to sign the packet with.
+ * @param[in] secret_len	The length of the secret.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
+		   uint8_t const *secret, size_t secret_len)
+{
+	uint8_t		*ma;
+	size_t		packet_len = fr_nbo_to_uint16(packet + 2);
+	int		ret;
+
+	ret = radius_sign_prepare(&ma, packet, vector, secret_len);
+	if (ret < 0) return -1;
+
+	/*
+	 *	Calculate the HMAC, and put it into the
+	 *	Message-Authenticator attribute.
+	 */
+	if (ma) fr_hmac_md5(ma, packet, packet_len, secret, secret_len);
+
+	if (ret == 0) return 0;
+
 	/*
 	 *	Request / Response Authenticator = MD5(packet + secret)
 	 */
@@ -442,6 +463,77 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 	return 0;
 }
 
+#define RADIUS_MULTI_CHUNK	32
+
+/** Sign multiple previously encoded packets
+ *
+ * Produces the same results as calling #fr_radius_sign for each packet,
+ * but calculates the Message-Authenticator and Request / Response
+ * Authenticator digests of several packets at once, which is
+ * considerably faster.
+ *
+ * @param[in,out] batch		Packets to sign.  batch[i].rcode is set to the
+ *				result of signing each packet.
+ * @param[in] num		Number of packets in the batch.
+ * @return The number of packets which could not be signed.  fr_strerror
+ *	will contain the reason the last one failed.
+ */
+size_t fr_radius_sign_multi(fr_radius_batch_t *batch, size_t num)
+{
+	fr_hmac_md5_multi_t	hmac[RADIUS_MULTI_CHUNK];
+	fr_md5_multi_t		md5[RADIUS_MULTI_CHUNK];
+	struct iovec		iov[RADIUS_MULTI_CHUNK][2];
+	size_t			done, count, i, num_hmac, num_md5, failed = 0;
+
+	for (done = 0; done < num; done += count) {
+		count = num - done;
+		if (count > RADIUS_MULTI_CHUNK) count = RADIUS_MULTI_CHUNK;
+
+		num_hmac = num_md5 = 0;
+		for (i = 0; i < count; i++) {
+			fr_radius_batch_t	*b = &batch[done + i];
+			uint8_t			*ma;
+			size_t			packet_len;
+
+			b->rcode = radius_sign_prepare(&ma, b->packet, b->vector, b->secret_len);
+			if (b->rcode < 0) {
+				b->rcode = -1;
+				failed++;
+				continue;
+			}
+			packet_len = fr_nbo_to_uint16(b->packet + 2);
+
+			if (ma) {
+				hmac[num_hmac++] = (fr_hmac_md5_multi_t){
+					.in = b->packet,
+					.inlen = packet_len,
+					.key = b->secret,
+					.key_len = b->secret_len,
+					.out = ma
+				};
+			}
+
+			if (b->rcode == 0) continue;
+			b->rcode = 0;
+
+			iov[num_md5][0] = (struct iovec){ .iov_base = b->packet, .iov_len = packet_len };
+			iov[num_md5][1] = (struct iovec){ .iov_base = UNCONST(uint8_t *, b->secret), .iov_len = b->secret_len };
+			md5[num_md5] = (fr_md5_multi_t){ .iov = iov[num_md5], .iovcnt = 2, .out = b->packet + 4 };
+			num_md5++;
+		}
+
+		/*
+		 *	The Message-Authenticator is included in
+		 *	the packet digest, so must be calculated
+		 *	first.
+		 */
+		fr_hmac_md5_multi(hmac, num_hmac);
+		fr_md5_calc_multi(md5, num_md5);
+	}
+
+	return failed;
+}
+
 
 /** See if the data pointed to by PTR is a valid RADIUS packet.
  *
@@ -699,33 +791,25 @@ finish:
 }
 
 
-/** Verify a request / response packet
+/** Authenticator values received in a packet
  *
- *  This function does its work by calling fr_radius_sign(), and then
- *  comparing the signature in the packet with the one we calculated.
- *  If they differ, there's a problem.
+ */
+typedef struct {
+	uint8_t		*ma;						//!< Message-Authenticator value in the packet.
+	uint8_t		request_authenticator[RADIUS_AUTH_VECTOR_LENGTH];	//!< As received.
+	uint8_t		message_authenticator[RADIUS_AUTH_VECTOR_LENGTH];	//!< As received.
+} radius_verify_t;
+
+/** Save the authenticators from a received packet before it's re-signed
  *
- * @param[in] packet		the raw RADIUS packet (request or response)
- * @param[in] vector		the original packet vector
- * @param[in] secret		the shared secret
- * @param[in] secret_len	the length of the secret
- * @param[in] require_ma	whether we require Message-Authenticator.
- * @return
- *	- -2 if the message authenticator or request authenticator was invalid.
- *	- -1 if we were unable to verify the shared secret, or the packet
- *	     was in some other way malformed.
- *	- 0 on success.
  */
-int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
-		     uint8_t const *secret, size_t secret_len, bool require_ma)
+static int radius_verify_prepare(radius_verify_t *rv, uint8_t *packet, bool require_ma)
 {
-	bool found_ma;
-	int rcode;
 	int code;
 	uint8_t *msg, *end;
 	size_t packet_len = fr_nbo_to_uint16(packet + 2);
-	uint8_t request_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
-	uint8_t message_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
+
+	rv->ma = NULL;
 
 	if (packet_len < RADIUS_HEADER_LENGTH) {
 		fr_strerror_printf("invalid packet length %zd", packet_len);
@@ -738,7 +822,7 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 		return -1;
 	}
 
-	memcpy(request_authenticator, packet + 4, sizeof(request_authenticator));
+	memcpy(rv->request_authenticator, packet + 4, sizeof(rv->request_authenticator));
 
 	/*
 	 *	Find Message-Authenticator.  Its value has to be
@@ -747,7 +831,6 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 	 */
 	msg = packet + RADIUS_HEADER_LENGTH;
 	end = packet + packet_len;
-	found_ma = false;
 
 	while (msg < end) {
 		if ((end - msg) < 2) goto invalid_attribute;
@@ -772,29 +855,25 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 		/*
 		 *	Found it, save a copy.
 		 */
-		memcpy(message_authenticator, msg + 2, sizeof(message_authenticator));
-		found_ma = true;
+		memcpy(rv->message_authenticator, msg + 2, sizeof(rv->message_authenticator));
+		rv->ma = msg + 2;
 		break;
 	}
 
 	if ((packet[0] == FR_RADIUS_CODE_ACCESS_REQUEST) &&
-	    require_ma && !found_ma) {
+	    require_ma && !rv->ma) {
 		fr_strerror_const("Access-Request is missing the required Message-Authenticator attribute");
 		return -1;
 	}
 
-	/*
-	 *	Implement verification as a signature, followed by
-	 *	checking our signature against the sent one.  This is
-	 *	slightly more CPU work than having verify-specific
-	 *	functions, but it ends up being cleaner in the code.
-	 */
-	rcode = fr_radius_sign(packet, vector, secret, secret_len);
-	if (rcode < 0) {
-		fr_strerror_const_push("Failed calculating correct authenticator");
-		return -1;
-	}
+	return 0;
+}
 
+/** Compare the authenticators we calculated with the ones received
+ *
+ */
+static int radius_verify_check(radius_verify_t const *rv, uint8_t *packet, uint8_t const *vector)
+{
 	/*
 	 *	Check the Message-Authenticator first.
 	 *
@@ -802,10 +881,10 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 	 *	Message-Authenticator and Request Authenticator
 	 *	fields.
 	 */
-	if ((msg < end) &&
-	    (fr_digest_cmp(message_authenticator, msg + 2, sizeof(message_authenticator)) != 0)) {
-		memcpy(msg + 2, message_authenticator, sizeof(message_authenticator));
-		memcpy(packet + 4, request_authenticator, sizeof(request_authenticator));
+	if (rv->ma &&
+	    (fr_digest_cmp(rv->message_authenticator, rv->ma, sizeof(rv->message_authenticator)) != 0)) {
+		memcpy(rv->ma, rv->message_authenticator, sizeof(rv->message_authenticator));
+		memcpy(packet + 4, rv->request_authenticator, sizeof(rv->request_authenticator));
 
 		fr_strerror_const("invalid Message-Authenticator (shared secret is incorrect)");
 		return -2;
@@ -822,8 +901,8 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 	/*
 	 *	Check the Request Authenticator.
 	 */
-	if (fr_digest_cmp(request_authenticator, packet + 4, sizeof(request_authenticator)) != 0) {
-		memcpy(packet + 4, request_authenticator, sizeof(request_authenticator));
+	if (fr_digest_cmp(rv->request_authenticator, packet + 4, sizeof(rv->request_authenticator)) != 0) {
+		memcpy(packet + 4, rv->request_authenticator, sizeof(rv->request_authenticator));
 		if (vector) {
 			fr_strerror_const("invalid Response Authenticator (shared secret is incorrect)");
 		} else {
@@ -835,6 +914,100 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 	return 0;
 }
 
+/** Verify a request / response packet
+ *
+ *  This function does its work by calling fr_radius_sign(), and then
+ *  comparing the signature in the packet with the one we calculated.
+ *  If they differ, there's a problem.
+ *
+ * @param[in] packet		the raw RADIUS packet (request or response)
+ * @param[in] vector		the original packet vector
+ * @param[in] secret		the shared secret
+ * @param[in] secret_len	the length of the secret
+ * @param[in] require_ma	whether we require Message-Authenticator.
+ * @return
+ *	- -2 if the message authenticator or request authenticator was invalid.
+ *	- -1 if we were unable to verify the shared secret, or the packet
+ *	     was in some other way malformed.
+ *	- 0 on success.
+ */
+int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
+		     uint8_t const *secret, size_t secret_len, bool require_ma)
+{
+	radius_verify_t rv;
+
+	if (radius_verify_prepare(&rv, packet, require_ma) < 0) return -1;
+
+	/*
+	 *	Implement verification as a signature, followed by
+	 *	checking our signature against the sent one.  This is
+	 *	slightly more CPU work than having verify-specific
+	 *	functions, but it ends up being cleaner in the code.
+	 */
+	if (fr_radius_sign(packet, vector, secret, secret_len) < 0) {
+		fr_strerror_const_push("Failed calculating correct authenticator");
+		return -1;
+	}
+
+	return radius_verify_check(&rv, packet, vector);
+}
+
+/** Verify multiple request / response packets
+ *
+ * Produces the same results as calling #fr_radius_verify for each
+ * packet, but uses #fr_radius_sign_multi to calculate the digests.
+ *
+ * @param[in,out] batch		Packets to verify.  batch[i].rcode is set to
+ *				the value #fr_radius_verify would return.
+ * @param[in] num		Number of packets in the batch.
+ * @return The number of packets which failed verification.  fr_strerror
+ *	will contain the reason the last one failed.
+ */
+size_t fr_radius_verify_multi(fr_radius_batch_t *batch, size_t num)
+{
+	radius_verify_t		rv[RADIUS_MULTI_CHUNK];
+	fr_radius_batch_t	sign[RADIUS_MULTI_CHUNK];
+	fr_radius_batch_t	*signed_from[RADIUS_MULTI_CHUNK];
+	size_t			done, count, i, num_sign, failed = 0;
+
+	for (done = 0; done < num; done += count) {
+		count = num - done;
+		if (count > RADIUS_MULTI_CHUNK) count = RADIUS_MULTI_CHUNK;
+
+		num_sign = 0;
+		for (i = 0; i < count; i++) {
+			fr_radius_batch_t *b = &batch[done + i];
+
+			if (radius_verify_prepare(&rv[num_sign], b->packet, b->require_ma) < 0) {
+				b->rcode = -1;
+				failed++;
+				continue;
+			}
+
+			signed_from[num_sign] = b;
+			sign[num_sign++] = *b;
+		}
+
+		fr_radius_sign_multi(sign, num_sign);
+
+		for (i = 0; i < num_sign; i++) {
+			fr_radius_batch_t *b = signed_from[i];
+
+			if (sign[i].rcode < 0) {
+				fr_strerror_const_push("Failed calculating correct authenticator");
+				b->rcode = -1;
+				failed++;
+				continue;
+			}
+
+			b->rcode = radius_verify_check(&rv[i], b->packet, b->vector);
+			if (b->rcode < 0) failed++;
+		}
+	}
+
+	return failed;
+}
+
 void *fr_radius_next_encodable(fr_dlist_head_t *list, void *current, void *uctx);
 
 void *fr_radius_next_encodable(fr_dlist_head_t *list, void *current, void *uctx)
@@ -994,6 +1167,247 @@ ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 	return fr_dbuff_set(dbuff, &work_dbuff);
 }
 
+/** A top level attribute in the packet
+ *
+ */
+typedef struct {
+	fr_pair_t		*anchor;		//!< Last pair in the list which came from this attribute,
+							///< or from the attributes before it.  NULL if there isn't one.
+	uint16_t		offset;			//!< Of the attribute in the packet.  0 once decoded.
+	uint16_t		next;			//!< Next deferred entry with the same attribute number, + 1.
+} radius_lazy_entry_t;
+
+/** Attributes which haven't been decoded yet
+ *
+ */
+typedef struct {
+	fr_pair_list_lazy_t	lazy;			//!< Registered with the pair list.
+	TALLOC_CTX		*ctx;			//!< To allocate pairs in.
+	uint8_t const		*packet;		//!< The raw packet.
+	fr_radius_decode_ctx_t	decode_ctx;		//!< Our own copy, as the caller's is usually on the stack.
+	fr_pair_t		*before;		//!< Last pair in the list before the packet was decoded.
+							///< NULL for the head of the list.
+
+	unsigned int		pending;		//!< Number of entries which haven't been decoded.
+	uint16_t		first[UINT8_MAX + 1];	//!< First deferred entry for each attribute number, + 1.
+	unsigned int		num;			//!< Number of entries.
+	radius_lazy_entry_t	entry[];		//!< One for each attribute, in packet order.
+} radius_lazy_t;
+
+/** Find the pair a deferred attribute should be inserted after
+ *
+ * @param[in] lazy	decoder state.
+ * @param[in] idx	of the entry being decoded.
+ * @return
+ *	- The pair to insert after.
+ *	- NULL to insert at the head of the list.
+ */
+static inline CC_HINT(always_inline) fr_pair_t *radius_lazy_anchor(radius_lazy_t const *lazy, unsigned int idx)
+{
+	while (idx-- > 0) if (lazy->entry[idx].anchor) return lazy->entry[idx].anchor;
+
+	return lazy->before;
+}
+
+/** Decode one deferred attribute, and insert its pairs where the attribute was in the packet
+ *
+ * @param[in] list	to insert the pairs into.
+ * @param[in] lazy	decoder state.
+ * @param[in] idx	of the entry to decode.
+ * @param[in] prev	pair to insert after.  NULL to insert at the head of the list.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int radius_lazy_decode_entry(fr_pair_list_t *list, radius_lazy_t *lazy, unsigned int idx, fr_pair_t *prev)
+{
+	radius_lazy_entry_t	*entry = &lazy->entry[idx];
+	uint8_t const		*attr = lazy->packet + entry->offset;
+	fr_pair_list_t		tmp;
+	fr_pair_t		*vp;
+	ssize_t			slen;
+
+	entry->offset = 0;
+	lazy->pending--;
+
+	fr_pair_list_init(&tmp);
+	slen = fr_radius_decode_pair(lazy->ctx, &tmp, attr, lazy->decode_ctx.end - attr, &lazy->decode_ctx);
+	talloc_free_children(lazy->decode_ctx.tmp_ctx);
+	if (slen < 0) {
+		fr_pair_list_free(&tmp);
+		return -1;
+	}
+
+	while ((vp = fr_pair_list_head(&tmp))) {
+		fr_pair_remove(&tmp, vp);
+		fr_pair_insert_after(list, prev, vp);
+		entry->anchor = prev = vp;
+	}
+
+	return 0;
+}
+
+/** Decode attributes which were deferred by #fr_radius_decode
+ *
+ * Called by the pair list API on first access.
+ */
+static int _radius_lazy_decode(fr_pair_list_t *list, fr_dict_attr_t const *da, void *uctx)
+{
+	radius_lazy_t	*lazy = talloc_get_type_abort(uctx, radius_lazy_t);
+	fr_pair_t	*prev = lazy->before;
+	unsigned int	i;
+
+	if (!da) {
+		for (i = 0; i < lazy->num; i++) {
+			if (lazy->entry[i].offset &&
+			    (radius_lazy_decode_entry(list, lazy, i, prev) < 0)) goto error;
+
+			if (lazy->entry[i].anchor) prev = lazy->entry[i].anchor;
+		}
+		goto done;
+	}
+
+	/*
+	 *	Only top level attributes are deferred.
+	 */
+	if ((da->parent != fr_dict_root(dict_radius)) || (da->attr > UINT8_MAX)) return 1;
+
+	for (i = lazy->first[da->attr]; i; i = lazy->entry[i - 1].next) {
+		if (radius_lazy_decode_entry(list, lazy, i - 1, radius_lazy_anchor(lazy, i - 1)) < 0) goto error;
+	}
+	lazy->first[da->attr] = 0;
+
+	if (lazy->pending) return 1;
+
+done:
+	talloc_free(lazy);
+	return 0;
+
+error:
+	talloc_free(lazy);
+	return -1;
+}
+
+/** Stop referring to pairs which are removed from the list
+ *
+ * Pairs from an attribute, and from the attributes before it, are all at
+ * or before the entry's anchor.  So once the anchor is gone, they're all
+ * at or before the pair which was before it.
+ *
+ * Only called whilst some attributes are still deferred, and removing
+ * pairs from the request is rare, so a scan of the entries is fine.
+ */
+static void _radius_lazy_remove(fr_pair_t const *vp, fr_pair_t *prev, void *uctx)
+{
+	radius_lazy_t	*lazy = talloc_get_type_abort(uctx, radius_lazy_t);
+	unsigned int	i;
+
+	if (lazy->before == vp) lazy->before = prev;
+
+	for (i = 0; i < lazy->num; i++) if (lazy->entry[i].anchor == vp) lazy->entry[i].anchor = prev;
+}
+
+/** Decode the attributes which can't be deferred, and index the rest
+ *
+ */
+static ssize_t radius_decode_lazy(TALLOC_CTX *ctx, fr_pair_list_t *out,
+				  uint8_t const *packet, size_t packet_len,
+				  fr_radius_decode_ctx_t *decode_ctx)
+{
+	uint8_t const		*attr, *end = packet + packet_len;
+	uint16_t		last[UINT8_MAX + 1];
+	radius_lazy_t		*lazy;
+	unsigned int		num = 0;
+	ssize_t			slen;
+
+	/*
+	 *	The packet has been checked by fr_radius_ok(),
+	 *	so the attribute lengths can be trusted.
+	 */
+	for (attr = packet + RADIUS_HEADER_LENGTH; attr < end; attr += attr[1]) num++;
+
+	lazy = talloc_size(ctx, sizeof(*lazy) + (sizeof(lazy->entry[0]) * num));
+	if (unlikely(!lazy)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	talloc_set_type(lazy, radius_lazy_t);
+
+	*lazy = (radius_lazy_t) {
+		.lazy = {
+			.decode = _radius_lazy_decode,
+			.remove = _radius_lazy_remove,
+			.uctx = lazy
+		},
+		.ctx = ctx,
+		.packet = packet,
+		/*
+		 *	Nothing we defer needs the secret or the
+		 *	authenticator, and neither outlives this call.
+		 */
+		.decode_ctx = {
+			.tmp_ctx = talloc(lazy, uint8_t),
+			.end = end,
+		},
+		.before = fr_pair_list_tail(out),
+	};
+
+	attr = packet + RADIUS_HEADER_LENGTH;
+	while (attr < end) {
+		radius_lazy_entry_t	*entry = &lazy->entry[lazy->num++];
+		fr_pair_t		*tail;
+
+		*entry = (radius_lazy_entry_t) {};
+
+		if (fr_radius_decode_pair_deferrable(attr)) {
+			entry->offset = attr - packet;
+			lazy->pending++;
+
+			if (!lazy->first[attr[0]]) {
+				lazy->first[attr[0]] = lazy->num;
+			} else {
+				lazy->entry[last[attr[0]] - 1].next = lazy->num;
+			}
+			last[attr[0]] = lazy->num;
+
+			attr += attr[1];
+			continue;
+		}
+
+		tail = fr_pair_list_tail(out);
+
+		slen = fr_radius_decode_pair(ctx, out, attr, (end - attr), decode_ctx);
+		if (slen < 0) {
+		error:
+			talloc_free(lazy);
+			return slen;
+		}
+
+		if (!fr_cond_assert(slen <= (end - attr))) {
+			slen = -slen;
+			goto error;
+		}
+
+		/*
+		 *	Remember where the pairs went, so deferred
+		 *	attributes after this one go after them.
+		 */
+		if (fr_pair_list_tail(out) != tail) entry->anchor = fr_pair_list_tail(out);
+
+		attr += slen;
+		talloc_free_children(decode_ctx->tmp_ctx);
+	}
+
+	if (!lazy->pending) {
+		talloc_free(lazy);
+		return packet_len;
+	}
+
+	fr_pair_list_lazy_set(out, &lazy->lazy);
+
+	return packet_len;
+}
+
 ssize_t	fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 			 uint8_t *packet, size_t packet_len,
 			 fr_radius_decode_ctx_t *decode_ctx)
@@ -1062,6 +1476,8 @@ ssize_t	fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 		}
 	}
 
+	if (decode_ctx->lazy) return radius_decode_lazy(ctx, out, packet, packet_len, decode_ctx);
+
 	attr = packet + 20;
 	end = packet + packet_len;
 
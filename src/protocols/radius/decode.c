@@ -2084,6 +2084,33 @@ ssize_t fr_radius_decode_pair(TALLOC_CTX *ctx, fr_pair_list_t *out,
 	return 2 + ret;
 }
 
+/** Check whether decoding of a top level attribute can be deferred
+ *
+ * Only simple attributes can be decoded on their own, at any time.
+ * Anything which is encrypted, tagged, concatenated, or which contains
+ * other attributes is decoded immediately, as it may depend on other
+ * attributes, or on state which doesn't outlive the packet decode.
+ *
+ * @param[in] data	Start of the attribute.  Must have been checked by fr_radius_ok().
+ * @return true if the attribute can be decoded later with #fr_radius_decode_pair.
+ */
+bool fr_radius_decode_pair_deferrable(uint8_t const *data)
+{
+	fr_dict_attr_t const	*da;
+
+	/*
+	 *	Empty attributes are ignored.  CUI may be empty, in
+	 *	which case it's special, so all instances of it are
+	 *	decoded immediately to keep them in order.
+	 */
+	if ((data[1] <= 2) || special[data[0]] || (data[0] == FR_CHARGEABLE_USER_IDENTITY)) return false;
+
+	da = fr_dict_attr_child_by_num(fr_dict_root(dict_radius), data[0]);
+	if (!da || !fr_type_is_leaf(da->type)) return false;
+
+	return !da->flags.extra && (da->flags.subtype == FLAG_NONE);
+}
+
 ssize_t fr_radius_decode_foreign(TALLOC_CTX *ctx, fr_pair_list_t *out,
 				 uint8_t const *data, size_t data_len)
 {
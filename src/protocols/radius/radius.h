@@ -43,6 +43,19 @@
 #define RADIUS_VENDORPEC_LUCENT			4846
 #define RADIUS_VENDORPEC_STARENT		8164
 
+/** A packet to sign or verify with #fr_radius_sign_multi or #fr_radius_verify_multi
+ *
+ */
+typedef struct {
+	uint8_t			*packet;		//!< Encoded packet.
+	uint8_t const		*vector;		//!< Original packet vector, for responses.
+	uint8_t const		*secret;		//!< Shared secret.
+	size_t			secret_len;		//!< Length of the shared secret.
+	bool			require_ma;		//!< Whether we require Message-Authenticator.
+							///< Only used when verifying.
+	int			rcode;			//!< Result of signing or verifying the packet.
+} fr_radius_batch_t;
+
 /*
  *	protocols/radius/base.c
  */
@@ -147,6 +160,10 @@ typedef struct {
 	bool			verify;			//!< can skip verify for dynamic clients
 	bool			require_message_authenticator;
 
+	bool			lazy;			//!< Only create pairs for simple attributes when
+							///< they're accessed.  The packet must outlive
+							///< the pair list.
+
 	fr_radius_tag_ctx_t    	**tags;			//!< for decoding tagged attributes
 	fr_pair_list_t		*tag_root;		//!< Where to insert tag attributes.
 	TALLOC_CTX		*tag_root_ctx;		//!< Where to allocate new tag attributes.
@@ -161,6 +178,8 @@ int		fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
 int		fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 				 uint8_t const *secret, size_t secret_len, bool require_ma) CC_HINT(nonnull (1,3));
+size_t		fr_radius_sign_multi(fr_radius_batch_t *batch, size_t num);
+size_t		fr_radius_verify_multi(fr_radius_batch_t *batch, size_t num);
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p,
 			     uint32_t max_attributes, bool require_ma, decode_fail_t *reason) CC_HINT(nonnull (1,2));
 
@@ -241,6 +260,8 @@ ssize_t		fr_radius_decode_tlv(TALLOC_CTX *ctx, fr_pair_list_t *list,
 ssize_t		fr_radius_decode_pair(TALLOC_CTX *ctx, fr_pair_list_t *list,
 				      uint8_t const *data, size_t data_len, fr_radius_decode_ctx_t *packet_ctx) CC_HINT(nonnull);
 
+bool		fr_radius_decode_pair_deferrable(uint8_t const *data) CC_HINT(nonnull);
+
 ssize_t		fr_radius_decode_foreign(TALLOC_CTX *ctx, fr_pair_list_t *out,
 					 uint8_t const *data, size_t data_len) CC_HINT(nonnull);
 
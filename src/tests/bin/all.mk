@@ -26,6 +26,13 @@ FILES	:= \
 #	unit_test_map 		\
 #	unit_test_module
 
+#
+#  These require pthread, see src/tests/util/all.mk
+#
+ifneq "$(findstring thread,${CFLAGS})" ""
+FILES += channel_test control_test
+endif
+
 #
 #  Add in all of the binary tests
 #
@@ -36,6 +43,8 @@ $(eval $(call TEST_BOOTSTRAP))
 #
 #  Some tests take arguments, others do not.
 #
+channel_test.ARGS = -m 200000 -o 100 -s 0.5
+control_test.ARGS = -m 40480
 radclient.ARGS = -h
 radict.ARGS = -D $(top_srcdir)/share/dictionary User-Name
 radmin.ARGS = -h
@@ -0,0 +1,17 @@
+#
+#  Test the "memcached_async" cache driver
+#
+cache_memcached_async.test:
+
+# Don't test memcached_async if CACHE_MEMCACHED_ASYNC_TEST_SERVER ENV is not set
+cache_memcached_async_require_test_server := 1
+
+#
+#  Start a memcached on localhost, and run the tests against it.
+#
+#	make test.modules.cache_memcached_async.local
+#
+.PHONY: test.modules.cache_memcached_async.local
+test.modules.cache_memcached_async.local:
+	${Q}scripts/ci/memcached-setup.sh
+	${Q}$(MAKE) CACHE_MEMCACHED_ASYNC_TEST_SERVER=127.0.0.1 test.modules.cache_memcached_async
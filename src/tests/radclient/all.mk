@@ -31,6 +31,7 @@ include src/tests/radiusd.mk
 $(eval $(call RADIUSD_SERVICE,radiusd,$(OUTPUT)))
 
 $(OUTPUT)/auth_proxy.txt: $(BUILD_DIR)/lib/local/rlm_radius.la
+$(OUTPUT)/auth_proxy_ma.txt: $(BUILD_DIR)/lib/local/rlm_radius.la
 
 define RADCLIENT_TEST
 test.radclient.$(basename ${1}): $(addprefix $(OUTPUT)/,${1})
@@ -68,6 +68,22 @@ test.unit.help: TEST_UNIT_HELP += test.unit.xlat
 #  This is useful, too
 test.unit.condition: $(addprefix $(OUTPUT)/,$(filter condition/%.txt,$(FILES))) $(BUILD_DIR)/lib/libfreeradius-server.la
 
+#
+#  Decode throughput benchmark over the protocol test vectors.
+#
+#	make test.unit.benchmark [BENCHMARK_ITERATIONS=n] [BENCHMARK_FLAGS=-u]
+#
+#  Pass BENCHMARK_FLAGS=-u to benchmark without compiled dictionaries.
+#
+BENCHMARK_ITERATIONS ?= 1000
+BENCHMARK_FILES := $(addprefix $(DIR)/,$(filter protocols/%.txt,$(FILES)))
+
+.PHONY: test.unit.benchmark
+test.unit.benchmark: $(TEST_BIN_DIR)/unit_test_attribute
+	${Q}TZ=GMT $(TEST_BIN)/unit_test_attribute -b $(BENCHMARK_ITERATIONS) $(BENCHMARK_FLAGS) -D ./share/dictionary -d ${top_srcdir}/src/tests/unit $(BENCHMARK_FILES)
+
+test.unit.help: TEST_UNIT_HELP += test.unit.benchmark
+
 #
 #  Add special command-line flag for purify tests.
 #
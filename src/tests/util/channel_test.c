@@ -33,32 +33,33 @@ RCSID("$Id$")
 #endif
 
 #include <pthread.h>
-#include <sys/event.h>
 
 #define MAX_MESSAGES		(2048)
 #define MAX_CONTROL_PLANE	(1024)
-#define MAX_KEVENTS		(10)
+#define MAX_OUTSTANDING		(1024)
 
 #define MPRINT1 if (debug_lvl) printf
 #define MPRINT2 if (debug_lvl > 1) printf
 
 static int			debug_lvl = 0;
-static int			kq_master, kq_worker;
+static fr_event_list_t		*el_master, *el_worker;
 static fr_atomic_queue_t	*aq_master, *aq_worker;
 static fr_control_t		*control_master, *control_worker;
 static int			max_messages = 10;
 static int			max_control_plane = 0;
 static int			max_outstanding = 1;
 static bool			touch_memory = false;
+static double			max_worker_signals = 0;
+
+/*
+ *	Signals and wakeups seen by each end.
+ */
+static uint64_t			master_signals, master_wakeups;
+static uint64_t			worker_signals, worker_wakeups;
 
 /**********************************************************************/
 typedef struct request_s request_t;
 
-request_t *request_alloc(UNUSED TALLOC_CTX *ctx, UNUSED request_init_args_t const *args)
-{
-	return NULL;
-}
-
 void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t const *request)
 {
 }
@@ -71,24 +72,92 @@ static NEVER_RETURNS void usage(void)
 	fprintf(stderr, "  -c <control-plane>     Size of the control plane queue.\n");
 	fprintf(stderr, "  -m <messages>	  Send number of messages.\n");
 	fprintf(stderr, "  -o <outstanding>       Keep number of messages outstanding.\n");
+	fprintf(stderr, "  -s <signals>           Fail if there are more signals to the worker per message.\n");
 	fprintf(stderr, "  -t                     Touch memory for fake packets.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
 	fr_exit_now(EXIT_FAILURE);
 }
 
-static void *channel_master(void *arg)
+static void touch(fr_channel_data_t *cd)
 {
-	bool			running, signaled_close;
-	int			rcode, i, num_events;
-	int			num_outstanding, num_messages;
+	size_t j, k;
+
+	for (j = k = 0; j < cd->m.data_size; j++) {
+		k += cd->m.data[j];
+	}
+
+	cd->m.data[4] = k;
+}
+
+typedef struct {
+	bool			running;
+	bool			signaled_close;
+	int			num_outstanding;
+	int			num_messages;
 	int			num_replies;
+} master_t;
+
+static void master_recv_reply(void *ctx, UNUSED fr_channel_t *ch, fr_channel_data_t *cd)
+{
+	master_t *master = ctx;
+
+	master->num_replies++;
+	master->num_outstanding--;
+	MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
+		master->num_replies, master->num_outstanding, master->num_messages, max_messages);
+	fr_message_done(&cd->m);
+}
+
+static void master_control(void *ctx, void const *data, size_t data_size, fr_time_t now)
+{
+	master_t		*master = ctx;
+	fr_channel_t		*ch;
+	fr_channel_event_t	ce;
+
+	master_signals++;
+
+	ce = fr_channel_service_message(now, &ch, data, data_size);
+	MPRINT1("Master got channel event %d\n", ce);
+
+	switch (ce) {
+	case FR_CHANNEL_DATA_READY_REQUESTOR:
+		MPRINT1("Master got data ready signal\n");
+		if (!fr_channel_recv_reply(ch)) {
+			MPRINT1("Master SIGNAL WITH NO DATA!\n");
+			break;
+		}
+		while (fr_channel_recv_reply(ch));
+		break;
+
+	case FR_CHANNEL_CLOSE:
+		MPRINT1("Master received close signal\n");
+		fr_assert(master->signaled_close == true);
+		master->running = false;
+		break;
+
+	case FR_CHANNEL_NOOP:
+		MPRINT1("Master got NOOP\n");
+		break;
+
+	default:
+		fprintf(stderr, "Master got unexpected CE %d\n", ce);
+
+		/*
+		 *	Not written yet!
+		 */
+		fr_assert(0 == 1);
+		break;
+	}
+}
+
+static void *channel_master(void *arg)
+{
+	int			rcode, i;
 	fr_message_set_t	*ms;
 	TALLOC_CTX		*ctx;
 	fr_channel_t		*channel = arg;
-	fr_channel_t		*new_channel;
-	fr_channel_event_t	ce;
-	struct kevent		events[MAX_KEVENTS];
+	master_t		master = { .running = true };
 
 	MEM(ctx = talloc_init_const("channel_master"));
 
@@ -98,6 +167,12 @@ static void *channel_master(void *arg)
 		fr_exit_now(EXIT_FAILURE);
 	}
 
+	fr_channel_set_recv_reply(channel, &master, master_recv_reply);
+	if (fr_control_callback_add(control_master, FR_CONTROL_ID_CHANNEL, &master, master_control) < 0) {
+		fr_perror("channel_test");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
 	MPRINT1("Master started.\n");
 
 	/*
@@ -109,43 +184,21 @@ static void *channel_master(void *arg)
 		fr_exit_now(EXIT_FAILURE);
 	}
 
-	/*
-	 *	Bootstrap the queue with messages.
-	 */
-	num_replies = num_outstanding = num_messages = 0;
-
-	running = true;
-	signaled_close = false;
-
-	while (running) {
-		fr_time_t now;
-		int num_to_send;
-		fr_channel_data_t *cd, *reply;
-
-#if 0
-		/*
-		 *	Drain the input queues before sleeping.
-		 */
-		while ((reply = fr_channel_recv_reply(channel)) != NULL) {
-			num_replies++;
-			num_outstanding--;
-			MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
-				num_replies, num_outstanding, num_messages, max_messages);
-			fr_message_done(&reply->m);
-		}
-#endif
+	while (master.running) {
+		int num_to_send, num_events;
+		fr_channel_data_t *cd;
 
 		/*
 		 *	Ensure we have outstanding messages.
 		 */
-		if (num_messages >= max_messages) {
+		if (master.num_messages >= max_messages) {
 			MPRINT1("Master DONE sending\n");
 			goto check_close;
 		}
 
-		num_to_send = max_outstanding - num_outstanding;
-		if ((num_messages + num_to_send) > max_messages) {
-			num_to_send = max_messages - num_messages;
+		num_to_send = max_outstanding - master.num_outstanding;
+		if ((master.num_messages + num_to_send) > max_messages) {
+			num_to_send = max_messages - master.num_messages;
 		}
 		MPRINT1("Master sending %d messages\n", num_to_send);
 
@@ -153,44 +206,28 @@ static void *channel_master(void *arg)
 			cd = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
 			fr_assert(cd != NULL);
 
-			num_outstanding++;
-			num_messages++;
+			master.num_outstanding++;
+			master.num_messages++;
 
 			cd->m.when = fr_time();
 
-			if (touch_memory) {
-				size_t j, k;
+			if (touch_memory) touch(cd);
 
-				for (j = k = 0; j < cd->m.data_size; j++) {
-					k += cd->m.data[j];
-				}
+			memcpy(cd->m.data, &master.num_messages, sizeof(master.num_messages));
 
-				cd->m.data[4] = k;
-			}
-
-			memcpy(cd->m.data, &num_messages, sizeof(num_messages));
-
-			MPRINT1("Master sent message %d\n", num_messages);
-			rcode = fr_channel_send_request(channel, cd, &reply);
+			MPRINT1("Master sent message %d\n", master.num_messages);
+			rcode = fr_channel_send_request(channel, cd);
 			if (rcode < 0) {
 				fprintf(stderr, "Failed sending request: %s\n", fr_syserror(errno));
 			}
 			fr_assert(rcode == 0);
-			if (reply) {
-				num_replies++;
-				num_outstanding--;
-				MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
-					num_replies, num_outstanding, num_messages, max_messages);
-				fr_message_done(&reply->m);
-			}
 		}
 
 		/*
 		 *	Signal close only when done.
 		 */
 check_close:
-
-		if (!signaled_close && (num_messages >= max_messages) && (num_outstanding == 0)) {
+		if (!master.signaled_close && (master.num_messages >= max_messages) && (master.num_outstanding == 0)) {
 			MPRINT1("Master signaling worker to exit.\n");
 			rcode = fr_channel_signal_responder_close(channel);
 			if (rcode < 0) {
@@ -198,89 +235,24 @@ check_close:
 				fr_exit_now(EXIT_FAILURE);
 			}
 
-			signaled_close = true;
+			master.signaled_close = true;
 		}
 
 		MPRINT1("Master waiting on events.\n");
-		fr_assert(num_messages <= max_messages);
+		fr_assert(master.num_messages <= max_messages);
 
-		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("Master kevent returned %d\n", num_events);
+		num_events = fr_event_corral(el_master, fr_time(), true);
+		MPRINT1("Master corral returned %d\n", num_events);
 
 		if (num_events < 0) {
-			if (num_events == EINTR) continue;
-
-			fprintf(stderr, "Failed waiting for kevent: %s\n", fr_syserror(errno));
+			fr_perror("Failed waiting for events");
 			fr_exit_now(EXIT_FAILURE);
 		}
 
 		if (num_events == 0) continue;
 
-		/*
-		 *	Service the events.
-		 */
-		for (i = 0; i < num_events; i++) {
-			(void) fr_channel_service_kevent(channel, control_master, &events[i]);
-		}
-
-		now = fr_time();
-
-		MPRINT1("Master servicing control-plane aq %p\n", aq_master);
-
-		while (true) {
-			uint32_t id;
-			size_t data_size;
-			char data[256];
-
-			data_size = fr_control_message_pop(aq_master, &id, data, sizeof(data));
-			if (!data_size) break;
-
-			fr_assert(id == FR_CONTROL_ID_CHANNEL);
-
-			ce = fr_channel_service_message(now, &new_channel, data, data_size);
-			MPRINT1("Master got channel event %d\n", ce);
-
-			switch (ce) {
-			case FR_CHANNEL_DATA_READY_REQUESTOR:
-				MPRINT1("Master got data ready signal\n");
-				fr_assert(new_channel == channel);
-
-				reply = fr_channel_recv_reply(channel);
-				if (!reply) {
-					MPRINT1("Master SIGNAL WITH NO DATA!\n");
-					continue;
-				}
-
-				do {
-					num_replies++;
-					num_outstanding--;
-					MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
-						num_replies, num_outstanding, num_messages, max_messages);
-					fr_message_done(&reply->m);
-				} while ((reply = fr_channel_recv_reply(channel)) != NULL);
-				break;
-
-			case FR_CHANNEL_CLOSE:
-				MPRINT1("Master received close signal\n");
-				fr_assert(new_channel == channel);
-				fr_assert(signaled_close == true);
-				running = false;
-				break;
-
-			case FR_CHANNEL_NOOP:
-				MPRINT1("Master got NOOP\n");
-				break;
-
-			default:
-				fprintf(stderr, "Master got unexpected CE %d\n", ce);
-
-				/*
-				 *	Not written yet!
-				 */
-				fr_assert(0 == 1);
-				break;
-			} /* switch over signal returned */
-		} /* drain the control plane */
+		master_wakeups++;
+		fr_event_service(el_master);
 	} /* loop until told to exit */
 
 	MPRINT1("Master exiting.\n");
@@ -305,157 +277,167 @@ check_close:
 	return NULL;
 }
 
-static void *channel_worker(void *arg)
-{
-	bool running = true;
-	int rcode, num_events;
-	int worker_messages = 0;
-	fr_message_set_t *ms;
-	TALLOC_CTX *ctx;
-	fr_channel_t *channel = arg;
-	fr_channel_event_t ce;
-	struct kevent events[MAX_KEVENTS];
-
-	MEM(ctx = talloc_init_const("channel_worker"));
+typedef struct {
+	bool			running;
+	int			worker_messages;
+	fr_message_set_t	*ms;
 
-	ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
-	if (!ms) {
-		fprintf(stderr, "Failed creating message set\n");
-		fr_exit_now(EXIT_FAILURE);
-	}
+	int			num_pending;
+	fr_channel_data_t	*pending[MAX_OUTSTANDING];	//!< requests we've read, but not replied to
+} worker_t;
 
-	MPRINT1("\tWorker started.\n");
+/*
+ *	Like the real worker, we only queue the request here.  Replying
+ *	from inside of this callback would recurse into the channel.
+ */
+static void worker_recv_request(void *ctx, UNUSED fr_channel_t *ch, fr_channel_data_t *cd)
+{
+	worker_t *worker = ctx;
 
-	while (running) {
-		int i;
-		fr_time_t now;
-		fr_channel_t *new_channel;
+	fr_assert(worker->num_pending < MAX_OUTSTANDING);
+	worker->pending[worker->num_pending++] = cd;
+}
 
-		MPRINT1("\tWorker waiting on events.\n");
+static void worker_reply(worker_t *worker, fr_channel_t *channel)
+{
+	int rcode;
 
-		num_events = kevent(kq_worker, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("\tWorker kevent returned %d events\n", num_events);
+	while (worker->num_pending > 0) {
+		int message_id;
+		fr_channel_data_t *cd, *reply;
 
-		if (num_events < 0) {
-			if (errno == EINTR) continue;
+		cd = worker->pending[--worker->num_pending];
+		worker->worker_messages++;
 
-			fprintf(stderr, "Failed waiting for kevent: %s\n", fr_syserror(errno));
-			fr_exit_now(EXIT_FAILURE);
-		}
-
-		if (num_events == 0) continue;
+		fr_assert(cd->m.data != NULL);
+		memcpy(&message_id, cd->m.data, sizeof(message_id));
+		MPRINT1("\tWorker got message %d (says %d)\n", worker->worker_messages, message_id);
 
-		for (i = 0; i < num_events; i++) {
-			(void) fr_channel_service_kevent(channel, control_worker, &events[i]);
-		}
+		reply = (fr_channel_data_t *) fr_message_alloc(worker->ms, NULL, 100);
+		fr_assert(reply != NULL);
 
-		MPRINT1("\tWorker servicing control-plane aq %p\n", aq_worker);
+		reply->m.when = fr_time();
+		reply->reply.cpu_time = fr_time_delta_wrap(0);
+		reply->reply.processing_time = fr_time_delta_wrap(0);
+		reply->reply.request_time = cd->m.when;
+		fr_message_done(&cd->m);
 
-		now = fr_time();
+		if (touch_memory) touch(reply);
 
-		while (true) {
-			uint32_t id;
-			size_t data_size;
-			char data[256];
-			fr_channel_data_t *cd, *reply;
+		MPRINT1("\tWorker sending reply to messages %d\n", worker->worker_messages);
+		rcode = fr_channel_send_reply(channel, reply);
+		if (rcode < 0) {
+			fprintf(stderr, "Failed sending reply: %s\n", fr_syserror(errno));
+		}
+		fr_assert(rcode == 0);
+	}
+}
 
-			data_size = fr_control_message_pop(aq_worker, &id, data, sizeof(data));
-			if (!data_size) break;
+static void worker_control(void *ctx, void const *data, size_t data_size, fr_time_t now)
+{
+	worker_t		*worker = ctx;
+	fr_channel_t		*ch;
+	fr_channel_event_t	ce;
 
-			fr_assert(id == FR_CONTROL_ID_CHANNEL);
+	worker_signals++;
 
-			ce = fr_channel_service_message(now, &new_channel, data, data_size);
-			MPRINT1("\tWorker got channel event %d\n", ce);
+	ce = fr_channel_service_message(now, &ch, data, data_size);
+	MPRINT1("\tWorker got channel event %d\n", ce);
 
-			switch (ce) {
+	switch (ce) {
+	case FR_CHANNEL_OPEN:
+		MPRINT1("\tWorker received a new channel\n");
+		break;
 
-			case FR_CHANNEL_OPEN:
-				MPRINT1("\tWorker received a new channel\n");
-				fr_assert(new_channel == channel);
-				break;
+	case FR_CHANNEL_CLOSE:
+		MPRINT1("\tWorker requested to close the channel.\n");
+		worker->running = false;
 
-			case FR_CHANNEL_CLOSE:
-				MPRINT1("\tWorker requested to close the channel.\n");
-				fr_assert(new_channel == channel);
-				running = false;
+		/*
+		 *	Drain the input before we ACK the exit.
+		 */
+		while (fr_channel_recv_request(ch));
+		while (worker->num_pending > 0) {
+			fr_message_done(&worker->pending[--worker->num_pending]->m);
+			worker->worker_messages++;
+		}
 
-				/*
-				 *	Drain the input before we ACK the exit.
-				 */
-				while ((cd = fr_channel_recv_request(channel)) != NULL) {
-					worker_messages++;
-					MPRINT1("\tWorker got message %d\n", worker_messages);
-					fr_message_done(&cd->m);
-				}
+		(void) fr_channel_responder_ack_close(ch);
+		break;
 
-				(void) fr_channel_responder_ack_close(channel);
-				break;
+	case FR_CHANNEL_DATA_READY_RESPONDER:
+		MPRINT1("\tWorker got data ready signal\n");
 
-			case FR_CHANNEL_DATA_READY_RESPONDER:
-				MPRINT1("\tWorker got data ready signal\n");
-				fr_assert(new_channel == channel);
+		if (!fr_channel_recv_request(ch)) {
+			MPRINT1("\tWorker SIGNAL WITH NO DATA!\n");
+			break;
+		}
+		while (fr_channel_recv_request(ch));
 
-				cd = fr_channel_recv_request(channel);
-				if (!cd) {
-					MPRINT1("\tWorker SIGNAL WITH NO DATA!\n");
-					break;
-				}
+		worker_reply(worker, ch);
+		break;
 
-				while (cd) {
-					int message_id;
+	case FR_CHANNEL_NOOP:
+		MPRINT1("\tWorker got NOOP\n");
+		break;
 
-					worker_messages++;
+	default:
+		fprintf(stderr, "\tWorker got unexpected CE %d\n", ce);
 
-					fr_assert(cd->m.data != NULL);
-					memcpy(&message_id, cd->m.data, sizeof(message_id));
-					MPRINT1("\tWorker got message %d (says %d)\n", worker_messages, message_id);
+		/*
+		 *	Not written yet!
+		 */
+		fr_assert(0 == 1);
+		break;
+	}
+}
 
-					reply = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
-					fr_assert(reply != NULL);
+static void *channel_worker(void *arg)
+{
+	int rcode, num_events;
+	TALLOC_CTX *ctx;
+	fr_channel_t *channel = arg;
+	worker_t *worker;
 
-					reply->m.when = fr_time();
-					fr_message_done(&cd->m);
+	MEM(ctx = talloc_init_const("channel_worker"));
+	MEM(worker = talloc_zero(ctx, worker_t));
+	worker->running = true;
 
-					if (touch_memory) {
-						size_t j, k;
+	worker->ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
+	if (!worker->ms) {
+		fprintf(stderr, "Failed creating message set\n");
+		fr_exit_now(EXIT_FAILURE);
+	}
 
-						for (j = k = 0; j < reply->m.data_size; j++) {
-							k += reply->m.data[j];
-						}
+	fr_channel_set_recv_request(channel, worker, worker_recv_request);
+	if (fr_control_callback_add(control_worker, FR_CONTROL_ID_CHANNEL, worker, worker_control) < 0) {
+		fr_perror("channel_test");
+		fr_exit_now(EXIT_FAILURE);
+	}
 
-						reply->m.data[4] = k;
-					}
+	MPRINT1("\tWorker started.\n");
 
+	while (worker->running) {
+		/*
+		 *	Tell the master that we're about to sleep.  It
+		 *	won't signal us for new requests until we do.
+		 */
+		(void) fr_channel_responder_sleeping(channel);
 
-					MPRINT1("\tWorker sending reply to messages %d\n", worker_messages);
-					rcode = fr_channel_send_reply(channel, reply, &cd);
-					if (rcode < 0) {
-						fprintf(stderr, "Failed sending reply: %s\n", fr_syserror(errno));
-					}
-					fr_assert(rcode == 0);
-				}
-				break;
+		MPRINT1("\tWorker waiting on events.\n");
 
-			case FR_CHANNEL_NOOP:
-				MPRINT1("\tWorker got NOOP\n");
-				fr_assert(new_channel == channel);
-				break;
+		num_events = fr_event_corral(el_worker, fr_time(), true);
+		MPRINT1("\tWorker corral returned %d events\n", num_events);
 
-			default:
-				fprintf(stderr, "\tWorker got unexpected CE %d\n", ce);
+		if (num_events < 0) {
+			fr_perror("Failed waiting for events");
+			fr_exit_now(EXIT_FAILURE);
+		}
 
-				/*
-				 *	Not written yet!
-				 */
-				fr_assert(0 == 1);
-				break;
-			} /* switch over signals */
+		if (num_events == 0) continue;
 
-			/*
-			 *	Get a new idea of "now".
-			 */
-			now = fr_time();
-		} /* drain the control plane */
+		worker_wakeups++;
+		fr_event_service(el_worker);
 	}
 
 	MPRINT1("\tWorker exiting.\n");
@@ -464,14 +446,14 @@ static void *channel_worker(void *arg)
 	 *	Force all messages to be garbage collected
 	 */
 	MPRINT2("Worker GC\n");
-	fr_message_set_gc(ms);
+	fr_message_set_gc(worker->ms);
 
-	if (debug_lvl > 1) fr_message_set_debug(ms, stdout);
+	if (debug_lvl > 1) fr_message_set_debug(worker->ms, stdout);
 
 	/*
 	 *	After the garbage collection, all messages marked "done" MUST also be marked "free".
 	 */
-	rcode = fr_message_set_messages_used(ms);
+	rcode = fr_message_set_messages_used(worker->ms);
 	fr_cond_assert(rcode == 0);
 
 	talloc_free(ctx);
@@ -491,7 +473,7 @@ int main(int argc, char *argv[])
 
 	fr_time_start();
 
-	while ((c = getopt(argc, argv, "c:hm:o:tx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "c:hm:o:s:tx")) != -1) switch (c) {
 		case 'x':
 			debug_lvl++;
 			break;
@@ -508,6 +490,10 @@ int main(int argc, char *argv[])
 			max_outstanding = atoi(optarg);
 			break;
 
+		case 's':
+			max_worker_signals = atof(optarg);
+			break;
+
 		case 't':
 			touch_memory = true;
 			break;
@@ -518,6 +504,7 @@ int main(int argc, char *argv[])
 	}
 
 	if (max_outstanding > max_messages) max_outstanding = max_messages;
+	if (max_outstanding > MAX_OUTSTANDING) max_outstanding = MAX_OUTSTANDING;
 
 	if (!max_control_plane) {
 		max_control_plane = MAX_CONTROL_PLANE;
@@ -529,11 +516,11 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	kq_master = kqueue();
-	fr_assert(kq_master >= 0);
+	el_master = fr_event_list_alloc(autofree, NULL, NULL);
+	fr_assert(el_master != NULL);
 
-	kq_worker = kqueue();
-	fr_assert(kq_worker >= 0);
+	el_worker = fr_event_list_alloc(autofree, NULL, NULL);
+	fr_assert(el_worker != NULL);
 
 	aq_master = fr_atomic_queue_alloc(autofree, max_control_plane);
 	fr_assert(aq_master != NULL);
@@ -541,10 +528,10 @@ int main(int argc, char *argv[])
 	aq_worker = fr_atomic_queue_alloc(autofree, max_control_plane);
 	fr_assert(aq_worker != NULL);
 
-	control_master = fr_control_create(autofree, kq_master, aq_master, 1024);
+	control_master = fr_control_create(autofree, el_master, aq_master);
 	fr_assert(control_master != NULL);
 
-	control_worker = fr_control_create(autofree, kq_worker, aq_worker, 1025);
+	control_worker = fr_control_create(autofree, el_worker, aq_worker);
 	fr_assert(control_worker != NULL);
 
 	channel = fr_channel_create(autofree, control_master, control_worker, false);
@@ -565,10 +552,27 @@ int main(int argc, char *argv[])
 	(void) pthread_join(master_id, NULL);
 	(void) pthread_join(worker_id, NULL);
 
-	close(kq_master);
-	close(kq_worker);
+	/*
+	 *	The open and close signals are included, so the
+	 *	minimum is a little over zero per message.
+	 */
+	printf("messages %d\n", max_messages);
+	printf("signals to worker %" PRIu64 " (%.3f per message), wakeups %" PRIu64 "\n",
+	       worker_signals, (double) worker_signals / max_messages, worker_wakeups);
+	printf("signals to master %" PRIu64 " (%.3f per message), wakeups %" PRIu64 "\n",
+	       master_signals, (double) master_signals / max_messages, master_wakeups);
+
+	if (debug_lvl) fr_channel_stats_log(channel, &default_log, __FILE__, __LINE__);
+	fflush(stdout);
 
-	fr_channel_debug(channel, stdout);
+	/*
+	 *	With requests outstanding, the worker is usually
+	 *	awake, so most requests shouldn't signal it.
+	 */
+	if ((max_worker_signals > 0) && (((double) worker_signals / max_messages) > max_worker_signals)) {
+		fprintf(stderr, "channel_test: More than %.3f signals to worker per message\n", max_worker_signals);
+		fr_exit_now(EXIT_FAILURE);
+	}
 
 	fr_exit_now(EXIT_SUCCESS);
 }
@@ -28,7 +28,6 @@ RCSID("$Id$")
 #include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/time.h>
 
-#include <sys/event.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
@@ -43,28 +42,18 @@ RCSID("$Id$")
 #define CONTROL_MAGIC 0xabcd6809
 
 static int		debug_lvl = 0;
-static int		kq = -1;
+static fr_event_list_t	*el;
 static fr_atomic_queue_t *aq;
 static size_t		max_messages = 10;
 static int		aq_size = 16;
 static fr_control_t	*control = NULL;
 static fr_ring_buffer_t *rb = NULL;
 
-/**********************************************************************/
-typedef struct request_s request_t;
-request_t *request_alloc(UNUSED TALLOC_CTX *ctx, UNUSED request_init_args_t const *args);
-void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *request);
-
-request_t *request_alloc(UNUSED TALLOC_CTX *ctx, UNUSED request_init_args_t const *args)
-{
-	return NULL;
-}
-
-void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *request)
-{
-}
-
-/**********************************************************************/
+/*
+ *	Messages and wakeups seen by the master.
+ */
+static size_t		master_messages;
+static uint64_t		master_wakeups;
 
 static NEVER_RETURNS void usage(void)
 {
@@ -80,6 +69,26 @@ typedef struct {
 	size_t			counter;
 } my_message_t;
 
+static void master_control(UNUSED void *ctx, void const *data, size_t data_size, UNUSED fr_time_t now)
+{
+	my_message_t const *m = data;
+
+	fr_assert(data_size == sizeof(*m));
+	fr_assert(m->header == CONTROL_MAGIC);
+
+	MPRINT1("Master got message %zu.\n", m->counter);
+
+	/*
+	 *	There's only one sender, so messages
+	 *	must arrive in the order they were sent.
+	 */
+	if (m->counter != master_messages) {
+		fprintf(stderr, "Expected message %zu, got %zu\n", master_messages, m->counter);
+		fr_exit_now(EXIT_FAILURE);
+	}
+	master_messages++;
+}
+
 static void *control_master(UNUSED void *arg)
 {
 	TALLOC_CTX *ctx;
@@ -89,48 +98,27 @@ static void *control_master(UNUSED void *arg)
 	MPRINT1("Master started.\n");
 
 	/*
-	 *	Busy loop.  We're stupid.
+	 *	The control plane drains the queue each time
+	 *	it's woken up, and calls master_control() for
+	 *	each message.
 	 */
-	while (true) {
+	while (master_messages < max_messages) {
 		int num_events;
-		ssize_t data_size;
-		my_message_t m;
-		struct kevent kev;
 
-	wait_for_events:
 		MPRINT1("Master waiting for events.\n");
 
-		num_events = kevent(kq, NULL, 0, &kev, 1, NULL);
+		num_events = fr_event_corral(el, fr_time(), true);
 		if (num_events < 0) {
-			fprintf(stderr, "Failed reading kevent: %s\n", fr_syserror(errno));
+			fr_perror("Failed waiting for events");
 			fr_exit_now(EXIT_FAILURE);
 		}
 
-		MPRINT1("Master draining the control plane.\n");
-
-		while (true) {
-			uint32_t id;
-
-			data_size = fr_control_message_pop(aq, &id, &m, sizeof(m));
-			if (data_size == 0) goto wait_for_events;
-
-			if (data_size < 0) {
-				fprintf(stderr, "Failed reading control message\n");
-				fr_exit_now(EXIT_FAILURE);
-			}
-
-			fr_assert(data_size == sizeof(m));
-			fr_assert(id == FR_CONTROL_ID_CHANNEL);
+		if (num_events == 0) continue;
 
-			MPRINT1("Master got message %zu.\n", m.counter);
-
-			fr_assert(m.header == CONTROL_MAGIC);
-
-			if (m.counter == (max_messages - 1)) goto do_exit;
-		}
+		master_wakeups++;
+		fr_event_service(el);
 	}
 
-do_exit:
 	MPRINT1("Master exiting.\n");
 
 	talloc_free(ctx);
@@ -200,15 +188,20 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	kq = kqueue();
-	fr_assert(kq >= 0);
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	fr_assert(el != NULL);
 
 	aq = fr_atomic_queue_alloc(autofree, aq_size);
 	fr_assert(aq != NULL);
 
-	control = fr_control_create(autofree, kq, aq, 1024);
+	control = fr_control_create(autofree, el, aq);
 	if (!control) {
-		fprintf(stderr, "control_test: Failed to create control plane\n");
+		fr_perror("control_test: Failed to create control plane");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_control_callback_add(control, FR_CONTROL_ID_CHANNEL, NULL, master_control) < 0) {
+		fr_perror("control_test: Failed adding control callback");
 		fr_exit_now(EXIT_FAILURE);
 	}
 
@@ -227,7 +220,14 @@ int main(int argc, char *argv[])
 	(void) pthread_join(master_id, NULL);
 	(void) pthread_join(worker_id, NULL);
 
-	close(kq);
+	/*
+	 *	Senders only signal the first time after the
+	 *	master drains the queue, so there should be
+	 *	fewer wakeups than messages.
+	 */
+	printf("messages %zu, wakeups %" PRIu64 " (%.3f per message)\n",
+	       master_messages, master_wakeups, (double) master_wakeups / max_messages);
+	fflush(stdout);
 
 	fr_exit_now(EXIT_SUCCESS);
 }